@@ -18,6 +18,21 @@ bool force_cmdlist = true;
 module_param(force_cmdlist, bool, 0600);
 MODULE_PARM_DESC(force_cmdlist, "Force use command list (Default true)");
 
+static uint max_coalesce_cmds = CTX_MAX_CMDS;
+module_param(max_coalesce_cmds, uint, 0600);
+MODULE_PARM_DESC(max_coalesce_cmds,
+		 "Max queued commands of a context sent to device at once (Default 4, <= 1 disable)");
+
+static uint coalesce_budget_us;
+module_param(coalesce_budget_us, uint, 0600);
+MODULE_PARM_DESC(coalesce_budget_us,
+		 "Max estimated execution time of coalesced commands in us (Default 0, no limit)");
+
+static bool direct_submit = true;
+module_param(direct_submit, bool, 0600);
+MODULE_PARM_DESC(direct_submit,
+		 "Send command to idle context from submitter, not DRM scheduler (Default true)");
+
 static void aie2_job_release(struct kref *ref)
 {
 	struct amdxdna_sched_job *job;
@@ -29,7 +44,7 @@ static void aie2_job_release(struct kref *ref)
 	if (job->out_fence)
 		dma_fence_put(job->out_fence);
 
-	kfree(job);
+	amdxdna_sched_job_free(job);
 
 	atomic64_inc(&ctx->job_free_cnt);
 	wake_up(&ctx->priv->job_free_waitq);
@@ -104,10 +119,10 @@ void aie2_dump_ctx(struct amdxdna_ctx *ctx)
 	amdxdna_mgmt_buff_free(dma_hdl);
 
 	mutex_lock(&ctx->priv->io_lock);
-	for (int i = 0; i < CTX_MAX_CMDS; i++) {
+	for (int i = 0; i < ctx->priv->depth; i++) {
 		struct amdxdna_sched_job *j;
 
-		j = ctx->priv->pending[i];
+		j = READ_ONCE(ctx->priv->pending[i].job);
 		if (!j)
 			continue;
 		XDNA_ERR(xdna, "JOB[%d]:", i);
@@ -144,7 +159,8 @@ void aie2_ctx_disconnect(struct amdxdna_ctx *ctx, bool wait)
 	if (wait)
 		aie2_ctx_wait_for_idle(ctx);
 	mutex_lock(&xdna->dev_handle->aie2_lock);
-	aie2_hwctx_stop(ctx);
+	/* Nothing left for the scheduler to run, it can be kept */
+	aie2_hwctx_stop(ctx, wait && ctx->submitted == ctx->completed);
 	ctx->priv->disconn_cnt++;
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 }
@@ -158,6 +174,7 @@ int aie2_ctx_connect(struct amdxdna_ctx *ctx)
 	ret = aie2_hwctx_start(ctx);
 	if (ret)
 		goto unlock_and_err;
+	ctx->priv->conn_cnt++;
 
 #ifdef AMDXDNA_DEVEL
 	if (priv_load) {
@@ -181,7 +198,7 @@ skip_config_cu:
 	return 0;
 
 failed:
-	aie2_hwctx_stop(ctx);
+	aie2_hwctx_stop(ctx, false);
 unlock_and_err:
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 	return ret;
@@ -209,38 +226,83 @@ aie2_ctx_cmd_health_data(struct amdxdna_ctx *ctx, struct amdxdna_gem_obj *cmd_ab
 	amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_TIMEOUT);
 }
 
-static void
-reset_tdr_timer(struct amdxdna_sched_job *job)
-{
-	struct amdxdna_ctx *ctx = job->ctx;
-	struct amdxdna_dev_hdl *ndev = ctx->client->xdna->dev_handle;
-
-	WRITE_ONCE(ndev->tdr.status, AIE2_TDR_SIGNALED);
-}
-
 static void
 aie2_sched_notify(struct amdxdna_sched_job *job)
 {
 	struct amdxdna_ctx *ctx = job->ctx;
 	struct dma_fence *fence = job->fence;
-	int idx;
 
 	amdxdna_pm_suspend_put(ctx->client->xdna);
 
 	ctx->completed++;
-	reset_tdr_timer(job);
+	if (job->opcode == OP_USER) {
+		aie2_rq_account(ctx, job->run_time);
+		if (job->deadline)
+			aie2_rq_deadline_done(ctx, job->deadline);
+	}
 	trace_xdna_job(&job->base, ctx->name, "signaling fence", job->seq, job->opcode);
 	job->job_done = true;
 	dma_fence_signal(fence);
 	aie2_rq_yield(ctx);
-	idx = get_job_idx(job->seq);
-	ctx->priv->pending[idx] = NULL;
+	aie2_job_slot_clear(ctx->priv, job->seq);
 	up(&job->ctx->priv->job_sem);
 	dma_fence_put(fence);
 	mmput_async(job->mm);
 	aie2_job_put(job);
 }
 
+/*
+ * Response handlers run in a mailbox pass over all responses ready. Jobs are
+ * only queued there and completed together at the end of the pass, so that
+ * the ring buffer is drained first and waiters of a context are woken up and
+ * its runqueue state is checked once per pass, not once per response.
+ */
+static void
+aie2_sched_notify_defer(struct amdxdna_sched_job *job)
+{
+	llist_add(&job->done_node, &job->ctx->priv->done_jobs);
+}
+
+/* Mailbox flush callback of context channel */
+void aie2_sched_notify_flush(void *arg)
+{
+	struct amdxdna_ctx *ctx = arg;
+	struct amdxdna_sched_job *job, *tmp;
+	struct llist_node *first;
+
+	first = llist_del_all(&ctx->priv->done_jobs);
+	if (!first)
+		return;
+	/* Jobs complete in order, llist gives them newest first */
+	first = llist_reverse_order(first);
+
+	llist_for_each_entry(job, first, done_node) {
+		amdxdna_pm_suspend_put(ctx->client->xdna);
+		ctx->completed++;
+		if (job->opcode == OP_USER) {
+			aie2_rq_account(ctx, job->run_time);
+			if (job->deadline)
+				aie2_rq_deadline_done(ctx, job->deadline);
+		}
+		trace_xdna_job(&job->base, ctx->name, "signaling fence", job->seq, job->opcode);
+		job->job_done = true;
+	}
+
+	llist_for_each_entry(job, first, done_node)
+		dma_fence_signal(job->fence);
+	aie2_rq_yield(ctx);
+
+	llist_for_each_entry_safe(job, tmp, first, done_node) {
+		struct dma_fence *fence = job->fence;
+
+		aie2_job_slot_clear(ctx->priv, job->seq);
+		up(&ctx->priv->job_sem);
+		dma_fence_put(fence);
+		mmput_async(job->mm);
+		aie2_job_put(job);
+	}
+}
+
 static int
 aie2_sched_resp_handler(void *handle, void __iomem *data, size_t size)
 {
@@ -272,7 +334,7 @@ aie2_sched_resp_handler(void *handle, void __iomem *data, size_t size)
 		amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_ERROR);
 
 out:
-	aie2_sched_notify(job);
+	aie2_sched_notify_defer(job);
 	return ret;
 }
 
@@ -296,7 +358,7 @@ aie2_sched_nocmd_resp_handler(void *handle, void __iomem *data, size_t size)
 	XDNA_DBG(job->ctx->client->xdna, "Response status 0x%x", status);
 
 out:
-	aie2_sched_notify(job);
+	aie2_sched_notify_defer(job);
 	return ret;
 }
 
@@ -387,21 +449,236 @@ aie2_sched_cmdlist_resp_handler(void *handle, void __iomem *data, size_t size)
 			cc->error_index = 0;
 	}
 out:
-	aie2_sched_notify(job);
+	aie2_sched_notify_defer(job);
+	return ret;
+}
+
+/*
+ * Demultiplex response of coalesced command list to its jobs. Jobs before the
+ * failing one are completed, jobs after it are aborted.
+ */
+static int
+aie2_sched_coalesced_resp_handler(void *handle, void __iomem *data, size_t size)
+{
+	struct amdxdna_sched_job *jobs[CTX_MAX_CMDS];
+	struct amdxdna_sched_job *job = handle;
+	struct amdxdna_ctx *ctx = job->ctx;
+	u32 cnt = job->coalesce_cnt + 1;
+	enum ert_cmd_state state;
+	u32 fail_cmd_status;
+	u32 fail_cmd_idx;
+	u32 cmd_status;
+	int ret = 0;
+	u32 i;
+
+	amdxdna_stats_account(ctx->client);
+	/* Coalesced jobs stay pending until notified */
+	jobs[0] = job;
+	for (i = 1; i < cnt; i++)
+		jobs[i] = aie2_job_slot_get(ctx->priv, job->seq + i);
+
+	if (unlikely(!data)) {
+		for (i = 0; i < cnt; i++)
+			aie2_ctx_cmd_health_data(ctx, jobs[i]->cmd_bo);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (unlikely(size != sizeof(u32) * 3)) {
+		state = ERT_CMD_STATE_ABORT;
+		fail_cmd_idx = 0;
+		ret = -EINVAL;
+		goto set_state;
+	}
+
+	cmd_status = readl(data + offsetof(struct cmd_chain_resp, status));
+	XDNA_DBG(ctx->client->xdna, "Status 0x%x", cmd_status);
+	if (cmd_status == AIE2_STATUS_SUCCESS) {
+		for (i = 0; i < cnt; i++)
+			amdxdna_cmd_set_state(jobs[i]->cmd_bo, ERT_CMD_STATE_COMPLETED);
+		goto out;
+	}
+
+	fail_cmd_idx = readl(data + offsetof(struct cmd_chain_resp, fail_cmd_idx));
+	fail_cmd_status = readl(data + offsetof(struct cmd_chain_resp, fail_cmd_status));
+	XDNA_DBG(ctx->client->xdna, "Failed cmd idx %d, status 0x%x",
+		 fail_cmd_idx, fail_cmd_status);
+
+	/* See aie2_sched_cmdlist_resp_handler() */
+	state = ERT_CMD_STATE_ERROR;
+	if (fail_cmd_status == AIE2_STATUS_SUCCESS) {
+		state = ERT_CMD_STATE_ABORT;
+		fail_cmd_idx = 0;
+	} else if (fail_cmd_idx >= cnt) {
+		fail_cmd_idx = 0;
+	}
+	ret = -EINVAL;
+
+set_state:
+	for (i = 0; i < cnt; i++) {
+		if (i < fail_cmd_idx)
+			amdxdna_cmd_set_state(jobs[i]->cmd_bo, ERT_CMD_STATE_COMPLETED);
+		else if (i == fail_cmd_idx)
+			amdxdna_cmd_set_state(jobs[i]->cmd_bo, state);
+		else
+			amdxdna_cmd_set_state(jobs[i]->cmd_bo, ERT_CMD_STATE_ABORT);
+	}
+out:
+	for (i = 0; i < cnt; i++)
+		aie2_sched_notify_defer(jobs[i]);
+	return ret;
+}
+
+static bool
+aie2_job_can_coalesce(struct amdxdna_sched_job *job, struct amdxdna_sched_job *next)
+{
+	if (next->opcode != OP_USER || next->coalesced || next->deadline)
+		return false;
+	if (next->mm != job->mm || amdxdna_cmd_get_op(next->cmd_bo) == ERT_CMD_CHAIN)
+		return false;
+
+	/* DRM scheduler does not wait for its dependencies before it is run */
+	return next->deps_signaled;
+}
+
+/*
+ * Pick jobs queued after job in the same context to be sent with it. Stop at
+ * the first job which can't be, commands of a context have to run in order.
+ */
+static u32
+aie2_sched_job_coalesce(struct amdxdna_sched_job *job, struct amdxdna_sched_job **jobs)
+{
+	struct amdxdna_ctx_priv *priv = job->ctx->priv;
+	u32 max_cnt = min3(max_coalesce_cmds, (u32)CTX_MAX_CMDS, priv->depth);
+	struct amdxdna_sched_job *next;
+	u64 exec_cnt, avg_ns = 0;
+	u32 cnt = 0;
+	u64 seq;
+
+	/* Don't delay the completion of a job with deadline */
+	if (max_cnt <= 1 || job->deadline)
+		return 0;
+
+	exec_cnt = READ_ONCE(priv->exec_cnt);
+	if (coalesce_budget_us && exec_cnt)
+		avg_ns = div64_u64(READ_ONCE(priv->exec_ns), exec_cnt);
+
+	/* Jobs after this one can't complete or be freed before it runs */
+	for (seq = job->seq + 1; cnt < max_cnt - 1; seq++) {
+		next = aie2_job_slot_get(priv, seq);
+		if (!next || !aie2_job_can_coalesce(job, next))
+			break;
+		if (avg_ns && avg_ns * (cnt + 2) > (u64)coalesce_budget_us * NSEC_PER_USEC)
+			break;
+		jobs[cnt++] = next;
+	}
+
+	return cnt;
+}
+
+static int
+aie2_sched_job_send_coalesced(struct amdxdna_sched_job *job)
+{
+	struct amdxdna_sched_job *jobs[CTX_MAX_CMDS - 1];
+	struct amdxdna_ctx *ctx = job->ctx;
+	u32 cnt, i;
+	int ret;
+
+	cnt = aie2_sched_job_coalesce(job, jobs);
+	if (!cnt) {
+		if (force_cmdlist)
+			return aie2_cmdlist_single_execbuf(ctx, job,
+							   aie2_sched_cmdlist_resp_handler);
+		return aie2_execbuf(ctx, job, aie2_sched_resp_handler);
+	}
+
+	/*
+	 * Take what aie2_sched_job_run() takes for each coalesced job. The fence
+	 * reference is returned to DRM scheduler when the job is run.
+	 */
+	for (i = 0; i < cnt; i++) {
+		if (amdxdna_pm_resume_get(ctx->client->xdna))
+			break;
+		mmget(jobs[i]->mm);
+		kref_get(&jobs[i]->refcnt);
+		dma_fence_get(jobs[i]->fence);
+		amdxdna_cmd_set_state(jobs[i]->cmd_bo, ERT_CMD_STATE_NEW);
+		jobs[i]->run_time = job->run_time;
+		amdxdna_cmd_set_timestamp(jobs[i]->cmd_bo, ERT_CMD_STATE_NEW, jobs[i]->submit_time);
+		amdxdna_cmd_set_timestamp(jobs[i]->cmd_bo, ERT_CMD_STATE_RUNNING, job->run_time);
+	}
+	cnt = i;
+
+	/*
+	 * With command list, jobs are merged into one message. Otherwise, each
+	 * job is a message and they are sent back to back.
+	 */
+	if (force_cmdlist)
+		ret = aie2_cmdlist_coalesce_execbuf(ctx, job, jobs, cnt,
+						    aie2_sched_coalesced_resp_handler);
+	else
+		ret = aie2_execbufs(ctx, job, jobs, cnt, aie2_sched_resp_handler);
+	for (i = 0; i < cnt; i++) {
+		if (jobs[i]->coalesced) {
+			trace_xdna_job(&jobs[i]->base, ctx->name, "job coalesced",
+				       jobs[i]->seq, jobs[i]->opcode);
+			WRITE_ONCE(ctx->priv->queue_delay_ns, ctx->priv->queue_delay_ns +
+				   ktime_to_ns(ktime_sub(job->run_time, jobs[i]->submit_time)));
+			continue;
+		}
+		dma_fence_put(jobs[i]->fence);
+		aie2_job_put(jobs[i]);
+		mmput(jobs[i]->mm);
+		amdxdna_pm_suspend_put(ctx->client->xdna);
+	}
+
 	return ret;
 }
 
+/* Send user command job, and the ones which can be coalesced with it */
+static int aie2_sched_job_send(struct amdxdna_sched_job *job)
+{
+	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
+	struct amdxdna_ctx *ctx = job->ctx;
+
+	/*
+	 * Transaction binaries are only supported with RAI 1.5 release onwards. Below
+	 * implementation returns -EOPNOTSUPP error code for any older firmware versions.
+	 */
+	amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_NEW);
+
+	job->run_time = ktime_get();
+	amdxdna_cmd_set_timestamp(cmd_abo, ERT_CMD_STATE_NEW, job->submit_time);
+	amdxdna_cmd_set_timestamp(cmd_abo, ERT_CMD_STATE_RUNNING, job->run_time);
+	/* Jobs of a context are sent one by one, by its scheduler or submitter */
+	WRITE_ONCE(ctx->priv->queue_delay_ns, ctx->priv->queue_delay_ns +
+		   ktime_to_ns(ktime_sub(job->run_time, job->submit_time)));
+	if (job->deadline)
+		aie2_rq_check_deadline(ctx, job->run_time, job->deadline);
+	else
+		aie2_rq_check_preempt(ctx);
+	if (amdxdna_cmd_get_op(cmd_abo) == ERT_CMD_CHAIN)
+		return aie2_cmdlist_multi_execbuf(ctx, job, aie2_sched_cmdlist_resp_handler);
+	return aie2_sched_job_send_coalesced(job);
+}
+
 static struct dma_fence *
 aie2_sched_job_run(struct drm_sched_job *sched_job)
 {
 	struct amdxdna_sched_job *job = drm_job_to_xdna_job(sched_job);
-	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
 	struct amdxdna_ctx *ctx = job->ctx;
 	struct dma_fence *fence;
 	int ret;
 
 	trace_xdna_job(sched_job, ctx->name, "job run", job->seq, job->opcode);
 
+	/*
+	 * Sent to device along with an earlier job, see aie2_sched_job_send_coalesced(),
+	 * or by submitter, see aie2_job_send_direct()
+	 */
+	if (job->coalesced || job->direct)
+		return job->fence;
+
 	if (!mmget_not_zero(job->mm))
 		return ERR_PTR(-ESRCH);
 
@@ -428,18 +705,7 @@ aie2_sched_job_run(struct drm_sched_job *sched_job)
 		goto out;
 	}
 
-	/*
-	 * Transaction binaries are only supported with RAI 1.5 release onwards. Below
-	 * implementation returns -EOPNOTSUPP error code for any older firmware versions.
-	 */
-	amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_NEW);
-
-	if (amdxdna_cmd_get_op(cmd_abo) == ERT_CMD_CHAIN)
-		ret = aie2_cmdlist_multi_execbuf(ctx, job, aie2_sched_cmdlist_resp_handler);
-	else if (force_cmdlist)
-		ret = aie2_cmdlist_single_execbuf(ctx, job, aie2_sched_cmdlist_resp_handler);
-	else
-		ret = aie2_execbuf(ctx, job, aie2_sched_resp_handler);
+	ret = aie2_sched_job_send(job);
 out:
 	if (ret) {
 		dma_fence_put(job->fence);
@@ -462,11 +728,7 @@ static void aie2_sched_job_free(struct drm_sched_job *sched_job)
 
 	trace_xdna_job(sched_job, ctx->name, "job free", job->seq, job->opcode);
 	if (!job->job_done) {
-		int idx;
-
-		idx = get_job_idx(job->seq);
-		/* No contention with submit, no lock */
-		ctx->priv->pending[idx] = NULL;
+		aie2_job_slot_clear(ctx->priv, job->seq);
 		up(&ctx->priv->job_sem);
 	}
 
@@ -549,6 +811,7 @@ static void aie2_calc_ctx_dpm(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *
 	u32 req_gops;
 	u32 level;
 
+	ctx->priv->req_gops = 0;
 	if (!is_valid_qos_dpm_params(qos)) {
 		XDNA_DBG(ndev->xdna, "Invalid QoS gops %d fps %d latency %d",
 			 qos->gops, qos->fps, qos->latency);
@@ -569,6 +832,7 @@ static void aie2_calc_ctx_dpm(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *
 
 	req_gops = request_gops(qos->gops, qos->fps, qos->latency,
 				ndev->sys_eff_factor);
+	ctx->priv->req_gops = req_gops;
 	if (!req_gops) {
 		XDNA_WARN(ndev->xdna, "%s GOPS is zero, use max DPM level", ctx->name);
 		ctx->priv->req_dpm_level = ndev->max_dpm_level;
@@ -622,35 +886,41 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 
 	ctx->priv->orig_num_col = ctx->num_tiles / ndev->metadata.core.row_count;
 	ctx->max_opc = ndev->priv->col_opc * ctx->priv->orig_num_col;
-	mutex_lock(&client->mm_lock);
-	heap = client->dev_heap;
+	heap = amdxdna_gem_get_heap(client, ctx->dev_heap_bo);
 	if (!heap) {
-		XDNA_ERR(xdna, "The client dev heap object not exist");
-		mutex_unlock(&client->mm_lock);
+		XDNA_ERR(xdna, "The client dev heap %d object not exist", ctx->dev_heap_bo);
 		ret = -ENOENT;
 		goto free_priv;
 	}
-	drm_gem_object_get(to_gobj(heap));
-	mutex_unlock(&client->mm_lock);
 	priv->heap = heap;
-	sema_init(&priv->job_sem, CTX_MAX_CMDS);
+
+	BUILD_BUG_ON(!is_power_of_2(CTX_MAX_CMDS));
+	priv->depth = ctx->queue_depth ? ctx->queue_depth : CTX_MAX_CMDS;
+	if (priv->depth < CTX_MIN_DEPTH || priv->depth > CTX_MAX_DEPTH) {
+		XDNA_ERR(xdna, "Queue depth %d out of [%d, %d]",
+			 priv->depth, CTX_MIN_DEPTH, CTX_MAX_DEPTH);
+		ret = -EINVAL;
+		goto put_heap;
+	}
+	/* One cmdlist buffer per job allowed in flight, see aie2_cmdlist_get_cmd_buf() */
+	priv->pending = kcalloc(priv->depth, sizeof(*priv->pending), GFP_KERNEL);
+	priv->cmd_buf = kcalloc(priv->depth, sizeof(*priv->cmd_buf), GFP_KERNEL);
+	if (!priv->pending || !priv->cmd_buf) {
+		ret = -ENOMEM;
+		goto free_slots;
+	}
+	sema_init(&priv->job_sem, priv->depth);
 
 	ret = amdxdna_gem_pin(heap);
 	if (ret) {
 		XDNA_ERR(xdna, "Dev heap pin failed, ret %d", ret);
-		goto put_heap;
+		goto free_slots;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < priv->depth; i++) {
 		struct amdxdna_gem_obj *abo;
-		struct amdxdna_drm_create_bo args = {
-			.flags = 0,
-			.type = AMDXDNA_BO_DEV,
-			.vaddr = 0,
-			.size = MAX_CHAIN_CMDBUF_SIZE,
-		};
-
-		abo = amdxdna_drm_create_dev_bo(&xdna->ddev, &args, client->filp);
+
+		abo = amdxdna_gem_create_dev_bo(heap, MAX_CHAIN_CMDBUF_SIZE);
 		if (IS_ERR(abo)) {
 			ret = PTR_ERR(abo);
 			goto free_cmd_bufs;
@@ -663,6 +933,9 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 
 	mutex_init(&priv->io_lock);
 	init_waitqueue_head(&priv->job_free_waitq);
+	init_llist_head(&priv->done_jobs);
+	init_rwsem(&priv->resident_lock);
+	xa_init(&priv->resident_xa);
 
 	fs_reclaim_acquire(GFP_KERNEL);
 	might_lock(&priv->io_lock);
@@ -674,6 +947,8 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 		goto free_cmd_bufs;
 	}
 
+	/* Requested GOPS is checked against device capacity by aie2_rq_add() */
+	aie2_calc_ctx_dpm(ndev, ctx);
 	ret = aie2_rq_add(&xdna->dev_handle->ctx_rq, ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "Add ctx %s failed, ret %d", ctx->name, ret);
@@ -683,7 +958,6 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 	atomic64_set(&priv->job_pending_cnt, 0);
 	init_waitqueue_head(&priv->connect_waitq);
 
-	aie2_calc_ctx_dpm(ndev, ctx);
 	aie2_pm_add_dpm_level(ndev, ctx->priv->req_dpm_level);
 	priv->active = true; /* Init context is counted as an activity */
 
@@ -693,12 +967,15 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 destroy_syncobj:
 	aie2_ctx_syncobj_destroy(ctx);
 free_cmd_bufs:
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < priv->depth; i++) {
 		if (!priv->cmd_buf[i])
 			continue;
 		drm_gem_object_put(to_gobj(priv->cmd_buf[i]));
 	}
 	amdxdna_gem_unpin(heap);
+free_slots:
+	kfree(priv->cmd_buf);
+	kfree(priv->pending);
 put_heap:
 	drm_gem_object_put(to_gobj(heap));
 free_priv:
@@ -706,20 +983,36 @@ free_priv:
 	return ret;
 }
 
+static void aie2_ctx_resident_fini(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_gem_obj *abo;
+	unsigned long hdl;
+
+	xa_for_each(&ctx->priv->resident_xa, hdl, abo) {
+		atomic_dec(&abo->resident_cnt);
+		drm_gem_object_put(to_gobj(abo));
+	}
+	xa_destroy(&ctx->priv->resident_xa);
+}
+
 void aie2_ctx_fini(struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	int idx;
 
 	aie2_rq_del(&xdna->dev_handle->ctx_rq, ctx);
+	aie2_hwctx_unpark(ctx);
 	if (!amdxdna_pm_resume_get(xdna)) {
 		aie2_pm_del_dpm_level(xdna->dev_handle, ctx->priv->req_dpm_level);
 		amdxdna_pm_suspend_put(xdna);
 	}
 
+	aie2_ctx_resident_fini(ctx);
 	aie2_ctx_syncobj_destroy(ctx);
-	for (idx = 0; idx < ARRAY_SIZE(ctx->priv->cmd_buf); idx++)
+	for (idx = 0; idx < ctx->priv->depth; idx++)
 		drm_gem_object_put(to_gobj(ctx->priv->cmd_buf[idx]));
+	kfree(ctx->priv->cmd_buf);
+	kfree(ctx->priv->pending);
 	amdxdna_gem_unpin(ctx->priv->heap);
 	drm_gem_object_put(to_gobj(ctx->priv->heap));
 #ifdef AMDXDNA_DEVEL
@@ -730,6 +1023,7 @@ void aie2_ctx_fini(struct amdxdna_ctx *ctx)
 	}
 #endif
 
+	aie2_ctx_gen_gone(ctx);
 	XDNA_DBG(xdna, "%s total completed jobs %lld",
 		 ctx->name, ctx->completed);
 	mutex_destroy(&ctx->priv->io_lock);
@@ -853,6 +1147,202 @@ static int aie2_ctx_detach_debug_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
 	return ret;
 }
 
+/*
+ * Out fence of the last command submitted to ctx. Its timeline point is added
+ * under io_lock, after ctx->submitted is bumped.
+ */
+static struct dma_fence *aie2_ctx_last_out_fence(struct amdxdna_ctx *ctx)
+{
+	struct dma_fence *fence = NULL;
+
+	mutex_lock(&ctx->priv->io_lock);
+	if (ctx->submitted)
+		fence = aie2_cmd_get_out_fence(ctx, ctx->submitted - 1);
+	mutex_unlock(&ctx->priv->io_lock);
+	return fence;
+}
+
+static int aie2_ctx_add_resident_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
+{
+	struct amdxdna_client *client = ctx->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct drm_gem_object *gobj;
+	struct amdxdna_gem_obj *abo;
+	int ret;
+
+	gobj = drm_gem_object_lookup(client->filp, bo_hdl);
+	if (!gobj) {
+		XDNA_ERR(xdna, "Failed to get BO %d", bo_hdl);
+		return -ENOENT;
+	}
+	abo = to_xdna_obj(gobj);
+
+	ret = amdxdna_arg_bo_pin(abo);
+	if (ret)
+		goto put_obj;
+
+	down_write(&ctx->priv->resident_lock);
+	ret = xa_insert(&ctx->priv->resident_xa, bo_hdl, abo, GFP_KERNEL);
+	if (!ret)
+		atomic_inc(&abo->resident_cnt);
+	up_write(&ctx->priv->resident_lock);
+	if (ret) {
+		XDNA_ERR(xdna, "Failed to add resident BO %d to %s: %d", bo_hdl, ctx->name, ret);
+		goto put_obj;
+	}
+
+	XDNA_DBG(xdna, "Added resident BO %d to %s", bo_hdl, ctx->name);
+	return 0;
+
+put_obj:
+	drm_gem_object_put(gobj);
+	return ret;
+}
+
+static int aie2_ctx_remove_resident_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct amdxdna_gem_obj *abo;
+	struct dma_fence *fence;
+	int ret, err;
+
+	down_write(&ctx->priv->resident_lock);
+	abo = xa_erase(&ctx->priv->resident_xa, bo_hdl);
+	up_write(&ctx->priv->resident_lock);
+	if (!abo) {
+		XDNA_ERR(xdna, "BO %d is not resident in %s", bo_hdl, ctx->name);
+		return -EINVAL;
+	}
+
+	/* Commands submitted before may still use it, same as aie2_hmm_invalidate() */
+	fence = aie2_ctx_last_out_fence(ctx);
+	if (fence) {
+		ret = dma_fence_wait(fence, true);
+		if (ret) {
+			down_write(&ctx->priv->resident_lock);
+			err = xa_insert(&ctx->priv->resident_xa, bo_hdl, abo, GFP_KERNEL);
+			up_write(&ctx->priv->resident_lock);
+			if (!err) {
+				dma_fence_put(fence);
+				return ret;
+			}
+			/* Added again meanwhile, that entry keeps it pinned */
+			if (err != -EBUSY)
+				dma_fence_wait(fence, false);
+		}
+		dma_fence_put(fence);
+	}
+
+	atomic_dec(&abo->resident_cnt);
+	drm_gem_object_put(to_gobj(abo));
+	XDNA_DBG(xdna, "Removed resident BO %d from %s", bo_hdl, ctx->name);
+	return 0;
+}
+
+static int aie2_ctx_build_cmdlist(struct amdxdna_ctx *ctx, void *buf, u32 size)
+{
+	struct amdxdna_drm_build_cmdlist *args = buf;
+	struct amdxdna_client *client = ctx->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_gem_obj *list_abo = NULL;
+	struct amdxdna_gem_obj *cmd_abo, *old;
+	u32 list_size = 0, list_op = 0, list_cnt = 0;
+	struct dma_fence *fence;
+	u32 *offsets = NULL;
+	bool prebuilt;
+	int ret = 0;
+
+	if (size < sizeof(*args) || args->pad ||
+	    args->count > PAGE_SIZE / sizeof(u32))
+		return -EINVAL;
+
+	cmd_abo = amdxdna_gem_get_obj(client, args->cmd_handle, AMDXDNA_BO_CMD);
+	if (!cmd_abo) {
+		XDNA_ERR(xdna, "Failed to find chain cmd BO %d", args->cmd_handle);
+		return -ENOENT;
+	}
+
+	/*
+	 * Commands submitted before may still use the old list, which might be
+	 * the list BO about to be rebuilt.
+	 */
+	mutex_lock(&cmd_abo->lock);
+	prebuilt = !!cmd_abo->cmdlist;
+	mutex_unlock(&cmd_abo->lock);
+	fence = prebuilt ? aie2_ctx_last_out_fence(ctx) : NULL;
+	if (fence) {
+		/* -ERESTARTSYS, nothing is changed yet, so the ioctl can be restarted */
+		ret = dma_fence_wait(fence, true);
+		dma_fence_put(fence);
+		if (ret)
+			goto put_cmd;
+	}
+
+	if (args->list_handle != AMDXDNA_INVALID_BO_HANDLE) {
+		list_abo = amdxdna_gem_get_obj(client, args->list_handle, AMDXDNA_BO_DEV);
+		if (!list_abo) {
+			XDNA_ERR(xdna, "Failed to find cmdlist BO %d", args->list_handle);
+			ret = -ENOENT;
+			goto put_cmd;
+		}
+
+		if (args->offsets && args->count) {
+			offsets = kcalloc(args->count, sizeof(*offsets), GFP_KERNEL);
+			if (!offsets) {
+				ret = -ENOMEM;
+				goto put_list;
+			}
+		}
+
+		ret = aie2_cmdlist_build(cmd_abo, list_abo, offsets, args->count,
+					 &list_size, &list_op, &list_cnt);
+		if (ret) {
+			XDNA_ERR(xdna, "Failed to build cmdlist of BO %d: %d", args->cmd_handle, ret);
+			goto free_offsets;
+		}
+
+		if (offsets && copy_to_user(u64_to_user_ptr(args->offsets), offsets,
+					    args->count * sizeof(*offsets))) {
+			ret = -EFAULT;
+			goto free_offsets;
+		}
+	}
+
+	mutex_lock(&cmd_abo->lock);
+	old = cmd_abo->cmdlist;
+	cmd_abo->cmdlist = list_abo;
+	cmd_abo->cmdlist_size = list_size;
+	cmd_abo->cmdlist_op = list_op;
+	cmd_abo->cmdlist_cnt = list_cnt;
+	mutex_unlock(&cmd_abo->lock);
+	/* Reference goes to cmd BO */
+	list_abo = NULL;
+
+	if (old)
+		drm_gem_object_put(to_gobj(old));
+	XDNA_DBG(xdna, "%s cmdlist of BO %d, %d bytes", list_size ? "Built" : "Dropped",
+		 args->cmd_handle, list_size);
+
+free_offsets:
+	kfree(offsets);
+	if (ret && list_abo) {
+		/* A failed rebuild in place leaves the list half written, drop it */
+		mutex_lock(&cmd_abo->lock);
+		old = cmd_abo->cmdlist == list_abo ? list_abo : NULL;
+		if (old)
+			cmd_abo->cmdlist = NULL;
+		mutex_unlock(&cmd_abo->lock);
+		if (old)
+			drm_gem_object_put(to_gobj(old));
+	}
+put_list:
+	if (list_abo)
+		amdxdna_gem_put_obj(list_abo);
+put_cmd:
+	amdxdna_gem_put_obj(cmd_abo);
+	return ret;
+}
+
 int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32 size)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
@@ -872,6 +1362,18 @@ int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32
 	case DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF:
 		ret = aie2_ctx_detach_debug_bo(ctx, (u32)value);
 		break;
+	case DRM_AMDXDNA_HWCTX_ADD_RESIDENT_BO:
+		ret = aie2_ctx_add_resident_bo(ctx, (u32)value);
+		break;
+	case DRM_AMDXDNA_HWCTX_REMOVE_RESIDENT_BO:
+		ret = aie2_ctx_remove_resident_bo(ctx, (u32)value);
+		break;
+	case DRM_AMDXDNA_HWCTX_CONFIG_TDR_TIMEOUT:
+		ret = aie2_tdr_ctx_set_timeout(ctx, (u32)value);
+		break;
+	case DRM_AMDXDNA_HWCTX_BUILD_CMDLIST:
+		ret = aie2_ctx_build_cmdlist(ctx, buf, size);
+		break;
 	default:
 		XDNA_DBG(xdna, "Not supported type %d", type);
 		ret = -EOPNOTSUPP;
@@ -882,12 +1384,20 @@ int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32
 	return ret;
 }
 
+/*
+ * Fault in the invalidated part of each invalid range of abo. Invalidations
+ * of a range are merged into one interval, so pages that are not touched by
+ * migration or reclaim are not faulted in again.
+ */
 static int aie2_populate_range(struct amdxdna_gem_obj *abo)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
 	struct amdxdna_umap *mapp;
+	struct hmm_range range;
 	unsigned long timeout;
 	struct mm_struct *mm;
+	ktime_t start;
 	bool found;
 	int ret;
 
@@ -910,17 +1420,25 @@ again:
 	kref_get(&mapp->refcnt);
 	up_write(&xdna->notifier_lock);
 
-	XDNA_DBG(xdna, "populate memory range %lx %lx",
-		 mapp->vma->vm_start, mapp->vma->vm_end);
 	mm = mapp->notifier.mm;
 	if (!mmget_not_zero(mm)) {
 		amdxdna_umap_put(mapp);
 		return -EFAULT;
 	}
 
-	mapp->range.notifier_seq = mmu_interval_read_begin(&mapp->notifier);
+	start = ktime_get();
+	range = mapp->range;
+	/* Invalidation after this is caught by mmu_interval_read_retry() */
+	range.notifier_seq = mmu_interval_read_begin(&mapp->notifier);
+	down_read(&xdna->notifier_lock);
+	range.start = mapp->inval_start;
+	range.end = mapp->inval_end;
+	up_read(&xdna->notifier_lock);
+	range.hmm_pfns += (range.start - mapp->range.start) >> PAGE_SHIFT;
+
+	XDNA_DBG(xdna, "populate memory range %lx %lx", range.start, range.end);
 	mmap_read_lock(mm);
-	ret = hmm_range_fault(&mapp->range);
+	ret = hmm_range_fault(&range);
 	mmap_read_unlock(mm);
 	if (ret) {
 		if (time_after(jiffies, timeout)) {
@@ -930,6 +1448,7 @@ again:
 
 		if (ret == -EBUSY) {
 			amdxdna_umap_put(mapp);
+			mmput(mm);
 			goto again;
 		}
 
@@ -937,14 +1456,20 @@ again:
 	}
 
 	down_write(&xdna->notifier_lock);
-	if (mmu_interval_read_retry(&mapp->notifier, mapp->range.notifier_seq)) {
+	if (mmu_interval_read_retry(&mapp->notifier, range.notifier_seq)) {
 		up_write(&xdna->notifier_lock);
 		amdxdna_umap_put(mapp);
+		mmput(mm);
 		goto again;
 	}
 	mapp->invalid = false;
 	up_write(&xdna->notifier_lock);
+
+	atomic64_inc(&ndev->hmm_populate_cnt);
+	atomic64_add(range.end - range.start, &ndev->hmm_populate_bytes);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)), &ndev->hmm_populate_ns);
 	amdxdna_umap_put(mapp);
+	mmput(mm);
 	goto again;
 
 put_mm:
@@ -972,130 +1497,313 @@ static int aie2_add_job_dependency(struct amdxdna_sched_job *job, u32 *syncobj_h
 				 hdl, pt, ret);
 		}
 	}
+
+	for (i = 0; ret == 0 && i < job->dep_fence_cnt; i++) {
+		/* Fence reference is consumed, even on failure */
+		ret = drm_sched_job_add_dependency(&job->base, job->dep_fences[i]);
+		job->dep_fences[i] = NULL;
+		if (ret)
+			XDNA_ERR(client->xdna, "Failed to add fence as dependency, ret %d", ret);
+	}
 	return ret;
 }
 
-int aie2_cmd_submit(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
-		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq)
+/*
+ * Send job to device right away, instead of waking up DRM scheduler to run
+ * it, when nothing else of the context is in flight or queued and the job
+ * waits for nothing. Caller holds io_lock, so no later job of the context can
+ * get ahead of it. The job is still pushed to DRM scheduler afterwards, which
+ * finds it sent, and its fences are signaled the same way as if DRM scheduler
+ * had run it. Returns false if the job was not sent.
+ */
+static bool aie2_job_send_direct(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
+	int ret;
+
+	if (!direct_submit || job->opcode != OP_USER || !job->deps_signaled)
+		return false;
+
+	if (job->seq != READ_ONCE(ctx->completed))
+		return false;
+
+	/* Waking up device is left to DRM scheduler */
+	if (!amdxdna_pm_get_if_active(xdna))
+		return false;
+
+	if (!mmget_not_zero(job->mm)) {
+		amdxdna_pm_suspend_put(xdna);
+		return false;
+	}
+
+	/* Same as aie2_sched_job_run(), fence reference goes to DRM scheduler */
+	kref_get(&job->refcnt);
+	dma_fence_get(job->fence);
+	job->direct = true;
+	ret = aie2_sched_job_send(job);
+	if (ret) {
+		XDNA_DBG(xdna, "%s direct send failed, ret %d", ctx->name, ret);
+		job->direct = false;
+		dma_fence_put(job->fence);
+		aie2_job_put(job);
+		mmput(job->mm);
+		amdxdna_pm_suspend_put(xdna);
+		return false;
+	}
+
+	amdxdna_stats_start(ctx->client);
+	trace_xdna_job(&job->base, ctx->name, "job sent direct", job->seq, job->opcode);
+	WRITE_ONCE(ctx->priv->direct_cnt, ctx->priv->direct_cnt + 1);
+	return true;
+}
+
+/*
+ * Once the job is pushed, DRM scheduler drops its dependencies as they are
+ * waited for, so they can only be looked at before that. A dependency which
+ * signals later only keeps the job from being sent early.
+ */
+static bool aie2_job_deps_signaled(struct amdxdna_sched_job *job)
+{
+	struct dma_fence *fence;
+	unsigned long i;
+
+	xa_for_each(&job->base.dependencies, i, fence) {
+		if (!dma_fence_is_signaled(fence))
+			return false;
+	}
+	return true;
+}
+
+/* Caller holds notifier_lock and resident_lock */
+static struct amdxdna_gem_obj *
+aie2_resident_bo_invalid(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_gem_obj *abo;
+	unsigned long hdl;
+
+	xa_for_each(&ctx->priv->resident_xa, hdl, abo) {
+		if (abo->mem.map_invalid)
+			return abo;
+	}
+	return NULL;
+}
+
+/*
+ * Push jobs sharing one BO list to DRM scheduler, they get consecutive seq
+ * and *seq is the one of the last job. Everything which may sleep or fail is
+ * done before io_lock, which is held only to arm the jobs, so submitters of a
+ * context serialize on nothing else. Only the first job waits for a free
+ * slot, the batch is cut short where the context runs out of them. Returns
+ * number of jobs pushed, or error if none is.
+ */
+static int aie2_cmd_submit_jobs(struct amdxdna_ctx *ctx, struct amdxdna_sched_job **jobs,
+				u32 cnt, u32 *syncobj_hdls, u64 *syncobj_points,
+				u32 syncobj_cnt, u64 *seq)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct dma_fence_chain *chain_buf, **chains;
+	struct amdxdna_sched_job *job = jobs[0];
 	struct ww_acquire_ctx acquire_ctx;
-	struct dma_fence_chain *chain;
 	struct amdxdna_gem_obj *abo;
 	unsigned long timeout = 0;
+	u32 inflight, inited, n;
+	ktime_t now;
 	int ret, i;
 
 	ret = down_killable(&ctx->priv->job_sem);
-	if (ret)
+	if (ret) {
 		XDNA_ERR(xdna, "%s Grab job sem failed, ret %d", ctx->name, ret);
+		return ret;
+	}
+	for (n = 1; n < cnt; n++) {
+		if (down_trylock(&ctx->priv->job_sem))
+			break;
+	}
+	cnt = n;
+
+	chains = &chain_buf;
+	if (cnt > 1) {
+		chains = kcalloc(cnt, sizeof(*chains), GFP_KERNEL);
+		if (!chains) {
+			ret = -ENOMEM;
+			goto up_job_sem;
+		}
+	}
 
 	ret = aie2_rq_submit_enter(&xdna->dev_handle->ctx_rq, ctx);
 	if (ret) {
 		if (ret != -ERESTARTSYS)
 			XDNA_ERR(xdna, "Submit enter failed, ret %d", ret);
-		goto up_job_sem;
+		goto free_chains;
 	}
 
-	chain = dma_fence_chain_alloc();
-	if (!chain) {
-		ret = -ENOMEM;
-		goto rq_yield;
-	}
+	for (inited = 0; inited < cnt; inited++) {
+		job = jobs[inited];
+		chains[inited] = dma_fence_chain_alloc();
+		if (!chains[inited]) {
+			ret = -ENOMEM;
+			goto cleanup_jobs;
+		}
 
 #ifdef HAVE_6_17_drm_sched_job_init
-	ret = drm_sched_job_init(&job->base, &ctx->priv->entity, 1, ctx,
-				 ctx->client->filp->client_id);
+		ret = drm_sched_job_init(&job->base, &ctx->priv->entity, 1, ctx,
+					 ctx->client->filp->client_id);
 #else
-	ret = drm_sched_job_init(&job->base, &ctx->priv->entity, 1, ctx);
+		ret = drm_sched_job_init(&job->base, &ctx->priv->entity, 1, ctx);
 #endif
-	if (ret) {
-		XDNA_ERR(xdna, "DRM job init failed, ret %d", ret);
-		goto free_chain;
-	}
+		if (ret) {
+			XDNA_ERR(xdna, "DRM job init failed, ret %d", ret);
+			dma_fence_chain_free(chains[inited]);
+			goto cleanup_jobs;
+		}
 
-	ret = aie2_add_job_dependency(job, syncobj_hdls, syncobj_points, syncobj_cnt);
-	if (ret) {
-		XDNA_ERR(xdna, "Failed to add dependency, ret %d", ret);
-		goto cleanup_job;
+		/* Only a single job comes with syncobjs */
+		ret = aie2_add_job_dependency(job, syncobj_hdls, syncobj_points, syncobj_cnt);
+		if (ret) {
+			XDNA_ERR(xdna, "Failed to add dependency, ret %d", ret);
+			inited++;
+			goto cleanup_jobs;
+		}
 	}
 
+	/* Jobs of a batch have the same BOs, locking them once covers all */
+	job = jobs[0];
+	down_read(&ctx->priv->resident_lock);
 retry:
 	ret = amdxdna_lock_objects(job, &acquire_ctx);
 	if (ret) {
 		XDNA_WARN(xdna, "Failed to lock objects, ret %d", ret);
-		goto cleanup_job;
+		goto unlock_resident;
 	}
 
 	for (i = 0; i < job->bo_cnt; i++) {
-		ret = dma_resv_reserve_fences(job->bos[i].obj->resv, 1);
+		ret = dma_resv_reserve_fences(job->bos[i].obj->resv, cnt);
 		if (ret) {
 			XDNA_WARN(xdna, "Failed to reserve fences %d", ret);
 			amdxdna_unlock_objects(job, &acquire_ctx);
-			goto cleanup_job;
+			goto unlock_resident;
 		}
 	}
 
 	down_read(&xdna->notifier_lock);
 	for (i = 0; i < job->bo_cnt; i++) {
 		abo = to_xdna_obj(job->bos[i].obj);
-		if (abo->mem.map_invalid) {
-			up_read(&xdna->notifier_lock);
-			amdxdna_unlock_objects(job, &acquire_ctx);
-			if (!timeout) {
-				timeout = jiffies +
-					msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
-			} else if (time_after(jiffies, timeout)) {
-				ret = -ETIME;
-				goto cleanup_job;
-			}
-
-			ret = aie2_populate_range(abo);
-			if (ret)
-				goto cleanup_job;
-			goto retry;
-		}
+		if (abo->mem.map_invalid)
+			goto populate;
 	}
+	/* Resident BOs are neither locked nor fenced, only revalidated */
+	abo = aie2_resident_bo_invalid(ctx);
+	if (abo)
+		goto populate;
 
-	mutex_lock(&ctx->priv->io_lock);
-	drm_sched_job_arm(&job->base);
-	job->out_fence = dma_fence_get(&job->base.s_fence->finished);
-	for (i = 0; i < job->bo_cnt; i++)
-		dma_resv_add_fence(job->bos[i].obj->resv, job->out_fence, DMA_RESV_USAGE_WRITE);
 	/*
-	 * Resetting TDR timer before updating ctx->submitted to avoid
-	 * racing with TDR detection.
+	 * DRM scheduler requires jobs to be armed and pushed in the same order,
+	 * and syncobj timeline points have to be added in seq order. Nothing
+	 * else needs to be serialized.
 	 */
-	reset_tdr_timer(job);
-	job->seq = ctx->submitted++;
-	ctx->priv->pending[get_job_idx(job->seq)] = job;
-	kref_get(&job->refcnt);
-	drm_sched_entity_push_job(&job->base);
-
-	*seq = job->seq;
-	drm_syncobj_add_point(ctx->priv->syncobj, chain, job->out_fence, *seq);
+	ret = mutex_lock_killable(&ctx->priv->io_lock);
+	if (ret)
+		goto unlock_notifier;
+
+	now = ktime_get();
+	for (n = 0; n < cnt; n++) {
+		job = jobs[n];
+		job->submit_time = now;
+		job->deadline = 0;
+		if (ctx->priv->deadline_ns && job->opcode == OP_USER)
+			job->deadline = ktime_add_ns(job->submit_time, ctx->priv->deadline_ns);
+		job->deps_signaled = aie2_job_deps_signaled(job);
+		kref_get(&job->refcnt);
+
+		drm_sched_job_arm(&job->base);
+		job->out_fence = dma_fence_get(&job->base.s_fence->finished);
+		job->seq = ctx->submitted;
+		WRITE_ONCE(ctx->submitted, job->seq + 1);
+		inflight = job->seq + 1 - READ_ONCE(ctx->completed);
+		if (inflight > ctx->priv->inflight_hwm)
+			WRITE_ONCE(ctx->priv->inflight_hwm, inflight);
+		if (job->seq == READ_ONCE(ctx->completed))
+			aie2_rq_burst_start(ctx, job->submit_time);
+		aie2_job_slot_set(ctx->priv, job, job->seq);
+		aie2_job_send_direct(ctx, job);
+		drm_sched_entity_push_job(&job->base);
+		drm_syncobj_add_point(ctx->priv->syncobj, chains[n], job->out_fence, job->seq);
+	}
 	mutex_unlock(&ctx->priv->io_lock);
 
+	/* Objects are still locked */
+	for (n = 0; n < cnt; n++) {
+		for (i = 0; i < jobs[0]->bo_cnt; i++)
+			dma_resv_add_fence(jobs[0]->bos[i].obj->resv, jobs[n]->out_fence,
+					   DMA_RESV_USAGE_WRITE);
+	}
+	*seq = jobs[cnt - 1]->seq;
+
 	up_read(&xdna->notifier_lock);
-	amdxdna_unlock_objects(job, &acquire_ctx);
+	amdxdna_unlock_objects(jobs[0], &acquire_ctx);
+	up_read(&ctx->priv->resident_lock);
 	aie2_rq_submit_exit(ctx);
 
-	aie2_job_put(job);
+	for (n = 0; n < cnt; n++)
+		aie2_job_put(jobs[n]);
+	if (chains != &chain_buf)
+		kfree(chains);
 
-	return 0;
+	return cnt;
 
-cleanup_job:
-	drm_sched_job_cleanup(&job->base);
-free_chain:
-	dma_fence_chain_free(chain);
-rq_yield:
+populate:
+	up_read(&xdna->notifier_lock);
+	amdxdna_unlock_objects(job, &acquire_ctx);
+	if (!timeout) {
+		timeout = jiffies + msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
+	} else if (time_after(jiffies, timeout)) {
+		ret = -ETIME;
+		goto unlock_resident;
+	}
+
+	ret = aie2_populate_range(abo);
+	if (ret)
+		goto unlock_resident;
+	goto retry;
+
+unlock_notifier:
+	up_read(&xdna->notifier_lock);
+	amdxdna_unlock_objects(job, &acquire_ctx);
+unlock_resident:
+	up_read(&ctx->priv->resident_lock);
+cleanup_jobs:
+	for (n = 0; n < inited; n++) {
+		drm_sched_job_cleanup(&jobs[n]->base);
+		dma_fence_chain_free(chains[n]);
+	}
 	aie2_rq_yield(ctx);
 	aie2_rq_submit_exit(ctx);
+free_chains:
+	if (chains != &chain_buf)
+		kfree(chains);
 up_job_sem:
-	up(&ctx->priv->job_sem);
-	job->job_done = true;
+	for (n = 0; n < cnt; n++) {
+		up(&ctx->priv->job_sem);
+		jobs[n]->job_done = true;
+	}
 	return ret;
 }
 
+int aie2_cmd_submit(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq)
+{
+	int ret;
+
+	ret = aie2_cmd_submit_jobs(ctx, &job, 1, syncobj_hdls, syncobj_points, syncobj_cnt, seq);
+	return ret < 0 ? ret : 0;
+}
+
+int aie2_cmd_submit_batch(struct amdxdna_ctx *ctx, struct amdxdna_sched_job **jobs,
+			  u32 cnt, u64 *seq)
+{
+	return aie2_cmd_submit_jobs(ctx, jobs, cnt, NULL, NULL, 0, seq);
+}
+
 struct dma_fence *aie2_cmd_get_out_fence(struct amdxdna_ctx *ctx, u64 seq)
 {
 	struct dma_fence *fence, *out_fence = NULL;
@@ -1140,14 +1848,59 @@ int aie2_cmd_wait(struct amdxdna_ctx *ctx, u64 seq, u32 timeout)
 	return ret;
 }
 
+/*
+ * No resident_lock here, it is held across GFP_KERNEL allocation which may
+ * end up in the notifier. Lookup is under RCU, a BO being added races with
+ * the invalidation anyway and is revalidated before next command.
+ */
+static bool aie2_ctx_has_resident_bo(struct amdxdna_ctx *ctx, struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_gem_obj *entry;
+	unsigned long hdl;
+
+	xa_for_each(&ctx->priv->resident_xa, hdl, entry) {
+		if (entry == abo)
+			return true;
+	}
+	return false;
+}
+
 void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo, unsigned long cur_seq)
 {
 	struct drm_gem_object *gobj = to_gobj(abo);
 
+	atomic64_inc(&to_xdna_dev(gobj->dev)->dev_handle->hmm_inval_cnt);
+
 	/*
 	 * Must wait forever, otherwise, memory was unmapped then FW might crash.
 	 * In case FW not response, TDR will terminal context execution and unref all BOs.
 	 */
 	dma_resv_wait_timeout(gobj->resv, DMA_RESV_USAGE_BOOKKEEP,
 			      false /* non-interruptible */, MAX_SCHEDULE_TIMEOUT);
+
+	/*
+	 * Resident BOs are not fenced by each command. Wait for the last command
+	 * of contexts having resident BOs, commands of a context complete in order.
+	 */
+	if (atomic_read(&abo->resident_cnt) && abo->client) {
+		struct amdxdna_client *client = abo->client;
+		struct amdxdna_ctx *ctx;
+		unsigned long ctx_id;
+		int idx;
+
+		idx = srcu_read_lock(&client->ctx_srcu);
+		amdxdna_for_each_ctx(client, ctx_id, ctx) {
+			struct dma_fence *fence;
+
+			if (!aie2_ctx_has_resident_bo(ctx, abo))
+				continue;
+
+			fence = aie2_ctx_last_out_fence(ctx);
+			if (!fence)
+				continue;
+			dma_fence_wait(fence, false);
+			dma_fence_put(fence);
+		}
+		srcu_read_unlock(&client->ctx_srcu, idx);
+	}
 }
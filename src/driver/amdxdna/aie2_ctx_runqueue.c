@@ -7,6 +7,7 @@
 #include <linux/seq_file.h>
 #endif
 #include "amdxdna_drm.h"
+#include "amdxdna_trace.h"
 #include "aie2_pci.h"
 
 uint context_limit;
@@ -21,7 +22,64 @@ bool wait_update_parts = true;
 module_param(wait_update_parts, bool, 0600);
 MODULE_PARM_DESC(wait_update_parts, "[Debug] Add/Del context wait for update partition");
 
+bool rt_deadline_sched;
+module_param(rt_deadline_sched, bool, 0444);
+MODULE_PARM_DESC(rt_deadline_sched, "Schedule realtime contexts by QoS deadline (EDF)");
+
+bool energy_placement;
+module_param(energy_placement, bool, 0600);
+MODULE_PARM_DESC(energy_placement,
+		 "Pack contexts into fewest partitions while load is low, so that columns of the others go idle");
+
+uint energy_pack_depth = 4;
+module_param(energy_pack_depth, uint, 0600);
+MODULE_PARM_DESC(energy_pack_depth,
+		 "With energy_placement, commands queued per connected context above which partition takes no more contexts (default 4)");
+
+#define QOS_ADMIT_OFF		0
+#define QOS_ADMIT_REJECT	1
+#define QOS_ADMIT_DEGRADE	2
+uint qos_admission = QOS_ADMIT_OFF;
+module_param(qos_admission, uint, 0600);
+MODULE_PARM_DESC(qos_admission,
+		 "Admission of contexts over QoS GOPS capacity: 0 = admit (default), 1 = reject, 2 = admit as degraded");
+
 #define RQ_CTX_IDLE_COUNT 3
+/*
+ * Idle context keeps its hwctx longer when nothing waits for it, so that a
+ * context running in bursts doesn't pay for connecting every time.
+ */
+#define RQ_CTX_WARM_IDLE_COUNT 10
+/*
+ * When contexts wait for hwctx, an idle context is evicted once it has been
+ * idle for twice its average gap between bursts, but not less than
+ * RQ_CTX_IDLE_MIN_MS, so that it is not evicted just before its next burst.
+ * Gaps longer than RQ_CTX_GAP_MAX_MS are taken as that, one long pause should
+ * not keep the context connected for long afterwards. An eviction followed by
+ * a submission within RQ_CTX_EVICT_REGRET_MS is counted as regretted.
+ */
+#define RQ_CTX_IDLE_MIN_MS	100
+#define RQ_CTX_GAP_MAX_MS	5000
+#define RQ_CTX_EVICT_REGRET_MS	1000
+
+/*
+ * Shrinking partitions is optional, it is done only when the gain of running
+ * more contexts side by side over RQ_RECONF_HORIZON_MS is more than twice
+ * the cost of reconnecting all connected contexts, and not within
+ * RQ_RECONF_HOLDOFF_MS of the last reconfiguration.
+ */
+#define RQ_RECONF_HORIZON_MS	1000
+#define RQ_RECONF_HOLDOFF_MS	2000
+/* Initial guess of connect and disconnect time, until measured */
+#define RQ_DEFAULT_CONN_NS	(5 * NSEC_PER_MSEC)
+
+/*
+ * Weight of a context is its QoS GOPS hint, so a context asking for twice
+ * the GOPS gets twice the device time of its same priority peers. Contexts
+ * without the hint weigh as much as RQ_DEFAULT_WEIGHT GOPS.
+ */
+#define RQ_DEFAULT_WEIGHT	100
+#define RQ_MAX_WEIGHT		100000
 
 #if AMDXDNA_NUM_PRIORITY != CTX_RQ_NUM_QUEUE
 #error "AMDXDNA_NUM_PRIORITY not equals to CTX_RQ_NUM_QUEUE"
@@ -50,6 +108,62 @@ static void qos_to_rq_prio(struct amdxdna_ctx *ctx)
 	};
 }
 
+static void qos_to_rq_weight(struct amdxdna_ctx *ctx)
+{
+	u32 gops = ctx->qos.gops;
+
+	ctx->priv->weight = gops ? clamp_t(u32, gops, 1, RQ_MAX_WEIGHT) : RQ_DEFAULT_WEIGHT;
+}
+
+/*
+ * Relative deadline of a job of RT context, from QoS latency in ms, or the
+ * frame period if only fps is given. 0 means no deadline.
+ */
+static void qos_to_rq_deadline(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_qos_info *qos = &ctx->qos;
+
+	ctx->priv->deadline_ns = 0;
+	ctx->priv->deadline_miss_cnt = 0;
+	if (!rt_deadline_sched || !aie2_is_ctx_rt(ctx))
+		return;
+
+	if (qos->latency)
+		ctx->priv->deadline_ns = (u64)qos->latency * NSEC_PER_MSEC;
+	else if (qos->fps)
+		ctx->priv->deadline_ns = div_u64(NSEC_PER_SEC, qos->fps);
+}
+
+static void qos_to_rq_preempt(struct amdxdna_ctx *ctx)
+{
+	u32 *mode = &ctx->qos.preempt_mode;
+
+	if (*mode > AMDXDNA_PREEMPT_MODE_FINE)
+		*mode = AMDXDNA_PREEMPT_MODE_DEFAULT;
+	ctx->priv->preempt_mode = *mode;
+}
+
+static inline bool ctx_is_preemptible(struct amdxdna_ctx *ctx)
+{
+	return ctx->priv->preempt_mode == AMDXDNA_PREEMPT_MODE_FRAME ||
+	       ctx->priv->preempt_mode == AMDXDNA_PREEMPT_MODE_FINE;
+}
+
+/* Order of contexts in the same priority queue */
+static bool ctx_runs_before(struct amdxdna_ctx *a, struct amdxdna_ctx *b)
+{
+	if (a->priv->deadline_ns || b->priv->deadline_ns) {
+		/* Context without deadline goes after those with one */
+		if (!b->priv->deadline_ns)
+			return true;
+		if (!a->priv->deadline_ns)
+			return false;
+		return ktime_before(a->priv->deadline, b->priv->deadline);
+	}
+
+	return a->priv->vruntime < b->priv->vruntime;
+}
+
 static inline u32 part_max_non_rt_hwctx(struct aie2_partition *part)
 {
 	return part->max_hwctx - part->max_rt_ctx;
@@ -70,12 +184,59 @@ part_num_col(struct aie2_partition *part)
 	return part->end_col - part->start_col + 1;
 }
 
+static inline u32 part_waiting_ctx_cnt(struct aie2_partition *part)
+{
+	return part->ctx_cnt - part->hwctx_cnt;
+}
+
+/*
+ * A context coming back after sitting out starts no earlier than the least
+ * served connected context of its priority. Otherwise it would own the
+ * device until it catches up with time it did not ask for.
+ */
+/* Runqueue tracepoint of ctx on part, which may be NULL */
+#define trace_rq_ctx(event, ctx, part, reason, ns)				\
+	trace_rq_ctx_##event((ctx)->name, (ctx)->id, (ctx)->priv->priority,	\
+			     (part) ? (int)(part)->start_col : -1,		\
+			     (part) ? (int)(part)->end_col : -1, reason, ns)
+
+static void part_place_vruntime(struct aie2_partition *part, struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_ctx *curr;
+	u64 min = U64_MAX;
+
+	list_for_each_entry(curr, &part->conn_list, entry) {
+		if (curr->priv->priority == ctx->priv->priority)
+			min = min(min, READ_ONCE(curr->priv->vruntime));
+	}
+
+	if (min != U64_MAX && ctx->priv->vruntime < min)
+		ctx->priv->vruntime = min;
+}
+
+/*
+ * Each priority queue is ordered by vruntime, the least served context of a
+ * priority is connected first. RT contexts with deadline are ordered by it,
+ * earliest first. Waiting context doesn't run, so the order holds until it
+ * gets connected.
+ */
 static void
-part_ctx_dispatch(struct aie2_partition *part, struct amdxdna_ctx *ctx)
+part_ctx_dispatch(struct aie2_partition *part, struct amdxdna_ctx *ctx, const char *reason)
 {
 	int prio_q = ctx->priv->priority;
+	struct list_head *pos = &part->runqueue[prio_q];
+	struct amdxdna_ctx *curr;
 
-	list_move_tail(&ctx->entry, &part->runqueue[prio_q]);
+	part_place_vruntime(part, ctx);
+	if (ctx->priv->deadline_ns)
+		ctx->priv->deadline = ktime_add_ns(ktime_get(), ctx->priv->deadline_ns);
+	list_for_each_entry(curr, &part->runqueue[prio_q], entry) {
+		if (curr != ctx && ctx_runs_before(ctx, curr)) {
+			pos = &curr->entry;
+			break;
+		}
+	}
+	list_move_tail(&ctx->entry, pos);
 	part->ctx_cnt++;
 	if (aie2_is_ctx_rt(ctx))
 		part->rt_ctx_cnt++;
@@ -84,22 +245,44 @@ part_ctx_dispatch(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 	ctx->priv->part = part;
 	ctx->priv->active = true; /* Dispatch context is counted as an activity */
 	ctx->priv->idle_cnt = 0;
+	trace_rq_ctx(dispatch, ctx, part, reason, 0);
 	XDNA_DBG(ctx->client->xdna, "%s dispatched, priority queue %d", ctx->name, prio_q);
 }
 
+static bool ctx_idle_long_enough(struct amdxdna_ctx *ctx, ktime_t now)
+{
+	u64 threshold = max_t(u64, 2 * READ_ONCE(ctx->priv->burst_gap_ns),
+			      RQ_CTX_IDLE_MIN_MS * NSEC_PER_MSEC);
+
+	return ktime_to_ns(ktime_sub(now, READ_ONCE(ctx->priv->last_done))) >= threshold;
+}
+
+/*
+ * Without waiting contexts, idle context keeps its hwctx for
+ * RQ_CTX_WARM_IDLE_COUNT ticks. Otherwise, up to one idle context per waiting
+ * context is evicted, if it has been idle for longer than its usual gap
+ * between bursts, or for RQ_CTX_IDLE_COUNT ticks. Once there is one evicted
+ * for each waiting context, the rest is handled as if nothing waits. With
+ * force, every idle context is evicted.
+ */
 static bool part_handle_idle_ctx(struct aie2_partition *part, bool force)
 {
 	struct amdxdna_dev *xdna;
 	struct amdxdna_ctx *ctx;
+	ktime_t now = ktime_get();
 	bool found = false;
+	u32 waiting;
 
 	xdna = ctx_rq_to_xdna_dev(part->rq);
 	if (!part->hwctx_cnt)
 		return false;
 
+	waiting = part_waiting_ctx_cnt(part);
+
 	list_for_each_entry(ctx, &part->conn_list, entry) {
 		u64 completed = ctx->completed;
 		u64 submitted;
+		bool evict;
 
 		down_write(&ctx->priv->io_sem);
 		submitted = ctx->submitted;
@@ -108,16 +291,36 @@ static bool part_handle_idle_ctx(struct aie2_partition *part, bool force)
 		else
 			ctx->priv->idle_cnt = 0;
 
-		if (ctx->priv->idle_cnt == RQ_CTX_IDLE_COUNT ||
-		    (ctx->priv->idle_cnt && force)) {
-			XDNA_DBG(xdna, "%s idle, cnt %d try swap out",
-				 ctx->name, ctx->priv->idle_cnt);
+		if (!ctx->priv->idle_cnt)
+			evict = false;
+		else if (force)
+			evict = true;
+		else if (waiting)
+			evict = ctx->priv->idle_cnt >= RQ_CTX_IDLE_COUNT ||
+				ctx_idle_long_enough(ctx, now);
+		else if (READ_ONCE(energy_placement))
+			/* Idle hwctx holds columns up, let it go sooner */
+			evict = ctx->priv->idle_cnt >= RQ_CTX_IDLE_COUNT;
+		else
+			evict = ctx->priv->idle_cnt >= RQ_CTX_WARM_IDLE_COUNT;
+
+		if (evict) {
+			XDNA_DBG(xdna, "%s idle, cnt %d gap %llu ns try swap out",
+				 ctx->name, ctx->priv->idle_cnt, ctx->priv->burst_gap_ns);
+			trace_rq_ctx(evict, ctx, part,
+				     force ? "forced" : waiting ? "waiting ctx" : "idle",
+				     ktime_to_ns(ktime_sub(now, READ_ONCE(ctx->priv->last_done))));
 			ctx->priv->force_yield = true;
 			ctx->priv->status = CTX_STATE_DISCONNECTING;
 			ctx->priv->active = false;
 			ctx->priv->idle_cnt = 0;
+			WRITE_ONCE(ctx->priv->evict_time, now);
+			ctx->priv->evict_cnt++;
+			part->rq->idle_evict_cnt++;
 			queue_work(part->rq->work_q, &ctx->yield_work);
 			found = true;
+			if (waiting)
+				waiting--;
 		}
 		up_write(&ctx->priv->io_sem);
 	}
@@ -167,11 +370,33 @@ rq_part_rt_select(struct aie2_ctx_rq *rq)
 	return min;
 }
 
+static inline u32 part_non_rt_ctx_cnt(struct aie2_partition *part)
+{
+	return part->ctx_cnt - part->rt_ctx_cnt;
+}
+
+/*
+ * Partitions may reserve different number of hwctx for RT contexts. Compare
+ * the load of non-RT contexts relative to the non-RT hwctx a partition has,
+ * i.e. a/b < c/d, without division.
+ */
+static inline int
+part_non_rt_load_cmp(struct aie2_partition *a, struct aie2_partition *b)
+{
+	u64 load_a = (u64)part_non_rt_ctx_cnt(a) * part_max_non_rt_hwctx(b);
+	u64 load_b = (u64)part_non_rt_ctx_cnt(b) * part_max_non_rt_hwctx(a);
+
+	if (load_a == load_b)
+		return 0;
+	return load_a < load_b ? -1 : 1;
+}
+
 static struct aie2_partition *
 rq_part_non_rt_select(struct aie2_ctx_rq *rq)
 {
 	struct aie2_partition *min = NULL;
 	struct aie2_partition *part;
+	int cmp;
 	int i;
 
 	for (i = 0; i < rq->num_parts; i++) {
@@ -184,10 +409,11 @@ rq_part_non_rt_select(struct aie2_ctx_rq *rq)
 			continue;
 		}
 
-		if (part->ctx_cnt > min->ctx_cnt)
+		cmp = part_non_rt_load_cmp(part, min);
+		if (cmp > 0)
 			continue;
 
-		if (part->ctx_cnt < min->ctx_cnt) {
+		if (cmp < 0) {
 			min = part;
 			continue;
 		}
@@ -199,13 +425,113 @@ rq_part_non_rt_select(struct aie2_ctx_rq *rq)
 	return min;
 }
 
+/* Commands submitted to connected contexts of partition not completed yet */
+static u64 part_queued_cmds(struct aie2_partition *part)
+{
+	struct amdxdna_ctx *ctx;
+	u64 queued = 0;
+
+	list_for_each_entry(ctx, &part->conn_list, entry)
+		queued += ctx->submitted - READ_ONCE(ctx->completed);
+
+	return queued;
+}
+
+/*
+ * With energy_placement, non-RT context goes to the busiest partition that
+ * is already in use and still has a free hwctx, so that the others have no
+ * hwctx and their columns stay idle. Partition with contexts waiting for
+ * hwctx or with energy_pack_depth commands queued per context takes no more,
+ * next context then lights an idle partition up before the load is felt.
+ */
+static struct aie2_partition *
+rq_part_pack_select(struct aie2_ctx_rq *rq)
+{
+	u32 depth = READ_ONCE(energy_pack_depth);
+	struct aie2_partition *best = NULL;
+	struct aie2_partition *part;
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		if (part->max_hwctx == part->max_rt_ctx || !part->hwctx_cnt)
+			continue;
+
+		if (part_connect_is_full(part) || part_waiting_ctx_cnt(part))
+			continue;
+
+		if (part_queued_cmds(part) > (u64)depth * part->hwctx_cnt)
+			continue;
+
+		if (!best || part_non_rt_load_cmp(part, best) > 0)
+			best = part;
+	}
+
+	return best;
+}
+
+static struct aie2_partition *
+rq_part_last_connected(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
+{
+	struct aie2_partition *part;
+	int i;
+
+	if (!ctx->priv->last_num_col)
+		return NULL;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		if (part->start_col == ctx->priv->last_start_col &&
+		    part_num_col(part) == ctx->priv->last_num_col)
+			return part;
+	}
+
+	return NULL;
+}
+
+/*
+ * Prefer the partition the context was last connected to, as long as it
+ * has room and is not busier than the least loaded one. Firmware gets a
+ * chance to find the PDIs of the context still loaded on its columns.
+ */
 static struct aie2_partition *
 rq_part_select(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
-	if (aie2_is_ctx_rt(ctx))
-		return rq_part_rt_select(rq);
-	else
-		return rq_part_non_rt_select(rq);
+	struct aie2_partition *last;
+	struct aie2_partition *min;
+	bool rt = aie2_is_ctx_rt(ctx);
+
+	if (!rt && READ_ONCE(energy_placement)) {
+		min = rq_part_pack_select(rq);
+		if (min) {
+			rq->pack_cnt++;
+			return min;
+		}
+	}
+
+	min = rt ? rq_part_rt_select(rq) : rq_part_non_rt_select(rq);
+	last = rq_part_last_connected(rq, ctx);
+	if (!last || !min)
+		return min;
+
+	if (last == min)
+		goto hit;
+
+	if (rt) {
+		if (last->rt_ctx_cnt < last->max_rt_ctx &&
+		    last->rt_ctx_cnt <= min->rt_ctx_cnt)
+			goto hit;
+	} else if (last->max_hwctx != last->max_rt_ctx) {
+		if (!part_connect_is_full(last) || !part_non_rt_load_cmp(last, min))
+			goto hit;
+	}
+
+	rq->affinity_miss++;
+	return min;
+
+hit:
+	rq->affinity_hit++;
+	return last;
 }
 
 static struct amdxdna_ctx *
@@ -286,9 +612,14 @@ out:
 	part->hwctx_cnt++;
 }
 
+/*
+ * Among the lowest priority candidates, block the one which has got the most
+ * device time for its weight. For equal vruntime, the oldest one goes.
+ */
 static struct amdxdna_ctx *
 select_ctx_to_block(struct aie2_partition *part, int prio)
 {
+	struct amdxdna_ctx *ret = NULL;
 	struct amdxdna_ctx *ctx;
 
 	list_for_each_entry_reverse(ctx, &part->conn_list, entry) {
@@ -298,15 +629,33 @@ select_ctx_to_block(struct aie2_partition *part, int prio)
 		if (ctx->priv->should_block)
 			continue;
 
-		return ctx;
+		if (!ret) {
+			ret = ctx;
+			continue;
+		}
+
+		if (ctx->priv->priority != ret->priv->priority)
+			break;
+
+		if (READ_ONCE(ctx->priv->vruntime) > READ_ONCE(ret->priv->vruntime))
+			ret = ctx;
 	}
 
-	return NULL;
+	return ret;
+}
+
+/* Moving average of connect or disconnect time, weight 1/8 for newest */
+static void rq_update_avg(u64 *avg, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	*avg = *avg ? (*avg * 7 + ns) / 8 : ns;
 }
 
 static void part_ctx_start(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna;
+	ktime_t start;
 	int err;
 
 	xdna = ctx_rq_to_xdna_dev(part->rq);
@@ -314,7 +663,11 @@ static void part_ctx_start(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 	down_write(&ctx->priv->io_sem);
 	ctx->start_col = part->start_col;
 	ctx->num_col = part_num_col(part);
+	start = ktime_get();
 	err = aie2_ctx_connect(ctx);
+	rq_update_avg(&part->rq->avg_conn_ns, start);
+	trace_rq_ctx(connect, ctx, part, err ? "failed" : "connected",
+		     ktime_to_ns(ktime_sub(ktime_get(), start)));
 	if (err) {
 		ctx->priv->status = CTX_STATE_DEAD;
 		ctx->priv->errno = err;
@@ -342,6 +695,7 @@ static void part_ctx_stop_wait(struct amdxdna_ctx *ctx, bool wait)
 	struct aie2_partition *part;
 	struct amdxdna_dev *xdna;
 	struct aie2_ctx_rq *rq;
+	ktime_t start;
 
 	xdna = ctx->client->xdna;
 	rq = &xdna->dev_handle->ctx_rq;
@@ -350,7 +704,11 @@ static void part_ctx_stop_wait(struct amdxdna_ctx *ctx, bool wait)
 		XDNA_DBG(xdna, "%s skip stop, status %d", ctx->name, ctx->priv->status);
 		return;
 	}
+	start = ktime_get();
 	aie2_ctx_disconnect(ctx, wait);
+	rq_update_avg(&rq->avg_disconn_ns, start);
+	trace_rq_ctx(disconnect, ctx, ctx->priv->part, wait ? "wait" : "no wait",
+		     ktime_to_ns(ktime_sub(ktime_get(), start)));
 
 	list_move_tail(&ctx->entry, &rq->disconn_list);
 	ctx->priv->status = CTX_STATE_DISCONNECTED;
@@ -361,6 +719,8 @@ static void part_ctx_stop_wait(struct amdxdna_ctx *ctx, bool wait)
 		part->ctx_cnt--;
 		if (aie2_is_ctx_rt(ctx))
 			part->rt_ctx_cnt--;
+		ctx->priv->last_start_col = part->start_col;
+		ctx->priv->last_num_col = part_num_col(part);
 	}
 	ctx->priv->part = NULL;
 	ctx->priv->idle_cnt = 0;
@@ -431,6 +791,68 @@ static void part_cleanup(struct aie2_partition *part)
 	}
 }
 
+/*
+ * Look for a waiting non-RT context to move to part. Victim is the partition
+ * with most waiting contexts which can't be connected, since all its non-RT
+ * hwctx are in use. The highest priority and oldest waiting context goes first.
+ */
+static struct amdxdna_ctx *
+part_select_ctx_to_steal(struct aie2_partition *part, struct aie2_partition **from)
+{
+	struct aie2_partition *victim = NULL;
+	struct aie2_ctx_rq *rq = part->rq;
+	struct aie2_partition *p;
+	struct amdxdna_ctx *ctx;
+	int i, q;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		p = &rq->parts[i];
+		if (p == part || !part_connect_is_full(p) || !part_waiting_ctx_cnt(p))
+			continue;
+
+		if (!victim || part_waiting_ctx_cnt(p) > part_waiting_ctx_cnt(victim))
+			victim = p;
+	}
+	if (!victim)
+		return NULL;
+
+	for (q = CTX_RQ_HIGH; q < CTX_RQ_NUM_QUEUE; q++) {
+		list_for_each_entry(ctx, &victim->runqueue[q], entry) {
+			if (ctx->priv->orig_num_col > part_num_col(part))
+				continue;
+
+			*from = victim;
+			return ctx;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Called when part has free non-RT hwctx but nothing waiting of its own. The
+ * stolen context is dispatched here without going through rq_dispatch_work.
+ */
+static struct amdxdna_ctx *part_steal_ctx(struct aie2_partition *part)
+{
+	struct aie2_partition *from = NULL;
+	struct amdxdna_ctx *ctx;
+
+	ctx = part_select_ctx_to_steal(part, &from);
+	if (!ctx)
+		return NULL;
+
+	from->ctx_cnt--;
+	from->migrate_out++;
+	part_ctx_dispatch(part, ctx, "migrate");
+	part->migrate_in++;
+	ctx->priv->migrate_cnt++;
+	XDNA_DBG(ctx->client->xdna, "%s migrated [%d, %d] -> [%d, %d]", ctx->name,
+		 from->start_col, from->end_col, part->start_col, part->end_col);
+
+	return ctx;
+}
+
 static void part_sched_work(struct work_struct *work)
 {
 	struct aie2_partition *part;
@@ -457,6 +879,8 @@ static void part_sched_work(struct work_struct *work)
 
 	do {
 		next = select_highest_prio_ctx(part);
+		if (!next && !part_connect_is_full(part))
+			next = part_steal_ctx(part);
 		if (!next)
 			break;
 
@@ -476,7 +900,9 @@ static void part_sched_work(struct work_struct *work)
 			break;
 
 		XDNA_DBG(xdna, "block %s, next %s", curr->name, next->name);
+		trace_rq_ctx(block, curr, part, "preempted", 0);
 		curr->priv->should_block = true;
+		curr->priv->preempt_cnt++;
 		down_write(&curr->priv->io_sem);
 		if (!atomic64_read(&curr->priv->job_pending_cnt) &&
 		    curr->submitted == curr->completed) {
@@ -519,9 +945,12 @@ static void rq_yield_work(struct work_struct *work)
 			ctx->priv->should_block = false;
 		ctx->priv->status = CTX_STATE_CONNECTED;
 		wake_up_all(&ctx->priv->connect_waitq);
+		trace_rq_ctx(yield, ctx, part, "kept", 0);
 		goto out;
 	}
 
+	trace_rq_ctx(yield, ctx, part,
+		     rq->paused ? "reconfig" : ctx->priv->force_yield ? "idle" : "preempted", 0);
 	ctx->priv->should_block = false;
 	part_ctx_stop_wait(ctx, true);
 	if (rq->paused)
@@ -536,6 +965,22 @@ out:
 	mutex_unlock(&xdna->dev_lock);
 }
 
+/* Let partitions with free hwctx steal from part, if it has no more */
+static void rq_kick_stealers(struct aie2_ctx_rq *rq, struct aie2_partition *part)
+{
+	struct aie2_partition *p;
+	int i;
+
+	if (!part_connect_is_full(part))
+		return;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		p = &rq->parts[i];
+		if (p != part && !part_connect_is_full(p))
+			queue_work(rq->work_q, &p->sched_work);
+	}
+}
+
 static void rq_dispatch_work(struct work_struct *work)
 {
 	struct aie2_partition *part;
@@ -563,28 +1008,32 @@ static void rq_dispatch_work(struct work_struct *work)
 	WARN_ON(!part);
 	XDNA_DBG(xdna, "%s -> partition [%d, %d]",
 		 ctx->name, part->start_col, part->end_col);
-	part_ctx_dispatch(part, ctx);
+	part_ctx_dispatch(part, ctx, "dispatch");
 	queue_work(rq->work_q, &part->sched_work);
+	rq_kick_stealers(rq, part);
 out:
 	up_write(&ctx->priv->io_sem);
 	mutex_unlock(&xdna->dev_lock);
 }
 
-static void rq_part_ctx_limit_calc(struct aie2_ctx_rq *rq, int i)
+static u32 rq_part_rt_limit(struct aie2_ctx_rq *rq, int i)
 {
-	struct aie2_partition *part;
 	int average_rt;
 	int more_rt_i;
 
-	part = &rq->parts[i];
 	average_rt = rq->rt_ctx_cnt / rq->num_parts;
 	more_rt_i = rq->rt_ctx_cnt - average_rt * rq->num_parts;
 
+	return i < more_rt_i ? average_rt + 1 : average_rt;
+}
+
+static void rq_part_ctx_limit_calc(struct aie2_ctx_rq *rq, int i)
+{
+	struct aie2_partition *part;
+
+	part = &rq->parts[i];
 	part->max_hwctx = rq->hwctx_limit / rq->num_parts;
-	if (i < more_rt_i)
-		part->max_rt_ctx = average_rt + 1;
-	else
-		part->max_rt_ctx = average_rt;
+	part->max_rt_ctx = rq_part_rt_limit(rq, i);
 	WARN_ON(part->max_rt_ctx > part->max_hwctx);
 }
 
@@ -632,12 +1081,97 @@ static inline u32 get_part_cols(struct aie2_partition *p)
 	return p->end_col - p->start_col + 1;
 }
 
-static bool should_update_parts(struct aie2_ctx_rq *rq)
+enum rq_parts_update {
+	RQ_PARTS_KEEP,
+	RQ_PARTS_LIMITS,	/* Only RT limits change, no disconnect needed */
+	RQ_PARTS_RESIZE,
+};
+
+/*
+ * When only the number of RT contexts changes, the columns of partitions
+ * stay. New limits can be applied in place, if contexts connected to each
+ * partition still fit.
+ */
+static bool rq_part_limits_fit(struct aie2_ctx_rq *rq)
+{
+	struct aie2_partition *part;
+	u32 max_rt;
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		max_rt = rq_part_rt_limit(rq, i);
+		if (max_rt > part->max_hwctx || part->rt_ctx_cnt > max_rt)
+			return false;
+		if (part->hwctx_cnt - part->rt_ctx_cnt > part->max_hwctx - max_rt)
+			return false;
+	}
+
+	return true;
+}
+
+static void rq_part_limits_update(struct aie2_ctx_rq *rq)
+{
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		rq_part_ctx_limit_calc(rq, i);
+		queue_work(rq->work_q, &rq->parts[i].sched_work);
+	}
+}
+
+/*
+ * Narrower partitions let more contexts run side by side, but all connected
+ * contexts have to be disconnected and connected again, with their PDIs
+ * reloaded. Weigh one against the other.
+ */
+static bool rq_shrink_is_worth(struct aie2_ctx_rq *rq, u32 new_cols)
+{
+	u32 active = 0, conn = 0;
+	struct aie2_partition *part;
+	struct amdxdna_ctx *ctx;
+	u32 new_parts, old_run;
+	u64 cost, gain;
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		conn += part->hwctx_cnt;
+		list_for_each_entry(ctx, &part->conn_list, entry) {
+			if (ctx->priv->active || ctx->submitted != ctx->completed)
+				active++;
+		}
+		/* Waiting contexts have work to do */
+		active += part->ctx_cnt - part->hwctx_cnt;
+	}
+
+	/* Nothing to disconnect, reconfigure is free */
+	if (!conn)
+		return true;
+
+	if (ktime_before(ktime_get(), ktime_add_ms(rq->reconf_end, RQ_RECONF_HOLDOFF_MS)))
+		return false;
+
+	new_parts = min(rq->total_cols / max(new_cols, 1U), rq->hwctx_limit);
+	old_run = min(active, rq->num_parts);
+	if (!old_run || min(active, new_parts) <= old_run)
+		return false;
+
+	gain = div_u64((u64)RQ_RECONF_HORIZON_MS * NSEC_PER_MSEC *
+		       (min(active, new_parts) - old_run), old_run);
+	cost = conn * ((rq->avg_conn_ns ?: RQ_DEFAULT_CONN_NS) +
+		       (rq->avg_disconn_ns ?: RQ_DEFAULT_CONN_NS));
+
+	return gain > 2 * cost;
+}
+
+static enum rq_parts_update should_update_parts(struct aie2_ctx_rq *rq)
 {
 	struct amdxdna_dev *xdna;
 	u32 part_rt_ctx = 0;
 	u32 part_ctx = 0;
 	u32 part_col;
+	u32 max_cols;
 	int i;
 
 	xdna = ctx_rq_to_xdna_dev(rq);
@@ -650,29 +1184,43 @@ static bool should_update_parts(struct aie2_ctx_rq *rq)
 	XDNA_DBG(xdna, "max_cols %d part_col %d rt_ctx %d part_rt_ctx %d",
 		 rq->max_cols, part_col, rq->rt_ctx_cnt, part_rt_ctx);
 
-	/* rq is paused, go update */
-	if (rq->paused && !part_ctx)
-		return true;
-
-	rq->max_cols = xdna->dev_handle->total_col;
-	while (rq->max_cols) {
-		if (rq->ctx_width_resv[rq->max_cols])
+	max_cols = xdna->dev_handle->total_col;
+	while (max_cols) {
+		if (rq->ctx_width_resv[max_cols])
 			break;
 
-		rq->max_cols--;
+		max_cols--;
 	}
 
-	if (rq->max_cols != part_col)
-		return true;
+	/* rq is paused, reconfiguration in progress, go update */
+	if (rq->paused) {
+		rq->max_cols = max_cols;
+		return RQ_PARTS_RESIZE;
+	}
+
+	/* Widest context doesn't fit, must expand */
+	if (max_cols > part_col) {
+		rq->max_cols = max_cols;
+		return RQ_PARTS_RESIZE;
+	}
+
+	rq->reconf_deferred = false;
+	if (max_cols < part_col) {
+		if (rq_shrink_is_worth(rq, max_cols)) {
+			rq->max_cols = max_cols;
+			return RQ_PARTS_RESIZE;
+		}
+		XDNA_DBG(xdna, "Defer shrinking partitions from %d to %d columns",
+			 part_col, max_cols);
+		rq->reconf_deferred = true;
+		rq->reconf_deferred_cnt++;
+	}
+	rq->max_cols = part_col;
 
-	/*
-	 * When max cols not equals to partition cols,
-	 * it needs to update partition cols to new max cols.
-	 */
 	if (rq->rt_ctx_cnt != part_rt_ctx)
-		return true;
+		return rq_part_limits_fit(rq) ? RQ_PARTS_LIMITS : RQ_PARTS_RESIZE;
 
-	return false;
+	return RQ_PARTS_KEEP;
 }
 
 static bool handle_busy_ctxs(struct aie2_ctx_rq *rq)
@@ -700,19 +1248,38 @@ static void rq_parts_work(struct work_struct *work)
 	struct amdxdna_ctx *ctx;
 	struct amdxdna_ctx *tmp;
 	struct aie2_ctx_rq *rq;
+	u32 cur_cols;
+	u64 reconf_ns;
 	int i;
 
 	rq = container_of(work, struct aie2_ctx_rq, parts_work);
 	xdna = ctx_rq_to_xdna_dev(rq);
 
 	mutex_lock(&xdna->dev_lock);
-	if (!should_update_parts(rq))
-		goto out;
+	cur_cols = get_part_cols(&rq->parts[0]);
+	switch (should_update_parts(rq)) {
+	case RQ_PARTS_KEEP:
+		trace_rq_parts_reconf(rq->reconf_deferred ? "deferred" : "keep", cur_cols,
+				      rq->max_cols, rq->num_parts, 0);
+		goto done;
+	case RQ_PARTS_LIMITS:
+		trace_rq_parts_reconf("limits", cur_cols, rq->max_cols, rq->num_parts, 0);
+		rq_part_limits_update(rq);
+		rq->reconf_limits_cnt++;
+		goto done;
+	case RQ_PARTS_RESIZE:
+		break;
+	}
 
 	/* Partition expanding or trimming is needed */
-	rq->paused = true;
+	if (!rq->paused) {
+		rq->paused = true;
+		rq->reconf_start = ktime_get();
+	}
 	if (handle_busy_ctxs(rq)) {
 		XDNA_DBG(xdna, "Wait for disconneting active contexts");
+		trace_rq_parts_reconf("wait busy", cur_cols, rq->max_cols, rq->num_parts,
+				      ktime_to_ns(ktime_sub(ktime_get(), rq->reconf_start)));
 		goto out;
 	}
 
@@ -721,9 +1288,18 @@ static void rq_parts_work(struct work_struct *work)
 
 	rq_part_resize(rq);
 	rq->paused = false;
+	rq->reconf_end = ktime_get();
+	reconf_ns = ktime_to_ns(ktime_sub(rq->reconf_end, rq->reconf_start));
+	rq->reconf_cnt++;
+	rq->reconf_total_ns += reconf_ns;
+	rq->reconf_max_ns = max(rq->reconf_max_ns, reconf_ns);
+	trace_rq_parts_reconf("resized", cur_cols, rq->max_cols, rq->num_parts, reconf_ns);
+done:
 	list_for_each_entry_safe(ctx, tmp, &rq->parts_work_waitq, parts_work_entry) {
 		list_del_init(&ctx->parts_work_entry);
 		complete(&ctx->priv->parts_work_comp);
+		if (ctx->ready_fence)
+			dma_fence_signal(ctx->ready_fence);
 	}
 out:
 	list_for_each_entry_safe(ctx, tmp, &rq->disconn_list, entry)
@@ -732,56 +1308,94 @@ out:
 	mutex_unlock(&xdna->dev_lock);
 }
 
+static void rq_tdr_snapshot(struct amdxdna_ctx *ctx, ktime_t now)
+{
+	ctx->priv->tdr_completed = READ_ONCE(ctx->completed);
+	ctx->priv->tdr_stamp = now;
+}
+
+static void rq_recover_ctx(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
+{
+	struct aie2_partition *part = ctx->priv->part;
+
+	down_write(&ctx->priv->io_sem);
+	ctx->priv->should_block = true;
+	ctx->priv->force_yield = true;
+	part_ctx_stop_wait(ctx, false);
+	up_write(&ctx->priv->io_sem);
+
+	if (rq->paused)
+		queue_work(rq->work_q, &rq->parts_work);
+	else if (part)
+		queue_work(rq->work_q, &part->sched_work);
+	if (atomic64_read(&ctx->priv->job_pending_cnt))
+		queue_work(rq->work_q, &ctx->dispatch_work);
+}
+
 /*
- * aie2_rq_is_all_context_stuck - Check if all connected contexts stuck
+ * aie2_rq_handle_stuck_ctx - Detect and recover context(s) not making progress
  *
  * This function is helpful to implement TDR (Timeout Detecting & Recovering).
- * Return true when all running context(s) did NOT making progress. Otherwise
- * return false.
+ * A connected context with outstanding commands is stuck when its completed
+ * counter did not change for longer than its deadline, tdr_timeout_ns, or
+ * default_ns if it does not have one. Only the stuck context is disconnected,
+ * which aborts its outstanding commands. Other contexts keep running.
  *
- * Where running context is
- *   - A connected context
- *   - A context with outstanding commands
- *
- * Where making progress context is
- *   - Completed counter changed from last check
- *
- * NOTE: Based on above definition, caller needs to call this twice to know if
- * all context stuck. It is caller determine when to call.
+ * Return number of stuck contexts. The shortest deadline of connected contexts
+ * is returned in next_ns, for caller to decide when to check again.
  */
-bool aie2_rq_is_all_context_stuck(struct aie2_ctx_rq *rq)
+int aie2_rq_handle_stuck_ctx(struct aie2_ctx_rq *rq, u64 default_ns, bool dump_only,
+			     u64 *next_ns)
 {
-	struct amdxdna_dev_hdl *ndev;
 	struct aie2_partition *part;
 	struct amdxdna_dev *xdna;
-	bool pending = false;
-	u32 tdr;
+	struct amdxdna_ctx *ctx;
+	struct amdxdna_ctx *tmp;
+	ktime_t now = ktime_get();
+	u64 shortest = default_ns;
+	int stuck = 0;
+	u64 timeout;
 	int i;
 
 	xdna = ctx_rq_to_xdna_dev(rq);
-	ndev = xdna->dev_handle;
 	mutex_lock(&xdna->dev_lock);
+	/* Stall time starts counting when a context is connected */
+	list_for_each_entry(ctx, &rq->disconn_list, entry)
+		rq_tdr_snapshot(ctx, now);
+
 	for (i = 0; i < rq->num_parts; i++) {
 		part = &rq->parts[i];
-		if (!part->hwctx_cnt)
-			continue;
-
-		pending = part_has_pending_cmd(part);
-		if (pending)
-			break;
-	}
-	mutex_unlock(&xdna->dev_lock);
+		list_for_each_entry_safe(ctx, tmp, &part->conn_list, entry) {
+			timeout = ctx->priv->tdr_timeout_ns ?: default_ns;
+			shortest = min(shortest, timeout);
 
-	tdr = READ_ONCE(ndev->tdr.status);
-	if (pending && ndev->tdr.progress == tdr && tdr == AIE2_TDR_WAIT)
-		return true;
+			if (ctx->submitted == READ_ONCE(ctx->completed) ||
+			    ctx->priv->tdr_completed != READ_ONCE(ctx->completed)) {
+				rq_tdr_snapshot(ctx, now);
+				continue;
+			}
 
-	if (tdr != AIE2_TDR_WAIT)
-		WRITE_ONCE(ndev->tdr.status, AIE2_TDR_WAIT);
+			if (ktime_to_ns(ktime_sub(now, ctx->priv->tdr_stamp)) < timeout)
+				continue;
 
-	ndev->tdr.progress = tdr;
+			XDNA_WARN(xdna, "%s isn't making progress in %llu ms, sub=%lld comp=%lld",
+				  ctx->name, div_u64(timeout, NSEC_PER_MSEC),
+				  ctx->submitted, ctx->completed);
+			aie2_dump_ctx(ctx);
+			/* Report the same stall once when only dumping */
+			rq_tdr_snapshot(ctx, now);
+			stuck++;
+			if (dump_only)
+				continue;
+
+			ctx->priv->tdr_cnt++;
+			rq_recover_ctx(rq, ctx);
+		}
+	}
+	mutex_unlock(&xdna->dev_lock);
 
-	return false;
+	*next_ns = shortest;
+	return stuck;
 }
 
 bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq)
@@ -841,6 +1455,10 @@ bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq)
 				break;
 		}
 	}
+
+	/* Shrinking partitions was deferred, see if it pays off now */
+	if (rq->reconf_deferred)
+		queue_work(rq->work_q, &rq->parts_work);
 	mutex_unlock(&xdna->dev_lock);
 
 	return found;
@@ -921,6 +1539,195 @@ void aie2_rq_yield(struct amdxdna_ctx *ctx)
 		queue_work(rq->work_q, &ctx->yield_work);
 }
 
+/*
+ * This is called when command completed. Do NOT hold lock.
+ * Firmware does not report execution time of a command, so device time is
+ * taken from the command being sent to its completion. Overlap with the
+ * previous command of the same context is not counted twice.
+ */
+void aie2_rq_account(struct amdxdna_ctx *ctx, ktime_t start)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	ktime_t now = ktime_get();
+	u64 delta;
+
+	if (ktime_before(start, priv->last_done))
+		start = priv->last_done;
+	priv->last_done = now;
+	WRITE_ONCE(priv->exec_cnt, priv->exec_cnt + 1);
+	if (!ktime_after(now, start))
+		return;
+
+	delta = ktime_to_ns(ktime_sub(now, start));
+	WRITE_ONCE(priv->exec_ns, priv->exec_ns + delta);
+	WRITE_ONCE(priv->vruntime,
+		   priv->vruntime + div_u64(delta * RQ_DEFAULT_WEIGHT, priv->weight));
+}
+
+/*
+ * Called with io_lock held when a job is submitted to an idle context. Learns
+ * the gap between bursts of the context, and counts the last idle eviction as
+ * regretted if it was too recent.
+ */
+void aie2_rq_burst_start(struct amdxdna_ctx *ctx, ktime_t now)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	ktime_t evict_time = READ_ONCE(priv->evict_time);
+	u64 gap;
+
+	if (evict_time) {
+		if (ktime_ms_delta(now, evict_time) < RQ_CTX_EVICT_REGRET_MS)
+			WRITE_ONCE(priv->evict_regret_cnt, priv->evict_regret_cnt + 1);
+		WRITE_ONCE(priv->evict_time, 0);
+	}
+
+	if (!priv->last_done || !ktime_after(now, priv->last_done))
+		return;
+
+	gap = min_t(u64, ktime_to_ns(ktime_sub(now, priv->last_done)),
+		    RQ_CTX_GAP_MAX_MS * NSEC_PER_MSEC);
+	/* Moving average, 1/4 weight of the latest gap */
+	if (priv->burst_gap_ns)
+		gap = (3 * priv->burst_gap_ns + gap) / 4;
+	WRITE_ONCE(priv->burst_gap_ns, gap);
+}
+
+/*
+ * Called when a job of RT context is sent to device. If what's left before
+ * its deadline is less than the expected frame execution time, have lower
+ * priority contexts on the same partition preempted.
+ */
+void aie2_rq_check_deadline(struct amdxdna_ctx *ctx, ktime_t start, ktime_t deadline)
+{
+	struct aie2_partition *part;
+	struct aie2_ctx_rq *rq;
+
+	if (ktime_before(ktime_add_ms(start, ctx->qos.frame_exec_time), deadline))
+		return;
+
+	part = READ_ONCE(ctx->priv->part);
+	if (!part)
+		return;
+
+	rq = part->rq;
+	XDNA_DBG(ctx->client->xdna, "%s deadline at risk", ctx->name);
+	WRITE_ONCE(part->deadline_at_risk, true);
+	queue_work(rq->work_q, &rq->preempt_work);
+}
+
+/*
+ * Called when a job without deadline is sent to device. If the context is
+ * latency critical, RT or with QoS latency, have lower priority contexts on
+ * the same partition preempted, if they asked for it by their preempt mode.
+ */
+void aie2_rq_check_preempt(struct amdxdna_ctx *ctx)
+{
+	struct aie2_partition *part;
+	struct aie2_ctx_rq *rq;
+
+	if (!aie2_is_ctx_rt(ctx) && !ctx->qos.latency)
+		return;
+
+	part = READ_ONCE(ctx->priv->part);
+	if (!part || READ_ONCE(part->hwctx_cnt) < 2)
+		return;
+
+	rq = part->rq;
+	if (!READ_ONCE(rq->preemptible_cnt))
+		return;
+
+	WRITE_ONCE(ctx->priv->preempt_req_cnt, ctx->priv->preempt_req_cnt + 1);
+	set_bit(ctx->priv->priority, &part->preempt_req);
+	queue_work(rq->work_q, &rq->preempt_work);
+}
+
+/* This is called when command completed. Do NOT hold lock */
+void aie2_rq_deadline_done(struct amdxdna_ctx *ctx, ktime_t deadline)
+{
+	if (!ktime_after(ktime_get(), deadline))
+		return;
+
+	WRITE_ONCE(ctx->priv->deadline_miss_cnt, ctx->priv->deadline_miss_cnt + 1);
+	XDNA_DBG(ctx->client->xdna, "%s missed deadline", ctx->name);
+}
+
+/* Preempt ctx at the granularity of its preempt mode */
+static void rq_preempt_ctx(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	ktime_t start;
+	bool frame;
+	int ret;
+	u64 ns;
+
+	if (priv->preempt_mode == AMDXDNA_PREEMPT_MODE_DEFAULT)
+		frame = ndev->frame_boundary_preempt;
+	else
+		frame = priv->preempt_mode == AMDXDNA_PREEMPT_MODE_FRAME;
+
+	start = ktime_get();
+	mutex_lock(&ndev->aie2_lock);
+	ret = aie2_preempt_granularity(ndev, frame);
+	if (!ret)
+		ret = aie2_force_preemption(ndev, priv->id);
+	mutex_unlock(&ndev->aie2_lock);
+	if (ret) {
+		XDNA_WARN(ndev->xdna, "%s force preemption failed", ctx->name);
+		return;
+	}
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	priv->preempt_cnt++;
+	priv->preempt_ns += ns;
+	priv->preempt_max_ns = max(priv->preempt_max_ns, ns);
+}
+
+static void rq_preempt_work(struct work_struct *work)
+{
+	struct amdxdna_dev_hdl *ndev;
+	struct aie2_partition *part;
+	struct amdxdna_dev *xdna;
+	struct amdxdna_ctx *ctx;
+	struct aie2_ctx_rq *rq;
+	unsigned long req;
+	bool at_risk;
+	int i;
+
+	rq = container_of(work, struct aie2_ctx_rq, preempt_work);
+	ndev = ctx_rq_to_ndev(rq);
+	xdna = ndev->xdna;
+
+	if (amdxdna_pm_resume_get(xdna))
+		return;
+
+	mutex_lock(&xdna->dev_lock);
+	for (i = 0; i < rq->num_parts; i++) {
+		u32 prio;
+
+		part = &rq->parts[i];
+		at_risk = READ_ONCE(part->deadline_at_risk);
+		req = xchg(&part->preempt_req, 0);
+		if (!at_risk && !req)
+			continue;
+
+		WRITE_ONCE(part->deadline_at_risk, false);
+		/* Highest priority asking, anything below it may be preempted */
+		prio = req ? __ffs(req) : CTX_RQ_NUM_QUEUE;
+		list_for_each_entry(ctx, &part->conn_list, entry) {
+			if (ctx->submitted == ctx->completed ||
+			    ctx->priv->preempt_mode == AMDXDNA_PREEMPT_MODE_NONE)
+				continue;
+
+			if ((at_risk && !aie2_is_ctx_rt(ctx)) ||
+			    (ctx->priv->priority > prio && ctx_is_preemptible(ctx)))
+				rq_preempt_ctx(ndev, ctx);
+		}
+	}
+	mutex_unlock(&xdna->dev_lock);
+
+	amdxdna_pm_suspend_put(xdna);
+}
+
 static int rq_submit_enter_slow(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna;
@@ -1055,6 +1862,46 @@ aie2_disable_special_case(struct aie2_ctx_rq *rq)
 	XDNA_DBG(xdna, "Special case support disabled");
 }
 
+/*
+ * GOPS device delivers with all columns at the highest DPM level, same sum
+ * aie2_calc_ctx_dpm() picks DPM level of a context by.
+ */
+static u64 rq_capable_gops(struct aie2_ctx_rq *rq)
+{
+	struct amdxdna_dev_hdl *ndev = ctx_rq_to_ndev(rq);
+	u32 clk_mhz = ndev->priv->dpm_clk_tbl[ndev->max_dpm_level].hclk;
+
+	return div_u64((u64)ndev->priv->col_opc * rq->total_cols * clk_mhz, 1000);
+}
+
+static int rq_qos_admit(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna = ctx_rq_to_xdna_dev(rq);
+	u32 mode = READ_ONCE(qos_admission);
+	u32 req_gops = ctx->priv->req_gops;
+	u64 cap_gops;
+
+	ctx->qos_degraded = false;
+	if (mode == QOS_ADMIT_OFF || !req_gops)
+		return 0;
+
+	cap_gops = rq_capable_gops(rq);
+	if (rq->committed_gops + req_gops <= cap_gops)
+		return 0;
+
+	if (mode == QOS_ADMIT_REJECT) {
+		XDNA_ERR(xdna, "%s GOPS %u over capacity, committed %llu of %llu",
+			 ctx->name, req_gops, rq->committed_gops, cap_gops);
+		rq->admit_reject_cnt++;
+		return -EBUSY;
+	}
+
+	XDNA_WARN(xdna, "%s GOPS %u over capacity, committed %llu of %llu, admitted as degraded",
+		  ctx->name, req_gops, rq->committed_gops, cap_gops);
+	ctx->qos_degraded = true;
+	return 0;
+}
+
 int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna;
@@ -1099,16 +1946,48 @@ int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 		}
 	}
 
+	ret = rq_qos_admit(rq, ctx);
+	if (ret)
+		goto error;
+
 	INIT_WORK(&ctx->dispatch_work, rq_dispatch_work);
 	INIT_WORK(&ctx->yield_work, rq_yield_work);
 	init_completion(&ctx->priv->parts_work_comp);
+	INIT_LIST_HEAD(&ctx->parts_work_entry);
 	ctx->priv->status = CTX_STATE_DISCONNECTED;
 	ctx->priv->should_block = false;
 	qos_to_rq_prio(ctx);
+	qos_to_rq_weight(ctx);
+	qos_to_rq_deadline(ctx);
+	qos_to_rq_preempt(ctx);
+	aie2_tdr_ctx_init(ctx);
+	ctx->priv->vruntime = 0;
+	ctx->priv->exec_ns = 0;
+	ctx->priv->last_done = 0;
+	ctx->priv->conn_cnt = 0;
+	ctx->priv->burst_gap_ns = 0;
+	ctx->priv->evict_time = 0;
+	ctx->priv->evict_cnt = 0;
+	ctx->priv->evict_regret_cnt = 0;
+	ctx->priv->preempt_cnt = 0;
+	ctx->priv->preempt_ns = 0;
+	ctx->priv->preempt_max_ns = 0;
+	ctx->priv->preempt_req_cnt = 0;
+	ctx->priv->migrate_cnt = 0;
+	ctx->priv->queue_delay_ns = 0;
+	ctx->priv->direct_cnt = 0;
+	ctx->priv->last_num_col = 0;
 
 	rq->ctx_width_resv[num_col]++;
 	list_add_tail(&ctx->entry, &rq->disconn_list);
 	rq->ctx_cnt++;
+	/* Degraded context has nothing guaranteed, so it commits nothing */
+	if (ctx->qos_degraded)
+		rq->degraded_cnt++;
+	else
+		rq->committed_gops += ctx->priv->req_gops;
+	if (ctx_is_preemptible(ctx))
+		rq->preemptible_cnt++;
 
 	/* Expand partition is needed*/
 	if (num_col > rq->max_cols) {
@@ -1126,10 +2005,12 @@ int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 	if (wait_parts) {
 		list_add_tail(&ctx->parts_work_entry, &rq->parts_work_waitq);
 		queue_work(rq->work_q, &rq->parts_work);
+		/* Jobs stay on disconn_list until partitions are updated */
+		ctx->ready_deferred = !!ctx->ready_fence;
 	}
 	mutex_unlock(&xdna->dev_lock);
 
-	if (wait_update_parts && wait_parts)
+	if (wait_update_parts && wait_parts && !ctx->ready_deferred)
 		wait_for_completion(&ctx->priv->parts_work_comp);
 	XDNA_DBG(xdna, "%s added, status %d priority %d",
 		 ctx->name, ctx->priv->status, ctx->priv->priority);
@@ -1155,6 +2036,12 @@ void aie2_rq_del(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 
 	list_del(&ctx->entry);
 	rq->ctx_cnt--;
+	if (ctx->qos_degraded)
+		rq->degraded_cnt--;
+	else
+		rq->committed_gops -= ctx->priv->req_gops;
+	if (ctx_is_preemptible(ctx))
+		rq->preemptible_cnt--;
 	if (aie2_is_ctx_rt(ctx)) {
 		rq->rt_ctx_cnt--;
 		wait_parts = true;
@@ -1168,7 +2055,15 @@ void aie2_rq_del(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 
 	aie2_disable_special_case(rq);
 
+	/* Context not waited for may go before partitions are updated for it */
+	if (!list_empty(&ctx->parts_work_entry)) {
+		list_del_init(&ctx->parts_work_entry);
+		if (ctx->ready_fence)
+			dma_fence_signal(ctx->ready_fence);
+	}
+
 	if (wait_parts) {
+		reinit_completion(&ctx->priv->parts_work_comp);
 		list_add_tail(&ctx->parts_work_entry, &rq->parts_work_waitq);
 		queue_work(rq->work_q, &rq->parts_work);
 	}
@@ -1243,6 +2138,7 @@ int aie2_rq_init(struct aie2_ctx_rq *rq)
 		goto free_ctx_width_resv;
 
 	INIT_WORK(&rq->parts_work, rq_parts_work);
+	INIT_WORK(&rq->preempt_work, rq_preempt_work);
 	INIT_LIST_HEAD(&rq->parts_work_waitq);
 	INIT_LIST_HEAD(&rq->disconn_list);
 
@@ -1275,11 +2171,36 @@ int aie2_rq_active_context(struct aie2_ctx_rq *rq)
 }
 
 #if defined(CONFIG_DEBUG_FS)
+static void rq_show_ctx_stats(struct seq_file *m, struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+
+	seq_printf(m, "    submitted %lld completed %lld direct %llu queue_delay_ns %llu exec_ns %llu\n",
+		   ctx->submitted, ctx->completed, READ_ONCE(priv->direct_cnt),
+		   READ_ONCE(priv->queue_delay_ns), READ_ONCE(priv->exec_ns));
+	seq_printf(m, "    connects %llu disconnects %llu preemptions %llu migrations %llu\n",
+		   priv->conn_cnt, priv->disconn_cnt, priv->preempt_cnt, priv->migrate_cnt);
+	if (priv->preempt_mode || priv->preempt_cnt || priv->preempt_req_cnt)
+		seq_printf(m, "    preempt_mode %u preempt_ns %llu max_ns %llu preempt_requests %llu\n",
+			   priv->preempt_mode, priv->preempt_ns, priv->preempt_max_ns,
+			   READ_ONCE(priv->preempt_req_cnt));
+	seq_printf(m, "    idle_evictions %llu regretted %llu burst_gap_ns %llu\n",
+		   priv->evict_cnt, READ_ONCE(priv->evict_regret_cnt),
+		   READ_ONCE(priv->burst_gap_ns));
+	if (priv->deadline_ns)
+		seq_printf(m, "    deadline_ns %llu deadline_misses %llu\n",
+			   priv->deadline_ns, READ_ONCE(priv->deadline_miss_cnt));
+	if (priv->tdr_timeout_ns || priv->tdr_cnt)
+		seq_printf(m, "    tdr_timeout_ns %llu tdr_recoveries %llu\n",
+			   priv->tdr_timeout_ns, priv->tdr_cnt);
+}
+
 int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 {
 	struct aie2_partition *part;
 	struct amdxdna_dev *xdna;
 	struct amdxdna_ctx *ctx;
+	u64 migrations = 0;
 	int i;
 
 	xdna = ctx_rq_to_xdna_dev(rq);
@@ -1291,13 +2212,32 @@ int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 	seq_printf(m, "Number of RT contexts %d\n", rq->rt_ctx_cnt);
 	seq_printf(m, "Number of partitions %d\n", rq->num_parts);
 	seq_printf(m, "Max cols %d\n", rq->max_cols);
+	seq_printf(m, "Reconfigs %llu total_us %llu max_us %llu\n", rq->reconf_cnt,
+		   div_u64(rq->reconf_total_ns, NSEC_PER_USEC),
+		   div_u64(rq->reconf_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "Reconfigs in place %llu deferred %llu\n",
+		   rq->reconf_limits_cnt, rq->reconf_deferred_cnt);
+	seq_printf(m, "Partition affinity hit %llu miss %llu packed %llu\n",
+		   rq->affinity_hit, rq->affinity_miss, rq->pack_cnt);
+	seq_printf(m, "Avg connect_us %llu disconnect_us %llu\n",
+		   div_u64(rq->avg_conn_ns, NSEC_PER_USEC),
+		   div_u64(rq->avg_disconn_ns, NSEC_PER_USEC));
+	seq_printf(m, "Idle evictions %llu\n", rq->idle_evict_cnt);
+	seq_printf(m, "QoS GOPS committed %llu capacity %llu degraded %d rejected %llu\n",
+		   rq->committed_gops, rq_capable_gops(rq), rq->degraded_cnt,
+		   rq->admit_reject_cnt);
 
 	list_for_each_entry(ctx, &rq->disconn_list, entry) {
 		seq_printf(m, "%s status %d pending %lld\n",
 			   ctx->name, ctx->priv->status,
 			   atomic64_read(&ctx->priv->job_pending_cnt));
+		rq_show_ctx_stats(m, ctx);
 	}
 
+	for (i = 0; i < rq->num_parts; i++)
+		migrations += rq->parts[i].migrate_in;
+	seq_printf(m, "Number of migrations %llu\n", migrations);
+
 	for (i = 0; i < rq->num_parts; i++) {
 		part = &rq->parts[i];
 		seq_printf(m, "Part [%d, %d]:\n", part->start_col, part->end_col);
@@ -1306,6 +2246,14 @@ int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 		seq_printf(m, "  Number of ctx %d\n", part->ctx_cnt);
 		seq_printf(m, "  Number of RT ctx %d\n", part->rt_ctx_cnt);
 		seq_printf(m, "  Number of hwctx %d\n", part->hwctx_cnt);
+		seq_printf(m, "  Migrated in %llu\n", part->migrate_in);
+		seq_printf(m, "  Migrated out %llu\n", part->migrate_out);
+		list_for_each_entry(ctx, &part->conn_list, entry) {
+			seq_printf(m, "  %s priority %d weight %d vruntime %llu\n",
+				   ctx->name, ctx->priv->priority, ctx->priv->weight,
+				   READ_ONCE(ctx->priv->vruntime));
+			rq_show_ctx_stats(m, ctx);
+		}
 	}
 	mutex_unlock(&xdna->dev_lock);
 
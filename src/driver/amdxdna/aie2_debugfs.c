@@ -12,6 +12,7 @@
 #include <linux/vmalloc.h>
 #include <linux/completion.h>
 #include <linux/pm_runtime.h>
+#include <linux/sort.h>
 #include <linux/wait.h>
 
 #include "aie2_msg_priv.h"
@@ -23,6 +24,9 @@
 #define TX_TIMEOUT 2000 /* milliseconds */
 #define RX_TIMEOUT 5000 /* milliseconds */
 
+/* Firmware echoes back messages with this opcode */
+#define NPUTEST_ECHO_OPCODE 0x101010
+
 static int aie2_dbgfs_entry_open(struct inode *inode, struct file *file,
 				 int (*show)(struct seq_file *, void *))
 {
@@ -217,6 +221,28 @@ static int aie2_dpm_level_get(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(dpm_level, aie2_dpm_level_get, aie2_dpm_level_set);
 
+static int aie2_dpm_residency_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+	const struct dpm_clk_freq *dpm_table;
+	u32 i;
+
+	dpm_table = ndev->priv->dpm_clk_tbl;
+	mutex_lock(&ndev->aie2_lock);
+	aie2_pm_update_residency(ndev);
+	seq_printf(m, "governor %s\n", aie2_pm_gov_name());
+	seq_printf(m, "utilization %u%%\n", ndev->dpm_gov.util);
+	for (i = 0; i <= ndev->max_dpm_level; i++) {
+		seq_printf(m, "%c%u: %u,%u %llu ms\n", i == ndev->dpm_level ? '*' : ' ', i,
+			   dpm_table[i].npuclk, dpm_table[i].hclk,
+			   div_u64(ndev->dpm_gov.residency_ns[i], NSEC_PER_MSEC));
+	}
+	mutex_unlock(&ndev->aie2_lock);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(dpm_residency, aie2_dpm_residency_show, NULL);
+
 static int test_case01(struct amdxdna_dev_hdl *ndev)
 {
 	int ret;
@@ -292,7 +318,7 @@ static int test_case02(struct amdxdna_dev_hdl *ndev, u32 argc, const u32 *args)
 	for (i = 1; i < req_size; i++)
 		data[i] = pattern;
 
-	msg.opcode = 0x101010;
+	msg.opcode = NPUTEST_ECHO_OPCODE;
 	msg.handle = &comp;
 	msg.notify_cb = test_case02_cb;
 	msg.send_data = (u8 *)data;
@@ -320,6 +346,200 @@ static int test_case02(struct amdxdna_dev_hdl *ndev, u32 argc, const u32 *args)
 	return ret;
 }
 
+struct nputest_bench;
+
+struct nputest_bench_msg {
+	struct xdna_mailbox_msg	msg;
+	struct nputest_bench	*bench;
+	u64			start_ns;
+};
+
+struct nputest_bench {
+	struct completion	comp;
+	u64			*lat_ns;
+	struct nputest_bench_msg *msgs;
+};
+
+static int test_case04_cb(void *handle, void __iomem *data, size_t size)
+{
+	struct nputest_bench_msg *bmsg = handle;
+	struct nputest_bench *bench = bmsg->bench;
+
+	bench->lat_ns[bmsg - bench->msgs] = ktime_get_ns() - bmsg->start_ns;
+	complete(&bench->comp);
+	return 0;
+}
+
+static int nputest_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Look up mailbox channel of context ctx_id. Caller holds dev_lock and
+ * aie2_lock, the latter keeps the channel from being torn down, srcu read
+ * lock returned in idx keeps the context alive.
+ */
+static struct mailbox_channel *
+nputest_ctx_chann(struct amdxdna_dev *xdna, u32 ctx_id,
+		  struct amdxdna_client **client, int *idx)
+{
+	struct amdxdna_client *tmp_client;
+	struct amdxdna_ctx *ctx;
+	unsigned long id;
+
+	list_for_each_entry(tmp_client, &xdna->client_list, node) {
+		*idx = srcu_read_lock(&tmp_client->ctx_srcu);
+		amdxdna_for_each_ctx(tmp_client, id, ctx) {
+			if (ctx->id == ctx_id && ctx->priv && ctx->priv->mbox_chann) {
+				*client = tmp_client;
+				return ctx->priv->mbox_chann;
+			}
+		}
+		srcu_read_unlock(&tmp_client->ctx_srcu, *idx);
+	}
+	return NULL;
+}
+
+/*
+ * Round-trip benchmark of echo messages, keeping up to depth of them in
+ * flight on the channel. Measures mailbox and firmware cost without ioctl
+ * and scheduler overhead in the way.
+ */
+static int test_case04_run(struct amdxdna_dev_hdl *ndev, struct mailbox_channel *chann,
+			   u32 cnt, u32 depth, u32 req_size)
+{
+	struct nputest_bench bench;
+	u64 start, total_ns;
+	u32 sent, done, i;
+	u32 *data;
+	int ret = 0;
+
+	data = kcalloc(req_size, sizeof(u32), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+	/* Shortest response, data[0] is response length in words */
+	data[0] = 1;
+
+	init_completion(&bench.comp);
+	bench.lat_ns = kvcalloc(cnt, sizeof(*bench.lat_ns), GFP_KERNEL);
+	bench.msgs = kvcalloc(cnt, sizeof(*bench.msgs), GFP_KERNEL);
+	if (!bench.lat_ns || !bench.msgs) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		bench.msgs[i].bench = &bench;
+		bench.msgs[i].msg.opcode = NPUTEST_ECHO_OPCODE;
+		bench.msgs[i].msg.handle = &bench.msgs[i];
+		bench.msgs[i].msg.notify_cb = test_case04_cb;
+		bench.msgs[i].msg.send_data = (u8 *)data;
+		bench.msgs[i].msg.send_size = req_size * sizeof(u32);
+	}
+
+	start = ktime_get_ns();
+	for (sent = 0, done = 0; done < cnt; done++) {
+		while (sent < cnt && sent - done < depth) {
+			bench.msgs[sent].start_ns = ktime_get_ns();
+			ret = xdna_mailbox_send_msg(chann, &bench.msgs[sent].msg, TX_TIMEOUT);
+			if (ret) {
+				XDNA_ERR(ndev->xdna, "Send message %d failed, ret %d", sent, ret);
+				goto drain;
+			}
+			sent++;
+		}
+		if (!wait_for_completion_timeout(&bench.comp, msecs_to_jiffies(RX_TIMEOUT)))
+			goto timeout;
+	}
+	total_ns = ktime_get_ns() - start;
+
+	sort(bench.lat_ns, cnt, sizeof(*bench.lat_ns), nputest_cmp_u64, NULL);
+	XDNA_INFO(ndev->xdna, "%u msgs depth %u in %llu us, %llu msgs/sec",
+		  cnt, depth, div_u64(total_ns, NSEC_PER_USEC),
+		  div64_u64((u64)cnt * NSEC_PER_SEC, max_t(u64, total_ns, 1)));
+	XDNA_INFO(ndev->xdna, "latency ns: min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu",
+		  bench.lat_ns[0], bench.lat_ns[cnt / 2],
+		  bench.lat_ns[div_u64((u64)cnt * 90, 100)],
+		  bench.lat_ns[div_u64((u64)cnt * 99, 100)],
+		  bench.lat_ns[div_u64((u64)cnt * 999, 1000)],
+		  bench.lat_ns[cnt - 1]);
+	goto free;
+
+drain:
+	/* Messages already sent still reference bench */
+	for (; done < sent; done++) {
+		if (!wait_for_completion_timeout(&bench.comp, msecs_to_jiffies(RX_TIMEOUT)))
+			goto timeout;
+	}
+	goto free;
+
+timeout:
+	/* Late responses would still write to bench, leak it rather than crash */
+	XDNA_ERR(ndev->xdna, "wait for completion timeout, %d msgs outstanding", sent - done);
+	return -ETIME;
+
+free:
+	kvfree(bench.msgs);
+	kvfree(bench.lat_ns);
+	kfree(data);
+	return ret;
+}
+
+static int test_case04(struct amdxdna_dev_hdl *ndev, u32 argc, const u32 *args)
+{
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct amdxdna_client *client = NULL;
+	struct mailbox_channel *chann;
+	u32 cnt, depth, req_size = 2;
+	int idx = 0;
+	int ret;
+
+	if (argc < 4) {
+		XDNA_ERR(xdna, "Too few parameters");
+		return -EINVAL;
+	}
+
+	cnt = args[2];
+	depth = args[3];
+	if (argc >= 5)
+		req_size = args[4];
+
+	if (!cnt || cnt > 0x100000) {
+		XDNA_ERR(xdna, "Invalid message count %d", cnt);
+		return -EINVAL;
+	}
+	if (!depth) {
+		XDNA_ERR(xdna, "Invalid depth %d", depth);
+		return -EINVAL;
+	}
+	if (req_size < 2 || req_size > 0x400) {
+		XDNA_ERR(xdna, "Invalid request size %d", req_size);
+		return -EINVAL;
+	}
+
+	mutex_lock(&xdna->dev_lock);
+	mutex_lock(&ndev->aie2_lock);
+	if (!args[1]) {
+		chann = ndev->mgmt_chann;
+	} else {
+		chann = nputest_ctx_chann(xdna, args[1], &client, &idx);
+		if (!chann)
+			XDNA_ERR(xdna, "Context %d not found or not running", args[1]);
+	}
+
+	ret = chann ? test_case04_run(ndev, chann, cnt, depth, req_size) : -EINVAL;
+
+	if (client)
+		srcu_read_unlock(&client->ctx_srcu, idx);
+	mutex_unlock(&ndev->aie2_lock);
+	mutex_unlock(&xdna->dev_lock);
+	return ret;
+}
+
 #define NPUTEST_MAX_PARAM 5
 static ssize_t aie2_dbgfs_nputest(struct file *file, const char __user *ptr,
 				  size_t len, loff_t *off)
@@ -351,6 +571,12 @@ static ssize_t aie2_dbgfs_nputest(struct file *file, const char __user *ptr,
 	}
 	XDNA_DBG(ndev->xdna, "Got %d parameters\n", argc);
 
+	/* Takes dev_lock, which must be taken before aie2_lock */
+	if (args[0] == 4) {
+		ret = test_case04(ndev, argc, args);
+		goto free_and_out;
+	}
+
 	mutex_lock(&ndev->aie2_lock);
 	/* args[0] is test case ID */
 	switch (args[0]) {
@@ -377,7 +603,7 @@ static int aie2_dbgfs_nputest_show(struct seq_file *m, void *unused)
 {
 	seq_puts(m, "nputest usage:\n");
 	seq_puts(m, "\techo id [args] > <debugfs_path>/dri/<render_id>/nputest\n");
-	seq_puts(m, "\t\tid - test case id (1 - 2), bad id will be ignore\n");
+	seq_puts(m, "\t\tid - test case id (1 - 4), bad id will be ignore\n");
 	seq_puts(m, "\t\targs - arguments for test case, optional\n");
 	seq_puts(m, "\n");
 	seq_puts(m, "test case 1 usage:\n");
@@ -389,6 +615,13 @@ static int aie2_dbgfs_nputest_show(struct seq_file *m, void *unused)
 	seq_puts(m, "\t\tresp_len - response length in words (1 - 28)\n");
 	seq_puts(m, "\t\tpattern - data to fill message and response\n");
 	seq_puts(m, "\t\tcnt - send cnt messages without wait, optional (default 1)\n");
+	seq_puts(m, "\n");
+	seq_puts(m, "test case 4 usage (mailbox round-trip benchmark, result in dmesg):\n");
+	seq_puts(m, "\techo 4 ctx_id cnt depth [msg_len] > <nputest file>\n");
+	seq_puts(m, "\t\tctx_id - 0 for management channel, otherwise context ID\n");
+	seq_puts(m, "\t\tcnt - number of echo messages (1 - 1048576)\n");
+	seq_puts(m, "\t\tdepth - max messages in flight\n");
+	seq_puts(m, "\t\tmsg_len - messge length in words (2 - 1024), optional (default 2)\n");
 
 	return 0;
 }
@@ -417,6 +650,7 @@ seq_printf(m, "%ld:%s\n", _name, #_name)
 	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_SYNC_BO);
 	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_EXEC_CMD);
 	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_WAIT_CMD);
+	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_WAIT_CMDS);
 	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_GET_INFO);
 	drm_ioctl_id_seq_print(DRM_IOCTL_AMDXDNA_SET_STATE);
 
@@ -444,39 +678,31 @@ static int aie2_msg_queue_show(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(msg_queue, aie2_msg_queue_show, NULL);
 
+static int aie2_msg_latency_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	return xdna_mailbox_latency_show(ndev->mbox, m);
+}
+
+AIE2_DBGFS_FOPS(msg_latency, aie2_msg_latency_show, NULL);
+
 static int aie2_telemetry(struct seq_file *m, u32 type)
 {
 	struct amdxdna_dev_hdl *ndev = m->private;
-	struct amdxdna_dev *xdna = ndev->xdna;
-	struct amdxdna_mgmt_dma_hdl *dma_hdl;
-	const size_t size = SZ_8K;
+	const size_t size = AIE2_TELEMETRY_CACHE_SIZE;
 	void *buff;
 	int ret;
 
-	dma_hdl = amdxdna_mgmt_buff_alloc(xdna, size, DMA_FROM_DEVICE);
-	if (IS_ERR(dma_hdl))
-		return PTR_ERR(dma_hdl);
-
-	amdxdna_mgmt_buff_clflush(dma_hdl, 0, 0);
-	mutex_lock(&ndev->aie2_lock);
-	ret = aie2_query_aie_telemetry(ndev, dma_hdl, type, size, NULL);
-	mutex_unlock(&ndev->aie2_lock);
-	if (ret) {
-		XDNA_ERR(xdna, "Get telemetry failed ret %d", ret);
-		goto free_buf;
-	}
-
-	buff = amdxdna_mgmt_buff_get_cpu_addr(dma_hdl, 0);
-	if (IS_ERR(buff)) {
-		XDNA_ERR(xdna, "Failed to get CPU address for telemetry buffer");
-		ret = PTR_ERR(buff);
-		goto free_buf;
-	}
+	buff = kzalloc(size, GFP_KERNEL);
+	if (!buff)
+		return -ENOMEM;
 
-	seq_write(m, buff, size);
+	ret = aie2_telemetry_read(ndev, type, buff, size, NULL, false);
+	if (!ret)
+		seq_write(m, buff, size);
 
-free_buf:
-	amdxdna_mgmt_buff_free(dma_hdl);
+	kfree(buff);
 	return ret;
 }
 
@@ -703,6 +929,137 @@ static int aie2_dump_fw_trace_buffer_get(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(dump_fw_trace_buffer, aie2_dump_fw_trace_buffer_get, NULL);
 
+/*
+ * The ring files are created without the debugfs file proxy, which does not forward
+ * mmap. Guard against removal by hand instead.
+ */
+static int aie2_dbgfs_ring_mmap(struct file *file, struct vm_area_struct *vma, bool trace)
+{
+	struct amdxdna_dev_hdl *ndev = file->private_data;
+	int ret;
+
+	ret = debugfs_file_get(file->f_path.dentry);
+	if (ret)
+		return ret;
+
+	ret = amdxdna_dpt_mmap(ndev->xdna, trace, vma);
+	debugfs_file_put(file->f_path.dentry);
+	return ret;
+}
+
+static int aie2_fw_log_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return aie2_dbgfs_ring_mmap(file, vma, false);
+}
+
+static int aie2_fw_trace_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return aie2_dbgfs_ring_mmap(file, vma, true);
+}
+
+static const struct file_operations aie2_fops_fw_log_ring = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.mmap = aie2_fw_log_ring_mmap,
+	.llseek = noop_llseek,
+};
+
+static const struct file_operations aie2_fops_fw_trace_ring = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.mmap = aie2_fw_trace_ring_mmap,
+	.llseek = noop_llseek,
+};
+
+static int aie2_hmm_stats_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	seq_printf(m, "invalidations %lld\n", atomic64_read(&ndev->hmm_inval_cnt));
+	seq_printf(m, "repopulations %lld\n", atomic64_read(&ndev->hmm_populate_cnt));
+	seq_printf(m, "repopulated_bytes %lld\n", atomic64_read(&ndev->hmm_populate_bytes));
+	seq_printf(m, "repopulate_ns %lld\n", atomic64_read(&ndev->hmm_populate_ns));
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(hmm_stats, aie2_hmm_stats_show, NULL);
+
+static int aie2_rpm_stats_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	amdxdna_pm_rpm_show(ndev->xdna, m);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(rpm_stats, aie2_rpm_stats_show, NULL);
+
+static int aie2_resume_latency_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+	struct aie2_resume_stats st;
+
+	mutex_lock(&ndev->xdna->dev_lock);
+	st = ndev->resume_stats;
+	mutex_unlock(&ndev->xdna->dev_lock);
+
+	seq_printf(m, "count %llu\n", st.cnt);
+	seq_printf(m, "last_us %llu\n", div_u64(st.last_ns, NSEC_PER_USEC));
+	seq_printf(m, "last_hw_start_us %llu\n", div_u64(st.last_hw_ns, NSEC_PER_USEC));
+	seq_printf(m, "avg_us %llu\n",
+		   st.cnt ? div64_u64(st.total_ns, st.cnt) / NSEC_PER_USEC : 0);
+	seq_printf(m, "max_us %llu\n", div_u64(st.max_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(resume_latency, aie2_resume_latency_show, NULL);
+
+static int aie2_bringup_latency_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+	struct aie2_bringup_stats st;
+
+	mutex_lock(&ndev->xdna->dev_lock);
+	st = ndev->bringup_stats;
+	mutex_unlock(&ndev->xdna->dev_lock);
+
+	seq_printf(m, "probe_us %llu\n", div_u64(st.probe_ns, NSEC_PER_USEC));
+	seq_printf(m, "pci_setup_us %llu\n", div_u64(st.pci_setup_ns, NSEC_PER_USEC));
+	seq_printf(m, "fw_request_us %llu\n", div_u64(st.fw_request_ns, NSEC_PER_USEC));
+	seq_printf(m, "psp_create_us %llu\n", div_u64(st.psp_create_ns, NSEC_PER_USEC));
+	seq_printf(m, "smu_start_us %llu\n", div_u64(st.smu_start_ns, NSEC_PER_USEC));
+	seq_printf(m, "psp_start_us %llu\n", div_u64(st.psp_start_ns, NSEC_PER_USEC));
+	seq_printf(m, "mgmt_init_us %llu\n", div_u64(st.mgmt_init_ns, NSEC_PER_USEC));
+	seq_printf(m, "pm_init_us %llu\n", div_u64(st.pm_init_ns, NSEC_PER_USEC));
+	seq_printf(m, "fw_query_us %llu\n", div_u64(st.fw_query_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(bringup_latency, aie2_bringup_latency_show, NULL);
+
+static int aie2_heap_frag_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct amdxdna_client *client;
+
+	mutex_lock(&xdna->dev_lock);
+	list_for_each_entry(client, &xdna->client_list, node)
+		amdxdna_gem_heap_show(client, m);
+	mutex_unlock(&xdna->dev_lock);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(heap_frag, aie2_heap_frag_show, NULL);
+
+static int aie2_job_cache_show(struct seq_file *m, void *unused)
+{
+	amdxdna_job_cache_show(m);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(job_cache, aie2_job_cache_show, NULL);
+
 const struct {
 	const char *name;
 	const struct file_operations *fops;
@@ -712,8 +1069,10 @@ const struct {
 	AIE2_DBGFS_FILE(pasid, 0600),
 	AIE2_DBGFS_FILE(powerstate, 0600),
 	AIE2_DBGFS_FILE(dpm_level, 0600),
+	AIE2_DBGFS_FILE(dpm_residency, 0400),
 	AIE2_DBGFS_FILE(ringbuf, 0400),
 	AIE2_DBGFS_FILE(msg_queue, 0400),
+	AIE2_DBGFS_FILE(msg_latency, 0400),
 	AIE2_DBGFS_FILE(ioctl_id, 0400),
 	AIE2_DBGFS_FILE(telemetry_disabled, 0400),
 	AIE2_DBGFS_FILE(telemetry_health, 0400),
@@ -721,6 +1080,12 @@ const struct {
 	AIE2_DBGFS_FILE(telemetry_profiling, 0400),
 	AIE2_DBGFS_FILE(telemetry_debug, 0400),
 	AIE2_DBGFS_FILE(ctx_rq, 0400),
+	AIE2_DBGFS_FILE(hmm_stats, 0400),
+	AIE2_DBGFS_FILE(rpm_stats, 0400),
+	AIE2_DBGFS_FILE(resume_latency, 0400),
+	AIE2_DBGFS_FILE(bringup_latency, 0400),
+	AIE2_DBGFS_FILE(heap_frag, 0400),
+	AIE2_DBGFS_FILE(job_cache, 0400),
 	AIE2_DBGFS_FILE(get_app_health, 0400),
 	AIE2_DBGFS_FILE(dump_fw_log, 0600),
 	AIE2_DBGFS_FILE(dump_fw_log_buffer, 0400),
@@ -728,6 +1093,14 @@ const struct {
 	AIE2_DBGFS_FILE(dump_fw_trace_buffer, 0400),
 };
 
+static const struct {
+	const char *name;
+	const struct file_operations *fops;
+} aie2_dbgfs_ring_files[] = {
+	{ "fw_log_ring", &aie2_fops_fw_log_ring },
+	{ "fw_trace_ring", &aie2_fops_fw_trace_ring },
+};
+
 void aie2_debugfs_init(struct amdxdna_dev *xdna)
 {
 	struct drm_minor *minor = xdna->ddev.accel;
@@ -747,6 +1120,12 @@ void aie2_debugfs_init(struct amdxdna_dev *xdna)
 				    xdna->dev_handle,
 				    aie2_dbgfs_files[i].fops);
 	}
+
+	for (i = 0; i < ARRAY_SIZE(aie2_dbgfs_ring_files); i++) {
+		debugfs_create_file_unsafe(aie2_dbgfs_ring_files[i].name, 0400,
+					   minor->debugfs_root, xdna->dev_handle,
+					   aie2_dbgfs_ring_files[i].fops);
+	}
 }
 #else
 void aie2_debugfs_init(struct amdxdna_dev *xdna)
@@ -6,10 +6,38 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/dma-mapping.h>
+#include <linux/ratelimit.h>
 #include <drm/drm_cache.h>
 #include "aie2_msg_priv.h"
 #include "aie2_pci.h"
 
+static uint async_err_ratelimit = 100;
+module_param(async_err_ratelimit, uint, 0444);
+MODULE_PARM_DESC(async_err_ratelimit,
+		 "AIE async errors recorded per second, default 100; 0 - No limit");
+
+/*
+ * Async errors are kept in a ring of AIE2_ERR_RING_SIZE entries. The only
+ * writer is the ordered async event workqueue; readers do not take a lock.
+ * Entry seq is cleared while the entry is written and set last, so a reader
+ * which sees the same seq before and after copying has a consistent entry.
+ */
+#define AIE2_ERR_RING_SIZE	256
+#define AIE2_ERR_RING_MASK	(AIE2_ERR_RING_SIZE - 1)
+/* Errors are reported by column, same assumption as aie2_error_backtrack() */
+#define AIE2_ERR_MAX_COL	32
+
+struct aie2_err_ring {
+	/* Seq of the newest entry, 0 if none */
+	atomic64_t			head;
+	struct ratelimit_state		rs;
+	/* Errors dropped by rate limit since the last recorded one */
+	u32				dropped;
+	/* Context running on each column, pid << 32 | context handle */
+	u64				col_owner[AIE2_ERR_MAX_COL];
+	struct amdxdna_async_error_entry entry[AIE2_ERR_RING_SIZE];
+};
+
 struct async_event {
 	struct amdxdna_dev_hdl		*ndev;
 	struct async_event_msg_resp	resp;
@@ -221,47 +249,124 @@ aie_get_error_category(u8 row, u8 event_id, enum aie_module_type mod_type)
 	return AIE_ERROR_UNKNOWN;
 }
 
-static void aie2_async_errors_cache(struct amdxdna_dev_hdl *ndev, void *err_info, u32 num_err)
+static void aie2_error_ring_push(struct aie2_err_ring *ring, struct aie_error *err,
+				enum aie_error_category cat)
 {
-	struct amdxdna_async_error *record = &ndev->async_errs_cache.err;
-	u64 current_time_us = ktime_to_us(ktime_get_real());
-	struct aie_error *errs = err_info;
-	enum amdxdna_error_module amdxdna_err_mod;
-	enum amdxdna_error_num err_num;
-	struct aie_error *err;
-	u64 err_code;
-
-	/* Cache the last async error only */
-	err = &errs[num_err - 1];
-	err_num = aie_err_cat_get_amdxdna_err_num(aie_get_error_category(err->row, err->event_id,
-									 err->mod_type));
-	amdxdna_err_mod = aie_get_amdxdna_error_mod(err->mod_type);
-	err_code = AMDXDNA_CRITICAL_ERROR_CODE_BUILD(err_num, amdxdna_err_mod);
-
-	mutex_lock(&ndev->async_errs_cache.lock);
-	record->ts_us = current_time_us;
-	record->err_code = err_code;
-	// Record tile location for last error
-	record->ex_err_code = AMDXDNA_ERROR_EXTRA_CODE_BUILD(err->row, err->col);
-
-	mutex_unlock(&ndev->async_errs_cache.lock);
+	struct amdxdna_async_error_entry *e;
+	u64 owner = 0;
+	u64 seq;
+
+	if (err->col < AIE2_ERR_MAX_COL)
+		owner = READ_ONCE(ring->col_owner[err->col]);
+
+	seq = atomic64_read(&ring->head) + 1;
+	e = &ring->entry[seq & AIE2_ERR_RING_MASK];
+	WRITE_ONCE(e->seq, 0);
+	smp_wmb(); /* Invalidate the entry before changing it */
+	e->err_code = AMDXDNA_CRITICAL_ERROR_CODE_BUILD(aie_err_cat_get_amdxdna_err_num(cat),
+							aie_get_amdxdna_error_mod(err->mod_type));
+	e->ts_us = ktime_to_us(ktime_get_real());
+	e->ex_err_code = AMDXDNA_ERROR_EXTRA_CODE_BUILD(err->row, err->col);
+	e->pid = owner >> 32;
+	e->ctx_id = lower_32_bits(owner);
+	e->dropped = ring->dropped;
+	smp_wmb(); /* Publish the entry after it is complete */
+	WRITE_ONCE(e->seq, seq);
+	atomic64_set_release(&ring->head, seq);
+	ring->dropped = 0;
+}
+
+static bool aie2_error_ring_copy(struct aie2_err_ring *ring, u64 seq,
+				 struct amdxdna_async_error_entry *out)
+{
+	struct amdxdna_async_error_entry *e = &ring->entry[seq & AIE2_ERR_RING_MASK];
+
+	if (READ_ONCE(e->seq) != seq)
+		return false;
+	smp_rmb(); /* Read seq before the entry */
+	memcpy(out, e, sizeof(*out));
+	smp_rmb(); /* Read the entry before checking seq again */
+	return READ_ONCE(e->seq) == seq && out->seq == seq;
+}
+
+/*
+ * aie2_error_ring_read - Copy async errors starting from seq into entries
+ *
+ * seq 0 starts from the oldest error in the ring. Entries overwritten by the
+ * writer while being read are skipped, which shows as a gap of seq.
+ *
+ * Return: number of entries copied.
+ */
+u32 aie2_error_ring_read(struct amdxdna_dev_hdl *ndev, u64 seq,
+			 struct amdxdna_async_error_entry *entries, u32 num)
+{
+	struct aie2_err_ring *ring = ndev->err_ring;
+	u64 head, oldest;
+	u32 cnt = 0;
+
+	head = atomic64_read_acquire(&ring->head);
+	oldest = head > AIE2_ERR_RING_SIZE ? head - AIE2_ERR_RING_SIZE + 1 : 1;
+	seq = max(seq, oldest);
+	for (; seq <= head && cnt < num; seq++) {
+		if (aie2_error_ring_copy(ring, seq, &entries[cnt]))
+			cnt++;
+	}
+
+	return cnt;
+}
+
+void aie2_error_set_owner(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *ctx, bool connect)
+{
+	struct aie2_err_ring *ring = ndev->err_ring;
+	u64 owner = 0;
+	u32 col;
+
+	if (connect)
+		owner = (u64)ctx->client->pid << 32 | ctx->id;
+
+	for (col = ctx->start_col; col < ctx->start_col + ctx->num_col; col++) {
+		if (col >= AIE2_ERR_MAX_COL)
+			break;
+		WRITE_ONCE(ring->col_owner[col], owner);
+	}
+}
+
+int aie2_error_ring_init(struct amdxdna_dev_hdl *ndev)
+{
+	struct aie2_err_ring *ring;
+
+	ring = devm_kzalloc(ndev->xdna->ddev.dev, sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	atomic64_set(&ring->head, 0);
+	ratelimit_state_init(&ring->rs, HZ, async_err_ratelimit);
+	ratelimit_set_flags(&ring->rs, RATELIMIT_MSG_ON_RELEASE);
+	ndev->err_ring = ring;
+	return 0;
 }
 
 static u32 aie2_error_backtrack(struct amdxdna_dev_hdl *ndev, void *err_info, u32 num_err)
 {
+	struct aie2_err_ring *ring = ndev->err_ring;
 	struct aie_error *errs = err_info;
 	u32 err_col = 0; /* assume that AIE has less than 32 columns */
 	int i;
 
-	/* Get err column bitmap */
+	/* Get err column bitmap, record and print errors within rate limit */
 	for (i = 0; i < num_err; i++) {
 		struct aie_error *err = &errs[i];
 		enum aie_error_category cat;
 
 		cat = aie_get_error_category(err->row, err->event_id, err->mod_type);
-		XDNA_ERR(ndev->xdna, "Row: %d, Col: %d, module %d, event ID %d, category %d",
-			 err->row, err->col, err->mod_type,
-			 err->event_id, cat);
+		if (!async_err_ratelimit || __ratelimit(&ring->rs)) {
+			aie2_error_ring_push(ring, err, cat);
+			XDNA_ERR(ndev->xdna, "Row: %d, Col: %d, module %d, event ID %d, category %d",
+				 err->row, err->col, err->mod_type,
+				 err->event_id, cat);
+		} else {
+			ring->dropped++;
+		}
 
 		if (err->col >= 32) {
 			/* If you see this, contact NPU firmware team */
@@ -334,8 +439,6 @@ static void aie2_error_worker(struct work_struct *err_work)
 		return;
 	}
 
-	aie2_async_errors_cache(e->ndev, info->payload, info->err_cnt);
-
 	mutex_lock(&xdna->dev_handle->aie2_lock);
 	/* Re-sent this event to firmware */
 	if (aie2_error_event_send(e))
@@ -427,41 +530,35 @@ free_events:
 }
 
 /**
- * amdxdna_aie2_get_last_async_error - Retrieve the last asynchronous error information.
- * @xdna: Pointer to the xdna structure, it is used when printing function related information
- * @err_cache: async errors cache
+ * aie2_error_get_last_async - Retrieve the last asynchronous error information.
+ * @ndev: Pointer to the device handle
  * @num_errs: Number of error structures to populate.
  * @errors: errors array for returning errors information.
  *
- * This function obtains the most recent asynchronous error that occurred
- * in the xdna subsystem and populates the provided error information structure.
- * It is typically used for error handling and diagnostics in the driver.
- * Today, only one last async error is cached. And thus, this function will only
- * return 1 last async error.
+ * This returns the newest error of the async error ring in the legacy
+ * struct amdxdna_async_error format. Use aie2_error_ring_read() for all of
+ * the errors and their context.
  *
- * Return: number of cached last errors, max is 1, negative error code on failure.
+ * Return: number of last errors, max is 1, negative error code on failure.
  */
-int aie2_error_get_last_async(struct amdxdna_dev *xdna,
-			      struct amdxdna_async_err_cache *err_cache, u32 num_errs,
-			      void *errors)
+int aie2_error_get_last_async(struct amdxdna_dev_hdl *ndev, u32 num_errs,
+			      struct amdxdna_async_error *errors)
 {
-	struct amdxdna_async_error *cached_last_err = &err_cache->err;
+	struct amdxdna_async_error_entry e;
+	u64 head;
 
 	if (num_errs == 0 || !errors) {
-		XDNA_ERR(xdna,
+		XDNA_ERR(ndev->xdna,
 			 "get last async failed due to invalid input num_errors or empty errors array.");
 		return -EINVAL;
 	}
 
-	/* Retrieve the last async error information */
-	mutex_lock(&err_cache->lock);
-	if (!cached_last_err->err_code) {
-		mutex_unlock(&err_cache->lock);
+	head = atomic64_read_acquire(&ndev->err_ring->head);
+	if (!head || !aie2_error_ring_read(ndev, head, &e, 1))
 		return 0;
-	}
-
-	memcpy(errors, cached_last_err, sizeof(*cached_last_err));
-	mutex_unlock(&err_cache->lock);
 
+	errors->err_code = e.err_code;
+	errors->ts_us = e.ts_us;
+	errors->ex_err_code = e.ex_err_code;
 	return 1;
 }
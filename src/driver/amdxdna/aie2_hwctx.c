@@ -7,6 +7,7 @@
 #include "amdxdna_mailbox.h"
 #include "amdxdna_trace.h"
 #include "aie2_pci.h"
+#include "aie2_msg_priv.h"
 
 #ifdef AMDXDNA_DEVEL
 #include "amdxdna_devel.h"
@@ -14,6 +15,11 @@
 
 extern const struct drm_sched_backend_ops sched_ops;
 
+static bool park_sched = true;
+module_param(park_sched, bool, 0600);
+MODULE_PARM_DESC(park_sched,
+		 "Keep DRM scheduler of idle disconnected context for next connect (Default true)");
+
 static int aie2_load_hwctx(struct amdxdna_ctx *ctx)
 {
 	enum xdna_mailbox_channel_type type;
@@ -21,6 +27,7 @@ static int aie2_load_hwctx(struct amdxdna_ctx *ctx)
 	struct amdxdna_dev_hdl *ndev;
 	struct amdxdna_dev *xdna;
 	void *mbox_chann;
+	u32 ring_cmds;
 	int ret;
 
 	xdna = ctx->client->xdna;
@@ -42,6 +49,17 @@ static int aie2_load_hwctx(struct amdxdna_ctx *ctx)
 		goto failed;
 	}
 
+	xdna_mailbox_set_flush_cb(mbox_chann, aie2_sched_notify_flush, ctx);
+	/*
+	 * Rings are sized by firmware, nothing in create context asks for a size.
+	 * Tell when the ring can't hold all cmds in flight, sending those may have
+	 * to wait for firmware to drain it.
+	 */
+	ring_cmds = xdna_mailbox_x2i_capacity(mbox_chann,
+					      max(sizeof(union exec_req), sizeof(struct exec_npu_req)));
+	if (ring_cmds < ctx->priv->depth)
+		XDNA_DBG(xdna, "%s X2I ring holds %d cmds, queue depth %d",
+			 ctx->name, ring_cmds, ctx->priv->depth);
 	trace_amdxdna_debug_point(ctx->name, ret, "channel created");
 	XDNA_DBG(xdna, "%s mailbox channel irq: %d, msix_id: %d",
 		 ctx->name, ret, info.msix_id);
@@ -81,7 +99,7 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 	const struct drm_sched_init_args args = {
 		.ops = &sched_ops,
 		.num_rqs = DRM_SCHED_PRIORITY_COUNT,
-		.credit_limit = CTX_MAX_CMDS,
+		.credit_limit = ctx->priv->depth,
 		.timeout = MAX_SCHEDULE_TIMEOUT,
 		.name = ctx->name,
 		.dev = xdna->ddev.dev,
@@ -98,11 +116,16 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 	heap = ctx->priv->heap;
 
 	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
+	if (ctx->priv->sched_parked) {
+		ctx->priv->sched_parked = false;
+		goto load_hwctx;
+	}
+
 #ifdef HAVE_6_15_drm_sched_init
 	ret = drm_sched_init(sched, &args);
 #else
 	ret = drm_sched_init(sched, &sched_ops, NULL, DRM_SCHED_PRIORITY_COUNT,
-			     CTX_MAX_CMDS, 0, MAX_SCHEDULE_TIMEOUT,
+			     ctx->priv->depth, 0, MAX_SCHEDULE_TIMEOUT,
 			     NULL, NULL, ctx->name, xdna->ddev.dev);
 #endif
 	if (ret) {
@@ -117,6 +140,7 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 		goto fini_sched;
 	}
 
+load_hwctx:
 	ret = aie2_load_hwctx(ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "Alloc hw resource failed, ret %d", ret);
@@ -141,6 +165,7 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 	}
 
 	ndev->hwctx_cnt++;
+	aie2_error_set_owner(ndev, ctx, true);
 	return 0;
 
 unload_hwctx:
@@ -152,15 +177,43 @@ fini_sched:
 	return ret;
 }
 
-void aie2_hwctx_stop(struct amdxdna_ctx *ctx)
+/*
+ * Firmware can't save a context to host memory, so disconnecting always
+ * destroys it on device. With park, which the caller asks for only when all
+ * jobs of the context are done, the DRM scheduler and entity are kept, so
+ * that connecting again costs firmware messages only, not creating and
+ * destroying a scheduler and its workqueue every time.
+ */
+void aie2_hwctx_stop(struct amdxdna_ctx *ctx, bool park)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 
 	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&xdna->dev_handle->aie2_lock));
-	drm_sched_entity_destroy(&ctx->priv->entity);
+	park = park && park_sched;
+	aie2_error_set_owner(xdna->dev_handle, ctx, false);
+	if (!park)
+		drm_sched_entity_destroy(&ctx->priv->entity);
 	aie2_unload_hwctx(ctx);
+	xdna->dev_handle->hwctx_cnt--;
+	if (park) {
+		ctx->priv->sched_parked = true;
+		return;
+	}
+
 	wait_event(ctx->priv->job_free_waitq,
 		   (ctx->submitted == atomic64_read(&ctx->job_free_cnt)));
 	drm_sched_fini(&ctx->priv->sched);
-	xdna->dev_handle->hwctx_cnt--;
+}
+
+/* Free scheduler kept by aie2_hwctx_stop(), context is disconnected */
+void aie2_hwctx_unpark(struct amdxdna_ctx *ctx)
+{
+	if (!ctx->priv->sched_parked)
+		return;
+
+	drm_sched_entity_destroy(&ctx->priv->entity);
+	wait_event(ctx->priv->job_free_waitq,
+		   (ctx->submitted == atomic64_read(&ctx->job_free_cnt)));
+	drm_sched_fini(&ctx->priv->sched);
+	ctx->priv->sched_parked = false;
 }
@@ -47,22 +47,45 @@ is_supported_rt_cfg(struct amdxdna_dev_hdl *ndev, u32 type)
 	return false;
 }
 
-static int aie2_send_mgmt_msg_wait(struct amdxdna_dev_hdl *ndev,
-				   struct xdna_mailbox_msg *msg)
+/*
+ * Firmware not answering in time is taken as dead, channel is torn down.
+ * Caller holds aie2_lock, messages in flight by others hold mgmt_sem.
+ */
+static void aie2_mgmt_chann_timeout(struct amdxdna_dev_hdl *ndev, struct mailbox_channel *chann)
+{
+	down_write(&ndev->mgmt_sem);
+	/* Somebody else may have timed out on it as well */
+	if (ndev->mgmt_chann == chann) {
+		xdna_mailbox_stop_channel(chann);
+		xdna_mailbox_destroy_channel(chann);
+		ndev->mgmt_chann = NULL;
+	}
+	up_write(&ndev->mgmt_sem);
+}
+
+static int __aie2_send_mgmt_msg_wait(struct amdxdna_dev_hdl *ndev,
+				     struct xdna_mailbox_msg *msg, bool locked)
 {
 	struct amdxdna_dev *xdna = ndev->xdna;
 	struct xdna_notify *hdl = msg->handle;
+	struct mailbox_channel *chann;
 	int ret;
 
-	if (!ndev->mgmt_chann)
+	down_read(&ndev->mgmt_sem);
+	chann = ndev->mgmt_chann;
+	if (!chann) {
+		up_read(&ndev->mgmt_sem);
 		return -ENODEV;
+	}
 
-	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
-	ret = xdna_send_msg_wait(xdna, ndev->mgmt_chann, msg);
+	ret = xdna_send_msg_wait(xdna, chann, msg);
+	up_read(&ndev->mgmt_sem);
 	if (ret == -ETIME) {
-		xdna_mailbox_stop_channel(ndev->mgmt_chann);
-		xdna_mailbox_destroy_channel(ndev->mgmt_chann);
-		ndev->mgmt_chann = NULL;
+		if (!locked)
+			mutex_lock(&ndev->aie2_lock);
+		aie2_mgmt_chann_timeout(ndev, chann);
+		if (!locked)
+			mutex_unlock(&ndev->aie2_lock);
 	}
 
 	if (!ret && *hdl->status != AIE2_STATUS_SUCCESS) {
@@ -74,6 +97,24 @@ static int aie2_send_mgmt_msg_wait(struct amdxdna_dev_hdl *ndev,
 	return ret;
 }
 
+static int aie2_send_mgmt_msg_wait(struct amdxdna_dev_hdl *ndev,
+				   struct xdna_mailbox_msg *msg)
+{
+	drm_WARN_ON(&ndev->xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
+	return __aie2_send_mgmt_msg_wait(ndev, msg, true);
+}
+
+/*
+ * For messages touching no state protected by aie2_lock. Caller must not
+ * hold aie2_lock, messages sent this way don't wait for each other or for
+ * the ones sent under aie2_lock.
+ */
+static int aie2_send_mgmt_msg_wait_unlocked(struct amdxdna_dev_hdl *ndev,
+					    struct xdna_mailbox_msg *msg)
+{
+	return __aie2_send_mgmt_msg_wait(ndev, msg, false);
+}
+
 bool aie2_is_supported_msg(struct amdxdna_dev_hdl *ndev, enum aie2_msg_opcode opcode)
 {
 	const struct msg_op_ver *op_tbl;
@@ -197,6 +238,27 @@ int aie2_frame_boundary_preemption(struct amdxdna_dev_hdl *ndev, bool enable)
 		return ret;
 
 	ndev->frame_boundary_preempt = enable;
+	ndev->frame_boundary_active = enable;
+	return 0;
+}
+
+/*
+ * Set granularity of the next forced preemption, for a context with its own
+ * preempt mode. Device wide state, for other contexts, is not changed.
+ */
+int aie2_preempt_granularity(struct amdxdna_dev_hdl *ndev, bool frame)
+{
+	u32 type = NPU4_RT_TYPE_FRAME_BOUNDARY_PREEMPTION;
+	int ret;
+
+	if (ndev->frame_boundary_active == frame || !is_supported_rt_cfg(ndev, type))
+		return 0;
+
+	ret = aie2_set_runtime_cfg(ndev, type, frame ? 0 : 1);
+	if (ret)
+		return ret;
+
+	ndev->frame_boundary_active = frame;
 	return 0;
 }
 
@@ -306,6 +368,7 @@ int aie2_check_protocol_version(struct amdxdna_dev_hdl *ndev)
 int aie2_calibrate_time(struct amdxdna_dev_hdl *ndev)
 {
 	DECLARE_AIE2_MSG(calibrate_time, MSG_OP_CALIBRATE_TIME);
+	u64 mono_ns;
 	int ret;
 
 	if (!aie2_is_supported_msg(ndev, MSG_OP_CALIBRATE_TIME)) {
@@ -313,6 +376,7 @@ int aie2_calibrate_time(struct amdxdna_dev_hdl *ndev)
 		return 0;
 	}
 
+	mono_ns = ktime_get_ns();
 	req.timestamp_ns = ktime_get_real_ns();
 
 	ret = aie2_send_mgmt_msg_wait(ndev, &msg);
@@ -321,6 +385,12 @@ int aie2_calibrate_time(struct amdxdna_dev_hdl *ndev)
 		return ret;
 	}
 
+	/*
+	 * Firmware keeps counting from the wall clock value handed over here, so this
+	 * offset maps its timestamps onto CLOCK_MONOTONIC until the next calibration.
+	 */
+	ndev->xdna->fw_clock_offset_ns = req.timestamp_ns - mono_ns;
+
 	XDNA_DBG(ndev->xdna, "System clock calibrated with firmware");
 	return 0;
 }
@@ -348,7 +418,7 @@ int aie2_query_aie_telemetry(struct amdxdna_dev_hdl *ndev, struct amdxdna_mgmt_d
 	req.buf_size = size;
 	req.type = type;
 
-	ret = aie2_send_mgmt_msg_wait(ndev, &msg);
+	ret = aie2_send_mgmt_msg_wait_unlocked(ndev, &msg);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to get telemetry, ret %d", ret);
 		return ret;
@@ -871,9 +941,9 @@ int aie2_config_cu(struct amdxdna_ctx *ctx)
 		}
 		abo = to_xdna_obj(gobj);
 
-		if (abo->type != AMDXDNA_BO_DEV) {
+		if (abo->type != AMDXDNA_BO_DEV || abo->dev_heap != ctx->priv->heap) {
 			drm_gem_object_put(gobj);
-			XDNA_ERR(xdna, "Invalid BO type");
+			XDNA_ERR(xdna, "Invalid BO type or heap");
 			return -EINVAL;
 		}
 
@@ -1295,7 +1365,7 @@ void aie2_msg_init(struct amdxdna_dev_hdl *ndev)
 static inline struct amdxdna_gem_obj *
 aie2_cmdlist_get_cmd_buf(struct amdxdna_sched_job *job)
 {
-	int idx = get_job_idx(job->seq);
+	int idx = get_job_idx(job->ctx->priv, job->seq);
 
 	return job->ctx->priv->cmd_buf[idx];
 }
@@ -1335,6 +1405,162 @@ int aie2_execbuf(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 	return 0;
 }
 
+/*
+ * Send job and the queued jobs after it as separate messages with one
+ * mailbox tail pointer update. Each job gets its own response. Queued jobs
+ * are added in order until one fails to be prepared or sent. The jobs
+ * actually sent along are marked coalesced.
+ */
+int aie2_execbufs(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+		  struct amdxdna_sched_job **jobs, u32 job_cnt,
+		  int (*notify_cb)(void *, void __iomem *, size_t))
+{
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct xdna_mailbox_msg msgs[CTX_MAX_CMDS];
+	union exec_req reqs[CTX_MAX_CMDS];
+	struct amdxdna_sched_job *cur;
+	int ret;
+	u32 i;
+
+	if (!chann)
+		return -ENODEV;
+
+	job_cnt = min_t(u32, job_cnt, CTX_MAX_CMDS - 1);
+	for (i = 0; i <= job_cnt; i++) {
+		cur = i ? jobs[i - 1] : job;
+		ret = aie2_init_exec_req(&reqs[i], cur->cmd_bo, &msgs[i].send_size,
+					 &msgs[i].opcode);
+		if (ret) {
+			if (!i)
+				return ret;
+			break;
+		}
+
+		msgs[i].handle = cur;
+		msgs[i].notify_cb = notify_cb;
+		msgs[i].send_data = (u8 *)&reqs[i];
+	}
+	job_cnt = i - 1;
+
+	/* Response may come before send returns, mark jobs before sending */
+	for (i = 0; i < job_cnt; i++)
+		jobs[i]->coalesced = true;
+
+	ret = xdna_mailbox_send_msgs(chann, msgs, job_cnt + 1, TX_TIMEOUT);
+	if (ret < 0) {
+		XDNA_ERR(xdna, "Send messages failed ret %d", ret);
+		for (i = 0; i < job_cnt; i++)
+			jobs[i]->coalesced = false;
+		return ret;
+	}
+
+	job->msg_id = msgs[0].id;
+	for (i = 0; i < job_cnt; i++) {
+		if (i + 1 < ret)
+			jobs[i]->msg_id = msgs[i + 1].id;
+		else
+			jobs[i]->coalesced = false;
+	}
+	XDNA_DBG(xdna, "Sent %d commands back to back", ret);
+
+	return 0;
+}
+
+/*
+ * Convert sub commands of chain cmd_abo into list_abo. Where each slot starts
+ * goes to offsets, if there is room, size, op and number of sub commands of the
+ * list are returned.
+ */
+int aie2_cmdlist_build(struct amdxdna_gem_obj *cmd_abo, struct amdxdna_gem_obj *list_abo,
+		       u32 *offsets, u32 count, u32 *size, u32 *op, u32 *cnt)
+{
+	struct amdxdna_client *client = cmd_abo->client;
+	struct amdxdna_cmd_chain *payload;
+	void *list_buf;
+	u32 payload_len;
+	u32 offset = 0;
+	size_t slot_sz;
+	int ret;
+	u32 i;
+
+	payload = amdxdna_cmd_get_payload(cmd_abo, &payload_len);
+	if (!payload || amdxdna_cmd_get_op(cmd_abo) != ERT_CMD_CHAIN ||
+	    !payload->command_count ||
+	    payload_len < struct_size(payload, data, payload->command_count))
+		return -EINVAL;
+
+	list_buf = amdxdna_gem_vmap(list_abo);
+	if (!list_buf)
+		return -ENOMEM;
+
+	*op = ERT_INVALID_CMD;
+	for (i = 0; i < payload->command_count; i++) {
+		u32 boh = (u32)(payload->data[i]);
+		struct amdxdna_gem_obj *abo;
+
+		abo = amdxdna_gem_get_obj(client, boh, AMDXDNA_BO_SHARE);
+		if (!abo) {
+			XDNA_ERR(client->xdna, "Failed to find cmd BO %d", boh);
+			return -ENOENT;
+		}
+
+		slot_sz = list_abo->mem.size - offset;
+		ret = aie2_cmdlist_fill_slot(list_buf + offset, abo, &slot_sz, op);
+		amdxdna_gem_put_obj(abo);
+		if (ret)
+			return ret;
+
+		if (i < count)
+			offsets[i] = offset;
+		offset += slot_sz;
+	}
+	if (i < count)
+		offsets[i] = offset;
+
+	if (EXEC_MSG_OPS(client->xdna)->get_chain_msg_op(*op) == MSG_OP_MAX_OPCODE)
+		return -EOPNOTSUPP;
+
+	drm_clflush_virt_range(list_buf, offset);
+	*size = offset;
+	*cnt = payload->command_count;
+	return 0;
+}
+
+/*
+ * Send prebuilt command list of chain job->cmd_bo as is, see
+ * DRM_AMDXDNA_HWCTX_BUILD_CMDLIST. Only arguments may have been updated in
+ * place by user since it was built, flush them out.
+ */
+static int aie2_cmdlist_prebuilt_execbuf(struct amdxdna_ctx *ctx,
+					 struct amdxdna_sched_job *job,
+					 struct amdxdna_gem_obj *list_abo, u32 size,
+					 u32 op, u32 cmd_cnt,
+					 int (*notify_cb)(void *, void __iomem *, size_t))
+{
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct xdna_mailbox_msg msg;
+	union exec_chain_req req;
+	int ret;
+
+	drm_clflush_virt_range(amdxdna_gem_vmap(list_abo), size);
+
+	msg.opcode = EXEC_MSG_OPS(xdna)->get_chain_msg_op(op);
+	EXEC_MSG_OPS(xdna)->init_chain_req(&req, amdxdna_gem_dev_addr(list_abo), size, cmd_cnt);
+	msg.handle = job;
+	msg.notify_cb = notify_cb;
+	msg.send_data = (u8 *)&req;
+	msg.send_size = sizeof(req);
+	ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
+	if (ret) {
+		XDNA_ERR(xdna, "Send message failed");
+		return ret;
+	}
+	job->msg_id = msg.id;
+	return 0;
+}
+
 int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 			       struct amdxdna_sched_job *job,
 			       int (*notify_cb)(void *, void __iomem *, size_t))
@@ -1365,6 +1591,24 @@ int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 	    payload_len < struct_size(payload, data, payload->command_count))
 		return -EINVAL;
 
+	mutex_lock(&cmd_abo->lock);
+	if (cmd_abo->cmdlist) {
+		/* The chain was changed since the list was built */
+		if (payload->command_count != cmd_abo->cmdlist_cnt) {
+			XDNA_ERR(xdna, "Chain has %d sub cmds, prebuilt cmdlist has %d",
+				 payload->command_count, cmd_abo->cmdlist_cnt);
+			mutex_unlock(&cmd_abo->lock);
+			return -EINVAL;
+		}
+		/* Builder makes sure list BO stays while submitted commands run */
+		ret = aie2_cmdlist_prebuilt_execbuf(ctx, job, cmd_abo->cmdlist,
+						    cmd_abo->cmdlist_size, cmd_abo->cmdlist_op,
+						    cmd_abo->cmdlist_cnt, notify_cb);
+		mutex_unlock(&cmd_abo->lock);
+		return ret;
+	}
+	mutex_unlock(&cmd_abo->lock);
+
 	op = ERT_INVALID_CMD;
 	for (i = 0; i < payload->command_count; i++) {
 		u32 boh = (u32)(payload->data[i]);
@@ -1417,6 +1661,85 @@ int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 	return 0;
 }
 
+/*
+ * Send job and the queued jobs after it in one command list. Queued jobs are
+ * added in order until one does not fit in the command buffer or has a
+ * different opcode. The jobs actually sent along are marked coalesced and
+ * counted in job->coalesce_cnt.
+ */
+int aie2_cmdlist_coalesce_execbuf(struct amdxdna_ctx *ctx,
+				  struct amdxdna_sched_job *job,
+				  struct amdxdna_sched_job **jobs, u32 job_cnt,
+				  int (*notify_cb)(void *, void __iomem *, size_t))
+{
+	struct amdxdna_gem_obj *cmdbuf_abo = aie2_cmdlist_get_cmd_buf(job);
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	void *cmd_buf = amdxdna_gem_vmap(cmdbuf_abo);
+	struct xdna_mailbox_msg msg;
+	union exec_chain_req req;
+	u32 op = ERT_INVALID_CMD;
+	u32 offset;
+	u64 dev_addr;
+	size_t size;
+	int ret;
+	u32 i;
+
+	size = cmdbuf_abo->mem.size;
+	ret = aie2_cmdlist_fill_slot(cmd_buf, job->cmd_bo, &size, &op);
+	if (ret)
+		return ret;
+	offset = size;
+
+	for (i = 0; i < job_cnt; i++) {
+		size = cmdbuf_abo->mem.size - offset;
+		if (aie2_cmdlist_fill_slot(cmd_buf + offset, jobs[i]->cmd_bo, &size, &op))
+			break;
+		offset += size;
+	}
+	job_cnt = i;
+#ifdef AMDXDNA_DEVEL
+	XDNA_DBG(xdna, "Coalesced %d commands:", job_cnt + 1);
+	print_hex_dump_debug("cmdbufs: ", DUMP_PREFIX_OFFSET, 16, 4,
+			     amdxdna_gem_vmap(cmdbuf_abo), offset, false);
+#endif
+
+	msg.opcode = EXEC_MSG_OPS(xdna)->get_chain_msg_op(op);
+	if (msg.opcode == MSG_OP_MAX_OPCODE)
+		return -EOPNOTSUPP;
+
+	dev_addr = amdxdna_gem_dev_addr(cmdbuf_abo);
+	EXEC_MSG_OPS(xdna)->init_chain_req(&req, dev_addr, offset, job_cnt + 1);
+	drm_clflush_virt_range(cmd_buf, offset);
+
+	/* Response may come before send returns, mark jobs before sending */
+	job->coalesce_cnt = job_cnt;
+	for (i = 0; i < job_cnt; i++)
+		jobs[i]->coalesced = true;
+
+	msg.handle = job;
+	msg.notify_cb = notify_cb;
+	msg.send_data = (u8 *)&req;
+	msg.send_size = sizeof(req);
+	ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
+	if (ret) {
+		XDNA_ERR(xdna, "Send message failed");
+		job->coalesce_cnt = 0;
+		for (i = 0; i < job_cnt; i++)
+			jobs[i]->coalesced = false;
+		return ret;
+	}
+	job->msg_id = msg.id;
+	for (i = 0; i < job_cnt; i++)
+		jobs[i]->msg_id = msg.id;
+#ifdef AMDXDNA_DEVEL
+	print_hex_dump_debug("cmdlist msg: ", DUMP_PREFIX_OFFSET, 16, 4,
+			     &req, msg.send_size, false);
+#endif
+
+	return 0;
+}
+
 int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
 				struct amdxdna_sched_job *job,
 				int (*notify_cb)(void *, void __iomem *, size_t))
@@ -1515,8 +1838,13 @@ int aie2_config_debug_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 	struct xdna_mailbox_msg msg;
 	int ret;
 
+	if (abo->dev_heap != ctx->priv->heap) {
+		XDNA_ERR(xdna, "Debug BO is not on dev heap of %s", ctx->name);
+		return -EINVAL;
+	}
+
 	req.config = (job->opcode == OP_REG_DEBUG_BO) ? REGISTER : UNREGISTER;
-	req.offset = amdxdna_gem_dev_addr(abo) - amdxdna_gem_dev_addr(ctx->client->dev_heap);
+	req.offset = amdxdna_gem_dev_addr(abo) - amdxdna_gem_dev_addr(ctx->priv->heap);
 	req.size = abo->mem.size;
 
 	XDNA_DBG(xdna, "offset 0x%llx size 0x%llx config %d",
@@ -1577,15 +1905,119 @@ int aie2_get_aie_coredump(struct amdxdna_dev_hdl *ndev, struct amdxdna_mgmt_dma_
 }
 
 #ifdef AMDXDNA_DEVEL
-int aie2_register_pdis(struct amdxdna_ctx *ctx)
+static struct ctx_pdi *
+aie2_lookup_pdi(struct amdxdna_dev_hdl *ndev, const void *data, size_t size)
+{
+	struct ctx_pdi *pdi;
+
+	list_for_each_entry(pdi, &ndev->pdi_list, node) {
+		if (pdi->size == size && !memcmp(pdi->addr, data, size))
+			return pdi;
+	}
+	return NULL;
+}
+
+static struct ctx_pdi *
+aie2_create_pdi(struct amdxdna_dev_hdl *ndev, const void *data, size_t size)
 {
 	DECLARE_AIE2_MSG(register_pdi, MSG_OP_REGISTER_PDI);
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct ctx_pdi *pdi;
+	int ret;
+
+	pdi = kzalloc(sizeof(*pdi), GFP_KERNEL);
+	if (!pdi)
+		return ERR_PTR(-ENOMEM);
+
+	pdi->id = ida_alloc_range(&xdna->pdi_ida, 0, AIE2_MAX_PDI_ID, GFP_KERNEL);
+	if (pdi->id < 0) {
+		XDNA_ERR(xdna, "Cannot allocate PDI id");
+		ret = pdi->id;
+		goto free_pdi;
+	}
+	pdi->size = size;
+	pdi->addr = dma_alloc_noncoherent(xdna->ddev.dev, pdi->size, &pdi->dma_addr,
+					  DMA_TO_DEVICE, GFP_KERNEL);
+	if (!pdi->addr) {
+		ret = -ENOMEM;
+		goto free_id;
+	}
+	memcpy(pdi->addr, data, size);
+
+	req.num_infos = 1;
+	req.pdi_info.pdi_id = pdi->id;
+	req.pdi_info.address = pdi->dma_addr;
+	req.pdi_info.size = pdi->size;
+	req.pdi_info.type = 3;
+	resp.status = MAX_AIE2_STATUS_CODE;
+
+	drm_clflush_virt_range(pdi->addr, pdi->size); /* device can access */
+	ret = aie2_send_mgmt_msg_wait(ndev, &msg);
+	if (ret) {
+		XDNA_ERR(xdna, "PDI %d register failed, ret %d", pdi->id, ret);
+		goto free_buf;
+	}
+
+	pdi->registered = 1;
+	pdi->refcnt = 1;
+	list_add_tail(&pdi->node, &ndev->pdi_list);
+	WARN_ONCE(pdi->id != resp.reg_index, "PDI ID and FW registered index mismatch");
+	XDNA_DBG(xdna, "PDI %d register completed, index %d", pdi->id, resp.reg_index);
+	return pdi;
+
+free_buf:
+	dma_free_noncoherent(xdna->ddev.dev, pdi->size, pdi->addr,
+			     pdi->dma_addr, DMA_TO_DEVICE);
+free_id:
+	ida_free(&xdna->pdi_ida, pdi->id);
+free_pdi:
+	kfree(pdi);
+	return ERR_PTR(ret);
+}
+
+static void aie2_put_pdi(struct amdxdna_dev_hdl *ndev, struct ctx_pdi *pdi)
+{
+	DECLARE_AIE2_MSG(unregister_pdi, MSG_OP_UNREGISTER_PDI);
+	struct amdxdna_dev *xdna = ndev->xdna;
+	int ret;
+
+	if (--pdi->refcnt)
+		return;
+
+	list_del(&pdi->node);
+	req.num_pdi = 1;
+	req.pdi_id = pdi->id;
+	resp.status = MAX_AIE2_STATUS_CODE;
+	ret = aie2_send_mgmt_msg_wait(ndev, &msg);
+	if (ret) {
+		/* Firmware may still reference the PDI, leak its buffer and ID */
+		XDNA_ERR(xdna, "PDI %d unregister failed, ret %d", pdi->id, ret);
+		kfree(pdi);
+		return;
+	}
+	XDNA_DBG(xdna, "PDI %d unregister completed", pdi->id);
+
+	dma_free_noncoherent(xdna->ddev.dev, pdi->size, pdi->addr,
+			     pdi->dma_addr, DMA_TO_DEVICE);
+	ida_free(&xdna->pdi_ida, pdi->id);
+	kfree(pdi);
+}
+
+/*
+ * Contexts created from the same xclbin load identical PDIs. A PDI is
+ * registered to firmware by the first context loading it and refcounted
+ * afterwards, so that only the first of them pays for the registration.
+ */
+int aie2_register_pdis(struct amdxdna_ctx *ctx)
+{
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
 	int num_cus = ctx->cus->num_cus;
 	struct drm_gem_object *gobj;
 	struct amdxdna_gem_obj *abo;
 	struct ctx_pdi *pdi;
+	size_t size;
+	void *data;
 	int i, ret;
 
 	if (num_cus > MAX_NUM_CUS) {
@@ -1597,11 +2029,9 @@ int aie2_register_pdis(struct amdxdna_ctx *ctx)
 	if (!ctx->priv->pdi_infos)
 		return -ENOMEM;
 
-	req.num_infos = 1;
 	for (i = 0; i < num_cus; i++) {
 		struct amdxdna_cu_config *cu = &ctx->cus->cu_configs[i];
 
-		pdi = &ctx->priv->pdi_infos[i];
 		gobj = drm_gem_object_lookup(ctx->client->filp, cu->cu_bo);
 		if (!gobj) {
 			XDNA_ERR(xdna, "Lookup GEM object failed");
@@ -1617,45 +2047,35 @@ int aie2_register_pdis(struct amdxdna_ctx *ctx)
 			goto cleanup;
 		}
 
-		pdi->id = -1; /* Set to negative value, so that cleanup can work */
-		pdi->id = ida_alloc_range(&xdna->pdi_ida, 0, AIE2_MAX_PDI_ID, GFP_KERNEL);
-		if (pdi->id < 0) {
-			XDNA_ERR(xdna, "Cannot allocate PDI id");
-			ret = pdi->id;
-			goto cleanup;
-		}
-		pdi->size = gobj->size;
-		pdi->addr = dma_alloc_noncoherent(xdna->ddev.dev, pdi->size, &pdi->dma_addr,
-						  DMA_TO_DEVICE, GFP_KERNEL);
-		if (!pdi->addr) {
+		size = gobj->size;
+		data = kvmalloc(size, GFP_KERNEL);
+		if (!data) {
 			drm_gem_object_put(gobj);
 			ret = -ENOMEM;
 			goto cleanup;
 		}
 
-		if (copy_from_user(pdi->addr, u64_to_user_ptr(amdxdna_gem_uva(abo)), pdi->size)) {
+		if (copy_from_user(data, u64_to_user_ptr(amdxdna_gem_uva(abo)), size)) {
 			drm_gem_object_put(gobj);
+			kvfree(data);
 			ret = -EFAULT;
 			goto cleanup;
 		}
-
 		drm_gem_object_put(gobj);
-		req.pdi_info.pdi_id = pdi->id;
-		req.pdi_info.address = pdi->dma_addr;
-		req.pdi_info.size = pdi->size;
-		req.pdi_info.type = 3;
-		resp.status = MAX_AIE2_STATUS_CODE;
 
-		drm_clflush_virt_range(pdi->addr, pdi->size); /* device can access */
-		ret = aie2_send_mgmt_msg_wait(ndev, &msg);
-		if (ret) {
-			XDNA_ERR(xdna, "PDI %d register failed, ret %d", pdi->id, ret);
+		pdi = aie2_lookup_pdi(ndev, data, size);
+		if (pdi) {
+			pdi->refcnt++;
+			XDNA_DBG(xdna, "PDI %d shared, refcnt %u", pdi->id, pdi->refcnt);
+		} else {
+			pdi = aie2_create_pdi(ndev, data, size);
+		}
+		kvfree(data);
+		if (IS_ERR(pdi)) {
+			ret = PTR_ERR(pdi);
 			goto cleanup;
 		}
-
-		pdi->registered = 1;
-		WARN_ONCE(pdi->id != resp.reg_index, "PDI ID and FW registered index mismatch");
-		XDNA_DBG(xdna, "PDI %d register completed, index %d", pdi->id, resp.reg_index);
+		ctx->priv->pdi_infos[i] = pdi;
 	}
 
 	return 0;
@@ -1667,43 +2087,21 @@ cleanup:
 
 int aie2_unregister_pdis(struct amdxdna_ctx *ctx)
 {
-	DECLARE_AIE2_MSG(unregister_pdi, MSG_OP_UNREGISTER_PDI);
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
 	int num_cus = ctx->cus->num_cus;
-	struct ctx_pdi *pdi;
-	int ret, i;
+	int i;
 
 	if (!ctx->priv->pdi_infos)
 		return 0;
 
-	req.num_pdi = 1;
 	for (i = 0; i < num_cus; i++) {
-		pdi = &ctx->priv->pdi_infos[i];
-
-		if (pdi->registered) {
-			req.pdi_id = pdi->id;
-			resp.status = MAX_AIE2_STATUS_CODE;
-			ret = aie2_send_mgmt_msg_wait(ndev, &msg);
-			if (ret) {
-				XDNA_ERR(xdna, "PDI %d unregister failed, ret %d",
-					 pdi->id, ret);
-				break;
-			}
-
-			pdi->registered = 0;
-			XDNA_DBG(xdna, "PDI %d unregister completed", pdi->id);
-		}
-
-		if (pdi->addr)
-			dma_free_noncoherent(xdna->ddev.dev, pdi->size, pdi->addr,
-					     pdi->dma_addr, DMA_TO_DEVICE);
-
-		if (pdi->id >= 0)
-			ida_free(&xdna->pdi_ida, pdi->id);
+		if (ctx->priv->pdi_infos[i])
+			aie2_put_pdi(ndev, ctx->priv->pdi_infos[i]);
 	}
 
 	kfree(ctx->priv->pdi_infos);
+	ctx->priv->pdi_infos = NULL;
 	return 0;
 }
 
@@ -1728,7 +2126,7 @@ int aie2_legacy_config_cu(struct amdxdna_ctx *ctx)
 
 		req.configs[i].cu_idx = i;
 		req.configs[i].cu_func = cu->cu_func;
-		req.configs[i].cu_pdi_id = ctx->priv->pdi_infos[i].id;
+		req.configs[i].cu_pdi_id = ctx->priv->pdi_infos[i]->id;
 	}
 
 	ret = xdna_send_msg_wait(xdna, chann, &msg);
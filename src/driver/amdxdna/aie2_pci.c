@@ -6,6 +6,8 @@
 #include <linux/errno.h>
 #include <linux/kthread.h>
 #include <linux/iommu.h>
+#include <linux/pci-ats.h>
+#include <linux/rculist.h>
 #include <linux/firmware.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
@@ -45,6 +47,16 @@ uint time_quantum_ms = 30; /* milliseconds */
 module_param(time_quantum_ms, uint, 0400);
 MODULE_PARM_DESC(time_quantum_ms, "Execution time quantum. Default 30 ms, MAX 2000 ms");
 
+static bool sva_userptr;
+module_param(sva_userptr, bool, 0400);
+MODULE_PARM_DESC(sva_userptr,
+		 "Allow user pointer BO accessed through PASID with IO page faults, no pinning. Requires PRI");
+
+uint telemetry_cache_ms = 1000; /* milliseconds */
+module_param(telemetry_cache_ms, uint, 0600);
+MODULE_PARM_DESC(telemetry_cache_ms,
+		 "Telemetry background refresh period, 0 to always query firmware. Default 1000 ms");
+
 /*
  * The management mailbox channel is allocated by firmware.
  * The related register and ring buffer information is on SRAM BAR.
@@ -255,6 +267,8 @@ static int aie2_mgmt_fw_init(struct amdxdna_dev_hdl *ndev)
 			 disable_fine_preemption ? "disable" : "enable");
 		return ret;
 	}
+	/* Firmware starts without frame boundary preemption */
+	ndev->frame_boundary_active = false;
 
 	ret = aie2_assign_mgmt_pasid(ndev, 0);
 	if (ret) {
@@ -322,6 +336,25 @@ static void aie2_mgmt_fw_fini(struct amdxdna_dev_hdl *ndev)
 	XDNA_DBG(ndev->xdna, "npu firmware suspended");
 }
 
+static void aie2_mbox_fini(struct amdxdna_dev_hdl *ndev)
+{
+	if (!ndev->mbox)
+		return;
+
+	xdna_mailbox_destroy(ndev->mbox);
+	ndev->mbox = NULL;
+}
+
+/* Return ns since *t and restart *t for the next stage */
+static u64 aie2_stage_ns(ktime_t *t)
+{
+	ktime_t now = ktime_get();
+	u64 ns = ktime_to_ns(ktime_sub(now, *t));
+
+	*t = now;
+	return ns;
+}
+
 static void aie2_hw_stop(struct amdxdna_dev *xdna)
 {
 	struct pci_dev *pdev = to_pci_dev(xdna->ddev.dev);
@@ -332,16 +365,16 @@ static void aie2_hw_stop(struct amdxdna_dev *xdna)
 		return;
 	}
 
+	aie2_pm_gov_stop(ndev);
 	mutex_lock(&ndev->aie2_lock);
 	aie2_pm_fini(ndev);
 	aie2_mgmt_fw_fini(ndev);
+	down_write(&ndev->mgmt_sem);
 	xdna_mailbox_stop_channel(ndev->mgmt_chann);
 	xdna_mailbox_destroy_channel(ndev->mgmt_chann);
 	ndev->mgmt_chann = NULL;
-	if (ndev->mbox) {
-		xdna_mailbox_destroy(ndev->mbox);
-		ndev->mbox = NULL;
-	}
+	up_write(&ndev->mgmt_sem);
+	/* The mailbox itself is kept for the next start, see aie2_mbox_fini() */
 	aie2_psp_stop(ndev->psp_hdl);
 	aie2_smu_stop(ndev);
 	mutex_unlock(&ndev->aie2_lock);
@@ -357,7 +390,9 @@ static int aie2_hw_start(struct amdxdna_dev *xdna)
 {
 	struct pci_dev *pdev = to_pci_dev(xdna->ddev.dev);
 	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	struct aie2_bringup_stats *st = &ndev->bringup_stats;
 	struct xdna_mailbox_res mbox_res;
+	ktime_t t;
 	int ret;
 
 	if (ndev->dev_status >= AIE2_DEV_START) {
@@ -377,17 +412,20 @@ static int aie2_hw_start(struct amdxdna_dev *xdna)
 	 * aie2_lock. One mutex_lock() and mutex_unlock() is simpler.
 	 */
 	mutex_lock(&ndev->aie2_lock);
+	t = ktime_get();
 	ret = aie2_smu_start(ndev);
 	if (ret) {
 		XDNA_ERR(xdna, "failed to init smu, ret %d", ret);
 		goto disable_dev;
 	}
+	st->smu_start_ns = aie2_stage_ns(&t);
 
 	ret = aie2_psp_start(ndev->psp_hdl);
 	if (ret) {
 		XDNA_ERR(xdna, "failed to start psp, ret %d", ret);
 		goto fini_smu;
 	}
+	st->psp_start_ns = aie2_stage_ns(&t);
 
 	ret = aie2_mgmt_chann_init(ndev);
 	if (ret) {
@@ -395,20 +433,25 @@ static int aie2_hw_start(struct amdxdna_dev *xdna)
 		goto stop_psp;
 	}
 
-	mbox_res.ringbuf_base = ndev->sram_base;
-	mbox_res.ringbuf_size = pci_resource_len(pdev, xdna->dev_info->sram_bar);
-	mbox_res.mbox_base = ndev->mbox_base;
-	mbox_res.mbox_size = MBOX_SIZE(ndev);
-	mbox_res.name = "xdna_mailbox";
-	ndev->mbox = xdna_mailbox_create(&pdev->dev, &mbox_res);
+	/* Mailbox BAR resources do not change, reuse the one kept across suspend */
 	if (!ndev->mbox) {
-		XDNA_ERR(xdna, "failed to create mailbox device");
-		ret = -ENODEV;
-		goto stop_psp;
+		mbox_res.ringbuf_base = ndev->sram_base;
+		mbox_res.ringbuf_size = pci_resource_len(pdev, xdna->dev_info->sram_bar);
+		mbox_res.mbox_base = ndev->mbox_base;
+		mbox_res.mbox_size = MBOX_SIZE(ndev);
+		mbox_res.name = "xdna_mailbox";
+		ndev->mbox = xdna_mailbox_create(&pdev->dev, &mbox_res);
+		if (!ndev->mbox) {
+			XDNA_ERR(xdna, "failed to create mailbox device");
+			ret = -ENODEV;
+			goto stop_psp;
+		}
 	}
 
+	down_write(&ndev->mgmt_sem);
 	ndev->mgmt_chann = xdna_mailbox_create_channel(ndev->mbox, &ndev->mgmt_info,
 						       MB_CHANNEL_MGMT);
+	up_write(&ndev->mgmt_sem);
 	if (!ndev->mgmt_chann) {
 		XDNA_ERR(xdna, "failed to create management mailbox channel");
 		ret = -EINVAL;
@@ -420,17 +463,26 @@ static int aie2_hw_start(struct amdxdna_dev *xdna)
 		XDNA_ERR(xdna, "initial mgmt firmware failed, ret %d", ret);
 		goto destroy_mgmt_chann;
 	}
+	st->mgmt_init_ns = aie2_stage_ns(&t);
 
 	ret = aie2_pm_init(ndev);
 	if (ret) {
 		XDNA_ERR(xdna, "failed to init pm, ret %d", ret);
 		goto destroy_mgmt_chann;
 	}
+	st->pm_init_ns = aie2_stage_ns(&t);
 
-	ret = aie2_mgmt_fw_query(ndev);
-	if (ret) {
-		XDNA_ERR(xdna, "failed to query fw, ret %d", ret);
-		goto pm_fini;
+	/*
+	 * Versions and metadata come from the firmware image loaded at probe and
+	 * do not change across suspend, only query them on the first start.
+	 */
+	if (ndev->dev_status == AIE2_DEV_UNINIT) {
+		ret = aie2_mgmt_fw_query(ndev);
+		if (ret) {
+			XDNA_ERR(xdna, "failed to query fw, ret %d", ret);
+			goto pm_fini;
+		}
+		st->fw_query_ns = aie2_stage_ns(&t);
 	}
 
 	ret = aie2_error_async_events_alloc(ndev);
@@ -441,15 +493,18 @@ static int aie2_hw_start(struct amdxdna_dev *xdna)
 
 	mutex_unlock(&ndev->aie2_lock);
 	ndev->dev_status = AIE2_DEV_START;
+	aie2_pm_gov_start(ndev);
 
 	return 0;
 
 pm_fini:
 	aie2_pm_fini(ndev);
 destroy_mgmt_chann:
+	down_write(&ndev->mgmt_sem);
 	xdna_mailbox_stop_channel(ndev->mgmt_chann);
 	xdna_mailbox_destroy_channel(ndev->mgmt_chann);
 	ndev->mgmt_chann = NULL;
+	up_write(&ndev->mgmt_sem);
 destroy_mbox:
 	xdna_mailbox_destroy(ndev->mbox);
 	ndev->mbox = NULL;
@@ -472,31 +527,207 @@ static void aie2_hw_suspend(struct amdxdna_dev *xdna)
 	aie2_hw_stop(xdna);
 }
 
+static void aie2_resume_account(struct amdxdna_dev_hdl *ndev, ktime_t start, ktime_t hw_end)
+{
+	struct aie2_resume_stats *st = &ndev->resume_stats;
+	u64 total_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	st->cnt++;
+	st->last_ns = total_ns;
+	st->last_hw_ns = ktime_to_ns(ktime_sub(hw_end, start));
+	st->total_ns += total_ns;
+	st->max_ns = max(st->max_ns, total_ns);
+}
+
 static int aie2_hw_resume(struct amdxdna_dev *xdna)
 {
+	ktime_t start, hw_end;
 	int ret;
 
 	XDNA_DBG(xdna, "firmware resuming...");
 	guard(mutex)(&xdna->dev_lock);
+	start = ktime_get();
 	ret = aie2_hw_start(xdna);
 	if (ret) {
 		XDNA_ERR(xdna, "resume NPU firmware failed");
 		return ret;
 	}
+	hw_end = ktime_get();
 
 	XDNA_DBG(xdna, "context resuming...");
 	aie2_rq_restart_all(&xdna->dev_handle->ctx_rq);
+	aie2_resume_account(xdna->dev_handle, start, hw_end);
 	return 0;
 }
 
+/* Called with telemetry_lock held, aie2_lock must not be held */
+static int aie2_telemetry_refresh(struct amdxdna_dev_hdl *ndev, u32 type)
+{
+	struct aie2_telemetry_cache *c = &ndev->telemetry[type];
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct aie_version ver;
+	void *buff;
+	int ret;
+
+	if (!c->dma_hdl) {
+		c->dma_hdl = amdxdna_mgmt_buff_alloc(xdna, AIE2_TELEMETRY_CACHE_SIZE,
+						     DMA_FROM_DEVICE);
+		if (IS_ERR(c->dma_hdl)) {
+			ret = PTR_ERR(c->dma_hdl);
+			c->dma_hdl = NULL;
+			return ret;
+		}
+	}
+
+	buff = amdxdna_mgmt_buff_get_cpu_addr(c->dma_hdl, 0);
+	if (IS_ERR(buff))
+		return PTR_ERR(buff);
+
+	/* A failed query may have left partial data, don't serve it */
+	c->stamp = 0;
+	memset(buff, 0, AIE2_TELEMETRY_CACHE_SIZE);
+	amdxdna_mgmt_buff_clflush(c->dma_hdl, 0, 0);
+	ret = aie2_query_aie_telemetry(ndev, c->dma_hdl, type, AIE2_TELEMETRY_CACHE_SIZE, &ver);
+	if (ret)
+		return ret;
+
+	c->ver = ver;
+	c->stamp = ktime_get();
+	return 0;
+}
+
+/*
+ * Copy telemetry of given type into buf. Unless fresh is set, the copy
+ * refreshed in the background is served, as long as it is no older than two
+ * refresh periods. Otherwise, firmware is queried synchronously. Reading a
+ * type keeps its background refresh going, so that periodic readers don't
+ * wait for the mailbox round trip.
+ *
+ * Called without aie2_lock, firmware is queried without waiting for other
+ * management messages. At most AIE2_TELEMETRY_CACHE_SIZE bytes are copied,
+ * rest of buf is left as is.
+ */
+int aie2_telemetry_read(struct amdxdna_dev_hdl *ndev, u32 type, void *buf, size_t size,
+			struct aie_version *ver, bool fresh)
+{
+	uint period = READ_ONCE(telemetry_cache_ms);
+	struct aie2_telemetry_cache *c;
+	ktime_t now = ktime_get();
+	int ret = 0;
+
+#ifdef AMDXDNA_DEVEL
+	BUILD_BUG_ON(AIE2_TELEMETRY_TYPES != MAX_TELEMETRY_TYPE);
+#endif
+	if (type >= AIE2_TELEMETRY_TYPES)
+		return -EINVAL;
+
+	c = &ndev->telemetry[type];
+	mutex_lock(&ndev->telemetry_lock);
+	c->last_read = now;
+	if (fresh || !period || !c->stamp || ktime_ms_delta(now, c->stamp) > 2 * period) {
+		ret = aie2_telemetry_refresh(ndev, type);
+		if (ret) {
+			XDNA_ERR(ndev->xdna, "Get telemetry type %u failed ret %d", type, ret);
+			goto unlock;
+		}
+	}
+
+	memcpy(buf, amdxdna_mgmt_buff_get_cpu_addr(c->dma_hdl, 0),
+	       min_t(size_t, size, AIE2_TELEMETRY_CACHE_SIZE));
+	if (ver)
+		*ver = c->ver;
+unlock:
+	mutex_unlock(&ndev->telemetry_lock);
+
+	if (period)
+		queue_delayed_work(system_wq, &ndev->telemetry_work, msecs_to_jiffies(period));
+	return ret;
+}
+
+static void aie2_telemetry_work(struct work_struct *work)
+{
+	struct amdxdna_dev_hdl *ndev;
+	struct amdxdna_dev *xdna;
+	bool wanted = false;
+	ktime_t now;
+	uint period;
+	int i;
+
+	ndev = container_of(to_delayed_work(work), struct amdxdna_dev_hdl, telemetry_work);
+	xdna = ndev->xdna;
+	period = READ_ONCE(telemetry_cache_ms);
+	if (!period)
+		return;
+
+	/* Never wake up device for telemetry nobody may read */
+	if (!amdxdna_pm_get_if_active(xdna))
+		return;
+
+	now = ktime_get();
+	mutex_lock(&ndev->telemetry_lock);
+	for (i = 0; i < AIE2_TELEMETRY_TYPES; i++) {
+		struct aie2_telemetry_cache *c = &ndev->telemetry[i];
+
+		/* Stop refreshing types not read for a few periods */
+		if (!c->last_read || ktime_ms_delta(now, c->last_read) > 4 * period)
+			continue;
+
+		wanted = true;
+		if (aie2_telemetry_refresh(ndev, i))
+			XDNA_DBG(xdna, "Refresh telemetry type %d failed", i);
+	}
+	mutex_unlock(&ndev->telemetry_lock);
+	amdxdna_pm_suspend_put(xdna);
+
+	if (wanted)
+		queue_delayed_work(system_wq, &ndev->telemetry_work, msecs_to_jiffies(period));
+}
+
+static void aie2_telemetry_fini(struct amdxdna_dev_hdl *ndev)
+{
+	int i;
+
+	/* Readers are gone, nothing requeues the work any more */
+	cancel_delayed_work_sync(&ndev->telemetry_work);
+	for (i = 0; i < AIE2_TELEMETRY_TYPES; i++) {
+		if (ndev->telemetry[i].dma_hdl)
+			amdxdna_mgmt_buff_free(ndev->telemetry[i].dma_hdl);
+		ndev->telemetry[i].dma_hdl = NULL;
+		ndev->telemetry[i].stamp = 0;
+	}
+}
+
+struct aie2_fw_request {
+	struct completion	done;
+	const struct firmware	*fw;
+};
+
+static void aie2_fw_request_done(const struct firmware *fw, void *context)
+{
+	struct aie2_fw_request *req = context;
+
+	req->fw = fw;
+	/* All waiters, error path may wait after a successful wait */
+	complete_all(&req->done);
+}
+
+static const struct firmware *aie2_fw_request_wait(struct aie2_fw_request *req)
+{
+	wait_for_completion(&req->done);
+	return req->fw;
+}
+
 static int aie2_init(struct amdxdna_dev *xdna)
 {
 	struct pci_dev *pdev = to_pci_dev(xdna->ddev.dev);
+	struct aie2_bringup_stats *st;
+	struct aie2_fw_request fw_req;
 	struct amdxdna_dev_hdl *ndev;
 	struct psp_config psp_conf;
 	const struct firmware *fw;
 	void __iomem * const *tbl;
 	int i, bars, nvec, ret;
+	ktime_t start, t;
 
 	XDNA_DBG(xdna, "Control flags 0x%x", aie2_control_flags);
 	ndev = devm_kzalloc(&pdev->dev, sizeof(*ndev), GFP_KERNEL);
@@ -506,9 +737,23 @@ static int aie2_init(struct amdxdna_dev *xdna)
 	ndev->priv = xdna->dev_info->dev_priv;
 	ndev->xdna = xdna;
 	mutex_init(&ndev->aie2_lock);
+	init_rwsem(&ndev->mgmt_sem);
+	mutex_init(&ndev->ctx_gen_lock);
+	mutex_init(&ndev->telemetry_lock);
+	INIT_DELAYED_WORK(&ndev->telemetry_work, aie2_telemetry_work);
+#ifdef AMDXDNA_DEVEL
+	INIT_LIST_HEAD(&ndev->pdi_list);
+#endif
+	st = &ndev->bringup_stats;
+	start = ktime_get();
+	t = start;
 
+	/* Firmware is read from file system while PCI resources are set up */
 	XDNA_DBG(xdna, "Request fw %s", ndev->priv->fw_path);
-	ret = request_firmware(&fw, ndev->priv->fw_path, &pdev->dev);
+	init_completion(&fw_req.done);
+	fw_req.fw = NULL;
+	ret = request_firmware_nowait(THIS_MODULE, FW_ACTION_UEVENT, ndev->priv->fw_path,
+				      &pdev->dev, GFP_KERNEL, &fw_req, aie2_fw_request_done);
 	if (ret) {
 		XDNA_ERR(xdna, "failed to request_firmware %s, ret %d",
 			 ndev->priv->fw_path, ret);
@@ -574,16 +819,36 @@ static int aie2_init(struct amdxdna_dev *xdna)
 		goto skip_pasid;
 #endif
 
+	/* Device accessing pages not pinned needs PRI to have them faulted in */
+	if (sva_userptr && pci_pri_supported(pdev)) {
+#ifdef HAVE_iommu_dev_enable_disable_feature
+		xdna->sva_iopf = !iommu_dev_enable_feature(&pdev->dev, IOMMU_DEV_FEAT_IOPF);
+#else
+		xdna->sva_iopf = true;
+#endif
+		XDNA_INFO(xdna, "SVA user pointer BO %s", xdna->sva_iopf ? "enabled" : "failed");
+	}
+
 #ifdef HAVE_iommu_dev_enable_disable_feature
 	ret = iommu_dev_enable_feature(&pdev->dev, IOMMU_DEV_FEAT_SVA);
 	if (ret) {
 		XDNA_ERR(xdna, "Enable PASID failed, ret %d", ret);
-		goto free_irq;
+		goto disable_iopf;
 	}
 #endif
 #ifdef AMDXDNA_DEVEL
 skip_pasid:
 #endif
+	st->pci_setup_ns = aie2_stage_ns(&t);
+	fw = aie2_fw_request_wait(&fw_req);
+	if (!fw) {
+		XDNA_ERR(xdna, "failed to request_firmware %s", ndev->priv->fw_path);
+		ret = -ENOENT;
+		goto disable_sva;
+	}
+	st->fw_request_ns = aie2_stage_ns(&t);
+
+	/* PSP keeps its own copy, which is what reset and resume load from */
 	psp_conf.fw_size = fw->size;
 	psp_conf.fw_buf = fw->data;
 	for (i = 0; i < PSP_MAX_REGS; i++)
@@ -594,8 +859,11 @@ skip_pasid:
 		ret = -ENOMEM;
 		goto disable_sva;
 	}
+	st->psp_create_ns = aie2_stage_ns(&t);
 
-	mutex_init(&ndev->async_errs_cache.lock);
+	ret = aie2_error_ring_init(ndev);
+	if (ret)
+		goto disable_sva;
 
 	xdna->dev_handle = ndev;
 
@@ -614,18 +882,29 @@ skip_pasid:
 	release_firmware(fw);
 	aie2_msg_init(ndev);
 	amdxdna_rpm_init(xdna);
+	st->probe_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	XDNA_INFO(xdna, "NPU started in %llu us, fw %llu us, psp %llu us, mgmt fw %llu us",
+		  div_u64(st->probe_ns, NSEC_PER_USEC),
+		  div_u64(st->fw_request_ns + st->psp_create_ns, NSEC_PER_USEC),
+		  div_u64(st->psp_start_ns, NSEC_PER_USEC),
+		  div_u64(st->mgmt_init_ns + st->fw_query_ns, NSEC_PER_USEC));
 	return 0;
 
 stop_hw:
 	aie2_hw_stop(xdna);
+	aie2_mbox_fini(ndev);
 disable_sva:
 #ifdef HAVE_iommu_dev_enable_disable_feature
 	iommu_dev_disable_feature(&pdev->dev, IOMMU_DEV_FEAT_SVA);
+disable_iopf:
+	if (xdna->sva_iopf)
+		iommu_dev_disable_feature(&pdev->dev, IOMMU_DEV_FEAT_IOPF);
 #endif
+	xdna->sva_iopf = false;
 free_irq:
 	pci_free_irq_vectors(pdev);
 release_fw:
-	release_firmware(fw);
+	release_firmware(aie2_fw_request_wait(&fw_req));
 
 	return ret;
 }
@@ -636,8 +915,10 @@ static void aie2_fini(struct amdxdna_dev *xdna)
 	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
 
 	amdxdna_rpm_fini(xdna);
+	aie2_telemetry_fini(ndev);
 	aie2_rq_fini(&ndev->ctx_rq);
 	aie2_hw_stop(xdna);
+	aie2_mbox_fini(ndev);
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode != AMDXDNA_IOMMU_PASID)
 		goto skip_pasid;
@@ -645,12 +926,17 @@ static void aie2_fini(struct amdxdna_dev *xdna)
 
 #ifdef HAVE_iommu_dev_enable_disable_feature
 	iommu_dev_disable_feature(&pdev->dev, IOMMU_DEV_FEAT_SVA);
+	if (xdna->sva_iopf)
+		iommu_dev_disable_feature(&pdev->dev, IOMMU_DEV_FEAT_IOPF);
 #endif
+	xdna->sva_iopf = false;
 
 #ifdef AMDXDNA_DEVEL
 skip_pasid:
 #endif
 	pci_free_irq_vectors(pdev);
+	mutex_destroy(&ndev->telemetry_lock);
+	mutex_destroy(&ndev->ctx_gen_lock);
 	mutex_destroy(&ndev->aie2_lock);
 }
 
@@ -922,8 +1208,8 @@ static int aie2_query_ctx_status(struct amdxdna_client *client,
 			tmp->num_col = ctx->num_col;
 			tmp->command_submissions = ctx->submitted;
 			tmp->command_completions = ctx->completed;
-			tmp->migrations = 0;
-			tmp->preemptions = 0;
+			tmp->migrations = ctx->priv->migrate_cnt;
+			tmp->preemptions = ctx->priv->preempt_cnt;
 			tmp->errors = 0;
 
 			if (copy_to_user(&buf[hw_i], tmp, sizeof(*tmp))) {
@@ -953,11 +1239,12 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 {
 	struct amdxdna_drm_query_telemetry_header header = {}, *tmp = NULL;
 	struct amdxdna_dev *xdna = client->xdna;
-	struct amdxdna_mgmt_dma_hdl *dma_hdl;
+	struct amdxdna_mgmt_dma_hdl *dma_hdl = NULL;
 	struct aie_version ver;
 	size_t size, offset;
 	int ret, i, min;
 	void *buff;
+	bool fresh;
 
 	if (!access_ok(u64_to_user_ptr(args->buffer), args->buffer_size)) {
 		XDNA_ERR(xdna, "Failed to access buffer size %d", args->buffer_size);
@@ -970,6 +1257,8 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 		return -EFAULT;
 	}
 
+	fresh = header.type & AMDXDNA_TELEMETRY_FRESH;
+	header.type &= ~AMDXDNA_TELEMETRY_FRESH;
 	header.map_num_elements = xdna->dev_handle->ctx_rq.hwctx_limit;
 	offset = struct_size(&header, map, header.map_num_elements);
 	if (args->buffer_size < offset)
@@ -981,24 +1270,35 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 	 */
 	size = max_t(size_t, args->buffer_size - offset, SZ_8K);
 
-	dma_hdl = amdxdna_mgmt_buff_alloc(xdna, size, DMA_FROM_DEVICE);
-	if (IS_ERR(dma_hdl))
-		return PTR_ERR(dma_hdl);
+	if (size <= AIE2_TELEMETRY_CACHE_SIZE && header.type < AIE2_TELEMETRY_TYPES) {
+		buff = kzalloc(size, GFP_KERNEL);
+		if (!buff)
+			return -ENOMEM;
 
-	buff = amdxdna_mgmt_buff_get_cpu_addr(dma_hdl, 0);
-	if (IS_ERR(buff)) {
-		XDNA_ERR(xdna, "Failed to get CPU address for telemetry buffer");
-		ret = PTR_ERR(buff);
-		goto free_mbuf;
-	}
+		ret = aie2_telemetry_read(xdna->dev_handle, header.type, buff, size, &ver, fresh);
+		if (ret)
+			goto free_mbuf;
+	} else {
+		/* Too big to be cached, query into user sized buffer */
+		dma_hdl = amdxdna_mgmt_buff_alloc(xdna, size, DMA_FROM_DEVICE);
+		if (IS_ERR(dma_hdl))
+			return PTR_ERR(dma_hdl);
+
+		buff = amdxdna_mgmt_buff_get_cpu_addr(dma_hdl, 0);
+		if (IS_ERR(buff)) {
+			XDNA_ERR(xdna, "Failed to get CPU address for telemetry buffer");
+			ret = PTR_ERR(buff);
+			goto free_mbuf;
+		}
 
-	memset(buff, 0, size);
-	amdxdna_mgmt_buff_clflush(dma_hdl, 0, 0);
+		memset(buff, 0, size);
+		amdxdna_mgmt_buff_clflush(dma_hdl, 0, 0);
 
-	ret = aie2_query_aie_telemetry(xdna->dev_handle, dma_hdl, header.type, size, &ver);
-	if (ret) {
-		XDNA_ERR(xdna, "Get telemetry failed ret %d", ret);
-		goto free_mbuf;
+		ret = aie2_query_aie_telemetry(xdna->dev_handle, dma_hdl, header.type, size, &ver);
+		if (ret) {
+			XDNA_ERR(xdna, "Get telemetry failed ret %d", ret);
+			goto free_mbuf;
+		}
 	}
 
 	tmp = kzalloc(offset, GFP_KERNEL);
@@ -1012,6 +1312,8 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 	tmp->major = ver.major;
 	tmp->minor = ver.minor;
 
+	/* Firmware is queried without dev_lock, map is as of now */
+	mutex_lock(&xdna->dev_lock);
 	for (i = 0; i < xdna->dev_handle->ctx_rq.num_parts; i++) {
 		struct aie2_partition *part = &xdna->dev_handle->ctx_rq.parts[i];
 		struct amdxdna_ctx *ctx;
@@ -1020,6 +1322,7 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 			tmp->map[ctx->priv->id] = ctx->id;
 		}
 	}
+	mutex_unlock(&xdna->dev_lock);
 
 	print_hex_dump_debug("telemetry: ", DUMP_PREFIX_OFFSET, 16, 4, buff, size, false);
 
@@ -1034,7 +1337,10 @@ static int aie2_query_telemetry(struct amdxdna_client *client,
 free_kbuf:
 	kfree(tmp);
 free_mbuf:
-	amdxdna_mgmt_buff_free(dma_hdl);
+	if (dma_hdl)
+		amdxdna_mgmt_buff_free(dma_hdl);
+	else
+		kfree(buff);
 	return ret;
 }
 
@@ -1124,6 +1430,15 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 	if (ret)
 		return ret;
 
+	/* Not held up by context setup or other management messages in flight */
+	if (args->param == DRM_AMDXDNA_QUERY_TELEMETRY) {
+		if (amdxdna_admin_access_allowed(xdna))
+			ret = aie2_query_telemetry(client, args);
+		else
+			ret = -EPERM;
+		goto out;
+	}
+
 	mutex_lock(&xdna->dev_lock);
 	mutex_lock(&xdna->dev_handle->aie2_lock);
 	switch (args->param) {
@@ -1159,13 +1474,6 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 	case DRM_AMDXDNA_GET_POWER_MODE:
 		ret = aie2_get_power_mode(client, args);
 		break;
-	case DRM_AMDXDNA_QUERY_TELEMETRY:
-		if (!amdxdna_admin_access_allowed(xdna)) {
-			ret = -EPERM;
-			break;
-		}
-		ret = aie2_query_telemetry(client, args);
-		break;
 	case DRM_AMDXDNA_GET_FORCE_PREEMPT_STATE:
 		ret = aie2_get_force_preempt_state(client, args);
 		break;
@@ -1182,25 +1490,70 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 	mutex_unlock(&xdna->dev_lock);
 
+out:
 	amdxdna_pm_suspend_put(xdna);
 	XDNA_DBG(xdna, "Got param %d", args->param);
 
 	return ret;
 }
 
+static void aie2_fill_ctx_entry(struct amdxdna_drm_hwctx_entry *e, struct amdxdna_client *client,
+				struct amdxdna_ctx *ctx, u32 heap_usage)
+{
+	e->pid = client->pid;
+	e->context_id = ctx->id;
+	e->hwctx_id = ctx->priv->id;
+	e->start_col = ctx->start_col;
+	e->num_col = ctx->num_col;
+	e->command_submissions = ctx->submitted;
+	e->command_completions = ctx->completed;
+	e->migrations = ctx->priv->migrate_cnt;
+	e->preemptions = ctx->priv->preempt_cnt;
+	e->errors = 0;
+	e->pasid = client->pasid;
+	e->priority = ctx->qos.priority;
+	e->gops = ctx->qos.gops;
+	e->fps = ctx->qos.fps;
+	e->dma_bandwidth = ctx->qos.dma_bandwidth;
+	e->latency = ctx->qos.latency;
+	e->frame_exec_time = ctx->qos.frame_exec_time;
+	e->heap_usage = heap_usage;
+	e->suspensions = ctx->priv->disconn_cnt;
+	e->connections = ctx->priv->conn_cnt;
+	e->queue_delay_ns = READ_ONCE(ctx->priv->queue_delay_ns);
+	e->exec_ns = READ_ONCE(ctx->priv->exec_ns);
+	e->deadline_misses = READ_ONCE(ctx->priv->deadline_miss_cnt);
+	e->generation = ctx->priv->gen;
+	e->queue_depth = ctx->priv->depth;
+	e->queue_hwm = READ_ONCE(ctx->priv->inflight_hwm);
+
+	if (ctx->priv->active)
+		e->state = AMDXDNA_HWCTX_STATE_ACTIVE;
+	else
+		e->state = AMDXDNA_HWCTX_STATE_IDLE;
+}
+
+/*
+ * Without health, only counters kept by driver are filled in. No message is
+ * sent to firmware, so that it is cheap enough to be polled by monitors.
+ */
 static int aie2_query_ctx_status_array(struct amdxdna_client *client,
-				       struct amdxdna_drm_hwctx_entry *tmp, pid_t pid, u32 ctx_id)
+				       struct amdxdna_drm_hwctx_entry *tmp, pid_t pid, u32 ctx_id,
+				       bool health)
 {
 	struct amdxdna_dev *xdna = client->xdna;
-	struct amdxdna_mgmt_dma_hdl *dma_hdl;
+	struct amdxdna_mgmt_dma_hdl *dma_hdl = NULL;
 	struct amdxdna_client *tmp_client;
-	struct app_health_report *r;
+	struct app_health_report *r = NULL;
 	struct amdxdna_ctx *ctx;
 	unsigned long id;
 	int ret = 0, idx;
 	u32 hw_i = 0;
 	size_t size;
 
+	if (!health)
+		goto query;
+
 	size = max_t(size_t, sizeof(*r), SZ_8K);
 	dma_hdl = amdxdna_mgmt_buff_alloc(xdna, size, DMA_FROM_DEVICE);
 	if (IS_ERR(dma_hdl)) {
@@ -1215,15 +1568,14 @@ static int aie2_query_ctx_status_array(struct amdxdna_client *client,
 		goto exit;
 	}
 
+query:
 	list_for_each_entry(tmp_client, &xdna->client_list, node) {
 		int heap_usage;
 
 		if (pid && pid != tmp_client->pid)
 			continue;
 
-		mutex_lock(&tmp_client->mm_lock);
-		heap_usage = tmp_client->heap_usage;
-		mutex_unlock(&tmp_client->mm_lock);
+		heap_usage = atomic_read(&tmp_client->heap_usage);
 
 		idx = srcu_read_lock(&tmp_client->ctx_srcu);
 		amdxdna_for_each_ctx(tmp_client, id, ctx) {
@@ -1233,30 +1585,11 @@ static int aie2_query_ctx_status_array(struct amdxdna_client *client,
 			if (ctx_id && ctx_id != ctx->id)
 				continue;
 
-			tmp[hw_i].pid = tmp_client->pid;
-			tmp[hw_i].context_id = ctx->id;
-			tmp[hw_i].hwctx_id = ctx->priv->id;
-			tmp[hw_i].start_col = ctx->start_col;
-			tmp[hw_i].num_col = ctx->num_col;
-			tmp[hw_i].command_submissions = ctx->submitted;
-			tmp[hw_i].command_completions = ctx->completed;
-			tmp[hw_i].migrations = 0;
-			tmp[hw_i].preemptions = 0;
-			tmp[hw_i].errors = 0;
-			tmp[hw_i].pasid = tmp_client->pasid;
-			tmp[hw_i].priority = ctx->qos.priority;
-			tmp[hw_i].gops = ctx->qos.gops;
-			tmp[hw_i].fps = ctx->qos.fps;
-			tmp[hw_i].dma_bandwidth = ctx->qos.dma_bandwidth;
-			tmp[hw_i].latency = ctx->qos.latency;
-			tmp[hw_i].frame_exec_time = ctx->qos.frame_exec_time;
-			tmp[hw_i].heap_usage = heap_usage;
-			tmp[hw_i].suspensions = ctx->priv->disconn_cnt;
-
-			if (ctx->priv->active)
-				tmp[hw_i].state = AMDXDNA_HWCTX_STATE_ACTIVE;
-			else
-				tmp[hw_i].state = AMDXDNA_HWCTX_STATE_IDLE;
+			aie2_fill_ctx_entry(&tmp[hw_i], tmp_client, ctx, heap_usage);
+			if (!health) {
+				hw_i++;
+				continue;
+			}
 
 			if (aie2_is_ctx_connected(ctx)) {
 				amdxdna_mgmt_buff_clflush(dma_hdl, 0, 0);
@@ -1298,7 +1631,132 @@ static int aie2_query_ctx_status_array(struct amdxdna_client *client,
 	}
 
 exit:
-	amdxdna_mgmt_buff_free(dma_hdl);
+	if (dma_hdl)
+		amdxdna_mgmt_buff_free(dma_hdl);
+	return ret;
+}
+
+void aie2_ctx_gen_gone(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev_hdl *ndev = ctx->client->xdna->dev_handle;
+	u32 i;
+
+	mutex_lock(&ndev->ctx_gen_lock);
+	i = ndev->ctx_gone_cnt++ % AIE2_CTX_GONE_NUM;
+	ndev->ctx_gone[i].pid = ctx->client->pid;
+	ndev->ctx_gone[i].ctx_id = ctx->id;
+	ndev->ctx_gone[i].gen = ++ndev->ctx_gen;
+	mutex_unlock(&ndev->ctx_gen_lock);
+}
+
+/*
+ * Generations are handed out lazily, when a query finds a context looking
+ * different from last time, so that submission and completion paths stay
+ * untouched.
+ */
+static void aie2_ctx_gen_stamp(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *ctx)
+{
+	struct aie2_ctx_snap snap = {
+		.submitted = ctx->submitted,
+		.completed = ctx->completed,
+		.conn_cnt = READ_ONCE(ctx->priv->conn_cnt),
+		.disconn_cnt = READ_ONCE(ctx->priv->disconn_cnt),
+		.migrate_cnt = READ_ONCE(ctx->priv->migrate_cnt),
+		.preempt_cnt = READ_ONCE(ctx->priv->preempt_cnt),
+		.start_col = ctx->start_col,
+		.active = READ_ONCE(ctx->priv->active),
+	};
+
+	if (ctx->priv->gen && !memcmp(&snap, &ctx->priv->gen_snap, sizeof(snap)))
+		return;
+
+	ctx->priv->gen_snap = snap;
+	ctx->priv->gen = ++ndev->ctx_gen;
+}
+
+/*
+ * Clients are walked under RCU and their contexts under SRCU, neither
+ * dev_lock nor any client lock is taken. Only concurrent queries serialize,
+ * on ctx_gen_lock.
+ */
+static int aie2_query_ctx_changed(struct amdxdna_client *client, struct amdxdna_drm_get_array *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	struct amdxdna_drm_hwctx_entry input = {};
+	struct amdxdna_drm_hwctx_entry *tmp;
+	struct amdxdna_client *tmp_client;
+	struct amdxdna_ctx *ctx;
+	unsigned long id;
+	u32 cnt = 0, i;
+	int ret, idx;
+
+	if (!args->num_element || args->num_element > AMDXDNA_MAX_NUM_ELEMENT)
+		return -EINVAL;
+
+	ret = amdxdna_drm_copy_array_from_user(args, &input, sizeof(input), 1);
+	if (ret)
+		return ret;
+
+	tmp = kvcalloc(args->num_element, sizeof(*tmp), GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	mutex_lock(&ndev->ctx_gen_lock);
+	if (input.generation && ndev->ctx_gone_cnt > AIE2_CTX_GONE_NUM &&
+	    input.generation < ndev->ctx_gone[ndev->ctx_gone_cnt % AIE2_CTX_GONE_NUM].gen) {
+		ret = -ESTALE;
+		goto unlock;
+	}
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(tmp_client, &xdna->client_list, node) {
+		idx = srcu_read_lock(&tmp_client->ctx_srcu);
+		amdxdna_for_each_ctx(tmp_client, id, ctx) {
+			if (!ctx->priv)
+				continue;
+
+			aie2_ctx_gen_stamp(ndev, ctx);
+			if (ctx->priv->gen <= input.generation)
+				continue;
+
+			if (cnt < args->num_element)
+				aie2_fill_ctx_entry(&tmp[cnt], tmp_client, ctx,
+						    atomic_read(&tmp_client->heap_usage));
+			cnt++;
+		}
+		srcu_read_unlock(&tmp_client->ctx_srcu, idx);
+	}
+	rcu_read_unlock();
+
+	for (i = 0; i < min_t(u64, ndev->ctx_gone_cnt, AIE2_CTX_GONE_NUM); i++) {
+		if (ndev->ctx_gone[i].gen <= input.generation)
+			continue;
+
+		if (cnt < args->num_element) {
+			memset(&tmp[cnt], 0, sizeof(tmp[cnt]));
+			tmp[cnt].pid = ndev->ctx_gone[i].pid;
+			tmp[cnt].context_id = ndev->ctx_gone[i].ctx_id;
+			tmp[cnt].generation = ndev->ctx_gone[i].gen;
+			tmp[cnt].state = AMDXDNA_HWCTX_STATE_DESTROYED;
+		}
+		cnt++;
+	}
+
+	if (cnt > args->num_element) {
+		args->num_element = cnt;
+		ret = -ENOSPC;
+		goto unlock;
+	}
+	mutex_unlock(&ndev->ctx_gen_lock);
+
+	ret = amdxdna_drm_copy_array_to_user(args, tmp, sizeof(*tmp), cnt);
+	kvfree(tmp);
+	return ret;
+
+unlock:
+	mutex_unlock(&ndev->ctx_gen_lock);
+	kvfree(tmp);
 	return ret;
 }
 
@@ -1307,7 +1765,7 @@ static int aie2_get_array_async_error(struct amdxdna_dev *xdna, struct amdxdna_d
 	struct amdxdna_async_error tmp;
 	int ret;
 
-	ret = aie2_error_get_last_async(xdna, &xdna->dev_handle->async_errs_cache, 1, &tmp);
+	ret = aie2_error_get_last_async(xdna->dev_handle, 1, &tmp);
 	if (ret < 0)
 		goto exit;
 
@@ -1316,6 +1774,32 @@ exit:
 	return ret;
 }
 
+static int aie2_get_array_async_error_ring(struct amdxdna_dev *xdna,
+					   struct amdxdna_drm_get_array *args)
+{
+	struct amdxdna_async_error_entry *entries;
+	struct amdxdna_async_error_entry input;
+	u32 num;
+	int ret;
+
+	if (args->element_size < sizeof(input)) {
+		XDNA_DBG(xdna, "Invalid element size %d", args->element_size);
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&input, u64_to_user_ptr(args->buffer), sizeof(input)))
+		return -EFAULT;
+
+	entries = kvcalloc(args->num_element, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	num = aie2_error_ring_read(xdna->dev_handle, input.seq, entries, args->num_element);
+	ret = amdxdna_drm_copy_array_to_user(args, entries, sizeof(*entries), num);
+	kvfree(entries);
+	return ret;
+}
+
 static int aie2_get_coredump(struct amdxdna_client *client, struct amdxdna_drm_get_array *args)
 {
 	struct amdxdna_drm_aie_coredump config = {};
@@ -1504,6 +1988,7 @@ static int aie2_get_array_hwctx(struct amdxdna_client *client, struct amdxdna_dr
 
 	switch (args->param) {
 	case DRM_AMDXDNA_HW_CONTEXT_ALL:
+	case DRM_AMDXDNA_HW_CONTEXT_STATS:
 		ctx_limit = aie2_rq_context_limit(&xdna->dev_handle->ctx_rq);
 		WARN_ON(ctx_limit > AMDXDNA_MAX_NUM_ELEMENT);
 		ctx_cnt = aie2_rq_active_context(&xdna->dev_handle->ctx_rq);
@@ -1516,7 +2001,8 @@ static int aie2_get_array_hwctx(struct amdxdna_client *client, struct amdxdna_dr
 			goto exit;
 		}
 
-		ret = aie2_query_ctx_status_array(client, tmp, 0, 0);
+		ret = aie2_query_ctx_status_array(client, tmp, 0, 0,
+						  args->param == DRM_AMDXDNA_HW_CONTEXT_ALL);
 		if (ret)
 			goto exit;
 
@@ -1537,7 +2023,7 @@ static int aie2_get_array_hwctx(struct amdxdna_client *client, struct amdxdna_dr
 
 		ctx_cnt = 1;
 
-		ret = aie2_query_ctx_status_array(client, tmp, input.pid, input.context_id);
+		ret = aie2_query_ctx_status_array(client, tmp, input.pid, input.context_id, true);
 		if (ret)
 			goto exit;
 
@@ -1561,6 +2047,12 @@ static int aie2_get_array(struct amdxdna_client *client, struct amdxdna_drm_get_
 	struct amdxdna_dev *xdna = client->xdna;
 	int ret;
 
+	/* Counters only, polling them should not keep device awake */
+	if (args->param == DRM_AMDXDNA_HW_CONTEXT_STATS)
+		return aie2_get_array_hwctx(client, args);
+	if (args->param == DRM_AMDXDNA_HW_CONTEXT_CHANGED)
+		return aie2_query_ctx_changed(client, args);
+
 	ret = amdxdna_pm_resume_get(xdna);
 	if (ret)
 		return ret;
@@ -1569,6 +2061,9 @@ static int aie2_get_array(struct amdxdna_client *client, struct amdxdna_drm_get_
 	case DRM_AMDXDNA_HW_LAST_ASYNC_ERR:
 		ret = aie2_get_array_async_error(xdna, args);
 		break;
+	case DRM_AMDXDNA_HW_ASYNC_ERR_RING:
+		ret = aie2_get_array_async_error_ring(xdna, args);
+		break;
 	case DRM_AMDXDNA_FW_LOG:
 		if (!amdxdna_admin_access_allowed(xdna)) {
 			ret = -EPERM;
@@ -1768,6 +2263,7 @@ const struct amdxdna_dev_ops aie2_ops = {
 	.ctx_fini		= aie2_ctx_fini,
 	.ctx_config		= aie2_ctx_config,
 	.cmd_submit		= aie2_cmd_submit,
+	.cmd_submit_batch	= aie2_cmd_submit_batch,
 	.cmd_wait		= aie2_cmd_wait,
 	.hmm_invalidate		= aie2_hmm_invalidate,
 	.cmd_get_out_fence	= aie2_cmd_get_out_fence,
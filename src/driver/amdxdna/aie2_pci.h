@@ -11,6 +11,7 @@
 #include <linux/wait.h>
 #include <linux/io.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/rwsem.h>
 #include <linux/workqueue.h>
 #include <linux/completion.h>
@@ -83,9 +84,6 @@
 #define ctx_rq_to_xdna_dev(r) \
 	(ctx_rq_to_ndev(r)->xdna)
 
-#define AIE2_TDR_WAIT		0
-#define AIE2_TDR_SIGNALED	1
-
 #define AIE2_DPT_MSI_ADDR_MASK	GENMASK(23, 0)
 
 struct amdxdna_ctx_priv;
@@ -154,6 +152,15 @@ struct aie_version {
 	u32 minor;
 };
 
+#define AIE2_TELEMETRY_TYPES		5
+#define AIE2_TELEMETRY_CACHE_SIZE	SZ_8K
+struct aie2_telemetry_cache {
+	struct amdxdna_mgmt_dma_hdl	*dma_hdl;
+	struct aie_version		ver;
+	ktime_t				stamp; /* Filled at, 0 if never */
+	ktime_t				last_read;
+};
+
 struct aie_tile_metadata {
 	u16 row_count;
 	u16 row_start;
@@ -190,7 +197,13 @@ struct dpm_clk_freq {
 };
 
 #ifdef AMDXDNA_DEVEL
+/*
+ * Registered PDIs are shared by all contexts loading the same PDI, see
+ * aie2_register_pdis(). Protected by aie2_lock.
+ */
 struct ctx_pdi {
+	struct list_head	node;
+	u32			refcnt;
 	int			id;
 	int			registered;
 	size_t			size;
@@ -200,24 +213,62 @@ struct ctx_pdi {
 #endif
 
 /*
- * Define the maximum number of pending commands in a context.
- * Must be power of 2!
+ * Default number of pending commands in a context, also the most commands
+ * sent to device in one batch. Must be power of 2!
  */
 #define CTX_MAX_CMDS		4
-#define get_job_idx(seq) ((seq) & (CTX_MAX_CMDS - 1))
+/* Limits of queue depth asked for at context creation */
+#define CTX_MIN_DEPTH		1
+#define CTX_MAX_DEPTH		64
+#define get_job_idx(priv, seq) ((seq) & ((priv)->depth - 1))
+
+/*
+ * Slot of the pending job ring, indexed by job seq. The seq is published
+ * after the job so that readers can tell which job a slot holds without
+ * holding a lock or dereferencing a job that may be completing.
+ */
+struct aie2_job_slot {
+	struct amdxdna_sched_job	*job;
+	u64				seq;
+};
+
+/* What a context looked like when it was stamped with a generation */
+struct aie2_ctx_snap {
+	u64				submitted;
+	u64				completed;
+	u64				conn_cnt;
+	u64				disconn_cnt;
+	u64				migrate_cnt;
+	u64				preempt_cnt;
+	u32				start_col;
+	/* Not bool so that there is no padding, snapshots are memcmp()ed */
+	u32				active;
+};
+
 struct amdxdna_ctx_priv {
 	struct amdxdna_gem_obj		*heap;
 #ifdef AMDXDNA_DEVEL
-	struct ctx_pdi			*pdi_infos;
+	struct ctx_pdi			**pdi_infos;
 #endif
 
-	struct amdxdna_gem_obj		*cmd_buf[CTX_MAX_CMDS];
+	/*
+	 * Cmdlist staging buffers, indexed by job seq like pending, so that
+	 * every job job_sem lets in has its own and never waits for another.
+	 * Both have depth entries.
+	 */
+	struct amdxdna_gem_obj		**cmd_buf;
+	u32				depth;
+	/* Most jobs in flight seen, updated under io_lock */
+	u32				inflight_hwm;
 
 	struct mutex			io_lock; /* protect seq and cmd order */
-#ifdef AMDXDNA_DEVEL
-	struct amdxdna_sched_job	*pending[CTX_MAX_CMDS];
-#endif
+	/* BOs used by all commands, keyed by BO handle */
+	struct rw_semaphore		resident_lock;
+	struct xarray			resident_xa;
+	struct aie2_job_slot		*pending;
 	struct semaphore		job_sem;
+	/* Jobs responded in current mailbox pass, see aie2_sched_notify_flush() */
+	struct llist_head		done_jobs;
 
 	struct drm_syncobj		*syncobj;
 
@@ -226,6 +277,8 @@ struct amdxdna_ctx_priv {
 
 	u32				orig_num_col;
 	u32				req_dpm_level;
+	/* GOPS asked for by QoS, committed in aie2_ctx_rq unless degraded */
+	u32				req_gops;
 
 	/* For context runqueue */
 	/* When there is ongoing IO, use this sem avoid runqueue disconnect ctx */
@@ -235,6 +288,53 @@ struct amdxdna_ctx_priv {
 	int				idle_cnt;
 	bool				active;
 	u64				disconn_cnt;
+	/* Cumulative counters for telemetry */
+	u64				conn_cnt;
+	u64				preempt_cnt;
+	/*
+	 * Preempt mode from QoS, time taken by forced preemptions of this
+	 * context, and number of times this context asked to preempt others.
+	 */
+	u32				preempt_mode;
+	u64				preempt_ns;
+	u64				preempt_max_ns;
+	u64				preempt_req_cnt;
+	u64				migrate_cnt;
+	u64				queue_delay_ns;
+	/* Jobs sent to device without waiting for DRM scheduler */
+	u64				direct_cnt;
+	/*
+	 * For idle eviction, see part_handle_idle_ctx(). Average gap between
+	 * last completion and next submission, when the context was last
+	 * evicted as idle, number of such evictions and of those followed by
+	 * a submission within RQ_CTX_EVICT_REGRET_MS.
+	 */
+	u64				burst_gap_ns;
+	ktime_t				evict_time;
+	u64				evict_cnt;
+	u64				evict_regret_cnt;
+	/*
+	 * For RT context with rt_deadline_sched. Relative deadline of a job,
+	 * deadline of the context when it is dispatched, for EDF ordering, and
+	 * number of jobs finished after deadline.
+	 */
+	u64				deadline_ns;
+	ktime_t				deadline;
+	u64				deadline_miss_cnt;
+	/*
+	 * For TDR. Hang deadline of the context, completed counter and time
+	 * seen by last check, and number of times the context was recovered.
+	 */
+	u64				tdr_timeout_ns;
+	u64				tdr_completed;
+	ktime_t				tdr_stamp;
+	u64				tdr_cnt;
+	/*
+	 * For incremental status query, generation the context was last seen
+	 * changed at and what it looked like then. Protected by ctx_gen_lock.
+	 */
+	u64				gen;
+	struct aie2_ctx_snap		gen_snap;
 	bool				force_yield;
 #define CTX_STATE_DISCONNECTED		0x0
 #define CTX_STATE_DISPATCHED		0x1
@@ -246,7 +346,19 @@ struct amdxdna_ctx_priv {
 	int				errno; /* when CTX_STATE_DEAD */
 	bool				should_block;
 	int				priority;
+	/*
+	 * Fair share of device time among contexts of the same priority.
+	 * vruntime is device time scaled by RQ_DEFAULT_WEIGHT / weight.
+	 */
+	u32				weight;
+	u64				vruntime;
+	u64				exec_ns;
+	u64				exec_cnt;
+	ktime_t				last_done;
 	struct aie2_partition		*part;
+	/* Columns of partition last connected to, preferred on reconnect */
+	u32				last_start_col;
+	u32				last_num_col;
 	struct completion		parts_work_comp;
 
 	/* Hardware context related in below */
@@ -254,14 +366,87 @@ struct amdxdna_ctx_priv {
 	void				*mbox_chann;
 	struct drm_gpu_scheduler	sched;
 	struct drm_sched_entity		entity;
+	/* Scheduler and entity kept for next connect, see aie2_hwctx_stop() */
+	bool				sched_parked;
 };
 
+static inline void
+aie2_job_slot_set(struct amdxdna_ctx_priv *priv, struct amdxdna_sched_job *job, u64 seq)
+{
+	struct aie2_job_slot *slot = &priv->pending[get_job_idx(priv, seq)];
+
+	WRITE_ONCE(slot->job, job);
+	smp_store_release(&slot->seq, seq);
+}
+
+/* The job of seq, if it has been submitted and not completed */
+static inline struct amdxdna_sched_job *
+aie2_job_slot_get(struct amdxdna_ctx_priv *priv, u64 seq)
+{
+	struct aie2_job_slot *slot = &priv->pending[get_job_idx(priv, seq)];
+
+	if (smp_load_acquire(&slot->seq) != seq)
+		return NULL;
+	return READ_ONCE(slot->job);
+}
+
+static inline void
+aie2_job_slot_clear(struct amdxdna_ctx_priv *priv, u64 seq)
+{
+	WRITE_ONCE(priv->pending[get_job_idx(priv, seq)].job, NULL);
+}
+
 enum aie2_dev_status {
 	AIE2_DEV_UNINIT,
 	AIE2_DEV_INIT,
 	AIE2_DEV_START,
 };
 
+/*
+ * Utilization based DPM governor state
+ * @work: periodic sampling work, runs while the device is started
+ * @last_sample: time of the previous sample
+ * @last_busy_ns: device busy time at the previous sample
+ * @util: utilization in percent over the last sample period
+ * @active: governor was in control of the DPM level at the last sample
+ * @residency_ns: time spent at each DPM level
+ * @residency_ts: start of the current residency period, 0 while powered off
+ */
+struct aie2_dpm_gov {
+	struct delayed_work	work;
+	ktime_t			last_sample;
+	u64			last_busy_ns;
+	u32			util;
+	bool			active;
+	u64			*residency_ns;
+	ktime_t			residency_ts;
+};
+
+/*
+ * Time spent in stages of probe and of the last aie2_hw_start(), in ns.
+ * fw_request is the part of firmware request not overlapped by PCI setup.
+ */
+struct aie2_bringup_stats {
+	u64			probe_ns;
+	u64			fw_request_ns;
+	u64			pci_setup_ns;
+	u64			psp_create_ns;
+	u64			smu_start_ns;
+	u64			psp_start_ns;
+	u64			mgmt_init_ns;
+	u64			pm_init_ns;
+	u64			fw_query_ns;
+};
+
+/* Runtime resume latency, updated under dev_lock */
+struct aie2_resume_stats {
+	u64			cnt;
+	u64			last_ns;
+	u64			last_hw_ns;	/* Part of last_ns spent in aie2_hw_start() */
+	u64			total_ns;
+	u64			max_ns;
+};
+
 enum aie2_power_state {
 	SMU_POWER_OFF,
 	SMU_POWER_ON,
@@ -287,6 +472,15 @@ struct aie2_partition {
 	u32			ctx_cnt;
 	u32			hwctx_cnt;
 	u32			rt_ctx_cnt;
+
+	/* Waiting contexts stolen from or by other partitions */
+	u64			migrate_in;
+	u64			migrate_out;
+
+	/* An RT job may miss its deadline, see rq_preempt_work() */
+	bool			deadline_at_risk;
+	/* Bit of each priority asking to preempt lower ones, see aie2_rq_check_preempt() */
+	unsigned long		preempt_req;
 };
 
 struct aie2_ctx_rq {
@@ -299,6 +493,7 @@ struct aie2_ctx_rq {
 	struct workqueue_struct	*work_q;
 	struct work_struct	parts_work;
 	struct list_head	parts_work_waitq;
+	struct work_struct	preempt_work;
 	bool			paused;
 
 	/*
@@ -313,9 +508,34 @@ struct aie2_ctx_rq {
 	u32			rt_ctx_cnt;
 	int			*ctx_width_resv;
 	u32			max_cols;
+
+	/* Cost of partition reconfiguration, see should_update_parts() */
+	u64			avg_conn_ns;
+	u64			avg_disconn_ns;
+	ktime_t			reconf_start;
+	ktime_t			reconf_end;
+	bool			reconf_deferred;
+	u64			reconf_cnt;
+	u64			reconf_total_ns;
+	u64			reconf_max_ns;
+	u64			reconf_limits_cnt;
+	u64			reconf_deferred_cnt;
+	/* Dispatch to partition last connected to */
+	u64			affinity_hit;
+	u64			affinity_miss;
+	/* Dispatch packed onto partition in use, see energy_placement */
+	u64			pack_cnt;
+	u64			idle_evict_cnt;
+	/* Contexts with FRAME or FINE preempt mode */
+	u32			preemptible_cnt;
+	/* QoS GOPS of admitted contexts, see qos_admission */
+	u64			committed_gops;
+	u32			degraded_cnt;
+	u64			admit_reject_cnt;
 };
 
 struct async_events;
+struct aie2_err_ring;
 
 struct aie2_exec_msg_ops {
 	int (*init_cu_req)(struct amdxdna_gem_obj *cmd_bo, void *req,
@@ -355,6 +575,9 @@ struct amdxdna_dev_hdl {
 	u32				dft_dpm_level;
 	u32				max_dpm_level;
 	u32				*dpm_cnt;
+	struct aie2_dpm_gov		dpm_gov;
+	struct aie2_resume_stats	resume_stats;
+	struct aie2_bringup_stats	bringup_stats;
 	u32				clk_gating;
 	u32				npuclk_freq;
 	u32				hclk_freq;
@@ -362,6 +585,8 @@ struct amdxdna_dev_hdl {
 	u32				curr_tops;
 	bool				force_preempt_enabled;
 	bool				frame_boundary_preempt;
+	/* What firmware is set to, may differ for contexts with own preempt mode */
+	bool				frame_boundary_active;
 
 	/* Mailbox and the management channel */
 	struct mailbox			*mbox;
@@ -373,7 +598,8 @@ struct amdxdna_dev_hdl {
 
 	/*
 	 * The aie2_lock should be used in non critical path for below purposes
-	 *   - Exclusively send message to mgmt channel
+	 *   - Send message to mgmt channel, except for the ones done by
+	 *     aie2_send_mgmt_msg_wait_unlocked()
 	 *   - Protect hwctx_cnt
 	 *   - Protect SMU set dpm, power on/off
 	 *
@@ -382,12 +608,53 @@ struct amdxdna_dev_hdl {
 	 * aie2_mgmt_fw_init() needs to send multiple messages, etc.
 	 */
 	struct mutex			aie2_lock;
+	/*
+	 * Held for read while a message is in flight on mgmt_chann, for write
+	 * with aie2_lock held to create or destroy it. Mailbox matches
+	 * responses by msg id, so any number of messages may be in flight.
+	 */
+	struct rw_semaphore		mgmt_sem;
+
+	/*
+	 * For DRM_AMDXDNA_HW_CONTEXT_CHANGED. Generation is bumped each time a
+	 * context is seen changed, recently destroyed contexts are kept in a
+	 * ring so that they can be reported as well.
+	 */
+	struct mutex			ctx_gen_lock;
+	u64				ctx_gen;
+#define AIE2_CTX_GONE_NUM		64
+	struct {
+		pid_t			pid;
+		u32			ctx_id;
+		u64			gen;
+	}				ctx_gone[AIE2_CTX_GONE_NUM];
+	u64				ctx_gone_cnt;
+
+#ifdef AMDXDNA_DEVEL
+	struct list_head		pdi_list; /* Registered PDIs, protected by aie2_lock */
+#endif
+
+	/*
+	 * Last telemetry of each type, refreshed in the background every
+	 * telemetry_cache_ms while somebody keeps reading it. See
+	 * aie2_telemetry_read(). Protected by telemetry_lock, which is taken
+	 * without aie2_lock, so that telemetry isn't held up by context setup.
+	 */
+	struct mutex			telemetry_lock;
+	struct aie2_telemetry_cache	telemetry[AIE2_TELEMETRY_TYPES];
+	struct delayed_work		telemetry_work;
 
 	struct aie2_ctx_rq		ctx_rq;
 
 	struct aie2_tdr			tdr;
 
-	struct amdxdna_async_err_cache	async_errs_cache; // For async error event cache
+	struct aie2_err_ring		*err_ring; /* Async errors, see aie2_error.c */
+
+	/* Userptr BO invalidation and repopulation, for debugfs */
+	atomic64_t			hmm_inval_cnt;
+	atomic64_t			hmm_populate_cnt;
+	atomic64_t			hmm_populate_bytes;
+	atomic64_t			hmm_populate_ns;
 };
 
 #define DEFINE_BAR_OFFSET(reg_name, bar, reg_addr) \
@@ -459,6 +726,9 @@ int aie2_runtime_cfg(struct amdxdna_dev_hdl *ndev,
 extern uint aie2_control_flags;
 extern const struct amdxdna_dev_ops aie2_ops;
 int aie2_check_protocol(struct amdxdna_dev_hdl *ndev, u32 fw_major, u32 fw_minor);
+void aie2_ctx_gen_gone(struct amdxdna_ctx *ctx);
+int aie2_telemetry_read(struct amdxdna_dev_hdl *ndev, u32 type, void *buf, size_t size,
+			struct aie_version *ver, bool fresh);
 
 /* aie2_smu.c */
 int aie2_smu_start(struct amdxdna_dev_hdl *ndev);
@@ -478,10 +748,16 @@ int aie2_pm_set_mode(struct amdxdna_dev_hdl *ndev, int target);
 #define aie2_pm_add_dpm_level(d, l) aie2_pm_set_dft_dpm_level(d, l, true)
 #define aie2_pm_del_dpm_level(d, l) aie2_pm_set_dft_dpm_level(d, l, false)
 void aie2_pm_set_dft_dpm_level(struct amdxdna_dev_hdl *ndev, u32 level, bool add);
+void aie2_pm_gov_start(struct amdxdna_dev_hdl *ndev);
+void aie2_pm_gov_stop(struct amdxdna_dev_hdl *ndev);
+void aie2_pm_update_residency(struct amdxdna_dev_hdl *ndev);
+const char *aie2_pm_gov_name(void);
 
 /* aie2_tdr.c */
 void aie2_tdr_start(struct amdxdna_dev *xdna);
 void aie2_tdr_stop(struct amdxdna_dev *xdna);
+void aie2_tdr_ctx_init(struct amdxdna_ctx *ctx);
+int aie2_tdr_ctx_set_timeout(struct amdxdna_ctx *ctx, u32 timeout_ms);
 
 static inline bool aie2_pm_is_turbo(struct amdxdna_dev_hdl *ndev)
 {
@@ -503,9 +779,12 @@ void aie2_error_async_events_free(struct amdxdna_dev_hdl *ndev);
 int aie2_error_async_events_send(struct amdxdna_dev_hdl *ndev);
 int aie2_error_async_msg_thread(void *data);
 int aie2_error_async_cache_init(struct amdxdna_dev_hdl *ndev);
-int aie2_error_get_last_async(struct amdxdna_dev *xdna,
-			      struct amdxdna_async_err_cache *err_cache, u32 num_errs,
-			      void *errors);
+int aie2_error_ring_init(struct amdxdna_dev_hdl *ndev);
+u32 aie2_error_ring_read(struct amdxdna_dev_hdl *ndev, u64 seq,
+			 struct amdxdna_async_error_entry *entries, u32 num);
+void aie2_error_set_owner(struct amdxdna_dev_hdl *ndev, struct amdxdna_ctx *ctx, bool connect);
+int aie2_error_get_last_async(struct amdxdna_dev_hdl *ndev, u32 num_errs,
+			      struct amdxdna_async_error *errors);
 
 /* aie2_message.c */
 void aie2_msg_init(struct amdxdna_dev_hdl *ndev);
@@ -517,6 +796,7 @@ int aie2_get_runtime_cfg(struct amdxdna_dev_hdl *ndev, u32 type, u64 *value);
 int aie2_fine_preemption(struct amdxdna_dev_hdl *ndev, bool disable);
 int aie2_force_preemption(struct amdxdna_dev_hdl *ndev, u32 hwctx_id);
 int aie2_frame_boundary_preemption(struct amdxdna_dev_hdl *ndev, bool enable);
+int aie2_preempt_granularity(struct amdxdna_dev_hdl *ndev, bool frame);
 int aie2_update_prop_time_quota(struct amdxdna_dev_hdl *ndev,
 				struct amdxdna_ctx *ctx, u32 us);
 int aie2_check_protocol_version(struct amdxdna_dev_hdl *ndev);
@@ -560,12 +840,21 @@ int aie2_set_trace_categories(struct amdxdna_dev_hdl *ndev, u32 categories);
 int aie2_config_cu(struct amdxdna_ctx *ctx);
 int aie2_execbuf(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t));
+int aie2_execbufs(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+		  struct amdxdna_sched_job **jobs, u32 job_cnt,
+		  int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
 				struct amdxdna_sched_job *job,
 				int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 			       struct amdxdna_sched_job *job,
 			       int (*notify_cb)(void *, void __iomem *, size_t));
+int aie2_cmdlist_build(struct amdxdna_gem_obj *cmd_abo, struct amdxdna_gem_obj *list_abo,
+		       u32 *offsets, u32 count, u32 *size, u32 *op, u32 *cnt);
+int aie2_cmdlist_coalesce_execbuf(struct amdxdna_ctx *ctx,
+				  struct amdxdna_sched_job *job,
+				  struct amdxdna_sched_job **jobs, u32 job_cnt,
+				  int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_sync_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_config_debug_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
@@ -579,14 +868,18 @@ void aie2_ctx_disconnect(struct amdxdna_ctx *ctx, bool wait);
 int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32 size);
 int aie2_cmd_submit(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq);
+int aie2_cmd_submit_batch(struct amdxdna_ctx *ctx, struct amdxdna_sched_job **jobs,
+			  u32 cnt, u64 *seq);
 int aie2_cmd_wait(struct amdxdna_ctx *ctx, u64 seq, u32 timeout);
+void aie2_sched_notify_flush(void *arg);
 struct dma_fence *aie2_cmd_get_out_fence(struct amdxdna_ctx *ctx, u64 seq);
 void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo, unsigned long cur_seq);
 void aie2_dump_ctx(struct amdxdna_ctx *ctx);
 
 /* aie2_hwctx.c */
 int aie2_hwctx_start(struct amdxdna_ctx *ctx);
-void aie2_hwctx_stop(struct amdxdna_ctx *ctx);
+void aie2_hwctx_stop(struct amdxdna_ctx *ctx, bool park);
+void aie2_hwctx_unpark(struct amdxdna_ctx *ctx);
 
 /* aie2_ctx_runqueue.c */
 int aie2_rq_init(struct aie2_ctx_rq *rq);
@@ -594,7 +887,8 @@ void aie2_rq_fini(struct aie2_ctx_rq *rq);
 int aie2_rq_context_limit(struct aie2_ctx_rq *rq);
 int aie2_rq_active_context(struct aie2_ctx_rq *rq);
 bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq);
-bool aie2_rq_is_all_context_stuck(struct aie2_ctx_rq *rq);
+int aie2_rq_handle_stuck_ctx(struct aie2_ctx_rq *rq, u64 default_ns, bool dump_only,
+			     u64 *next_ns);
 void aie2_rq_dump_all(struct aie2_ctx_rq *rq);
 void aie2_rq_stop_all(struct aie2_ctx_rq *rq);
 void aie2_rq_restart_all(struct aie2_ctx_rq *rq);
@@ -605,6 +899,11 @@ void aie2_rq_del(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
 int aie2_rq_submit_enter(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
 void aie2_rq_submit_exit(struct amdxdna_ctx *ctx);
 void aie2_rq_yield(struct amdxdna_ctx *ctx);
+void aie2_rq_burst_start(struct amdxdna_ctx *ctx, ktime_t now);
+void aie2_rq_account(struct amdxdna_ctx *ctx, ktime_t start);
+void aie2_rq_check_deadline(struct amdxdna_ctx *ctx, ktime_t start, ktime_t deadline);
+void aie2_rq_check_preempt(struct amdxdna_ctx *ctx);
+void aie2_rq_deadline_done(struct amdxdna_ctx *ctx, ktime_t deadline);
 
 static inline bool aie2_is_ctx_connected(struct amdxdna_ctx *ctx)
 {
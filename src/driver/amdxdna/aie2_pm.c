@@ -4,6 +4,7 @@
  */
 
 #include <drm/drm_managed.h>
+#include <linux/math64.h>
 #include "aie2_pci.h"
 
 #define DEFAULT_SYS_EFF_FACTOR 2
@@ -11,9 +12,48 @@ uint sys_eff_factor = DEFAULT_SYS_EFF_FACTOR;
 module_param(sys_eff_factor, int, 0444);
 MODULE_PARM_DESC(sys_eff_factor, "System efficiency factor, default 2");
 
+enum aie2_dpm_governor {
+	AIE2_DPM_GOV_STATIC,	/* DPM level from per-context QoS requests */
+	AIE2_DPM_GOV_ONDEMAND,	/* Jump to max when busy, step down when idle */
+	AIE2_DPM_GOV_PPW,	/* Perf-per-watt, step one level in either direction */
+	AIE2_DPM_GOV_MAX
+};
+
+static const char * const aie2_dpm_gov_names[] = {
+	[AIE2_DPM_GOV_STATIC] = "static",
+	[AIE2_DPM_GOV_ONDEMAND] = "ondemand",
+	[AIE2_DPM_GOV_PPW] = "perf-per-watt",
+};
+
+static uint dpm_governor = AIE2_DPM_GOV_STATIC;
+module_param(dpm_governor, uint, 0644);
+MODULE_PARM_DESC(dpm_governor, "DPM governor: 0 static (Default), 1 ondemand, 2 perf-per-watt");
+
+static uint dpm_up_threshold = 80;
+module_param(dpm_up_threshold, uint, 0644);
+MODULE_PARM_DESC(dpm_up_threshold, "Utilization percent to raise DPM level, default 80");
+
+static uint dpm_down_threshold = 30;
+module_param(dpm_down_threshold, uint, 0644);
+MODULE_PARM_DESC(dpm_down_threshold, "Utilization percent to lower DPM level, default 30");
+
+static uint dpm_sample_ms = 20;
+module_param(dpm_sample_ms, uint, 0644);
+MODULE_PARM_DESC(dpm_sample_ms, "DPM governor sampling period in ms, default 20");
+
 #define AIE2_CLK_GATING_ENABLE	1
 #define AIE2_CLK_GATING_DISABLE	0
 
+#define AIE2_DPM_GOV_PERIOD	msecs_to_jiffies(max(dpm_sample_ms, 1U))
+
+static bool aie2_pm_gov_active(struct amdxdna_dev_hdl *ndev)
+{
+	u32 gov = READ_ONCE(dpm_governor);
+
+	return gov > AIE2_DPM_GOV_STATIC && gov < AIE2_DPM_GOV_MAX &&
+		ndev->pw_mode == POWER_MODE_DEFAULT;
+}
+
 static int pm_set_clk_gating(struct amdxdna_dev_hdl *ndev, u32 val)
 {
 	int ret;
@@ -117,13 +157,125 @@ void aie2_pm_set_dft_dpm_level(struct amdxdna_dev_hdl *ndev, u32 level, bool add
 			break;
 
 	XDNA_DBG(xdna, "Set default DPM to %d", level);
-	if (ndev->pw_mode == POWER_MODE_DEFAULT && ndev->dev_status == AIE2_DEV_START)
+	/* The governor owns the DPM level while it is active */
+	if (ndev->pw_mode == POWER_MODE_DEFAULT && ndev->dev_status == AIE2_DEV_START &&
+	    !aie2_pm_gov_active(ndev))
 		ndev->priv->hw_ops.set_dpm(ndev, level);
 	ndev->dft_dpm_level = level;
 
 	mutex_unlock(&ndev->aie2_lock);
 }
 
+/* Caller must hold aie2_lock or be the only one changing the DPM level */
+void aie2_pm_update_residency(struct amdxdna_dev_hdl *ndev)
+{
+	struct aie2_dpm_gov *gov = &ndev->dpm_gov;
+	ktime_t now;
+
+	if (!gov->residency_ns || !gov->residency_ts)
+		return;
+
+	now = ktime_get();
+	gov->residency_ns[ndev->dpm_level] += ktime_to_ns(ktime_sub(now, gov->residency_ts));
+	gov->residency_ts = now;
+}
+
+const char *aie2_pm_gov_name(void)
+{
+	u32 gov = READ_ONCE(dpm_governor);
+
+	return gov < AIE2_DPM_GOV_MAX ? aie2_dpm_gov_names[gov] : "invalid";
+}
+
+static u32 aie2_pm_gov_next_level(struct amdxdna_dev_hdl *ndev, u32 util)
+{
+	u32 level = ndev->dpm_level;
+
+	if (util >= READ_ONCE(dpm_up_threshold)) {
+		if (READ_ONCE(dpm_governor) == AIE2_DPM_GOV_ONDEMAND)
+			return ndev->max_dpm_level;
+		return min(level + 1, ndev->max_dpm_level);
+	}
+
+	if (util <= READ_ONCE(dpm_down_threshold) && level)
+		return level - 1;
+
+	return level;
+}
+
+static void aie2_pm_gov_work(struct work_struct *work)
+{
+	struct aie2_dpm_gov *gov = container_of(to_delayed_work(work),
+						struct aie2_dpm_gov, work);
+	struct amdxdna_dev_hdl *ndev = container_of(gov, struct amdxdna_dev_hdl, dpm_gov);
+	struct amdxdna_dev *xdna = ndev->xdna;
+	u64 busy_ns, elapsed_ns;
+	bool active;
+	ktime_t now;
+	u32 level;
+
+	now = ktime_get();
+	busy_ns = amdxdna_stats_busy_ns(&xdna->stats);
+	elapsed_ns = ktime_to_ns(ktime_sub(now, gov->last_sample));
+	gov->util = elapsed_ns ?
+		min_t(u64, div64_u64((busy_ns - gov->last_busy_ns) * 100, elapsed_ns), 100) : 0;
+	gov->last_sample = now;
+	gov->last_busy_ns = busy_ns;
+
+	mutex_lock(&ndev->aie2_lock);
+	if (ndev->dev_status != AIE2_DEV_START)
+		goto unlock;
+
+	active = aie2_pm_gov_active(ndev);
+	if (active) {
+		level = aie2_pm_gov_next_level(ndev, gov->util);
+	} else if (gov->active && ndev->pw_mode == POWER_MODE_DEFAULT) {
+		/* Governor switched off, hand the level back to QoS requests */
+		level = ndev->dft_dpm_level;
+	} else {
+		level = ndev->dpm_level;
+	}
+	gov->active = active;
+
+	if (level != ndev->dpm_level) {
+		XDNA_DBG(xdna, "Utilization %u%%, DPM %u -> %u", gov->util,
+			 ndev->dpm_level, level);
+		ndev->priv->hw_ops.set_dpm(ndev, level);
+	}
+unlock:
+	mutex_unlock(&ndev->aie2_lock);
+
+	schedule_delayed_work(&gov->work, AIE2_DPM_GOV_PERIOD);
+}
+
+/*
+ * Sampling runs while the device is started, so switching the governor at
+ * runtime takes effect at the next sample. Runtime suspend stops it.
+ */
+void aie2_pm_gov_start(struct amdxdna_dev_hdl *ndev)
+{
+	struct aie2_dpm_gov *gov = &ndev->dpm_gov;
+
+	gov->last_sample = ktime_get();
+	gov->last_busy_ns = amdxdna_stats_busy_ns(&ndev->xdna->stats);
+	gov->util = 0;
+	gov->active = false;
+	gov->residency_ts = gov->last_sample;
+	schedule_delayed_work(&gov->work, AIE2_DPM_GOV_PERIOD);
+}
+
+void aie2_pm_gov_stop(struct amdxdna_dev_hdl *ndev)
+{
+	struct aie2_dpm_gov *gov = &ndev->dpm_gov;
+
+	cancel_delayed_work_sync(&gov->work);
+
+	mutex_lock(&ndev->aie2_lock);
+	aie2_pm_update_residency(ndev);
+	gov->residency_ts = 0;
+	mutex_unlock(&ndev->aie2_lock);
+}
+
 int aie2_pm_init(struct amdxdna_dev_hdl *ndev)
 {
 	struct amdxdna_dev *xdna = ndev->xdna;
@@ -146,6 +298,12 @@ int aie2_pm_init(struct amdxdna_dev_hdl *ndev)
 		return -ENOMEM;
 	ndev->max_dpm_level--;
 
+	ndev->dpm_gov.residency_ns = drmm_kcalloc(&xdna->ddev, ndev->max_dpm_level + 1,
+						  sizeof(u64), GFP_KERNEL);
+	if (!ndev->dpm_gov.residency_ns)
+		return -ENOMEM;
+	INIT_DELAYED_WORK(&ndev->dpm_gov.work, aie2_pm_gov_work);
+
 	ret = ndev->priv->hw_ops.set_dpm(ndev, ndev->max_dpm_level);
 	if (ret)
 		return ret;
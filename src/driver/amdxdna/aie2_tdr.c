@@ -17,46 +17,81 @@ bool tdr_dump_ctx;
 module_param(tdr_dump_ctx, bool, 0644);
 MODULE_PARM_DESC(tdr_dump_ctx, "Instead of resetting, just dump the ctx info for debugging");
 
+static uint tdr_latency_factor = 10;
+module_param(tdr_latency_factor, uint, 0644);
+MODULE_PARM_DESC(tdr_latency_factor,
+		 "Context hang deadline in multiples of its QoS latency, default 10; 0 - Use timeout_in_sec");
+
 #define TDR_TIMEOUT_JIFF msecs_to_jiffies(timeout_in_sec * 1000)
+#define TDR_TIMEOUT_NS ((u64)timeout_in_sec * NSEC_PER_SEC)
+/* Bounds of context deadline and of check interval */
+#define TDR_MIN_TIMEOUT_MS	100
+#define TDR_MAX_TIMEOUT_MS	(600 * MSEC_PER_SEC)
+#define TDR_MIN_PERIOD_MS	50
 #define to_tdr(w) \
 	((struct aie2_tdr *)container_of(w, struct aie2_tdr, work))
 #define tdr_to_xdna(t) \
 	(((struct amdxdna_dev_hdl *)container_of(t, struct amdxdna_dev_hdl, tdr))->xdna)
 
-/* This function returns recover is needed or not */
-static bool aie2_tdr_detect(struct aie2_tdr *tdr)
+void aie2_tdr_ctx_init(struct amdxdna_ctx *ctx)
 {
-	struct amdxdna_dev *xdna = tdr_to_xdna(tdr);
-	struct aie2_ctx_rq *rq = &xdna->dev_handle->ctx_rq;
+	u64 timeout_ms = 0;
 
-	if (aie2_rq_handle_idle_ctx(rq))
-		return false;
+	if (ctx->qos.latency && tdr_latency_factor)
+		timeout_ms = clamp_t(u64, (u64)ctx->qos.latency * tdr_latency_factor,
+				     TDR_MIN_TIMEOUT_MS, TDR_MAX_TIMEOUT_MS);
 
-	return aie2_rq_is_all_context_stuck(rq);
+	ctx->priv->tdr_timeout_ns = timeout_ms * NSEC_PER_MSEC;
+	ctx->priv->tdr_cnt = 0;
 }
 
-static void aie2_tdr_recover(struct aie2_tdr *tdr, bool dump_only)
+int aie2_tdr_ctx_set_timeout(struct amdxdna_ctx *ctx, u32 timeout_ms)
 {
-	struct amdxdna_dev *xdna = tdr_to_xdna(tdr);
-	struct aie2_ctx_rq *rq = &xdna->dev_handle->ctx_rq;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
 
-	guard(mutex)(&xdna->dev_lock);
-	aie2_rq_dump_all(rq);
-	if (dump_only)
-		return;
-	aie2_rq_stop_all(rq);
-	aie2_rq_restart_all(rq);
+	if (!timeout_ms) {
+		aie2_tdr_ctx_init(ctx);
+		return 0;
+	}
+
+	if (timeout_ms < TDR_MIN_TIMEOUT_MS || timeout_ms > TDR_MAX_TIMEOUT_MS) {
+		XDNA_DBG(xdna, "%s invalid TDR timeout %u ms", ctx->name, timeout_ms);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(ctx->priv->tdr_timeout_ns, (u64)timeout_ms * NSEC_PER_MSEC);
+	XDNA_DBG(xdna, "%s TDR timeout %u ms", ctx->name, timeout_ms);
+	return 0;
 }
 
 static void aie2_tdr_work(struct work_struct *work)
 {
 	struct aie2_tdr *tdr = to_tdr(work);
+	struct amdxdna_dev *xdna = tdr_to_xdna(tdr);
+	struct aie2_ctx_rq *rq = &xdna->dev_handle->ctx_rq;
+	u64 next_ns;
+	int stuck;
+
+	/* Watchdog is turned off on the fly */
+	if (!timeout_in_sec)
+		return;
+
+	/* Idle context handling keeps its own pace, regardless of deadlines */
+	if (time_after_eq(jiffies, tdr->next_idle_check)) {
+		aie2_rq_handle_idle_ctx(rq);
+		tdr->next_idle_check = jiffies + TDR_TIMEOUT_JIFF;
+	}
 
-	if (aie2_tdr_detect(tdr)) {
-		XDNA_WARN(tdr_to_xdna(tdr),
-			  "Device isn't making progress... Count %d", ++tdr->counter);
-		aie2_tdr_recover(tdr, tdr_dump_ctx);
+	stuck = aie2_rq_handle_stuck_ctx(rq, TDR_TIMEOUT_NS, tdr_dump_ctx, &next_ns);
+	if (stuck) {
+		tdr->counter += stuck;
+		XDNA_WARN(xdna, "%d context(s) not making progress... Count %d",
+			  stuck, tdr->counter);
 	}
+
+	/* Check twice within the shortest deadline */
+	WRITE_ONCE(tdr->period_ms, clamp_t(u64, div_u64(next_ns, 2 * NSEC_PER_MSEC),
+					   TDR_MIN_PERIOD_MS, timeout_in_sec * MSEC_PER_SEC));
 }
 
 static void aie2_tdr_timer(struct timer_list *t)
@@ -69,7 +104,7 @@ static void aie2_tdr_timer(struct timer_list *t)
 
 	queue_work(system_long_wq, &tdr->work);
 
-	mod_timer(t, jiffies + TDR_TIMEOUT_JIFF);
+	mod_timer(t, jiffies + msecs_to_jiffies(READ_ONCE(tdr->period_ms)));
 }
 
 void aie2_tdr_start(struct amdxdna_dev *xdna)
@@ -84,6 +119,8 @@ void aie2_tdr_start(struct amdxdna_dev *xdna)
 	timer_setup(&tdr->timer, aie2_tdr_timer, 0);
 	INIT_WORK(&tdr->work, aie2_tdr_work);
 
+	tdr->period_ms = timeout_in_sec * MSEC_PER_SEC;
+	tdr->next_idle_check = jiffies + TDR_TIMEOUT_JIFF;
 	tdr->timer.expires = jiffies + TDR_TIMEOUT_JIFF;
 	add_timer(&tdr->timer);
 	tdr->started = 1;
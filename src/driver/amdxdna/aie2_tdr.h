@@ -1,6 +1,6 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 /*
- * Copyright (C) 2024, Advanced Micro Devices, Inc.
+ * Copyright (C) 2024-2025, Advanced Micro Devices, Inc.
  */
 
 #ifndef _AIE2_TDR_H_
@@ -14,9 +14,10 @@ struct aie2_tdr {
 	struct timer_list	timer;
 	struct work_struct	work;
 	int			counter;
-	u32			status;
 	int			started;
-	u32			progress;
+	/* Check interval, follows the shortest context deadline */
+	u32			period_ms;
+	unsigned long		next_idle_check;
 };
 
 #endif /* _AIE2_TDR_H_ */
@@ -5,11 +5,15 @@
 
 #include <drm/drm_mm.h>
 #include <linux/dma-buf.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
 
 #include "amdxdna_carvedout_buf.h"
 #include "amdxdna_drm.h"
 
 #define MAX_SG_ENTRY_SIZE	(2UL * 1024 * 1024 * 1024)
+/* Carvedout is cleared this much at a time, rescheduling in between */
+#define SCRUB_CHUNK_SIZE	SZ_64M
 
 /*
  * Carvedout memory is a chunk of memory which is physically contiguous and
@@ -25,36 +29,133 @@ u64 carvedout_size;
 module_param(carvedout_size, ullong, 0444);
 MODULE_PARM_DESC(carvedout_size, "Physical memory size for reserved memory chunk");
 
+/*
+ * Free space in mm is always zeroed. Memory of a released buffer, and the
+ * whole carvedout at init, stays allocated in mm on dirty list until it is
+ * cleared by scrub_work, so that allocation never waits for clearing unless
+ * carvedout is short of clean memory.
+ */
 struct amdxdna_carvedout {
-	struct drm_mm	mm;
-	struct mutex	lock; /* protect mm */
+	struct drm_mm		mm;
+	struct mutex		lock; /* protect mm, dirty and dirty_cnt */
+	struct list_head	dirty;
+	u32			dirty_cnt; /* Nodes on dirty list or being scrubbed */
+	struct work_struct	scrub_work;
 } carvedout;
 
+struct amdxdna_cbuf_priv {
+	struct drm_mm_node node;
+	struct list_head entry; /* On carvedout dirty list */
+};
+
 bool amdxdna_use_carvedout(void)
 {
 	return !!carvedout_size;
 }
 
+static bool amdxdna_carvedout_scrub(u64 start, u64 size)
+{
+	void *kva;
+	u64 len;
+
+	while (size) {
+		len = min_t(u64, size, SCRUB_CHUNK_SIZE);
+		kva = ioremap_cache(start, len);
+		if (!kva)
+			return false;
+		memset(kva, 0, len);
+		iounmap(kva);
+		start += len;
+		size -= len;
+		cond_resched();
+	}
+	return true;
+}
+
+static void amdxdna_carvedout_scrub_work(struct work_struct *work)
+{
+	struct amdxdna_cbuf_priv *cbuf;
+	bool cleared;
+
+	mutex_lock(&carvedout.lock);
+	while ((cbuf = list_first_entry_or_null(&carvedout.dirty,
+						struct amdxdna_cbuf_priv, entry))) {
+		list_del(&cbuf->entry);
+		mutex_unlock(&carvedout.lock);
+
+		cleared = amdxdna_carvedout_scrub(cbuf->node.start, cbuf->node.size);
+
+		mutex_lock(&carvedout.lock);
+		carvedout.dirty_cnt--;
+		if (!cleared) {
+			/* Never hand out memory which is not cleared, leave it in use */
+			pr_err("Failed to clear carvedout 0x%llx size 0x%llx\n",
+			       cbuf->node.start, cbuf->node.size);
+			continue;
+		}
+		drm_mm_remove_node(&cbuf->node);
+		kfree(cbuf);
+	}
+	mutex_unlock(&carvedout.lock);
+}
+
+/* Caller holds carvedout lock */
+static void amdxdna_carvedout_add_dirty(struct amdxdna_cbuf_priv *cbuf)
+{
+	list_add_tail(&cbuf->entry, &carvedout.dirty);
+	carvedout.dirty_cnt++;
+	queue_work(system_unbound_wq, &carvedout.scrub_work);
+}
+
 void amdxdna_carvedout_init(void)
 {
+	struct amdxdna_cbuf_priv *cbuf;
+	u64 off, len;
+
 	if (!amdxdna_use_carvedout())
 		return;
 	mutex_init(&carvedout.lock);
+	INIT_LIST_HEAD(&carvedout.dirty);
+	INIT_WORK(&carvedout.scrub_work, amdxdna_carvedout_scrub_work);
 	drm_mm_init(&carvedout.mm, carvedout_addr, carvedout_size);
+
+	/* Content left from before is cleared in background, chunk by chunk */
+	mutex_lock(&carvedout.lock);
+	for (off = 0; off < carvedout_size; off += len) {
+		len = min_t(u64, carvedout_size - off, SCRUB_CHUNK_SIZE);
+		cbuf = kzalloc(sizeof(*cbuf), GFP_KERNEL);
+		if (!cbuf) {
+			if (!amdxdna_carvedout_scrub(carvedout_addr + off, len))
+				pr_err("Failed to clear carvedout offset 0x%llx\n", off);
+			continue;
+		}
+		cbuf->node.start = carvedout_addr + off;
+		cbuf->node.size = len;
+		if (drm_mm_reserve_node(&carvedout.mm, &cbuf->node)) {
+			kfree(cbuf);
+			continue;
+		}
+		amdxdna_carvedout_add_dirty(cbuf);
+	}
+	mutex_unlock(&carvedout.lock);
 }
 
 void amdxdna_carvedout_fini(void)
 {
+	struct drm_mm_node *node, *next;
+
 	if (!amdxdna_use_carvedout())
 		return;
+	flush_work(&carvedout.scrub_work);
+	/* Only nodes failed to be cleared are left */
+	drm_mm_for_each_node_safe(node, next, &carvedout.mm) {
+		drm_mm_remove_node(node);
+		kfree(container_of(node, struct amdxdna_cbuf_priv, node));
+	}
 	mutex_destroy(&carvedout.lock);
 	drm_mm_takedown(&carvedout.mm);
 }
 
-struct amdxdna_cbuf_priv {
-	struct drm_mm_node node;
-};
-
 static struct sg_table *amdxdna_cbuf_map(struct dma_buf_attachment *attach,
 					 enum dma_data_direction direction)
 {
@@ -123,11 +224,10 @@ static void amdxdna_cbuf_release(struct dma_buf *dbuf)
 {
 	struct amdxdna_cbuf_priv *cbuf = dbuf->priv;
 
+	/* Memory goes back to mm once it is cleared */
 	mutex_lock(&carvedout.lock);
-	drm_mm_remove_node(&cbuf->node);
+	amdxdna_carvedout_add_dirty(cbuf);
 	mutex_unlock(&carvedout.lock);
-
-	kfree(cbuf);
 }
 
 static vm_fault_t amdxdna_cbuf_vm_fault(struct vm_fault *vmf)
@@ -186,19 +286,6 @@ static const struct dma_buf_ops amdxdna_cbuf_dmabuf_ops = {
 	.vunmap = amdxdna_cbuf_vunmap,
 };
 
-static void amdxdna_cbuf_clear(struct dma_buf *dbuf)
-{
-	struct iosys_map vmap = IOSYS_MAP_INIT_VADDR(NULL);
-
-	dma_buf_vmap(dbuf, &vmap);
-	if (!vmap.vaddr) {
-		pr_err("Failed to vmap carveout dma buf\n");
-		return;
-	}
-	memset(vmap.vaddr, 0, dbuf->size);
-	dma_buf_vunmap(dbuf, &vmap);
-}
-
 struct dma_buf *amdxdna_get_carvedout_buf(struct drm_device *dev, size_t size,
 					  u64 alignment)
 {
@@ -214,6 +301,14 @@ struct dma_buf *amdxdna_get_carvedout_buf(struct drm_device *dev, size_t size,
 	mutex_lock(&carvedout.lock);
 	ret = drm_mm_insert_node_generic(&carvedout.mm, &cbuf->node, size,
 					 alignment, 0, DRM_MM_INSERT_BEST);
+	if (ret == -ENOSPC && carvedout.dirty_cnt) {
+		/* Memory being cleared may be what is needed */
+		mutex_unlock(&carvedout.lock);
+		flush_work(&carvedout.scrub_work);
+		mutex_lock(&carvedout.lock);
+		ret = drm_mm_insert_node_generic(&carvedout.mm, &cbuf->node, size,
+						 alignment, 0, DRM_MM_INSERT_BEST);
+	}
 	mutex_unlock(&carvedout.lock);
 	if (ret)
 		goto free_cbuf;
@@ -229,11 +324,13 @@ struct dma_buf *amdxdna_get_carvedout_buf(struct drm_device *dev, size_t size,
 		goto remove_node;
 	}
 
-	amdxdna_cbuf_clear(dbuf);
 	return dbuf;
 
 remove_node:
+	/* Nothing is written to it, memory is still clean */
+	mutex_lock(&carvedout.lock);
 	drm_mm_remove_node(&cbuf->node);
+	mutex_unlock(&carvedout.lock);
 free_cbuf:
 	kfree(cbuf);
 	return ERR_PTR(ret);
@@ -7,8 +7,11 @@
 #include <linux/dma-buf.h>
 #include "amdxdna_cma_buf.h"
 
+#define MAX_CMA_ORDER	16
+
 struct amdxdna_cmabuf_priv {
 	struct device *dev;
+	struct amdxdna_cma_region *region;
 	dma_addr_t dma_addr;
 	void *cpu_addr;
 	size_t size;
@@ -78,6 +81,10 @@ static void amdxdna_cmabuf_release(struct dma_buf *dbuf)
 
 	dma_free_coherent(cmabuf->dev, cmabuf->size,
 			  cmabuf->cpu_addr, cmabuf->dma_addr);
+	if (cmabuf->region) {
+		atomic64_sub(cmabuf->size, &cmabuf->region->used);
+		atomic64_dec(&cmabuf->region->buf_cnt);
+	}
 	kfree(cmabuf);
 	dbuf->priv = NULL;
 }
@@ -191,45 +198,131 @@ int get_cma_mem_index(u64 flags)
 	return flags & 0xFF;
 }
 
+static size_t amdxdna_cma_region_free(struct amdxdna_cma_region *region)
+{
+	u64 used = atomic64_read(&region->used);
+
+	/* Region of unknown size is always worth a try */
+	if (!region->size)
+		return SIZE_MAX;
+	return used < region->size ? region->size - used : 0;
+}
+
+static struct dma_buf *
+amdxdna_cma_region_alloc(struct amdxdna_cma_region *region, size_t size)
+{
+	struct amdxdna_cmabuf_priv *cmabuf;
+	struct dma_buf *dma_buf;
+
+	dma_buf = amdxdna_get_cma_buf(region->dev, size);
+	if (IS_ERR(dma_buf)) {
+		atomic64_inc(&region->fail_cnt);
+		return dma_buf;
+	}
+
+	cmabuf = dma_buf->priv;
+	cmabuf->region = region;
+	atomic64_add(cmabuf->size, &region->used);
+	atomic64_inc(&region->buf_cnt);
+	return dma_buf;
+}
+
+/* Region a goes before region b for a buffer of size on node nid */
+static bool amdxdna_cma_region_before(struct amdxdna_cma_region *a,
+				      struct amdxdna_cma_region *b,
+				      int nid, size_t size)
+{
+	if ((a->nid == nid) != (b->nid == nid))
+		return a->nid == nid;
+	/* Large buffers keep their interleaved order */
+	if (size >= AMDXDNA_CMA_INTERLEAVE_SIZE)
+		return false;
+	return amdxdna_cma_region_free(a) > amdxdna_cma_region_free(b);
+}
+
+/*
+ * Order regions to try, skipping the one already tried and regions known to
+ * be too full. Regions on node of device come first. Small buffers go to the
+ * region with most free space, large ones are spread round-robin, so that
+ * neither usage nor fragmentation piles up on the first region.
+ */
+static int amdxdna_cma_region_order(struct amdxdna_cma_region *regions, int max_regions,
+				    int skip, atomic_t *next, int nid, size_t size,
+				    int *order)
+{
+	int tmp[MAX_CMA_ORDER];
+	int n = 0, start;
+	int i, j, cur;
+
+	for (i = 0; i < max_regions && n < MAX_CMA_ORDER; i++) {
+		if (i == skip || !regions[i].dev || amdxdna_cma_region_free(&regions[i]) < size)
+			continue;
+		order[n++] = i;
+	}
+	if (n < 2)
+		return n;
+
+	if (size >= AMDXDNA_CMA_INTERLEAVE_SIZE) {
+		start = (unsigned int)atomic_inc_return(next) % n;
+		for (i = 0; i < n; i++)
+			tmp[i] = order[(start + i) % n];
+		memcpy(order, tmp, n * sizeof(*order));
+	}
+
+	/* Stable insertion sort, there are only a few regions */
+	for (i = 1; i < n; i++) {
+		cur = order[i];
+		for (j = i; j > 0 && amdxdna_cma_region_before(&regions[cur],
+							       &regions[order[j - 1]],
+							       nid, size); j--)
+			order[j] = order[j - 1];
+		order[j] = cur;
+	}
+	return n;
+}
+
 /**
  * amdxdna_get_cma_buf_with_fallback - Allocate CMA buffer with region fallback
- * @region_devs: Array of device pointers for CMA regions (NULL = not initialized)
+ * @regions: Array of CMA regions (dev NULL = not initialized)
  * @max_regions: Maximum number of regions in the array
+ * @next: Round-robin cursor for interleaving large buffers
  * @fallback_dev: Device to use as final fallback (system default CMA)
  * @size: Size of buffer to allocate
  * @flags: Flags containing region index in bits [7:0]
  *
  * Attempts allocation in order:
  * 1. Requested region (extracted from flags)
- * 2. Other available initialized regions
+ * 2. Other initialized regions with enough free space, device local NUMA
+ *    node first, see amdxdna_cma_region_order()
  * 3. System default CMA (fallback_dev)
  *
  * Return: dma_buf pointer on success, ERR_PTR on failure
  */
-struct dma_buf *amdxdna_get_cma_buf_with_fallback(struct device *const *region_devs,
-						  int max_regions,
+struct dma_buf *amdxdna_get_cma_buf_with_fallback(struct amdxdna_cma_region *regions,
+						  int max_regions, atomic_t *next,
 						  struct device *fallback_dev,
 						  size_t size, u64 flags)
 {
+	int order[MAX_CMA_ORDER];
 	struct dma_buf *dma_buf;
 	int mem_index;
-	int i;
+	int i, n;
 
+	size = PAGE_ALIGN(size);
 	mem_index = get_cma_mem_index(flags);
 
 	/* Try requested region first */
-	if (mem_index < max_regions && region_devs[mem_index]) {
-		dma_buf = amdxdna_get_cma_buf(region_devs[mem_index], size);
+	if (mem_index < max_regions && regions[mem_index].dev &&
+	    amdxdna_cma_region_free(&regions[mem_index]) >= size) {
+		dma_buf = amdxdna_cma_region_alloc(&regions[mem_index], size);
 		if (!IS_ERR(dma_buf))
 			return dma_buf;
 	}
 
-	/* Try any other available initialized region */
-	for (i = 0; i < max_regions; i++) {
-		if (i == mem_index || !region_devs[i])
-			continue;
-
-		dma_buf = amdxdna_get_cma_buf(region_devs[i], size);
+	n = amdxdna_cma_region_order(regions, max_regions, mem_index, next,
+				     dev_to_node(fallback_dev), size, order);
+	for (i = 0; i < n; i++) {
+		dma_buf = amdxdna_cma_region_alloc(&regions[order[i]], size);
 		if (!IS_ERR(dma_buf))
 			return dma_buf;
 	}
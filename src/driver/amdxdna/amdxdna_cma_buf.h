@@ -6,13 +6,30 @@
 #ifndef _AMDXDNA_CMA_BUF_H_
 #define _AMDXDNA_CMA_BUF_H_
 
+#include <linux/sizes.h>
 #include <drm/drm_device.h>
 
+/* Buffers of this size or bigger are interleaved across CMA regions */
+#define AMDXDNA_CMA_INTERLEAVE_SIZE	SZ_2M
+
+/*
+ * Reserved CMA region of device. Usage is tracked by driver, so that a
+ * region known to be full is not tried and usage can be shown in sysfs.
+ */
+struct amdxdna_cma_region {
+	struct device	*dev; /* NULL if region is not initialized */
+	int		nid; /* NUMA node of region memory */
+	size_t		size; /* 0 if not known */
+	atomic64_t	used; /* Bytes of live buffers */
+	atomic64_t	buf_cnt; /* Number of live buffers */
+	atomic64_t	fail_cnt; /* Failed allocations */
+};
+
 bool amdxdna_use_cma(void);
 int get_cma_mem_index(u64 flags);
 struct dma_buf *amdxdna_get_cma_buf(struct device *dev, size_t size);
-struct dma_buf *amdxdna_get_cma_buf_with_fallback(struct device *const *region_devs,
-						  int max_regions,
+struct dma_buf *amdxdna_get_cma_buf_with_fallback(struct amdxdna_cma_region *regions,
+						  int max_regions, atomic_t *next,
 						  struct device *fallback_dev,
 						  size_t size, u64 flags);
 
@@ -5,6 +5,7 @@
 
 #include <linux/version.h>
 #include <linux/kref.h>
+#include <linux/seq_file.h>
 #include <drm/drm_file.h>
 #include <drm/drm_cache.h>
 #include <drm/drm_syncobj.h>
@@ -17,6 +18,11 @@
 
 #define MAX_CTX_ID		255
 #define MAX_ARG_COUNT		4095
+/*
+ * Jobs with up to this many argument BOs are allocated from job cache,
+ * bigger ones fall back to kzalloc().
+ */
+#define JOB_CACHE_ARG_COUNT	16
 
 struct amdxdna_fence {
 	struct dma_fence	base;
@@ -24,6 +30,12 @@ struct amdxdna_fence {
 	struct amdxdna_ctx	*ctx;
 };
 
+static struct kmem_cache *amdxdna_job_cache;
+static struct kmem_cache *amdxdna_fence_cache;
+static atomic64_t job_cache_alloc_cnt;
+static atomic64_t job_cache_miss_cnt;
+static atomic64_t arg_cache_hit_cnt;
+
 static const char *amdxdna_fence_get_driver_name(struct dma_fence *fence)
 {
 	return KBUILD_MODNAME;
@@ -38,16 +50,30 @@ static const char *amdxdna_fence_get_timeline_name(struct dma_fence *fence)
 	return xdna_fence->ctx->name;
 }
 
+static void amdxdna_fence_free_rcu(struct rcu_head *rcu)
+{
+	struct dma_fence *fence = container_of(rcu, struct dma_fence, rcu);
+
+	kmem_cache_free(amdxdna_fence_cache, container_of(fence, struct amdxdna_fence, base));
+}
+
+/* Same as dma_fence_free(), but back to the fence cache */
+static void amdxdna_fence_release(struct dma_fence *fence)
+{
+	call_rcu(&fence->rcu, amdxdna_fence_free_rcu);
+}
+
 static const struct dma_fence_ops fence_ops = {
 	.get_driver_name = amdxdna_fence_get_driver_name,
 	.get_timeline_name = amdxdna_fence_get_timeline_name,
+	.release = amdxdna_fence_release,
 };
 
 static struct dma_fence *amdxdna_fence_create(struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_fence *fence;
 
-	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	fence = kmem_cache_zalloc(amdxdna_fence_cache, GFP_KERNEL);
 	if (!fence)
 		return NULL;
 
@@ -57,33 +83,84 @@ static struct dma_fence *amdxdna_fence_create(struct amdxdna_ctx *ctx)
 	return &fence->base;
 }
 
-static void amdxdna_ctx_destroy_rcu(struct amdxdna_ctx *ctx, struct srcu_struct *ss)
+/* Binary syncobj of user for ctx->ready_fence, see AMDXDNA_CTX_CREATE_ASYNC */
+static int amdxdna_ctx_ready_syncobj_create(struct amdxdna_ctx *ctx, u32 *hdl)
 {
-	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct drm_syncobj *syncobj;
+	int ret;
 
-	synchronize_srcu(ss);
+	ctx->ready_fence = amdxdna_fence_create(ctx);
+	if (!ctx->ready_fence)
+		return -ENOMEM;
+
+	ret = drm_syncobj_create(&syncobj, 0, ctx->ready_fence);
+	if (ret)
+		goto put_fence;
+
+	ret = drm_syncobj_get_handle(ctx->client->filp, syncobj, hdl);
+	drm_syncobj_put(syncobj);
+	if (ret)
+		goto put_fence;
+
+	return 0;
+
+put_fence:
+	dma_fence_put(ctx->ready_fence);
+	ctx->ready_fence = NULL;
+	return ret;
+}
+
+/* Context is off ctx_xa and SRCU readers which may have seen it are done */
+static void amdxdna_ctx_destroy(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
 
 	xdna->dev_info->ops->ctx_fini(ctx);
+	if (ctx->ready_fence) {
+		dma_fence_signal(ctx->ready_fence);
+		dma_fence_put(ctx->ready_fence);
+	}
+	mutex_destroy(&ctx->submit_lock);
 	kfree(ctx->name);
 	kfree(ctx);
 }
 
+static void amdxdna_ctx_destroy_rcu(struct amdxdna_ctx *ctx, struct srcu_struct *ss)
+{
+	synchronize_srcu(ss);
+	amdxdna_ctx_destroy(ctx);
+}
+
 /*
  * This should be called in flush() and remove(). DO NOT call in other syscalls.
  * This guarantee that when ctx and resources will be released, if user
  * doesn't call amdxdna_drm_destroy_hwctx_ioctl.
+ *
+ * All contexts are taken off ctx_xa first, so that one SRCU grace period
+ * covers all of them instead of one per context.
  */
 void amdxdna_ctx_remove_all(struct amdxdna_client *client)
 {
 	struct amdxdna_ctx *ctx;
 	unsigned long ctx_id;
+	struct xarray gone;
 
+	xa_init(&gone);
 	amdxdna_for_each_ctx(client, ctx_id, ctx) {
 		XDNA_DBG(client->xdna, "PID %d close context %d",
 			 client->pid, ctx->id);
 		xa_erase(&client->ctx_xa, ctx->id);
-		amdxdna_ctx_destroy_rcu(ctx, &client->ctx_srcu);
+		if (xa_insert(&gone, ctx_id, ctx, GFP_KERNEL))
+			amdxdna_ctx_destroy_rcu(ctx, &client->ctx_srcu);
 	}
+
+	if (xa_empty(&gone))
+		return;
+
+	synchronize_srcu(&client->ctx_srcu);
+	xa_for_each(&gone, ctx_id, ctx)
+		amdxdna_ctx_destroy(ctx);
+	xa_destroy(&gone);
 }
 
 int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
@@ -94,7 +171,17 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	struct amdxdna_ctx *ctx;
 	int ret, idx;
 
-	if (args->ext || args->ext_flags)
+	/* No implicit padding, every byte of the struct is checked or returned */
+	BUILD_BUG_ON(offsetofend(struct amdxdna_drm_create_hwctx, pad) !=
+		     sizeof(struct amdxdna_drm_create_hwctx));
+	if (args->ext || args->ext_flags || args->out_flags || args->pad)
+		return -EINVAL;
+
+	if (args->flags & ~AMDXDNA_CTX_CREATE_ASYNC)
+		return -EINVAL;
+
+	/* Range is up to device */
+	if (args->queue_depth && !is_power_of_2(args->queue_depth))
 		return -EINVAL;
 
 	if (!drm_dev_enter(dev, &idx))
@@ -105,6 +192,7 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 		ret = -ENOMEM;
 		goto exit;
 	}
+	mutex_init(&ctx->submit_lock);
 
 	if (copy_from_user(&ctx->qos, u64_to_user_ptr(args->qos_p), sizeof(ctx->qos))) {
 		XDNA_ERR(xdna, "Access QoS info failed");
@@ -118,6 +206,8 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	ctx->max_opc = args->max_opc;
 	ctx->umq_bo = args->umq_bo;
 	ctx->log_buf_bo = args->log_buf_bo;
+	ctx->dev_heap_bo = args->dev_heap;
+	ctx->queue_depth = args->queue_depth;
 	ret = xa_alloc_cyclic(&client->ctx_xa, &ctx->id, ctx,
 			      XA_LIMIT(AMDXDNA_INVALID_CTX_HANDLE + 1, MAX_CTX_ID),
 			      &client->next_ctxid, GFP_KERNEL);
@@ -132,27 +222,50 @@ int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 		goto rm_id;
 	}
 
+	args->ready_syncobj = AMDXDNA_INVALID_FENCE_HANDLE;
+	if (args->flags & AMDXDNA_CTX_CREATE_ASYNC) {
+		ret = amdxdna_ctx_ready_syncobj_create(ctx, &args->ready_syncobj);
+		if (ret) {
+			XDNA_ERR(xdna, "Create ready syncobj failed, ret %d", ret);
+			goto free_name;
+		}
+	}
+
 	ret = xdna->dev_info->ops->ctx_init(ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "Init ctx failed, ret %d", ret);
-		goto free_name;
+		goto destroy_ready;
 	}
 
+	/* Device is done with context setup or doesn't defer any of it */
+	if (ctx->ready_fence && !ctx->ready_deferred)
+		dma_fence_signal(ctx->ready_fence);
+
 	atomic64_set(&ctx->job_free_cnt, 0);
 	args->handle = ctx->id;
 	args->syncobj_handle = ctx->syncobj_hdl;
 	args->umq_doorbell = ctx->doorbell_offset;
+	if (ctx->qos_degraded)
+		args->out_flags |= AMDXDNA_CTX_OUT_QOS_DEGRADED;
 
 	XDNA_DBG(xdna, "PID %d create context %d, ret %d", client->pid, args->handle, ret);
 	drm_dev_exit(idx);
 
 	return 0;
 
+destroy_ready:
+	if (ctx->ready_fence) {
+		drm_syncobj_destroy(filp, args->ready_syncobj);
+		args->ready_syncobj = AMDXDNA_INVALID_FENCE_HANDLE;
+		dma_fence_signal(ctx->ready_fence);
+		dma_fence_put(ctx->ready_fence);
+	}
 free_name:
 	kfree(ctx->name);
 rm_id:
 	xa_erase(&client->ctx_xa, ctx->id);
 free_ctx:
+	mutex_destroy(&ctx->submit_lock);
 	kfree(ctx);
 exit:
 	drm_dev_exit(idx);
@@ -205,6 +318,7 @@ int amdxdna_drm_config_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 
 	switch (args->param_type) {
 	case DRM_AMDXDNA_HWCTX_CONFIG_CU:
+	case DRM_AMDXDNA_HWCTX_BUILD_CMDLIST:
 		/* For those types that param_val is pointer */
 		if (buf_size > PAGE_SIZE) {
 			XDNA_ERR(xdna, "Config CU param buffer too large");
@@ -224,6 +338,11 @@ int amdxdna_drm_config_hwctx_ioctl(struct drm_device *dev, void *data, struct dr
 	case DRM_AMDXDNA_HWCTX_ASSIGN_DBG_BUF:
 	case DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF:
 	case DRM_AMDXDNA_HWCTX_CONFIG_OPCODE_TIMEOUT:
+	case DRM_AMDXDNA_HWCTX_ADD_RESIDENT_BO:
+	case DRM_AMDXDNA_HWCTX_REMOVE_RESIDENT_BO:
+	case DRM_AMDXDNA_HWCTX_CONFIG_TDR_TIMEOUT:
+	case DRM_AMDXDNA_HWCTX_UMQ_DOORBELL:
+	case DRM_AMDXDNA_HWCTX_QUEUE_DEPTH:
 		/* For those types that param_val is a value */
 		buf = NULL;
 		buf_size = 0;
@@ -261,44 +380,186 @@ amdxdna_arg_bos_put(struct amdxdna_sched_job *job)
 	}
 }
 
+/* Pin BO used by commands, it stays pinned until BO is freed */
+int amdxdna_arg_bo_pin(struct amdxdna_gem_obj *abo)
+{
+	int ret = 0;
+
+	mutex_lock(&abo->lock);
+	if (!(abo->flags & BO_SUBMIT_PINNED)) {
+		ret = amdxdna_gem_pin_nolock(abo);
+		if (!ret)
+			abo->flags |= BO_SUBMIT_PINNED;
+	}
+	mutex_unlock(&abo->lock);
+
+	return ret;
+}
+
+static void amdxdna_arg_cache_put(struct drm_gem_object **objs, u32 cnt)
+{
+	u32 i;
+
+	for (i = 0; i < cnt; i++)
+		drm_gem_object_put(objs[i]);
+}
+
+void amdxdna_arg_cache_fini(struct amdxdna_client *client)
+{
+	amdxdna_arg_cache_put(client->arg_cache_objs, client->arg_cache_obj_cnt);
+	client->arg_cache_obj_cnt = 0;
+	client->arg_cache_hdl_cnt = 0;
+}
+
+/*
+ * Handle of gobj is closed. Cache is stale anyway, drop it right away if it
+ * holds gobj, so that the BO is not kept alive, pinned, until the next cache
+ * replacement.
+ */
+void amdxdna_arg_cache_drop(struct amdxdna_client *client, struct drm_gem_object *gobj)
+{
+	struct drm_gem_object *old[AMDXDNA_ARG_CACHE_COUNT];
+	u32 old_cnt = 0, i;
+
+	mutex_lock(&client->arg_cache_lock);
+	for (i = 0; i < client->arg_cache_obj_cnt; i++) {
+		if (client->arg_cache_objs[i] != gobj)
+			continue;
+		old_cnt = client->arg_cache_obj_cnt;
+		memcpy(old, client->arg_cache_objs, old_cnt * sizeof(*old));
+		client->arg_cache_obj_cnt = 0;
+		client->arg_cache_hdl_cnt = 0;
+		break;
+	}
+	mutex_unlock(&client->arg_cache_lock);
+
+	amdxdna_arg_cache_put(old, old_cnt);
+}
+
+/*
+ * A handle can only be closed and its number reused after handle_gen is
+ * bumped, so an unchanged handle_gen means cached handles still point to the
+ * cached BOs. Cached BOs are pinned already, pinning stays until BO is freed.
+ */
+static bool
+amdxdna_arg_cache_get(struct amdxdna_client *client,
+		      struct amdxdna_sched_job *job,
+		      u32 *bo_hdls, u32 bo_cnt)
+{
+	bool hit = false;
+	u32 i;
+
+	mutex_lock(&client->arg_cache_lock);
+	if (client->arg_cache_hdl_cnt != bo_cnt ||
+	    client->arg_cache_gen != atomic64_read(&client->handle_gen) ||
+	    memcmp(client->arg_cache_hdls, bo_hdls, bo_cnt * sizeof(*bo_hdls)))
+		goto unlock;
+
+	for (i = 0; i < client->arg_cache_obj_cnt; i++) {
+		drm_gem_object_get(client->arg_cache_objs[i]);
+		job->bos[i].obj = client->arg_cache_objs[i];
+	}
+	job->bo_cnt = client->arg_cache_obj_cnt;
+	atomic64_inc(&arg_cache_hit_cnt);
+	hit = true;
+unlock:
+	mutex_unlock(&client->arg_cache_lock);
+	return hit;
+}
+
+static void
+amdxdna_arg_cache_set(struct amdxdna_client *client,
+		      struct amdxdna_sched_job *job,
+		      u32 *bo_hdls, u32 bo_cnt, u64 gen)
+{
+	struct drm_gem_object *old[AMDXDNA_ARG_CACHE_COUNT];
+	u32 old_cnt, i;
+
+	if (bo_cnt > AMDXDNA_ARG_CACHE_COUNT)
+		return;
+
+	for (i = 0; i < job->bo_cnt; i++)
+		drm_gem_object_get(job->bos[i].obj);
+
+	mutex_lock(&client->arg_cache_lock);
+	old_cnt = client->arg_cache_obj_cnt;
+	memcpy(old, client->arg_cache_objs, old_cnt * sizeof(*old));
+	for (i = 0; i < job->bo_cnt; i++)
+		client->arg_cache_objs[i] = job->bos[i].obj;
+	client->arg_cache_obj_cnt = job->bo_cnt;
+	memcpy(client->arg_cache_hdls, bo_hdls, bo_cnt * sizeof(*bo_hdls));
+	client->arg_cache_hdl_cnt = bo_cnt;
+	client->arg_cache_gen = gen;
+	mutex_unlock(&client->arg_cache_lock);
+
+	/* Last reference of old BOs may go, don't free them under the lock */
+	amdxdna_arg_cache_put(old, old_cnt);
+}
+
+/*
+ * Look all handles up with one pass over the handle table, as
+ * drm_gem_objects_lookup() does, and drop repeated handles so that every BO
+ * shows up once in job->bos. Handles sent by shim are sorted, the slow
+ * duplicate search is only for handles not in ascending order.
+ */
 static int
 amdxdna_arg_bos_lookup(struct amdxdna_client *client,
 		       struct amdxdna_sched_job *job,
 		       u32 *bo_hdls, u32 bo_cnt)
 {
+	struct drm_file *filp = client->filp;
 	struct drm_gem_object *gobj;
-	int i, ret;
+	bool sorted = true;
+	u32 i, j, cnt = 0;
+	u64 gen;
+	int ret;
+
+	if (!bo_cnt)
+		return 0;
+
+	if (amdxdna_arg_cache_get(client, job, bo_hdls, bo_cnt))
+		return 0;
+
+	/* Read before lookup, any handle closed from here on stales the cache */
+	gen = atomic64_read(&client->handle_gen);
 
 	job->bo_cnt = bo_cnt;
-	for (i = 0; i < job->bo_cnt; i++) {
-		struct amdxdna_gem_obj *abo;
+	spin_lock(&filp->table_lock);
+	for (i = 0; i < bo_cnt; i++) {
+		if (i && bo_hdls[i] == bo_hdls[i - 1])
+			continue;
 
-		gobj = drm_gem_object_lookup(client->filp, bo_hdls[i]);
+		gobj = idr_find(&filp->object_idr, bo_hdls[i]);
 		if (!gobj) {
+			spin_unlock(&filp->table_lock);
 			ret = -ENOENT;
 			goto put_arg_bos;
 		}
-		abo = to_xdna_obj(gobj);
 
-		mutex_lock(&abo->lock);
-		if (abo->flags & BO_SUBMIT_PINNED) {
-			mutex_unlock(&abo->lock);
-			job->bos[i].obj = gobj;
-			continue;
+		if (i && bo_hdls[i] < bo_hdls[i - 1])
+			sorted = false;
+		if (!sorted) {
+			for (j = 0; j < cnt; j++) {
+				if (job->bos[j].obj == gobj)
+					break;
+			}
+			if (j < cnt)
+				continue;
 		}
 
-		ret = amdxdna_gem_pin_nolock(abo);
-		if (ret) {
-			mutex_unlock(&abo->lock);
-			drm_gem_object_put(gobj);
-			goto put_arg_bos;
-		}
-		abo->flags |= BO_SUBMIT_PINNED;
-		mutex_unlock(&abo->lock);
+		drm_gem_object_get(gobj);
+		job->bos[cnt++].obj = gobj;
+	}
+	spin_unlock(&filp->table_lock);
+	job->bo_cnt = cnt;
 
-		job->bos[i].obj = gobj;
+	for (i = 0; i < cnt; i++) {
+		ret = amdxdna_arg_bo_pin(to_xdna_obj(job->bos[i].obj));
+		if (ret)
+			goto put_arg_bos;
 	}
 
+	amdxdna_arg_cache_set(client, job, bo_hdls, bo_cnt, gen);
 	return 0;
 
 put_arg_bos:
@@ -388,20 +649,26 @@ void amdxdna_unlock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx
 	ww_acquire_fini(ctx);
 }
 
-int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
-		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
-		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
-		       u32 ctx_hdl, u64 *seq)
+static struct amdxdna_sched_job *
+amdxdna_job_alloc(struct amdxdna_client *client, u32 opcode, u32 cmd_bo_hdl,
+		  u32 *arg_bo_hdls, u32 arg_bo_cnt)
 {
 	struct amdxdna_dev *xdna = client->xdna;
 	struct amdxdna_sched_job *job;
-	struct amdxdna_ctx *ctx;
-	int ret, idx;
+	int ret;
 
 	XDNA_DBG(xdna, "Command BO hdl %d, Arg BO count %d", cmd_bo_hdl, arg_bo_cnt);
-	job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
+	if (arg_bo_cnt <= JOB_CACHE_ARG_COUNT) {
+		job = kmem_cache_zalloc(amdxdna_job_cache, GFP_KERNEL);
+		if (job)
+			job->from_cache = true;
+		atomic64_inc(&job_cache_alloc_cnt);
+	} else {
+		job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
+		atomic64_inc(&job_cache_miss_cnt);
+	}
 	if (!job)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 
 	if (cmd_bo_hdl != AMDXDNA_INVALID_BO_HANDLE) {
 		job->cmd_bo = amdxdna_gem_get_obj(client, cmd_bo_hdl, AMDXDNA_BO_SHARE);
@@ -422,36 +689,102 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 			goto cmd_put;
 		}
 	}
+	job->opcode = opcode;
 
-	idx = srcu_read_lock(&client->ctx_srcu);
-	ctx = xa_load(&client->ctx_xa, ctx_hdl);
-	if (!ctx) {
-		XDNA_ERR(xdna, "PID %d failed to get ctx %d",
-			 client->pid, ctx_hdl);
-		ret = -EINVAL;
-		goto unlock_srcu;
-	}
+	return job;
+
+cmd_put:
+	amdxdna_gem_put_obj(job->cmd_bo);
+free_job:
+	amdxdna_sched_job_free(job);
+	return ERR_PTR(ret);
+}
+
+void amdxdna_sched_job_free(struct amdxdna_sched_job *job)
+{
+	if (job->from_cache)
+		kmem_cache_free(amdxdna_job_cache, job);
+	else
+		kfree(job);
+}
 
+static void amdxdna_job_free(struct amdxdna_sched_job *job)
+{
+	amdxdna_arg_bos_put(job);
+	amdxdna_gem_put_obj(job->cmd_bo);
+	amdxdna_sched_job_free(job);
+}
+
+/* Bind job allocated by amdxdna_job_alloc() to ctx, before it is pushed */
+static int amdxdna_job_prepare(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
 	job->ctx = ctx;
 	job->mm = current->mm;
-	job->opcode = opcode;
 
 	job->fence = amdxdna_fence_create(ctx);
 	if (!job->fence) {
-		XDNA_ERR(xdna, "Failed to create fence");
-		ret = -ENOMEM;
-		goto unlock_srcu;
+		XDNA_ERR(ctx->client->xdna, "Failed to create fence");
+		return -ENOMEM;
 	}
 	kref_init(&job->refcnt);
+	return 0;
+}
+
+/*
+ * Push one job allocated by amdxdna_job_alloc() to device layer. Caller holds
+ * client->ctx_srcu. On failure, caller still owns the job and should free it.
+ */
+static int amdxdna_job_push(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+			    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+			    u64 *seq)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	int ret;
+
+	ret = amdxdna_job_prepare(ctx, job);
+	if (ret)
+		return ret;
 
 	ret = xdna->dev_info->ops->cmd_submit(ctx, job, syncobj_hdls,
 					      syncobj_points, syncobj_cnt, seq);
 	if (ret) {
 		if (ret != -ERESTARTSYS)
 			XDNA_ERR(xdna, "Submit cmds failed, ret %d", ret);
-		goto put_fence;
+		dma_fence_put(job->fence);
+		return ret;
 	}
 
+	trace_amdxdna_debug_point(ctx->name, *seq, "job pushed");
+	return 0;
+}
+
+int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
+		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
+		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+		       u32 ctx_hdl, u64 *seq)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_sched_job *job;
+	struct amdxdna_ctx *ctx;
+	int ret, idx;
+
+	job = amdxdna_job_alloc(client, opcode, cmd_bo_hdl, arg_bo_hdls, arg_bo_cnt);
+	if (IS_ERR(job))
+		return PTR_ERR(job);
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, ctx_hdl);
+	if (!ctx) {
+		XDNA_ERR(xdna, "PID %d failed to get ctx %d",
+			 client->pid, ctx_hdl);
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	ret = amdxdna_job_push(ctx, job, syncobj_hdls, syncobj_points, syncobj_cnt, seq);
+	if (ret)
+		goto unlock_srcu;
+
 	/*
 	 * The amdxdna_ctx_destroy_rcu() will release ctx and associated
 	 * resource after synchronize_srcu(). The submitted jobs should be
@@ -459,33 +792,109 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 	 * For here we can unlock SRCU.
 	 */
 	srcu_read_unlock(&client->ctx_srcu, idx);
-	trace_amdxdna_debug_point(ctx->name, *seq, "job pushed");
 
 	return 0;
 
-put_fence:
-	dma_fence_put(job->fence);
 unlock_srcu:
 	srcu_read_unlock(&client->ctx_srcu, idx);
-	amdxdna_arg_bos_put(job);
-cmd_put:
-	amdxdna_gem_put_obj(job->cmd_bo);
-free_job:
-	kfree(job);
+	amdxdna_job_free(job);
+	return ret;
+}
+
+/*
+ * Submit a batch of user commands sharing one argument BO list. All command
+ * and argument BOs are looked up before anything is pushed, the device layer
+ * then pushes the jobs in one go so that they get consecutive sequence
+ * numbers. It may push fewer than cmd_cnt, when the context has no room for
+ * more. On return, *submitted is the number of pushed jobs and *seq is the
+ * sequence number of the last one.
+ */
+static int amdxdna_cmd_submit_batch(struct amdxdna_client *client,
+				    u32 *cmd_bo_hdls, u32 cmd_cnt,
+				    u32 *arg_bo_hdls, u32 arg_bo_cnt,
+				    u32 ctx_hdl, u64 *seq, u32 *submitted)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_sched_job **jobs;
+	struct amdxdna_ctx *ctx;
+	int ret = 0, idx;
+	u32 i;
+
+	*submitted = 0;
+	if (!xdna->dev_info->ops->cmd_submit_batch)
+		return -EOPNOTSUPP;
+
+	jobs = kcalloc(cmd_cnt, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < cmd_cnt; i++) {
+		jobs[i] = amdxdna_job_alloc(client, OP_USER, cmd_bo_hdls[i],
+					    arg_bo_hdls, arg_bo_cnt);
+		if (IS_ERR(jobs[i])) {
+			ret = PTR_ERR(jobs[i]);
+			jobs[i] = NULL;
+			goto free_jobs;
+		}
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, ctx_hdl);
+	if (!ctx) {
+		XDNA_ERR(xdna, "PID %d failed to get ctx %d", client->pid, ctx_hdl);
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	for (i = 0; i < cmd_cnt; i++) {
+		ret = amdxdna_job_prepare(ctx, jobs[i]);
+		if (ret)
+			goto unlock_srcu;
+	}
+
+	ret = xdna->dev_info->ops->cmd_submit_batch(ctx, jobs, cmd_cnt, seq);
+	if (ret < 0) {
+		if (ret != -ERESTARTSYS)
+			XDNA_ERR(xdna, "Submit cmds failed, ret %d", ret);
+		goto unlock_srcu;
+	}
+	/* Pushed jobs are owned by device layer now */
+	*submitted = ret;
+	for (i = 0; i < *submitted; i++)
+		jobs[i] = NULL;
+	ret = 0;
+	trace_amdxdna_debug_point(ctx->name, *seq, "jobs pushed");
+
+unlock_srcu:
+	srcu_read_unlock(&client->ctx_srcu, idx);
+free_jobs:
+	for (i = 0; i < cmd_cnt; i++) {
+		if (!jobs[i])
+			continue;
+		if (jobs[i]->fence)
+			dma_fence_put(jobs[i]->fence);
+		amdxdna_job_free(jobs[i]);
+	}
+	kfree(jobs);
 	return ret;
 }
 
 /*
- * The submit command ioctl submits a command to firmware. One firmware command
+ * The submit command ioctl submits commands to firmware. One firmware command
  * may contain multiple command BOs for processing as a whole.
- * The command sequence number is returned which can be used for wait command ioctl.
+ * If more than one command BO handle is given, each of them is submitted as an
+ * independent command. The sequence number of the last command is returned
+ * which can be used for wait command ioctl.
  */
 static int amdxdna_drm_submit_execbuf(struct amdxdna_client *client,
 				      struct amdxdna_drm_exec_cmd *args)
 {
+	u32 arg_bo_hdls_buf[JOB_CACHE_ARG_COUNT];
 	struct amdxdna_dev *xdna = client->xdna;
+	u32 *cmd_bo_hdls = NULL;
 	u32 *arg_bo_hdls;
 	u32 cmd_bo_hdl;
+	u32 submitted;
 	int ret;
 
 	if (args->arg_count > MAX_ARG_COUNT) {
@@ -493,39 +902,100 @@ static int amdxdna_drm_submit_execbuf(struct amdxdna_client *client,
 		return -EINVAL;
 	}
 
-	/* Only support single command for now. */
-	if (args->cmd_count != 1) {
+	if (!args->cmd_count || args->cmd_count > AMDXDNA_EXEC_CMD_MAX_BATCH) {
 		XDNA_ERR(xdna, "Invalid cmd bo count %d", args->cmd_count);
 		return -EINVAL;
 	}
 
-	cmd_bo_hdl = (u32)args->cmd_handles;
-	if (cmd_bo_hdl == AMDXDNA_INVALID_BO_HANDLE) {
-		XDNA_ERR(xdna, "Invalid cmd bo handle");
-		return -EINVAL;
+	if (args->cmd_count == 1) {
+		cmd_bo_hdl = (u32)args->cmd_handles;
+		if (cmd_bo_hdl == AMDXDNA_INVALID_BO_HANDLE) {
+			XDNA_ERR(xdna, "Invalid cmd bo handle");
+			return -EINVAL;
+		}
+	} else {
+		cmd_bo_hdls = kcalloc(args->cmd_count, sizeof(u32), GFP_KERNEL);
+		if (!cmd_bo_hdls)
+			return -ENOMEM;
+		if (copy_from_user(cmd_bo_hdls, u64_to_user_ptr(args->cmd_handles),
+				   args->cmd_count * sizeof(u32))) {
+			ret = -EFAULT;
+			goto free_cmd_bo_hdls;
+		}
 	}
 
 	if (!args->arg_count) {
 		arg_bo_hdls = NULL;
 	} else {
-		arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
-		if (!arg_bo_hdls)
-			return -ENOMEM;
+		if (args->arg_count <= ARRAY_SIZE(arg_bo_hdls_buf))
+			arg_bo_hdls = arg_bo_hdls_buf;
+		else
+			arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+		if (!arg_bo_hdls) {
+			ret = -ENOMEM;
+			goto free_cmd_bo_hdls;
+		}
 		ret = copy_from_user(arg_bo_hdls, u64_to_user_ptr(args->args),
 				     args->arg_count * sizeof(u32));
 		if (ret) {
 			ret = -EFAULT;
-			goto free_cmd_bo_hdls;
+			goto free_arg_bo_hdls;
 		}
 	}
 
-	ret = amdxdna_cmd_submit(client, OP_USER, cmd_bo_hdl, arg_bo_hdls,
-				 args->arg_count, NULL, NULL, 0, args->hwctx, &args->seq);
+	if (!cmd_bo_hdls) {
+		ret = amdxdna_cmd_submit(client, OP_USER, cmd_bo_hdl, arg_bo_hdls,
+					 args->arg_count, NULL, NULL, 0, args->hwctx,
+					 &args->seq);
+		goto free_arg_bo_hdls;
+	}
+
+	ret = amdxdna_cmd_submit_batch(client, cmd_bo_hdls, args->cmd_count,
+				       arg_bo_hdls, args->arg_count, args->hwctx,
+				       &args->seq, &submitted);
+	/* Tell user how many commands made it in, the rest can be retried */
+	args->cmd_count = submitted;
 
+free_arg_bo_hdls:
+	if (arg_bo_hdls != arg_bo_hdls_buf)
+		kfree(arg_bo_hdls);
 free_cmd_bo_hdls:
-	kfree(arg_bo_hdls);
+	kfree(cmd_bo_hdls);
 	if (!ret)
-		XDNA_DBG(xdna, "Pushed cmd %lld to scheduler", args->seq);
+		XDNA_DBG(xdna, "Pushed %d cmd(s) to scheduler, last %lld",
+			 args->cmd_count, args->seq);
+	return ret;
+}
+
+static int amdxdna_cmds_get_out_fences(struct amdxdna_client *client,
+				       struct amdxdna_drm_wait_cmd *cmds,
+				       struct dma_fence **fences, u32 count)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx *ctx;
+	int ret = 0, idx;
+	u32 i;
+
+	/* For locking concerns, see amdxdna_drm_exec_cmd_ioctl. */
+	idx = srcu_read_lock(&client->ctx_srcu);
+	for (i = 0; i < count; i++) {
+		ctx = xa_load(&client->ctx_xa, cmds[i].hwctx);
+		if (!ctx) {
+			XDNA_DBG(xdna, "PID %d failed to get ctx %d",
+				 client->pid, cmds[i].hwctx);
+			ret = -EINVAL;
+			break;
+		}
+
+		fences[i] = xdna->dev_info->ops->cmd_get_out_fence(ctx, cmds[i].seq);
+		if (!fences[i]) {
+			XDNA_DBG(xdna, "Invalid sequence number %lld of ctx %d",
+				 cmds[i].seq, cmds[i].hwctx);
+			ret = -EINVAL;
+			break;
+		}
+	}
+	srcu_read_unlock(&client->ctx_srcu, idx);
 	return ret;
 }
 
@@ -580,6 +1050,99 @@ done:
 	return ret;
 }
 
+/*
+ * Submit a no-op command which completes when given commands of contexts of
+ * this client complete, so that later commands of the context wait for them
+ * without any syncobj or round trip to user space. Waiting on commands of
+ * more than one context lets commands spanning contexts be chained.
+ */
+static int amdxdna_drm_submit_ctx_dependency(struct amdxdna_client *client,
+					     struct amdxdna_drm_exec_cmd *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_drm_wait_cmd *cmds;
+	struct amdxdna_sched_job *job;
+	struct dma_fence **fences;
+	struct amdxdna_ctx *ctx;
+	u32 i, cnt = 0;
+	int ret, idx;
+
+	if (!xdna->dev_info->ops->cmd_get_out_fence)
+		return -EOPNOTSUPP;
+
+	if (!args->cmd_count || args->cmd_count > AMDXDNA_WAIT_CMDS_MAX || args->arg_count) {
+		XDNA_ERR(xdna, "Invalid cmd count %d or arg count %d",
+			 args->cmd_count, args->arg_count);
+		return -EINVAL;
+	}
+
+	cmds = kcalloc(args->cmd_count, sizeof(*cmds), GFP_KERNEL);
+	if (!cmds)
+		return -ENOMEM;
+	fences = kcalloc(args->cmd_count, sizeof(*fences), GFP_KERNEL);
+	if (!fences) {
+		ret = -ENOMEM;
+		goto free_cmds;
+	}
+
+	if (copy_from_user(cmds, u64_to_user_ptr(args->cmd_handles),
+			   args->cmd_count * sizeof(*cmds))) {
+		ret = -EFAULT;
+		goto free_fences;
+	}
+
+	ret = amdxdna_cmds_get_out_fences(client, cmds, fences, args->cmd_count);
+	if (ret)
+		goto put_fences;
+
+	/* Nothing to wait for on completed ones */
+	for (i = 0; i < args->cmd_count; i++) {
+		if (dma_fence_is_signaled(fences[i]))
+			dma_fence_put(fences[i]);
+		else
+			fences[cnt++] = fences[i];
+	}
+	for (i = cnt; i < args->cmd_count; i++)
+		fences[i] = NULL;
+
+	job = amdxdna_job_alloc(client, OP_NOOP, AMDXDNA_INVALID_BO_HANDLE, NULL, 0);
+	if (IS_ERR(job)) {
+		ret = PTR_ERR(job);
+		goto put_fences;
+	}
+	job->dep_fences = fences;
+	job->dep_fence_cnt = cnt;
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, args->hwctx);
+	if (!ctx) {
+		XDNA_ERR(xdna, "PID %d failed to get ctx %d", client->pid, args->hwctx);
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	ret = amdxdna_job_push(ctx, job, NULL, NULL, 0, &args->seq);
+unlock_srcu:
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	/* Fences not taken by DRM scheduler are still in the array */
+	if (ret)
+		amdxdna_job_free(job);
+	else
+		XDNA_DBG(xdna, "Pushed no-op cmd %lld waiting for %d of %d cmds",
+			 args->seq, cnt, args->cmd_count);
+
+put_fences:
+	for (i = 0; i < args->cmd_count; i++) {
+		if (fences[i])
+			dma_fence_put(fences[i]);
+	}
+free_fences:
+	kfree(fences);
+free_cmds:
+	kfree(cmds);
+	return ret;
+}
+
 static int amdxdna_drm_submit_signal(struct amdxdna_client *client,
 				     struct amdxdna_drm_exec_cmd *args)
 {
@@ -671,6 +1234,9 @@ int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_
 	case AMDXDNA_CMD_SUBMIT_SIGNAL:
 		ret = amdxdna_drm_submit_signal(client, args);
 		break;
+	case AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY:
+		ret = amdxdna_drm_submit_ctx_dependency(client, args);
+		break;
 	default:
 		XDNA_ERR(client->xdna, "Invalid command type %d", args->type);
 		ret = -EINVAL;
@@ -724,3 +1290,131 @@ int amdxdna_drm_wait_cmd_ioctl(struct drm_device *dev, void *data, struct drm_fi
 	trace_amdxdna_debug_point(current->comm, args->seq, "job returned to user");
 	return ret;
 }
+
+int amdxdna_drm_wait_cmds_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_wait_cmds *args = data;
+	signed long remaining = MAX_SCHEDULE_TIMEOUT;
+	struct amdxdna_drm_wait_cmd *cmds;
+	struct dma_fence **fences;
+	u32 i, nwords;
+	u64 *completed;
+	long ret;
+
+	if (!xdna->dev_info->ops->cmd_get_out_fence)
+		return -EOPNOTSUPP;
+
+	if (!args->count || args->count > AMDXDNA_WAIT_CMDS_MAX || args->pad ||
+	    args->flags & ~AMDXDNA_WAIT_CMDS_ALL) {
+		XDNA_DBG(xdna, "Invalid count %d or flags 0x%x", args->count, args->flags);
+		return -EINVAL;
+	}
+
+	cmds = kcalloc(args->count, sizeof(*cmds), GFP_KERNEL);
+	if (!cmds)
+		return -ENOMEM;
+
+	if (copy_from_user(cmds, u64_to_user_ptr(args->cmds), args->count * sizeof(*cmds))) {
+		ret = -EFAULT;
+		goto free_cmds;
+	}
+
+	nwords = DIV_ROUND_UP(args->count, 64);
+	completed = kcalloc(nwords, sizeof(*completed), GFP_KERNEL);
+	if (!completed) {
+		ret = -ENOMEM;
+		goto free_cmds;
+	}
+
+	fences = kcalloc(args->count, sizeof(*fences), GFP_KERNEL);
+	if (!fences) {
+		ret = -ENOMEM;
+		goto free_completed;
+	}
+
+	ret = amdxdna_cmds_get_out_fences(client, cmds, fences, args->count);
+	if (ret)
+		goto put_fences;
+
+	XDNA_DBG(xdna, "PID %d wait %s of %d cmds, timeout set %d ms", client->pid,
+		 args->flags & AMDXDNA_WAIT_CMDS_ALL ? "all" : "any",
+		 args->count, args->timeout);
+
+	if (args->timeout)
+		remaining = msecs_to_jiffies(args->timeout);
+
+	if (args->flags & AMDXDNA_WAIT_CMDS_ALL) {
+		for (i = 0; i < args->count && remaining > 0; i++)
+			remaining = dma_fence_wait_timeout(fences[i], true, remaining);
+		ret = remaining;
+	} else {
+		ret = dma_fence_wait_any_timeout(fences, args->count, true, remaining, NULL);
+	}
+
+	if (!ret)
+		ret = -ETIME;
+	else if (ret > 0)
+		ret = 0;
+
+	/* Interrupted wait will be restarted, no need to report progress */
+	if (ret == -ERESTARTSYS)
+		goto put_fences;
+
+	for (i = 0; i < args->count; i++) {
+		if (dma_fence_is_signaled(fences[i]))
+			completed[i / 64] |= BIT_ULL(i % 64);
+	}
+
+	if (copy_to_user(u64_to_user_ptr(args->completed), completed,
+			 nwords * sizeof(*completed)))
+		ret = -EFAULT;
+
+	XDNA_DBG(xdna, "PID %d wait %d cmds finished, ret %ld", client->pid, args->count, ret);
+
+put_fences:
+	for (i = 0; i < args->count; i++) {
+		if (fences[i])
+			dma_fence_put(fences[i]);
+	}
+	kfree(fences);
+free_completed:
+	kfree(completed);
+free_cmds:
+	kfree(cmds);
+	return ret;
+}
+
+int amdxdna_job_cache_init(void)
+{
+	amdxdna_job_cache = kmem_cache_create("amdxdna_job",
+					      sizeof(struct amdxdna_sched_job) +
+					      JOB_CACHE_ARG_COUNT * sizeof(struct amdxdna_job_bo),
+					      0, 0, NULL);
+	if (!amdxdna_job_cache)
+		return -ENOMEM;
+
+	amdxdna_fence_cache = KMEM_CACHE(amdxdna_fence, 0);
+	if (!amdxdna_fence_cache) {
+		kmem_cache_destroy(amdxdna_job_cache);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void amdxdna_job_cache_fini(void)
+{
+	/* Fences are freed after RCU grace period */
+	rcu_barrier();
+	kmem_cache_destroy(amdxdna_fence_cache);
+	kmem_cache_destroy(amdxdna_job_cache);
+}
+
+void amdxdna_job_cache_show(struct seq_file *m)
+{
+	seq_printf(m, "job cache allocations %lld\n", atomic64_read(&job_cache_alloc_cnt));
+	seq_printf(m, "job cache misses %lld (more than %d argument BOs)\n",
+		   atomic64_read(&job_cache_miss_cnt), JOB_CACHE_ARG_COUNT);
+	seq_printf(m, "argument BO cache hits %lld\n", atomic64_read(&arg_cache_hit_cnt));
+}
@@ -9,6 +9,7 @@
 #include <linux/bitfield.h>
 #include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/workqueue.h>
 #include <drm/drm_drv.h>
 #include <drm/gpu_scheduler.h>
@@ -17,6 +18,7 @@
 #include "amdxdna_gem.h"
 
 struct amdxdna_ctx_priv;
+struct seq_file;
 
 enum ert_cmd_opcode {
 	ERT_INVALID_CMD	= ~0U,
@@ -190,6 +192,7 @@ struct amdxdna_ctx_health_data {
 
 /* Exec buffer command header format */
 #define AMDXDNA_CMD_STATE		GENMASK(3, 0)
+#define AMDXDNA_CMD_STAT_ENABLED	BIT(4)
 #define AMDXDNA_CMD_EXTRA_CU_MASK	GENMASK(11, 10)
 #define AMDXDNA_CMD_COUNT		GENMASK(22, 12)
 #define AMDXDNA_CMD_OPCODE		GENMASK(27, 23)
@@ -198,6 +201,13 @@ struct amdxdna_cmd {
 	u32 data[];
 };
 
+/*
+ * With AMDXDNA_CMD_STAT_ENABLED, CLOCK_MONOTONIC time in ns of each state
+ * from ERT_CMD_STATE_NEW to ERT_CMD_STATE_TIMEOUT is stored right after the
+ * payload, same layout as struct cu_cmd_state_timestamps of XRT.
+ */
+#define AMDXDNA_CMD_STAT_NUM		8
+
 #define INVALID_CU_IDX		(~0U)
 
 struct amdxdna_ctx {
@@ -215,11 +225,16 @@ struct amdxdna_ctx {
 	u32				num_col;
 	u32				umq_bo;
 	u32				log_buf_bo;
+	u32				dev_heap_bo;
+	/* Asked for at creation, 0 for device default */
+	u32				queue_depth;
 	u32				doorbell_offset;
 
 	struct amdxdna_qos_info		     qos;
 	struct amdxdna_hwctx_param_config_cu *cus;
 
+	/* Keeps device layer submissions out while queue is reconfigured */
+	struct mutex			submit_lock;
 	/* Submitted, completed, freed job counter */
 	u64				submitted;
 	u64				completed ____cacheline_aligned_in_smp;
@@ -227,6 +242,14 @@ struct amdxdna_ctx {
 	atomic64_t			job_free_cnt;
 	/* For command completion notification. */
 	u32				syncobj_hdl;
+	/*
+	 * With AMDXDNA_CTX_CREATE_ASYNC, signaled once context is ready. Device
+	 * sets ready_deferred in ctx_init() if it signals the fence later.
+	 */
+	struct dma_fence		*ready_fence;
+	bool				ready_deferred;
+	/* Admitted over QoS capacity of device, see AMDXDNA_CTX_OUT_QOS_DEGRADED */
+	bool				qos_degraded;
 	struct amdxdna_ctx_health_data	health_data;
 	bool				health_reported;
 
@@ -254,6 +277,13 @@ struct amdxdna_sched_job {
 	/* user can wait on this fence */
 	struct dma_fence	*out_fence;
 	bool			job_done;
+	/* Allocated from job cache, see amdxdna_sched_job_free() */
+	bool			from_cache;
+	/* When the job is submitted and sent to device, for accounting */
+	ktime_t			submit_time;
+	ktime_t			run_time;
+	/* Absolute deadline of the job, 0 if it has none */
+	ktime_t			deadline;
 	u64			seq;
 #define OP_USER			0
 #define OP_SYNC_BO		1
@@ -262,6 +292,26 @@ struct amdxdna_sched_job {
 #define OP_NOOP			4
 	u32			opcode;
 	int			msg_id;
+	/*
+	 * Number of jobs queued after this one and sent to device in the same
+	 * command list. A job sent along with an earlier one, in its command
+	 * list or right after it in the same mailbox batch, is coalesced.
+	 */
+	u32			coalesce_cnt;
+	bool			coalesced;
+	/* Sent to device by submitter, before DRM scheduler runs it */
+	bool			direct;
+	/* All dependencies were signaled when job was pushed to DRM scheduler */
+	bool			deps_signaled;
+	/* On done_jobs of context till end of mailbox response pass */
+	struct llist_node	done_node;
+	/*
+	 * Out fences of cmds of other contexts to wait for before this job, see
+	 * AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY. Only valid during submission, the
+	 * references are handed over to DRM scheduler.
+	 */
+	struct dma_fence	**dep_fences;
+	u32			dep_fence_cnt;
 	struct amdxdna_gem_obj	*cmd_bo;
 	size_t			bo_cnt;
 	struct amdxdna_job_bo	bos[] __counted_by(bo_cnt);
@@ -275,11 +325,37 @@ amdxdna_cmd_get_op(struct amdxdna_gem_obj *abo)
 	return FIELD_GET(AMDXDNA_CMD_OPCODE, cmd->header);
 }
 
+static inline void
+amdxdna_cmd_set_timestamp(struct amdxdna_gem_obj *abo, enum ert_cmd_state s, ktime_t t)
+{
+	struct amdxdna_cmd *cmd = amdxdna_gem_vmap(abo);
+	u32 idx = s - ERT_CMD_STATE_NEW;
+	size_t off;
+	u32 *ts;
+	u64 ns;
+
+	if (!(cmd->header & AMDXDNA_CMD_STAT_ENABLED) || idx >= AMDXDNA_CMD_STAT_NUM)
+		return;
+
+	off = offsetof(struct amdxdna_cmd, data) +
+	      (FIELD_GET(AMDXDNA_CMD_COUNT, cmd->header) + idx * 2) * sizeof(u32);
+	if (off + sizeof(u64) > abo->mem.size)
+		return;
+
+	/* Payload is u32 aligned only */
+	ts = (u32 *)((char *)cmd + off);
+	ns = ktime_to_ns(t);
+	ts[0] = lower_32_bits(ns);
+	ts[1] = upper_32_bits(ns);
+}
+
 static inline void
 amdxdna_cmd_set_state(struct amdxdna_gem_obj *abo, enum ert_cmd_state s)
 {
 	struct amdxdna_cmd *cmd = amdxdna_gem_vmap(abo);
 
+	if (s >= ERT_CMD_STATE_COMPLETED)
+		amdxdna_cmd_set_timestamp(abo, s, ktime_get());
 	cmd->header &= ~AMDXDNA_CMD_STATE;
 	cmd->header |= FIELD_PREP(AMDXDNA_CMD_STATE, s);
 }
@@ -356,6 +432,10 @@ amdxdna_ctx_col_map(struct amdxdna_ctx *ctx)
 
 void amdxdna_ctx_wait_jobs(struct amdxdna_ctx *ctx, long timeout);
 void amdxdna_sched_job_cleanup(struct amdxdna_sched_job *job);
+void amdxdna_sched_job_free(struct amdxdna_sched_job *job);
+int amdxdna_arg_bo_pin(struct amdxdna_gem_obj *abo);
+void amdxdna_arg_cache_fini(struct amdxdna_client *client);
+void amdxdna_arg_cache_drop(struct amdxdna_client *client, struct drm_gem_object *gobj);
 void amdxdna_ctx_remove_all(struct amdxdna_client *client);
 
 int amdxdna_lock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx *ctx);
@@ -368,10 +448,15 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 int amdxdna_cmd_wait(struct amdxdna_client *client, u32 ctx_hdl,
 		     u64 seq, u32 timeout);
 
+int amdxdna_job_cache_init(void);
+void amdxdna_job_cache_fini(void);
+void amdxdna_job_cache_show(struct seq_file *m);
+
 int amdxdna_drm_create_hwctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_config_hwctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_destroy_hwctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_wait_cmd_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_wait_cmds_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 
 #endif /* _AMDXDNA_CTX_H_ */
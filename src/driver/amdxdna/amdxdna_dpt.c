@@ -16,6 +16,7 @@
 #include <linux/workqueue.h>
 
 #include "amdxdna_dpt.h"
+#include "amdxdna_pm.h"
 #include "aie2_msg_priv.h"
 
 #define AMDXDNA_DPT_FW_LOG_MAX_DEFAULT		1
@@ -610,6 +611,74 @@ static int amdxdna_fw_trace_fini(struct amdxdna_dev *xdna)
 	return 0;
 }
 
+/*
+ * Every mapping of a DPT ring pins the DMA buffer, the DRM device and a runtime PM
+ * reference. The latter keeps the DPT from being torn down by runtime suspend, so
+ * the firmware keeps streaming into the pages the consumer is watching. Explicitly
+ * disabling the DPT still frees it; the mapping then sees a frozen ring.
+ */
+static void amdxdna_dpt_vm_open(struct vm_area_struct *vma)
+{
+	struct amdxdna_mgmt_dma_hdl *dma_hdl = vma->vm_private_data;
+
+	amdxdna_mgmt_buff_get(dma_hdl);
+	drm_dev_get(&dma_hdl->xdna->ddev);
+	pm_runtime_get_noresume(dma_hdl->xdna->ddev.dev);
+}
+
+static void amdxdna_dpt_vm_close(struct vm_area_struct *vma)
+{
+	struct amdxdna_mgmt_dma_hdl *dma_hdl = vma->vm_private_data;
+	struct amdxdna_dev *xdna = dma_hdl->xdna;
+
+	amdxdna_pm_suspend_put(xdna);
+	amdxdna_mgmt_buff_free(dma_hdl);
+	drm_dev_put(&xdna->ddev);
+}
+
+static const struct vm_operations_struct amdxdna_dpt_vm_ops = {
+	.open = amdxdna_dpt_vm_open,
+	.close = amdxdna_dpt_vm_close,
+};
+
+int amdxdna_dpt_mmap(struct amdxdna_dev *xdna, bool trace, struct vm_area_struct *vma)
+{
+	struct amdxdna_mgmt_dma_hdl *dma_hdl;
+	struct amdxdna_dpt *dpt;
+	int ret;
+
+	ret = amdxdna_pm_resume_get(xdna);
+	if (ret)
+		return ret;
+
+	dpt = trace ? xdna->fw_trace : xdna->fw_log;
+	if (!dpt || !dpt->enabled) {
+		XDNA_DBG(xdna, "FW %s not enabled", trace ? "trace" : "logging");
+		ret = -ESHUTDOWN;
+		goto put_pm;
+	}
+
+	dma_hdl = dpt->dma_hdl;
+	ret = amdxdna_mgmt_buff_mmap(dma_hdl, vma);
+	if (ret) {
+		XDNA_ERR(xdna, "%s: mmap failed, ret %d", dpt->name, ret);
+		goto put_pm;
+	}
+
+	/* The PM reference taken above is handed over to the mapping */
+	vma->vm_private_data = amdxdna_mgmt_buff_get(dma_hdl);
+	vma->vm_ops = &amdxdna_dpt_vm_ops;
+	drm_dev_get(&xdna->ddev);
+
+	XDNA_DBG(xdna, "%s: mapped 0x%lx bytes at 0x%lx", dpt->name,
+		 vma->vm_end - vma->vm_start, vma->vm_start);
+	return 0;
+
+put_pm:
+	amdxdna_pm_suspend_put(xdna);
+	return ret;
+}
+
 int amdxdna_dpt_dump_to_dmesg(struct amdxdna_dpt *dpt, bool dump)
 {
 	if (!dpt)
@@ -742,11 +811,12 @@ int amdxdna_get_fw_log_configs(struct amdxdna_dev *xdna, struct amdxdna_drm_get_
 		return -EFAULT;
 	}
 
-	if (buf_size < sizeof(config)) {
+	if (buf_size < offsetofend(typeof(config), reserved)) {
 		XDNA_ERR(xdna, "Insufficient buffer size: 0x%x", buf_size);
 		return -ENOSPC;
 	}
 
+	config.clock_offset_ns = xdna->fw_clock_offset_ns;
 	if (!xdna->fw_log)
 		goto exit;
 
@@ -754,7 +824,8 @@ int amdxdna_get_fw_log_configs(struct amdxdna_dev *xdna, struct amdxdna_drm_get_
 	config.status = xdna->fw_log->enabled;
 	config.config = fw_log_level;
 exit:
-	if (copy_to_user(buf, &config, sizeof(config)))
+	/* Older userspace knows only the fields up to reserved */
+	if (copy_to_user(buf, &config, min_t(u32, buf_size, sizeof(config))))
 		return -EFAULT;
 	return 0;
 }
@@ -783,11 +854,12 @@ int amdxdna_get_fw_trace_configs(struct amdxdna_dev *xdna, struct amdxdna_drm_ge
 		return -EFAULT;
 	}
 
-	if (buf_size < sizeof(config)) {
+	if (buf_size < offsetofend(typeof(config), reserved)) {
 		XDNA_ERR(xdna, "Insufficient buffer size: 0x%x", buf_size);
 		return -ENOSPC;
 	}
 
+	config.clock_offset_ns = xdna->fw_clock_offset_ns;
 	if (!xdna->fw_trace)
 		goto exit;
 
@@ -795,7 +867,8 @@ int amdxdna_get_fw_trace_configs(struct amdxdna_dev *xdna, struct amdxdna_drm_ge
 	config.status = xdna->fw_trace->enabled;
 	config.config = fw_trace_categories;
 exit:
-	if (copy_to_user(buf, &config, sizeof(config)))
+	/* Older userspace knows only the fields up to reserved */
+	if (copy_to_user(buf, &config, min_t(u32, buf_size, sizeof(config))))
 		return -EFAULT;
 	return 0;
 }
@@ -4,11 +4,16 @@
  */
 
 #include <linux/iommu.h>
+#include <linux/rculist.h>
+#ifdef HAVE_io_uring_sqe_cmd
+#include <linux/io_uring/cmd.h>
+#endif
 #include <drm/drm_ioctl.h>
 #include <drm/drm_accel.h>
 #include "drm_local/amdxdna_accel.h"
 
 #include "amdxdna_drm.h"
+#include "amdxdna_mem_notify.h"
 #include "amdxdna_pm.h"
 #ifdef AMDXDNA_DEVEL
 #include "amdxdna_devel.h"
@@ -53,9 +58,11 @@ skip_sva_bind:
 	init_srcu_struct(&client->ctx_srcu);
 	xa_init_flags(&client->ctx_xa, XA_FLAGS_ALLOC);
 	mutex_init(&client->mm_lock);
+	mutex_init(&client->arg_cache_lock);
 
 	mutex_lock(&xdna->dev_lock);
-	list_add_tail(&client->node, &xdna->client_list);
+	list_add_tail_rcu(&client->node, &xdna->client_list);
+	client->listed = true;
 	mutex_unlock(&xdna->dev_lock);
 
 	seqlock_init(&client->stats.lock);
@@ -76,17 +83,29 @@ failed:
 	return ret;
 }
 
+static void amdxdna_client_free_work(struct work_struct *work)
+{
+	struct amdxdna_client *client;
+
+	client = container_of(to_rcu_work(work), struct amdxdna_client, free_rwork);
+	xa_destroy(&client->ctx_xa);
+	cleanup_srcu_struct(&client->ctx_srcu);
+	kfree(client);
+}
+
 static void amdxdna_drm_close(struct drm_device *ddev, struct drm_file *filp)
 {
 	struct amdxdna_client *client = filp->driver_priv;
 	struct amdxdna_dev *xdna = to_xdna_dev(ddev);
+	u32 i;
 
 	XDNA_DBG(xdna, "Closing PID %d", client->pid);
 
-	xa_destroy(&client->ctx_xa);
-	cleanup_srcu_struct(&client->ctx_srcu);
-	if (client->dev_heap)
-		drm_gem_object_put(to_gobj(client->dev_heap));
+	amdxdna_mem_notify_fini_client(client);
+	amdxdna_arg_cache_fini(client);
+	mutex_destroy(&client->arg_cache_lock);
+	for (i = 0; i < client->num_dev_heaps; i++)
+		drm_gem_object_put(to_gobj(client->dev_heaps[i]));
 	mutex_destroy(&client->mm_lock);
 
 #ifdef AMDXDNA_DEVEL
@@ -99,7 +118,13 @@ skip_sva_unbind:
 #endif
 
 	XDNA_DBG(xdna, "PID %d closed", client->pid);
-	kfree(client);
+	/*
+	 * Client is off clients list, but RCU walkers of the list may still be
+	 * looking at its ctx_srcu and ctx_xa. Release those after a grace period.
+	 * cleanup_srcu_struct() may sleep, so that runs from bo_free_wq.
+	 */
+	INIT_RCU_WORK(&client->free_rwork, amdxdna_client_free_work);
+	queue_rcu_work(xdna->bo_free_wq, &client->free_rwork);
 }
 
 static int amdxdna_flush(struct file *f, fl_owner_t id)
@@ -123,11 +148,12 @@ static int amdxdna_flush(struct file *f, fl_owner_t id)
 		return 0;
 
 	mutex_lock(&xdna->dev_lock);
-	if (list_empty(&client->node)) {
+	if (!client->listed) {
 		mutex_unlock(&xdna->dev_lock);
 		goto out;
 	}
-	list_del_init(&client->node);
+	list_del_rcu(&client->node);
+	client->listed = false;
 	mutex_unlock(&xdna->dev_lock);
 	amdxdna_ctx_remove_all(client);
 
@@ -136,6 +162,16 @@ out:
 	return 0;
 }
 
+static int amdxdna_release(struct inode *inode, struct file *f)
+{
+	struct drm_file *filp = f->private_data;
+	struct amdxdna_client *client = filp->driver_priv;
+
+	/* Last reference of the file, nothing can look at its usage any more */
+	WRITE_ONCE(client->releasing, true);
+	return drm_release(inode, f);
+}
+
 static int amdxdna_drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct drm_file *drm_filp = filp->private_data;
@@ -158,6 +194,10 @@ static int amdxdna_drm_get_info_ioctl(struct drm_device *dev, void *data, struct
 	struct amdxdna_drm_get_info *args = data;
 	int ret, idx;
 
+	/* Same for all devices and needs nothing from device */
+	if (args->param == DRM_AMDXDNA_QUERY_MEM_INFO)
+		return amdxdna_gem_query_mem_info(client, args);
+
 	if (!xdna->dev_info->ops->get_aie_info)
 		return -EOPNOTSUPP;
 
@@ -241,7 +281,7 @@ static int amdxdna_drm_get_bo_usage(struct amdxdna_client *client,
 		mutex_lock(&tmp_client->mm_lock);
 		tmp.total_usage += tmp_client->total_bo_usage;
 		tmp.internal_usage += tmp_client->total_int_bo_usage;
-		tmp.heap_usage += tmp_client->heap_usage;
+		tmp.heap_usage += atomic_read(&tmp_client->heap_usage);
 		mutex_unlock(&tmp_client->mm_lock);
 	}
 
@@ -311,9 +351,12 @@ static const struct drm_ioctl_desc amdxdna_drm_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(AMDXDNA_CREATE_BO, amdxdna_drm_create_bo_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_BO_INFO, amdxdna_drm_get_bo_info_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_SYNC_BO, amdxdna_drm_sync_bo_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_SYNC_BOS, amdxdna_drm_sync_bos_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_MEM_NOTIFY, amdxdna_drm_mem_notify_ioctl, 0),
 	/* Exectuion */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_EXEC_CMD, amdxdna_drm_submit_cmd_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_WAIT_CMD, amdxdna_drm_wait_cmd_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_WAIT_CMDS, amdxdna_drm_wait_cmds_ioctl, 0),
 	/* AIE hardware */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_INFO, amdxdna_drm_get_info_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_ARRAY, amdxdna_drm_get_array_ioctl, 0),
@@ -351,59 +394,152 @@ bool amdxdna_ctx_access_allowed(struct amdxdna_ctx *ctx, bool root_only)
 	return is_admin || is_owner;
 }
 
+static void amdxdna_stats_begin(struct amdxdna_stats *stats, ktime_t now)
+{
+	write_seqlock(&stats->lock);
+	if (!stats->job_depth++)
+		stats->start_time = now;
+	write_sequnlock(&stats->lock);
+}
+
+static void amdxdna_stats_end(struct amdxdna_stats *stats, ktime_t now)
+{
+	write_seqlock(&stats->lock);
+	if (!--stats->job_depth)
+		stats->busy_time += ktime_to_ns(ktime_sub(now, stats->start_time));
+	write_sequnlock(&stats->lock);
+}
+
 void amdxdna_stats_start(struct amdxdna_client *client)
 {
-	ktime_t now;
-	int depth;
-
-	now = ktime_get();
-	write_seqlock(&client->stats.lock);
-	depth = client->stats.job_depth++;
-	if (!depth)
-		client->stats.start_time = now;
-	write_sequnlock(&client->stats.lock);
+	ktime_t now = ktime_get();
+
+	amdxdna_stats_begin(&client->stats, now);
+	amdxdna_stats_begin(&client->xdna->stats, now);
 }
 
 void amdxdna_stats_account(struct amdxdna_client *client)
 {
-	ktime_t now;
+	ktime_t now = ktime_get();
+
+	amdxdna_stats_end(&client->stats, now);
+	amdxdna_stats_end(&client->xdna->stats, now);
+}
+
+/* Accumulated busy time, including the job currently in flight */
+u64 amdxdna_stats_busy_ns(struct amdxdna_stats *stats)
+{
+	unsigned int seq;
 	u64 busy_ns;
-	int depth;
-
-	now = ktime_get();
-	write_seqlock(&client->stats.lock);
-	depth = --client->stats.job_depth;
-	if (!depth) {
-		busy_ns = ktime_to_ns(ktime_sub(now, client->stats.start_time));
-		client->stats.busy_time += busy_ns;
-	}
-	write_sequnlock(&client->stats.lock);
+
+	do {
+		seq = read_seqbegin(&stats->lock);
+		busy_ns = stats->busy_time;
+		if (stats->job_depth)
+			busy_ns += ktime_to_ns(ktime_sub(ktime_get(), stats->start_time));
+	} while (read_seqretry(&stats->lock, seq));
+
+	return busy_ns;
 }
 
 static void amdxdna_show_fdinfo(struct drm_printer *p, struct drm_file *filp)
 {
 	struct amdxdna_client *client = filp->driver_priv;
 	const char *engine_npu_name = "npu-amdxdna";
-	unsigned int seq;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+	u32 num_ctx = 0;
+	u64 heap_kib;
 	u64 busy_ns;
 
-	do {
-		seq = read_seqbegin(&client->stats.lock);
-		busy_ns = ktime_to_ns(client->stats.busy_time);
-		if (client->stats.job_depth)
-			busy_ns += ktime_to_ns(ktime_sub(ktime_get(), client->stats.start_time));
-	} while (read_seqretry(&client->stats.lock, seq));
+	busy_ns = amdxdna_stats_busy_ns(&client->stats);
 
 	/* see Documentation/gpu/drm-usage-stats.rst */
 	drm_printf(p, "drm-engine-%s:\t%llu ns\n", engine_npu_name, busy_ns);
 
 	drm_show_memory_stats(p, filp);
+
+	/*
+	 * Heap BO is already in memory stats above, this is how much of it is
+	 * handed out to device BOs. Heap is pinned, all of it is resident.
+	 */
+	heap_kib = atomic_read(&client->heap_usage) / SZ_1K;
+	drm_printf(p, "drm-total-heap:\t%llu KiB\n", heap_kib);
+	drm_printf(p, "drm-resident-heap:\t%llu KiB\n", heap_kib);
+
+	/* ctx_xa can be walked without lock, count may be stale by the time it is read */
+	amdxdna_for_each_ctx(client, ctx_id, ctx)
+		num_ctx++;
+	drm_printf(p, "amdxdna-contexts:\t%u\n", num_ctx);
 }
 
+#ifdef HAVE_io_uring_sqe_cmd
+static int amdxdna_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	const struct amdxdna_uring_cmd *ucmd = io_uring_sqe_cmd(ioucmd->sqe);
+	u32 cmd_op = ioucmd->cmd_op;
+	union {
+		struct amdxdna_drm_exec_cmd exec;
+		struct amdxdna_drm_wait_cmd wait;
+		struct amdxdna_drm_wait_cmds waits;
+		struct amdxdna_drm_sync_bo sync;
+		struct amdxdna_drm_sync_bos syncs;
+	} kdata;
+	void __user *uarg;
+	drm_ioctl_t *func;
+	int ret;
+
+	switch (cmd_op) {
+	case DRM_IOCTL_AMDXDNA_EXEC_CMD:
+		func = amdxdna_drm_submit_cmd_ioctl;
+		break;
+	case DRM_IOCTL_AMDXDNA_WAIT_CMD:
+		func = amdxdna_drm_wait_cmd_ioctl;
+		break;
+	case DRM_IOCTL_AMDXDNA_WAIT_CMDS:
+		func = amdxdna_drm_wait_cmds_ioctl;
+		break;
+	case DRM_IOCTL_AMDXDNA_SYNC_BO:
+		func = amdxdna_drm_sync_bo_ioctl;
+		break;
+	case DRM_IOCTL_AMDXDNA_SYNC_BOS:
+		func = amdxdna_drm_sync_bos_ioctl;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	/*
+	 * All of them may sleep, submission on job_sem, ctx and io locks and
+	 * HMM faults. Let io_uring punt them to its worker instead of blocking
+	 * submitter or SQPOLL thread.
+	 */
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	if (READ_ONCE(ucmd->pad) || _IOC_SIZE(cmd_op) > sizeof(kdata))
+		return -EINVAL;
+
+	uarg = u64_to_user_ptr(READ_ONCE(ucmd->arg));
+	if (copy_from_user(&kdata, uarg, _IOC_SIZE(cmd_op)))
+		return -EFAULT;
+
+	ret = drm_ioctl_kernel(ioucmd->file, func, &kdata, 0);
+	/* Nothing restarts a uring cmd, don't leak the kernel internal errno */
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	/* Same as drm_ioctl(), output is written back even on failure */
+	if (copy_to_user(uarg, &kdata, _IOC_SIZE(cmd_op)))
+		ret = -EFAULT;
+	return ret;
+}
+#endif
+
 static const struct file_operations amdxdna_fops = {
 	.owner		= THIS_MODULE,
 	.open		= accel_open,
-	.release	= drm_release,
+	.release	= amdxdna_release,
 	.flush		= amdxdna_flush,
 	.unlocked_ioctl	= drm_ioctl,
 	.compat_ioctl	= drm_compat_ioctl,
@@ -412,6 +548,9 @@ static const struct file_operations amdxdna_fops = {
 	.llseek		= noop_llseek,
 	.mmap		= amdxdna_drm_gem_mmap,
 	.show_fdinfo	= drm_show_fdinfo,
+#ifdef HAVE_io_uring_sqe_cmd
+	.uring_cmd	= amdxdna_uring_cmd,
+#endif
 #ifdef FOP_UNSIGNED_OFFSET
 	.fop_flags      = FOP_UNSIGNED_OFFSET,
 #endif
@@ -15,6 +15,7 @@
 #include <linux/workqueue.h>
 #include <linux/seqlock_types.h>
 
+#include "amdxdna_cma_buf.h"
 #include "amdxdna_ctx.h"
 #include "amdxdna_dpt.h"
 #include "amdxdna_gem.h"
@@ -71,6 +72,9 @@ struct amdxdna_dev_ops {
 	void (*hmm_invalidate)(struct amdxdna_gem_obj *abo, unsigned long cur_seq);
 	int (*cmd_submit)(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 			  u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq);
+	/* Push jobs with consecutive seq, returns how many, optional */
+	int (*cmd_submit_batch)(struct amdxdna_ctx *ctx, struct amdxdna_sched_job **jobs,
+				u32 cnt, u64 *seq);
 	int (*cmd_wait)(struct amdxdna_ctx *ctx, u64 seq, u32 timeout);
 	int (*get_aie_info)(struct amdxdna_client *client, struct amdxdna_drm_get_info *args);
 	int (*get_aie_array)(struct amdxdna_client *client, struct amdxdna_drm_get_array *args);
@@ -119,6 +123,37 @@ struct amdxdna_fw_ver {
 	u32 build;
 };
 
+struct amdxdna_stats {
+	seqlock_t			lock; /* protect stats */
+	int				job_depth;
+	ktime_t				start_time;
+	u64				busy_time;
+};
+
+#define AMDXDNA_RPM_GAP_HIST	16
+
+/*
+ * Runtime PM idle gap history and resume accounting
+ * @lock: protects all fields below
+ * @last_put: time the last runtime PM reference was dropped
+ * @gaps_ms: recent idle gaps that ended with a new request, in ms
+ * @gap_idx: next slot in @gaps_ms
+ * @delay_ms: autosuspend delay currently programmed
+ * @resume_cnt: requests that had to wait for a runtime resume
+ * @resume_ns: total time those requests spent waiting
+ * @resume_max_ns: longest single wait
+ */
+struct amdxdna_rpm {
+	spinlock_t			lock;
+	ktime_t				last_put;
+	u32				gaps_ms[AMDXDNA_RPM_GAP_HIST];
+	u32				gap_idx;
+	int				delay_ms;
+	u64				resume_cnt;
+	u64				resume_ns;
+	u64				resume_max_ns;
+};
+
 struct amdxdna_dev {
 	struct drm_device		ddev;
 	struct amdxdna_dev_hdl		*dev_handle;
@@ -130,41 +165,60 @@ struct amdxdna_dev {
 	struct amdxdna_fw_ver		fw_ver;
 	struct amdxdna_dpt		*fw_log;
 	struct amdxdna_dpt		*fw_trace;
+	/* Device wide busy time, any job in flight counts as busy */
+	struct amdxdna_stats		stats;
+	struct amdxdna_rpm		rpm;
+	/* Firmware clock minus CLOCK_MONOTONIC, sampled at time calibration */
+	s64				fw_clock_offset_ns;
 #ifdef AMDXDNA_DEVEL
 	struct ida			pdi_ida;
 #endif
 	struct rw_semaphore		notifier_lock; /* for mmu notifier */
 	struct workqueue_struct		*notifier_wq;
+	/* Releases BO backing off the freeing context, NULL if not in use */
+	struct workqueue_struct		*bo_free_wq;
+	atomic64_t			bo_free_pending; /* Bytes queued to bo_free_wq */
 
-	struct device			*cma_region_devs[MAX_MEM_REGIONS];
-};
-
-struct amdxdna_stats {
-	seqlock_t			lock; /* protect stats */
-	int				job_depth;
-	ktime_t				start_time;
-	u64				busy_time;
+	struct amdxdna_cma_region	cma_regions[MAX_MEM_REGIONS];
+	atomic_t			cma_next; /* Interleave cursor of cma_regions */
+	/* Private tmpfs with huge pages for shmem BOs, NULL if not in use */
+	struct vfsmount			*huge_mnt;
+	/* IO page faults are served, AMDXDNA_BO_FLAG_SVA BOs can be created */
+	bool				sva_iopf;
 };
 
 /*
  * struct amdxdna_client - amdxdna client
  * A per fd data structure for managing context and other user process stuffs.
  *
- * @node: entry node in clients list
+ * @node: entry node in clients list, which may be walked under RCU
+ * @listed: whether node is still in clients list, protected by dev_lock
+ * @releasing: set once the file is being released, before its BO handles go
  * @pid: PID of current client
  * @ctx_srcu: Per client SRCU for synchronizing ctx destroy with other ioctls.
  * @ctx_xa: context xarray
  * @xdna: XDNA device pointer
  * @filp: DRM file pointer
  * @mm_lock: lock for client wide memory related
- * @dev_heap: Shared device heap memory
+ * @dev_heap: First device heap, used when no heap is given
+ * @dev_heaps: All device heaps of client, protected by mm_lock
+ * @num_dev_heaps: Number of entries in dev_heaps
  * @heap_usage: Total number of bytes allocated in heap memory
  * @sva: iommu SVA handle
  * @pasid: PASID
  * @stats: record npu usage stats
+ * @mem_notify: Armed memory pressure notification, see amdxdna_mem_notify.c
+ * @free_rwork: Frees client after an RCU grace period
  */
+#define AMDXDNA_MAX_DEV_HEAPS		8
+
+/* Max argument BOs of a submission to be kept in client arg BO cache */
+#define AMDXDNA_ARG_CACHE_COUNT		16
+
 struct amdxdna_client {
 	struct list_head		node;
+	bool				listed;
+	bool				releasing;
 	pid_t				pid;
 	kuid_t				uid;
 	/* To avoid deadlock, do NOT wait this srcu when dev_lock is hold */
@@ -176,7 +230,9 @@ struct amdxdna_client {
 
 	struct mutex			mm_lock; /* protect memory related */
 	struct amdxdna_gem_obj		*dev_heap;
-	u32				heap_usage;
+	struct amdxdna_gem_obj		*dev_heaps[AMDXDNA_MAX_DEV_HEAPS];
+	u32				num_dev_heaps;
+	atomic_t			heap_usage;
 	size_t				total_bo_usage;
 	size_t				total_int_bo_usage;
 
@@ -184,6 +240,23 @@ struct amdxdna_client {
 	int				pasid;
 
 	struct amdxdna_stats		stats;
+
+	struct amdxdna_mem_notify	*mem_notify;
+	struct rcu_work			free_rwork;
+
+	/* Bumped whenever a BO handle of this client is closed */
+	atomic64_t			handle_gen;
+	/*
+	 * Argument BOs of last submission, for resubmitting the same handles
+	 * without looking them up and pinning again. Holds a reference on
+	 * each BO until replaced or client is closed.
+	 */
+	struct mutex			arg_cache_lock; /* protect arg_cache_* */
+	u64				arg_cache_gen;
+	u32				arg_cache_hdl_cnt;
+	u32				arg_cache_obj_cnt;
+	u32				arg_cache_hdls[AMDXDNA_ARG_CACHE_COUNT];
+	struct drm_gem_object		*arg_cache_objs[AMDXDNA_ARG_CACHE_COUNT];
 };
 
 #define amdxdna_for_each_ctx(client, ctx_id, entry)		\
@@ -193,6 +266,7 @@ struct amdxdna_client {
 
 void amdxdna_stats_start(struct amdxdna_client *client);
 void amdxdna_stats_account(struct amdxdna_client *client);
+u64 amdxdna_stats_busy_ns(struct amdxdna_stats *stats);
 int amdxdna_drm_copy_array_to_user(struct amdxdna_drm_get_array *tgt,
 				   void *array, size_t element_size, size_t num_element);
 int amdxdna_drm_copy_array_from_user(struct amdxdna_drm_get_array *src,
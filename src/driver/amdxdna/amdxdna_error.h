@@ -114,11 +114,6 @@ enum amdxdna_error_class {
 	AMDXDNA_ERROR_CODE_BUILD((num), AMDXDNA_ERROR_DRIVER_AIE, \
 	AMDXDNA_ERROR_SEVERITY_CRITICAL, (module), AMDXDNA_ERROR_CLASS_AIE)
 
-struct amdxdna_async_err_cache {
-	struct amdxdna_async_error err; /* last async error which can be queried from userspace */
-	struct mutex lock; /* protects access to the error cache */
-};
-
 /**
  * AMDXDNA extra error code layout
  *
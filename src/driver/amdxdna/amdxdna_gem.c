@@ -6,12 +6,18 @@
 #include "drm_local/amdxdna_accel.h"
 #include <linux/dma-buf.h>
 #include <linux/dma-direct.h>
+#include <linux/fs.h>
+#include <linux/huge_mm.h>
 #include <linux/iosys-map.h>
+#include <linux/mount.h>
 #include <linux/pagemap.h>
 #include <linux/pfn.h>
+#include <linux/seq_file.h>
 #include <linux/version.h>
 #include <linux/vmalloc.h>
 #include <drm/drm_cache.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_prime.h>
 
 #include "amdxdna_carvedout_buf.h"
 #include "amdxdna_drm.h"
@@ -19,6 +25,8 @@
 #include "amdxdna_gem.h"
 #include "amdxdna_ubuf.h"
 #include "amdxdna_cma_buf.h"
+#include "amdxdna_page_pool.h"
+#include "amdxdna_mem_notify.h"
 
 #ifdef AMDXDNA_DEVEL
 #include "amdxdna_devel.h"
@@ -30,63 +38,402 @@ MODULE_IMPORT_NS("DMA_BUF");
 MODULE_IMPORT_NS(DMA_BUF);
 #endif
 
+static bool huge_page_bo;
+module_param(huge_page_bo, bool, 0444);
+MODULE_PARM_DESC(huge_page_bo, "Back shmem BOs with transparent huge pages (Default false)");
+
+static uint bo_free_defer_mb = 1024;
+module_param(bo_free_defer_mb, uint, 0644);
+MODULE_PARM_DESC(bo_free_defer_mb,
+		 "Max MB of BOs being released in background, 0 to release synchronously (Default 1024)");
+
+/* Workers releasing BOs in parallel */
+#define BO_FREE_MAX_ACTIVE	4
+
+static void amdxdna_gem_free_wq_fini(struct drm_device *ddev, void *arg)
+{
+	struct amdxdna_dev *xdna = arg;
+
+	/* Clients closed within a grace period are not queued yet */
+	rcu_barrier();
+	/* Drains BOs and clients still queued */
+	destroy_workqueue(xdna->bo_free_wq);
+	xdna->bo_free_wq = NULL;
+}
+
+int amdxdna_gem_free_wq_init(struct amdxdna_dev *xdna)
+{
+	/*
+	 * BOs can be freed by clients closed after device removal, keep the
+	 * workqueue around until DRM device is released.
+	 */
+	xdna->bo_free_wq = alloc_workqueue("amdxdna_bo_free", WQ_UNBOUND | WQ_MEM_RECLAIM,
+					   BO_FREE_MAX_ACTIVE);
+	if (!xdna->bo_free_wq)
+		return -ENOMEM;
+	atomic64_set(&xdna->bo_free_pending, 0);
+
+	return drmm_add_action_or_reset(&xdna->ddev, amdxdna_gem_free_wq_fini, xdna);
+}
+
+void amdxdna_gem_huge_mnt_init(struct amdxdna_dev *xdna)
+{
+#ifdef HAVE_drm_gem_shmem_create_with_mnt
+	char huge_opt[] = "huge=within_size";
+	struct file_system_type *type;
+	struct vfsmount *mnt;
+
+	if (!huge_page_bo)
+		return;
+
+	if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE)) {
+		XDNA_WARN(xdna, "Transparent huge page is not enabled");
+		return;
+	}
+
+	type = get_fs_type("tmpfs");
+	if (!type) {
+		XDNA_WARN(xdna, "Can not find tmpfs for huge page BO");
+		return;
+	}
+
+	mnt = vfs_kern_mount(type, SB_KERNMOUNT, type->name, huge_opt);
+	put_filesystem(type);
+	if (IS_ERR(mnt)) {
+		XDNA_WARN(xdna, "Mount huge page tmpfs failed, ret %ld", PTR_ERR(mnt));
+		return;
+	}
+
+	xdna->huge_mnt = mnt;
+	XDNA_DBG(xdna, "Shmem BOs are backed by huge pages");
+#else
+	if (huge_page_bo)
+		XDNA_WARN(xdna, "Huge page BO is not supported by this kernel");
+#endif
+}
+
+void amdxdna_gem_huge_mnt_fini(struct amdxdna_dev *xdna)
+{
+	if (!xdna->huge_mnt)
+		return;
+
+	kern_unmount(xdna->huge_mnt);
+	xdna->huge_mnt = NULL;
+}
+
+static struct amdxdna_heap_cache *amdxdna_heap_cache_init(u32 align)
+{
+	struct amdxdna_heap_cache *cache;
+	int i;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return NULL;
+
+	spin_lock_init(&cache->lock);
+	cache->align = align;
+	for (i = 0; i < HEAP_CACHE_CLASSES; i++)
+		INIT_LIST_HEAD(&cache->free[i]);
+	return cache;
+}
+
+/*
+ * Give all cached free chunks back to heap drm_mm. Caller holds heap mm_lock,
+ * or heap is being freed. Returns number of chunks given back.
+ */
+static u32 amdxdna_heap_cache_drain(struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_heap_cache *cache = heap->heap_cache;
+	struct amdxdna_heap_chunk *chunk, *tmp;
+	LIST_HEAD(drained);
+	u32 cnt = 0;
+	int i;
+
+	spin_lock(&cache->lock);
+	for (i = 0; i < HEAP_CACHE_CLASSES; i++) {
+		list_splice_init(&cache->free[i], &drained);
+		cache->free_cnt[i] = 0;
+	}
+	cache->drain_cnt++;
+	spin_unlock(&cache->lock);
+
+	list_for_each_entry_safe(chunk, tmp, &drained, entry) {
+		drm_mm_remove_node(&chunk->node);
+		kfree(chunk);
+		cnt++;
+	}
+	return cnt;
+}
+
+static void amdxdna_heap_cache_fini(struct amdxdna_gem_obj *heap)
+{
+	if (!heap->heap_cache)
+		return;
+
+	amdxdna_heap_cache_drain(heap);
+	kfree(heap->heap_cache);
+	heap->heap_cache = NULL;
+}
+
+static inline int amdxdna_heap_cache_class(struct amdxdna_heap_cache *cache, size_t size)
+{
+	size_t idx = DIV_ROUND_UP(size, cache->align) - 1;
+
+	return idx < HEAP_CACHE_CLASSES ? idx : -1;
+}
+
+/*
+ * Size class chunks are packed from the bottom of the heap and bigger BOs
+ * from the top. Short lived small BOs then do not punch holes in between
+ * big ones, which is what keeps a big allocation from fitting later.
+ */
 static int
-amdxdna_gem_heap_alloc(struct amdxdna_gem_obj *abo)
+amdxdna_heap_mm_alloc(struct amdxdna_gem_obj *heap, struct amdxdna_gem_obj *abo, int class)
 {
-	struct amdxdna_client *client = abo->client;
-	struct amdxdna_dev *xdna = client->xdna;
-	struct amdxdna_mem *mem = &abo->mem;
-	struct amdxdna_gem_obj *heap;
-	u32 align;
+	struct amdxdna_heap_cache *cache = heap->heap_cache;
+	struct amdxdna_heap_chunk *chunk;
 	int ret;
 
-	mutex_lock(&client->mm_lock);
+	if (class < 0)
+		return drm_mm_insert_node_generic(&heap->mm, &abo->mm_node, abo->mem.size,
+						  cache->align, 0, DRM_MM_INSERT_HIGH);
 
-	heap = client->dev_heap;
-	if (!heap) {
-		mutex_unlock(&client->mm_lock);
-		return -EINVAL;
+	chunk = kzalloc(sizeof(*chunk), GFP_KERNEL);
+	if (!chunk)
+		return -ENOMEM;
+
+	ret = drm_mm_insert_node_generic(&heap->mm, &chunk->node,
+					 (size_t)(class + 1) * cache->align,
+					 cache->align, 0, DRM_MM_INSERT_LOW);
+	if (ret) {
+		kfree(chunk);
+		return ret;
+	}
+	abo->heap_chunk = chunk;
+	return 0;
+}
+
+/* Caller holds heap mm_lock */
+static void amdxdna_heap_holes(struct amdxdna_gem_obj *heap, u64 *total, u64 *largest,
+			       u32 *cnt)
+{
+	u64 hole_start, hole_end, hole_size;
+	struct drm_mm_node *pos;
+
+	*total = 0;
+	*largest = 0;
+	*cnt = 0;
+	drm_mm_for_each_hole(pos, &heap->mm, hole_start, hole_end) {
+		hole_size = hole_end - hole_start;
+		*total += hole_size;
+		*largest = max(*largest, hole_size);
+		(*cnt)++;
 	}
+}
+
+/*
+ * Each heap has its own drm_mm and mm_lock, so that contexts on different
+ * heaps of a client don't contend or fragment each other.
+ */
+static int
+amdxdna_gem_heap_alloc(struct amdxdna_gem_obj *heap, struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_client *client = abo->client;
+	struct amdxdna_heap_cache *cache = heap->heap_cache;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_mem *mem = &abo->mem;
+	u32 usage;
+	int class;
+	int ret;
 
 	if (amdxdna_gem_uva(heap) == AMDXDNA_INVALID_ADDR) {
 		XDNA_ERR(xdna, "Invalid dev heap userptr");
-		mutex_unlock(&client->mm_lock);
 		return -EINVAL;
 	}
 
 	if (mem->size == 0 || mem->size > heap->mem.size) {
 		XDNA_ERR(xdna, "Invalid dev bo size 0x%lx, limit 0x%lx",
 			 mem->size, heap->mem.size);
-		mutex_unlock(&client->mm_lock);
 		return -EINVAL;
 	}
 
-	align = 1 << max(PAGE_SHIFT, xdna->dev_info->dev_mem_buf_shift);
-	ret = drm_mm_insert_node_generic(&heap->mm, &abo->mm_node, mem->size,
-					 align, 0, DRM_MM_INSERT_BEST);
+	class = amdxdna_heap_cache_class(cache, mem->size);
+	if (class >= 0) {
+		spin_lock(&cache->lock);
+		abo->heap_chunk = list_first_entry_or_null(&cache->free[class],
+							   struct amdxdna_heap_chunk, entry);
+		if (abo->heap_chunk) {
+			list_del(&abo->heap_chunk->entry);
+			cache->free_cnt[class]--;
+			cache->hit_cnt++;
+			cache->used += mem->size;
+			spin_unlock(&cache->lock);
+			goto done;
+		}
+		cache->miss_cnt++;
+		spin_unlock(&cache->lock);
+	}
+
+	mutex_lock(&heap->mm_lock);
+	ret = amdxdna_heap_mm_alloc(heap, abo, class);
+	/* Cached free chunks may be what fragments the heap */
+	if (ret == -ENOSPC && amdxdna_heap_cache_drain(heap))
+		ret = amdxdna_heap_mm_alloc(heap, abo, class);
+	if (ret == -ENOSPC) {
+		u64 hole_total, hole_max;
+		u32 hole_cnt;
+
+		amdxdna_heap_holes(heap, &hole_total, &hole_max, &hole_cnt);
+		if (hole_total >= mem->size)
+			XDNA_ERR(xdna, "Dev heap fragmented, 0x%llx free in %d holes, largest 0x%llx",
+				 hole_total, hole_cnt, hole_max);
+	}
+	mutex_unlock(&heap->mm_lock);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
-		mutex_unlock(&client->mm_lock);
 		return ret;
 	}
-	client->heap_usage += mem->size;
 
-	drm_gem_object_get(to_gobj(heap));
+	spin_lock(&cache->lock);
+	cache->used += mem->size;
+	spin_unlock(&cache->lock);
 
-	mutex_unlock(&client->mm_lock);
+done:
+	usage = atomic_add_return(mem->size, &client->heap_usage);
+	amdxdna_mem_notify_usage(client, AMDXDNA_MEM_PRESSURE_HEAP, usage - mem->size, usage);
+	drm_gem_object_get(to_gobj(heap));
+	abo->dev_heap = heap;
 	return 0;
 }
 
 static void
 amdxdna_gem_heap_free(struct amdxdna_gem_obj *abo)
 {
-	mutex_lock(&abo->client->mm_lock);
+	struct amdxdna_gem_obj *heap = abo->dev_heap;
+	struct amdxdna_heap_cache *cache = heap->heap_cache;
+	struct amdxdna_heap_chunk *chunk = abo->heap_chunk;
+	int class;
+
+	atomic_sub(abo->mem.size, &abo->client->heap_usage);
+	spin_lock(&cache->lock);
+	cache->used -= abo->mem.size;
+	if (chunk) {
+		class = amdxdna_heap_cache_class(cache, chunk->node.size);
+		if (cache->free_cnt[class] < HEAP_CACHE_MAX_FREE) {
+			list_add(&chunk->entry, &cache->free[class]);
+			cache->free_cnt[class]++;
+			spin_unlock(&cache->lock);
+			goto put_heap;
+		}
+	}
+	spin_unlock(&cache->lock);
+
+	mutex_lock(&heap->mm_lock);
+	if (chunk) {
+		drm_mm_remove_node(&chunk->node);
+		kfree(chunk);
+	} else {
+		drm_mm_remove_node(&abo->mm_node);
+	}
+	mutex_unlock(&heap->mm_lock);
+
+put_heap:
+	abo->heap_chunk = NULL;
+	abo->dev_heap = NULL;
+	drm_gem_object_put(to_gobj(heap));
+}
+
+static void amdxdna_gem_heap_show_one(struct amdxdna_gem_obj *heap, u32 idx,
+				      struct seq_file *m)
+{
+	struct amdxdna_heap_cache *cache = heap->heap_cache;
+	u64 hole_total, hole_max;
+	u64 cached = 0;
+	u32 hole_cnt;
+	int i;
+
+	mutex_lock(&heap->mm_lock);
+	amdxdna_heap_holes(heap, &hole_total, &hole_max, &hole_cnt);
+	mutex_unlock(&heap->mm_lock);
+	spin_lock(&cache->lock);
+	seq_printf(m, "  heap %d size 0x%lx used 0x%llx\n", idx, heap->mem.size, cache->used);
+	spin_unlock(&cache->lock);
+	seq_printf(m, "  holes %d total 0x%llx largest 0x%llx fragmentation %lld%%\n",
+		   hole_cnt, hole_total, hole_max,
+		   hole_total ? div64_u64((hole_total - hole_max) * 100, hole_total) : 0);
+
+	spin_lock(&cache->lock);
+	seq_printf(m, "  cache hits %lld misses %lld drains %lld\n",
+		   cache->hit_cnt, cache->miss_cnt, cache->drain_cnt);
+	for (i = 0; i < HEAP_CACHE_CLASSES; i++) {
+		if (!cache->free_cnt[i])
+			continue;
+		seq_printf(m, "  class 0x%x free %d\n", (i + 1) * cache->align,
+			   cache->free_cnt[i]);
+		cached += (u64)cache->free_cnt[i] * (i + 1) * cache->align;
+	}
+	spin_unlock(&cache->lock);
+	seq_printf(m, "  cached free 0x%llx\n", cached);
+}
+
+void amdxdna_gem_heap_show(struct amdxdna_client *client, struct seq_file *m)
+{
+	u32 i;
+
+	mutex_lock(&client->mm_lock);
+	if (client->num_dev_heaps)
+		seq_printf(m, "PID %d heaps %d used 0x%x\n", client->pid,
+			   client->num_dev_heaps, atomic_read(&client->heap_usage));
+	for (i = 0; i < client->num_dev_heaps; i++)
+		amdxdna_gem_heap_show_one(client->dev_heaps[i], i, m);
+	mutex_unlock(&client->mm_lock);
+}
+
+int amdxdna_gem_query_mem_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_drm_query_mem_info info = {};
+	struct amdxdna_heap_cache *cache;
+	struct amdxdna_gem_obj *heap;
+	u64 hole_total, hole_max;
+	u32 hole_cnt, size;
+	u32 i;
+	int c;
 
-	drm_mm_remove_node(&abo->mm_node);
-	abo->client->heap_usage -= abo->mem.size;
-	drm_gem_object_put(to_gobj(abo->client->dev_heap));
+	mutex_lock(&client->mm_lock);
+	for (i = 0; i < client->num_dev_heaps; i++) {
+		heap = client->dev_heaps[i];
+		cache = heap->heap_cache;
+
+		mutex_lock(&heap->mm_lock);
+		amdxdna_heap_holes(heap, &hole_total, &hole_max, &hole_cnt);
+		mutex_unlock(&heap->mm_lock);
+
+		info.heap_size += heap->mem.size;
+		info.heap_free += hole_total;
+		info.heap_largest_free = max(info.heap_largest_free, hole_max);
+		/* Cached free chunks are taken by dev BOs of their size class */
+		spin_lock(&cache->lock);
+		info.heap_used += cache->used;
+		for (c = 0; c < HEAP_CACHE_CLASSES; c++) {
+			if (!cache->free_cnt[c])
+				continue;
+			info.heap_free += (u64)cache->free_cnt[c] * (c + 1) * cache->align;
+			info.heap_largest_free = max_t(u64, info.heap_largest_free,
+						       (c + 1) * cache->align);
+		}
+		spin_unlock(&cache->lock);
+	}
+	info.heap_count = client->num_dev_heaps;
+	info.heap_max_count = AMDXDNA_MAX_DEV_HEAPS;
+	info.bo_usage = client->total_bo_usage;
+	info.internal_bo_usage = client->total_int_bo_usage;
+	mutex_unlock(&client->mm_lock);
 
-	mutex_unlock(&abo->client->mm_lock);
+	size = min_t(u32, args->buffer_size, sizeof(info));
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &info, size))
+		return -EFAULT;
+	args->buffer_size = size;
+	return 0;
 }
 
 static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
@@ -96,6 +443,7 @@ static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
 	struct amdxdna_umap *mapp = container_of(mni, struct amdxdna_umap, notifier);
 	struct amdxdna_gem_obj *abo = mapp->abo;
 	struct amdxdna_dev *xdna;
+	unsigned long start, end;
 
 	xdna = to_xdna_dev(to_gobj(abo)->dev);
 	XDNA_DBG(xdna, "Invalidating range 0x%lx, 0x%lx, type %d",
@@ -104,7 +452,16 @@ static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
 	if (!mmu_notifier_range_blockable(range))
 		return false;
 
+	start = max(range->start, mapp->range.start);
+	end = min(range->end, mapp->range.end);
 	down_write(&xdna->notifier_lock);
+	if (!mapp->invalid) {
+		mapp->inval_start = start;
+		mapp->inval_end = end;
+	} else {
+		mapp->inval_start = min(mapp->inval_start, start);
+		mapp->inval_end = max(mapp->inval_end, end);
+	}
 	abo->mem.map_invalid = true;
 	mapp->invalid = true;
 	mmu_interval_set_seq(&mapp->notifier, cur_seq);
@@ -314,12 +671,15 @@ u64 amdxdna_gem_uva(struct amdxdna_gem_obj *abo)
 	struct amdxdna_umap *mapp;
 
 	if (abo->type == AMDXDNA_BO_DEV) {
-		struct amdxdna_gem_obj *heap = abo->client->dev_heap;
+		struct amdxdna_gem_obj *heap = abo->dev_heap;
 		u64 off = amdxdna_gem_dev_addr(abo) - amdxdna_gem_dev_addr(heap);
 
 		return amdxdna_gem_uva(heap) + off;
 	}
 
+	if (is_sva_bo(abo))
+		return abo->mem.sva_addr;
+
 	down_read(&xdna->notifier_lock);
 	list_for_each_entry(mapp, &abo->mem.umap_list, node) {
 		if (mapp->unmapped)
@@ -340,7 +700,7 @@ u64 amdxdna_gem_dev_addr(struct amdxdna_gem_obj *abo)
 	if (abo->type == AMDXDNA_BO_DEV_HEAP)
 		return abo->client->xdna->dev_info->dev_mem_base;
 	if (abo->type == AMDXDNA_BO_DEV)
-		return abo->mm_node.start;
+		return abo->heap_chunk ? abo->heap_chunk->node.start : abo->mm_node.start;
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID)
 		return abo->mem.dma_addr;
@@ -387,9 +747,22 @@ static void amdxdna_gem_dev_obj_free(struct drm_gem_object *gobj)
 	amdxdna_gem_destroy_obj(abo);
 }
 
+static void amdxdna_gem_sva_obj_free(struct drm_gem_object *gobj)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
+	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
+
+	XDNA_DBG(xdna, "SVA BO uva 0x%llx size 0x%lx", abo->mem.sva_addr, abo->mem.size);
+	drm_gem_object_release(gobj);
+	amdxdna_gem_destroy_obj(abo);
+}
+
 static void amdxdna_imported_obj_free(struct amdxdna_gem_obj *abo)
 {
-	dma_buf_unmap_attachment_unlocked(abo->attach, abo->base.sgt, DMA_BIDIRECTIONAL);
+	dma_resv_lock(abo->dma_buf->resv, NULL);
+	dma_buf_unmap_attachment(abo->attach, abo->base.sgt, DMA_BIDIRECTIONAL);
+	dma_buf_unpin(abo->attach);
+	dma_resv_unlock(abo->dma_buf->resv);
 	dma_buf_detach(abo->dma_buf, abo->attach);
 	dma_buf_put(abo->dma_buf);
 	drm_gem_object_release(to_gobj(abo));
@@ -400,10 +773,12 @@ static void
 amdxdna_gem_shmem_add_bo_usage(struct amdxdna_gem_obj *abo, bool internal)
 {
 	struct amdxdna_client *client = abo->client;
+	size_t usage;
 
 	mutex_lock(&client->mm_lock);
 
 	client->total_bo_usage += abo->mem.size;
+	usage = client->total_bo_usage;
 	abo->acct_total = true;
 
 	if (internal) {
@@ -412,6 +787,8 @@ amdxdna_gem_shmem_add_bo_usage(struct amdxdna_gem_obj *abo, bool internal)
 	}
 
 	mutex_unlock(&client->mm_lock);
+
+	amdxdna_mem_notify_usage(client, AMDXDNA_MEM_PRESSURE_BO, usage - abo->mem.size, usage);
 }
 
 static void
@@ -435,20 +812,10 @@ amdxdna_gem_shmem_del_bo_usage(struct amdxdna_gem_obj *abo)
 	mutex_unlock(&client->mm_lock);
 }
 
-static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
+/* Release everything not depending on abo->client, may run in bo_free_wq */
+static void amdxdna_gem_shmem_obj_release(struct amdxdna_gem_obj *abo)
 {
-	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
-	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
-
-	XDNA_DBG(xdna, "BO type %d xdna_addr 0x%llx", abo->type, amdxdna_gem_dev_addr(abo));
-
-	amdxdna_hmm_unregister(abo, NULL);
-	/*
-	 * For driver's internal BOs without handle, do the clean-up here
-	 * and driver needs to make sure abo->client is still valid (BO isn't exported
-	 * and is freed before device is closed).
-	 */
-	amdxdna_gem_shmem_del_bo_usage(abo);
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
 
 	/* workqueue is not valid for VE2 */
 	if (xdna->notifier_wq)
@@ -457,8 +824,11 @@ static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
 	if (abo->flags & BO_SUBMIT_PINNED)
 		amdxdna_gem_unpin(abo);
 
-	if (abo->type == AMDXDNA_BO_DEV_HEAP)
+	if (abo->type == AMDXDNA_BO_DEV_HEAP) {
+		amdxdna_heap_cache_fini(abo);
 		drm_mm_takedown(&abo->mm);
+		mutex_destroy(&abo->mm_lock);
+	}
 
 	amdxdna_gem_vunmap(abo);
 	mutex_destroy(&abo->lock);
@@ -471,10 +841,90 @@ static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
 	drm_gem_shmem_free(&abo->base);
 }
 
+static void amdxdna_gem_shmem_free_work(struct work_struct *work)
+{
+	struct amdxdna_gem_obj *abo = container_of(work, struct amdxdna_gem_obj, free_work);
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	size_t size = to_gobj(abo)->size;
+
+	amdxdna_gem_shmem_obj_release(abo);
+	atomic64_sub(size, &xdna->bo_free_pending);
+}
+
+static bool amdxdna_gem_shmem_free_deferrable(struct amdxdna_dev *xdna, size_t size)
+{
+	u64 limit = (u64)READ_ONCE(bo_free_defer_mb) << 20;
+
+	if (!xdna->bo_free_wq || !limit)
+		return false;
+
+	/* Memory is needed right now, don't hold it in the queue */
+	if (current->flags & PF_MEMALLOC || si_mem_available() < totalram_pages() / 16)
+		return false;
+
+	if (atomic64_add_return(size, &xdna->bo_free_pending) > limit) {
+		atomic64_sub(size, &xdna->bo_free_pending);
+		return false;
+	}
+	return true;
+}
+
+static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
+	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
+
+	XDNA_DBG(xdna, "BO type %d xdna_addr 0x%llx", abo->type, amdxdna_gem_dev_addr(abo));
+
+	amdxdna_hmm_unregister(abo, NULL);
+	if (abo->cmdlist)
+		drm_gem_object_put(to_gobj(abo->cmdlist));
+	/*
+	 * For driver's internal BOs without handle, do the clean-up here
+	 * and driver needs to make sure abo->client is still valid (BO isn't exported
+	 * and is freed before device is closed).
+	 */
+	amdxdna_gem_shmem_del_bo_usage(abo);
+
+	/*
+	 * Unpinning, vunmap and releasing pages of large or many BOs take a
+	 * while, do it in background unless memory is tight.
+	 */
+	if (amdxdna_gem_shmem_free_deferrable(xdna, gobj->size)) {
+		INIT_WORK(&abo->free_work, amdxdna_gem_shmem_free_work);
+		queue_work(xdna->bo_free_wq, &abo->free_work);
+		return;
+	}
+
+	amdxdna_gem_shmem_obj_release(abo);
+}
+
+/* Handle of BO is going away, argument BO cache of client is stale */
+static void amdxdna_gem_obj_close(struct drm_gem_object *gobj, struct drm_file *file)
+{
+	struct amdxdna_client *client = file->driver_priv;
+
+	atomic64_inc(&client->handle_gen);
+	amdxdna_arg_cache_drop(client, gobj);
+}
+
 static void amdxdna_gem_shmem_obj_close(struct drm_gem_object *gobj, struct drm_file *file)
 {
+	struct amdxdna_client *client = file->driver_priv;
 	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
 
+	amdxdna_gem_obj_close(gobj, file);
+	/*
+	 * Client of a file being released is going away along with all its
+	 * handles and its usage is read by nobody, skip locking mm_lock for each
+	 * BO. Client taken off client list by flush() may still be used, e.g. by
+	 * a child process.
+	 */
+	if (abo->client == client && READ_ONCE(client->releasing)) {
+		abo->acct_total = false;
+		abo->acct_int = false;
+		return;
+	}
 	/*
 	 * For BOs with handle, do the clean-up here when abo->client is
 	 * guaranteed to be valid.
@@ -482,6 +932,148 @@ static void amdxdna_gem_shmem_obj_close(struct drm_gem_object *gobj, struct drm_
 	amdxdna_gem_shmem_del_bo_usage(abo);
 }
 
+#ifdef HAVE_vmf_insert_folio_pmd
+/* Pages mapped around a 4K fault on huge page BO */
+#define AMDXDNA_FAULT_AROUND_PAGES	16
+
+static void amdxdna_gem_huge_vm_open(struct vm_area_struct *vma)
+{
+	drm_gem_shmem_vm_ops.open(vma);
+}
+
+static void amdxdna_gem_huge_vm_close(struct vm_area_struct *vma)
+{
+	drm_gem_shmem_vm_ops.close(vma);
+}
+
+static vm_fault_t amdxdna_gem_huge_vm_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct drm_gem_object *gobj = vma->vm_private_data;
+	struct drm_gem_shmem_object *shmem = to_drm_gem_shmem_obj(gobj);
+	pgoff_t num_pages = min_t(pgoff_t, gobj->size >> PAGE_SHIFT, vma_pages(vma));
+	unsigned long addr = vmf->address;
+	pgoff_t pgoff, end;
+	vm_fault_t ret;
+	int err;
+
+	pgoff = (addr - vma->vm_start) >> PAGE_SHIFT;
+	end = min_t(pgoff_t, num_pages, pgoff + AMDXDNA_FAULT_AROUND_PAGES);
+
+	dma_resv_lock(gobj->resv, NULL);
+	if (pgoff >= num_pages || !shmem->pages) {
+		ret = VM_FAULT_SIGBUS;
+		goto unlock;
+	}
+
+	err = vm_insert_page(vma, addr, shmem->pages[pgoff]);
+	if (err && err != -EBUSY) {
+		ret = err == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+		goto unlock;
+	}
+	ret = VM_FAULT_NOPAGE;
+
+	/* Fault around is best effort, stop at the first page already mapped */
+	for (pgoff++, addr += PAGE_SIZE; pgoff < end; pgoff++, addr += PAGE_SIZE) {
+		if (vm_insert_page(vma, addr, shmem->pages[pgoff]))
+			break;
+	}
+
+unlock:
+	dma_resv_unlock(gobj->resv);
+	return ret;
+}
+
+static vm_fault_t amdxdna_gem_huge_vm_huge_fault(struct vm_fault *vmf, unsigned int order)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct drm_gem_object *gobj = vma->vm_private_data;
+	struct drm_gem_shmem_object *shmem = to_drm_gem_shmem_obj(gobj);
+	unsigned long addr = vmf->address & PMD_MASK;
+	struct folio *folio;
+	struct page *page;
+	pgoff_t pgoff;
+	vm_fault_t ret;
+
+	if (order != PMD_ORDER)
+		return VM_FAULT_FALLBACK;
+
+	if (addr < vma->vm_start || addr + PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+
+	pgoff = (addr - vma->vm_start) >> PAGE_SHIFT;
+	if (pgoff + HPAGE_PMD_NR > gobj->size >> PAGE_SHIFT)
+		return VM_FAULT_FALLBACK;
+
+	dma_resv_lock(gobj->resv, NULL);
+	if (!shmem->pages) {
+		ret = VM_FAULT_SIGBUS;
+		goto unlock;
+	}
+
+	/* The whole PMD has to be backed by one huge folio */
+	page = shmem->pages[pgoff];
+	folio = page_folio(page);
+	if (folio_order(folio) != PMD_ORDER || folio_page(folio, 0) != page) {
+		ret = VM_FAULT_FALLBACK;
+		goto unlock;
+	}
+
+	ret = vmf_insert_folio_pmd(vmf, folio, vmf->flags & FAULT_FLAG_WRITE);
+
+unlock:
+	dma_resv_unlock(gobj->resv);
+	return ret;
+}
+
+/*
+ * Inserting all 4K PTEs at mmap time costs a lot for large BO backed by huge
+ * pages, and gives up the huge mapping. Map it on fault instead, by PMD when
+ * possible.
+ */
+static const struct vm_operations_struct amdxdna_gem_huge_vm_ops = {
+	.fault = amdxdna_gem_huge_vm_fault,
+	.huge_fault = amdxdna_gem_huge_vm_huge_fault,
+	.open = amdxdna_gem_huge_vm_open,
+	.close = amdxdna_gem_huge_vm_close,
+};
+
+static bool amdxdna_gem_shmem_is_huge(struct amdxdna_gem_obj *abo,
+				      struct vm_area_struct *vma)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+
+	if (!xdna->huge_mnt || to_gobj(abo)->size < PMD_SIZE)
+		return false;
+
+	if (!IS_ALIGNED(vma->vm_start, PMD_SIZE))
+		return false;
+
+	return folio_order(page_folio(abo->base.pages[0])) == PMD_ORDER;
+}
+#endif
+
+/* Set up user mapping of shmem pages obtained by drm_gem_shmem_mmap(). */
+static int amdxdna_gem_shmem_map_pages(struct amdxdna_gem_obj *abo,
+				       struct vm_area_struct *vma)
+{
+	unsigned long num_pages = vma_pages(vma);
+
+	/* The buffer is based on memory pages. Fix the flag. */
+	vm_flags_mod(vma, VM_MIXEDMAP, VM_PFNMAP);
+
+#ifdef HAVE_vmf_insert_folio_pmd
+	if (amdxdna_gem_shmem_is_huge(abo, vma)) {
+		vm_flags_set(vma, VM_HUGEPAGE);
+		vma->vm_ops = &amdxdna_gem_huge_vm_ops;
+		return 0;
+	}
+#endif
+
+	/* One batch for all pages, page table is locked once per PMD. */
+	return vm_insert_pages(vma, vma->vm_start, abo->base.pages, &num_pages);
+}
+
 static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 					  struct vm_area_struct *vma)
 {
@@ -497,10 +1089,7 @@ static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 			return ret;
 		}
 
-		/* The buffer is based on memory pages. Fix the flag. */
-		vm_flags_mod(vma, VM_MIXEDMAP, VM_PFNMAP);
-		ret = vm_insert_pages(vma, vma->vm_start, abo->base.pages,
-				      &num_pages);
+		ret = amdxdna_gem_shmem_map_pages(abo, vma);
 		if (ret) {
 			XDNA_ERR(xdna, "Failed to insert pages %d", ret);
 			vma->vm_ops->close(vma);
@@ -555,9 +1144,9 @@ static int amdxdna_gem_shmem_obj_mmap(struct drm_gem_object *gobj,
 		goto hmm_unreg;
 	}
 
-	XDNA_DBG(xdna, "SHMEM BO map_offset 0x%llx type %d userptr 0x%lx size 0x%lx",
+	XDNA_DBG(xdna, "SHMEM BO map_offset 0x%llx type %d userptr 0x%lx size 0x%lx wc %d",
 		 drm_vma_node_offset_addr(&gobj->vma_node), abo->type,
-		 vma->vm_start, gobj->size);
+		 vma->vm_start, gobj->size, abo->base.map_wc);
 	return 0;
 
 hmm_unreg:
@@ -569,7 +1158,6 @@ static int amdxdna_gem_dmabuf_mmap(struct dma_buf *dma_buf, struct vm_area_struc
 {
 	struct drm_gem_object *gobj = dma_buf->priv;
 	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
-	unsigned long num_pages = vma_pages(vma);
 	int ret;
 
 	vma->vm_ops = &drm_gem_shmem_vm_ops;
@@ -580,10 +1168,7 @@ static int amdxdna_gem_dmabuf_mmap(struct dma_buf *dma_buf, struct vm_area_struc
 	if (ret)
 		goto put_obj;
 
-	/* The buffer is based on memory pages. Fix the flag. */
-	vm_flags_mod(vma, VM_MIXEDMAP, VM_PFNMAP);
-	ret = vm_insert_pages(vma, vma->vm_start, abo->base.pages,
-			      &num_pages);
+	ret = amdxdna_gem_shmem_map_pages(abo, vma);
 	if (ret)
 		goto close_vma;
 
@@ -630,7 +1215,7 @@ static void amdxdna_gem_obj_vunmap(struct drm_gem_object *obj, struct iosys_map
 static int amdxdna_gem_dev_obj_vmap(struct drm_gem_object *obj, struct iosys_map *map)
 {
 	struct amdxdna_gem_obj *abo = to_xdna_obj(obj);
-	struct amdxdna_gem_obj *heap = abo->client->dev_heap;
+	struct amdxdna_gem_obj *heap = abo->dev_heap;
 	u64 offset = amdxdna_gem_dev_addr(abo) - amdxdna_gem_dev_addr(heap);
 	void *base = amdxdna_gem_vmap(heap);
 
@@ -678,9 +1263,18 @@ static struct dma_buf *amdxdna_gem_prime_export(struct drm_gem_object *gobj, int
 	return drm_gem_dmabuf_export(gobj->dev, &exp_info);
 }
 
+/* For drm-resident-memory of fdinfo, pages are only there once BO is used */
+static enum drm_gem_object_status amdxdna_gem_shmem_obj_status(struct drm_gem_object *gobj)
+{
+	struct drm_gem_shmem_object *shmem = to_drm_gem_shmem_obj(gobj);
+
+	return READ_ONCE(shmem->pages) ? DRM_GEM_OBJECT_RESIDENT : 0;
+}
+
 static const struct drm_gem_object_funcs amdxdna_gem_shmem_funcs = {
 	.free = amdxdna_gem_shmem_obj_free,
 	.close = amdxdna_gem_shmem_obj_close,
+	.status = amdxdna_gem_shmem_obj_status,
 	.print_info = drm_gem_shmem_object_print_info,
 	.pin = drm_gem_shmem_object_pin,
 	.unpin = drm_gem_shmem_object_unpin,
@@ -694,10 +1288,23 @@ static const struct drm_gem_object_funcs amdxdna_gem_shmem_funcs = {
 
 static const struct drm_gem_object_funcs amdxdna_gem_dev_obj_funcs = {
 	.free = amdxdna_gem_dev_obj_free,
+	.close = amdxdna_gem_obj_close,
 	.vmap = amdxdna_gem_dev_obj_vmap,
 	.vunmap = amdxdna_gem_dev_obj_vunmap,
 };
 
+static struct dma_buf *amdxdna_gem_sva_obj_export(struct drm_gem_object *gobj, int flags)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+
+/* No vmap, mmap or export, nothing but user memory is behind SVA BO */
+static const struct drm_gem_object_funcs amdxdna_gem_sva_obj_funcs = {
+	.free = amdxdna_gem_sva_obj_free,
+	.close = amdxdna_gem_obj_close,
+	.export = amdxdna_gem_sva_obj_export,
+};
+
 /* For drm_driver->gem_create_object callback, only support shmem */
 struct drm_gem_object *
 amdxdna_gem_create_shmem_object_cb(struct drm_device *dev, size_t size)
@@ -716,12 +1323,20 @@ amdxdna_gem_create_shmem_object_cb(struct drm_device *dev, size_t size)
 static struct amdxdna_gem_obj *
 amdxdna_gem_create_shmem_object(struct drm_device *dev, struct amdxdna_drm_create_bo *args)
 {
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct drm_gem_shmem_object *shmem;
 	size_t size = args->size;
-	struct drm_gem_shmem_object *shmem = drm_gem_shmem_create(dev, size);
 
+#ifdef HAVE_drm_gem_shmem_create_with_mnt
+	if (xdna->huge_mnt)
+		shmem = drm_gem_shmem_create_with_mnt(dev, size, xdna->huge_mnt);
+	else
+#endif
+		shmem = drm_gem_shmem_create(dev, size);
 	if (IS_ERR(shmem))
 		return ERR_CAST(shmem);
-	shmem->map_wc = false;
+	/* drm_gem_shmem sets up WC pages and CPU mapping for map_wc BO. */
+	shmem->map_wc = !!(args->flags & AMDXDNA_BO_FLAG_WC);
 
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
@@ -738,6 +1353,32 @@ amdxdna_gem_create_shmem_object(struct drm_device *dev, struct amdxdna_drm_creat
 	return to_xdna_obj(&shmem->base);
 }
 
+/*
+ * Plain host BO takes pre-zeroed pages from page pool if there are enough,
+ * otherwise it is backed by shmem.
+ */
+static struct amdxdna_gem_obj *
+amdxdna_gem_create_host_object(struct drm_device *dev, struct amdxdna_drm_create_bo *args)
+{
+	struct drm_gem_object *gobj;
+	struct dma_buf *dma_buf;
+
+	if (!amdxdna_use_page_pool() || args->type != AMDXDNA_BO_SHARE ||
+	    (args->flags & AMDXDNA_BO_FLAG_WC))
+		return amdxdna_gem_create_shmem_object(dev, args);
+
+	dma_buf = amdxdna_get_pool_buf(dev, args->size);
+	if (IS_ERR(dma_buf))
+		return amdxdna_gem_create_shmem_object(dev, args);
+
+	gobj = dev->driver->gem_prime_import(dev, dma_buf);
+	dma_buf_put(dma_buf);
+	if (IS_ERR(gobj))
+		return ERR_CAST(gobj);
+
+	return to_xdna_obj(gobj);
+}
+
 static struct amdxdna_gem_obj *
 amdxdna_gem_create_carvedout_object(struct drm_device *dev, struct amdxdna_drm_create_bo *args)
 {
@@ -775,8 +1416,8 @@ amdxdna_gem_create_cma_object(struct drm_device *dev, struct amdxdna_drm_create_
 		return ERR_PTR(-EINVAL);
 	}
 
-	dma_buf = amdxdna_get_cma_buf_with_fallback(xdna->cma_region_devs,
-						    MAX_MEM_REGIONS,
+	dma_buf = amdxdna_get_cma_buf_with_fallback(xdna->cma_regions,
+						    MAX_MEM_REGIONS, &xdna->cma_next,
 						    dev->dev, size,
 						    args->flags);
 	if (IS_ERR(dma_buf))
@@ -826,6 +1467,71 @@ amdxdna_gem_create_user_object(struct drm_device *dev, struct amdxdna_drm_create
 	return to_xdna_obj(gobj);
 }
 
+/*
+ * Device reaches user pages through process PASID and faults them in on its
+ * own, so there is no pinning, dma-buf or MMU notifier behind this BO. Only
+ * the address range is recorded.
+ */
+static struct amdxdna_gem_obj *
+amdxdna_gem_create_sva_object(struct drm_device *dev, struct amdxdna_drm_create_bo *args,
+			      struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_va_entry va_ent;
+	struct amdxdna_drm_va_tbl va_tbl;
+	struct amdxdna_gem_obj *abo;
+
+	if (!xdna->sva_iopf || !client->sva)
+		return ERR_PTR(-EOPNOTSUPP);
+
+	/* Device walks page table of the process bound at open */
+	if (task_tgid_nr(current) != client->pid) {
+		XDNA_DBG(xdna, "SVA BO of PID %d created by PID %d", client->pid,
+			 task_tgid_nr(current));
+		return ERR_PTR(-EPERM);
+	}
+
+	if (copy_from_user(&va_tbl, u64_to_user_ptr(args->vaddr), sizeof(va_tbl)) ||
+	    va_tbl.num_entries != 1 ||
+	    copy_from_user(&va_ent, u64_to_user_ptr(args->vaddr + sizeof(va_tbl)),
+			   sizeof(va_ent))) {
+		XDNA_DBG(xdna, "SVA BO needs exactly one va entry");
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (!va_ent.vaddr || !PAGE_ALIGNED(va_ent.vaddr) || !PAGE_ALIGNED(va_ent.len) ||
+	    !va_ent.len || !access_ok(u64_to_user_ptr(va_ent.vaddr), va_ent.len)) {
+		XDNA_DBG(xdna, "Invalid SVA range 0x%llx size 0x%llx", va_ent.vaddr, va_ent.len);
+		return ERR_PTR(-EINVAL);
+	}
+
+	abo = amdxdna_gem_create_obj(dev, va_ent.len);
+	if (IS_ERR(abo))
+		return abo;
+
+	to_gobj(abo)->funcs = &amdxdna_gem_sva_obj_funcs;
+	drm_gem_private_object_init(dev, to_gobj(abo), va_ent.len);
+	abo->mem.sva_addr = va_ent.vaddr;
+	return abo;
+}
+
+static void amdxdna_gem_dmabuf_move_notify(struct dma_buf_attachment *attach)
+{
+	/* Imported buffer is pinned for its whole life, exporter can't move it */
+	WARN_ONCE(1, "Pinned dma-buf %p is being moved", attach->dmabuf);
+}
+
+/*
+ * Peer-to-peer capable, so that exporter like GPU can hand out its own memory
+ * directly, no staging through host memory. Firmware keeps the address, the
+ * buffer is thus pinned rather than being dynamically re-mapped.
+ */
+static const struct dma_buf_attach_ops amdxdna_gem_dmabuf_attach_ops = {
+	.allow_peer2peer = true,
+	.move_notify = amdxdna_gem_dmabuf_move_notify,
+};
+
 struct drm_gem_object *
 amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
 {
@@ -837,17 +1543,27 @@ amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
 
 	get_dma_buf(dma_buf);
 
-	attach = dma_buf_attach(dma_buf, dev->dev);
+	attach = dma_buf_dynamic_attach(dma_buf, dev->dev, &amdxdna_gem_dmabuf_attach_ops, NULL);
 	if (IS_ERR(attach)) {
 		ret = PTR_ERR(attach);
 		goto put_buf;
 	}
 
-	sgt = dma_buf_map_attachment_unlocked(attach, DMA_BIDIRECTIONAL);
+	dma_resv_lock(dma_buf->resv, NULL);
+	ret = dma_buf_pin(attach);
+	if (ret) {
+		dma_resv_unlock(dma_buf->resv);
+		goto fail_detach;
+	}
+
+	sgt = dma_buf_map_attachment(attach, DMA_BIDIRECTIONAL);
 	if (IS_ERR(sgt)) {
 		ret = PTR_ERR(sgt);
+		dma_buf_unpin(attach);
+		dma_resv_unlock(dma_buf->resv);
 		goto fail_detach;
 	}
+	dma_resv_unlock(dma_buf->resv);
 
 	gobj = drm_gem_shmem_prime_import_sg_table(dev, attach, sgt);
 	if (IS_ERR(gobj)) {
@@ -874,7 +1590,10 @@ amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
 	return gobj;
 
 fail_unmap:
-	dma_buf_unmap_attachment_unlocked(attach, sgt, DMA_BIDIRECTIONAL);
+	dma_resv_lock(dma_buf->resv, NULL);
+	dma_buf_unmap_attachment(attach, sgt, DMA_BIDIRECTIONAL);
+	dma_buf_unpin(attach);
+	dma_resv_unlock(dma_buf->resv);
 fail_detach:
 	dma_buf_detach(dma_buf, attach);
 put_buf:
@@ -889,6 +1608,30 @@ amdxdna_drm_create_share_bo(struct drm_device *dev,
 {
 	struct amdxdna_gem_obj *abo;
 
+	if (args->flags & AMDXDNA_BO_FLAG_SVA) {
+		if (!args->vaddr || args->type != AMDXDNA_BO_SHARE ||
+		    (args->flags & AMDXDNA_BO_FLAG_WC))
+			return ERR_PTR(-EINVAL);
+
+		abo = amdxdna_gem_create_sva_object(dev, args, filp);
+		if (IS_ERR(abo))
+			return ERR_CAST(abo);
+
+		/* Not backed by driver allocated memory, not accounted either */
+		abo->client = filp->driver_priv;
+		abo->type = AMDXDNA_BO_SHARE;
+		return abo;
+	}
+
+	if (args->flags & AMDXDNA_BO_FLAG_WC) {
+		if (args->vaddr || args->type == AMDXDNA_BO_DEV_HEAP)
+			return ERR_PTR(-EINVAL);
+#ifdef AMDXDNA_DEVEL
+		if (amdxdna_use_cma() || amdxdna_use_carvedout())
+			return ERR_PTR(-EOPNOTSUPP);
+#endif
+	}
+
 	if (args->vaddr)
 		abo = amdxdna_gem_create_user_object(dev, args);
 #ifdef AMDXDNA_DEVEL
@@ -898,7 +1641,7 @@ amdxdna_drm_create_share_bo(struct drm_device *dev,
 		abo = amdxdna_gem_create_carvedout_object(dev, args);
 #endif
 	else
-		abo = amdxdna_gem_create_shmem_object(dev, args);
+		abo = amdxdna_gem_create_host_object(dev, args);
 	if (IS_ERR(abo))
 		return ERR_CAST(abo);
 
@@ -937,18 +1680,29 @@ amdxdna_drm_create_dev_heap_bo(struct drm_device *dev,
 	if (IS_ERR(abo))
 		return ERR_CAST(abo);
 
-	/* Set up heap for this client. */
+	drm_mm_init(&abo->mm, xdna->dev_info->dev_mem_base, abo->mem.size);
+	mutex_init(&abo->mm_lock);
+	abo->heap_cache = amdxdna_heap_cache_init(1 << max(PAGE_SHIFT,
+						       xdna->dev_info->dev_mem_buf_shift));
+	if (!abo->heap_cache) {
+		drm_gem_object_put(to_gobj(abo));
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* Add heap to this client, it holds a reference until closed. */
 	mutex_lock(&client->mm_lock);
 
-	if (client->dev_heap) {
-		XDNA_ERR(xdna, "dev heap is already created");
+	if (client->num_dev_heaps == AMDXDNA_MAX_DEV_HEAPS) {
+		XDNA_ERR(xdna, "Client already has %d dev heaps", client->num_dev_heaps);
 		ret = -EBUSY;
 		goto mm_unlock;
 	}
-	client->dev_heap = abo;
-	drm_gem_object_get(to_gobj(abo));
 
-	drm_mm_init(&abo->mm, xdna->dev_info->dev_mem_base, abo->mem.size);
+	drm_gem_object_get(to_gobj(abo));
+	client->dev_heaps[client->num_dev_heaps++] = abo;
+	/* Device BOs are allocated from the default heap without mm_lock */
+	if (!client->dev_heap)
+		smp_store_release(&client->dev_heap, abo);
 
 	mutex_unlock(&client->mm_lock);
 
@@ -960,13 +1714,30 @@ mm_unlock:
 	return ERR_PTR(ret);
 }
 
+/*
+ * Get heap by handle, or the first heap of client if handle is 0. Caller
+ * puts the returned heap.
+ */
+struct amdxdna_gem_obj *amdxdna_gem_get_heap(struct amdxdna_client *client, u32 heap_hdl)
+{
+	struct amdxdna_gem_obj *heap;
+
+	if (heap_hdl)
+		return amdxdna_gem_get_obj(client, heap_hdl, AMDXDNA_BO_DEV_HEAP);
+
+	/* Published by amdxdna_drm_create_dev_heap_bo() and never changed */
+	heap = smp_load_acquire(&client->dev_heap);
+	if (heap)
+		drm_gem_object_get(to_gobj(heap));
+	return heap;
+}
+
 struct amdxdna_gem_obj *
-amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *args,
-			  struct drm_file *filp)
+amdxdna_gem_create_dev_bo(struct amdxdna_gem_obj *heap, size_t size)
 {
-	struct amdxdna_client *client = filp->driver_priv;
+	struct drm_device *dev = to_gobj(heap)->dev;
 	struct amdxdna_dev *xdna = to_xdna_dev(dev);
-	size_t aligned_sz = PAGE_ALIGN(args->size);
+	size_t aligned_sz = PAGE_ALIGN(size);
 	struct amdxdna_gem_obj *abo;
 	struct drm_gem_object *gobj;
 	int ret;
@@ -978,9 +1749,9 @@ amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *
 	gobj->funcs = &amdxdna_gem_dev_obj_funcs;
 
 	abo->type = AMDXDNA_BO_DEV;
-	abo->client = client;
+	abo->client = heap->client;
 
-	ret = amdxdna_gem_heap_alloc(abo);
+	ret = amdxdna_gem_heap_alloc(heap, abo);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
 		amdxdna_gem_destroy_obj(abo);
@@ -993,6 +1764,24 @@ amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *
 	return abo;
 }
 
+struct amdxdna_gem_obj *
+amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *args,
+			  struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_gem_obj *heap, *abo;
+
+	heap = amdxdna_gem_get_heap(client, args->heap);
+	if (!heap) {
+		XDNA_ERR(client->xdna, "Dev heap %d not found", args->heap);
+		return ERR_PTR(-EINVAL);
+	}
+
+	abo = amdxdna_gem_create_dev_bo(heap, args->size);
+	drm_gem_object_put(to_gobj(heap));
+	return abo;
+}
+
 int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(dev);
@@ -1002,6 +1791,9 @@ int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_f
 
 	XDNA_DBG(xdna, "BO arg type %d va_tbl 0x%llx size 0x%llx flags 0x%llx",
 		 args->type, args->vaddr, args->size, args->flags);
+	if (args->pad || (args->heap && args->type != AMDXDNA_BO_DEV))
+		return -EINVAL;
+
 	switch (args->type) {
 	case AMDXDNA_BO_SHARE:
 		fallthrough;
@@ -1046,9 +1838,9 @@ int amdxdna_gem_pin_nolock(struct amdxdna_gem_obj *abo)
 	int ret;
 
 	if (abo->type == AMDXDNA_BO_DEV)
-		abo = abo->client->dev_heap;
+		abo = abo->dev_heap;
 
-	if (is_import_bo(abo))
+	if (is_import_bo(abo) || is_sva_bo(abo))
 		return 0;
 
 	ret = drm_gem_shmem_pin(&abo->base);
@@ -1071,9 +1863,9 @@ int amdxdna_gem_pin(struct amdxdna_gem_obj *abo)
 void amdxdna_gem_unpin(struct amdxdna_gem_obj *abo)
 {
 	if (abo->type == AMDXDNA_BO_DEV)
-		abo = abo->client->dev_heap;
+		abo = abo->dev_heap;
 
-	if (is_import_bo(abo))
+	if (is_import_bo(abo) || is_sva_bo(abo))
 		return;
 
 	mutex_lock(&abo->lock);
@@ -1108,11 +1900,24 @@ int amdxdna_drm_get_bo_info_ioctl(struct drm_device *dev, void *data, struct drm
 	struct amdxdna_dev *xdna = to_xdna_dev(dev);
 	struct amdxdna_gem_obj *abo;
 	struct drm_gem_object *gobj;
+	struct sg_table *sgt;
 	int ret = 0;
 
-	if (args->ext || args->ext_flags)
+	if (args->ext || (args->ext_flags & ~AMDXDNA_BO_INFO_FROM_FD))
 		return -EINVAL;
 
+	if (args->ext_flags & AMDXDNA_BO_INFO_FROM_FD) {
+		/* Saves user a separate DRM_IOCTL_PRIME_FD_TO_HANDLE round trip */
+		u32 handle;
+
+		ret = drm_gem_prime_fd_to_handle(dev, filp, args->handle, &handle);
+		if (ret) {
+			XDNA_DBG(xdna, "Import dma-buf fd %d failed, ret %d", args->handle, ret);
+			return ret;
+		}
+		args->handle = handle;
+	}
+
 	gobj = drm_gem_object_lookup(filp, args->handle);
 	if (!gobj) {
 		XDNA_DBG(xdna, "Lookup GEM object %d failed", args->handle);
@@ -1122,14 +1927,16 @@ int amdxdna_drm_get_bo_info_ioctl(struct drm_device *dev, void *data, struct drm
 	abo = to_xdna_obj(gobj);
 	args->vaddr = amdxdna_gem_uva(abo);
 	args->xdna_addr = amdxdna_gem_dev_addr(abo);
+	sgt = READ_ONCE(abo->base.sgt);
+	args->nr_segs = sgt ? sgt->nents : 0;
 
 	if (abo->type != AMDXDNA_BO_DEV)
 		args->map_offset = drm_vma_node_offset_addr(&gobj->vma_node);
 	else
 		args->map_offset = AMDXDNA_INVALID_ADDR;
 
-	XDNA_DBG(xdna, "BO hdl %d map_offset 0x%llx vaddr 0x%llx xdna_addr 0x%llx",
-		 args->handle, args->map_offset, args->vaddr, args->xdna_addr);
+	XDNA_DBG(xdna, "BO hdl %d map_offset 0x%llx vaddr 0x%llx xdna_addr 0x%llx segs %u",
+		 args->handle, args->map_offset, args->vaddr, args->xdna_addr, args->nr_segs);
 
 	drm_gem_object_put(gobj);
 	return ret;
@@ -1186,24 +1993,49 @@ amdxdna_drm_clflush(struct amdxdna_gem_obj *abo, u32 start, u32 size)
 }
 
 /*
- * The sync bo ioctl is to make sure the CPU cache is in sync with memory.
- * This is required because NPU is not cache coherent device. CPU cache
- * flushing/invalidation is expensive so it is best to handle this outside
- * of the command submission path. This ioctl allows explicit cache
- * flushing/invalidation outside of the critical path.
+ * User normally syncs SVA BO through its own mapping. For driver sync, pages
+ * are looked up just for the flush, device may fault them in again anytime.
  */
-int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
-			      void *data, struct drm_file *filp)
+static int amdxdna_gem_sva_clflush(struct amdxdna_gem_obj *abo, u64 offset, u64 size)
 {
-	struct amdxdna_client *client = filp->driver_priv;
-	struct amdxdna_dev *xdna = to_xdna_dev(dev);
-	struct amdxdna_drm_sync_bo *args = data;
+	u64 start = round_down(abo->mem.sva_addr + offset, PAGE_SIZE);
+	u64 end = abo->mem.sva_addr + offset + size;
+	struct page *pages[64];
+	int i, n;
+
+	if (task_tgid_nr(current) != abo->client->pid)
+		return -EPERM;
+
+	while (start < end) {
+		n = min_t(u64, ARRAY_SIZE(pages), DIV_ROUND_UP(end - start, PAGE_SIZE));
+		n = get_user_pages_fast(start, n, 0, pages);
+		if (n <= 0)
+			return n ? n : -EFAULT;
+
+		drm_clflush_pages(pages, n);
+		for (i = 0; i < n; i++)
+			put_page(pages[i]);
+		start += (u64)n << PAGE_SHIFT;
+	}
+	return 0;
+}
+
+/*
+ * Sync one BO range. If device has to write back BO content first, a sync
+ * command is submitted to the BO's context and *seq is set to the sequence
+ * number to wait for. Otherwise, *ctx_hdl is AMDXDNA_INVALID_CTX_HANDLE.
+ */
+static int amdxdna_gem_sync_bo(struct amdxdna_client *client, struct drm_file *filp,
+			       struct amdxdna_drm_sync_bo *args, u32 *ctx_hdl, u64 *seq)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct drm_device *dev = &xdna->ddev;
 	struct amdxdna_gem_obj *abo;
 	struct drm_gem_object *gobj;
 	dma_addr_t bo_phyaddr;
-	u32 ctx_hdl;
 	int ret;
 
+	*ctx_hdl = AMDXDNA_INVALID_CTX_HANDLE;
 	gobj = drm_gem_object_lookup(filp, args->handle);
 	if (!gobj) {
 		XDNA_ERR(xdna, "Lookup GEM object failed");
@@ -1222,7 +2054,9 @@ int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
 		goto put_obj;
 	}
 
-	if (amdxdna_use_cma()) {
+	if (is_sva_bo(abo)) {
+		ret = amdxdna_gem_sva_clflush(abo, args->offset, args->size);
+	} else if (amdxdna_use_cma()) {
 		bo_phyaddr = abo->mem.dma_addr;
 		bo_phyaddr += args->offset;
 		if (args->direction == SYNC_DIRECT_TO_DEVICE) {
@@ -1234,6 +2068,16 @@ int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
 			ret = -EINVAL;
 		}
 	}
+	/*
+	 * Exporter knows whether its memory is coherent with device, e.g., GPU
+	 * memory is never flushed through CPU mapping.
+	 */
+	else if (is_import_bo(abo) && abo->dma_buf->ops->end_cpu_access) {
+		if (args->direction == SYNC_DIRECT_TO_DEVICE)
+			ret = dma_buf_end_cpu_access(abo->dma_buf, DMA_TO_DEVICE);
+		else
+			ret = dma_buf_begin_cpu_access(abo->dma_buf, DMA_FROM_DEVICE);
+	}
 	/* For import bo, still sync whole BO */
 	else if (amdxdna_gem_vmap(abo))
 		drm_clflush_virt_range(amdxdna_gem_vmap(abo) + args->offset, args->size);
@@ -1245,26 +2089,25 @@ int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
 		WARN_ONCE(1, "Can not find memory to sync");
 
 	amdxdna_gem_unpin(abo);
+	if (ret)
+		goto put_obj;
 
 	if (abo->assigned_ctx != AMDXDNA_INVALID_CTX_HANDLE &&
 	    args->direction == SYNC_DIRECT_FROM_DEVICE) {
-		u64 seq;
-
-		ctx_hdl = amdxdna_gem_get_assigned_ctx(client, args->handle);
-		if (ctx_hdl == AMDXDNA_INVALID_CTX_HANDLE) {
+		*ctx_hdl = amdxdna_gem_get_assigned_ctx(client, args->handle);
+		if (*ctx_hdl == AMDXDNA_INVALID_CTX_HANDLE) {
 			XDNA_ERR(xdna, "Failed to find ctx for BO sync");
 			ret = -EINVAL;
 			goto put_obj;
 		}
 
 		ret = amdxdna_cmd_submit(client, OP_SYNC_BO, AMDXDNA_INVALID_BO_HANDLE,
-					 &args->handle, 1, NULL, NULL, 0, ctx_hdl, &seq);
+					 &args->handle, 1, NULL, NULL, 0, *ctx_hdl, seq);
 		if (ret) {
 			XDNA_ERR(xdna, "Submit command failed");
+			*ctx_hdl = AMDXDNA_INVALID_CTX_HANDLE;
 			goto put_obj;
 		}
-
-		ret = amdxdna_cmd_wait(client, ctx_hdl, seq, 3000 /* ms */);
 	}
 
 	XDNA_DBG(xdna, "Sync bo %d offset 0x%llx, size 0x%llx, dir %d, ctx %d",
@@ -1276,6 +2119,108 @@ put_obj:
 	return ret;
 }
 
+/*
+ * The sync bo ioctl is to make sure the CPU cache is in sync with memory.
+ * This is required because NPU is not cache coherent device. CPU cache
+ * flushing/invalidation is expensive so it is best to handle this outside
+ * of the command submission path. This ioctl allows explicit cache
+ * flushing/invalidation outside of the critical path.
+ */
+int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
+			      void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_drm_sync_bo *args = data;
+	u32 ctx_hdl;
+	u64 seq;
+	int ret;
+
+	ret = amdxdna_gem_sync_bo(client, filp, args, &ctx_hdl, &seq);
+	if (ret || ctx_hdl == AMDXDNA_INVALID_CTX_HANDLE)
+		return ret;
+
+	return amdxdna_cmd_wait(client, ctx_hdl, seq, 3000 /* ms */);
+}
+
+/*
+ * Same as sync bo ioctl, for an array of BO ranges. Ranges of the same BO
+ * and direction following each other are merged when they touch, so that
+ * they are flushed at once. Sync commands of all BOs written back by device
+ * are submitted before waiting for any of them.
+ */
+int amdxdna_drm_sync_bos_ioctl(struct drm_device *dev,
+			       void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_sync_bos *args = data;
+	struct amdxdna_drm_sync_bo *bos;
+	u32 i, n, *ctx_hdls;
+	u64 *seqs;
+	int ret = 0;
+
+	if (!args->count || args->count > AMDXDNA_SYNC_BOS_MAX || args->pad) {
+		XDNA_DBG(xdna, "Invalid count %d", args->count);
+		return -EINVAL;
+	}
+
+	bos = kcalloc(args->count, sizeof(*bos) + sizeof(*ctx_hdls) + sizeof(*seqs), GFP_KERNEL);
+	if (!bos)
+		return -ENOMEM;
+	seqs = (u64 *)&bos[args->count];
+	ctx_hdls = (u32 *)&seqs[args->count];
+
+	if (copy_from_user(bos, u64_to_user_ptr(args->bos), args->count * sizeof(*bos))) {
+		ret = -EFAULT;
+		goto free_bos;
+	}
+
+	for (i = 0, n = 0; i < args->count; i++) {
+		struct amdxdna_drm_sync_bo *prev = n ? &bos[n - 1] : NULL;
+		struct amdxdna_drm_sync_bo *cur = &bos[i];
+
+		if (cur->offset + cur->size < cur->offset) {
+			ret = -EINVAL;
+			goto free_bos;
+		}
+
+		if (prev && prev->handle == cur->handle && prev->direction == cur->direction &&
+		    cur->offset <= prev->offset + prev->size &&
+		    prev->offset <= cur->offset + cur->size) {
+			u64 end = max(prev->offset + prev->size, cur->offset + cur->size);
+
+			prev->offset = min(prev->offset, cur->offset);
+			prev->size = end - prev->offset;
+			continue;
+		}
+		bos[n++] = *cur;
+	}
+
+	for (i = 0; i < n; i++) {
+		ret = amdxdna_gem_sync_bo(client, filp, &bos[i], &ctx_hdls[i], &seqs[i]);
+		if (ret)
+			break;
+	}
+	n = i;
+
+	/* Already submitted syncs are waited for even on error */
+	for (i = 0; i < n; i++) {
+		int r;
+
+		if (ctx_hdls[i] == AMDXDNA_INVALID_CTX_HANDLE)
+			continue;
+
+		r = amdxdna_cmd_wait(client, ctx_hdls[i], seqs[i], 3000 /* ms */);
+		if (r && !ret)
+			ret = r;
+	}
+	XDNA_DBG(xdna, "Sync'ed %d BO ranges merged into %d, ret %d", args->count, n, ret);
+
+free_bos:
+	kfree(bos);
+	return ret;
+}
+
 u32 amdxdna_gem_get_assigned_ctx(struct amdxdna_client *client, u32 bo_hdl)
 {
 	struct amdxdna_gem_obj *abo = amdxdna_gem_get_obj(client, bo_hdl, AMDXDNA_BO_INVALID);
@@ -11,6 +11,11 @@
 #include <drm/drm_gem_shmem_helper.h>
 #include <linux/hmm.h>
 
+struct amdxdna_dev;
+struct amdxdna_client;
+struct seq_file;
+struct amdxdna_drm_get_info;
+
 struct amdxdna_umap {
 	struct vm_area_struct		*vma;
 	struct mmu_interval_notifier	notifier;
@@ -21,6 +26,9 @@ struct amdxdna_umap {
 	struct kref			refcnt;
 	bool				invalid;
 	bool				unmapped;
+	/* Bounds of the invalidated part of range, when invalid is set */
+	unsigned long			inval_start;
+	unsigned long			inval_end;
 };
 
 struct amdxdna_mem {
@@ -28,11 +36,35 @@ struct amdxdna_mem {
 	size_t				size;
 	struct list_head		umap_list;
 	bool				map_invalid;
+	u64				sva_addr; /* User address of SVA BO */
 #ifdef AMDXDNA_DEVEL
 	u64				dma_addr; /* DMA mapped addr */
 #endif
 };
 
+/*
+ * Free chunks of device heap cached by size class, a class is a multiple of
+ * heap alignment. Common BO sizes are allocated and freed in O(1) without
+ * taking heap mm_lock or searching heap drm_mm. Bigger BOs go to drm_mm directly.
+ */
+#define HEAP_CACHE_CLASSES	16
+#define HEAP_CACHE_MAX_FREE	8
+struct amdxdna_heap_chunk {
+	struct drm_mm_node	node;
+	struct list_head	entry;
+};
+
+struct amdxdna_heap_cache {
+	spinlock_t		lock; /* Protects free lists and counters */
+	u32			align;
+	u64			used;
+	struct list_head	free[HEAP_CACHE_CLASSES];
+	u32			free_cnt[HEAP_CACHE_CLASSES];
+	u64			hit_cnt;
+	u64			miss_cnt;
+	u64			drain_cnt;
+};
+
 #define BO_SUBMIT_PINNED	BIT(0)
 struct amdxdna_gem_obj {
 	struct drm_gem_shmem_object	base;
@@ -44,10 +76,21 @@ struct amdxdna_gem_obj {
 
 	/* Below members are initialized when needed */
 	struct drm_mm			mm; /* For AMDXDNA_BO_DEV_HEAP */
+	struct mutex			mm_lock; /* For AMDXDNA_BO_DEV_HEAP, protects mm */
+	struct amdxdna_heap_cache	*heap_cache; /* For AMDXDNA_BO_DEV_HEAP */
+	struct amdxdna_gem_obj		*dev_heap; /* For AMDXDNA_BO_DEV, heap it is from */
 	struct drm_mm_node		mm_node; /* For AMDXDNA_BO_DEV / carvedout */
+	struct amdxdna_heap_chunk	*heap_chunk; /* For AMDXDNA_BO_DEV of a size class */
 	u32				assigned_ctx; /* For debug bo */
+	atomic_t			resident_cnt; /* Contexts having it resident */
+	/* Prebuilt command list of ERT_CMD_CHAIN cmd BO, protected by lock */
+	struct amdxdna_gem_obj		*cmdlist;
+	u32				cmdlist_size;
+	u32				cmdlist_op;
+	u32				cmdlist_cnt; /* Sub cmds converted into it */
 	struct dma_buf			*dma_buf;
 	struct dma_buf_attachment	*attach;
+	struct work_struct		free_work; /* Deferred release of backing */
 
 	/* True, if accounted for internal BO usage */
 	bool				acct_total;
@@ -57,6 +100,7 @@ struct amdxdna_gem_obj {
 
 #define to_gobj(obj)    (&(obj)->base.base)
 #define is_import_bo(obj) ((obj)->attach)
+#define is_sva_bo(obj) ((obj)->mem.sva_addr)
 
 static inline struct amdxdna_gem_obj *to_xdna_obj(struct drm_gem_object *gobj)
 {
@@ -71,6 +115,8 @@ static inline void amdxdna_gem_put_obj(struct amdxdna_gem_obj *abo)
 }
 
 void amdxdna_umap_put(struct amdxdna_umap *mapp);
+void amdxdna_gem_heap_show(struct amdxdna_client *client, struct seq_file *m);
+int amdxdna_gem_query_mem_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args);
 
 struct drm_gem_object *
 amdxdna_gem_create_shmem_object_cb(struct drm_device *dev, size_t size);
@@ -79,6 +125,8 @@ amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf);
 struct amdxdna_gem_obj *
 amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *args,
 			  struct drm_file *filp);
+struct amdxdna_gem_obj *amdxdna_gem_get_heap(struct amdxdna_client *client, u32 heap_hdl);
+struct amdxdna_gem_obj *amdxdna_gem_create_dev_bo(struct amdxdna_gem_obj *heap, size_t size);
 
 int amdxdna_gem_pin_nolock(struct amdxdna_gem_obj *abo);
 int amdxdna_gem_pin(struct amdxdna_gem_obj *abo);
@@ -91,6 +139,11 @@ void amdxdna_gem_clear_assigned_ctx(struct amdxdna_client *client, u32 bo_hdl);
 int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_get_bo_info_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_sync_bos_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+
+int amdxdna_gem_free_wq_init(struct amdxdna_dev *xdna);
+void amdxdna_gem_huge_mnt_init(struct amdxdna_dev *xdna);
+void amdxdna_gem_huge_mnt_fini(struct amdxdna_dev *xdna);
 
 void *amdxdna_gem_vmap(struct amdxdna_gem_obj *abo);
 u64 amdxdna_gem_uva(struct amdxdna_gem_obj *abo);
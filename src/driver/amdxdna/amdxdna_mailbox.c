@@ -6,6 +6,7 @@
 #include <linux/bitfield.h>
 #include <linux/types.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
 #include <linux/io.h>
 #include <linux/pci.h>
@@ -50,6 +51,29 @@
 #define MAILBOX_NAME			"xdna_mailbox"
 #define MSG_ID2ENTRY(msg_id)		((msg_id) & ~MAGIC_VAL_MASK)
 
+/*
+ * Adaptive interrupt/polling of response channels. After an interrupt, the rx
+ * worker keeps polling the channel till it has been quiet for mailbox_poll_us,
+ * interrupts coming in meanwhile are ignored. At most mailbox_poll_budget
+ * responses are handled before the worker yields and requeues itself.
+ */
+static uint mailbox_poll_us;
+module_param(mailbox_poll_us, uint, 0644);
+MODULE_PARM_DESC(mailbox_poll_us, "Poll response channel for up to this many us of no response after an interrupt, 0 to disable (default)");
+
+static uint mailbox_poll_budget = 64;
+module_param(mailbox_poll_budget, uint, 0644);
+MODULE_PARM_DESC(mailbox_poll_budget, "Max responses handled in one run of rx worker when polling (default 64)");
+
+/*
+ * X2I ring is sized by firmware. When it is full, firmware is given a little
+ * time to take messages out of it before sending fails. The wait is a busy
+ * one, senders may not sleep.
+ */
+static uint mailbox_tx_wait_us = 200;
+module_param(mailbox_tx_wait_us, uint, 0644);
+MODULE_PARM_DESC(mailbox_tx_wait_us, "Max us to wait for space when sending to a full ring, 0 to fail right away (default 200)");
+
 #ifdef AMDXDNA_DEVEL
 int mailbox_polling;
 module_param(mailbox_polling, int, 0444);
@@ -82,6 +106,20 @@ struct mailbox {
 };
 
 #if defined(CONFIG_DEBUG_FS)
+/*
+ * Send to response latency histogram of one opcode. Bucket i counts latency
+ * in [2^(i-1), 2^i) us, the last bucket counts everything above.
+ */
+#define MB_LAT_BUCKETS			20
+#define MB_LAT_OPCODES			16
+struct mailbox_lat_hist {
+	u32		opcode;
+	u64		cnt;
+	u64		total_ns;
+	u64		max_ns;
+	u64		buckets[MB_LAT_BUCKETS];
+};
+
 struct mailbox_res_record {
 	enum xdna_mailbox_channel_type	type;
 	struct list_head		re_entry;
@@ -105,6 +143,8 @@ struct mailbox_channel {
 	enum xdna_mailbox_channel_type	type;
 	struct xarray			chan_xa;
 	u32				next_msgid;
+	/* Preallocated msg slots, indexed by msg ID entry */
+	struct mailbox_msg		*msgs;
 
 	/* Received msg related fields */
 	struct workqueue_struct		*work_q;
@@ -112,6 +152,28 @@ struct mailbox_channel {
 	u32				i2x_head;
 	bool				bad_state;
 	u32				last_msg_id;
+	/* Called after each pass of responses, see xdna_mailbox_set_flush_cb() */
+	void				(*flush_cb)(void *arg);
+	void				*flush_arg;
+
+	/* X2I ring usage, see mailbox_wait_x2i_space() */
+	u32				x2i_peak;
+	u64				x2i_full_cnt;
+	u64				x2i_full_fail_cnt;
+	u64				x2i_full_ns;
+
+	/* Adaptive polling related fields */
+	bool				polling;
+	u64				irq_cnt;
+	u64				irq_ignored_cnt;
+	u64				poll_enter_cnt;
+	u64				poll_yield_cnt;
+	u64				poll_resp_cnt;
+
+#if defined(CONFIG_DEBUG_FS)
+	/* Updated by rx path only, opcodes beyond MB_LAT_OPCODES go to the last */
+	struct mailbox_lat_hist		lat_hist[MB_LAT_OPCODES + 1];
+#endif
 
 #ifdef AMDXDNA_DEVEL
 	struct timer_list		timer;
@@ -129,21 +191,21 @@ struct xdna_msg_header {
 
 static_assert(sizeof(struct xdna_msg_header) == 16);
 
-struct mailbox_pkg {
-	struct xdna_msg_header	header;
-	__u32			payload[];
-};
-
 /* The protocol version. */
 #define MSG_PROTOCOL_VERSION	0x1
 /* The tombstone value. */
 #define TOMBSTONE		0xDEADFACE
 
+/*
+ * Message payload is written to ring buffer right away when sending. Only
+ * what is needed to deliver the response is kept till then.
+ */
 struct mailbox_msg {
 	void			*handle;
 	int			(*notify_cb)(void *handle, void __iomem *data, size_t size);
-	size_t			pkg_size; /* package size in bytes */
-	struct mailbox_pkg	pkg;
+	u32			opcode;
+	u32			id;
+	ktime_t			send_time;
 };
 
 static void mailbox_reg_write(struct mailbox_channel *mb_chann, u32 mbox_reg, u32 data)
@@ -230,12 +292,16 @@ static inline int mailbox_validate_msgid(struct mailbox_channel *mb_chann, u32 m
 	return true;
 }
 
-static int mailbox_acquire_msgid(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+/*
+ * The msg ID is reserved first, then the msg slot of the ID is filled and
+ * published by mailbox_publish_msg() before the msg is sent.
+ */
+static int mailbox_acquire_msgid(struct mailbox_channel *mb_chann)
 {
 	u32 msg_id;
 	int ret;
 
-	ret = xa_alloc_cyclic_irq(&mb_chann->chan_xa, &msg_id, mb_msg,
+	ret = xa_alloc_cyclic_irq(&mb_chann->chan_xa, &msg_id, NULL,
 				  XA_LIMIT(0, MAX_MSG_ID_ENTRIES - 1),
 				  &mb_chann->next_msgid, GFP_NOWAIT);
 	if (ret < 0)
@@ -248,6 +314,20 @@ static int mailbox_acquire_msgid(struct mailbox_channel *mb_chann, struct mailbo
 	return msg_id;
 }
 
+static void mailbox_publish_msg(struct mailbox_channel *mb_chann, u32 msg_id,
+				struct xdna_mailbox_msg *msg)
+{
+	struct mailbox_msg *mb_msg = &mb_chann->msgs[MSG_ID2ENTRY(msg_id)];
+
+	mb_msg->handle = msg->handle;
+	mb_msg->notify_cb = msg->notify_cb;
+	mb_msg->opcode = msg->opcode;
+	mb_msg->id = msg_id;
+	mb_msg->send_time = ktime_get();
+	/* Replacing the reserved entry does not allocate memory */
+	xa_store_irq(&mb_chann->chan_xa, MSG_ID2ENTRY(msg_id), mb_msg, GFP_NOWAIT);
+}
+
 static bool mailbox_channel_no_msg(struct mailbox_channel *mb_chann)
 {
 	return xa_empty(&mb_chann->chan_xa);
@@ -263,14 +343,20 @@ static void mailbox_release_msg(struct mailbox_channel *mb_chann,
 				struct mailbox_msg *mb_msg)
 {
 	MB_DBG(mb_chann, "msg_id 0x%x msg opcode 0x%x",
-	       mb_msg->pkg.header.id, mb_msg->pkg.header.opcode);
+	       mb_msg->id, mb_msg->opcode);
 	mb_msg->notify_cb(mb_msg->handle, NULL, 0);
-	kfree(mb_msg);
 }
 
+/*
+ * Write a message to ring buffer at *tailp and move *tailp past it. The tail
+ * pointer register is not updated, so that messages written back to back
+ * can be made visible to firmware with one register write.
+ */
 static int
-mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+mailbox_write_msg(struct mailbox_channel *mb_chann, struct xdna_msg_header *header,
+		  const void *payload, u32 *tailp)
 {
+	size_t pkg_size = sizeof(*header) + header->total_size;
 	void __iomem *write_addr;
 	u32 ringbuf_size;
 	u32 head, tail;
@@ -278,10 +364,10 @@ mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 	u32 tmp_tail;
 
 	head = mailbox_get_headptr(mb_chann, CHAN_RES_X2I);
-	tail = mb_chann->x2i_tail;
+	tail = *tailp;
 	ringbuf_size = mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I);
 	start_addr = mb_chann->res[CHAN_RES_X2I].rb_start_addr;
-	tmp_tail = tail + mb_msg->pkg_size;
+	tmp_tail = tail + pkg_size;
 
 	if (tail < head && tmp_tail >= head) {
 		MB_DBG(mb_chann, "head 0x%x tail 0x%x tmp_tail 0x%x",
@@ -290,7 +376,7 @@ mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 	}
 
 	if (tail >= head && (tmp_tail > ringbuf_size - sizeof(u32) &&
-			     mb_msg->pkg_size >= head)) {
+			     pkg_size >= head)) {
 		MB_DBG(mb_chann, "head 0x%x tail 0x%x tmp_tail 0x%x",
 		       head, tail, tmp_tail);
 		goto no_space;
@@ -304,16 +390,24 @@ mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 		tail = 0;
 	}
 
-	print_hex_dump_debug("req data: ", DUMP_PREFIX_OFFSET, 16, 4, &mb_msg->pkg,
-			     mb_msg->pkg_size, false);
+	print_hex_dump_debug("req header: ", DUMP_PREFIX_OFFSET, 16, 4, header,
+			     sizeof(*header), false);
+	print_hex_dump_debug("req data: ", DUMP_PREFIX_OFFSET, 16, 4, payload,
+			     header->total_size, false);
 
+	/* Caller's payload goes to ring buffer directly, no intermediate copy */
 	write_addr = mb_chann->mb->res.ringbuf_base + start_addr + tail;
-	memcpy_toio(write_addr, &mb_msg->pkg, mb_msg->pkg_size);
-	mailbox_set_tailptr(mb_chann, tail + mb_msg->pkg_size);
+	memcpy_toio(write_addr, header, sizeof(*header));
+	memcpy_toio(write_addr + sizeof(*header), payload, header->total_size);
+	*tailp = tail + pkg_size;
+	/* Bytes not taken by firmware yet, tombstone gap at the end not counted */
+	if (*tailp >= head)
+		mb_chann->x2i_peak = max(mb_chann->x2i_peak, *tailp - head);
+	else
+		mb_chann->x2i_peak = max(mb_chann->x2i_peak, ringbuf_size - head + *tailp);
 
 	trace_mbox_set_tail(MAILBOX_NAME, mb_chann->msix_irq,
-			    mb_msg->pkg.header.opcode,
-			    mb_msg->pkg.header.id);
+			    header->opcode, header->id);
 
 	return 0;
 
@@ -321,6 +415,34 @@ no_space:
 	return -ENOSPC;
 }
 
+static void mailbox_record_latency(struct mailbox_channel *mb_chann,
+				   struct mailbox_msg *mb_msg)
+{
+	u64 elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), mb_msg->send_time));
+#if defined(CONFIG_DEBUG_FS)
+	struct mailbox_lat_hist *hist;
+	u32 bucket;
+	int i;
+
+	for (i = 0; i < MB_LAT_OPCODES; i++) {
+		hist = &mb_chann->lat_hist[i];
+		if (!hist->cnt)
+			hist->opcode = mb_msg->opcode;
+		if (hist->opcode == mb_msg->opcode)
+			break;
+	}
+	hist = &mb_chann->lat_hist[i];
+
+	bucket = min_t(u32, fls64(div_u64(elapsed_ns, NSEC_PER_USEC)), MB_LAT_BUCKETS - 1);
+	hist->buckets[bucket]++;
+	hist->total_ns += elapsed_ns;
+	hist->max_ns = max(hist->max_ns, elapsed_ns);
+	WRITE_ONCE(hist->cnt, hist->cnt + 1);
+#endif
+	trace_mbox_msg_latency(MAILBOX_NAME, mb_chann->msix_irq, mb_msg->opcode,
+			       mb_msg->id, elapsed_ns);
+}
+
 static int
 mailbox_get_resp(struct mailbox_channel *mb_chann, struct xdna_msg_header *header,
 		 void __iomem *data)
@@ -334,8 +456,12 @@ mailbox_get_resp(struct mailbox_channel *mb_chann, struct xdna_msg_header *heade
 		return -EINVAL;
 	mb_chann->last_msg_id = msg_id;
 
+	/*
+	 * The msg slot is reused once its ID is released. Keep the ID till
+	 * the notify callback is done with the slot.
+	 */
 	msg_id = MSG_ID2ENTRY(msg_id);
-	mb_msg = xa_erase_irq(&mb_chann->chan_xa, msg_id);
+	mb_msg = xa_load(&mb_chann->chan_xa, msg_id);
 	if (!mb_msg) {
 		MB_ERR(mb_chann, "Cannot find msg 0x%x", msg_id);
 		return -EINVAL;
@@ -343,12 +469,13 @@ mailbox_get_resp(struct mailbox_channel *mb_chann, struct xdna_msg_header *heade
 
 	MB_DBG(mb_chann, "resp opcode 0x%x size %d id 0x%x",
 	       header->opcode, header->total_size, header->id);
+	mailbox_record_latency(mb_chann, mb_msg);
 	ret = mb_msg->notify_cb(mb_msg->handle, data, header->total_size);
 	if (unlikely(ret))
 		MB_ERR(mb_chann, "Size %d opcode 0x%x ret %d",
 		       header->total_size, header->opcode, ret);
 
-	kfree(mb_msg);
+	xa_erase_irq(&mb_chann->chan_xa, msg_id);
 	return ret;
 }
 
@@ -426,9 +553,92 @@ static int mailbox_get_msg(struct mailbox_channel *mb_chann)
 	return ret;
 }
 
+static inline void mailbox_rx_flush(struct mailbox_channel *mb_chann)
+{
+	if (mb_chann->flush_cb)
+		mb_chann->flush_cb(mb_chann->flush_arg);
+}
+
+/*
+ * Consume responses till ring buffer is empty. Returns number of responses
+ * consumed or negative error code.
+ */
+static int mailbox_rx_drain(struct mailbox_channel *mb_chann)
+{
+	int cnt = 0;
+	int ret;
+
+	while (1) {
+		/*
+		 * If return is 0, keep consuming next message, until there is
+		 * no messages or an error happened.
+		 */
+		ret = mailbox_get_msg(mb_chann);
+		if (ret)
+			break;
+		cnt++;
+	}
+
+	/* Callbacks may have run before an error, flush them anyway */
+	mailbox_rx_flush(mb_chann);
+	if (ret == -ENOENT)
+		return cnt;
+	return ret;
+}
+
+static bool mailbox_rx_pending(struct mailbox_channel *mb_chann)
+{
+	if (mb_chann->iohub_int_addr)
+		return mailbox_irq_status(mb_chann);
+
+	return mailbox_get_tailptr(mb_chann, CHAN_RES_I2X) != mb_chann->i2x_head;
+}
+
+/*
+ * Keep polling after the ring buffer is drained, till no response comes in
+ * for poll_us or budget is used up. Returns true if budget is used up, the
+ * worker should be requeued then with interrupts still ignored.
+ */
+static bool mailbox_rx_poll(struct mailbox_channel *mb_chann, u32 poll_us, int *ret)
+{
+	u32 budget = READ_ONCE(mailbox_poll_budget);
+	ktime_t quiet_end;
+	u32 resp_cnt = 0;
+
+	if (!mb_chann->polling) {
+		WRITE_ONCE(mb_chann->polling, true);
+		mb_chann->poll_enter_cnt++;
+	}
+
+	quiet_end = ktime_add_us(ktime_get(), poll_us);
+	while (ktime_before(ktime_get(), quiet_end)) {
+		if (budget && resp_cnt >= budget) {
+			mb_chann->poll_yield_cnt++;
+			return true;
+		}
+
+		if (!mailbox_rx_pending(mb_chann)) {
+			cpu_relax();
+			continue;
+		}
+
+		mailbox_irq_acknowledge(mb_chann);
+		*ret = mailbox_rx_drain(mb_chann);
+		if (*ret < 0)
+			return false;
+		resp_cnt += *ret;
+		mb_chann->poll_resp_cnt += *ret;
+		quiet_end = ktime_add_us(ktime_get(), poll_us);
+	}
+
+	*ret = 0;
+	return false;
+}
+
 static void mailbox_rx_worker(struct work_struct *rx_work)
 {
 	struct mailbox_channel *mb_chann;
+	u32 poll_us;
 	u32 iohub;
 	int ret;
 
@@ -440,25 +650,28 @@ static void mailbox_rx_worker(struct work_struct *rx_work)
 		return;
 	}
 
+	poll_us = mb_chann->type == MB_CHANNEL_MGMT ? 0 : READ_ONCE(mailbox_poll_us);
 again:
 	mailbox_irq_acknowledge(mb_chann);
 
-	while (1) {
-		/*
-		 * If return is 0, keep consuming next message, until there is
-		 * no messages or an error happened.
-		 */
-		ret = mailbox_get_msg(mb_chann);
-		if (ret == -ENOENT)
-			break;
+	ret = mailbox_rx_drain(mb_chann);
+	if (ret >= 0 && poll_us && mailbox_rx_poll(mb_chann, poll_us, &ret)) {
+		queue_work(mb_chann->work_q, &mb_chann->rx_work);
+		return;
+	}
 
-		/* Other error means device doesn't look good, disable irq. */
-		if (unlikely(ret)) {
-			MB_ERR(mb_chann, "Unexpected ret %d, disable irq", ret);
-			WRITE_ONCE(mb_chann->bad_state, true);
-			disable_irq(mb_chann->msix_irq);
-			return;
-		}
+	/* Other error means device doesn't look good, disable irq. */
+	if (unlikely(ret < 0)) {
+		MB_ERR(mb_chann, "Unexpected ret %d, disable irq", ret);
+		WRITE_ONCE(mb_chann->bad_state, true);
+		disable_irq(mb_chann->msix_irq);
+		return;
+	}
+
+	/* Channel is quiet, back to interrupt */
+	if (mb_chann->polling) {
+		WRITE_ONCE(mb_chann->polling, false);
+		smp_mb(); /* Clear polling before checking interrupt status */
 	}
 
 	/*
@@ -480,6 +693,13 @@ static irqreturn_t mailbox_irq_handler(int irq, void *p)
 	if (mb_chann->type == MB_CHANNEL_USER_POLL)
 		return IRQ_HANDLED;
 
+	/* rx worker is polling, it will see the response */
+	mb_chann->irq_cnt++;
+	if (READ_ONCE(mb_chann->polling)) {
+		mb_chann->irq_ignored_cnt++;
+		return IRQ_HANDLED;
+	}
+
 	/* Schedule a rx_work to call the callback functions */
 	queue_work(mb_chann->work_q, &mb_chann->rx_work);
 
@@ -534,8 +754,11 @@ static void mailbox_polld_handle_chann(struct mailbox_channel *mb_chann)
 		return;
 
 	ret = mailbox_has_more_msg(mb_chann);
-	if (!ret)
+	if (!ret) {
+		/* A response may have been consumed while checking */
+		mailbox_rx_flush(mb_chann);
 		return;
+	}
 
 	trace_mbox_poll_handle(MAILBOX_NAME, mb_chann->msix_irq);
 
@@ -556,6 +779,7 @@ static void mailbox_polld_handle_chann(struct mailbox_channel *mb_chann)
 		ret = mailbox_get_msg(mb_chann);
 	} while (!ret);
 
+	mailbox_rx_flush(mb_chann);
 	if (ret == -ENOENT)
 		return;
 
@@ -635,15 +859,51 @@ static int mailbox_polld(void *data)
 	return 0;
 }
 
-int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
-			  struct xdna_mailbox_msg *msg, u64 tx_timeout)
+/*
+ * Ring is full. Messages already written are made visible to firmware, so
+ * that it can make room, then writing is retried till mailbox_tx_wait_us.
+ */
+static int
+mailbox_wait_x2i_space(struct mailbox_channel *mb_chann, struct xdna_msg_header *header,
+		       const void *payload, u32 *tailp)
 {
-	struct xdna_msg_header *header;
-	struct mailbox_msg *mb_msg;
-	size_t pkg_size;
+	ktime_t start = ktime_get();
+	ktime_t end = ktime_add_us(start, READ_ONCE(mailbox_tx_wait_us));
 	int ret;
 
-	pkg_size = sizeof(*header) + msg->send_size;
+	mb_chann->x2i_full_cnt++;
+	if (*tailp != mb_chann->x2i_tail)
+		mailbox_set_tailptr(mb_chann, *tailp);
+
+	do {
+		udelay(1);
+		ret = mailbox_write_msg(mb_chann, header, payload, tailp);
+	} while (ret == -ENOSPC && ktime_before(ktime_get(), end));
+
+	mb_chann->x2i_full_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret) {
+		mb_chann->x2i_full_fail_cnt++;
+		MB_DBG(mb_chann, "X2I ring still full after %u us", mailbox_tx_wait_us);
+	}
+	return ret;
+}
+
+u32 xdna_mailbox_x2i_capacity(struct mailbox_channel *mb_chann, size_t msg_size)
+{
+	size_t pkg_size = sizeof(struct xdna_msg_header) + msg_size;
+	u32 ringbuf_size = mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I);
+
+	/* Tail never catches up with head, and up to one message is lost at wrap */
+	if (ringbuf_size - sizeof(u32) < 2 * pkg_size)
+		return 0;
+	return (ringbuf_size - sizeof(u32)) / pkg_size - 1;
+}
+
+static int mailbox_validate_msg(struct mailbox_channel *mb_chann,
+				struct xdna_mailbox_msg *msg)
+{
+	size_t pkg_size = sizeof(struct xdna_msg_header) + msg->send_size;
+
 	if (pkg_size > mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I)) {
 		MB_ERR(mb_chann, "Message size larger than ringbuf size");
 		return -EINVAL;
@@ -660,56 +920,78 @@ int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
 		return -EINVAL;
 	}
 
+	return 0;
+}
+
+int xdna_mailbox_send_msgs(struct mailbox_channel *mb_chann,
+			   struct xdna_mailbox_msg *msgs, u32 msg_cnt, u64 tx_timeout)
+{
+	struct xdna_msg_header header;
+	struct xdna_mailbox_msg *msg;
+	u32 tail;
+	int ret;
+	u32 i;
+
 	if (READ_ONCE(mb_chann->bad_state)) {
 		MB_ERR(mb_chann, "Channel in bad state");
 		return -EPIPE;
 	}
 
-	mb_msg = kzalloc(sizeof(*mb_msg) + pkg_size, GFP_KERNEL);
-	if (!mb_msg)
-		return -ENOMEM;
-
-	mb_msg->handle = msg->handle;
-	mb_msg->notify_cb = msg->notify_cb;
-	mb_msg->pkg_size = pkg_size;
-
-	header = &mb_msg->pkg.header;
-	/*
-	 * Hardware use total_size and size to split huge message.
-	 * We do not support it here. Thus the values are the same.
-	 */
-	header->total_size = msg->send_size;
-	header->sz_ver = FIELD_PREP(MSG_BODY_SZ, msg->send_size) |
-			FIELD_PREP(MSG_PROTO_VER, MSG_PROTOCOL_VERSION);
-	header->opcode = msg->opcode;
-	memcpy(mb_msg->pkg.payload, msg->send_data, msg->send_size);
+	tail = mb_chann->x2i_tail;
+	for (i = 0; i < msg_cnt; i++) {
+		msg = &msgs[i];
+		ret = mailbox_validate_msg(mb_chann, msg);
+		if (ret)
+			break;
 
-	ret = mailbox_acquire_msgid(mb_chann, mb_msg);
-	if (unlikely(ret < 0)) {
-		MB_ERR(mb_chann, "mailbox_acquire_msgid failed");
-		goto msg_id_failed;
+		/*
+		 * Hardware use total_size and size to split huge message.
+		 * We do not support it here. Thus the values are the same.
+		 */
+		header.total_size = msg->send_size;
+		header.sz_ver = FIELD_PREP(MSG_BODY_SZ, msg->send_size) |
+				FIELD_PREP(MSG_PROTO_VER, MSG_PROTOCOL_VERSION);
+		header.opcode = msg->opcode;
+
+		ret = mailbox_acquire_msgid(mb_chann);
+		if (unlikely(ret < 0)) {
+			MB_ERR(mb_chann, "mailbox_acquire_msgid failed");
+			break;
+		}
+		header.id = ret;
+		msg->id = header.id;
+		mailbox_publish_msg(mb_chann, header.id, msg);
+
+		MB_DBG(mb_chann, "req opcode 0x%x size %d id 0x%x",
+		       header.opcode, header.total_size, header.id);
+
+		ret = mailbox_write_msg(mb_chann, &header, msg->send_data, &tail);
+		if (ret == -ENOSPC && READ_ONCE(mailbox_tx_wait_us))
+			ret = mailbox_wait_x2i_space(mb_chann, &header, msg->send_data, &tail);
+		if (ret) {
+			MB_DBG(mb_chann, "Error in mailbox send msg, ret %d", ret);
+			mailbox_release_msgid(mb_chann, header.id);
+			break;
+		}
 	}
-	header->id = ret;
-	msg->id = header->id;
-
-	MB_DBG(mb_chann, "req opcode 0x%x size %d id 0x%x",
-	       header->opcode, header->total_size, header->id);
 
-	ret = mailbox_send_msg(mb_chann, mb_msg);
-	if (ret) {
-		MB_DBG(mb_chann, "Error in mailbox send msg, ret %d", ret);
-		goto release_id;
-	}
+	if (!i)
+		return ret;
 
+	/* One tail pointer update for all messages written above */
+	mailbox_set_tailptr(mb_chann, tail);
 	if (mb_chann->type == MB_CHANNEL_USER_POLL)
 		mailbox_polld_wakeup(mb_chann->mb);
-	return 0;
+	return i;
+}
 
-release_id:
-	mailbox_release_msgid(mb_chann, header->id);
-msg_id_failed:
-	kfree(mb_msg);
-	return ret;
+int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
+			  struct xdna_mailbox_msg *msg, u64 tx_timeout)
+{
+	int ret;
+
+	ret = xdna_mailbox_send_msgs(mb_chann, msg, 1, tx_timeout);
+	return ret < 0 ? ret : 0;
 }
 
 #if defined(CONFIG_DEBUG_FS)
@@ -753,11 +1035,21 @@ found:
 	return record;
 }
 
+static void xdna_mailbox_x2i_show_chann(struct mailbox_channel *mb_chann,
+					struct seq_file *m)
+{
+	seq_printf(m, "%4d  0x%-8x  0x%-8x  %-10lld  %-10lld  %lld\n", mb_chann->msix_irq,
+		   mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I), READ_ONCE(mb_chann->x2i_peak),
+		   READ_ONCE(mb_chann->x2i_full_cnt), READ_ONCE(mb_chann->x2i_full_fail_cnt),
+		   div_u64(READ_ONCE(mb_chann->x2i_full_ns), NSEC_PER_USEC));
+}
+
 int xdna_mailbox_info_show(struct mailbox *mb, struct seq_file *m)
 {
 	static const char ring_fmt[] = "%4d  %3s  %5d  %4d  0x%08x  0x%04x  ";
 	static const char mbox_fmt[] = "0x%08x  0x%08x  0x%04x    0x%04x\n";
 	struct mailbox_res_record *record;
+	struct mailbox_channel *mb_chann;
 
 	/* If below two puts changed, make sure update fmt[] as well */
 	seq_puts(m, "mbox  dir  alive  type  ring addr   size    ");
@@ -788,6 +1080,69 @@ int xdna_mailbox_info_show(struct mailbox *mb, struct seq_file *m)
 	}
 	spin_unlock(&mb->mbox_lock);
 
+	seq_printf(m, "\nadaptive polling: poll_us %d budget %d\n",
+		   READ_ONCE(mailbox_poll_us), READ_ONCE(mailbox_poll_budget));
+	seq_puts(m, "mbox  polling  irqs        ignored     poll enter  poll yield  poll resps\n");
+	spin_lock(&mb->mbox_lock);
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry) {
+		seq_printf(m, "%4d  %7d  %-10lld  %-10lld  %-10lld  %-10lld  %lld\n",
+			   mb_chann->msix_irq, READ_ONCE(mb_chann->polling),
+			   mb_chann->irq_cnt, mb_chann->irq_ignored_cnt,
+			   mb_chann->poll_enter_cnt, mb_chann->poll_yield_cnt,
+			   mb_chann->poll_resp_cnt);
+	}
+	spin_unlock(&mb->mbox_lock);
+
+	seq_printf(m, "\nx2i ring full: wait_us %u\n", READ_ONCE(mailbox_tx_wait_us));
+	seq_puts(m, "mbox  x2i size    x2i peak    full        failed      full us\n");
+	spin_lock(&mb->mbox_lock);
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry)
+		xdna_mailbox_x2i_show_chann(mb_chann, m);
+	list_for_each_entry(mb_chann, &mb->poll_chann_list, chann_entry)
+		xdna_mailbox_x2i_show_chann(mb_chann, m);
+	spin_unlock(&mb->mbox_lock);
+
+	return 0;
+}
+
+static void xdna_mailbox_latency_show_chann(struct mailbox_channel *mb_chann,
+					    struct seq_file *m)
+{
+	struct mailbox_lat_hist *hist;
+	int i, j;
+
+	for (i = 0; i <= MB_LAT_OPCODES; i++) {
+		hist = &mb_chann->lat_hist[i];
+		if (!READ_ONCE(hist->cnt))
+			continue;
+
+		if (i == MB_LAT_OPCODES)
+			seq_printf(m, "%4d  others      ", mb_chann->msix_irq);
+		else
+			seq_printf(m, "%4d  0x%08x  ", mb_chann->msix_irq, hist->opcode);
+		seq_printf(m, "%-10lld  %-10lld  %-10lld ", hist->cnt,
+			   div64_u64(hist->total_ns, hist->cnt * NSEC_PER_USEC),
+			   div_u64(hist->max_ns, NSEC_PER_USEC));
+		for (j = 0; j < MB_LAT_BUCKETS; j++)
+			seq_printf(m, " %lld", hist->buckets[j]);
+		seq_puts(m, "\n");
+	}
+}
+
+int xdna_mailbox_latency_show(struct mailbox *mb, struct seq_file *m)
+{
+	struct mailbox_channel *mb_chann;
+
+	seq_printf(m, "Buckets: <1us, then [2^(i-1), 2^i) us, last >= %dus\n",
+		   1 << (MB_LAT_BUCKETS - 2));
+	seq_puts(m, "mbox  opcode      count       avg us      max us      buckets\n");
+	spin_lock(&mb->mbox_lock);
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry)
+		xdna_mailbox_latency_show_chann(mb_chann, m);
+	list_for_each_entry(mb_chann, &mb->poll_chann_list, chann_entry)
+		xdna_mailbox_latency_show_chann(mb_chann, m);
+	spin_unlock(&mb->mbox_lock);
+
 	return 0;
 }
 
@@ -858,6 +1213,12 @@ xdna_mailbox_create_channel(struct mailbox *mb,
 	if (!mb_chann)
 		return NULL;
 
+	mb_chann->msgs = kcalloc(MAX_MSG_ID_ENTRIES, sizeof(*mb_chann->msgs), GFP_KERNEL);
+	if (!mb_chann->msgs) {
+		kfree(mb_chann);
+		return NULL;
+	}
+
 	mb_chann->mb = mb;
 	mb_chann->type = type;
 #ifdef AMDXDNA_DEVEL
@@ -922,6 +1283,7 @@ skip_irq:
 destroy_wq:
 	destroy_workqueue(mb_chann->work_q);
 free_and_out:
+	kfree(mb_chann->msgs);
 	kfree(mb_chann);
 	return NULL;
 }
@@ -955,17 +1317,26 @@ destroy_wq:
 
 	xa_for_each(&mb_chann->chan_xa, msg_id, mb_msg)
 		mailbox_release_msg(mb_chann, mb_msg);
+	mailbox_rx_flush(mb_chann);
 
 	MB_DBG(mb_chann, "Mailbox channel released type %d irq: %d",
 	       mb_chann->type, mb_chann->msix_irq);
 }
 
+void xdna_mailbox_set_flush_cb(struct mailbox_channel *mb_chann,
+			       void (*cb)(void *arg), void *arg)
+{
+	mb_chann->flush_arg = arg;
+	mb_chann->flush_cb = cb;
+}
+
 void xdna_mailbox_free_channel(struct mailbox_channel *mb_chann)
 {
 	if (!mb_chann)
 		return;
 
 	xa_destroy(&mb_chann->chan_xa);
+	kfree(mb_chann->msgs);
 	kfree(mb_chann);
 }
 
@@ -113,6 +113,21 @@ xdna_mailbox_create_channel(struct mailbox *mailbox,
 			    struct xdna_mailbox_chann_info *info,
 			    enum xdna_mailbox_channel_type type);
 
+/*
+ * xdna_mailbox_set_flush_cb() -- set callback for end of a response pass
+ *
+ * @mailbox_chann: the handle return from xdna_mailbox_create_channel()
+ * @cb: callback, called with arg
+ * @arg: argument of cb
+ *
+ * Responses are taken from ring buffer in passes, each pass runs notify_cb of
+ * all responses ready. cb is called after each pass, also after messages are
+ * released with the channel, so that notify_cb can leave waking up waiters
+ * to it and do that once per pass. Must be set before any message is sent.
+ */
+void xdna_mailbox_set_flush_cb(struct mailbox_channel *mailbox_chann,
+			       void (*cb)(void *arg), void *arg);
+
 /*
  * xdna_mailbox_release_channel() -- release mailbox channel
  *
@@ -164,6 +179,37 @@ void xdna_mailbox_stop_channel(struct mailbox_channel *mailbox_chann);
 int xdna_mailbox_send_msg(struct mailbox_channel *mailbox_chann,
 			  struct xdna_mailbox_msg *msg, u64 tx_timeout);
 
+/*
+ * xdna_mailbox_send_msgs() -- Send messages back to back
+ *
+ * @mailbox_chann: Mailbox channel handle
+ * @msgs: array of message struct for message information
+ * @msg_cnt: number of messages in msgs
+ * @tx_timeout: the timeout value for sending the message in ms.
+ *
+ * Messages are written to ring buffer in order and made visible to firmware
+ * with one tail pointer update. Sending stops at the first message that
+ * can't be sent, messages after it are not sent.
+ *
+ * Return: number of messages sent if at least one is sent, otherwise,
+ * return error code of the first message
+ */
+int xdna_mailbox_send_msgs(struct mailbox_channel *mailbox_chann,
+			   struct xdna_mailbox_msg *msgs, u32 msg_cnt, u64 tx_timeout);
+
+/*
+ * xdna_mailbox_x2i_capacity() -- Number of messages the X2I ring always holds
+ *
+ * @mailbox_chann: Mailbox channel handle
+ * @msg_size: payload size of each message
+ *
+ * Messages beyond this, not yet taken by firmware, may find the ring full.
+ * Sending to a full ring waits a bit for firmware, see mailbox_tx_wait_us.
+ *
+ * Return: number of messages
+ */
+u32 xdna_mailbox_x2i_capacity(struct mailbox_channel *mailbox_chann, size_t msg_size);
+
 #if defined(CONFIG_DEBUG_FS)
 /*
  * xdna_mailbox_info_show() -- Show mailbox info for debug
@@ -176,6 +222,17 @@ int xdna_mailbox_send_msg(struct mailbox_channel *mailbox_chann,
 int xdna_mailbox_info_show(struct mailbox *mailbox,
 			   struct seq_file *m);
 
+/*
+ * xdna_mailbox_latency_show() -- Show per opcode send to response latency
+ *
+ * @mailbox: the handle return from xdna_mailbox_create()
+ * @m: the seq_file handle
+ *
+ * Return: if success, return 0; otherwise return error code
+ */
+int xdna_mailbox_latency_show(struct mailbox *mailbox,
+			      struct seq_file *m);
+
 /*
  * xdna_mailbox_ringbuf_show() -- Show ringbuf for debug
  *
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+
+#include <drm/drm_file.h>
+#include <drm/drm_print.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include "drm_local/amdxdna_accel.h"
+
+#include "amdxdna_drm.h"
+#include "amdxdna_mem_notify.h"
+
+/*
+ * Memory pressure notification of clients. A client arms it with
+ * DRM_IOCTL_AMDXDNA_MEM_NOTIFY and gets one DRM event on its fd once its heap
+ * or BO usage crosses the threshold it has given, or once system memory is
+ * short. For the latter, a shrinker is registered which frees nothing by
+ * itself, it only tells armed clients to give back what they keep cached.
+ */
+struct amdxdna_mem_notify {
+	/* Freed by drm_read() once event is read, has to be first */
+	struct drm_pending_event	base;
+	struct amdxdna_drm_mem_event	event;
+	struct list_head		node;
+	struct amdxdna_client		*client;
+	u64				heap_threshold;
+	u64				bo_threshold;
+};
+
+/* Protects mem_notify_armed, mem_notify_count and client->mem_notify */
+static DEFINE_SPINLOCK(mem_notify_lock);
+static LIST_HEAD(mem_notify_armed);
+static unsigned long mem_notify_count;
+
+static struct shrinker *mem_notify_shrinker;
+#ifndef HAVE_shrinker_alloc
+static struct shrinker mem_notify_shrinker_s;
+#endif
+
+/* Event is handed over to DRM, whatever happens to client after this */
+static void amdxdna_mem_notify_send(struct amdxdna_mem_notify *n, u32 reasons)
+{
+	struct amdxdna_client *client = n->client;
+
+	lockdep_assert_held(&mem_notify_lock);
+	list_del(&n->node);
+	mem_notify_count--;
+	client->mem_notify = NULL;
+
+	n->event.reasons = reasons;
+	n->event.heap_usage = atomic_read(&client->heap_usage);
+	n->event.bo_usage = READ_ONCE(client->total_bo_usage);
+	drm_send_event(&client->xdna->ddev, &n->base);
+}
+
+int amdxdna_drm_mem_notify_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_mem_notify *args = data;
+	struct amdxdna_mem_notify *n;
+	int ret;
+
+	if (args->flags || args->pad)
+		return -EINVAL;
+
+	n = kzalloc(sizeof(*n), GFP_KERNEL);
+	if (!n)
+		return -ENOMEM;
+
+	n->event.base.type = AMDXDNA_EVENT_MEM_PRESSURE;
+	n->event.base.length = sizeof(n->event);
+	n->event.user_data = args->user_data;
+	n->client = client;
+	n->heap_threshold = args->heap_threshold;
+	n->bo_threshold = args->bo_threshold;
+
+	spin_lock(&mem_notify_lock);
+	if (client->mem_notify) {
+		/* Still armed, only thresholds change */
+		client->mem_notify->heap_threshold = n->heap_threshold;
+		client->mem_notify->bo_threshold = n->bo_threshold;
+		client->mem_notify->event.user_data = n->event.user_data;
+		spin_unlock(&mem_notify_lock);
+		kfree(n);
+		return 0;
+	}
+
+	ret = drm_event_reserve_init(dev, filp, &n->base, &n->event.base);
+	if (ret) {
+		spin_unlock(&mem_notify_lock);
+		kfree(n);
+		return ret;
+	}
+	list_add_tail(&n->node, &mem_notify_armed);
+	mem_notify_count++;
+	client->mem_notify = n;
+	spin_unlock(&mem_notify_lock);
+
+	XDNA_DBG(xdna, "PID %d armed mem notify, heap 0x%llx, bo 0x%llx",
+		 client->pid, args->heap_threshold, args->bo_threshold);
+	return 0;
+}
+
+void amdxdna_mem_notify_usage(struct amdxdna_client *client, u32 reason, u64 old, u64 new)
+{
+	struct amdxdna_mem_notify *n;
+	u64 threshold;
+
+	/* Nothing armed is the common case, keep allocation path lock free */
+	if (!READ_ONCE(client->mem_notify) || new <= old)
+		return;
+
+	spin_lock(&mem_notify_lock);
+	n = client->mem_notify;
+	if (!n)
+		goto out;
+
+	threshold = reason == AMDXDNA_MEM_PRESSURE_HEAP ? n->heap_threshold : n->bo_threshold;
+	if (threshold && old < threshold && new >= threshold)
+		amdxdna_mem_notify_send(n, reason);
+out:
+	spin_unlock(&mem_notify_lock);
+}
+
+void amdxdna_mem_notify_fini_client(struct amdxdna_client *client)
+{
+	struct amdxdna_mem_notify *n;
+
+	spin_lock(&mem_notify_lock);
+	n = client->mem_notify;
+	if (n) {
+		list_del(&n->node);
+		mem_notify_count--;
+		client->mem_notify = NULL;
+	}
+	spin_unlock(&mem_notify_lock);
+
+	if (n)
+		drm_event_cancel_free(&client->xdna->ddev, &n->base);
+}
+
+static unsigned long
+amdxdna_mem_notify_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	return READ_ONCE(mem_notify_count) ?: SHRINK_EMPTY;
+}
+
+static unsigned long
+amdxdna_mem_notify_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct amdxdna_mem_notify *n;
+
+	spin_lock(&mem_notify_lock);
+	while ((n = list_first_entry_or_null(&mem_notify_armed, struct amdxdna_mem_notify, node)))
+		amdxdna_mem_notify_send(n, AMDXDNA_MEM_PRESSURE_SYSTEM);
+	spin_unlock(&mem_notify_lock);
+
+	/* Memory is given back by clients later, if at all */
+	return SHRINK_STOP;
+}
+
+int amdxdna_mem_notify_init(void)
+{
+#ifdef HAVE_shrinker_alloc
+	mem_notify_shrinker = shrinker_alloc(0, "amdxdna-mem-notify");
+	if (!mem_notify_shrinker)
+		return -ENOMEM;
+	mem_notify_shrinker->count_objects = amdxdna_mem_notify_count;
+	mem_notify_shrinker->scan_objects = amdxdna_mem_notify_scan;
+	shrinker_register(mem_notify_shrinker);
+#else
+	mem_notify_shrinker = &mem_notify_shrinker_s;
+	mem_notify_shrinker->count_objects = amdxdna_mem_notify_count;
+	mem_notify_shrinker->scan_objects = amdxdna_mem_notify_scan;
+	mem_notify_shrinker->seeks = DEFAULT_SEEKS;
+	if (register_shrinker(mem_notify_shrinker, "amdxdna-mem-notify")) {
+		mem_notify_shrinker = NULL;
+		return -ENOMEM;
+	}
+#endif
+	return 0;
+}
+
+void amdxdna_mem_notify_fini(void)
+{
+	if (!mem_notify_shrinker)
+		return;
+
+#ifdef HAVE_shrinker_alloc
+	shrinker_free(mem_notify_shrinker);
+#else
+	unregister_shrinker(mem_notify_shrinker);
+#endif
+	mem_notify_shrinker = NULL;
+}
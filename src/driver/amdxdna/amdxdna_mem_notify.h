@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+#ifndef _AMDXDNA_MEM_NOTIFY_H_
+#define _AMDXDNA_MEM_NOTIFY_H_
+
+#include <drm/drm_device.h>
+#include <drm/drm_file.h>
+
+struct amdxdna_client;
+
+int amdxdna_mem_notify_init(void);
+void amdxdna_mem_notify_fini(void);
+int amdxdna_drm_mem_notify_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+/* Usage of client went from old to new, reason is AMDXDNA_MEM_PRESSURE_HEAP or _BO */
+void amdxdna_mem_notify_usage(struct amdxdna_client *client, u32 reason, u64 old, u64 new);
+void amdxdna_mem_notify_fini_client(struct amdxdna_client *client);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include <drm/drm_cache.h>
 #include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/string_helpers.h>
 
 #include "amdxdna_mgmt.h"
@@ -95,11 +96,14 @@ struct amdxdna_mgmt_dma_hdl *amdxdna_mgmt_buff_alloc(struct amdxdna_dev *xdna, s
 	dma_hdl->size = size;
 	dma_hdl->xdna = xdna;
 	dma_hdl->dir = dir;
+	kref_init(&dma_hdl->refcnt);
 
 	return dma_hdl;
 
 free_buf:
-	amdxdna_mgmt_buff_free(dma_hdl);
+	dma_free_noncoherent(xdna->ddev.dev, dma_hdl->aligned_size, dma_hdl->vaddr,
+			     dma_hdl->dma_hdl, dir);
+	kfree(dma_hdl);
 	return ERR_PTR(-EINVAL);
 }
 
@@ -142,11 +146,37 @@ void *amdxdna_mgmt_buff_get_cpu_addr(struct amdxdna_mgmt_dma_hdl *dma_hdl, u32 o
 	return dma_hdl->vaddr + offset;
 }
 
-void amdxdna_mgmt_buff_free(struct amdxdna_mgmt_dma_hdl *dma_hdl)
+struct amdxdna_mgmt_dma_hdl *amdxdna_mgmt_buff_get(struct amdxdna_mgmt_dma_hdl *dma_hdl)
 {
-	if (!dma_hdl)
-		return;
+	kref_get(&dma_hdl->refcnt);
+	return dma_hdl;
+}
+
+/*
+ * Map the buffer read-only into userspace. The pages come from dma_alloc_pages()
+ * underneath dma_alloc_noncoherent(), so they can be remapped directly. The caller
+ * is responsible for holding a buffer reference for the lifetime of the mapping.
+ */
+int amdxdna_mgmt_buff_mmap(struct amdxdna_mgmt_dma_hdl *dma_hdl, struct vm_area_struct *vma)
+{
+	struct amdxdna_dev *xdna = dma_hdl->xdna;
+
+	if (vma->vm_flags & VM_WRITE) {
+		XDNA_DBG(xdna, "Writable mapping of management buffer not allowed");
+		return -EPERM;
+	}
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	return dma_mmap_pages(xdna->ddev.dev, vma, PAGE_ALIGN(dma_hdl->size),
+			      virt_to_page(dma_hdl->vaddr));
+}
+
+static void amdxdna_mgmt_buff_release(struct kref *ref)
+{
+	struct amdxdna_mgmt_dma_hdl *dma_hdl;
 
+	dma_hdl = container_of(ref, struct amdxdna_mgmt_dma_hdl, refcnt);
 	dma_free_noncoherent(dma_hdl->xdna->ddev.dev, dma_hdl->aligned_size, dma_hdl->vaddr,
 			     dma_hdl->dma_hdl, dma_hdl->dir);
 	dma_hdl->vaddr = NULL;
@@ -154,5 +184,16 @@ void amdxdna_mgmt_buff_free(struct amdxdna_mgmt_dma_hdl *dma_hdl)
 	dma_hdl->dma_hdl = 0;
 	dma_hdl->aligned_size = 0;
 	kfree(dma_hdl);
-	dma_hdl = NULL;
+}
+
+/*
+ * Drop a reference. The memory is returned to the DMA allocator only once the
+ * last userspace mapping of the buffer is gone.
+ */
+void amdxdna_mgmt_buff_free(struct amdxdna_mgmt_dma_hdl *dma_hdl)
+{
+	if (!dma_hdl)
+		return;
+
+	kref_put(&dma_hdl->refcnt, amdxdna_mgmt_buff_release);
 }
@@ -6,6 +6,7 @@
 #define _AMDXDNA_MGMT_H_
 
 #include <linux/dma-mapping.h>
+#include <linux/kref.h>
 
 #include "amdxdna_drm.h"
 
@@ -16,6 +17,7 @@ struct amdxdna_mgmt_dma_hdl {
 	dma_addr_t			dma_hdl;
 	size_t				size;
 	size_t				aligned_size;
+	struct kref			refcnt;
 };
 
 struct amdxdna_mgmt_dma_hdl *amdxdna_mgmt_buff_alloc(struct amdxdna_dev *xdna, size_t size,
@@ -23,6 +25,8 @@ struct amdxdna_mgmt_dma_hdl *amdxdna_mgmt_buff_alloc(struct amdxdna_dev *xdna, s
 int amdxdna_mgmt_buff_clflush(struct amdxdna_mgmt_dma_hdl *dma_hdl, u32 offset, size_t size);
 dma_addr_t amdxdna_mgmt_buff_get_dma_addr(struct amdxdna_mgmt_dma_hdl *dma_hdl);
 void *amdxdna_mgmt_buff_get_cpu_addr(struct amdxdna_mgmt_dma_hdl *dma_hdl, u32 offset);
+struct amdxdna_mgmt_dma_hdl *amdxdna_mgmt_buff_get(struct amdxdna_mgmt_dma_hdl *dma_hdl);
 void amdxdna_mgmt_buff_free(struct amdxdna_mgmt_dma_hdl *dma_hdl);
+int amdxdna_mgmt_buff_mmap(struct amdxdna_mgmt_dma_hdl *dma_hdl, struct vm_area_struct *vma);
 
 #endif /* _AMDXDNA_MGMT_H_ */
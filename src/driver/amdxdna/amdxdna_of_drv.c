@@ -9,6 +9,7 @@
 #include <drm/drm_managed.h>
 
 #include "amdxdna_devel.h"
+#include "amdxdna_mem_notify.h"
 #include "amdxdna_of_drv.h"
 
 static const struct of_device_id amdxdna_of_table[] = {
@@ -111,7 +112,39 @@ static struct platform_driver amdxdna_of_plat_driver = {
 	},
 };
 
-module_platform_driver(amdxdna_of_plat_driver);
+static int __init amdxdna_of_mod_init(void)
+{
+	int ret;
+
+	ret = amdxdna_job_cache_init();
+	if (ret)
+		return ret;
+
+	ret = amdxdna_mem_notify_init();
+	if (ret)
+		goto fini_job_cache;
+
+	ret = platform_driver_register(&amdxdna_of_plat_driver);
+	if (ret)
+		goto fini_mem_notify;
+	return 0;
+
+fini_mem_notify:
+	amdxdna_mem_notify_fini();
+fini_job_cache:
+	amdxdna_job_cache_fini();
+	return ret;
+}
+
+static void __exit amdxdna_of_mod_exit(void)
+{
+	platform_driver_unregister(&amdxdna_of_plat_driver);
+	amdxdna_mem_notify_fini();
+	amdxdna_job_cache_fini();
+}
+
+module_init(amdxdna_of_mod_init);
+module_exit(amdxdna_of_mod_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("XRT Team <runtimeca39d@amd.com>");
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+
+#include <drm/drm_cache.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/shrinker.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "amdxdna_page_pool.h"
+
+/*
+ * Pool of zeroed pages with no dirty cache line, refilled in background.
+ * Host BOs taking their pages from it are created in about the same time
+ * whatever the size, instead of zeroing and flushing every page when the BO
+ * is first pinned. Pool shrinks on memory pressure and grows back once the
+ * pressure is gone.
+ */
+static uint page_pool_mb;
+module_param(page_pool_mb, uint, 0444);
+MODULE_PARM_DESC(page_pool_mb,
+		 "MB of pre-zeroed pages kept for backing host BOs, 0 to disable (Default 0)");
+
+/* Pages allocated and flushed at a time by refill */
+#define POOL_REFILL_BATCH	64
+/* No refill for this long after pool was shrunk */
+#define POOL_SHRINK_BACKOFF	(5 * HZ)
+
+static struct amdxdna_page_pool {
+	spinlock_t		lock; /* Protects pages, count and target */
+	struct list_head	pages;
+	unsigned long		count;
+	unsigned long		target; /* Pages to keep, lowered by shrinker */
+	unsigned long		max; /* Pages given by page_pool_mb */
+	unsigned long		shrunk_at; /* jiffies of last shrink */
+	struct delayed_work	refill_work;
+	struct shrinker		*shrinker;
+#ifndef HAVE_shrinker_alloc
+	struct shrinker		shrinker_s;
+#endif
+} page_pool;
+
+bool amdxdna_use_page_pool(void)
+{
+	return !!page_pool.max;
+}
+
+static void amdxdna_page_pool_kick(void)
+{
+	mod_delayed_work(system_unbound_wq, &page_pool.refill_work, 0);
+}
+
+static void amdxdna_page_pool_refill(struct work_struct *work)
+{
+	struct page *batch[POOL_REFILL_BATCH];
+	unsigned long want;
+	int i, n;
+
+	spin_lock(&page_pool.lock);
+	if (time_before(jiffies, page_pool.shrunk_at + POOL_SHRINK_BACKOFF)) {
+		spin_unlock(&page_pool.lock);
+		mod_delayed_work(system_unbound_wq, &page_pool.refill_work,
+				 POOL_SHRINK_BACKOFF);
+		return;
+	}
+	/* Grow back to configured size step by step after being shrunk */
+	page_pool.target = min(page_pool.max, page_pool.target + page_pool.max / 8 + 1);
+	want = page_pool.target > page_pool.count ? page_pool.target - page_pool.count : 0;
+	spin_unlock(&page_pool.lock);
+
+	while (want) {
+		n = min_t(unsigned long, want, POOL_REFILL_BATCH);
+		for (i = 0; i < n; i++) {
+			batch[i] = alloc_page(GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN |
+					      __GFP_NORETRY);
+			if (!batch[i])
+				break;
+		}
+		n = i;
+		if (!n)
+			break;
+		drm_clflush_pages(batch, n);
+
+		spin_lock(&page_pool.lock);
+		for (i = 0; i < n; i++)
+			list_add(&batch[i]->lru, &page_pool.pages);
+		page_pool.count += n;
+		spin_unlock(&page_pool.lock);
+
+		want -= n;
+		cond_resched();
+	}
+
+	/* Not fully refilled means memory is short, try again later */
+	if (want)
+		mod_delayed_work(system_unbound_wq, &page_pool.refill_work,
+				 POOL_SHRINK_BACKOFF);
+}
+
+/* Takes n pages, all or nothing */
+static int amdxdna_page_pool_get(struct page **pages, unsigned long n)
+{
+	struct page *page;
+	unsigned long i;
+	bool kick;
+
+	spin_lock(&page_pool.lock);
+	if (page_pool.count < n) {
+		spin_unlock(&page_pool.lock);
+		amdxdna_page_pool_kick();
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		page = list_first_entry(&page_pool.pages, struct page, lru);
+		list_del(&page->lru);
+		pages[i] = page;
+	}
+	page_pool.count -= n;
+	kick = page_pool.count < page_pool.target / 2;
+	spin_unlock(&page_pool.lock);
+
+	if (kick)
+		amdxdna_page_pool_kick();
+	return 0;
+}
+
+static unsigned long
+amdxdna_page_pool_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	return READ_ONCE(page_pool.count) ?: SHRINK_EMPTY;
+}
+
+static unsigned long
+amdxdna_page_pool_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	unsigned long freed = 0;
+	struct page *page;
+	LIST_HEAD(drop);
+
+	spin_lock(&page_pool.lock);
+	while (freed < sc->nr_to_scan && page_pool.count) {
+		page = list_first_entry(&page_pool.pages, struct page, lru);
+		list_move(&page->lru, &drop);
+		page_pool.count--;
+		freed++;
+	}
+	page_pool.target = page_pool.count;
+	page_pool.shrunk_at = jiffies;
+	spin_unlock(&page_pool.lock);
+
+	while ((page = list_first_entry_or_null(&drop, struct page, lru))) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	return freed ?: SHRINK_STOP;
+}
+
+int amdxdna_page_pool_init(void)
+{
+	page_pool.max = (unsigned long)page_pool_mb << (20 - PAGE_SHIFT);
+	if (!page_pool.max)
+		return 0;
+
+	spin_lock_init(&page_pool.lock);
+	INIT_LIST_HEAD(&page_pool.pages);
+	INIT_DELAYED_WORK(&page_pool.refill_work, amdxdna_page_pool_refill);
+	page_pool.target = page_pool.max;
+	page_pool.shrunk_at = jiffies - POOL_SHRINK_BACKOFF;
+
+#ifdef HAVE_shrinker_alloc
+	page_pool.shrinker = shrinker_alloc(0, "amdxdna-page-pool");
+	if (!page_pool.shrinker) {
+		page_pool.max = 0;
+		return -ENOMEM;
+	}
+	page_pool.shrinker->count_objects = amdxdna_page_pool_count;
+	page_pool.shrinker->scan_objects = amdxdna_page_pool_scan;
+	shrinker_register(page_pool.shrinker);
+#else
+	page_pool.shrinker = &page_pool.shrinker_s;
+	page_pool.shrinker->count_objects = amdxdna_page_pool_count;
+	page_pool.shrinker->scan_objects = amdxdna_page_pool_scan;
+	page_pool.shrinker->seeks = DEFAULT_SEEKS;
+	if (register_shrinker(page_pool.shrinker, "amdxdna-page-pool")) {
+		page_pool.max = 0;
+		return -ENOMEM;
+	}
+#endif
+
+	amdxdna_page_pool_kick();
+	return 0;
+}
+
+void amdxdna_page_pool_fini(void)
+{
+	struct page *page, *tmp;
+
+	if (!amdxdna_use_page_pool())
+		return;
+
+#ifdef HAVE_shrinker_alloc
+	shrinker_free(page_pool.shrinker);
+#else
+	unregister_shrinker(page_pool.shrinker);
+#endif
+	cancel_delayed_work_sync(&page_pool.refill_work);
+	list_for_each_entry_safe(page, tmp, &page_pool.pages, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	page_pool.count = 0;
+	page_pool.max = 0;
+}
+
+struct amdxdna_pbuf_priv {
+	struct page **pages;
+	unsigned long nr_pages;
+};
+
+static struct sg_table *amdxdna_pbuf_map(struct dma_buf_attachment *attach,
+					 enum dma_data_direction direction)
+{
+	struct amdxdna_pbuf_priv *pbuf = attach->dmabuf->priv;
+	struct sg_table *sg;
+	int ret;
+
+	sg = kzalloc(sizeof(*sg), GFP_KERNEL);
+	if (!sg)
+		return ERR_PTR(-ENOMEM);
+
+	ret = sg_alloc_table_from_pages(sg, pbuf->pages, pbuf->nr_pages, 0,
+					pbuf->nr_pages << PAGE_SHIFT, GFP_KERNEL);
+	if (ret)
+		goto free_sg;
+
+	ret = dma_map_sgtable(attach->dev, sg, direction, 0);
+	if (ret)
+		goto free_table;
+
+	return sg;
+
+free_table:
+	sg_free_table(sg);
+free_sg:
+	kfree(sg);
+	return ERR_PTR(ret);
+}
+
+static void amdxdna_pbuf_unmap(struct dma_buf_attachment *attach,
+			       struct sg_table *sg,
+			       enum dma_data_direction direction)
+{
+	dma_unmap_sgtable(attach->dev, sg, direction, 0);
+	sg_free_table(sg);
+	kfree(sg);
+}
+
+static void amdxdna_pbuf_release(struct dma_buf *dbuf)
+{
+	struct amdxdna_pbuf_priv *pbuf = dbuf->priv;
+	unsigned long i;
+
+	/* Pages are dirty now, refill brings fresh ones into pool */
+	for (i = 0; i < pbuf->nr_pages; i++)
+		__free_page(pbuf->pages[i]);
+	kvfree(pbuf->pages);
+	kfree(pbuf);
+}
+
+static vm_fault_t amdxdna_pbuf_vm_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct amdxdna_pbuf_priv *pbuf;
+	pgoff_t pgoff;
+
+	pbuf = vma->vm_private_data;
+	pgoff = (vmf->address - vma->vm_start) >> PAGE_SHIFT;
+	if (pgoff >= pbuf->nr_pages)
+		return VM_FAULT_SIGBUS;
+
+	return vmf_insert_pfn(vma, vmf->address, page_to_pfn(pbuf->pages[pgoff]));
+}
+
+static const struct vm_operations_struct amdxdna_pbuf_vm_ops = {
+	.fault = amdxdna_pbuf_vm_fault,
+};
+
+static int amdxdna_pbuf_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma)
+{
+	struct amdxdna_pbuf_priv *pbuf = dbuf->priv;
+
+	vma->vm_ops = &amdxdna_pbuf_vm_ops;
+	vma->vm_private_data = pbuf;
+	vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP);
+
+	return 0;
+}
+
+static int amdxdna_pbuf_vmap(struct dma_buf *dbuf, struct iosys_map *map)
+{
+	struct amdxdna_pbuf_priv *pbuf = dbuf->priv;
+	void *kva;
+
+	kva = vmap(pbuf->pages, pbuf->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!kva)
+		return -EINVAL;
+
+	iosys_map_set_vaddr(map, kva);
+	return 0;
+}
+
+static void amdxdna_pbuf_vunmap(struct dma_buf *dbuf, struct iosys_map *map)
+{
+	vunmap(map->vaddr);
+}
+
+static const struct dma_buf_ops amdxdna_pbuf_dmabuf_ops = {
+	.map_dma_buf = amdxdna_pbuf_map,
+	.unmap_dma_buf = amdxdna_pbuf_unmap,
+	.release = amdxdna_pbuf_release,
+	.mmap = amdxdna_pbuf_mmap,
+	.vmap = amdxdna_pbuf_vmap,
+	.vunmap = amdxdna_pbuf_vunmap,
+};
+
+/*
+ * Returns -ENOMEM right away if pool does not have enough pages, caller is
+ * expected to fall back to shmem then.
+ */
+struct dma_buf *amdxdna_get_pool_buf(struct drm_device *dev, size_t size)
+{
+	struct amdxdna_pbuf_priv *pbuf;
+	struct dma_buf *dbuf;
+	int ret;
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+
+	pbuf = kzalloc(sizeof(*pbuf), GFP_KERNEL);
+	if (!pbuf)
+		return ERR_PTR(-ENOMEM);
+
+	size = PAGE_ALIGN(size);
+	pbuf->nr_pages = size >> PAGE_SHIFT;
+	pbuf->pages = kvmalloc_array(pbuf->nr_pages, sizeof(*pbuf->pages), GFP_KERNEL);
+	if (!pbuf->pages) {
+		ret = -ENOMEM;
+		goto free_pbuf;
+	}
+
+	ret = amdxdna_page_pool_get(pbuf->pages, pbuf->nr_pages);
+	if (ret)
+		goto free_pages;
+
+	exp_info.size = size;
+	exp_info.ops = &amdxdna_pbuf_dmabuf_ops;
+	exp_info.priv = pbuf;
+	exp_info.flags = O_RDWR;
+
+	dbuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dbuf)) {
+		ret = PTR_ERR(dbuf);
+		goto put_pages;
+	}
+
+	return dbuf;
+
+put_pages:
+	while (pbuf->nr_pages)
+		__free_page(pbuf->pages[--pbuf->nr_pages]);
+free_pages:
+	kvfree(pbuf->pages);
+free_pbuf:
+	kfree(pbuf);
+	return ERR_PTR(ret);
+}
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+#ifndef _AMDXDNA_PAGE_POOL_H_
+#define _AMDXDNA_PAGE_POOL_H_
+
+#include <drm/drm_device.h>
+
+bool amdxdna_use_page_pool(void);
+int amdxdna_page_pool_init(void);
+void amdxdna_page_pool_fini(void);
+struct dma_buf *amdxdna_get_pool_buf(struct drm_device *dev, size_t size);
+
+#endif
@@ -4,6 +4,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/rculist.h>
 #include <linux/version.h>
 #include <drm/drm_managed.h>
 
@@ -11,6 +12,8 @@
 #include "amdxdna_pci_drv.h"
 #include "amdxdna_sysfs.h"
 #include "amdxdna_pm.h"
+#include "amdxdna_page_pool.h"
+#include "amdxdna_mem_notify.h"
 #ifdef AMDXDNA_DEVEL
 #include "amdxdna_devel.h"
 #include "amdxdna_carvedout_buf.h"
@@ -90,6 +93,7 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	drmm_mutex_init(&xdna->ddev, &xdna->dev_lock);
 	init_rwsem(&xdna->notifier_lock);
+	seqlock_init(&xdna->stats.lock);
 	INIT_LIST_HEAD(&xdna->client_list);
 	pci_set_drvdata(pdev, xdna);
 
@@ -102,6 +106,10 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	if (!xdna->dev_info->ops->init || !xdna->dev_info->ops->fini)
 		return -EOPNOTSUPP;
 
+	ret = amdxdna_gem_free_wq_init(xdna);
+	if (ret)
+		return ret;
+
 	xdna->notifier_wq = alloc_ordered_workqueue("notifier_wq", WQ_MEM_RECLAIM);
 	if (!xdna->notifier_wq)
 		return -ENOMEM;
@@ -121,6 +129,8 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	if (xdna->dev_info->ops->tdr_start)
 		xdna->dev_info->ops->tdr_start(xdna);
 
+	amdxdna_gem_huge_mnt_init(xdna);
+
 	ret = drm_dev_register(&xdna->ddev, 0);
 	if (ret) {
 		XDNA_ERR(xdna, "DRM register failed, ret %d", ret);
@@ -141,6 +151,7 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	return 0;
 
 failed_tdr_fini:
+	amdxdna_gem_huge_mnt_fini(xdna);
 	if (xdna->dev_info->ops->tdr_stop)
 		xdna->dev_info->ops->tdr_stop(xdna);
 	amdxdna_sysfs_fini(xdna);
@@ -157,6 +168,8 @@ static void amdxdna_remove(struct pci_dev *pdev)
 	struct amdxdna_client *client;
 
 	amdxdna_dpt_fini(xdna);
+	/* Queued BO release flushes notifier_wq */
+	flush_workqueue(xdna->bo_free_wq);
 	destroy_workqueue(xdna->notifier_wq);
 	if (xdna->dev_info->ops->tdr_stop)
 		xdna->dev_info->ops->tdr_stop(xdna);
@@ -171,7 +184,8 @@ static void amdxdna_remove(struct pci_dev *pdev)
 	client = list_first_entry_or_null(&xdna->client_list,
 					  struct amdxdna_client, node);
 	while (client) {
-		list_del_init(&client->node);
+		list_del_rcu(&client->node);
+		client->listed = false;
 		mutex_unlock(&xdna->dev_lock);
 
 		amdxdna_ctx_remove_all(client);
@@ -183,6 +197,7 @@ static void amdxdna_remove(struct pci_dev *pdev)
 	mutex_unlock(&xdna->dev_lock);
 
 	xdna->dev_info->ops->fini(xdna);
+	amdxdna_gem_huge_mnt_fini(xdna);
 #ifdef AMDXDNA_DEVEL
 	ida_destroy(&xdna->pdi_ida);
 #endif
@@ -235,19 +250,50 @@ static struct pci_driver amdxdna_pci_driver = {
 	.probe = amdxdna_probe,
 	.remove = amdxdna_remove,
 	.driver.pm = &amdxdna_pm_ops,
+	/* Firmware bring-up of several NPUs does not serialize module load */
+	.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	.err_handler = &amdxdna_err_handler,
 };
 
 static int __init amdxdna_mod_init(void)
 {
+	int ret;
+
+	ret = amdxdna_job_cache_init();
+	if (ret)
+		return ret;
+
+	ret = amdxdna_page_pool_init();
+	if (ret)
+		goto fini_job_cache;
+
+	ret = amdxdna_mem_notify_init();
+	if (ret)
+		goto fini_page_pool;
+
 	amdxdna_carvedout_init();
-	return pci_register_driver(&amdxdna_pci_driver);
+	ret = pci_register_driver(&amdxdna_pci_driver);
+	if (ret)
+		goto fini_carvedout;
+	return 0;
+
+fini_carvedout:
+	amdxdna_carvedout_fini();
+	amdxdna_mem_notify_fini();
+fini_page_pool:
+	amdxdna_page_pool_fini();
+fini_job_cache:
+	amdxdna_job_cache_fini();
+	return ret;
 }
 
 static void __exit amdxdna_mod_exit(void)
 {
 	pci_unregister_driver(&amdxdna_pci_driver);
 	amdxdna_carvedout_fini();
+	amdxdna_mem_notify_fini();
+	amdxdna_page_pool_fini();
+	amdxdna_job_cache_fini();
 }
 
 module_init(amdxdna_mod_init);
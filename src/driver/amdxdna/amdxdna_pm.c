@@ -3,7 +3,9 @@
  * Copyright (C) 2025, Advanced Micro Devices, Inc.
  */
 
+#include <linux/math64.h>
 #include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
 
 #include "amdxdna_drm.h"
 #include "amdxdna_pm.h"
@@ -12,6 +14,18 @@ int autosuspend_ms = 5000;
 module_param(autosuspend_ms, int, 0644);
 MODULE_PARM_DESC(autosuspend_ms, "runtime suspend delay in milliseconds. < 0: prevent it");
 
+static bool autosuspend_adaptive;
+module_param(autosuspend_adaptive, bool, 0644);
+MODULE_PARM_DESC(autosuspend_adaptive, "Learn runtime suspend delay from request gaps (Default false)");
+
+static uint autosuspend_min_ms = 100;
+module_param(autosuspend_min_ms, uint, 0644);
+MODULE_PARM_DESC(autosuspend_min_ms, "Minimum adaptive runtime suspend delay in ms, default 100");
+
+static uint autosuspend_max_ms = 30000;
+module_param(autosuspend_max_ms, uint, 0644);
+MODULE_PARM_DESC(autosuspend_max_ms, "Maximum adaptive runtime suspend delay in ms, default 30000");
+
 static int amdxdna_pmops_suspend(struct device *dev)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(dev_get_drvdata(dev));
@@ -38,32 +52,130 @@ static int amdxdna_pmops_resume(struct device *dev)
 	return ret;
 }
 
+/*
+ * Stay awake across the longest recent gap that was short enough to be part of
+ * a burst, plus a quarter as margin. Gaps above autosuspend_max_ms are treated
+ * as real idle periods and do not stretch the delay.
+ */
+static int amdxdna_rpm_calc_delay(struct amdxdna_rpm *rpm)
+{
+	u32 max_ms = READ_ONCE(autosuspend_max_ms);
+	u32 min_ms = min(READ_ONCE(autosuspend_min_ms), max_ms);
+	u32 gap_ms = 0;
+	int i;
+
+	for (i = 0; i < AMDXDNA_RPM_GAP_HIST; i++) {
+		if (rpm->gaps_ms[i] <= max_ms)
+			gap_ms = max(gap_ms, rpm->gaps_ms[i]);
+	}
+
+	return clamp(gap_ms + gap_ms / 4, min_ms, max_ms);
+}
+
+/* Called for requests that found the device idle */
+static void amdxdna_rpm_learn(struct amdxdna_dev *xdna, bool resumed, ktime_t start, ktime_t end)
+{
+	struct amdxdna_rpm *rpm = &xdna->rpm;
+	struct device *dev = xdna->ddev.dev;
+	int delay_ms = -1;
+	u64 wait_ns;
+
+	spin_lock(&rpm->lock);
+	if (resumed) {
+		wait_ns = ktime_to_ns(ktime_sub(end, start));
+		rpm->resume_cnt++;
+		rpm->resume_ns += wait_ns;
+		rpm->resume_max_ns = max(rpm->resume_max_ns, wait_ns);
+	}
+
+	if (rpm->last_put) {
+		rpm->gaps_ms[rpm->gap_idx] = min_t(s64, ktime_ms_delta(start, rpm->last_put),
+						   U32_MAX);
+		rpm->gap_idx = (rpm->gap_idx + 1) % AMDXDNA_RPM_GAP_HIST;
+
+		if (READ_ONCE(autosuspend_adaptive) && READ_ONCE(autosuspend_ms) >= 0) {
+			delay_ms = amdxdna_rpm_calc_delay(rpm);
+			if (delay_ms == rpm->delay_ms)
+				delay_ms = -1;
+			else
+				rpm->delay_ms = delay_ms;
+		}
+	}
+	spin_unlock(&rpm->lock);
+
+	if (delay_ms >= 0) {
+		XDNA_DBG(xdna, "Autosuspend delay adjusted to %d ms", delay_ms);
+		pm_runtime_set_autosuspend_delay(dev, delay_ms);
+	}
+}
+
 int amdxdna_pm_resume_get(struct amdxdna_dev *xdna)
 {
 	struct device *dev = xdna->ddev.dev;
+	bool idle, resumed;
+	ktime_t start;
 	int ret;
 
+	/* Sampled without the PM lock, only feeds statistics and the delay estimate */
+	idle = !atomic_read(&dev->power.usage_count);
+	resumed = pm_runtime_suspended(dev);
+	start = ktime_get();
+
 	ret = pm_runtime_resume_and_get(dev);
 	if (ret) {
 		XDNA_ERR(xdna, "Resume failed: %d", ret);
 		pm_runtime_set_suspended(dev);
+		return ret;
 	}
 
-	return ret;
+	if (idle)
+		amdxdna_rpm_learn(xdna, resumed, start, ktime_get());
+
+	return 0;
+}
+
+/* Take a reference only if device is resumed and in use, never wakes it up */
+bool amdxdna_pm_get_if_active(struct amdxdna_dev *xdna)
+{
+	return pm_runtime_get_if_in_use(xdna->ddev.dev) > 0;
 }
 
 void amdxdna_pm_suspend_put(struct amdxdna_dev *xdna)
 {
 	struct device *dev = xdna->ddev.dev;
 
+	WRITE_ONCE(xdna->rpm.last_put, ktime_get());
 	pm_runtime_mark_last_busy(dev);
 	pm_runtime_put_autosuspend(dev);
 }
 
+void amdxdna_pm_rpm_show(struct amdxdna_dev *xdna, struct seq_file *m)
+{
+	struct amdxdna_rpm *rpm = &xdna->rpm;
+	u64 cnt, total_ns, max_ns;
+	int delay_ms;
+
+	spin_lock(&rpm->lock);
+	delay_ms = rpm->delay_ms;
+	cnt = rpm->resume_cnt;
+	total_ns = rpm->resume_ns;
+	max_ns = rpm->resume_max_ns;
+	spin_unlock(&rpm->lock);
+
+	seq_printf(m, "adaptive %s\n", READ_ONCE(autosuspend_adaptive) ? "on" : "off");
+	seq_printf(m, "delay_ms %d\n", delay_ms);
+	seq_printf(m, "resume_hits %llu\n", cnt);
+	seq_printf(m, "resume_avg_us %llu\n", cnt ? div64_u64(total_ns, cnt) / NSEC_PER_USEC : 0);
+	seq_printf(m, "resume_max_us %llu\n", max_ns / NSEC_PER_USEC);
+}
+
 void amdxdna_rpm_init(struct amdxdna_dev *xdna)
 {
 	struct device *dev = xdna->ddev.dev;
 
+	spin_lock_init(&xdna->rpm.lock);
+	xdna->rpm.delay_ms = autosuspend_ms;
+
 	pm_runtime_set_active(dev);
 	pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
 	pm_runtime_use_autosuspend(dev);
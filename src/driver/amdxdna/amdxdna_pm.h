@@ -9,10 +9,14 @@
 #include <linux/pm_runtime.h>
 #include "amdxdna_drm.h"
 
+struct seq_file;
+
 extern const struct dev_pm_ops amdxdna_pm_ops;
 
 int amdxdna_pm_resume_get(struct amdxdna_dev *xdna);
+bool amdxdna_pm_get_if_active(struct amdxdna_dev *xdna);
 void amdxdna_pm_suspend_put(struct amdxdna_dev *xdna);
+void amdxdna_pm_rpm_show(struct amdxdna_dev *xdna, struct seq_file *m);
 void amdxdna_rpm_init(struct amdxdna_dev *xdna);
 void amdxdna_rpm_fini(struct amdxdna_dev *xdna);
 
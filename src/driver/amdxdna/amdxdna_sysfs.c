@@ -31,10 +31,33 @@ static ssize_t fw_version_show(struct device *dev, struct device_attribute *attr
 }
 static DEVICE_ATTR_RO(fw_version);
 
+static ssize_t cma_regions_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct amdxdna_dev *xdna = dev_get_drvdata(dev);
+	struct amdxdna_cma_region *region;
+	int len = 0;
+	int i;
+
+	for (i = 0; i < MAX_MEM_REGIONS; i++) {
+		region = &xdna->cma_regions[i];
+		if (!region->dev)
+			continue;
+		len += sysfs_emit_at(buf, len,
+				     "%d node %d size 0x%zx used 0x%llx buffers %lld failed %lld\n",
+				     i, region->nid, region->size,
+				     atomic64_read(&region->used),
+				     atomic64_read(&region->buf_cnt),
+				     atomic64_read(&region->fail_cnt));
+	}
+	return len;
+}
+static DEVICE_ATTR_RO(cma_regions);
+
 static struct attribute *amdxdna_attrs[] = {
 	&dev_attr_device_type.attr,
 	&dev_attr_vbnv.attr,
 	&dev_attr_fw_version.attr,
+	&dev_attr_cma_regions.attr,
 	NULL,
 };
 
@@ -89,6 +89,28 @@ DEFINE_EVENT(xdna_mbox_msg, mbox_set_head,
 	     TP_ARGS(name, chann_id, opcode, id)
 );
 
+TRACE_EVENT(mbox_msg_latency,
+	    TP_PROTO(char *name, u8 chann_id, u32 opcode, u32 msg_id, u64 elapsed_ns),
+
+	    TP_ARGS(name, chann_id, opcode, msg_id, elapsed_ns),
+
+	    TP_STRUCT__entry(__string(name, name)
+			     __field(u32, chann_id)
+			     __field(u32, opcode)
+			     __field(u32, msg_id)
+			     __field(u64, elapsed_ns)),
+
+	    TP_fast_assign(__assign_str(name);
+			   __entry->chann_id = chann_id;
+			   __entry->opcode = opcode;
+			   __entry->msg_id = msg_id;
+			   __entry->elapsed_ns = elapsed_ns;),
+
+	    TP_printk("%s.%d id 0x%x opcode 0x%x elapsed %lld ns", __get_str(name),
+		      __entry->chann_id, __entry->msg_id, __entry->opcode,
+		      __entry->elapsed_ns)
+);
+
 DECLARE_EVENT_CLASS(xdna_mbox_name_id,
 		    TP_PROTO(char *name, int irq),
 
@@ -128,6 +150,99 @@ DEFINE_EVENT(xdna_mbox_name_id, mbox_poll_handle,
 	     TP_ARGS(name, irq)
 );
 
+/*
+ * Runqueue scheduling decisions. Partition is [start_col, end_col], -1 if
+ * context has none. elapsed_ns is time taken by the step, e.g. connect, or
+ * since the event it follows, e.g. idle time before eviction, 0 if none.
+ */
+DECLARE_EVENT_CLASS(xdna_rq_ctx,
+		    TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+			     int end_col, const char *reason, u64 elapsed_ns),
+
+		    TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns),
+
+		    TP_STRUCT__entry(__string(name, name)
+				     __field(u32, ctx_id)
+				     __field(int, prio)
+				     __field(int, start_col)
+				     __field(int, end_col)
+				     __string(reason, reason)
+				     __field(u64, elapsed_ns)),
+
+		    TP_fast_assign(__assign_str(name);
+				   __entry->ctx_id = ctx_id;
+				   __entry->prio = prio;
+				   __entry->start_col = start_col;
+				   __entry->end_col = end_col;
+				   __assign_str(reason);
+				   __entry->elapsed_ns = elapsed_ns;),
+
+		    TP_printk("%s id %u prio %d [%d, %d] %s elapsed %llu ns",
+			      __get_str(name), __entry->ctx_id, __entry->prio,
+			      __entry->start_col, __entry->end_col,
+			      __get_str(reason), __entry->elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_dispatch,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_connect,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_block,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_evict,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_yield,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+DEFINE_EVENT(xdna_rq_ctx, rq_ctx_disconnect,
+	     TP_PROTO(const char *name, u32 ctx_id, int prio, int start_col,
+		      int end_col, const char *reason, u64 elapsed_ns),
+	     TP_ARGS(name, ctx_id, prio, start_col, end_col, reason, elapsed_ns)
+);
+
+/* Partition reconfiguration decision, and its duration once resized */
+TRACE_EVENT(rq_parts_reconf,
+	    TP_PROTO(const char *decision, u32 cur_cols, u32 new_cols, u32 num_parts,
+		     u64 elapsed_ns),
+
+	    TP_ARGS(decision, cur_cols, new_cols, num_parts, elapsed_ns),
+
+	    TP_STRUCT__entry(__string(decision, decision)
+			     __field(u32, cur_cols)
+			     __field(u32, new_cols)
+			     __field(u32, num_parts)
+			     __field(u64, elapsed_ns)),
+
+	    TP_fast_assign(__assign_str(decision);
+			   __entry->cur_cols = cur_cols;
+			   __entry->new_cols = new_cols;
+			   __entry->num_parts = num_parts;
+			   __entry->elapsed_ns = elapsed_ns;),
+
+	    TP_printk("%s cols %u -> %u, %u partitions, elapsed %llu ns",
+		      __get_str(decision), __entry->cur_cols, __entry->new_cols,
+		      __entry->num_parts, __entry->elapsed_ns)
+);
+
 #endif /* !defined(_AMDXDNA_TRACE_EVENTS_H_) || defined(TRACE_HEADER_MULTI_READ) */
 
 /* This part must be outside protection */
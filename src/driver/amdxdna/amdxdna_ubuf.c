@@ -4,6 +4,7 @@
  */
 
 #include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
 #include <linux/pagemap.h>
 #include <linux/vmalloc.h>
 
@@ -21,6 +22,7 @@ static struct sg_table *amdxdna_ubuf_map(struct dma_buf_attachment *attach,
 					 enum dma_data_direction direction)
 {
 	struct amdxdna_ubuf_priv *ubuf = attach->dmabuf->priv;
+	unsigned int max_segment;
 	struct sg_table *sg;
 	int ret;
 
@@ -28,16 +30,29 @@ static struct sg_table *amdxdna_ubuf_map(struct dma_buf_attachment *attach,
 	if (!sg)
 		return ERR_PTR(-ENOMEM);
 
-	ret = sg_alloc_table_from_pages(sg, ubuf->pages, ubuf->nr_pages, 0,
-					ubuf->nr_pages << PAGE_SHIFT, GFP_KERNEL);
+	/*
+	 * Merge physically contiguous pages, e.g. huge pages, into segments as
+	 * large as device DMA allows, fewer entries to map.
+	 */
+	max_segment = min_t(size_t, UINT_MAX, dma_max_mapping_size(attach->dev));
+	max_segment = round_down(max_segment, PAGE_SIZE);
+	ret = sg_alloc_table_from_pages_segment(sg, ubuf->pages, ubuf->nr_pages, 0,
+						ubuf->nr_pages << PAGE_SHIFT,
+						max_segment, GFP_KERNEL);
 	if (ret)
-		return ERR_PTR(ret);
+		goto free_sg;
 
 	ret = dma_map_sgtable(attach->dev, sg, direction, 0);
 	if (ret)
-		return ERR_PTR(ret);
+		goto free_table;
 
 	return sg;
+
+free_table:
+	sg_free_table(sg);
+free_sg:
+	kfree(sg);
+	return ERR_PTR(ret);
 }
 
 static void amdxdna_ubuf_unmap(struct dma_buf_attachment *attach,
@@ -3,6 +3,9 @@
  * Copyright (C) 2025, Advanced Micro Devices, Inc.
  */
 #include <linux/device.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/sizes.h>
 #include <linux/version.h>
 #include <linux/vmalloc.h>
 
@@ -11,6 +14,20 @@
 #include "ve2_mgmt.h"
 #include "ve2_res_solver.h"
 
+/* Upper bound of data buffer of one batched AIE read */
+#define VE2_AIE_READ_BATCH_MAX_SIZE	SZ_4M
+#define VE2_COREDUMP_CHUNK_MAX_SIZE	SZ_4M
+
+struct ve2_counter_sampler {
+	struct amdxdna_ctx		*hwctx;
+	struct amdxdna_gem_obj		*abo;
+	struct amdxdna_aie_counter_ring	*ring;
+	struct amdxdna_drm_aie_counter	*counters;
+	u32				num_counters;
+	u32				period_us;
+	struct task_struct		*thread;
+};
+
 static int ve2_query_ctx_status_array(struct amdxdna_client *client,
 				      struct amdxdna_drm_hwctx_entry *tmp,
 				      pid_t pid, u32 ctx_id)
@@ -64,6 +81,10 @@ static int ve2_query_ctx_status_array(struct amdxdna_client *client,
 			tmp[hw_i].heap_usage = total_bo_usage;
 			tmp[hw_i].suspensions = 0;
 			tmp[hw_i].state = ctx->priv->state;
+			tmp[hw_i].poll_hits = atomic64_read(&ctx->priv->poll_hits);
+			tmp[hw_i].poll_misses = atomic64_read(&ctx->priv->poll_misses);
+			tmp[hw_i].queue_full = READ_ONCE(ctx->priv->hwctx_hsa_queue.full_cnt);
+			tmp[hw_i].queue_depth = READ_ONCE(ctx->priv->hwctx_hsa_queue.capacity);
 
 			hw_i++;
 		}
@@ -143,6 +164,45 @@ exit:
 	return ret;
 }
 
+static int ve2_get_array_partition_stats(struct amdxdna_client *client,
+					 struct amdxdna_drm_get_array *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_dev_hdl *xdna_hdl = xdna->dev_handle;
+	struct amdxdna_partition_stats *tmp;
+	u32 cols = xdna_hdl->aie_dev_info.cols;
+	u32 num = 0;
+	int ret;
+
+	tmp = kcalloc(cols, sizeof(*tmp), GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	for (u32 col = 0; col < cols && num < args->num_element; col++) {
+		struct amdxdna_mgmtctx *mgmtctx = &xdna_hdl->ve2_mgmtctx[col];
+
+		/* Never had a partition created */
+		if (!mgmtctx->xdna)
+			continue;
+
+		mutex_lock(&mgmtctx->ctx_lock);
+		if (mgmtctx->mgmtctx_workq) {
+			tmp[num].start_col = mgmtctx->start_col;
+			tmp[num].num_col = mgmtctx->num_col;
+			tmp[num].ctx_switches = mgmtctx->ctx_switches;
+			tmp[num].ctx_switch_total_ns = mgmtctx->ctx_switch_total_ns;
+			tmp[num].ctx_switch_max_ns = mgmtctx->ctx_switch_max_ns;
+			tmp[num].sched_runs = mgmtctx->sched_runs;
+			num++;
+		}
+		mutex_unlock(&mgmtctx->ctx_lock);
+	}
+
+	ret = amdxdna_drm_copy_array_to_user(args, tmp, sizeof(*tmp), num);
+	kfree(tmp);
+	return ret;
+}
+
 static int ve2_aie_write(struct amdxdna_client *client,
 			 struct amdxdna_drm_set_state *args)
 {
@@ -323,6 +383,115 @@ static int ve2_aie_read(struct amdxdna_client *client, struct amdxdna_drm_get_ar
 	return 0;
 }
 
+static struct amdxdna_ctx *ve2_find_hwctx(struct amdxdna_dev *xdna, u64 pid, u32 ctx_id)
+{
+	struct amdxdna_client *tmp_client;
+	struct amdxdna_ctx *hwctx = NULL;
+	unsigned long hwctx_id;
+	int idx;
+
+	list_for_each_entry(tmp_client, &xdna->client_list, node) {
+		idx = srcu_read_lock(&tmp_client->ctx_srcu);
+		struct amdxdna_ctx *hw_ctx;
+
+		amdxdna_for_each_ctx(tmp_client, hwctx_id, hw_ctx) {
+			if (ctx_id == hwctx_id && pid == hw_ctx->client->pid)
+				hwctx = hw_ctx;
+		}
+		srcu_read_unlock(&tmp_client->ctx_srcu, idx);
+	}
+
+	return hwctx;
+}
+
+/*
+ * Read all ranges into one kernel buffer and copy it to user once. Ranges are
+ * read straight through the AIE partition, there is no firmware round trip.
+ */
+static int ve2_aie_read_batch(struct amdxdna_client *client, struct amdxdna_drm_get_array *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_drm_aie_tile_range *ranges;
+	struct amdxdna_drm_aie_tile_batch batch;
+	struct amdxdna_ctx *hwctx;
+	struct device *aie_dev;
+	void *data;
+	int ret;
+
+	if (args->element_size < sizeof(batch) || args->num_element != 1)
+		return -EINVAL;
+
+	if (copy_from_user(&batch, u64_to_user_ptr(args->buffer), sizeof(batch))) {
+		XDNA_ERR(xdna, "Failed to copy batch request from user");
+		return -EFAULT;
+	}
+
+	if (!batch.num_ranges || batch.num_ranges > AMDXDNA_MAX_NUM_ELEMENT ||
+	    !batch.data_size || batch.data_size > VE2_AIE_READ_BATCH_MAX_SIZE) {
+		XDNA_ERR(xdna, "Invalid batch, %u ranges, %u bytes",
+			 batch.num_ranges, batch.data_size);
+		return -EINVAL;
+	}
+
+	hwctx = ve2_find_hwctx(xdna, batch.pid, batch.context_id);
+	if (!hwctx) {
+		XDNA_ERR(xdna, "hw context :%u pid:%llu not found\n", batch.context_id,
+			 batch.pid);
+		return -EINVAL;
+	}
+
+	aie_dev = hwctx->priv->aie_dev;
+	if (!aie_dev) {
+		XDNA_ERR(xdna, "AIE device handle not found\n");
+		return -EINVAL;
+	}
+
+	/* num_ranges is bounded above, size can't overflow */
+	ranges = memdup_user(u64_to_user_ptr(batch.ranges_p), batch.num_ranges * sizeof(*ranges));
+	if (IS_ERR(ranges))
+		return PTR_ERR(ranges);
+
+	for (u32 i = 0; i < batch.num_ranges; i++) {
+		struct amdxdna_drm_aie_tile_range *r = &ranges[i];
+
+		if (r->col >= hwctx->num_col || r->row >= xdna->dev_handle->aie_dev_info.rows ||
+		    !r->size || r->data_offset > batch.data_size ||
+		    r->size > batch.data_size - r->data_offset) {
+			XDNA_ERR(xdna, "Invalid range %u, col %u row %u size %u offset %u",
+				 i, r->col, r->row, r->size, r->data_offset);
+			ret = -EINVAL;
+			goto free_ranges;
+		}
+	}
+
+	data = kvzalloc(batch.data_size, GFP_KERNEL);
+	if (!data) {
+		ret = -ENOMEM;
+		goto free_ranges;
+	}
+
+	for (u32 i = 0; i < batch.num_ranges; i++) {
+		struct amdxdna_drm_aie_tile_range *r = &ranges[i];
+
+		ret = ve2_partition_read(aie_dev, r->col, r->row, r->addr, r->size,
+					 data + r->data_offset);
+		if (ret < 0) {
+			XDNA_ERR(xdna, "Read range %u failed, err: %d", i, ret);
+			goto free_data;
+		}
+	}
+
+	ret = 0;
+	if (copy_to_user(u64_to_user_ptr(batch.data_p), data, batch.data_size))
+		ret = -EFAULT;
+
+free_data:
+	kvfree(data);
+free_ranges:
+	kfree(ranges);
+	return ret;
+}
+
 static int ve2_coredump_read(struct amdxdna_client *client, struct amdxdna_drm_get_array *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -396,6 +565,105 @@ static int ve2_coredump_read(struct amdxdna_client *client, struct amdxdna_drm_g
 	return 0;
 }
 
+/*
+ * Coredump of selected tiles, one chunk per call. Tiles are read straight
+ * through the AIE partition, bounced through a buffer of at most one tile.
+ */
+static int ve2_coredump_read_chunk(struct amdxdna_client *client,
+				   struct amdxdna_drm_get_array *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_drm_aie_coredump_chunk chunk;
+	struct amdxdna_mgmtctx *mgmtctx;
+	struct amdxdna_ctx *hwctx;
+	u32 rows, num_col, num_row;
+	struct device *aie_dev;
+	u64 total, pos, end;
+	size_t done = 0;
+	void *bounce;
+	int ret = 0;
+
+	if (args->element_size < sizeof(chunk) || args->num_element != 1)
+		return -EINVAL;
+
+	if (copy_from_user(&chunk, u64_to_user_ptr(args->buffer), sizeof(chunk))) {
+		XDNA_ERR(xdna, "Failed to copy coredump chunk request from user");
+		return -EFAULT;
+	}
+
+	hwctx = ve2_find_hwctx(xdna, chunk.pid, chunk.context_id);
+	if (!hwctx) {
+		XDNA_ERR(xdna, "hw context :%u pid:%llu not found\n", chunk.context_id,
+			 chunk.pid);
+		return -EINVAL;
+	}
+
+	aie_dev = hwctx->priv->aie_dev;
+	if (!aie_dev) {
+		XDNA_ERR(xdna, "AIE device handle not found\n");
+		return -EINVAL;
+	}
+
+	mgmtctx = &xdna->dev_handle->ve2_mgmtctx[hwctx->start_col];
+	if (mgmtctx->active_ctx != hwctx) {
+		XDNA_ERR(xdna, "hwctx %p is not the last scheduled, %p is\n",
+			 hwctx, mgmtctx->active_ctx);
+		return -EINVAL;
+	}
+
+	rows = xdna->dev_handle->aie_dev_info.rows;
+	if (chunk.col >= hwctx->num_col || chunk.row >= rows)
+		return -EINVAL;
+	num_col = chunk.num_col ? chunk.num_col : hwctx->num_col - chunk.col;
+	num_row = chunk.num_row ? chunk.num_row : rows - chunk.row;
+	if (num_col > hwctx->num_col - chunk.col || num_row > rows - chunk.row) {
+		XDNA_ERR(xdna, "Invalid tiles, col %u+%u row %u+%u", chunk.col,
+			 chunk.num_col, chunk.row, chunk.num_row);
+		return -EINVAL;
+	}
+
+	total = (u64)num_col * num_row * TILE_ADDRESS_SPACE;
+	if (chunk.offset > total || chunk.size > VE2_COREDUMP_CHUNK_MAX_SIZE)
+		return -EINVAL;
+
+	end = min(chunk.offset + chunk.size, total);
+	if (end > chunk.offset) {
+		bounce = kvmalloc(min_t(u64, end - chunk.offset, TILE_ADDRESS_SPACE), GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+
+		for (pos = chunk.offset; pos < end; pos += done) {
+			u32 tile = div_u64(pos, TILE_ADDRESS_SPACE);
+			u32 off = pos - (u64)tile * TILE_ADDRESS_SPACE;
+			u32 col = chunk.col + tile / num_row;
+			u32 row = chunk.row + tile % num_row;
+
+			done = min_t(u64, end - pos, TILE_ADDRESS_SPACE - off);
+			ret = ve2_partition_read(aie_dev, col, row, off, done, bounce);
+			if (ret < 0) {
+				XDNA_ERR(xdna, "Read col %u row %u failed, err: %d", col, row, ret);
+				break;
+			}
+			ret = 0;
+			if (copy_to_user(u64_to_user_ptr(chunk.data_p) + (pos - chunk.offset),
+					 bounce, done)) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+		kvfree(bounce);
+		if (ret)
+			return ret;
+	}
+
+	chunk.size = end - chunk.offset;
+	chunk.total_size = total;
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &chunk, sizeof(chunk)))
+		return -EFAULT;
+
+	return 0;
+}
+
 static int ve2_get_firmware_version(struct amdxdna_client *client,
 				    struct amdxdna_drm_get_info *args)
 {
@@ -441,6 +709,192 @@ static int ve2_get_total_col(struct amdxdna_client *client, struct amdxdna_drm_g
 	return ret;
 }
 
+/*
+ * Counters are read straight through the AIE partition, same as batched
+ * reads, so sampling does not go through firmware or the mailbox.
+ */
+static int ve2_counter_sampler_thread(void *data)
+{
+	struct ve2_counter_sampler *s = data;
+	struct amdxdna_aie_counter_ring *ring = s->ring;
+	struct device *aie_dev = s->hwctx->priv->aie_dev;
+	ktime_t next = ktime_get();
+	u64 head = 0;
+
+	while (!kthread_should_stop()) {
+		u64 *entry = (void *)ring->entries + (head % ring->num_entries) * ring->entry_size;
+		u32 *vals = (u32 *)(entry + 1);
+		u32 i;
+
+		*entry = ktime_get_ns();
+		for (i = 0; i < s->num_counters; i++) {
+			struct amdxdna_drm_aie_counter *c = &s->counters[i];
+
+			if (ve2_partition_read(aie_dev, c->col, c->row, c->addr,
+					       sizeof(u32), &vals[i]) < 0)
+				break;
+		}
+		if (i == s->num_counters) {
+			/* Entry must be visible before head moves past it */
+			smp_wmb();
+			WRITE_ONCE(ring->head, ++head);
+		} else {
+			WRITE_ONCE(ring->dropped, ring->dropped + 1);
+		}
+
+		/* Keep the cadence, but don't catch up on missed periods */
+		next = ktime_add_us(next, s->period_us);
+		if (ktime_before(next, ktime_get()))
+			next = ktime_get();
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_hrtimeout_range(&next, s->period_us * NSEC_PER_USEC / 8,
+						 HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static void ve2_counter_sampler_free(struct ve2_counter_sampler *s)
+{
+	if (!s)
+		return;
+
+	kthread_stop(s->thread);
+	amdxdna_gem_put_obj(s->abo);
+	kfree(s->counters);
+	kfree(s);
+}
+
+void ve2_counter_sampling_stop(struct amdxdna_ctx *hwctx)
+{
+	struct ve2_counter_sampler *s;
+
+	mutex_lock(&hwctx->priv->privctx_lock);
+	s = hwctx->priv->sampler;
+	hwctx->priv->sampler = NULL;
+	mutex_unlock(&hwctx->priv->privctx_lock);
+
+	ve2_counter_sampler_free(s);
+}
+
+static int ve2_counter_sampling_start(struct amdxdna_client *client, struct amdxdna_ctx *hwctx,
+				      struct amdxdna_drm_aie_counter_sampling *cfg)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_aie_counter_ring *ring;
+	struct ve2_counter_sampler *s, *old;
+	u32 entry_size, i;
+	int ret;
+
+	if (!cfg->num_counters || cfg->num_counters > AMDXDNA_AIE_COUNTER_MAX ||
+	    cfg->period_us < AMDXDNA_AIE_COUNTER_MIN_PERIOD_US) {
+		XDNA_ERR(xdna, "Invalid sampling, %u counters every %u us",
+			 cfg->num_counters, cfg->period_us);
+		return -EINVAL;
+	}
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+	s->hwctx = hwctx;
+	s->num_counters = cfg->num_counters;
+	s->period_us = cfg->period_us;
+
+	s->counters = memdup_user(u64_to_user_ptr(cfg->counters_p),
+				  cfg->num_counters * sizeof(*s->counters));
+	if (IS_ERR(s->counters)) {
+		ret = PTR_ERR(s->counters);
+		s->counters = NULL;
+		goto free_sampler;
+	}
+	for (i = 0; i < s->num_counters; i++) {
+		struct amdxdna_drm_aie_counter *c = &s->counters[i];
+
+		if (c->col >= hwctx->num_col || c->row >= xdna->dev_handle->aie_dev_info.rows) {
+			XDNA_ERR(xdna, "Invalid counter %u, col %u row %u", i, c->col, c->row);
+			ret = -EINVAL;
+			goto free_sampler;
+		}
+	}
+
+	s->abo = amdxdna_gem_get_obj(client, cfg->bo_handle, AMDXDNA_BO_INVALID);
+	if (!s->abo) {
+		XDNA_ERR(xdna, "Get sample bo %d failed", cfg->bo_handle);
+		ret = -EINVAL;
+		goto free_sampler;
+	}
+
+	ring = amdxdna_gem_vmap(s->abo);
+	entry_size = round_up(sizeof(u64) + s->num_counters * sizeof(u32), sizeof(u64));
+	if (!ring || s->abo->mem.size < sizeof(*ring) + entry_size) {
+		XDNA_ERR(xdna, "Sample bo %d can't be mapped or is too small", cfg->bo_handle);
+		ret = -EINVAL;
+		goto put_bo;
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->num_counters = s->num_counters;
+	ring->entry_size = entry_size;
+	ring->num_entries = (s->abo->mem.size - sizeof(*ring)) / entry_size;
+	s->ring = ring;
+
+	s->thread = kthread_run(ve2_counter_sampler_thread, s, "ve2_sample%u", hwctx->id);
+	if (IS_ERR(s->thread)) {
+		ret = PTR_ERR(s->thread);
+		goto put_bo;
+	}
+
+	mutex_lock(&hwctx->priv->privctx_lock);
+	old = hwctx->priv->sampler;
+	hwctx->priv->sampler = s;
+	mutex_unlock(&hwctx->priv->privctx_lock);
+	ve2_counter_sampler_free(old);
+
+	XDNA_DBG(xdna, "Sampling %u counters of ctx %u every %u us into %u entries",
+		 s->num_counters, hwctx->id, s->period_us, ring->num_entries);
+	return 0;
+
+put_bo:
+	amdxdna_gem_put_obj(s->abo);
+free_sampler:
+	kfree(s->counters);
+	kfree(s);
+	return ret;
+}
+
+static int ve2_counter_sampling(struct amdxdna_client *client, struct amdxdna_drm_set_state *args)
+{
+	struct amdxdna_drm_aie_counter_sampling cfg;
+	struct amdxdna_ctx *hwctx;
+	int ret, idx;
+
+	if (args->buffer_size != sizeof(cfg))
+		return -EINVAL;
+
+	if (copy_from_user(&cfg, u64_to_user_ptr(args->buffer), sizeof(cfg)))
+		return -EFAULT;
+
+	/* Context can't be destroyed until SRCU read side is left */
+	idx = srcu_read_lock(&client->ctx_srcu);
+	hwctx = xa_load(&client->ctx_xa, cfg.context_id);
+	if (!hwctx) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	if (!cfg.bo_handle) {
+		ve2_counter_sampling_stop(hwctx);
+		ret = 0;
+		goto unlock;
+	}
+	ret = ve2_counter_sampling_start(client, hwctx, &cfg);
+
+unlock:
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	return ret;
+}
+
 int ve2_get_aie_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -485,12 +939,21 @@ int ve2_get_array(struct amdxdna_client *client, struct amdxdna_drm_get_array *a
 	case DRM_AMDXDNA_AIE_COREDUMP:
 		ret = ve2_coredump_read(client, args);
 		break;
+	case DRM_AMDXDNA_AIE_COREDUMP_CHUNK:
+		ret = ve2_coredump_read_chunk(client, args);
+		break;
 	case DRM_AMDXDNA_HW_CONTEXT_ALL:
 		ret = ve2_get_array_hwctx(client, args);
 		break;
 	case DRM_AMDXDNA_AIE_TILE_READ:
 		ret = ve2_aie_read(client, args);
 		break;
+	case DRM_AMDXDNA_AIE_TILE_READ_BATCH:
+		ret = ve2_aie_read_batch(client, args);
+		break;
+	case DRM_AMDXDNA_HW_PARTITION_STATS:
+		ret = ve2_get_array_partition_stats(client, args);
+		break;
 	default:
 		XDNA_ERR(xdna, "Not supported request parameter %u", args->param);
 		ret = -EOPNOTSUPP;
@@ -517,6 +980,9 @@ int ve2_set_aie_state(struct amdxdna_client *client, struct amdxdna_drm_set_stat
 	case DRM_AMDXDNA_AIE_TILE_WRITE:
 		ret = ve2_aie_write(client, args);
 		break;
+	case DRM_AMDXDNA_AIE_COUNTER_SAMPLING:
+		ret = ve2_counter_sampling(client, args);
+		break;
 	default:
 		XDNA_ERR(xdna, "Not supported request parameter %u", args->param);
 		ret = -EOPNOTSUPP;
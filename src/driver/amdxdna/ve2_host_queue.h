@@ -3,7 +3,10 @@
  * Copyright (C) 2025, Advanced Micro Devices, Inc.
  */
 
+/* Default capacity, the one struct hsa_queue is laid out for */
 #define HOST_QUEUE_ENTRY        32
+#define HOST_QUEUE_MIN_ENTRY    8
+#define HOST_QUEUE_MAX_ENTRY    256
 #define HOST_INDIRECT_PKT_NUM   36
 
 #define LAST_CMD (0)
@@ -103,6 +106,21 @@ struct hsa_queue {
 	struct host_queue_indirect_pkt	hq_indirect_pkt[HOST_QUEUE_ENTRY][HOST_INDIRECT_PKT_NUM];
 };
 
+/*
+ * A queue of n slots has the layout of struct hsa_queue, with every array
+ * n entries long, followed by one 64-bit completion state per slot. Firmware
+ * only knows where header and packets are, the rest is addressed through
+ * packets.
+ */
+#define HSA_QUEUE_ENTRY_OFF		offsetof(struct hsa_queue, hq_entry)
+#define HSA_QUEUE_INDIRECT_HDR_OFF(n)	(HSA_QUEUE_ENTRY_OFF + \
+					 (n) * sizeof(struct host_queue_packet))
+#define HSA_QUEUE_INDIRECT_PKT_OFF(n)	(HSA_QUEUE_INDIRECT_HDR_OFF(n) + \
+					 (n) * sizeof(struct host_queue_indirect_hdr))
+#define HSA_QUEUE_COMPLETE_OFF(n)	(HSA_QUEUE_INDIRECT_PKT_OFF(n) + (n) * \
+					 HOST_INDIRECT_PKT_NUM * sizeof(struct host_queue_indirect_pkt))
+#define HSA_QUEUE_SIZE(n)		(HSA_QUEUE_COMPLETE_OFF(n) + (n) * sizeof(u64))
+
 struct ve2_hq_complete {
 	u64	*hqc_mem;
 	u64	hqc_dma_addr;
@@ -113,12 +131,34 @@ struct ve2_mem {
 	u64	dma_addr;
 };
 
+/*
+ * HSA queue memory. It is reference counted, so that a user mode queue
+ * mapping stays valid after its context is destroyed.
+ */
+struct ve2_hsa_queue_buf {
+	struct kref			ref;
+	struct device			*dev;
+	size_t				size;
+	void				*vaddr;
+	dma_addr_t			dma_addr;
+};
+
 struct ve2_hsa_queue {
+	struct ve2_hsa_queue_buf	*buf;
+	/* Replaced by resizing, kept until the next resize or context is gone */
+	struct ve2_hsa_queue_buf	*prev_buf;
 	struct hsa_queue		*hsa_queue_p;
 	struct ve2_mem			hsa_queue_mem;
 	struct ve2_hq_complete		hq_complete;
 	/* hq_lock protects hsa_queue_p->hq_header->[read | write]_index */
 	struct mutex			hq_lock;
+	/* Arrays of a queue of capacity slots, see HSA_QUEUE_SIZE() */
+	u32				capacity;
+	struct host_queue_packet	*hq_entry;
+	struct host_queue_indirect_hdr	*hq_indirect_hdr;
+	struct host_queue_indirect_pkt	(*hq_indirect_pkt)[HOST_INDIRECT_PKT_NUM];
+	/* Submissions refused as all slots were in use, protected by hq_lock */
+	u64				full_cnt;
 };
 
 /* handshake */
@@ -16,6 +16,11 @@ int enable_polling;
 module_param(enable_polling, int, 0644);
 MODULE_PARM_DESC(enable_polling, "Enable polling mode. Polling mode disabled by default.");
 
+static uint poll_max_us = 100;
+module_param(poll_max_us, uint, 0644);
+MODULE_PARM_DESC(poll_max_us,
+		 "Max busy poll before sleeping for command completion in us, default 100; 0 - No poll");
+
 int verbosity;
 module_param(verbosity, int, 0644);
 MODULE_PARM_DESC(verbosity, "[Debug] Enabling verbosity. default is 0");
@@ -36,6 +41,11 @@ int max_col;
 module_param(max_col, int, 0644);
 MODULE_PARM_DESC(max_col, "Max column supported by this driver");
 
+static uint hsa_queue_depth = HOST_QUEUE_ENTRY;
+module_param(hsa_queue_depth, uint, 0644);
+MODULE_PARM_DESC(hsa_queue_depth,
+		 "HSA queue slots of a new context, power of 2 from 8 to 256, default 32");
+
 #define CTX_TIMER	(nsecs_to_jiffies(1))
 
 /*
@@ -92,6 +102,7 @@ static int hsa_queue_reserve_slot(struct amdxdna_dev *xdna, struct amdxdna_ctx_p
 		XDNA_DBG(xdna, "slot %lld", *slot);
 	} else {
 		XDNA_ERR(xdna, "HSQ Queue is full");
+		queue->full_cnt++;
 		mutex_unlock(&queue->hq_lock);
 		return -EIO;
 	}
@@ -100,13 +111,18 @@ static int hsa_queue_reserve_slot(struct amdxdna_dev *xdna, struct amdxdna_ctx_p
 	return 0;
 }
 
+static inline u32 ve2_job_idx(struct amdxdna_ctx_priv *priv, u64 seq)
+{
+	return seq & (priv->hwctx_hsa_queue.capacity - 1);
+}
+
 static void ve2_job_release(struct kref *ref)
 {
 	struct amdxdna_sched_job *job;
 
 	job = container_of(ref, struct amdxdna_sched_job, refcnt);
 	amdxdna_sched_job_cleanup(job);
-	kfree(job);
+	amdxdna_sched_job_free(job);
 }
 
 static void ve2_job_put(struct amdxdna_sched_job *job)
@@ -132,8 +148,9 @@ static inline int ve2_hwctx_add_job(struct amdxdna_ctx *hwctx, struct amdxdna_sc
 	mutex_lock(&hwctx->priv->privctx_lock);
 	hwctx->submitted += cmd_cnt;
 	job->seq = seq;
+	job->submit_time = ktime_get();
 
-	idx = get_job_idx(job->seq);
+	idx = ve2_job_idx(hwctx->priv, job->seq);
 	if (hwctx->priv->pending[idx]) {
 		XDNA_ERR(xdna, "No more room for new command!!!");
 		mutex_unlock(&hwctx->priv->privctx_lock);
@@ -150,7 +167,7 @@ static inline int ve2_hwctx_add_job(struct amdxdna_ctx *hwctx, struct amdxdna_sc
 
 static inline struct amdxdna_sched_job *ve2_hwctx_get_job(struct amdxdna_ctx *hwctx, u64 seq)
 {
-	return hwctx->priv->pending[get_job_idx(seq)];
+	return hwctx->priv->pending[ve2_job_idx(hwctx->priv, seq)];
 }
 
 static inline void ve2_hwctx_job_release(struct amdxdna_ctx *hwctx, struct amdxdna_sched_job *job)
@@ -191,14 +208,14 @@ static inline void ve2_hwctx_job_release(struct amdxdna_ctx *hwctx, struct amdxd
 	}
 
 	// Reset the pending list
-	hwctx->priv->pending[get_job_idx(job->seq)] = NULL;
+	hwctx->priv->pending[ve2_job_idx(hwctx->priv, job->seq)] = NULL;
 	ve2_job_put(job);
 	mutex_unlock(&hwctx->priv->privctx_lock);
 }
 
-static inline struct host_queue_packet *hsa_queue_get_pkt(struct hsa_queue *queue, u64 slot)
+static inline struct host_queue_packet *hsa_queue_get_pkt(struct ve2_hsa_queue *queue, u64 slot)
 {
-	return &queue->hq_entry[slot & (queue->hq_header.capacity - 1)];
+	return &queue->hq_entry[slot & (queue->capacity - 1)];
 }
 
 static inline int hsa_queue_pkt_is_valid(struct host_queue_packet *pkt)
@@ -208,8 +225,8 @@ static inline int hsa_queue_pkt_is_valid(struct host_queue_packet *pkt)
 
 static void *get_host_queue_pkt(struct amdxdna_ctx *hwctx, u64 *seq)
 {
+	struct ve2_hsa_queue *queue = &hwctx->priv->hwctx_hsa_queue;
 	struct amdxdna_dev *xdna = hwctx->client->xdna;
-	struct hsa_queue *queue = NULL;
 	struct host_queue_packet *pkt;
 	int ret;
 
@@ -219,8 +236,7 @@ static void *get_host_queue_pkt(struct amdxdna_ctx *hwctx, u64 *seq)
 		return NULL;
 	}
 
-	queue = (struct hsa_queue *)hwctx->priv->hwctx_hsa_queue.hsa_queue_p;
-	if (!queue) {
+	if (!queue->hsa_queue_p) {
 		XDNA_ERR(xdna, "Invalid Host queue");
 		return NULL;
 	}
@@ -244,24 +260,34 @@ static inline void hsa_queue_pkt_set_invalid(struct host_queue_packet *pkt)
 	pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
 }
 
-static void ve2_free_hsa_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue *queue)
+static void ve2_hsa_queue_buf_release(struct kref *ref)
 {
-	struct platform_device *pdev = to_platform_device(xdna->ddev.dev);
+	struct ve2_hsa_queue_buf *buf = container_of(ref, struct ve2_hsa_queue_buf, ref);
+
+	dma_free_coherent(buf->dev, buf->size, buf->vaddr, buf->dma_addr);
+	kfree(buf);
+}
 
+static void ve2_free_hsa_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue *queue)
+{
+	if (queue->prev_buf) {
+		kref_put(&queue->prev_buf->ref, ve2_hsa_queue_buf_release);
+		queue->prev_buf = NULL;
+	}
 	if (queue->hsa_queue_p) {
-		dma_free_coherent(&pdev->dev,
-				  sizeof(struct hsa_queue) + sizeof(u64) * HOST_QUEUE_ENTRY,
-				  queue->hsa_queue_p,
-				  queue->hsa_queue_mem.dma_addr);
+		kref_put(&queue->buf->ref, ve2_hsa_queue_buf_release);
+		queue->buf = NULL;
 		queue->hsa_queue_p = NULL;
 		queue->hsa_queue_mem.dma_addr = 0;
 		mutex_destroy(&queue->hq_lock);
 	}
 }
 
-void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id)
+void packet_dump(struct amdxdna_dev *xdna, struct ve2_hsa_queue *hq_queue, u64 slot_id)
 {
-	if (slot_id >= HOST_QUEUE_ENTRY) {
+	struct hsa_queue *queue = hq_queue->hsa_queue_p;
+
+	if (slot_id >= hq_queue->capacity) {
 		XDNA_ERR(xdna, "Invalid slot_id: %llu\n", slot_id);
 		return;
 	}
@@ -270,7 +296,7 @@ void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id)
 	XDNA_DBG(xdna, "hsa dma_addr data 0x%llx\n", queue->hq_header.data_address);
 
 	/* Print host_queue_packet */
-	struct host_queue_packet *pkt = &queue->hq_entry[slot_id];
+	struct host_queue_packet *pkt = &hq_queue->hq_entry[slot_id];
 
 	XDNA_DBG(xdna, "Packet Dump for slot_id %llu:\n", slot_id);
 	XDNA_DBG(xdna, "xrt_header.common_header.opcode: %u\n",
@@ -287,12 +313,12 @@ void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id)
 		XDNA_DBG(xdna, "\tdata[%d]: %x\n", i, (u32)pkt->data[i]);
 
 	/* Print physical address of host_queue_packet */
-	u64 pkt_paddr = queue->hq_header.data_address + ((u64)pkt - (u64)queue->hq_entry);
+	u64 pkt_paddr = queue->hq_header.data_address + ((u64)pkt - (u64)hq_queue->hq_entry);
 
 	XDNA_DBG(xdna, "Physical address of host_queue_packet: 0x%llx\n", pkt_paddr);
 
 	/* Print host_queue_indirect_hdr */
-	struct host_queue_indirect_hdr *indirect_hdr = &queue->hq_indirect_hdr[slot_id];
+	struct host_queue_indirect_hdr *indirect_hdr = &hq_queue->hq_indirect_hdr[slot_id];
 	int total_entry = indirect_hdr->header.count / sizeof(struct host_indirect_packet_entry);
 
 	XDNA_DBG(xdna, "indirect_hdr.header.opcode: %u\n", indirect_hdr->header.opcode);
@@ -310,16 +336,16 @@ void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id)
 
 	/* Print physical address of host_queue_indirect_hdr */
 	u64 indirect_hdr_paddr = queue->hq_header.data_address +
-			((u64)indirect_hdr - (u64)queue->hq_entry);
+			((u64)indirect_hdr - (u64)hq_queue->hq_entry);
 	XDNA_DBG(xdna, "Physical addr of host_queue_indirect_hdr: 0x%llx\n", indirect_hdr_paddr);
 
 	/* Print host_queue_indirect_pkt */
 	for (int i = 0; i < total_entry; i++) {
-		struct host_queue_indirect_pkt *indirect_pkt = &queue->hq_indirect_pkt[slot_id][i];
+		struct host_queue_indirect_pkt *indirect_pkt = &hq_queue->hq_indirect_pkt[slot_id][i];
 
 		/* Print physical address of host_queue_indirect_pkt */
 		u64 indirect_pkt_paddr = queue->hq_header.data_address +
-			((u64)indirect_pkt - (u64)queue->hq_entry);
+			((u64)indirect_pkt - (u64)hq_queue->hq_entry);
 
 		XDNA_DBG(xdna, "\nPhysical address of indirect_pkt[%d]: 0x%llx\n", i,
 			 indirect_pkt_paddr);
@@ -346,40 +372,65 @@ void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id)
 	}
 }
 
+static bool ve2_hsa_queue_depth_valid(u32 nslots)
+{
+	return is_power_of_2(nslots) && nslots >= HOST_QUEUE_MIN_ENTRY &&
+		nslots <= HOST_QUEUE_MAX_ENTRY;
+}
+
 /*
- * Create hsa queue in kernel and initialize queue slots.
+ * Allocate hsa queue memory of nslots slots and initialize queue slots. Read
+ * and write index start from index, so that sequence numbers of a resized
+ * queue carry on from the old one.
  */
-static int ve2_create_host_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue *queue)
+static int ve2_alloc_host_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue *queue,
+				u32 nslots, u64 index)
 {
 	struct platform_device *pdev = to_platform_device(xdna->ddev.dev);
-	int nslots = HOST_QUEUE_ENTRY;
+	struct ve2_hsa_queue_buf *buf;
 	dma_addr_t dma_handle;
 
+	BUILD_BUG_ON(HSA_QUEUE_COMPLETE_OFF(HOST_QUEUE_ENTRY) != sizeof(struct hsa_queue));
+	BUILD_BUG_ON(HSA_QUEUE_ENTRY_OFF != sizeof(struct host_queue_header));
+	BUILD_BUG_ON(HSA_QUEUE_SIZE(HOST_QUEUE_MAX_ENTRY) > BIT(AMDXDNA_VE2_UMQ_SHIFT));
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
 	/* Allocate a single contiguous block of memory */
-	queue->hsa_queue_p = dma_alloc_coherent(&pdev->dev,
-						sizeof(struct hsa_queue) + sizeof(u64) * nslots,
-						&dma_handle,
-						GFP_KERNEL);
-	if (!queue->hsa_queue_p)
+	buf->dev = &pdev->dev;
+	buf->size = HSA_QUEUE_SIZE(nslots);
+	buf->vaddr = dma_alloc_coherent(buf->dev, buf->size, &dma_handle, GFP_KERNEL);
+	if (!buf->vaddr) {
+		kfree(buf);
 		return -ENOMEM;
+	}
+	buf->dma_addr = dma_handle;
+	kref_init(&buf->ref);
+	queue->buf = buf;
+	queue->hsa_queue_p = buf->vaddr;
+	queue->capacity = nslots;
+	queue->hq_entry = buf->vaddr + HSA_QUEUE_ENTRY_OFF;
+	queue->hq_indirect_hdr = buf->vaddr + HSA_QUEUE_INDIRECT_HDR_OFF(nslots);
+	queue->hq_indirect_pkt = buf->vaddr + HSA_QUEUE_INDIRECT_PKT_OFF(nslots);
 
-	/* Initialize mutex here */
-	mutex_init(&queue->hq_lock);
 	/* Set the base DMA address for hsa queue */
 	queue->hsa_queue_mem.dma_addr = dma_handle;
 
 	/* Calculate the address for hqc_mem within the allocated block */
-	queue->hq_complete.hqc_mem =
-		(u64 *)((char *)queue->hsa_queue_p + sizeof(struct hsa_queue));
-	queue->hq_complete.hqc_dma_addr = queue->hsa_queue_mem.dma_addr + sizeof(struct hsa_queue);
+	queue->hq_complete.hqc_mem = buf->vaddr + HSA_QUEUE_COMPLETE_OFF(nslots);
+	queue->hq_complete.hqc_dma_addr = dma_handle + HSA_QUEUE_COMPLETE_OFF(nslots);
 	queue->hsa_queue_p->hq_header.data_address = queue->hsa_queue_mem.dma_addr +
 		sizeof(struct host_queue_header);
+	queue->hsa_queue_p->hq_header.read_index = index;
+	queue->hsa_queue_p->hq_header.write_index = index;
 
 	/* Set hsa queue slots to invalid */
 	for (int i = 0; i < nslots; i++) {
-		struct host_queue_indirect_hdr *hdr = &queue->hsa_queue_p->hq_indirect_hdr[i];
+		struct host_queue_indirect_hdr *hdr = &queue->hq_indirect_hdr[i];
 
-		hsa_queue_pkt_set_invalid(hsa_queue_get_pkt(queue->hsa_queue_p, i));
+		hsa_queue_pkt_set_invalid(hsa_queue_get_pkt(queue, i));
 		hdr->header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
 		hdr->header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
 		hdr->header.count = 0;
@@ -387,8 +438,7 @@ static int ve2_create_host_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue
 		hdr->header.indirect = 1;
 
 		for (int j = 0; j < HOST_INDIRECT_PKT_NUM; j++) {
-			struct host_queue_indirect_pkt *pkt =
-			       &queue->hsa_queue_p->hq_indirect_pkt[i][j];
+			struct host_queue_indirect_pkt *pkt = &queue->hq_indirect_pkt[i][j];
 
 			pkt->header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
 			pkt->header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
@@ -405,6 +455,38 @@ static int ve2_create_host_queue(struct amdxdna_dev *xdna, struct ve2_hsa_queue
 	return 0;
 }
 
+/*
+ * Create hsa queue in kernel, as deep as asked for at context creation, or
+ * hsa_queue_depth slots deep.
+ */
+static int ve2_create_host_queue(struct amdxdna_ctx *hwctx, struct ve2_hsa_queue *queue)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	u32 nslots = hwctx->queue_depth;
+	int ret;
+
+	if (nslots) {
+		if (!ve2_hsa_queue_depth_valid(nslots)) {
+			XDNA_DBG(xdna, "Invalid queue depth %u", nslots);
+			return -EINVAL;
+		}
+	} else {
+		nslots = READ_ONCE(hsa_queue_depth);
+		if (!ve2_hsa_queue_depth_valid(nslots)) {
+			XDNA_WARN(xdna, "Invalid hsa_queue_depth %u, using %u",
+				  nslots, HOST_QUEUE_ENTRY);
+			nslots = HOST_QUEUE_ENTRY;
+		}
+	}
+
+	ret = ve2_alloc_host_queue(xdna, queue, nslots, 0);
+	if (ret)
+		return ret;
+
+	mutex_init(&queue->hq_lock);
+	return 0;
+}
+
 static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u64 *seq,
 				   bool last_cmd)
 {
@@ -425,7 +507,7 @@ static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u6
 
 	hq_queue = (struct ve2_hsa_queue *)&ve2_ctx->hwctx_hsa_queue;
 	queue = (struct hsa_queue *)hq_queue->hsa_queue_p;
-	pkt = hsa_queue_get_pkt(queue, slot_id);
+	pkt = hsa_queue_get_pkt(hq_queue, slot_id);
 	if (hsa_queue_pkt_is_valid(pkt)) {
 		XDNA_ERR(xdna, "pkt of slot %llx is already selected", slot_id);
 		return -EINVAL;
@@ -433,7 +515,7 @@ static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u6
 
 	*seq = slot_id;
 	XDNA_DBG(xdna, "slot %llx is selected", slot_id);
-	slot_id = slot_id & (queue->hq_header.capacity - 1);
+	slot_id = slot_id & (hq_queue->capacity - 1);
 
 	hdr = &pkt->xrt_header;
 	hdr->common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
@@ -444,14 +526,14 @@ static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u6
 	hdr->completion_signal = (u64)(hq_queue->hq_complete.hqc_dma_addr + slot_id * sizeof(u64));
 
 	struct host_queue_indirect_hdr *indirect_hdr =
-		(struct host_queue_indirect_hdr *)&queue->hq_indirect_hdr[slot_id];
+		(struct host_queue_indirect_hdr *)&hq_queue->hq_indirect_hdr[slot_id];
 	u32 total_cmds = dpu->chained + 1;
 
 	indirect_hdr->header.count = total_cmds * sizeof(struct host_indirect_packet_entry);
 	indirect_hdr->header.indirect = 1;
 	indirect_hdr->header.distribute = 1;
 	u64 m_indirect_hdr_paddr = (u64)(queue->hq_header.data_address +
-		((u64)&queue->hq_indirect_hdr[slot_id] - (u64)&queue->hq_entry));
+		((u64)&hq_queue->hq_indirect_hdr[slot_id] - (u64)hq_queue->hq_entry));
 
 	struct host_indirect_packet_entry *hp = (struct host_indirect_packet_entry *)pkt->data;
 
@@ -464,9 +546,9 @@ static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u6
 
 	for (int i = 0; dpu && (i < total_cmds); i++, hp_hdr++, dpu = get_ve2_dpu_data_next(dpu)) {
 		struct host_queue_indirect_pkt *indirect_data =
-			(struct host_queue_indirect_pkt *)&queue->hq_indirect_pkt[slot_id][i];
+			(struct host_queue_indirect_pkt *)&hq_queue->hq_indirect_pkt[slot_id][i];
 		u64 m_indirect_data_paddr = (u64)(queue->hq_header.data_address +
-				((u64)&queue->hq_indirect_pkt[slot_id][i] - (u64)&queue->hq_entry));
+				((u64)&hq_queue->hq_indirect_pkt[slot_id][i] - (u64)hq_queue->hq_entry));
 
 		XDNA_DBG(xdna, "\nIndirect packet id %d\n", i);
 		XDNA_DBG(xdna, "        uc index %d\n", dpu->uc_index);
@@ -491,7 +573,7 @@ static int submit_command_indirect(struct amdxdna_ctx *hwctx, void *cmd_data, u6
 
 	/* Enable for debug purpose */
 	if (verbosity >= VERBOSITY_LEVEL_DBG)
-		packet_dump(xdna, queue, slot_id);
+		packet_dump(xdna, hq_queue, slot_id);
 
 	hsa_queue_pkt_set_valid(pkt);
 
@@ -646,16 +728,26 @@ int ve2_cmd_submit(struct amdxdna_ctx *hwctx, struct amdxdna_sched_job *job, u32
 		return -EINVAL;
 	}
 
+	if (READ_ONCE(hwctx->priv->umq)) {
+		XDNA_DBG(xdna, "%s submits through user mode queue", hwctx->name);
+		return -EBUSY;
+	}
+
 	op = amdxdna_cmd_get_op(cmd_bo);
 	if (op != ERT_START_DPU && op != ERT_CMD_CHAIN) {
 		XDNA_WARN(xdna, "Unsupported ERT cmd: %d received", op);
 		return -EINVAL;
 	}
 
+	/* Queue may be resized otherwise, see ve2_hwctx_resize_queue() */
+	ret = mutex_lock_killable(&hwctx->submit_lock);
+	if (ret)
+		return ret;
 	if (op == ERT_CMD_CHAIN)
 		ret = ve2_submit_cmd_chain(hwctx, job, seq);
 	else
 		ret = ve2_submit_cmd_single(hwctx, job, seq);
+	mutex_unlock(&hwctx->submit_lock);
 
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to submit a command. ret %d\n", ret);
@@ -668,6 +760,56 @@ int ve2_cmd_submit(struct amdxdna_ctx *hwctx, struct amdxdna_sched_job *job, u32
 	return 0;
 }
 
+static inline bool ve2_cmd_done(struct amdxdna_ctx_priv *priv_ctx, u64 seq)
+{
+	u64 *read_index;
+
+	if (priv_ctx->misc_intrpt_flag)
+		return true;
+
+	read_index = (u64 *)((char *)priv_ctx->hwctx_hsa_queue.hsa_queue_p +
+			HSA_QUEUE_READ_INDEX_OFFSET);
+	return READ_ONCE(*read_index) > seq;
+}
+
+/*
+ * Busy poll for commands that usually complete shortly, where interrupt plus
+ * wake up latency would dominate. A context polls only when its average
+ * command run time is within poll_max_us, and for twice the average at most.
+ * Otherwise, or if the command is still running, the caller sleeps for the
+ * interrupt.
+ */
+static bool ve2_cmd_poll(struct amdxdna_ctx_priv *priv_ctx, u64 seq)
+{
+	u64 max_ns = (u64)READ_ONCE(poll_max_us) * NSEC_PER_USEC;
+	u64 avg = READ_ONCE(priv_ctx->avg_run_ns);
+	ktime_t end;
+
+	if (!avg || avg > max_ns)
+		return false;
+
+	end = ktime_add_ns(ktime_get(), min(2 * avg, max_ns));
+	do {
+		if (ve2_cmd_done(priv_ctx, seq)) {
+			atomic64_inc(&priv_ctx->poll_hits);
+			return true;
+		}
+		cpu_relax();
+	} while (ktime_before(ktime_get(), end));
+
+	atomic64_inc(&priv_ctx->poll_misses);
+	return false;
+}
+
+/* Moving average of command run time, 1/8 weight for the new sample */
+static void ve2_cmd_learn(struct amdxdna_ctx_priv *priv_ctx, struct amdxdna_sched_job *job)
+{
+	u64 sample = ktime_to_ns(ktime_sub(ktime_get(), job->submit_time));
+	u64 avg = priv_ctx->avg_run_ns;
+
+	WRITE_ONCE(priv_ctx->avg_run_ns, avg ? avg - (avg >> 3) + (sample >> 3) : sample);
+}
+
 /*
  * Handle interrupt notification based on read_index and write_index.
  */
@@ -696,7 +838,7 @@ static inline bool check_read_index(struct amdxdna_ctx *hwctx,
 	}
 
 	counter++;
-	return (*read_index > seq);
+	return ve2_cmd_done(priv_ctx, seq);
 }
 
 static void ve2_dump_ctx(struct amdxdna_dev *xdna, struct amdxdna_ctx *hwctx)
@@ -757,19 +899,27 @@ int ve2_cmd_wait(struct amdxdna_ctx *hwctx, u64 seq, u32 timeout)
 {
 	struct amdxdna_ctx_priv *priv_ctx = hwctx->priv;
 	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	struct ve2_hsa_queue *queue = &priv_ctx->hwctx_hsa_queue;
 	struct amdxdna_sched_job *job;
 	u32 print_interval = 300;
 	unsigned long wait_jifs;
+	bool learn;
 	int ret = 0;
 
 	/*
 	 * NOTE: this is simplified hwctx which has no col_entry list for different ctx
 	 * sharing the same lead col.
 	 * The current version assumes one hwctx is 1:1 mapping with one lead cert col
+	 *
+	 * Wait without hq_lock, so that submitters and waiters of other seqs are not
+	 * blocked. hq_lock is only taken to collect the completion and release the job.
 	 */
 	wait_jifs = msecs_to_jiffies(timeout);
-	mutex_lock(&priv_ctx->hwctx_hsa_queue.hq_lock);
-	if (wait_jifs)
+	/* Only a wait which sees the completion happen can learn the run time */
+	learn = queue->hsa_queue_p && !ve2_cmd_done(priv_ctx, seq);
+	if (learn && ve2_cmd_poll(priv_ctx, seq))
+		ret = wait_jifs ? 1 : 0;
+	else if (wait_jifs)
 		ret = wait_event_interruptible_timeout(priv_ctx->waitq,
 						       check_read_index(hwctx, seq, print_interval),
 						       wait_jifs);
@@ -780,8 +930,14 @@ int ve2_cmd_wait(struct amdxdna_ctx *hwctx, u64 seq, u32 timeout)
 	XDNA_DBG(xdna, "wait_event returned %d (timeout_jiffies=%lu)", ret, wait_jifs);
 
 	if ((!wait_jifs && !ret) || ret > 0) {
+		/* User mode queue collects completion state and frees slots itself */
+		if (READ_ONCE(priv_ctx->umq))
+			return 0;
+
+		mutex_lock(&queue->hq_lock);
+		/* Another waiter of the same seq may have released the job already */
 		job = ve2_hwctx_get_job(hwctx, seq);
-		if (unlikely(!job)) {
+		if (unlikely(!job || job->seq != seq)) {
 			ret = 0;
 			goto out;
 		}
@@ -810,25 +966,24 @@ int ve2_cmd_wait(struct amdxdna_ctx *hwctx, u64 seq, u32 timeout)
 			hwctx->health_reported = true;
 			amdxdna_cmd_set_state(job->cmd_bo, ERT_CMD_STATE_TIMEOUT);
 		} else {
-			u32 slot =
-				seq % (priv_ctx->hwctx_hsa_queue.hsa_queue_p->hq_header.capacity);
+			u32 slot = seq % (queue->hsa_queue_p->hq_header.capacity);
 			enum ert_cmd_state state;
 
-			state = priv_ctx->hwctx_hsa_queue.hq_complete.hqc_mem[slot];
+			state = queue->hq_complete.hqc_mem[slot];
 			if (state <= ERT_CMD_STATE_INVALID || state > ERT_CMD_STATE_NORESPONSE) {
 				XDNA_WARN(xdna, "state %u at hqc_mem[%u]", state, slot);
 				ret = 0;
 				goto out;
 			}
 			amdxdna_cmd_set_state(job->cmd_bo, state);
+			if (learn)
+				ve2_cmd_learn(priv_ctx, job);
 		}
 
 		ve2_hwctx_job_release(hwctx, job);
-
-		if (!wait_jifs) {
-			mutex_unlock(&priv_ctx->hwctx_hsa_queue.hq_lock);
+		mutex_unlock(&queue->hq_lock);
+		if (!wait_jifs)
 			return 0;
-		}
 	}
 
 	/*
@@ -837,14 +992,102 @@ int ve2_cmd_wait(struct amdxdna_ctx *hwctx, u64 seq, u32 timeout)
 	 */
 	if (!ret)
 		ret = -ETIME;
+	goto done;
 
 out:
-	mutex_unlock(&priv_ctx->hwctx_hsa_queue.hq_lock);
+	mutex_unlock(&queue->hq_lock);
+done:
 	XDNA_DBG(xdna, "wait_cmd ret:%d", ret);
 	/* 0 is success, others are timeout */
 	return ret > 0 ? 0 : ret;
 }
 
+static void ve2_umq_vm_open(struct vm_area_struct *vma)
+{
+	struct ve2_hsa_queue_buf *buf = vma->vm_private_data;
+	struct amdxdna_dev *xdna = to_xdna_dev(((struct drm_file *)vma->vm_file->private_data)->minor->dev);
+
+	kref_get(&buf->ref);
+	drm_dev_get(&xdna->ddev);
+}
+
+static void ve2_umq_vm_close(struct vm_area_struct *vma)
+{
+	struct ve2_hsa_queue_buf *buf = vma->vm_private_data;
+	struct amdxdna_dev *xdna = to_xdna_dev(((struct drm_file *)vma->vm_file->private_data)->minor->dev);
+
+	kref_put(&buf->ref, ve2_hsa_queue_buf_release);
+	drm_dev_put(&xdna->ddev);
+}
+
+static const struct vm_operations_struct ve2_umq_vm_ops = {
+	.open = ve2_umq_vm_open,
+	.close = ve2_umq_vm_close,
+};
+
+/*
+ * Map HSA queue of a context into user for user mode submission. The context
+ * must not have commands submitted through the driver in flight, as both
+ * would allocate slots from the same write index.
+ */
+int ve2_mmap(struct amdxdna_dev *xdna, struct vm_area_struct *vma)
+{
+	struct drm_file *filp = vma->vm_file->private_data;
+	struct amdxdna_client *client = filp->driver_priv;
+	unsigned long shift = AMDXDNA_VE2_UMQ_SHIFT - PAGE_SHIFT;
+	struct ve2_hsa_queue_buf *buf;
+	struct ve2_hsa_queue *queue;
+	struct amdxdna_ctx *hwctx;
+	u32 handle;
+	int ret, idx;
+
+	if (vma->vm_pgoff & ((1UL << shift) - 1))
+		return -EINVAL;
+
+	handle = vma->vm_pgoff >> shift;
+	idx = srcu_read_lock(&client->ctx_srcu);
+	hwctx = xa_load(&client->ctx_xa, handle);
+	if (!hwctx) {
+		XDNA_DBG(xdna, "PID %d failed to get ctx %d", client->pid, handle);
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	queue = &hwctx->priv->hwctx_hsa_queue;
+	buf = queue->buf;
+	if (vma->vm_end - vma->vm_start > PAGE_ALIGN(buf->size)) {
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	mutex_lock(&queue->hq_lock);
+	if (hwctx->submitted != hwctx->completed) {
+		XDNA_DBG(xdna, "%s has commands in flight", hwctx->name);
+		ret = -EBUSY;
+		goto unlock_queue;
+	}
+
+	vma->vm_pgoff = 0;
+	ret = dma_mmap_coherent(buf->dev, vma, buf->vaddr, buf->dma_addr, buf->size);
+	if (ret) {
+		XDNA_ERR(xdna, "%s map HSA queue failed, ret %d", hwctx->name, ret);
+		goto unlock_queue;
+	}
+
+	kref_get(&buf->ref);
+	drm_dev_get(&xdna->ddev);
+	vma->vm_private_data = buf;
+	vma->vm_ops = &ve2_umq_vm_ops;
+	WRITE_ONCE(hwctx->priv->umq, true);
+	XDNA_DBG(xdna, "%s HSA queue mapped at 0x%lx", hwctx->name, vma->vm_start);
+
+unlock_queue:
+	mutex_unlock(&queue->hq_lock);
+unlock_srcu:
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	return ret;
+}
+
 static void timeout_cb(struct timer_list *t)
 {
 	struct amdxdna_ctx_priv *priv = from_timer(priv, t, event_timer);
@@ -883,13 +1126,20 @@ int ve2_hwctx_init(struct amdxdna_ctx *hwctx)
 	init_waitqueue_head(&priv->waitq);
 
 	/* one host_queue entry per hwctx */
-	ret = ve2_create_host_queue(xdna, &priv->hwctx_hsa_queue);
+	ret = ve2_create_host_queue(hwctx, &priv->hwctx_hsa_queue);
 	if (ret)
 		goto free_priv;
 
+	priv->pending = kcalloc(priv->hwctx_hsa_queue.capacity, sizeof(*priv->pending),
+				GFP_KERNEL);
+	if (!priv->pending) {
+		ret = -ENOMEM;
+		goto free_hsa_queue;
+	}
+
 	ret = ve2_xrs_request(xdna, hwctx);
 	if (ret)
-		goto free_hsa_queue;
+		goto free_pending;
 
 	if (enable_polling) {
 		XDNA_INFO(xdna, "Running in timer mode");
@@ -906,6 +1156,8 @@ int ve2_hwctx_init(struct amdxdna_ctx *hwctx)
 
 	return 0;
 
+free_pending:
+	kfree(priv->pending);
 free_hsa_queue:
 	ve2_free_hsa_queue(xdna, &hwctx->priv->hwctx_hsa_queue);
 free_priv:
@@ -926,6 +1178,8 @@ void ve2_hwctx_fini(struct amdxdna_ctx *hwctx)
 	if (enable_polling)
 		del_timer_sync(&hwctx->priv->event_timer);
 
+	ve2_counter_sampling_stop(hwctx);
+
 	/*
 	 * Clear active_ctx FIRST to prevent IRQ handler from queueing new work,
 	 * then cancel any pending work to ensure no work is accessing this context
@@ -945,7 +1199,7 @@ void ve2_hwctx_fini(struct amdxdna_ctx *hwctx)
 	 * be freed immediately if the application still holds references
 	 */
 
-	for (idx = 0; idx < HWCTX_MAX_CMDS; idx++) {
+	for (idx = 0; idx < nhwctx->hwctx_hsa_queue.capacity; idx++) {
 		job = hwctx->priv->pending[idx];
 		if (!job)
 			continue;
@@ -958,6 +1212,7 @@ void ve2_hwctx_fini(struct amdxdna_ctx *hwctx)
 
 	ve2_mgmt_destroy_partition(hwctx);
 	ve2_free_hsa_queue(xdna, &hwctx->priv->hwctx_hsa_queue);
+	kfree(hwctx->priv->pending);
 	kfree(hwctx->priv->hwctx_config);
 	kfree(hwctx->priv);
 	XDNA_DBG(xdna, "Destroyed hwctx %p, total cmds submitted (%llu), completed(%llu)",
@@ -991,6 +1246,7 @@ static int ve2_update_handshake_pkt(struct amdxdna_ctx *hwctx, u8 buf_type, u64
 		return -EOPNOTSUPP;
 	}
 
+	WRITE_ONCE(nhwctx->hs_cfg_gen, nhwctx->hs_cfg_gen + 1);
 	return 0;
 }
 
@@ -1000,6 +1256,82 @@ static void ve2_hwctx_config_op_timeout(struct amdxdna_ctx *hwctx, u32 op_timeou
 
 	for (u32 col = 0; col < hwctx->num_col; col++)
 		nhwctx->hwctx_config[col].opcode_timeout_config = op_timeout;
+	WRITE_ONCE(nhwctx->hs_cfg_gen, nhwctx->hs_cfg_gen + 1);
+}
+
+/*
+ * Replace HSA queue of an idle context by one of nslots slots. Firmware picks
+ * queue address up from the handshake done when the context is switched in,
+ * so the context can't be the one active on its partition. User mapped queue
+ * can't be moved either.
+ */
+static int ve2_hwctx_resize_queue(struct amdxdna_ctx *hwctx, u32 nslots)
+{
+	struct amdxdna_dev *xdna = hwctx->client->xdna;
+	struct amdxdna_ctx_priv *priv = hwctx->priv;
+	struct ve2_hsa_queue *queue = &priv->hwctx_hsa_queue;
+	struct amdxdna_sched_job **pending, **old_pending;
+	struct amdxdna_mgmtctx *mgmtctx;
+	struct ve2_hsa_queue nq = {};
+	int ret;
+
+	if (!ve2_hsa_queue_depth_valid(nslots)) {
+		XDNA_DBG(xdna, "Invalid queue depth %u", nslots);
+		return -EINVAL;
+	}
+
+	pending = kcalloc(nslots, sizeof(*pending), GFP_KERNEL);
+	if (!pending)
+		return -ENOMEM;
+
+	mgmtctx = &xdna->dev_handle->ve2_mgmtctx[priv->start_col];
+	mutex_lock(&hwctx->submit_lock);
+	mutex_lock(&mgmtctx->ctx_lock);
+	mutex_lock(&queue->hq_lock);
+	if (READ_ONCE(priv->umq) || hwctx->submitted != hwctx->completed ||
+	    mgmtctx->active_ctx == hwctx) {
+		XDNA_DBG(xdna, "%s is not idle, queue can't be resized", hwctx->name);
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	ret = 0;
+	if (nslots == queue->capacity)
+		goto unlock;
+
+	ret = ve2_alloc_host_queue(xdna, &nq, nslots,
+				   queue->hsa_queue_p->hq_header.write_index);
+	if (ret)
+		goto unlock;
+
+	/* Late readers of the old read index may still be around */
+	if (queue->prev_buf)
+		kref_put(&queue->prev_buf->ref, ve2_hsa_queue_buf_release);
+	queue->prev_buf = queue->buf;
+	queue->buf = nq.buf;
+	queue->hsa_queue_mem = nq.hsa_queue_mem;
+	queue->hq_complete = nq.hq_complete;
+	queue->capacity = nq.capacity;
+	queue->hq_entry = nq.hq_entry;
+	queue->hq_indirect_hdr = nq.hq_indirect_hdr;
+	queue->hq_indirect_pkt = nq.hq_indirect_pkt;
+	WRITE_ONCE(queue->hsa_queue_p, nq.hsa_queue_p);
+	/* Queue address goes to firmware with the next handshake */
+	WRITE_ONCE(priv->hs_cfg_gen, priv->hs_cfg_gen + 1);
+
+	mutex_lock(&priv->privctx_lock);
+	old_pending = priv->pending;
+	priv->pending = pending;
+	pending = old_pending;
+	mutex_unlock(&priv->privctx_lock);
+	XDNA_DBG(xdna, "%s queue resized to %u slots", hwctx->name, nslots);
+
+unlock:
+	mutex_unlock(&queue->hq_lock);
+	mutex_unlock(&mgmtctx->ctx_lock);
+	mutex_unlock(&hwctx->submit_lock);
+	kfree(pending);
+	return ret;
 }
 
 int ve2_hwctx_config(struct amdxdna_ctx *hwctx, u32 type, u64 mdata_hdl, void *buf, u32 size)
@@ -1086,6 +1418,15 @@ int ve2_hwctx_config(struct amdxdna_ctx *hwctx, u32 type, u64 mdata_hdl, void *b
 		amdxdna_gem_put_obj(mdata_abo);
 		break;
 
+	case DRM_AMDXDNA_HWCTX_UMQ_DOORBELL:
+		if (!READ_ONCE(hwctx->priv->umq)) {
+			XDNA_DBG(xdna, "%s has no user mode queue", hwctx->name);
+			return -EINVAL;
+		}
+
+		ret = ve2_mgmt_schedule_cmd(xdna, hwctx);
+		break;
+
 	case DRM_AMDXDNA_HWCTX_CONFIG_OPCODE_TIMEOUT:
 		if (copy_from_user(&op_timeout, (u32 __user *)(uintptr_t)mdata_hdl, sizeof(u32))) {
 			XDNA_ERR(xdna, "hwctx config req %d failed", type);
@@ -1097,6 +1438,13 @@ int ve2_hwctx_config(struct amdxdna_ctx *hwctx, u32 type, u64 mdata_hdl, void *b
 			 op_timeout, hwctx->name);
 		break;
 
+	case DRM_AMDXDNA_HWCTX_QUEUE_DEPTH:
+		if (mdata_hdl > U32_MAX)
+			return -EINVAL;
+
+		ret = ve2_hwctx_resize_queue(hwctx, mdata_hdl);
+		break;
+
 	default:
 		XDNA_DBG(xdna, "%s Not supported type %d", __func__, type);
 		ret = -EOPNOTSUPP;
@@ -53,54 +53,68 @@ static void cert_setup_partition(struct amdxdna_dev *xdna,
 	cert_hs->mpaie_alive = ALIVE_MAGIC;
 }
 
-static void ve2_free_hs_data(struct aie_op_handshake_data *hs_data, u32 max_cols)
+void ve2_mgmt_free_hs_data(struct amdxdna_mgmtctx *mgmtctx)
 {
-	if (!hs_data)
-		return;
-
-	for (u32 col = 0; col < max_cols; col++) {
-		kfree(hs_data[col].addr);
-		hs_data[col].addr = NULL;
-	}
-	kfree(hs_data);
-	hs_data = NULL;
+	kfree(mgmtctx->hs_data);
+	mgmtctx->hs_data = NULL;
+	mgmtctx->hs_cols = 0;
+	mgmtctx->hs_ctx = NULL;
 }
 
+/*
+ * Get handshake data of the partition. It is allocated once per partition
+ * layout, with the packets of all columns in the same block, and packets are
+ * only filled again when a different context or a changed configuration of
+ * the same context is handshaked. With init false, packets are cleared.
+ */
 static struct aie_op_handshake_data *ve2_prepare_hs_data(struct amdxdna_dev *xdna,
-							 struct amdxdna_ctx_priv *nhwctx,
+							 struct amdxdna_mgmtctx *mgmtctx,
+							 struct amdxdna_ctx *hwctx,
 							 bool init)
 {
+	struct amdxdna_ctx_priv *nhwctx = hwctx->priv;
 	struct aie_op_handshake_data *hs_data;
 	u32 num_col = nhwctx->num_col;
-	struct aie_location aie_loc;
+	struct handshake *cert_hs;
+	u32 gen;
 
-	hs_data = kmalloc_array(num_col, sizeof(*hs_data), GFP_KERNEL);
-	if (!hs_data) {
-		XDNA_ERR(xdna, "No memory for handshake data allocation\n");
-		return NULL;
-	}
-
-	for (u32 col = 0; col < num_col; col++) {
-		struct handshake *cert_hs;
-
-		aie_loc.col = col;
-		cert_hs = kmalloc(sizeof(*cert_hs), GFP_KERNEL);
-		if (!cert_hs) {
-			XDNA_ERR(xdna, "No memory for cert hs packet\n");
-			/* Free previously allocated handshakes */
-			ve2_free_hs_data(hs_data, col);
+	lockdep_assert_held(&mgmtctx->ctx_lock);
+	if (mgmtctx->hs_cols != num_col) {
+		ve2_mgmt_free_hs_data(mgmtctx);
+		hs_data = kzalloc(num_col * (sizeof(*hs_data) + sizeof(*cert_hs)), GFP_KERNEL);
+		if (!hs_data) {
+			XDNA_ERR(xdna, "No memory for handshake data allocation\n");
 			return NULL;
 		}
-		memset(cert_hs, 0, sizeof(*cert_hs));
-		if (init)
-			cert_setup_partition(xdna, nhwctx, col, cert_hs);
 
-		hs_data[col].addr = (void *)cert_hs;
-		hs_data[col].size = sizeof(struct handshake);
-		hs_data[col].offset = 0x0;
-		hs_data[col].loc = aie_loc;
+		cert_hs = (struct handshake *)&hs_data[num_col];
+		for (u32 col = 0; col < num_col; col++) {
+			hs_data[col].addr = (void *)&cert_hs[col];
+			hs_data[col].size = sizeof(struct handshake);
+			hs_data[col].offset = 0x0;
+			hs_data[col].loc.col = col;
+		}
+		mgmtctx->hs_data = hs_data;
+		mgmtctx->hs_cols = num_col;
 	}
 
+	hs_data = mgmtctx->hs_data;
+	cert_hs = hs_data[0].addr;
+	if (!init) {
+		memset(cert_hs, 0, num_col * sizeof(*cert_hs));
+		mgmtctx->hs_ctx = NULL;
+		return hs_data;
+	}
+
+	gen = READ_ONCE(nhwctx->hs_cfg_gen);
+	if (mgmtctx->hs_ctx == hwctx && mgmtctx->hs_cfg_gen == gen)
+		return hs_data;
+
+	for (u32 col = 0; col < num_col; col++)
+		cert_setup_partition(xdna, nhwctx, col, &cert_hs[col]);
+	mgmtctx->hs_ctx = hwctx;
+	mgmtctx->hs_cfg_gen = gen;
+
 	return hs_data;
 }
 
@@ -285,14 +299,16 @@ void ve2_mgmt_handshake_init(struct amdxdna_dev *xdna,
 {
 	struct amdxdna_ctx_priv *nhwctx = hwctx->priv;
 	struct aie_op_handshake_data *hs_data;
+	struct amdxdna_mgmtctx *mgmtctx;
 	u32 start_col;
 	u32 num_col;
 	int ret = 0;
 
 	start_col = nhwctx->start_col;
 	num_col = nhwctx->num_col;
+	mgmtctx = &xdna->dev_handle->ve2_mgmtctx[start_col];
 
-	hs_data = ve2_prepare_hs_data(xdna, nhwctx, true);
+	hs_data = ve2_prepare_hs_data(xdna, mgmtctx, hwctx, true);
 	if (!hs_data) {
 		XDNA_ERR(xdna, "preparing cert handshake data failed ");
 		return;
@@ -305,14 +321,32 @@ void ve2_mgmt_handshake_init(struct amdxdna_dev *xdna,
 	ret = ve2_partition_initialize(nhwctx->aie_dev, nhwctx->args);
 	if (ret < 0) {
 		XDNA_ERR(xdna, "aie partition init failed: %d", ret);
-		goto release_hs_data;
+		return;
 	}
 
 	for (int col = num_col - 1; col >= 0; col--)
 		ve2_partition_uc_wakeup(nhwctx->aie_dev, col);
+}
+
+/* Latency is from the first request until the new context is initialized */
+static void ve2_ctx_switch_begin(struct amdxdna_mgmtctx *mgmtctx)
+{
+	if (!mgmtctx->ctx_switch_start)
+		mgmtctx->ctx_switch_start = ktime_get();
+}
 
-release_hs_data:
-	ve2_free_hs_data(hs_data, num_col);
+static void ve2_ctx_switch_end(struct amdxdna_mgmtctx *mgmtctx)
+{
+	u64 delta;
+
+	if (!mgmtctx->ctx_switch_start)
+		return;
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), mgmtctx->ctx_switch_start));
+	mgmtctx->ctx_switch_start = 0;
+	mgmtctx->ctx_switches++;
+	mgmtctx->ctx_switch_total_ns += delta;
+	mgmtctx->ctx_switch_max_ns = max(mgmtctx->ctx_switch_max_ns, delta);
 }
 
 #define RR_SHARING BIT(0)
@@ -333,6 +367,7 @@ static int ve2_request_context_switch(struct amdxdna_dev *xdna,
 					   sizeof(u32), (void *)&val);
 
 	mgmtctx->is_context_req = 1;
+	ve2_ctx_switch_begin(mgmtctx);
 
 	return 0;
 }
@@ -362,6 +397,7 @@ ve2_response_ctx_switch_req(struct amdxdna_mgmtctx *mgmtctx)
 				break;
 
 			mgmtctx->active_ctx = hwctx;
+			ve2_ctx_switch_end(mgmtctx);
 		}
 
 		if (t_ctx && c_ctx->ctx != t_ctx->ctx)
@@ -407,6 +443,7 @@ int ve2_mgmt_schedule_cmd(struct amdxdna_dev *xdna, struct amdxdna_ctx *hwctx)
 			XDNA_DBG(mgmtctx->xdna,
 				 "Context switch possible as partition is idle active hwctx:%p ------>\n",
 				 mgmtctx->active_ctx);
+			ve2_ctx_switch_begin(mgmtctx);
 			ve2_response_ctx_switch_req(mgmtctx);
 		} else {
 			XDNA_DBG(mgmtctx->xdna,
@@ -539,6 +576,7 @@ static void ve2_scheduler_work(struct work_struct *work)
 		container_of(work, struct amdxdna_mgmtctx, sched_work);
 
 	mutex_lock(&mgmtctx->ctx_lock);
+	mgmtctx->sched_runs++;
 
 	/* Check if context is being destroyed */
 	if (!mgmtctx->active_ctx || !mgmtctx->active_ctx->priv) {
@@ -732,14 +770,26 @@ static int ve2_create_mgmt_partition(struct amdxdna_dev *xdna,
 		mgmtctx->xdna = xdna;
 		mgmtctx->mgmt_partid = request.partition_id;
 		mgmtctx->start_col = load_act->part.start_col;
+		mgmtctx->num_col = load_act->part.ncols;
 		mgmtctx->args.locs = NULL;
 		mgmtctx->args.num_tiles = 0;
 		nhwctx->args = &mgmtctx->args;
 		nhwctx->aie_dev = mgmtctx->mgmt_aiedev;
 		mutex_init(&mgmtctx->ctx_lock);
 		INIT_LIST_HEAD(&mgmtctx->ctx_command_fifo_head);
-		/* Create workqueue for scheduling the command */
-		mgmtctx->mgmtctx_workq = create_workqueue("ve2_mgmtctx_scheduler");
+		mgmtctx->ctx_switch_start = 0;
+		mgmtctx->ctx_switches = 0;
+		mgmtctx->ctx_switch_total_ns = 0;
+		mgmtctx->ctx_switch_max_ns = 0;
+		mgmtctx->sched_runs = 0;
+		/*
+		 * Each partition has its own workqueue, so that context switch on one
+		 * partition does not delay another. It is per CPU and high priority, so
+		 * the work runs right away on the CPU which took the interrupt.
+		 */
+		mgmtctx->mgmtctx_workq = alloc_workqueue("ve2_sched_%u",
+							 WQ_HIGHPRI | WQ_MEM_RECLAIM, 1,
+							 mgmtctx->start_col);
 		if (!mgmtctx->mgmtctx_workq) {
 			XDNA_ERR(xdna, "Failed to create Workqueue for scheduler");
 			aie_partition_release(mgmtctx->mgmt_aiedev);
@@ -793,14 +843,16 @@ static int ve2_xrs_release(struct amdxdna_dev *xdna, struct amdxdna_ctx *hwctx,
 	return xrs_release_resource(xdna->dev_handle->xrs_hdl, (uintptr_t)hwctx, load_act);
 }
 
-static void cert_clear_partition(struct amdxdna_dev *xdna, struct amdxdna_ctx_priv *nhwctx)
+static void cert_clear_partition(struct amdxdna_dev *xdna, struct amdxdna_mgmtctx *mgmtctx,
+				 struct amdxdna_ctx *hwctx)
 {
+	struct amdxdna_ctx_priv *nhwctx = hwctx->priv;
 	struct device *aie_dev = nhwctx->aie_dev;
 	u32 num_col = nhwctx->num_col;
 	int ret = 0;
 	struct aie_op_handshake_data *hs_data;
 
-	hs_data = ve2_prepare_hs_data(xdna, nhwctx, false);
+	hs_data = ve2_prepare_hs_data(xdna, mgmtctx, hwctx, false);
 	if (!hs_data) {
 		XDNA_ERR(xdna, "No memory for hs_data\n");
 		return;
@@ -809,7 +861,6 @@ static void cert_clear_partition(struct amdxdna_dev *xdna, struct amdxdna_ctx_pr
 	ret = aie_partition_handshake_update(aie_dev, hs_data, num_col);
 	if (ret < 0)
 		XDNA_ERR(xdna, "aie partition handshake update failed, ret: %d\n", ret);
-	ve2_free_hs_data(hs_data, num_col);
 }
 
 /**
@@ -847,8 +898,8 @@ int ve2_mgmt_destroy_partition(struct amdxdna_ctx *hwctx)
 	if (load_act.release_aie_part) {
 		struct workqueue_struct *wq = NULL;
 
-		cert_clear_partition(xdna, nhwctx);
 		mutex_lock(&mgmtctx->ctx_lock);
+		cert_clear_partition(xdna, mgmtctx, hwctx);
 		/* Update the active context as partition doesn't exists any more */
 		mgmtctx->active_ctx = NULL;
 		wq = mgmtctx->mgmtctx_workq;
@@ -864,6 +915,9 @@ int ve2_mgmt_destroy_partition(struct amdxdna_ctx *hwctx)
 		mutex_lock(&mgmtctx->ctx_lock);
 		if (mgmtctx->active_ctx == hwctx)
 			mgmtctx->active_ctx = NULL;
+		/* Context memory may come back as a new context */
+		if (mgmtctx->hs_ctx == hwctx)
+			mgmtctx->hs_ctx = NULL;
 		mutex_unlock(&mgmtctx->ctx_lock);
 	}
 
@@ -12,6 +12,7 @@
 struct aie_device;
 struct amdxdna_dev;
 struct amdxdna_ctx;
+struct amdxdna_mgmtctx;
 
 #define VE2_COL_SHIFT			25
 #define VE2_ROW_SHIFT			20
@@ -223,4 +224,10 @@ int ve2_mgmt_schedule_cmd(struct amdxdna_dev *xdna, struct amdxdna_ctx *hwctx);
  */
 void ve2_mgmt_handshake_init(struct amdxdna_dev *xdna, struct amdxdna_ctx *hwctx);
 
+/**
+ * ve2_mgmt_free_hs_data - Free handshake data cached by a partition.
+ * @mgmtctx: Pointer to the management context of the partition.
+ */
+void ve2_mgmt_free_hs_data(struct amdxdna_mgmtctx *mgmtctx);
+
 #endif /* _VE2_MGMT_H_ */
@@ -8,6 +8,7 @@
 #include <linux/xlnx-ai-engine.h>
 #include <linux/of_reserved_mem.h>
 #include <linux/of_address.h>
+#include <linux/of.h>
 
 #include "ve2_of.h"
 #include "ve2_mgmt.h"
@@ -102,12 +103,12 @@ static void ve2_cma_mem_region_remove(struct amdxdna_dev *xdna)
 	int i;
 
 	for (i = 0; i < MAX_MEM_REGIONS; i++) {
-		struct device *dev = xdna->cma_region_devs[i];
+		struct device *dev = xdna->cma_regions[i].dev;
 
 		if (dev) {
 			of_reserved_mem_device_release(dev);
 			put_device(dev);
-			xdna->cma_region_devs[i] = NULL;
+			xdna->cma_regions[i].dev = NULL;
 		}
 	}
 }
@@ -116,7 +117,10 @@ static int
 ve2_cma_mem_region_init(struct amdxdna_dev *xdna,
 			struct platform_device *pdev)
 {
+	struct amdxdna_cma_region *region;
+	struct reserved_mem *rmem;
 	struct device *child_dev;
+	struct device_node *np;
 	int num_regions;
 	int ret;
 	int i;
@@ -157,7 +161,19 @@ ve2_cma_mem_region_init(struct amdxdna_dev *xdna,
 			goto put_dev;
 		}
 
-		xdna->cma_region_devs[i] = child_dev;
+		region = &xdna->cma_regions[i];
+		region->nid = NUMA_NO_NODE;
+		region->size = 0;
+		np = of_parse_phandle(pdev->dev.of_node, "memory-region", i);
+		if (np) {
+			region->nid = of_node_to_nid(np);
+			rmem = of_reserved_mem_lookup(np);
+			if (rmem)
+				region->size = rmem->size;
+			of_node_put(np);
+		}
+		XDNA_DBG(xdna, "CMA region %d node %d size 0x%zx", i, region->nid, region->size);
+		region->dev = child_dev;
 	}
 
 	return 0;
@@ -266,9 +282,11 @@ static int ve2_init(struct amdxdna_dev *xdna)
 
 static void ve2_fini(struct amdxdna_dev *xdna)
 {
-	/* All resources are managed by devm_/drmm_ */
+	/* All resources but cached handshake data are managed by devm_/drmm_ */
 	XDNA_DBG(xdna, "VE2 device cleanup function");
 
+	for (u32 col = 0; col < xdna->dev_handle->aie_dev_info.cols; col++)
+		ve2_mgmt_free_hs_data(&xdna->dev_handle->ve2_mgmtctx[col]);
 	ve2_cma_mem_region_remove(xdna);
 }
 const struct amdxdna_dev_ops ve2_ops = {
@@ -282,4 +300,5 @@ const struct amdxdna_dev_ops ve2_ops = {
 	.get_aie_info	= ve2_get_aie_info,
 	.set_aie_state	= ve2_set_aie_state,
 	.get_aie_array	= ve2_get_array,
+	.mmap		= ve2_mmap,
 };
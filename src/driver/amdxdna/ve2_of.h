@@ -10,8 +10,6 @@
 #include "ve2_host_queue.h"
 #include "ve2_fw.h"
 
-#define HWCTX_MAX_CMDS		HOST_QUEUE_ENTRY
-#define get_job_idx(seq)	((seq) & (HWCTX_MAX_CMDS - 1))
 
 #define VERBOSITY_LEVEL_DBG	2
 
@@ -78,10 +76,21 @@ struct amdxdna_ctx_priv {
 	struct ve2_hsa_queue		hwctx_hsa_queue;
 	struct ve2_config_hwctx		*hwctx_config;
 	wait_queue_head_t		waitq;
-	struct amdxdna_sched_job	*pending[HWCTX_MAX_CMDS];
+	/* One per HSA queue slot */
+	struct amdxdna_sched_job	**pending;
 	struct timer_list		event_timer;
 	bool			misc_intrpt_flag; /* Hardware sync required */
 	struct mutex			privctx_lock; /* protect private ctx */
+	/* Submission goes through user mapped HSA queue, see ve2_mmap() */
+	bool				umq;
+	/* Adaptive busy poll before sleeping for completion interrupt */
+	u64				avg_run_ns;
+	atomic64_t			poll_hits;
+	atomic64_t			poll_misses;
+	/* Periodic AIE counter sampling, protected by privctx_lock */
+	struct ve2_counter_sampler	*sampler;
+	/* Bumped whenever what goes into the handshake packets changes */
+	u32				hs_cfg_gen;
 };
 
 struct amdxdna_dev_priv {
@@ -95,6 +104,7 @@ struct amdxdna_mgmtctx {
 	struct amdxdna_ctx		*active_ctx;
 	struct device			*mgmt_aiedev;
 	u32				start_col;
+	u32				num_col;
 	u32				mgmt_partid;
 	struct aie_partition_init_args	args;
 	struct list_head		ctx_command_fifo_head;
@@ -104,6 +114,20 @@ struct amdxdna_mgmtctx {
 	u32			is_partition_idle; /* Hardware sync required */
 	u32			is_context_req; /* Hardware sync required */
 	u32			is_idle_due_to_context; /* Hardware sync required */
+	/* Context switch latency, protected by ctx_lock */
+	ktime_t				ctx_switch_start;
+	u64				ctx_switches;
+	u64				ctx_switch_total_ns;
+	u64				ctx_switch_max_ns;
+	u64				sched_runs;
+	/*
+	 * Handshake data reused by every handshake on this partition, filled for
+	 * hs_ctx at its hs_cfg_gen. Protected by ctx_lock.
+	 */
+	struct aie_op_handshake_data	*hs_data;
+	u32				hs_cols;
+	struct amdxdna_ctx		*hs_ctx;
+	u32				hs_cfg_gen;
 };
 
 struct amdxdna_dev_hdl {
@@ -128,10 +152,12 @@ void ve2_free_firmware_slots(struct amdxdna_dev_hdl *xdna_hdl, u32 max_cols);
 int ve2_cmd_submit(struct amdxdna_ctx *hwctx, struct amdxdna_sched_job *job, u32 *syncobj_hdls,
 		   u64 *syncobj_points, u32 syncobj_cnt, u64 *seq);
 int ve2_cmd_wait(struct amdxdna_ctx *hwctx, u64 seq, u32 timeout);
+int ve2_mmap(struct amdxdna_dev *xdna, struct vm_area_struct *vma);
 
 /* ve2_debug.c */
 int ve2_set_aie_state(struct amdxdna_client *client, struct amdxdna_drm_set_state *args);
 int ve2_get_aie_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args);
-void packet_dump(struct amdxdna_dev *xdna, struct hsa_queue *queue, u64 slot_id);
+void packet_dump(struct amdxdna_dev *xdna, struct ve2_hsa_queue *hq_queue, u64 slot_id);
 int ve2_get_array(struct amdxdna_client *client, struct amdxdna_drm_get_array *args);
+void ve2_counter_sampling_stop(struct amdxdna_ctx *hwctx);
 #endif /* _VE2_OF_H_ */
@@ -116,6 +116,95 @@ static inline bool is_partition_free(struct solver_state *xrs, u32 col, u32 ncol
 	return true;
 }
 
+static inline bool is_exclusive_partition(struct solver_state *xrs, u32 col, u32 ncols);
+
+/**
+ * free_run - Find the free column range containing a free partition
+ * @xrs: Solver state
+ * @col: Starting column of a free partition
+ * @ncols: Number of columns of the partition
+ * @run_start: Returned start column of the free range
+ *
+ * Returns: number of columns of the free range.
+ */
+static u32 free_run(struct solver_state *xrs, u32 col, u32 ncols, u32 *run_start)
+{
+	u32 total = xrs->cfg.total_col;
+	u32 end = col + ncols;
+	u32 start = col;
+
+	while (start > 0 && !test_bit(start - 1, xrs->rgp.resbit))
+		start--;
+	end = find_next_bit(xrs->rgp.resbit, total, end);
+
+	*run_start = start;
+	return end - start;
+}
+
+/**
+ * find_best_fit_col - Pick the free start column which fragments the array least
+ * @xrs: Solver state
+ * @snode: Solver node containing valid start columns from XCLBIN
+ * @ncols: Number of columns
+ * @shared: Skip ranges overlapping exclusive partitions
+ * @col: Returned start column
+ *
+ * Best fit: the partition goes to the smallest free range it fits in, so that
+ * large free ranges are kept for large requests. In that range, a start column
+ * at either edge is preferred, which does not split the rest in two.
+ *
+ * Returns: true if a free start column is found, false otherwise.
+ */
+static bool find_best_fit_col(struct solver_state *xrs, struct solver_node *snode,
+			      u32 ncols, bool shared, u32 *col)
+{
+	u32 best_run = U32_MAX;
+	u32 best_split = U32_MAX;
+	u32 run, run_start, split;
+	u32 candidate;
+
+	for (u32 i = 0; i < snode->cols_len; i++) {
+		candidate = snode->start_cols[i];
+		if (candidate + ncols > xrs->cfg.total_col)
+			continue;
+
+		if (shared && is_exclusive_partition(xrs, candidate, ncols))
+			continue;
+
+		if (!is_partition_free(xrs, candidate, ncols))
+			continue;
+
+		run = free_run(xrs, candidate, ncols, &run_start);
+		split = (candidate != run_start) + (candidate + ncols != run_start + run);
+		if (run > best_run || (run == best_run && split >= best_split))
+			continue;
+
+		best_run = run;
+		best_split = split;
+		*col = candidate;
+	}
+
+	return best_run != U32_MAX;
+}
+
+/**
+ * dump_fragmentation - Report free columns when a request can not be placed
+ * @xrs: Solver state
+ * @ncols: Number of columns requested
+ */
+static void dump_fragmentation(struct solver_state *xrs, u32 ncols)
+{
+	u32 total = xrs->cfg.total_col;
+	u32 largest = 0;
+	u32 start, end;
+
+	for_each_clear_bitrange(start, end, xrs->rgp.resbit, total)
+		largest = max(largest, end - start);
+
+	drm_dbg(xrs->cfg.ddev, "Request ncols %u, free cols %u, largest free range %u\n",
+		ncols, total - bitmap_weight(xrs->rgp.resbit, total), largest);
+}
+
 /**
  * is_valid_start_col - Check if the requested start column is valid per XCLBIN metadata
  * @snode: Solver node containing valid start columns from XCLBIN
@@ -139,8 +228,8 @@ static inline bool is_valid_start_col(struct solver_node *snode, u32 col)
  * @snode: Solver node requesting partition
  * @req: Allocation request details
  *
- * Scans available columns in snode->start_cols and checks bitmap for free space.
- * Allocates a new partition node if space is available.
+ * Picks the best fit free partition among snode->start_cols, see
+ * find_best_fit_col(). Allocates a new partition node if space is available.
  *
  * Returns: 0 on success, -ENODEV if no free partition, -ENOMEM if allocation fails.
  */
@@ -151,23 +240,16 @@ static int allocate_partition_exclusive(struct solver_state *xrs,
 	struct partition_node *pt_node;
 	u32 ncols = req->cdo.ncols;
 	u32 col;
-	u32 i;
 
 	drm_dbg(xrs->cfg.ddev, "Allocating new exclusive partition\n");
 
 	if (req->rqos.user_start_col == USER_START_COL_NOT_REQUESTED) {
-		for (i = 0; i < snode->cols_len; i++) {
-			col = snode->start_cols[i];
-			if (is_partition_free(xrs, col, ncols)) {
-				drm_dbg(xrs->cfg.ddev,
-					"Found free exclusive partition at col=%u\n", col);
-				break;
-			}
-		}
-		if (i == snode->cols_len) {
+		if (!find_best_fit_col(xrs, snode, ncols, false, &col)) {
 			drm_err(xrs->cfg.ddev, "No free exclusive partition found\n");
+			dump_fragmentation(xrs, ncols);
 			return -ENODEV; /* No free partition found */
 		}
+		drm_dbg(xrs->cfg.ddev, "Found free exclusive partition at col=%u\n", col);
 	} else {
 		col = req->rqos.user_start_col;
 
@@ -283,21 +365,10 @@ static int allocate_partition_shared(struct solver_state *xrs,
 	/* STEP 1: Check if requested or any column is free */
 	if (req->rqos.user_start_col == USER_START_COL_NOT_REQUESTED) {
 		drm_dbg(xrs->cfg.ddev, "Searching for free shared partition\n");
-		for (idx = 0; idx < snode->cols_len; idx++) {
-			candidate_col = snode->start_cols[idx];
-
-			/* Skip if this range is already exclusively allocated */
-			if (is_exclusive_partition(xrs, candidate_col, ncols))
-				continue;
-
-			/* Try to find a free column range */
-			if (is_partition_free(xrs, candidate_col, ncols)) {
-				is_free = true;
-				drm_dbg(xrs->cfg.ddev,
-					"Found free shared partition at col=%u\n", candidate_col);
-				break;
-			}
-		}
+		is_free = find_best_fit_col(xrs, snode, ncols, true, &candidate_col);
+		if (is_free)
+			drm_dbg(xrs->cfg.ddev,
+				"Found free shared partition at col=%u\n", candidate_col);
 	} else {
 		candidate_col = req->rqos.user_start_col;
 
@@ -337,13 +408,13 @@ static int allocate_partition_shared(struct solver_state *xrs,
 		return 0;
 	}
 
-	/* STEP 3: Reuse least-used partition */
+	/* STEP 3: Reuse least-used partition among all valid start columns */
 	if (req->rqos.user_start_col == USER_START_COL_NOT_REQUESTED) {
+		candidate_col = USER_START_COL_NOT_REQUESTED;
 		for (idx = 0; idx < snode->cols_len; idx++) {
-			candidate_col = snode->start_cols[idx];
-			least_used = find_least_used_partition(xrs, candidate_col, ncols);
-			if (least_used)
-				break;
+			pt_node = find_least_used_partition(xrs, snode->start_cols[idx], ncols);
+			if (pt_node && (!least_used || pt_node->nshared < least_used->nshared))
+				least_used = pt_node;
 		}
 	} else {
 		candidate_col = req->rqos.user_start_col;
@@ -360,6 +431,7 @@ static int allocate_partition_shared(struct solver_state *xrs,
 	if (!least_used) {
 		drm_err(xrs->cfg.ddev, "No available shared partition for col=%u ncols=%u\n",
 			candidate_col, ncols);
+		dump_fragmentation(xrs, ncols);
 		return -ENODEV;
 	}
 
@@ -224,6 +224,67 @@ int main(void)
 }
 EOF
 
+# Test drm_gem_shmem_create_with_mnt() in 6.8+:
+# struct drm_gem_shmem_object *drm_gem_shmem_create_with_mnt(struct drm_device *dev,
+#							      size_t size, struct vfsmount *gemfs)
+try_compile HAVE_drm_gem_shmem_create_with_mnt << 'EOF'
+#include <drm/drm_gem_shmem_helper.h>
+int main(void)
+{
+	struct drm_device *a = NULL;
+	struct vfsmount *b = NULL;
+
+	(void)drm_gem_shmem_create_with_mnt(a, 0, b);
+	return 0;
+}
+EOF
+
+# Test vmf_insert_folio_pmd() in 6.15+:
+# vm_fault_t vmf_insert_folio_pmd(struct vm_fault *vmf, struct folio *folio,
+#				  bool write)
+try_compile HAVE_vmf_insert_folio_pmd << 'EOF'
+#include <linux/huge_mm.h>
+int main(void)
+{
+	struct vm_fault *a = NULL;
+	struct folio *b = NULL;
+
+	(void)vmf_insert_folio_pmd(a, b, false);
+	return 0;
+}
+EOF
+
+# Test io_uring command passthrough with io_uring_sqe_cmd() in 6.7+:
+# static inline const void *io_uring_sqe_cmd(const struct io_uring_sqe *sqe)
+try_compile HAVE_io_uring_sqe_cmd << 'EOF'
+#include <linux/fs.h>
+#include <linux/io_uring/cmd.h>
+static int conftest_uring_cmd(struct io_uring_cmd *a, unsigned int b)
+{
+	return a->cmd_op + (io_uring_sqe_cmd(a->sqe) ? 0 : 1);
+}
+int main(void)
+{
+	struct file_operations a = { .uring_cmd = conftest_uring_cmd };
+
+	(void)a;
+	return 0;
+}
+EOF
+
+# Test shrinker_alloc() in 6.7+:
+# struct shrinker *shrinker_alloc(unsigned int flags, const char *fmt, ...)
+try_compile HAVE_shrinker_alloc << 'EOF'
+#include <linux/shrinker.h>
+int main(void)
+{
+	struct shrinker *a = shrinker_alloc(0, "conftest");
+
+	shrinker_free(a);
+	return 0;
+}
+EOF
+
 # ---- Header trailer ----------------------------------------------------
 
 cat >> "$OUT" <<EOF
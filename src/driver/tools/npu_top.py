@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2025, Advanced Micro Devices, Inc.
+
+"""Live top-style view of the contexts running on an amdxdna device.
+
+Every interval, all contexts are fetched with one DRM_AMDXDNA_HW_CONTEXT_STATS
+query, which is served from driver counters without waking up the device or
+sending anything to firmware. Rates are the difference of two snapshots:
+
+  util    device time of the context over the interval, from exec_ns
+  sub/s   commands submitted per second
+  cmp/s   commands completed per second
+  depth   commands submitted but not completed
+  qdelay  average time a completed command waited before being sent to device
+
+The header shows power mode, clocks and power sensors. If debugfs is readable,
+average mailbox latency over the interval is shown as well. Contexts are
+sorted by utilization, so the busiest tenants come first.
+"""
+
+import argparse
+import ctypes
+import errno
+import fcntl
+import glob
+import json
+import os
+import sys
+import time
+
+DRM_COMMAND_BASE = 0x40
+DRM_AMDXDNA_GET_INFO = 7
+DRM_AMDXDNA_GET_ARRAY = 10
+
+DRM_AMDXDNA_QUERY_CLOCK_METADATA = 3
+DRM_AMDXDNA_QUERY_SENSORS = 4
+DRM_AMDXDNA_GET_POWER_MODE = 9
+DRM_AMDXDNA_HW_CONTEXT_ALL = 0
+DRM_AMDXDNA_HW_CONTEXT_STATS = 13
+AMDXDNA_MAX_NUM_ELEMENT = 1024
+AMDXDNA_HWCTX_STATE_ACTIVE = 1
+
+POWER_MODES = ["default", "low", "medium", "high", "turbo"]
+
+
+class GetInfo(ctypes.Structure):
+    _fields_ = [("param", ctypes.c_uint32), ("buffer_size", ctypes.c_uint32),
+                ("buffer", ctypes.c_uint64)]
+
+
+class GetArray(ctypes.Structure):
+    _fields_ = [("param", ctypes.c_uint32), ("element_size", ctypes.c_uint32),
+                ("num_element", ctypes.c_uint32), ("pad", ctypes.c_uint32),
+                ("buffer", ctypes.c_uint64)]
+
+
+# struct amdxdna_drm_hwctx_entry
+class HwctxEntry(ctypes.Structure):
+    _fields_ = [(n, ctypes.c_uint32) for n in
+                ("context_id", "start_col", "num_col", "hwctx_id")] + \
+               [("pid", ctypes.c_int64)] + \
+               [(n, ctypes.c_uint64) for n in
+                ("command_submissions", "command_completions", "migrations",
+                 "preemptions", "errors", "priority", "heap_usage", "suspensions")] + \
+               [(n, ctypes.c_uint32) for n in
+                ("state", "pasid", "gops", "fps", "dma_bandwidth", "latency",
+                 "frame_exec_time", "txn_op_idx", "ctx_pc", "fatal_error_type",
+                 "fatal_error_exception_type", "fatal_error_exception_pc",
+                 "fatal_error_app_module", "pad")] + \
+               [(n, ctypes.c_uint64) for n in
+                ("connections", "queue_delay_ns", "exec_ns", "deadline_misses",
+                 "poll_hits", "poll_misses", "generation", "queue_full")]
+
+
+class Clock(ctypes.Structure):
+    _fields_ = [("name", ctypes.c_char * 16), ("freq_mhz", ctypes.c_uint32),
+                ("pad", ctypes.c_uint32)]
+
+
+class Sensor(ctypes.Structure):
+    _fields_ = [("label", ctypes.c_char * 64), ("input", ctypes.c_uint32),
+                ("max", ctypes.c_uint32), ("average", ctypes.c_uint32),
+                ("highest", ctypes.c_uint32), ("status", ctypes.c_char * 64),
+                ("units", ctypes.c_char * 16), ("unitm", ctypes.c_int8),
+                ("type", ctypes.c_uint8), ("pad", ctypes.c_uint8 * 6)]
+
+
+def drm_iowr(nr, size):
+    return (3 << 30) | (size << 16) | (ord("d") << 8) | (DRM_COMMAND_BASE + nr)
+
+
+class Device:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR)
+        self.minor = os.path.basename(path).replace("accel", "")
+        # Drivers without HW_CONTEXT_STATS fall back to the heavier query
+        self.ctx_param = DRM_AMDXDNA_HW_CONTEXT_STATS
+        self.num_element = 32
+
+    def get_info(self, param, buf):
+        arg = GetInfo(param, ctypes.sizeof(buf), ctypes.addressof(buf))
+        fcntl.ioctl(self.fd, drm_iowr(DRM_AMDXDNA_GET_INFO, ctypes.sizeof(arg)), arg)
+        return arg.buffer_size
+
+    def contexts(self):
+        while True:
+            buf = (HwctxEntry * self.num_element)()
+            arg = GetArray(self.ctx_param, ctypes.sizeof(HwctxEntry), self.num_element, 0,
+                           ctypes.addressof(buf))
+            try:
+                fcntl.ioctl(self.fd, drm_iowr(DRM_AMDXDNA_GET_ARRAY, ctypes.sizeof(arg)), arg)
+            except OSError as e:
+                if e.errno == errno.ENOSPC and arg.num_element > self.num_element:
+                    self.num_element = min(arg.num_element, AMDXDNA_MAX_NUM_ELEMENT)
+                    continue
+                if e.errno in (errno.EINVAL, errno.EOPNOTSUPP) and \
+                        self.ctx_param == DRM_AMDXDNA_HW_CONTEXT_STATS:
+                    self.ctx_param = DRM_AMDXDNA_HW_CONTEXT_ALL
+                    continue
+                raise
+            return list(buf[:arg.num_element])
+
+    def power_mode(self):
+        buf = (ctypes.c_uint8 * 8)()
+        try:
+            self.get_info(DRM_AMDXDNA_GET_POWER_MODE, buf)
+        except OSError:
+            return "n/a"
+        return POWER_MODES[buf[0]] if buf[0] < len(POWER_MODES) else str(buf[0])
+
+    def clocks(self):
+        buf = (Clock * 2)()
+        try:
+            self.get_info(DRM_AMDXDNA_QUERY_CLOCK_METADATA, buf)
+        except OSError:
+            return []
+        return [(c.name.decode(errors="replace"), c.freq_mhz) for c in buf if c.name]
+
+    def sensors(self):
+        buf = (Sensor * 8)()
+        try:
+            size = self.get_info(DRM_AMDXDNA_QUERY_SENSORS, buf)
+        except OSError:
+            return []
+        out = []
+        for s in buf[:min(size // ctypes.sizeof(Sensor), len(buf))]:
+            # Driver reports UINT32_MAX when it can't read the sensor
+            value = None if s.input == 0xffffffff else s.input * 10 ** s.unitm
+            out.append((s.label.decode(errors="replace"), value))
+        return out
+
+    def mbox_latency(self):
+        """(count, total_us) over all mailbox messages, None if not readable."""
+        path = "/sys/kernel/debug/accel/%s/msg_latency" % self.minor
+        try:
+            with open(path) as f:
+                lines = f.readlines()[2:]
+        except OSError:
+            return None
+        count, total = 0, 0
+        for line in lines:
+            cols = line.split()
+            if len(cols) < 5:
+                continue
+            count += int(cols[2])
+            total += int(cols[2]) * int(cols[3])
+        return count, total
+
+
+def find_device():
+    for path in sorted(glob.glob("/sys/class/accel/accel*")):
+        drv = os.path.realpath(os.path.join(path, "device", "driver"))
+        if os.path.basename(drv) == "amdxdna":
+            return "/dev/accel/" + os.path.basename(path)
+    return None
+
+
+def snapshot(dev, with_mbox):
+    return {"time": time.monotonic(), "ctx": {(c.pid, c.context_id): c for c in dev.contexts()},
+            "mbox": dev.mbox_latency() if with_mbox else None}
+
+
+def rates(prev, cur):
+    dt = cur["time"] - prev["time"]
+    rows = []
+    for key, c in cur["ctx"].items():
+        p = prev["ctx"].get(key)
+        d_sub = c.command_submissions - (p.command_submissions if p else 0)
+        d_cmp = c.command_completions - (p.command_completions if p else 0)
+        d_exec = c.exec_ns - (p.exec_ns if p else 0)
+        d_qd = c.queue_delay_ns - (p.queue_delay_ns if p else 0)
+        rows.append({
+            "pid": c.pid, "ctx": c.context_id,
+            "cols": "%d-%d" % (c.start_col, c.start_col + c.num_col - 1) if c.num_col else "-",
+            "state": "active" if c.state == AMDXDNA_HWCTX_STATE_ACTIVE else "idle",
+            "prio": c.priority,
+            "util": d_exec / (dt * 1e9) * 100 if dt else 0,
+            "sub_per_sec": d_sub / dt if dt else 0,
+            "cmp_per_sec": d_cmp / dt if dt else 0,
+            "depth": c.command_submissions - c.command_completions,
+            "qdelay_us": d_qd / d_cmp / 1000 if d_cmp else 0,
+            "preemptions": c.preemptions, "migrations": c.migrations,
+            "deadline_misses": c.deadline_misses,
+        })
+    rows.sort(key=lambda r: (-r["util"], -r["sub_per_sec"]))
+    mbox = None
+    if prev["mbox"] and cur["mbox"] and cur["mbox"][0] > prev["mbox"][0]:
+        mbox = (cur["mbox"][1] - prev["mbox"][1]) / (cur["mbox"][0] - prev["mbox"][0])
+    return rows, mbox
+
+
+def render(dev, rows, mbox, batch):
+    out = []
+    clocks = ", ".join("%s %d MHz" % c for c in dev.clocks()) or "n/a"
+    power = ", ".join("%s %s" % (l, "n/a" if v is None else "%.3f W" % v)
+                      for l, v in dev.sensors()) or "n/a"
+    out.append("power mode %s | clocks %s | %s" % (dev.power_mode(), clocks, power))
+    out.append("contexts %d | util %.1f%% | mailbox latency %s" %
+               (len(rows), sum(r["util"] for r in rows),
+                "n/a" if mbox is None else "%.1f us" % mbox))
+    out.append("")
+    out.append("%8s %5s %6s %6s %4s %6s %9s %9s %6s %9s %7s %6s" %
+               ("pid", "ctx", "cols", "state", "prio", "util%", "sub/s", "cmp/s",
+                "depth", "qdelay_us", "preempt", "migr"))
+    for r in rows:
+        out.append("%8d %5d %6s %6s %4d %6.1f %9.1f %9.1f %6d %9.1f %7d %6d" %
+                   (r["pid"], r["ctx"], r["cols"], r["state"], r["prio"], r["util"],
+                    r["sub_per_sec"], r["cmp_per_sec"], r["depth"], r["qdelay_us"],
+                    r["preemptions"], r["migrations"]))
+    if not batch:
+        sys.stdout.write("\x1b[H\x1b[2J")
+    print("\n".join(out), flush=True)
+    if batch:
+        print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-d", "--device", help="accel device node, first amdxdna one if omitted")
+    parser.add_argument("-i", "--interval", type=int, default=1000, help="refresh period in ms")
+    parser.add_argument("-n", "--iterations", type=int, default=0,
+                        help="stop after this many refreshes, 0 runs until interrupted")
+    parser.add_argument("-b", "--batch", action="store_true",
+                        help="append each refresh instead of redrawing the screen")
+    parser.add_argument("--json", action="store_true",
+                        help="print one JSON object per refresh, implies --batch")
+    parser.add_argument("--no-mbox", action="store_true",
+                        help="don't read mailbox latency from debugfs")
+    opts = parser.parse_args()
+
+    path = opts.device or find_device()
+    if not path:
+        sys.exit("No amdxdna device found")
+    dev = Device(path)
+
+    prev = snapshot(dev, not opts.no_mbox)
+    n = 0
+    try:
+        while not opts.iterations or n < opts.iterations:
+            time.sleep(opts.interval / 1000)
+            cur = snapshot(dev, not opts.no_mbox)
+            rows, mbox = rates(prev, cur)
+            prev = cur
+            n += 1
+            if opts.json:
+                print(json.dumps({"time": cur["time"], "power_mode": dev.power_mode(),
+                                  "mbox_latency_us": mbox, "contexts": rows}), flush=True)
+            else:
+                render(dev, rows, mbox, opts.batch)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
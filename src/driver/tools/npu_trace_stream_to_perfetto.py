@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2025, Advanced Micro Devices, Inc.
+
+"""Convert a shim trace stream (Debug.trace_stream) into Chrome trace JSON.
+
+The output loads in ui.perfetto.dev. Host submit/wait events and firmware
+log/trace entries are all placed on CLOCK_MONOTONIC, so one timeline shows a
+command from submission, through firmware, to completion.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+FILE_HEADER = struct.Struct("<8sIIQ")
+FRAME_HEADER = struct.Struct("<HHIQ")
+CMD_PAYLOAD = struct.Struct("<QQ")
+FW_PAYLOAD = struct.Struct("<Q")
+
+EV_FW_CLOCK = 1
+EV_CMD_SUBMIT = 2
+EV_CMD_WAIT_BEGIN = 3
+EV_CMD_WAIT_END = 4
+EV_FW_TRACE = 5
+EV_FW_LOG = 6
+
+# Firmware DPT entry framing, see aie2_dpt.c
+DPT_MAGIC_HEAD = 0xCA
+DPT_MAGIC_FOOTER = 0xBA
+DPT_HEADER = struct.Struct("<BBHI")
+DPT_FOOTER = struct.Struct("<IHBB")
+
+
+def dpt_entries(data):
+    """Yield (seq, payload) of every intact entry in a raw DPT chunk."""
+    p = 0
+    while len(data) - p >= DPT_HEADER.size:
+        magic, words, seq, _ = DPT_HEADER.unpack_from(data, p)
+        size = DPT_HEADER.size + words * 8 + DPT_FOOTER.size
+        if magic == DPT_MAGIC_HEAD and len(data) - p >= size:
+            _, fseq, fwords, fmagic = DPT_FOOTER.unpack_from(data, p + size - DPT_FOOTER.size)
+            if fmagic == DPT_MAGIC_FOOTER and seq and fseq == seq and fwords == words:
+                yield seq, data[p + DPT_HEADER.size:p + size - DPT_FOOTER.size]
+                p += size
+                continue
+        p += 4
+
+
+def frames(buf):
+    off = FILE_HEADER.size
+    while len(buf) - off >= FRAME_HEADER.size:
+        etype, _, size, ts = FRAME_HEADER.unpack_from(buf, off)
+        off += FRAME_HEADER.size
+        if len(buf) - off < size:
+            break
+        yield etype, ts, buf[off:off + size]
+        off += (size + 7) & ~7
+
+
+def convert(buf):
+    magic, version, pid, _ = FILE_HEADER.unpack_from(buf, 0)
+    if magic != b"XDNATRC\0" or version != 1:
+        raise ValueError("not a version 1 xdna trace stream")
+
+    events = [
+        {"ph": "M", "name": "process_name", "pid": pid, "args": {"name": "xrt host"}},
+        {"ph": "M", "name": "process_name", "pid": 0, "args": {"name": "npu firmware"}},
+    ]
+    waits = {}
+    clock_offset = 0
+    for etype, ts, payload in frames(buf):
+        us = ts / 1000.0
+        if etype == EV_FW_CLOCK:
+            clock_offset = struct.unpack_from("<q", payload)[0]
+        elif etype in (EV_CMD_SUBMIT, EV_CMD_WAIT_BEGIN, EV_CMD_WAIT_END):
+            bo, seq = CMD_PAYLOAD.unpack_from(payload)
+            args = {"bo": bo, "seq": seq}
+            if etype == EV_CMD_SUBMIT:
+                events.append({"ph": "b", "cat": "cmd", "name": "cmd", "id": "%d:%d" % (bo, seq),
+                               "pid": pid, "tid": 0, "ts": us, "args": args})
+            elif etype == EV_CMD_WAIT_BEGIN:
+                waits[(bo, seq)] = us
+            else:
+                events.append({"ph": "e", "cat": "cmd", "name": "cmd", "id": "%d:%d" % (bo, seq),
+                               "pid": pid, "tid": 0, "ts": us, "args": args})
+                begin = waits.pop((bo, seq), None)
+                if begin is not None:
+                    events.append({"ph": "X", "name": "wait", "pid": pid, "tid": 1,
+                                   "ts": begin, "dur": us - begin, "args": args})
+        elif etype in (EV_FW_TRACE, EV_FW_LOG):
+            name = "fw_trace" if etype == EV_FW_TRACE else "fw_log"
+            for seq, entry in dpt_entries(payload[FW_PAYLOAD.size:]):
+                if len(entry) < 8:
+                    continue
+                # First payload word of each entry is the firmware timestamp in ns
+                fw_ts = struct.unpack_from("<Q", entry)[0]
+                events.append({"ph": "i", "s": "t", "name": name, "pid": 0,
+                               "tid": etype, "ts": (fw_ts - clock_offset) / 1000.0,
+                               "args": {"seq": seq, "raw": entry[8:].hex()}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="trace stream written by the shim")
+    parser.add_argument("-o", "--output", help="output JSON file (default stdout)")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        out = convert(f.read())
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(out, f)
+    else:
+        json.dump(out, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
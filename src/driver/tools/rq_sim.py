@@ -0,0 +1,912 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2025, Advanced Micro Devices, Inc.
+
+"""Replay context/command traces against a model of the aie2 runqueue.
+
+The policy part of amdxdna/aie2_ctx_runqueue.c (partition selection, priority
+queues ordered by vruntime or deadline, blocking, yield, stealing and idle
+handling) is mirrored here, function by function, on top of a simple device
+model. Each partition executes one command at a time, in submission order
+across its connected contexts. Work items run one after another on a single
+worker, as under dev_lock, and connect/disconnect keep the worker busy for a
+fixed cost. Partition reconfiguration (rq_parts_work) is not modelled, the
+columns are split evenly by the widest context like rq_part_init() does.
+
+Policy changes in the driver must be mirrored here by hand. Names follow the
+driver so that the two can be compared side by side.
+
+Trace is CSV, one event per line, time in us, '#' starts a comment:
+
+  time,create,ctx,priority,gops,latency_ms,fps,num_col
+  time,submit,ctx,exec_us
+  time,run,ctx,count,exec_us,think_us,depth
+  time,destroy,ctx
+
+priority is one of realtime, high, normal, low. 'run' is a closed loop, it
+keeps depth commands in flight and submits the next one think_us after a
+command completes, until count commands are submitted. Without a trace file
+a reproducible synthetic one is generated from --seed.
+"""
+
+import argparse
+import collections
+import csv
+import heapq
+import json
+import math
+import random
+import sys
+
+CTX_RQ_REALTIME = 0
+CTX_RQ_HIGH = 1
+CTX_RQ_NORMAL = 2
+CTX_RQ_LOW = 3
+CTX_RQ_NUM_QUEUE = 4
+PRIO_NAMES = ["realtime", "high", "normal", "low"]
+
+CTX_STATE_DISCONNECTED = 0
+CTX_STATE_DISPATCHED = 1
+CTX_STATE_CONNECTED = 2
+CTX_STATE_DISCONNECTING = 3
+
+# Same as aie2_ctx_runqueue.c
+RQ_CTX_IDLE_COUNT = 3
+RQ_CTX_WARM_IDLE_COUNT = 10
+RQ_CTX_IDLE_MIN_US = 100 * 1000
+RQ_CTX_GAP_MAX_US = 5000 * 1000
+RQ_CTX_EVICT_REGRET_US = 1000 * 1000
+RQ_DEFAULT_CONN_US = 5000
+RQ_DEFAULT_WEIGHT = 100
+RQ_MAX_WEIGHT = 100000
+# timeout_in_sec of aie2_tdr.c, idle contexts are checked at this pace
+TDR_PERIOD_US = 2 * 1000 * 1000
+
+
+class Ctx:
+    def __init__(self, cid, prio, gops, latency_ms, fps, num_col, opts):
+        self.name = "ctx%s" % cid
+        self.priority = prio
+        # qos_to_rq_weight()
+        self.weight = min(max(gops, 1), RQ_MAX_WEIGHT) if gops else RQ_DEFAULT_WEIGHT
+        # qos_to_rq_deadline()
+        self.deadline_us = 0
+        if opts.rt_deadline and prio == CTX_RQ_REALTIME:
+            if latency_ms:
+                self.deadline_us = latency_ms * 1000
+            elif fps:
+                self.deadline_us = 1000000 // fps
+        self.deadline = 0
+        self.orig_num_col = num_col
+        self.status = CTX_STATE_DISCONNECTED
+        self.part = None
+        self.vruntime = 0
+        self.submitted = 0
+        self.completed = 0
+        self.should_block = False
+        self.force_yield = False
+        self.active = False
+        self.idle_cnt = 0
+        self.last_start_col = 0
+        self.last_num_col = 0
+        self.last_done = 0
+        self.burst_gap = 0
+        self.evict_time = None
+        self.ready_at = 0
+        self.destroyed = False
+        # Commands waiting for the context to be connected, job_pending_cnt
+        self.pending = collections.deque()
+        self.loop = None
+        # Statistics
+        self.latency = []
+        self.exec_us = 0
+        self.conn_cnt = 0
+        self.evict_cnt = 0
+        self.evict_regret_cnt = 0
+        self.preempt_cnt = 0
+        self.migrate_cnt = 0
+        self.wait_us = 0
+
+    def is_rt(self):
+        return self.priority == CTX_RQ_REALTIME
+
+
+class Partition:
+    def __init__(self, rq, start_col, num_col):
+        self.rq = rq
+        self.start_col = start_col
+        self.num_col = num_col
+        self.max_hwctx = 0
+        self.max_rt_ctx = 0
+        self.runqueue = [[] for _ in range(CTX_RQ_NUM_QUEUE)]
+        self.conn_list = []
+        self.ctx_cnt = 0
+        self.hwctx_cnt = 0
+        self.rt_ctx_cnt = 0
+        self.migrate_in = 0
+        self.migrate_out = 0
+        # Firmware model
+        self.fw_queue = collections.deque()
+        self.fw_busy = False
+        self.busy_us = 0
+
+
+class Sim:
+    def __init__(self, opts):
+        self.opts = opts
+        self.now = 0
+        self.events = []
+        self.seq = 0
+        self.ctxs = {}
+        self.disconn_list = []
+        self.work = collections.deque()
+        self.work_queued = set()
+        self.worker_free = 0
+        self.worker_armed = False
+        self.parts = []
+        self.rt_ctx_cnt = 0
+        self.affinity_hit = 0
+        self.affinity_miss = 0
+        self.end = 0
+        self.stuck = 0
+        self.rejected = 0
+        self.ctx_cnt = 0
+
+    # Event loop
+    def at(self, t, fn, *args):
+        heapq.heappush(self.events, (t, self.seq, fn, args))
+        self.seq += 1
+
+    def queue_work(self, fn, obj):
+        key = (fn, id(obj))
+        if key in self.work_queued:
+            return
+        self.work_queued.add(key)
+        self.work.append((fn, obj))
+        if not self.worker_armed:
+            self.worker_armed = True
+            self.at(max(self.now, self.worker_free), self.run_worker)
+
+    def run_worker(self):
+        self.worker_armed = False
+        if not self.work:
+            return
+        fn, obj = self.work.popleft()
+        self.work_queued.discard((fn, id(obj)))
+        self.worker_free = self.now
+        fn(obj)
+        if self.work:
+            self.worker_armed = True
+            self.at(max(self.now, self.worker_free), self.run_worker)
+
+    def worker_cost(self, us):
+        self.worker_free += us
+        return self.worker_free
+
+    # Partition setup, rq_part_init() and rq_part_ctx_limit_calc()
+    def part_init(self, max_cols):
+        num_col = max_cols if max_cols else 1
+        num_parts = min(self.opts.cols // num_col, self.opts.hwctx_limit)
+        self.parts = [Partition(self, i * num_col, num_col) for i in range(num_parts)]
+        self.part_limits_update()
+
+    def part_limits_update(self):
+        num_parts = len(self.parts)
+        average_rt = self.rt_ctx_cnt // num_parts
+        more_rt_i = self.rt_ctx_cnt - average_rt * num_parts
+        for i, part in enumerate(self.parts):
+            part.max_hwctx = self.opts.hwctx_limit // num_parts
+            part.max_rt_ctx = min(average_rt + 1 if i < more_rt_i else average_rt,
+                                  part.max_hwctx)
+
+    # Helpers of aie2_ctx_runqueue.c
+    @staticmethod
+    def ctx_runs_before(a, b):
+        if a.deadline_us or b.deadline_us:
+            if not b.deadline_us:
+                return True
+            if not a.deadline_us:
+                return False
+            return a.deadline < b.deadline
+        return a.vruntime < b.vruntime
+
+    @staticmethod
+    def part_max_non_rt_hwctx(part):
+        return part.max_hwctx - part.max_rt_ctx
+
+    def part_connect_is_full(self, part):
+        return part.hwctx_cnt - part.rt_ctx_cnt >= self.part_max_non_rt_hwctx(part)
+
+    @staticmethod
+    def part_waiting_ctx_cnt(part):
+        return part.ctx_cnt - part.hwctx_cnt
+
+    @staticmethod
+    def part_place_vruntime(part, ctx):
+        vr = [c.vruntime for c in part.conn_list if c.priority == ctx.priority]
+        if vr and ctx.vruntime < min(vr):
+            ctx.vruntime = min(vr)
+
+    def remove_from_lists(self, ctx):
+        if ctx in self.disconn_list:
+            self.disconn_list.remove(ctx)
+        for part in self.parts:
+            if ctx in part.conn_list:
+                part.conn_list.remove(ctx)
+            for q in part.runqueue:
+                if ctx in q:
+                    q.remove(ctx)
+
+    def part_ctx_dispatch(self, part, ctx):
+        self.part_place_vruntime(part, ctx)
+        if ctx.deadline_us:
+            ctx.deadline = self.now + ctx.deadline_us
+        self.remove_from_lists(ctx)
+        q = part.runqueue[ctx.priority]
+        pos = len(q)
+        for i, curr in enumerate(q):
+            if self.ctx_runs_before(ctx, curr):
+                pos = i
+                break
+        q.insert(pos, ctx)
+        part.ctx_cnt += 1
+        if ctx.is_rt():
+            part.rt_ctx_cnt += 1
+        ctx.status = CTX_STATE_DISPATCHED
+        ctx.part = part
+        ctx.active = True
+        ctx.idle_cnt = 0
+
+    def ctx_idle_long_enough(self, ctx):
+        threshold = max(2 * ctx.burst_gap, RQ_CTX_IDLE_MIN_US)
+        return self.now - ctx.last_done >= threshold
+
+    def part_handle_idle_ctx(self, part, force):
+        if not part.hwctx_cnt:
+            return False
+        waiting = self.part_waiting_ctx_cnt(part)
+        found = False
+        for ctx in list(part.conn_list):
+            if ctx.submitted == ctx.completed:
+                ctx.idle_cnt += 1
+            else:
+                ctx.idle_cnt = 0
+            if not ctx.idle_cnt:
+                evict = False
+            elif force:
+                evict = True
+            elif waiting:
+                evict = ctx.idle_cnt >= self.opts.idle_count or \
+                    (not self.opts.no_learned_idle and self.ctx_idle_long_enough(ctx))
+            else:
+                evict = ctx.idle_cnt >= self.opts.warm_idle_count
+            if evict:
+                ctx.force_yield = True
+                ctx.status = CTX_STATE_DISCONNECTING
+                ctx.active = False
+                ctx.idle_cnt = 0
+                ctx.evict_time = self.now
+                ctx.evict_cnt += 1
+                self.queue_work(self.rq_yield_work, ctx)
+                found = True
+                if waiting:
+                    waiting -= 1
+        return found
+
+    def rq_part_rt_select(self):
+        best = None
+        for part in self.parts:
+            if part.rt_ctx_cnt == part.max_rt_ctx:
+                continue
+            if best is None or best.rt_ctx_cnt > part.rt_ctx_cnt:
+                best = part
+        return best
+
+    def part_non_rt_load_cmp(self, a, b):
+        load_a = (a.ctx_cnt - a.rt_ctx_cnt) * self.part_max_non_rt_hwctx(b)
+        load_b = (b.ctx_cnt - b.rt_ctx_cnt) * self.part_max_non_rt_hwctx(a)
+        if load_a == load_b:
+            return 0
+        return -1 if load_a < load_b else 1
+
+    def rq_part_non_rt_select(self):
+        best = None
+        for part in self.parts:
+            if part.max_hwctx == part.max_rt_ctx:
+                continue
+            if best is None:
+                best = part
+                continue
+            cmp = self.part_non_rt_load_cmp(part, best)
+            if cmp > 0:
+                continue
+            if cmp < 0 or best.max_rt_ctx > part.max_rt_ctx:
+                best = part
+        return best
+
+    def rq_part_last_connected(self, ctx):
+        if not ctx.last_num_col:
+            return None
+        for part in self.parts:
+            if part.start_col == ctx.last_start_col and part.num_col == ctx.last_num_col:
+                return part
+        return None
+
+    def rq_part_select(self, ctx):
+        rt = ctx.is_rt()
+        best = self.rq_part_rt_select() if rt else self.rq_part_non_rt_select()
+        if not self.opts.affinity:
+            return best
+        last = self.rq_part_last_connected(ctx)
+        if last is None or best is None:
+            return best
+        hit = last is best
+        if not hit and rt:
+            hit = last.rt_ctx_cnt < last.max_rt_ctx and last.rt_ctx_cnt <= best.rt_ctx_cnt
+        elif not hit and last.max_hwctx != last.max_rt_ctx:
+            hit = (not self.part_connect_is_full(last) or
+                   not self.part_non_rt_load_cmp(last, best))
+        if hit:
+            self.affinity_hit += 1
+            return last
+        self.affinity_miss += 1
+        return best
+
+    @staticmethod
+    def select_next_ctx(part, ctx):
+        if part.ctx_cnt == part.hwctx_cnt:
+            return None
+        i = 0
+        if ctx is not None:
+            q = part.runqueue[ctx.priority]
+            idx = q.index(ctx)
+            if idx + 1 < len(q):
+                return q[idx + 1]
+            i = ctx.priority + 1
+        while i < CTX_RQ_NUM_QUEUE:
+            if part.runqueue[i]:
+                return part.runqueue[i][0]
+            i += 1
+        return None
+
+    def insert_ctx_to_conn_list(self, part, new):
+        self.remove_from_lists(new)
+        pos = len(part.conn_list)
+        for i, curr in enumerate(part.conn_list):
+            if curr.priority >= new.priority:
+                pos = i
+                break
+        part.conn_list.insert(pos, new)
+        part.hwctx_cnt += 1
+
+    @staticmethod
+    def select_ctx_to_block(part, prio):
+        ret = None
+        for ctx in reversed(part.conn_list):
+            if ctx.priority < prio or ctx.should_block:
+                continue
+            if ret is None:
+                ret = ctx
+                continue
+            if ctx.priority != ret.priority:
+                break
+            if ctx.vruntime > ret.vruntime:
+                ret = ctx
+        return ret
+
+    def part_ctx_start(self, part, ctx):
+        ctx.ready_at = self.worker_cost(self.opts.conn_us)
+        ctx.conn_cnt += 1
+        self.insert_ctx_to_conn_list(part, ctx)
+        ctx.status = CTX_STATE_CONNECTED
+        self.at(ctx.ready_at, self.ctx_connected, ctx)
+
+    def part_ctx_stop(self, ctx):
+        self.worker_cost(self.opts.disconn_us)
+        self.remove_from_lists(ctx)
+        self.disconn_list.append(ctx)
+        ctx.status = CTX_STATE_DISCONNECTED
+        part = ctx.part
+        if part is not None:
+            part.hwctx_cnt -= 1
+            part.ctx_cnt -= 1
+            if ctx.is_rt():
+                part.rt_ctx_cnt -= 1
+            ctx.last_start_col = part.start_col
+            ctx.last_num_col = part.num_col
+        ctx.part = None
+        ctx.idle_cnt = 0
+
+    def part_select_ctx_to_steal(self, part):
+        victim = None
+        for p in self.parts:
+            if p is part or not self.part_connect_is_full(p) or not self.part_waiting_ctx_cnt(p):
+                continue
+            if victim is None or self.part_waiting_ctx_cnt(p) > self.part_waiting_ctx_cnt(victim):
+                victim = p
+        if victim is None:
+            return None, None
+        for q in range(CTX_RQ_HIGH, CTX_RQ_NUM_QUEUE):
+            for ctx in victim.runqueue[q]:
+                if ctx.orig_num_col > part.num_col:
+                    continue
+                return ctx, victim
+        return None, None
+
+    def part_steal_ctx(self, part):
+        if not self.opts.steal:
+            return None
+        ctx, src = self.part_select_ctx_to_steal(part)
+        if ctx is None:
+            return None
+        src.ctx_cnt -= 1
+        src.migrate_out += 1
+        self.part_ctx_dispatch(part, ctx)
+        part.migrate_in += 1
+        ctx.migrate_cnt += 1
+        return ctx
+
+    def part_sched_work(self, part):
+        while True:
+            nxt = self.select_next_ctx(part, None)
+            if nxt is None and not self.part_connect_is_full(part):
+                nxt = self.part_steal_ctx(part)
+            if nxt is None:
+                break
+            if not nxt.is_rt() and self.part_connect_is_full(part):
+                break
+            self.part_ctx_start(part, nxt)
+
+        if not self.part_connect_is_full(part):
+            return
+
+        while nxt is not None:
+            curr = self.select_ctx_to_block(part, nxt.priority)
+            if curr is None:
+                break
+            curr.should_block = True
+            curr.preempt_cnt += 1
+            if not curr.pending and curr.submitted == curr.completed:
+                curr.status = CTX_STATE_DISCONNECTING
+                self.queue_work(self.rq_yield_work, curr)
+            nxt = self.select_next_ctx(part, nxt)
+
+    def rq_yield_work(self, ctx):
+        part = ctx.part
+        if part is None or ctx.submitted != ctx.completed:
+            ctx.force_yield = False
+            return
+        if part.ctx_cnt <= part.hwctx_cnt and not ctx.force_yield:
+            if not self.part_connect_is_full(part):
+                ctx.should_block = False
+            ctx.status = CTX_STATE_CONNECTED
+            ctx.force_yield = False
+            self.flush_pending(ctx)
+            return
+        ctx.should_block = False
+        self.part_ctx_stop(ctx)
+        self.queue_work(self.part_sched_work, part)
+        if ctx.pending:
+            self.queue_work(self.rq_dispatch_work, ctx)
+        ctx.force_yield = False
+
+    def rq_kick_stealers(self, part):
+        if not self.part_connect_is_full(part):
+            return
+        for p in self.parts:
+            if p is not part and not self.part_connect_is_full(p):
+                self.queue_work(self.part_sched_work, p)
+
+    def rq_dispatch_work(self, ctx):
+        if ctx.status != CTX_STATE_DISCONNECTED or ctx.destroyed:
+            return
+        part = self.rq_part_select(ctx)
+        if part is None:
+            # WARN_ON(!part) in the driver, partitions would be resized first
+            self.stuck += 1
+            ctx.pending.clear()
+            return
+        self.part_ctx_dispatch(part, ctx)
+        self.queue_work(self.part_sched_work, part)
+        self.rq_kick_stealers(part)
+
+    def rq_handle_idle_ctx(self):
+        for ctx in self.disconn_list:
+            if not ctx.active:
+                continue
+            ctx.idle_cnt += 1
+            if ctx.idle_cnt == RQ_CTX_IDLE_COUNT:
+                ctx.active = False
+                ctx.idle_cnt = 0
+
+        ctx_total = 0
+        for part in self.parts:
+            ctx_total += part.ctx_cnt
+            self.part_handle_idle_ctx(part, False)
+
+        if not self.opts.rebalance:
+            return
+        average = ctx_total // len(self.parts)
+        remainder = ctx_total - average * len(self.parts)
+        for part in self.parts:
+            num_move = part.ctx_cnt - (average + 1 if remainder else average)
+            for ctx in part.conn_list:
+                if num_move <= 0:
+                    break
+                ctx.force_yield = True
+                ctx.status = CTX_STATE_DISCONNECTING
+                ctx.active = False
+                ctx.idle_cnt = 0
+                self.queue_work(self.rq_yield_work, ctx)
+                num_move -= 1
+
+    def aie2_rq_account(self, ctx, start):
+        if start < ctx.last_done:
+            start = ctx.last_done
+        ctx.last_done = self.now
+        if self.now <= start:
+            return
+        delta = self.now - start
+        ctx.exec_us += delta
+        ctx.vruntime += delta * RQ_DEFAULT_WEIGHT / ctx.weight
+
+    def aie2_rq_yield(self, ctx):
+        if not ctx.should_block:
+            return
+        ctx.status = CTX_STATE_DISCONNECTING
+        if ctx.submitted == ctx.completed:
+            self.queue_work(self.rq_yield_work, ctx)
+
+    # Submission and firmware model
+    def submit(self, ctx, exec_us):
+        if ctx.destroyed:
+            return
+        cmd = {"submit": self.now, "exec": exec_us}
+        if ctx.status == CTX_STATE_CONNECTED:
+            self.fw_push(ctx, cmd)
+            return
+        ctx.pending.append(cmd)
+        if ctx.status == CTX_STATE_DISCONNECTED:
+            self.queue_work(self.rq_dispatch_work, ctx)
+
+    def flush_pending(self, ctx):
+        while ctx.pending and ctx.status == CTX_STATE_CONNECTED:
+            self.fw_push(ctx, ctx.pending.popleft())
+
+    def ctx_connected(self, ctx):
+        self.flush_pending(ctx)
+
+    def rq_burst_start(self, ctx):
+        if ctx.evict_time is not None:
+            if self.now - ctx.evict_time < RQ_CTX_EVICT_REGRET_US:
+                ctx.evict_regret_cnt += 1
+            ctx.evict_time = None
+        if not ctx.last_done or self.now <= ctx.last_done:
+            return
+        gap = min(self.now - ctx.last_done, RQ_CTX_GAP_MAX_US)
+        ctx.burst_gap = (3 * ctx.burst_gap + gap) // 4 if ctx.burst_gap else gap
+
+    def fw_push(self, ctx, cmd):
+        if ctx.submitted == ctx.completed:
+            self.rq_burst_start(ctx)
+        ctx.submitted += 1
+        cmd["ctx"] = ctx
+        part = ctx.part
+        part.fw_queue.append(cmd)
+        self.fw_kick(part)
+
+    def fw_kick(self, part):
+        if part.fw_busy or not part.fw_queue:
+            return
+        ready = [c for c in part.fw_queue if c["ctx"].ready_at <= self.now]
+        if not ready:
+            self.at(min(c["ctx"].ready_at for c in part.fw_queue), self.fw_kick, part)
+            return
+        cmd = ready[0]
+        part.fw_queue.remove(cmd)
+        part.fw_busy = True
+        cmd["start"] = self.now
+        cmd["ctx"].wait_us += self.now - cmd["submit"]
+        self.at(self.now + cmd["exec"], self.fw_done, part, cmd)
+
+    def fw_done(self, part, cmd):
+        ctx = cmd["ctx"]
+        part.fw_busy = False
+        part.busy_us += cmd["exec"]
+        ctx.completed += 1
+        ctx.latency.append(self.now - cmd["submit"])
+        self.aie2_rq_account(ctx, cmd["start"])
+        if ctx.loop:
+            self.loop_next(ctx)
+        self.aie2_rq_yield(ctx)
+        if ctx.destroyed and ctx.completed == ctx.submitted and not ctx.pending:
+            self.ctx_del(ctx)
+        self.fw_kick(part)
+        self.end = max(self.end, self.now)
+
+    # Trace events
+    # aie2_rq_add(), a context rejected here ignores the rest of its trace
+    def create(self, cid, prio, gops, latency_ms, fps, num_col):
+        ctx = Ctx(cid, prio, gops, latency_ms, fps, num_col, self.opts)
+        self.ctxs[cid] = ctx
+        if (self.ctx_cnt == self.opts.ctx_limit or self.rt_ctx_cnt == self.opts.hwctx_limit or
+                (self.ctx_cnt > self.rt_ctx_cnt and ctx.is_rt() and
+                 self.rt_ctx_cnt + 1 == self.opts.hwctx_limit) or
+                num_col > self.opts.cols):
+            ctx.status = None
+            self.rejected += 1
+            return
+        self.ctx_cnt += 1
+        self.disconn_list.append(ctx)
+        if ctx.is_rt():
+            self.rt_ctx_cnt += 1
+            self.part_limits_update()
+
+    def loop_start(self, ctx, count, exec_us, think_us, depth):
+        ctx.loop = {"left": count, "exec": exec_us, "think": think_us}
+        for _ in range(min(depth, count)):
+            ctx.loop["left"] -= 1
+            self.submit(ctx, exec_us)
+
+    def loop_next(self, ctx):
+        if not ctx.loop["left"] or ctx.destroyed:
+            return
+        ctx.loop["left"] -= 1
+        self.at(self.now + ctx.loop["think"], self.submit, ctx, ctx.loop["exec"])
+
+    def destroy(self, ctx):
+        ctx.destroyed = True
+        ctx.pending.clear()
+        if ctx.completed == ctx.submitted and not ctx.pending:
+            self.ctx_del(ctx)
+
+    def ctx_del(self, ctx):
+        if ctx.status is None:
+            return
+        self.ctx_cnt -= 1
+        part = ctx.part
+        if part is not None:
+            if ctx in part.conn_list:
+                part.hwctx_cnt -= 1
+            part.ctx_cnt -= 1
+            if ctx.is_rt():
+                part.rt_ctx_cnt -= 1
+        self.remove_from_lists(ctx)
+        ctx.part = None
+        ctx.status = None
+        if ctx.is_rt():
+            self.rt_ctx_cnt -= 1
+            self.part_limits_update()
+        if part is not None:
+            self.queue_work(self.part_sched_work, part)
+
+    def tick(self):
+        self.rq_handle_idle_ctx()
+        if self.events:
+            self.at(self.now + self.opts.tick_ms * 1000, self.tick)
+
+    def run(self, trace):
+        max_cols = max((e[4][4] for e in trace if e[1] == "create"), default=1)
+        self.part_init(max_cols)
+        for t, ev, cid, _, args in trace:
+            if ev == "create":
+                self.at(t, self.create, cid, *args)
+            else:
+                self.at(t, self.trace_event, ev, cid, args)
+        self.at(self.opts.tick_ms * 1000, self.tick)
+        while self.events:
+            t, _, fn, args = heapq.heappop(self.events)
+            if self.opts.duration_ms and t > self.opts.duration_ms * 1000:
+                break
+            self.now = t
+            fn(*args)
+
+    def trace_event(self, ev, cid, args):
+        ctx = self.ctxs[cid]
+        if ctx.status is None:
+            return
+        if ev == "submit":
+            self.submit(ctx, args[0])
+        elif ev == "run":
+            self.loop_start(ctx, *args)
+        elif ev == "destroy":
+            self.destroy(ctx)
+
+
+def parse_prio(s):
+    s = s.strip().lower()
+    if s.isdigit():
+        return int(s)
+    return PRIO_NAMES.index(s)
+
+
+def load_trace(path):
+    trace = []
+    with open(path, newline="") as f:
+        for n, row in enumerate(csv.reader(f)):
+            row = [c.strip() for c in row]
+            if not row or not row[0] or row[0].startswith("#"):
+                continue
+            if not row[0].isdigit():
+                continue  # header
+            t, ev, cid = int(row[0]), row[1], row[2]
+            if ev == "create":
+                args = (parse_prio(row[3]),) + tuple(int(x or 0) for x in row[4:8])
+            elif ev in ("submit", "run"):
+                args = tuple(int(x or 0) for x in row[3:])
+            elif ev == "destroy":
+                args = ()
+            else:
+                sys.exit("line %d: unknown event %s" % (n + 1, ev))
+            trace.append((t, ev, cid, n, args))
+    trace.sort(key=lambda e: (e[0], e[3]))
+    return trace
+
+
+def gen_trace(num_ctx, duration_ms, seed):
+    """A mix of steady, bursty and realtime contexts sharing the device."""
+    rnd = random.Random(seed)
+    trace = []
+    end = duration_ms * 1000
+    for i in range(num_ctx):
+        # Few RT contexts, each of them reserves a hwctx
+        if i % 6 == 5:
+            kind = "rt"
+        else:
+            kind = rnd.choices(["steady", "bursty", "low"], [4, 3, 1])[0]
+        start = rnd.randrange(0, end // 10)
+        if kind == "rt":
+            fps = rnd.choice([30, 60])
+            exec_us = rnd.randrange(1000, 4000)
+            trace.append((start, "create", str(i), i, (CTX_RQ_REALTIME, 0, 0, fps, 1)))
+            count = (end - start) * fps // 1000000
+            trace.append((start, "run", str(i), i, (count, exec_us, 1000000 // fps - exec_us, 1)))
+        elif kind in ("steady", "low"):
+            prio = CTX_RQ_NORMAL if kind == "steady" else CTX_RQ_LOW
+            gops = rnd.choice([0, 0, 50, 200])
+            exec_us = rnd.randrange(500, 5000)
+            trace.append((start, "create", str(i), i, (prio, gops, 0, 0, 1)))
+            count = (end - start) // exec_us
+            trace.append((start, "run", str(i), i, (count, exec_us, 0, rnd.choice([1, 2, 4]))))
+        else:
+            trace.append((start, "create", str(i), i, (CTX_RQ_NORMAL, 0, 0, 0, 1)))
+            t = start
+            while t < end:
+                for _ in range(rnd.randrange(5, 50)):
+                    trace.append((t, "submit", str(i), i, (rnd.randrange(200, 2000),)))
+                t += rnd.randrange(200000, 3000000)
+        trace.append((end, "destroy", str(i), i, ()))
+    trace.sort(key=lambda e: (e[0], e[3]))
+    return trace
+
+
+def dump_trace(trace, path):
+    with open(path, "w") as f:
+        f.write("# time_us,event,ctx,args\n")
+        for t, ev, cid, _, args in trace:
+            if ev == "create":
+                args = (PRIO_NAMES[args[0]],) + args[1:]
+            f.write(",".join(str(x) for x in (t, ev, cid) + tuple(args)) + "\n")
+
+
+def percentile(sorted_vals, p):
+    if not sorted_vals:
+        return 0
+    rank = max(int(math.ceil(p * len(sorted_vals))), 1)
+    return sorted_vals[rank - 1]
+
+
+def jain(vals):
+    if not vals or not any(vals):
+        return 1.0
+    return sum(vals) ** 2 / (len(vals) * sum(v * v for v in vals))
+
+
+def report(sim):
+    out = {"duration_us": sim.end, "contexts": [], "fairness": {},
+           "affinity_hit": sim.affinity_hit, "affinity_miss": sim.affinity_miss,
+           "partitions": [], "rejected": sim.rejected, "stuck": sim.stuck}
+    by_prio = collections.defaultdict(list)
+    for ctx in sim.ctxs.values():
+        lat = sorted(ctx.latency)
+        out["contexts"].append({
+            "name": ctx.name, "priority": PRIO_NAMES[ctx.priority], "weight": ctx.weight,
+            "cmds": ctx.completed, "exec_us": ctx.exec_us,
+            "p50_us": percentile(lat, 0.5), "p99_us": percentile(lat, 0.99),
+            "max_us": lat[-1] if lat else 0,
+            "connects": ctx.conn_cnt, "preempts": ctx.preempt_cnt,
+            "migrates": ctx.migrate_cnt, "evictions": ctx.evict_cnt,
+            "regretted": ctx.evict_regret_cnt,
+        })
+        if ctx.completed:
+            by_prio[ctx.priority].append(ctx.exec_us / ctx.weight)
+    for prio, vals in sorted(by_prio.items()):
+        out["fairness"][PRIO_NAMES[prio]] = jain(vals)
+    for part in sim.parts:
+        out["partitions"].append({
+            "start_col": part.start_col, "num_col": part.num_col,
+            "busy": part.busy_us / sim.end if sim.end else 0,
+            "migrate_in": part.migrate_in, "migrate_out": part.migrate_out,
+        })
+    return out
+
+
+def print_report(out):
+    print("%-8s %-8s %6s %8s %12s %10s %10s %10s %5s %5s %5s" %
+          ("context", "priority", "weight", "cmds", "exec_us", "p50_us", "p99_us",
+           "max_us", "conn", "prmt", "migr"))
+    for c in out["contexts"]:
+        print("%-8s %-8s %6d %8d %12d %10d %10d %10d %5d %5d %5d" %
+              (c["name"], c["priority"], c["weight"], c["cmds"], c["exec_us"],
+               c["p50_us"], c["p99_us"], c["max_us"], c["connects"],
+               c["preempts"], c["migrates"]))
+    print()
+    for i, p in enumerate(out["partitions"]):
+        print("partition %d [%d, %d] busy %.1f%% migrate in %d out %d" %
+              (i, p["start_col"], p["start_col"] + p["num_col"] - 1, p["busy"] * 100,
+               p["migrate_in"], p["migrate_out"]))
+    total = sum(c["cmds"] for c in out["contexts"])
+    secs = out["duration_us"] / 1000000
+    print("throughput %.1f cmds/s over %.3f s" % (total / secs if secs else 0, secs))
+    print("affinity hit %d miss %d" % (out["affinity_hit"], out["affinity_miss"]))
+    print("idle evictions %d regretted %d" % (sum(c["evictions"] for c in out["contexts"]),
+                                              sum(c["regretted"] for c in out["contexts"])))
+    if out["rejected"] or out["stuck"]:
+        print("contexts rejected %d, without partition %d" % (out["rejected"], out["stuck"]))
+    for prio, f in out["fairness"].items():
+        print("fairness (Jain, exec/weight) %-8s %.3f" % (prio, f))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("trace", nargs="?", help="trace CSV, synthetic if omitted")
+    parser.add_argument("--seed", type=int, default=1, help="seed of synthetic trace")
+    parser.add_argument("--num-ctx", type=int, default=12, help="contexts in synthetic trace")
+    parser.add_argument("--dump-trace", help="write the synthetic trace to a file")
+    parser.add_argument("--duration-ms", type=int,
+                        help="length of synthetic trace (default 10000), or cut-off of a replay")
+    parser.add_argument("--cols", type=int, default=4, help="total columns")
+    parser.add_argument("--hwctx-limit", type=int, default=6, help="hwctx_limit")
+    parser.add_argument("--ctx-limit", type=int, default=64, help="context_limit")
+    parser.add_argument("--conn-us", type=int, default=RQ_DEFAULT_CONN_US,
+                        help="cost of connecting a context")
+    parser.add_argument("--disconn-us", type=int, default=RQ_DEFAULT_CONN_US,
+                        help="cost of disconnecting a context")
+    parser.add_argument("--tick-ms", type=int, default=TDR_PERIOD_US // 1000,
+                        help="period of idle context handling")
+    parser.add_argument("--idle-count", type=int, default=RQ_CTX_IDLE_COUNT)
+    parser.add_argument("--warm-idle-count", type=int, default=RQ_CTX_WARM_IDLE_COUNT)
+    parser.add_argument("--no-learned-idle", action="store_true",
+                        help="evict idle contexts by tick count only, not by burst gap")
+    parser.add_argument("--rt-deadline", action="store_true",
+                        help="rt_deadline_sched, order RT contexts by deadline")
+    parser.add_argument("--no-affinity", dest="affinity", action="store_false",
+                        help="ignore the partition a context was last connected to")
+    parser.add_argument("--no-steal", dest="steal", action="store_false",
+                        help="idle partitions don't steal waiting contexts")
+    parser.add_argument("--no-rebalance", dest="rebalance", action="store_false",
+                        help="idle handling doesn't even out contexts across partitions")
+    parser.add_argument("--json", help="write the report as JSON to a file")
+    opts = parser.parse_args()
+
+    if opts.trace:
+        trace = load_trace(opts.trace)
+    else:
+        trace = gen_trace(opts.num_ctx, opts.duration_ms or 10000, opts.seed)
+        if opts.dump_trace:
+            dump_trace(trace, opts.dump_trace)
+        opts.duration_ms = 0
+
+    sim = Sim(opts)
+    sim.run(trace)
+    out = report(sim)
+    print_report(out)
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump(out, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -58,6 +58,9 @@ extern "C" {
 #define	DRM_AMDXDNA_SET_STATE		8
 #define	DRM_AMDXDNA_WAIT_CMD		9
 #define DRM_AMDXDNA_GET_ARRAY		10
+#define DRM_AMDXDNA_WAIT_CMDS		11
+#define DRM_AMDXDNA_SYNC_BOS		12
+#define DRM_AMDXDNA_MEM_NOTIFY		13
 
 #define	AMDXDNA_DEV_TYPE_UNKNOWN	-1
 #define	AMDXDNA_DEV_TYPE_KMQ		0
@@ -92,7 +95,7 @@ extern "C" {
  * @frame_exec_time: Frame execution time.
  * @priority: Request priority.
  * @user_start_col: User preferred start column, or USER_START_COL_NOT_REQUESTED if not specified.
- * @reserved: Padding for 64-bit alignment (MBZ, reserved for future use).
+ * @preempt_mode: How higher priority contexts may preempt this one, AMDXDNA_PREEMPT_MODE_*.
  *
  * User program can provide QoS hints to driver.
  */
@@ -104,9 +107,22 @@ struct amdxdna_qos_info {
 	__u32 frame_exec_time;
 	__u32 priority;
 	__u32 user_start_col;
-	__u32 reserved; /* ensure 64-bit alignment */
+	__u32 preempt_mode;
 };
 
+/*
+ * DEFAULT follows the device wide frame boundary preemption state and is
+ * preempted only when an RT context is about to miss its deadline. NONE is
+ * never forcibly preempted, for throughput. FRAME and FINE are also
+ * preempted whenever a latency critical (RT, or with QoS latency) context of
+ * higher priority runs on the same columns, at frame boundary or at the
+ * finest granularity firmware supports.
+ */
+#define AMDXDNA_PREEMPT_MODE_DEFAULT	0
+#define AMDXDNA_PREEMPT_MODE_NONE	1
+#define AMDXDNA_PREEMPT_MODE_FRAME	2
+#define AMDXDNA_PREEMPT_MODE_FINE	3
+
 /**
  * struct amdxdna_drm_create_hwctx - Create context.
  * @ext: MBZ.
@@ -120,6 +136,18 @@ struct amdxdna_qos_info {
  * @umq_doorbell: Returned offset of doorbell associated with UMQ.
  * @handle: Returned context handle.
  * @syncobj_handle: The drm timeline syncobj handle for command completion notification.
+ * @dev_heap: Handle of AMDXDNA_BO_DEV_HEAP BO context runs on, 0 for first
+ *            heap of the client. Device BOs used by the context must be
+ *            allocated from this heap.
+ * @queue_depth: Max number of commands of the context in flight, power of 2,
+ *               0 for driver default. Deeper queue keeps device busy, shallow
+ *               queue bounds time commands wait in queue.
+ * @flags: AMDXDNA_CTX_CREATE_* flags.
+ * @ready_syncobj: Returned with AMDXDNA_CTX_CREATE_ASYNC, handle of binary
+ *                 syncobj signaled once context is ready to run.
+ * @out_flags: MBZ, returned AMDXDNA_CTX_OUT_* flags.
+ * @pad: MBZ, keeps the struct free of implicit padding. Room for another
+ *       returned field.
  */
 struct amdxdna_drm_create_hwctx {
 	__u64 ext;
@@ -133,6 +161,23 @@ struct amdxdna_drm_create_hwctx {
 	__u32 umq_doorbell;
 	__u32 handle;
 	__u32 syncobj_handle;
+	__u32 dev_heap;
+	__u32 queue_depth;
+/*
+ * Return as soon as context is set up on host instead of waiting for device
+ * partitions to be reconfigured for it. Commands may be submitted right away,
+ * they run once context is ready.
+ */
+#define AMDXDNA_CTX_CREATE_ASYNC	(1 << 0)
+	__u32 flags;
+	__u32 ready_syncobj;
+/*
+ * Device is already committed to more QoS GOPS than it can deliver at its
+ * highest DPM level, context is admitted but its QoS is not guaranteed.
+ */
+#define AMDXDNA_CTX_OUT_QOS_DEGRADED	(1 << 0)
+	__u32 out_flags;
+	__u32 pad;
 };
 
 /**
@@ -202,6 +247,30 @@ struct fw_buffer_metadata {
 	struct uc_info_entry uc_info[];
 };
 
+/**
+ * struct amdxdna_log_ring - Header of a log buffer written in ring format.
+ * @magic: AMDXDNA_LOG_RING_MAGIC once producer has set the ring up.
+ * @size: Size of data following the header in bytes, power of 2.
+ * @prod: Bytes ever written by producer, written by producer only.
+ * @cons: Bytes ever read by consumer, written by consumer only.
+ * @data: Log data, byte prod is at data[prod & (size - 1)].
+ *
+ * prod and cons sit on cachelines of their own, so that a consumer reading
+ * through a non coherent mapping only invalidates what producer writes and
+ * only writes back cons. Producer may overwrite bytes not read yet, consumer
+ * finds out by prod - cons being larger than size.
+ */
+struct amdxdna_log_ring {
+#define AMDXDNA_LOG_RING_MAGIC	0x474f4c58 /* "XLOG" */
+	__u32 magic;
+	__u32 size;
+	__u64 prod;
+	__u8 pad0[48];
+	__u64 cons;
+	__u8 pad1[56];
+	__u8 data[];
+};
+
 /**
  * struct amdxdna_drm_config_hwctx - Configure context.
  * @handle: Context handle.
@@ -213,6 +282,27 @@ struct fw_buffer_metadata {
  *
  * Note: if the param_val is a pointer pointing to a buffer, the maximum size
  * of the buffer is 4KiB(PAGE_SIZE).
+ *
+ * BOs added by DRM_AMDXDNA_HWCTX_ADD_RESIDENT_BO (param_val is BO handle) are
+ * used by all commands of the context without being passed in
+ * amdxdna_drm_exec_cmd. Removing a resident BO waits for the commands
+ * submitted before to complete.
+ *
+ * DRM_AMDXDNA_HWCTX_CONFIG_TDR_TIMEOUT (param_val is milliseconds) sets how
+ * long the context may have outstanding commands without completing any
+ * before it is recovered. 0 restores the default, derived from QoS latency
+ * or the driver wide timeout.
+ *
+ * DRM_AMDXDNA_HWCTX_UMQ_DOORBELL (param_val is unused) tells VE2 firmware that
+ * packets up to the write index of the user mode queue are ready, see
+ * AMDXDNA_VE2_UMQ_OFFSET.
+ *
+ * DRM_AMDXDNA_HWCTX_BUILD_CMDLIST (param_val points to struct
+ * amdxdna_drm_build_cmdlist) prebuilds the firmware command list of a chain.
+ *
+ * DRM_AMDXDNA_HWCTX_QUEUE_DEPTH (param_val is number of slots, power of 2)
+ * resizes the VE2 HSA queue, which bounds commands in flight. Context must be
+ * idle, not active on its partition and its queue not mapped to user.
  */
 struct amdxdna_drm_config_hwctx {
 	__u32 handle;
@@ -220,12 +310,29 @@ struct amdxdna_drm_config_hwctx {
 #define DRM_AMDXDNA_HWCTX_ASSIGN_DBG_BUF	1
 #define DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF	2
 #define DRM_AMDXDNA_HWCTX_CONFIG_OPCODE_TIMEOUT	3
+#define DRM_AMDXDNA_HWCTX_ADD_RESIDENT_BO	4
+#define DRM_AMDXDNA_HWCTX_REMOVE_RESIDENT_BO	5
+#define DRM_AMDXDNA_HWCTX_CONFIG_TDR_TIMEOUT	6
+#define DRM_AMDXDNA_HWCTX_UMQ_DOORBELL		7
+#define DRM_AMDXDNA_HWCTX_BUILD_CMDLIST		8
+#define DRM_AMDXDNA_HWCTX_QUEUE_DEPTH		9
 	__u32 param_type;
 	__u64 param_val;
 	__u32 param_val_size;
 	__u32 pad;
 };
 
+/*
+ * VE2 user mode queue. mmap() of the DRM fd at AMDXDNA_VE2_UMQ_OFFSET(handle)
+ * maps the HSA queue of the context, followed by one 64-bit completion state
+ * per slot, read/write. From then on, user writes packets and the write index
+ * and rings DRM_AMDXDNA_HWCTX_UMQ_DOORBELL; DRM_IOCTL_AMDXDNA_EXEC_CMD is
+ * rejected for the context. DRM_IOCTL_AMDXDNA_WAIT_CMD still waits for the
+ * read index to pass seq, while the completion state is left to user.
+ */
+#define AMDXDNA_VE2_UMQ_SHIFT		20
+#define AMDXDNA_VE2_UMQ_OFFSET(handle)	((__u64)(handle) << AMDXDNA_VE2_UMQ_SHIFT)
+
 /**
  * struct amdxdna_drm_va_entry
  * @vaddr: Virtual address.
@@ -252,40 +359,69 @@ struct amdxdna_drm_va_tbl {
  * struct amdxdna_drm_create_bo - Create a buffer object.
  * @flags: Buffer flags.
  *         Bits [7:0] - CMA memory region index for allocation.
- *         Bits [63:8] - Reserved for other flags.
+ *         Bit 8 - AMDXDNA_BO_FLAG_WC, map BO write-combined for CPU.
+ *         Bit 9 - AMDXDNA_BO_FLAG_SVA, device accesses user pointer directly.
+ *         Bits [63:10] - Reserved for other flags.
  * @vaddr: Pointer of va address table.
  * @size: Size in bytes.
  * @type: Buffer type.
  * @handle: Returned DRM buffer object handle.
+ * @heap: For AMDXDNA_BO_DEV, handle of AMDXDNA_BO_DEV_HEAP BO to allocate
+ *        from, 0 for first heap of the client.
+ * @pad: MBZ.
  */
 struct amdxdna_drm_create_bo {
 	__u64	flags;
+/*
+ * CPU only writes the BO and device only reads it, e.g. instruction
+ * buffer. Pages are mapped write-combined, so no cache flush is needed
+ * before device reads it. Only supported by AMDXDNA_BO_SHARE and
+ * AMDXDNA_BO_CMD backed by shmem pages.
+ */
+#define	AMDXDNA_BO_FLAG_WC	(1ULL << 8)
+/*
+ * User pointer AMDXDNA_BO_SHARE with a single entry va table. Device
+ * accesses the memory at the user address through process PASID and IO
+ * page faults, nothing is pinned or mapped by driver. The BO can't be
+ * mmap'ed or exported, user syncs CPU cache through its own mapping.
+ * Fails with -EOPNOTSUPP if device or platform does not support it.
+ */
+#define	AMDXDNA_BO_FLAG_SVA	(1ULL << 9)
 	__u64	vaddr;
 	__u64	size;
 #define	AMDXDNA_BO_INVALID	0 /* Invalid BO type */
 #define	AMDXDNA_BO_SHARE	1 /* Regular BO shared between user and device */
+/*
+ * A client may create several heaps, e.g. one per context, each with its own
+ * allocator. Device addresses of all heaps start from the same base.
+ */
 #define	AMDXDNA_BO_DEV_HEAP	2 /* Shared host memory to device as heap memory */
 #define	AMDXDNA_BO_DEV		3 /* Allocated from BO_DEV_HEAP */
 #define	AMDXDNA_BO_CMD		4 /* Same as share BO, used only by XRT internally */
 	__u32	type;
 	__u32	handle;
+	__u32	heap;
+	__u32	pad;
 };
 
 /**
  * struct amdxdna_drm_get_bo_info - Get buffer object information.
  * @ext: MBZ.
- * @ext_flags: MBZ.
- * @handle: DRM buffer object handle.
- * @pad: Structure padding.
+ * @ext_flags: AMDXDNA_BO_INFO_FROM_FD or 0.
+ * @handle: DRM buffer object handle. With AMDXDNA_BO_INFO_FROM_FD, dma-buf fd
+ *          to be imported as input and returned DRM buffer object handle.
+ * @nr_segs: Returned number of DMA segments backing the buffer. 0 if the
+ *           buffer has no DMA mapping yet.
  * @map_offset: Returned DRM fake offset for mmap().
  * @vaddr: Returned user VA of buffer. 0 in case user needs mmap().
  * @xdna_addr: Returned XDNA device virtual address.
  */
 struct amdxdna_drm_get_bo_info {
 	__u64 ext;
+#define AMDXDNA_BO_INFO_FROM_FD	(1 << 0) /* Import dma-buf fd and describe it */
 	__u64 ext_flags;
 	__u32 handle;
-	__u32 pad;
+	__u32 nr_segs;
 	__u64 map_offset;
 	__u64 vaddr;
 	__u64 xdna_addr;
@@ -307,6 +443,68 @@ struct amdxdna_drm_sync_bo {
 	__u64 size;
 };
 
+/**
+ * struct amdxdna_drm_sync_bos - Sync multiple buffer object ranges.
+ * @bos: User pointer to an array of struct amdxdna_drm_sync_bo.
+ * @count: Number of entries, up to AMDXDNA_SYNC_BOS_MAX.
+ * @pad: MBZ.
+ *
+ * Ranges are synced in array order. On error, ranges before the failing one
+ * are synced, rest are left as is.
+ */
+struct amdxdna_drm_sync_bos {
+	__u64 bos;
+#define AMDXDNA_SYNC_BOS_MAX		256
+	__u32 count;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_build_cmdlist - Prebuild command list of a chain.
+ * @cmd_handle: ERT_CMD_CHAIN command BO.
+ * @list_handle: AMDXDNA_BO_DEV BO receiving the command list, or
+ *               AMDXDNA_INVALID_BO_HANDLE to drop the prebuilt one.
+ * @offsets: Optional user pointer to @count __u32, receiving offset of each
+ *           slot in list BO, followed by the end of the last slot.
+ * @count: Number of entries @offsets has room for, command_count + 1.
+ * @pad: MBZ.
+ *
+ * Sub commands of the chain are looked up, validated and converted into list
+ * BO once. Submitting the chain command BO afterwards sends list BO as is.
+ * Arguments of a sub command are at the end of its slot, same length as in
+ * the sub command, and may be updated in list BO in place while the chain is
+ * not running. The chain must not be changed afterwards, other than sub
+ * command arguments in list BO, submitting it with a different number of sub
+ * commands fails. Building again or dropping waits for commands submitted to
+ * the context before to complete. Failing to rebuild into the list BO in use
+ * drops it.
+ */
+struct amdxdna_drm_build_cmdlist {
+	__u32 cmd_handle;
+	__u32 list_handle;
+	__u64 offsets;
+	__u32 count;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_uring_cmd - io_uring command passthrough on the accel fd.
+ * @arg: User pointer to the argument of the ioctl given by cmd_op.
+ * @pad: MBZ.
+ *
+ * IORING_OP_URING_CMD with cmd_op set to one of DRM_IOCTL_AMDXDNA_EXEC_CMD,
+ * DRM_IOCTL_AMDXDNA_WAIT_CMD, DRM_IOCTL_AMDXDNA_WAIT_CMDS,
+ * DRM_IOCTL_AMDXDNA_SYNC_BO or DRM_IOCTL_AMDXDNA_SYNC_BOS does what the
+ * ioctl does. This struct is placed in the SQE cmd area, no SQE128 needed.
+ * CQE res is what the ioctl would return, output fields of the argument are
+ * written back the same way. Commands are run by io_uring worker, as all of
+ * them may sleep. Other cmd_op values complete with -EOPNOTSUPP.
+ */
+struct amdxdna_uring_cmd {
+	__u64 arg;
+	__u64 pad;
+};
+
 /**
  * struct amdxdna_drm_exec_cmd - Execute command.
  * @ext: MBZ.
@@ -314,11 +512,21 @@ struct amdxdna_drm_sync_bo {
  * @ctx: Context handle.
  * @type: Command type.
  * @cmd_handles: Array of command handles or the command handle itself
- *               in case of just one.
+ *               in case of just one. For AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY,
+ *               array of struct amdxdna_drm_wait_cmd, naming commands of
+ *               any contexts of this client to wait for. Timeout is ignored.
  * @args: Array of arguments for all command handles.
  * @cmd_count: Number of command handles in the cmd_handles array.
- * @arg_count: Number of arguments in the args array.
- * @seq: Returned sequence number for this command.
+ *             For AMDXDNA_CMD_SUBMIT_EXEC_BUF, each command handle is submitted
+ *             as an independent command and they get consecutive sequence
+ *             numbers. On return, it is updated to the number of commands
+ *             submitted. It is less than given if the context has no room
+ *             for more, or if submission fails, and the rest can be
+ *             submitted again.
+ * @arg_count: Number of arguments in the args array. MBZ for
+ *             AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY.
+ * @seq: Returned sequence number for this command, or the last command in
+ *       case of more than one.
  */
 struct amdxdna_drm_exec_cmd {
 	__u64 ext;
@@ -327,9 +535,11 @@ struct amdxdna_drm_exec_cmd {
 #define	AMDXDNA_CMD_SUBMIT_EXEC_BUF	0
 #define	AMDXDNA_CMD_SUBMIT_DEPENDENCY	1
 #define	AMDXDNA_CMD_SUBMIT_SIGNAL	2
+#define	AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY	3
 	__u32 type;
 	__u64 cmd_handles;
 	__u64 args;
+#define AMDXDNA_EXEC_CMD_MAX_BATCH	64
 	__u32 cmd_count;
 	__u32 arg_count;
 	__u64 seq;
@@ -350,6 +560,33 @@ struct amdxdna_drm_wait_cmd {
 	__u64 seq;
 };
 
+/**
+ * struct amdxdna_drm_wait_cmds - Wait multiple exectuion commands.
+ *
+ * @cmds: User pointer to an array of struct amdxdna_drm_wait_cmd. The timeout
+ *        field of each entry is ignored.
+ * @completed: User pointer to a bitmap of __u64 words, one bit per command.
+ *             On return, bit i is set if command i is completed.
+ * @count: Number of commands, up to AMDXDNA_WAIT_CMDS_MAX.
+ * @flags: AMDXDNA_WAIT_CMDS_ALL to wait for all commands, otherwise wait
+ *         for any of them.
+ * @timeout: timeout in ms, 0 implies infinite wait.
+ * @pad: Structure padding.
+ *
+ * Commands can belong to different contexts of the same client. The
+ * completed bitmap is also returned when the wait timed out.
+ */
+struct amdxdna_drm_wait_cmds {
+	__u64 cmds;
+	__u64 completed;
+#define AMDXDNA_WAIT_CMDS_MAX		256
+	__u32 count;
+#define AMDXDNA_WAIT_CMDS_ALL		(1 << 0)
+	__u32 flags;
+	__u32 timeout;
+	__u32 pad;
+};
+
 /**
  * struct amdxdna_drm_query_aie_status - Query the status of the AIE hardware
  * @buffer: The user space buffer that will return the AIE status.
@@ -578,6 +815,32 @@ struct amdxdna_drm_get_resource_info {
 	__u64 npu_task_curr;
 };
 
+/**
+ * struct amdxdna_drm_query_mem_info - Memory of calling client
+ * @heap_size: Total size of dev heaps, which are pinned as a whole.
+ * @heap_used: Bytes of dev heaps handed out to dev BOs.
+ * @heap_free: Bytes of dev heaps a dev BO can still be allocated from.
+ * @heap_largest_free: Largest dev BO which can be allocated without adding a
+ *                     dev heap.
+ * @bo_usage: Total size of BOs of client, dev heaps included.
+ * @internal_bo_usage: Part of @bo_usage allocated by driver for its own use.
+ * @heap_count: Number of dev heaps.
+ * @heap_max_count: Number of dev heaps a client can have.
+ *
+ * Served from driver accounting, without waking up device or taking locks
+ * shared with other clients, so that it can be asked before allocating.
+ */
+struct amdxdna_drm_query_mem_info {
+	__u64 heap_size;
+	__u64 heap_used;
+	__u64 heap_free;
+	__u64 heap_largest_free;
+	__u64 bo_usage;
+	__u64 internal_bo_usage;
+	__u32 heap_count;
+	__u32 heap_max_count;
+};
+
 /**
  * struct amdxdna_drm_attribute_state - Represent buffer packing for the below
  *					struct amdxdna_drm_<get/set>_state attributes,
@@ -603,9 +866,12 @@ struct amdxdna_drm_attribute_state {
  * @minor: Firmware telemetry interface minor version number. Based on firmware response message.
  * @type: Telemetry query type. Set by the user.
  *	  MBZ for NPU 1, 2, 4, 5, and 6. Non-zero for future generations.
+ *	  Or'ed with AMDXDNA_TELEMETRY_FRESH to bypass the copy driver refreshes
+ *	  periodically and query firmware right away. Returned without the flag.
  * @map_num_elements: Total number of elements in the map table. Set by the driver.
  * @map: Maps the firmware allocated context ID(key) to driver allocated context ID(value).
  */
+#define AMDXDNA_TELEMETRY_FRESH		(1U << 31)
 struct amdxdna_drm_query_telemetry_header {
 	__u32 major;
 	__u32 minor;
@@ -636,6 +902,7 @@ struct amdxdna_drm_get_info {
 #define	DRM_AMDXDNA_QUERY_RESOURCE_INFO			12
 #define	DRM_AMDXDNA_GET_FRAME_BOUNDARY_PREEMPT_STATE	13
 #define	DRM_AMDXDNA_QUERY_VE2_FIRMWARE_VERSION		14
+#define	DRM_AMDXDNA_QUERY_MEM_INFO			15
 	__u32 param; /* in */
 	__u32 buffer_size; /* in/out */
 	__u64 buffer; /* in/out */
@@ -670,6 +937,20 @@ struct amdxdna_drm_get_info {
  * @fatal_error_exception_type: LX7 exception type
  * @fatal_error_exception_pc: LX7 program counter at the time of the exception
  * @fatal_error_app_module: module name where the exception occurred
+ * @pad: MBZ.
+ * @connections: The number of times this context has been connected to hardware.
+ * @queue_delay_ns: Total time commands waited from submission to being sent to device.
+ * @exec_ns: Total time the device was busy with commands of this context.
+ * @deadline_misses: The number of commands completed after their QoS deadline.
+ * @poll_hits: The number of waits completed by busy polling, without interrupt.
+ * @poll_misses: The number of waits which polled and then slept for interrupt.
+ * @generation: Device generation at which this context was last seen changed.
+ *              For DRM_AMDXDNA_HW_CONTEXT_CHANGED, the first element passes in
+ *              the highest generation got from previous query.
+ * @queue_full: The number of submissions refused because the command queue of
+ *              this context was full.
+ * @queue_depth: Max number of commands of this context in flight.
+ * @queue_hwm: Highest number of commands of this context in flight so far.
  */
 struct amdxdna_drm_hwctx_entry {
 	__u32 context_id;
@@ -687,6 +968,8 @@ struct amdxdna_drm_hwctx_entry {
 	__u64 suspensions;
 #define AMDXDNA_HWCTX_STATE_IDLE	0
 #define AMDXDNA_HWCTX_STATE_ACTIVE	1
+/* Only reported by DRM_AMDXDNA_HW_CONTEXT_CHANGED */
+#define AMDXDNA_HWCTX_STATE_DESTROYED	2
 	__u32 state;
 	__u32 pasid;
 	__u32 gops;
@@ -700,6 +983,17 @@ struct amdxdna_drm_hwctx_entry {
 	__u32 fatal_error_exception_type;
 	__u32 fatal_error_exception_pc;
 	__u32 fatal_error_app_module;
+	__u32 pad;
+	__u64 connections;
+	__u64 queue_delay_ns;
+	__u64 exec_ns;
+	__u64 deadline_misses;
+	__u64 poll_hits;
+	__u64 poll_misses;
+	__u64 generation;
+	__u64 queue_full;
+	__u32 queue_depth;
+	__u32 queue_hwm;
 };
 
 /**
@@ -717,6 +1011,65 @@ struct amdxdna_async_error {
 	__u64 ex_err_code;
 };
 
+/**
+ * struct amdxdna_async_error_entry - XDNA async error ring entry
+ * @seq: Sequence number of the error, starting from 1
+ * @err_code: Same as struct amdxdna_async_error
+ * @ts_us: timestamp in us
+ * @ex_err_code: extra error code
+ * @pid: Process of the context running on the error column, 0 if none
+ * @ctx_id: Handle of that context in the process
+ * @dropped: Errors dropped by rate limiting right before this one
+ *
+ * This is used for DRM_AMDXDNA_HW_ASYNC_ERR_RING. On input, seq of the first
+ * element is where to start reading, 0 means the oldest error kept by driver.
+ * On output, elements are errors from there, oldest first. Pass the last seq
+ * plus one to read the next batch. A seq gap means errors were overwritten
+ * before being read.
+ */
+struct amdxdna_async_error_entry {
+	__u64 seq;
+	__u64 err_code;
+	__u64 ts_us;
+	__u64 ex_err_code;
+	__s64 pid;
+	__u32 ctx_id;
+	__u32 dropped;
+};
+
+/**
+ * struct amdxdna_partition_stats - Scheduling statistics of a VE2 partition
+ * @start_col: Start column of the partition
+ * @num_col: Number of columns of the partition
+ * @ctx_switches: Number of times another context was switched in
+ * @ctx_switch_total_ns: Total time from switch request to new context started
+ * @ctx_switch_max_ns: Longest of those
+ * @sched_runs: Number of times the partition scheduler work ran
+ *
+ * This is used for DRM_AMDXDNA_HW_PARTITION_STATS, one element per partition
+ * in use.
+ */
+struct amdxdna_partition_stats {
+	__u32 start_col;
+	__u32 num_col;
+	__u64 ctx_switches;
+	__u64 ctx_switch_total_ns;
+	__u64 ctx_switch_max_ns;
+	__u64 sched_runs;
+};
+
+/*
+ * Privileged consumers may also mmap the firmware log and trace rings read-only
+ * through the fw_log_ring and fw_trace_ring debugfs files, at offset 0 and for at
+ * most the ring size. The last AMDXDNA_DPT_RING_FOOTER_SIZE bytes of the mapping
+ * hold a footer written by firmware; the 32-bit value at
+ * AMDXDNA_DPT_RING_TAIL_OFFSET inside it is the count of bytes produced so far,
+ * modulo 2^32. The data region in front of the footer is written circularly, so a
+ * consumer keeps its own 64-bit head and reads [head, tail) modulo the data size.
+ */
+#define AMDXDNA_DPT_RING_FOOTER_SIZE	4096
+#define AMDXDNA_DPT_RING_TAIL_OFFSET	64
+
 /**
  * struct amdxdna_dpt_metadata - DPT metadata shared between shim and driver
  * @offset: ever increamenting DPT read pointer
@@ -747,12 +1100,17 @@ struct amdxdna_drm_set_dpt_state {
  * @version: Payload version
  * @status: 1 implies enabled. 0 implies disabled
  * @config: signifies log level for firmware logging or categories for firmware trace
+ * @clock_offset_ns: firmware timestamp minus CLOCK_MONOTONIC in nanoseconds, taken when the
+ *		     driver last calibrated the firmware clock. Subtract it from a firmware
+ *		     timestamp to place the record on the host monotonic timeline. Only
+ *		     returned when the buffer is large enough to hold it.
  */
 struct amdxdna_drm_get_dpt_state {
 	__u32 version;
 	__u32 status;
 	__u32 config;
 	__u32 reserved;
+	__s64 clock_offset_ns;
 };
 
 /**
@@ -777,6 +1135,111 @@ struct amdxdna_drm_aie_tile_access {
 	__u32 pad;
 };
 
+/**
+ * struct amdxdna_drm_aie_tile_range - One range of a batched AIE read
+ * @col: The AIE column index, relative to the partition
+ * @row: The AIE row index
+ * @addr: The AIE memory or register address to read
+ * @size: The size of bytes to read
+ * @data_offset: Where to put the bytes read in data buffer of the batch
+ * @pad: MBZ
+ */
+struct amdxdna_drm_aie_tile_range {
+	__u32 col;
+	__u32 row;
+	__u32 addr;
+	__u32 size;
+	__u32 data_offset;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_aie_tile_batch - Read a list of AIE ranges at once
+ * @pid: The Process ID of the process that created this context.
+ * @context_id: The hw context id.
+ * @num_ranges: Number of elements in ranges_p, at most AMDXDNA_MAX_NUM_ELEMENT
+ * @ranges_p: Array of struct amdxdna_drm_aie_tile_range
+ * @data_p: Buffer where read data is scattered into
+ * @data_size: Size of data_p in bytes
+ * @pad: MBZ
+ *
+ * This is used for DRM_AMDXDNA_AIE_TILE_READ_BATCH, with buffer pointing to
+ * one element of this structure. All ranges are validated before any is read.
+ */
+struct amdxdna_drm_aie_tile_batch {
+	__u64 pid;
+	__u32 context_id;
+	__u32 num_ranges;
+	__u64 ranges_p;
+	__u64 data_p;
+	__u32 data_size;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_aie_counter - One AIE register sampled periodically
+ * @col: The AIE column index, relative to the partition
+ * @row: The AIE row index
+ * @addr: The AIE register address
+ * @pad: MBZ
+ */
+struct amdxdna_drm_aie_counter {
+	__u32 col;
+	__u32 row;
+	__u32 addr;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_aie_counter_sampling - Start or stop counter sampling
+ * @context_id: The hw context id, owned by the caller.
+ * @bo_handle: BO the samples are written to, 0 stops sampling of the context.
+ * @period_us: Sampling period, at least AMDXDNA_AIE_COUNTER_MIN_PERIOD_US.
+ * @num_counters: Number of elements in counters_p, at most
+ *                AMDXDNA_AIE_COUNTER_MAX.
+ * @counters_p: Array of struct amdxdna_drm_aie_counter.
+ *
+ * This is used for DRM_AMDXDNA_AIE_COUNTER_SAMPLING. The driver reads all
+ * counters of the context partition every period and stores them into
+ * the BO, laid out as struct amdxdna_aie_counter_ring. Starting again
+ * replaces the previous configuration. Sampling stops when the context is
+ * destroyed.
+ */
+struct amdxdna_drm_aie_counter_sampling {
+	__u32 context_id;
+	__u32 bo_handle;
+	__u32 period_us;
+#define AMDXDNA_AIE_COUNTER_MIN_PERIOD_US	100
+	__u32 num_counters;
+#define AMDXDNA_AIE_COUNTER_MAX			64
+	__u64 counters_p;
+};
+
+/**
+ * struct amdxdna_aie_counter_ring - Layout of AIE counter sample BO
+ * @head: Number of samples written so far, sample n is in entry
+ *        n % num_entries. Updated after the entry is written.
+ * @dropped: Samples not stored because a register read failed.
+ * @num_counters: Number of counters in each entry.
+ * @num_entries: Number of entries in the BO, the oldest is overwritten.
+ * @entry_size: Size of one entry in bytes.
+ * @pad: MBZ
+ * @entries: Each entry is a __u64 CLOCK_MONOTONIC timestamp in ns followed
+ *           by one __u32 per counter, in the order they were given.
+ *
+ * A reader should re-check @head after copying entries out and discard
+ * the ones that may have been overwritten meanwhile.
+ */
+struct amdxdna_aie_counter_ring {
+	__u64 head;
+	__u64 dropped;
+	__u32 num_counters;
+	__u32 num_entries;
+	__u32 entry_size;
+	__u32 pad;
+	__u64 entries[];
+};
+
 /**
  * struct amdxdna_drm_aie_coredump - The data for AIE coredump
  * @pid: The Process ID of the process that created this context.
@@ -790,6 +1253,38 @@ struct amdxdna_drm_aie_coredump {
 	__u32 pad;
 };
 
+/**
+ * struct amdxdna_drm_aie_coredump_chunk - Read AIE coredump piece by piece
+ * @pid: The Process ID of the process that created this context.
+ * @context_id: The hw context id.
+ * @col: First column to dump, relative to the partition
+ * @num_col: Number of columns to dump, 0 for up to the end of the partition
+ * @row: First row to dump
+ * @num_row: Number of rows to dump, 0 for up to the last row
+ * @size: In, bytes to read into data_p. Out, bytes read.
+ * @offset: Where to start reading in the dump of selected tiles
+ * @data_p: Buffer bytes read go to
+ * @total_size: Out, size of the dump of selected tiles
+ *
+ * This is used for DRM_AMDXDNA_AIE_COREDUMP_CHUNK, with buffer pointing to one
+ * element of this structure. Tiles are laid out as in DRM_AMDXDNA_AIE_COREDUMP,
+ * column by column and TILE_ADDRESS_SPACE bytes each, but only selected tiles
+ * are in it. Caller reads it in chunks of its own size by moving offset up to
+ * total_size, and only a chunk is ever held in kernel.
+ */
+struct amdxdna_drm_aie_coredump_chunk {
+	__u64 pid;
+	__u32 context_id;
+	__u32 col;
+	__u32 num_col;
+	__u32 row;
+	__u32 num_row;
+	__u32 size;
+	__u64 offset;
+	__u64 data_p;
+	__u64 total_size;
+};
+
 /**
  * struct amdxdna_drm_bo_usage - The BO usage statistics
  * @pid: The ID of the process to query from
@@ -837,6 +1332,19 @@ struct amdxdna_drm_get_array {
 #define DRM_AMDXDNA_FW_LOG_CONFIG	7
 #define DRM_AMDXDNA_FW_TRACE_CONFIG	8
 #define DRM_AMDXDNA_AIE_TILE_READ	9
+#define DRM_AMDXDNA_HW_ASYNC_ERR_RING	10
+#define DRM_AMDXDNA_HW_PARTITION_STATS	11
+#define DRM_AMDXDNA_AIE_TILE_READ_BATCH	12
+/* Same as HW_CONTEXT_ALL without firmware query, health fields are zero */
+#define DRM_AMDXDNA_HW_CONTEXT_STATS	13
+/*
+ * Same as HW_CONTEXT_STATS, only contexts changed after the given generation
+ * are returned, destroyed ones with state AMDXDNA_HWCTX_STATE_DESTROYED.
+ * Fails with -ESTALE if destroyed contexts since then were forgotten, and
+ * caller should start over from generation 0.
+ */
+#define DRM_AMDXDNA_HW_CONTEXT_CHANGED	14
+#define DRM_AMDXDNA_AIE_COREDUMP_CHUNK	15
 	__u32 param; /* in */
 	__u32 element_size; /* in/out */
 #define AMDXDNA_MAX_NUM_ELEMENT			1024
@@ -870,12 +1378,60 @@ struct amdxdna_drm_set_state {
 #define	DRM_AMDXDNA_SET_FW_LOG_STATE		5
 #define	DRM_AMDXDNA_SET_FW_TRACE_STATE		6
 #define	DRM_AMDXDNA_AIE_TILE_WRITE		7
+#define	DRM_AMDXDNA_AIE_COUNTER_SAMPLING	8
 
 	__u32 param; /* in */
 	__u32 buffer_size; /* in */
 	__u64 buffer; /* in */
 };
 
+/**
+ * struct amdxdna_drm_mem_notify - Arm memory pressure notification of client.
+ * @heap_threshold: Notify once heap usage of client goes from below to at or
+ *                  above this many bytes. 0 for no heap threshold.
+ * @bo_threshold: Same for total size of BOs of client.
+ * @user_data: Passed back as is in struct amdxdna_drm_mem_event.
+ * @flags: MBZ.
+ * @pad: MBZ.
+ *
+ * Notification is a struct amdxdna_drm_mem_event read from the device fd,
+ * which becomes readable once any threshold is crossed or the system is short
+ * of memory. It is sent at most once per arming, arm again after it is read.
+ * Arming again before that only updates thresholds and user_data. Clients
+ * keeping memory for performance, e.g. BO pools, are expected to give back
+ * what they can spare on it.
+ */
+struct amdxdna_drm_mem_notify {
+	__u64 heap_threshold;
+	__u64 bo_threshold;
+	__u64 user_data;
+	__u32 flags;
+	__u32 pad;
+};
+
+#define AMDXDNA_EVENT_MEM_PRESSURE	0x80000000
+
+/**
+ * struct amdxdna_drm_mem_event - Memory pressure event read from device fd.
+ * @base: DRM event header, type is AMDXDNA_EVENT_MEM_PRESSURE.
+ * @reasons: AMDXDNA_MEM_PRESSURE_* bits.
+ * @pad: MBZ.
+ * @user_data: Given by struct amdxdna_drm_mem_notify.
+ * @heap_usage: Heap usage of client in bytes, when event was sent.
+ * @bo_usage: Total size of BOs of client in bytes, when event was sent.
+ */
+struct amdxdna_drm_mem_event {
+	struct drm_event base;
+#define AMDXDNA_MEM_PRESSURE_SYSTEM	(1 << 0)
+#define AMDXDNA_MEM_PRESSURE_HEAP	(1 << 1)
+#define AMDXDNA_MEM_PRESSURE_BO		(1 << 2)
+	__u32 reasons;
+	__u32 pad;
+	__u64 user_data;
+	__u64 heap_usage;
+	__u64 bo_usage;
+};
+
 #define DRM_IOCTL_AMDXDNA_CREATE_HWCTX \
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_CREATE_HWCTX, \
 		 struct amdxdna_drm_create_hwctx)
@@ -900,6 +1456,10 @@ struct amdxdna_drm_set_state {
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SYNC_BO, \
 		 struct amdxdna_drm_sync_bo)
 
+#define DRM_IOCTL_AMDXDNA_SYNC_BOS \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SYNC_BOS, \
+		 struct amdxdna_drm_sync_bos)
+
 #define DRM_IOCTL_AMDXDNA_EXEC_CMD \
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_EXEC_CMD, \
 		 struct amdxdna_drm_exec_cmd)
@@ -920,6 +1480,14 @@ struct amdxdna_drm_set_state {
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SET_STATE, \
 		 struct amdxdna_drm_set_state)
 
+#define DRM_IOCTL_AMDXDNA_WAIT_CMDS \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_WAIT_CMDS, \
+		 struct amdxdna_drm_wait_cmds)
+
+#define DRM_IOCTL_AMDXDNA_MEM_NOTIFY \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_MEM_NOTIFY, \
+		 struct amdxdna_drm_mem_notify)
+
 #if defined(__cplusplus)
 } /* extern c end */
 #endif
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef AWAITABLE_XDNA_H
+#define AWAITABLE_XDNA_H
+
+#include "hwq.h"
+#include "core/include/ert.h"
+
+// co_await support for cmd completion and fence waits, for runtimes built on
+// C++20 coroutines. Suspended coroutines are resumed by the cmd_reaper of
+// the device, so no thread is blocked per outstanding cmd or fence. If an
+// executor is given, coroutine is resumed by handing it there, e.g. posting
+// to the asio strand the coroutine runs on, otherwise it is resumed right on
+// the reaper thread.
+//
+// Shim itself is built as C++17, this is only available to C++20 code.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+
+namespace shim_xdna {
+
+// Result of co_await is ERT state of cmd, completed or failed.
+class cmd_awaitable
+{
+public:
+  cmd_awaitable(hwq& q, xrt_core::buffer_handle *cmd, cmd_reaper::executor_type exec = {})
+    : m_q(q), m_cmd(cmd), m_exec(std::move(exec))
+  {}
+
+  bool
+  await_ready() const
+  { return m_q.poll_command(m_cmd); }
+
+  void
+  await_suspend(std::coroutine_handle<> h)
+  {
+    // Coroutine may be resumed before this returns, don't touch this after.
+    m_q.add_completion_callback(m_cmd, [h, exec = m_exec] (uint32_t) {
+      if (exec)
+        exec([h] { h.resume(); });
+      else
+        h.resume();
+    });
+  }
+
+  uint32_t
+  await_resume() const
+  { return reinterpret_cast<ert_packet *>(static_cast<cmd_buffer*>(m_cmd)->vaddr())->state; }
+
+private:
+  hwq& m_q;
+  xrt_core::buffer_handle *m_cmd;
+  cmd_reaper::executor_type m_exec;
+};
+
+// Submit cmd and return what completes with it.
+inline cmd_awaitable
+async_submit(hwq& q, xrt_core::buffer_handle *cmd, cmd_reaper::executor_type exec = {})
+{
+  q.submit_command(cmd);
+  return cmd_awaitable(q, cmd, std::move(exec));
+}
+
+// Waits for state of fence f, created on dev, to be signaled.
+class fence_awaitable
+{
+public:
+  fence_awaitable(const device& dev, const fence& f, uint64_t state,
+    cmd_reaper::executor_type exec = {})
+    : m_reaper(dev.get_cmd_reaper()), m_fence(f), m_state(state), m_exec(std::move(exec))
+  {}
+
+  bool
+  await_ready() const
+  { return m_fence.is_signaled(m_state); }
+
+  void
+  await_suspend(std::coroutine_handle<> h)
+  {
+    // Coroutine may be resumed before this returns, don't touch this after.
+    auto reaper = m_reaper;
+    reaper->add_fence(&m_fence, m_state, [h, exec = m_exec] {
+      if (exec)
+        exec([h] { h.resume(); });
+      else
+        h.resume();
+    });
+  }
+
+  void
+  await_resume() const
+  {}
+
+private:
+  std::shared_ptr<cmd_reaper> m_reaper;
+  const fence& m_fence;
+  uint64_t m_state;
+  cmd_reaper::executor_type m_exec;
+};
+
+} // namespace shim_xdna
+
+#endif
+
+#endif
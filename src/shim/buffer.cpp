@@ -4,12 +4,32 @@
 // Disable debug print in this file.
 //#undef XDNA_SHIM_DEBUG
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "buffer.h"
+#include "fence.h"
 #include "shim_debug.h"
+#include "trace_stream.h"
 #include "core/common/config_reader.h"
+#include "trace_recorder.h"
+#include "core/include/ert.h"
 #if defined(__x86_64__) || defined(_M_X64)
+#include <cpuid.h>
 #include <x86intrin.h>
 #endif
 
@@ -34,6 +54,9 @@ use_to_fw_debug_type(uint8_t use)
 }
 
 const uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+// Set while this thread is in a shim_xdna::buffer::driver_sync_batch scope
+thread_local std::vector<shim_xdna::sync_bo_arg> *batched_driver_syncs = nullptr;
 const long cacheline_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
 
 bool
@@ -171,18 +194,224 @@ inline void flush_cache_line(const char *cur)
 #endif
 }
 
+// Cache maintenance kernels for non coherent memory. Each one flushes all
+// cachelines in [cur, end), cur being cacheline aligned.
+using flush_func = void (*)(const char *cur, const char *end);
+
+void
+flush_by_line(const char *cur, const char *end)
+{
+  for (; cur < end; cur += cacheline_size)
+    flush_cache_line(cur);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+bool
+cpu_has_leaf7_ebx(unsigned int bit)
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return false;
+  return ebx & (1u << bit);
+}
+
+// clflushopt is weakly ordered, only one fence is needed at the end.
+__attribute__((target("clflushopt")))
+void
+flush_by_clflushopt(const char *cur, const char *end)
+{
+  for (; cur < end; cur += cacheline_size)
+    _mm_clflushopt(const_cast<char *>(cur));
+  _mm_sfence();
+}
+
+// clwb writes back without invalidating, good enough before device reads.
+__attribute__((target("clwb")))
+void
+writeback_by_clwb(const char *cur, const char *end)
+{
+  for (; cur < end; cur += cacheline_size)
+    _mm_clwb(const_cast<char *>(cur));
+  _mm_sfence();
+}
+#elif defined(__aarch64__)
+void
+clean_by_dc_cvac(const char *cur, const char *end)
+{
+  for (; cur < end; cur += cacheline_size)
+    asm volatile("DC CVAC, %[addr]" : : [addr] "r" (cur) : "memory");
+  asm volatile("DSB SY" : : : "memory");
+}
+
+void
+clean_inval_by_dc_civac(const char *cur, const char *end)
+{
+  for (; cur < end; cur += cacheline_size)
+    asm volatile("DC CIVAC, %[addr]" : : [addr] "r" (cur) : "memory");
+  asm volatile("DSB SY" : : : "memory");
+}
+#endif
+
+struct flush_kernels {
+  flush_func to_device;   // Dirty lines must reach memory
+  flush_func from_device; // Lines must also be invalidated
+};
+
+const flush_kernels&
+get_flush_kernels()
+{
+  static const flush_kernels kernels = []() {
+    flush_kernels k = { flush_by_line, flush_by_line };
+
+    if (xrt_core::config::detail::get_bool_value("Debug.cache_flush_by_line", false))
+      return k;
+#if defined(__x86_64__) || defined(_M_X64)
+    // CPUID.(EAX=7,ECX=0):EBX bit 23 is CLFLUSHOPT, bit 24 is CLWB
+    if (cpu_has_leaf7_ebx(23))
+      k.to_device = k.from_device = flush_by_clflushopt;
+    if (cpu_has_leaf7_ebx(24))
+      k.to_device = writeback_by_clwb;
+#elif defined(__aarch64__)
+    k.to_device = clean_by_dc_cvac;
+    k.from_device = clean_inval_by_dc_civac;
+#endif
+    return k;
+  }();
+  return kernels;
+}
+
 // flash cache line for non coherent memory
 inline void
-clflush_data(const void *base, size_t offset, size_t len)
+clflush_data(const void *base, size_t offset, size_t len, bool to_device)
 {
-  const char *cur = (const char *)base;
-  cur += offset;
-  uintptr_t lastline = (uintptr_t)(cur + len - 1) | (cacheline_size - 1);
-  do {
-    flush_cache_line(cur);
-    cur += cacheline_size;
-  } while (cur <= (const char *)lastline);
+  if (!len)
+    return;
+
+  auto start = reinterpret_cast<uintptr_t>(base) + offset;
+  auto cur = reinterpret_cast<const char *>(start & ~(cacheline_size - 1));
+  auto end = reinterpret_cast<const char *>(start + len);
+  auto& k = get_flush_kernels();
+  (to_device ? k.to_device : k.from_device)(cur, end);
+}
+
+// Drain write-combining buffers so that CPU writes to WC mapping reach memory
+inline void
+wc_drain()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  _mm_sfence();
+#elif defined(__aarch64__)
+  asm volatile("DSB ST" : : : "memory");
+#endif
+}
+
+// Kernels copying len bytes from src to dst, dst being 64 bytes aligned and
+// len a multiple of 64, so that copied data is in memory when they return and
+// the range needs no flush before device reads it.
+using stream_copy_func = void (*)(char *dst, const char *src, size_t len);
+
+#if defined(__x86_64__) || defined(_M_X64)
+// Non-temporal stores go around CPU cache, evicting the line if present.
+void
+stream_copy_sse2(char *dst, const char *src, size_t len)
+{
+  for (size_t i = 0; i < len; i += 64) {
+    for (size_t j = 0; j < 64; j += 16) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + j));
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + j), v);
+    }
+  }
+  _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+void
+stream_copy_avx2(char *dst, const char *src, size_t len)
+{
+  for (size_t i = 0; i < len; i += 64) {
+    auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), v0);
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i + 32), v1);
+  }
+  _mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+void
+stream_copy_avx512(char *dst, const char *src, size_t len)
+{
+  for (size_t i = 0; i < len; i += 64) {
+    auto v = _mm512_loadu_si512(src + i);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + i), v);
+  }
+  _mm_sfence();
 }
+#elif defined(__aarch64__)
+// STNP is only a hint on arm, lines may still be left dirty. Copy in chunks
+// and clean each chunk right after, while it is still in cache, so that the
+// whole range is not walked again by sync().
+void
+stream_copy_dc_cvac(char *dst, const char *src, size_t len)
+{
+  const size_t chunk_size = 64 * 1024;
+
+  for (size_t off = 0; off < len; off += chunk_size) {
+    auto n = std::min(chunk_size, len - off);
+    for (size_t i = 0; i < n; i += 32) {
+      asm volatile(
+        "LDP q0, q1, [%[s]]\n"
+        "STNP q0, q1, [%[d]]\n"
+        :
+        : [s] "r" (src + off + i), [d] "r" (dst + off + i)
+        : "v0", "v1", "memory"
+      );
+    }
+    for (size_t i = 0; i < n; i += cacheline_size)
+      asm volatile("DC CVAC, %[addr]" : : [addr] "r" (dst + off + i) : "memory");
+  }
+  asm volatile("DSB SY" : : : "memory");
+}
+#endif
+
+// nullptr if CPU has no way to copy around its cache.
+stream_copy_func
+get_stream_copy()
+{
+  static const stream_copy_func func = []() -> stream_copy_func {
+    if (xrt_core::config::detail::get_bool_value("Debug.disable_stream_copy", false))
+      return nullptr;
+#if defined(__x86_64__) || defined(_M_X64)
+    // Also checks that OS saves the wider registers
+    if (__builtin_cpu_supports("avx512f"))
+      return stream_copy_avx512;
+    if (__builtin_cpu_supports("avx2"))
+      return stream_copy_avx2;
+    return stream_copy_sse2;
+#elif defined(__aarch64__)
+    return stream_copy_dc_cvac;
+#else
+    return nullptr;
+#endif
+  }();
+  return func;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+// Non-temporal loads are only honored on WC memory, where plain loads are
+// uncached and done one at a time. dst and src are 16 bytes aligned and len
+// a multiple of 16.
+__attribute__((target("sse4.1")))
+void
+stream_load_sse41(char *dst, const char *src, size_t len)
+{
+  _mm_mfence();
+  for (size_t i = 0; i < len; i += 16) {
+    auto v = _mm_stream_load_si128(reinterpret_cast<__m128i *>(const_cast<char *>(src + i)));
+    _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), v);
+  }
+}
+#endif
 
 bool
 is_driver_sync()
@@ -192,6 +421,14 @@ is_driver_sync()
   return drv_sync;
 }
 
+bool
+is_bo_write_tracking()
+{
+  static bool track =
+    xrt_core::config::detail::get_bool_value("Runtime.bo_write_tracking", false);
+  return track;
+}
+
 bool
 is_driver_pin_arg_bo()
 {
@@ -200,6 +437,301 @@ is_driver_pin_arg_bo()
   return drv_pin;
 }
 
+bool
+get_dump_arg_bos()
+{
+  static bool dump =
+    xrt_core::config::detail::get_bool_value("Debug.dump_arg_bos", false);
+  return dump;
+}
+
+bool
+get_cmd_timestamps()
+{
+  static bool ts =
+    xrt_core::config::detail::get_bool_value("Debug.cmd_timestamps", false);
+  return ts;
+}
+
+size_t
+get_cmd_bo_pool_size()
+{
+  static size_t pool_size =
+    xrt_core::config::detail::get_uint_value("Runtime.cmd_bo_pool_size", 32);
+  return pool_size;
+}
+
+bool
+is_small_bo_suballoc()
+{
+  static bool suballoc =
+    xrt_core::config::detail::get_bool_value("Runtime.small_bo_suballoc", false);
+  return suballoc;
+}
+
+size_t
+get_uptr_bo_cache_size()
+{
+  static size_t cache_size =
+    xrt_core::config::detail::get_uint_value("Runtime.uptr_bo_cache_size", 0);
+  return cache_size;
+}
+
+// Defer mmap of host BOs until CPU pointer is asked for.
+bool
+is_lazy_bo_mmap()
+{
+  static bool lazy =
+    xrt_core::config::detail::get_bool_value("Runtime.lazy_bo_mmap", true);
+  return lazy;
+}
+
+// Number of DRM BOs mapped at creation vs on first vaddr()/map().
+std::atomic<uint64_t> eager_mmap_count = 0;
+std::atomic<uint64_t> lazy_mmap_count = 0;
+
+// Syncs at or above this size are split across flush workers, 0 to disable.
+size_t
+get_parallel_sync_threshold()
+{
+  static size_t threshold =
+    xrt_core::config::detail::get_uint_value("Runtime.parallel_sync_threshold", 8 * 1024 * 1024);
+  return threshold;
+}
+
+size_t
+get_parallel_sync_threads()
+{
+  static size_t nthreads =
+    xrt_core::config::detail::get_uint_value("Runtime.parallel_sync_threads", 4);
+  return nthreads;
+}
+
+// CPUs on the NUMA node of the calling thread. Returns false if unknown.
+bool
+get_local_node_cpus(cpu_set_t& cpus)
+{
+  auto cpu = sched_getcpu();
+  if (cpu < 0)
+    return false;
+
+  const std::string sys_cpu = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  std::error_code ec;
+  for (const auto& e : std::filesystem::directory_iterator(sys_cpu, ec)) {
+    auto name = e.path().filename().string();
+    if (name.rfind("node", 0) != 0)
+      continue;
+
+    std::ifstream ifs("/sys/devices/system/node/" + name + "/cpulist");
+    std::string list;
+    if (!std::getline(ifs, list))
+      return false;
+    CPU_ZERO(&cpus);
+    try {
+      shim_xdna::parse_cpulist(list, cpus);
+    } catch (const std::exception&) {
+      return false;
+    }
+    return CPU_COUNT(&cpus) > 0;
+  }
+  return false;
+}
+
+// Small persistent pool of threads sharing the work of syncing very large
+// BOs with the calling thread. Workers are pinned to the NUMA node of the
+// thread which first needs them.
+class sync_workers
+{
+public:
+  sync_workers(size_t nthreads)
+  {
+    cpu_set_t cpus;
+    bool pin = get_local_node_cpus(cpus);
+    for (size_t i = 0; i < nthreads; i++) {
+      m_threads.emplace_back(&sync_workers::worker, this);
+      if (pin)
+        pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(cpus), &cpus);
+    }
+  }
+
+  ~sync_workers()
+  {
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto& t : m_threads)
+      t.join();
+  }
+
+  // Run fn(i) for i in [0, n) on workers and calling thread, return when all
+  // are done. First exception thrown by fn is re-thrown here.
+  void
+  run(size_t n, const std::function<void(size_t)>& fn)
+  {
+    std::lock_guard<std::mutex> run_lg(m_run_lock);
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_fn = &fn;
+      m_total = n;
+      m_next = 0;
+      m_active = m_threads.size();
+      m_error = nullptr;
+      m_generation++;
+    }
+    m_work_cv.notify_all();
+
+    do_work();
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    m_done_cv.wait(lk, [this]() { return m_active == 0; });
+    m_fn = nullptr;
+    if (m_error)
+      std::rethrow_exception(m_error);
+  }
+
+private:
+  void
+  do_work()
+  {
+    for (auto i = m_next++; i < m_total; i = m_next++) {
+      try {
+        (*m_fn)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lg(m_lock);
+        if (!m_error)
+          m_error = std::current_exception();
+      }
+    }
+  }
+
+  void
+  worker()
+  {
+    uint64_t gen = 0;
+    std::unique_lock<std::mutex> lk(m_lock);
+    while (true) {
+      m_work_cv.wait(lk, [this, gen]() { return m_stop || m_generation != gen; });
+      if (m_stop)
+        return;
+      gen = m_generation;
+      lk.unlock();
+      do_work();
+      lk.lock();
+      if (--m_active == 0)
+        m_done_cv.notify_one();
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+  // Serializes callers, one sync is split across workers at a time.
+  std::mutex m_run_lock;
+  std::mutex m_lock;
+  std::condition_variable m_work_cv;
+  std::condition_variable m_done_cv;
+  const std::function<void(size_t)> *m_fn = nullptr;
+  size_t m_total = 0;
+  std::atomic<size_t> m_next = 0;
+  size_t m_active = 0;
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+  std::exception_ptr m_error;
+};
+
+// Call fn(off, len) over [offset, offset + sz), split into page aligned
+// chunks handled in parallel if sz is large enough.
+void
+for_each_sync_chunk(size_t offset, size_t sz, const std::function<void(size_t, size_t)>& fn)
+{
+  const size_t chunk_size = 2 * 1024 * 1024;
+  auto threshold = get_parallel_sync_threshold();
+  auto nthreads = get_parallel_sync_threads();
+
+  if (!threshold || !nthreads || sz < threshold) {
+    fn(offset, sz);
+    return;
+  }
+
+  static sync_workers workers(nthreads);
+  auto end = offset + sz;
+  auto first = offset & ~(chunk_size - 1);
+  auto nchunks = (end - first + chunk_size - 1) / chunk_size;
+  workers.run(nchunks, [&](size_t i) {
+    auto s = std::max(first + i * chunk_size, offset);
+    auto e = std::min(first + (i + 1) * chunk_size, end);
+    fn(s, e - s);
+  });
+}
+
+// Single worker running async BO syncs in submission order.
+class async_sync_queue
+{
+public:
+  async_sync_queue()
+    : m_thread(&async_sync_queue::worker, this)
+  {
+  }
+
+  ~async_sync_queue()
+  {
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+  }
+
+  void
+  push(std::function<void()>&& job)
+  {
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+  }
+
+private:
+  void
+  worker()
+  {
+    std::unique_lock<std::mutex> lk(m_lock);
+    while (true) {
+      m_cv.wait(lk, [this]() { return m_stop || !m_jobs.empty(); });
+      if (m_jobs.empty())
+        return;
+      auto job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+      lk.unlock();
+      job();
+      lk.lock();
+    }
+  }
+
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::deque< std::function<void()> > m_jobs;
+  bool m_stop = false;
+  std::thread m_thread;
+};
+
+void
+futex_wait(std::atomic<uint32_t> *word, uint32_t val)
+{
+  // Returns right away if *word is not val any more, caller re-checks.
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, val,
+    nullptr, nullptr, 0);
+}
+
+void
+futex_wake_all(std::atomic<uint32_t> *word)
+{
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, INT_MAX,
+    nullptr, nullptr, 0);
+}
+
 uint64_t
 bo_addr_align(int type)
 {
@@ -207,6 +739,34 @@ bo_addr_align(int type)
   return (type == AMDXDNA_BO_DEV_HEAP) ? heap_page_size : 1;
 }
 
+uint64_t
+bo_vaddr_align(int type, size_t size)
+{
+  // Large host BOs may be backed by 2MB huge pages in driver, align CPU
+  // mapping to the same boundary so that it can be mapped by huge pages too.
+  const size_t huge_page_size = 2 * 1024 * 1024;
+  if (type == AMDXDNA_BO_SHARE && size >= huge_page_size)
+    return huge_page_size;
+  return bo_addr_align(type);
+}
+
+// BOs only written by CPU and read by device, worth of write-combined mapping.
+bool
+is_wc_bo_flags(uint64_t bo_flags, int type)
+{
+  if (type != AMDXDNA_BO_SHARE && type != AMDXDNA_BO_CMD)
+    return false;
+
+  switch (xcl_bo_flags{bo_flags}.use) {
+  case XRT_BO_USE_INSTRUCTION:
+  case XRT_BO_USE_PDI:
+  case XRT_BO_USE_CTRLPKT:
+    return true;
+  default:
+    return false;
+  }
+}
+
 int
 bo_flags_to_type(uint64_t bo_flags, bool has_dev_mem)
 {
@@ -267,12 +827,13 @@ mmap_ptr(size_t size, size_t alignment)
 }
 
 mmap_ptr::
-mmap_ptr(const pdev *dev, void *addr, uint64_t dev_offset, size_t size)
+mmap_ptr(const pdev *dev, void *addr, uint64_t dev_offset, size_t size, int prot)
   : m_dev(dev), m_size(size)
 {
   int flags = addr ? MAP_FIXED : 0;
-  m_ptr = dev->mmap(addr, size, PROT_READ | PROT_WRITE,
-    MAP_SHARED | MAP_LOCKED | flags, dev_offset);
+  // Pages of locked mapping are populated right here.
+  numa_mem_scope numa(*dev);
+  m_ptr = dev->mmap(addr, size, prot, MAP_SHARED | MAP_LOCKED | flags, dev_offset);
 }
 
 mmap_ptr::
@@ -296,13 +857,13 @@ get() const
 
 std::unique_ptr<mmap_ptr>
 mmap_ptr::
-alloc(const pdev *dev, uint64_t dev_offset, size_t size)
+alloc(const pdev *dev, uint64_t dev_offset, size_t size, int prot)
 {
   auto sz = page_size_roundup(size);
   if (sz > m_size)
     shim_err(ENOSPC, "mmap_alloc(len=%ld) failed", size);
 
-  auto new_mmap = std::make_unique<mmap_ptr>(dev, m_ptr, dev_offset, sz);
+  auto new_mmap = std::make_unique<mmap_ptr>(dev, m_ptr, dev_offset, sz, prot);
   m_size -= sz;
   if (m_size == 0)
     m_ptr = nullptr;
@@ -316,7 +877,7 @@ alloc(const pdev *dev, uint64_t dev_offset, size_t size)
 //
 
 drm_bo::
-drm_bo(const pdev& pdev, size_t size, uint32_t type)
+drm_bo(const pdev& pdev, size_t size, uint32_t type, bool wc)
   : m_pdev(pdev), m_size(size)
 {
   auto align = bo_addr_align(type);
@@ -324,11 +885,25 @@ drm_bo(const pdev& pdev, size_t size, uint32_t type)
     .xdna_addr_align = (align == 1 ? 0 : align), 
     .size = m_size,
     .type = type,
+    .flags = wc ? AMDXDNA_BO_FLAG_WC : 0,
   };
-  m_pdev.create_drm_bo(&arg);
+  // Driver may allocate backing pages at creation.
+  numa_mem_scope numa(m_pdev);
+  try {
+    m_pdev.create_drm_bo(&arg);
+  } catch (const xrt_core::system_error& ex) {
+    // Memory not backed by shmem pages can't be write-combined, fall back
+    // to regular cached BO.
+    if (!wc || ex.get_code() != EOPNOTSUPP)
+      throw;
+    arg.flags = 0;
+    m_pdev.create_drm_bo(&arg);
+  }
+  m_wc = (arg.flags & AMDXDNA_BO_FLAG_WC);
   m_id = arg.bo;
   m_xdna_addr = arg.xdna_addr;
   m_map_offset = arg.map_offset;
+  m_nr_segs = arg.nr_segs;
 }
 
 drm_bo::
@@ -343,6 +918,7 @@ drm_bo(const pdev& pdev, size_t size, void *uptr)
   m_id = arg.bo;
   m_xdna_addr = arg.xdna_addr;
   m_map_offset = arg.map_offset;
+  m_nr_segs = arg.nr_segs;
 }
 
 drm_bo::
@@ -357,12 +933,16 @@ drm_bo(const pdev& pdev, xrt_core::shared_handle::export_handle ehdl)
   m_id = arg.boinfo.bo;
   m_xdna_addr = arg.boinfo.xdna_addr;
   m_map_offset = arg.boinfo.map_offset;
+  m_nr_segs = arg.boinfo.nr_segs;
+  // Exporter relies on fences of submissions using it
+  m_pdev.exclude_resident_bo(m_id.handle);
 }
 
 drm_bo::
 ~drm_bo()
 {
   m_vaddr.reset();
+  m_pdev.drop_resident_bo(m_id.handle);
   destroy_bo_arg arg = {
     .bo = m_id,
   };
@@ -373,22 +953,180 @@ drm_bo::
   }
 }
 
+//
+// Impl for class write_tracker
+//
+
+// Pages of a CPU mapping written since they were last taken. Clean pages are
+// read-only, first write to one faults into the SIGSEGV handler, which makes
+// it writable and marks it dirty. Handler only looks at the static slots and
+// the bitmap, which are safe to touch from signal context.
+class write_tracker
+{
+public:
+  write_tracker(char *base, size_t size)
+    : m_base(base)
+    , m_size(size)
+    , m_npages((size + page_size - 1) / page_size)
+    , m_bits(new std::atomic<uint64_t>[(m_npages + 63) / 64])
+  {
+    // Everything is dirty and writable to begin with.
+    for (size_t i = 0; i < (m_npages + 63) / 64; i++)
+      m_bits[i] = ~0ul;
+
+    install_handler();
+    for (size_t i = 0; i < max_tracked; i++) {
+      write_tracker *none = nullptr;
+      if (s_slots[i].compare_exchange_strong(none, this, std::memory_order_release)) {
+        m_slot = i;
+        return;
+      }
+    }
+    shim_err(ENOSPC, "Too many write tracked BOs");
+  }
+
+  ~write_tracker()
+  {
+    s_slots[m_slot].store(nullptr, std::memory_order_release);
+    mprotect(m_base, m_npages * page_size, PROT_READ | PROT_WRITE);
+  }
+
+  std::vector< std::pair<size_t, size_t> >
+  take_dirty(size_t sz, size_t offset)
+  {
+    std::vector< std::pair<size_t, size_t> > ranges;
+    std::lock_guard<std::mutex> lg(m_lock);
+    if (m_broken.load(std::memory_order_acquire) || !sz) {
+      ranges.emplace_back(offset, sz);
+      return ranges;
+    }
+
+    // Pages fully covered by the range are made clean, bit cleared before
+    // page is made read-only, so a write racing with this either lands
+    // before the flush or faults again. Pages partially covered stay dirty
+    // for the part outside of the range.
+    const auto end = offset + sz;
+    const auto last = (end - 1) / page_size;
+    for (auto p = offset / page_size; p <= last;) {
+      if (!is_dirty(p)) {
+        p++;
+        continue;
+      }
+      auto first = p;
+      size_t clean_first = SIZE_MAX;
+      size_t clean_last = 0;
+      for (; p <= last && is_dirty(p); p++) {
+        if (p * page_size < offset || (p + 1) * page_size > end)
+          continue;
+        m_bits[p / 64].fetch_and(~(1ul << (p % 64)), std::memory_order_relaxed);
+        clean_first = std::min(clean_first, p);
+        clean_last = p;
+      }
+      if (clean_first != SIZE_MAX &&
+        mprotect(m_base + clean_first * page_size, (clean_last - clean_first + 1) * page_size,
+          PROT_READ)) {
+        // Likely out of VMAs, put the pages back to dirty.
+        for (auto q = clean_first; q <= clean_last; q++)
+          m_bits[q / 64].fetch_or(1ul << (q % 64), std::memory_order_relaxed);
+      }
+      auto s = std::max(first * page_size, offset);
+      auto e = std::min(p * page_size, end);
+      ranges.emplace_back(s, e - s);
+    }
+    return ranges;
+  }
+
+private:
+  static constexpr size_t max_tracked = 256;
+  static std::array<std::atomic<write_tracker *>, max_tracked> s_slots;
+  static struct sigaction s_prev_action;
+
+  bool
+  is_dirty(size_t p) const
+  {
+    return m_bits[p / 64].load(std::memory_order_relaxed) & (1ul << (p % 64));
+  }
+
+  // Page is made writable before it is marked dirty, see take_dirty().
+  bool
+  handle_fault(char *addr)
+  {
+    if (addr < m_base || addr >= m_base + m_size)
+      return false;
+    auto p = static_cast<size_t>(addr - m_base) / page_size;
+    if (mprotect(m_base + p * page_size, page_size, PROT_READ | PROT_WRITE)) {
+      // Can't split mapping any further, stop tracking it.
+      mprotect(m_base, m_npages * page_size, PROT_READ | PROT_WRITE);
+      m_broken.store(true, std::memory_order_release);
+    }
+    m_bits[p / 64].fetch_or(1ul << (p % 64), std::memory_order_relaxed);
+    return true;
+  }
+
+  static void
+  on_segv(int sig, siginfo_t *info, void *ctx)
+  {
+    if (info->si_code == SEGV_ACCERR) {
+      auto addr = static_cast<char *>(info->si_addr);
+      for (auto& slot : s_slots) {
+        auto t = slot.load(std::memory_order_acquire);
+        if (t && t->handle_fault(addr))
+          return;
+      }
+    }
+
+    // Not ours, hand it over to whoever was there before.
+    if (s_prev_action.sa_flags & SA_SIGINFO) {
+      s_prev_action.sa_sigaction(sig, info, ctx);
+    } else if (s_prev_action.sa_handler != SIG_DFL && s_prev_action.sa_handler != SIG_IGN) {
+      s_prev_action.sa_handler(sig);
+    } else {
+      // Faulting access is retried and gets default action.
+      signal(sig, SIG_DFL);
+    }
+  }
+
+  static void
+  install_handler()
+  {
+    static std::once_flag once;
+    std::call_once(once, [] {
+      struct sigaction sa = {};
+      sa.sa_sigaction = on_segv;
+      sa.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      if (sigaction(SIGSEGV, &sa, &s_prev_action))
+        shim_err(errno, "Failed to install SIGSEGV handler for BO write tracking");
+    });
+  }
+
+  char *m_base;
+  size_t m_size;
+  size_t m_npages;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_bits;
+  // Tracking has been given up on, everything is dirty from then on.
+  std::atomic<bool> m_broken = false;
+  size_t m_slot = 0;
+  std::mutex m_lock;
+};
+
+std::array<std::atomic<write_tracker *>, write_tracker::max_tracked> write_tracker::s_slots = {};
+struct sigaction write_tracker::s_prev_action = {};
+
 //
 // Impl for class buffer
 //
 
 buffer::
 buffer(const pdev& dev, size_t size, void *uptr, uint64_t flags)
-  : buffer(dev, size, bo_flags_to_type(flags, !!dev.get_heap_vaddr()), uptr)
+  : buffer(dev, size, bo_flags_to_type(flags, dev.has_dev_heap()), uptr, flags)
 {
-  m_flags = flags;
 }
 
 buffer::
 buffer(const pdev& dev, size_t size, uint64_t flags)
-  : buffer(dev, size, bo_flags_to_type(flags, !!dev.get_heap_vaddr()), nullptr)
+  : buffer(dev, size, bo_flags_to_type(flags, dev.has_dev_heap()), nullptr, flags)
 {
-  m_flags = flags;
 }
 
 buffer::
@@ -398,8 +1136,9 @@ buffer(const pdev& dev, size_t size, int type)
 }
 
 buffer::
-buffer(const pdev& dev, size_t size, int type, void *uptr)
+buffer(const pdev& dev, size_t size, int type, void *uptr, uint64_t flags)
   : m_pdev(dev)
+  , m_flags(flags)
   , m_uptr(uptr)
   , m_type(type)
   , m_total_size(size)
@@ -419,7 +1158,7 @@ buffer(const pdev& dev, size_t size, int type, void *uptr)
     shim_err(EINVAL, "User pointer BO must be AMDXDNA_BO_SHARE type.");
 
   // Prepare the mmap range for the entire buffer
-  m_range_addr = std::make_unique<mmap_ptr>(m_total_size, bo_addr_align(m_type));
+  m_range_addr = std::make_unique<mmap_ptr>(m_total_size, bo_vaddr_align(m_type, m_total_size));
 
   // Obtain the buffer
   expand(m_total_size);
@@ -427,8 +1166,83 @@ buffer(const pdev& dev, size_t size, int type, void *uptr)
 }
 
 buffer::
-buffer(const pdev& dev, xrt_core::shared_handle::export_handle ehdl)
+buffer(const pdev& dev, uint64_t flags, bo_backing&& backing)
+  : m_pdev(dev)
+  , m_flags(flags)
+  , m_range_addr(std::move(backing.m_range_addr))
+  , m_bos(std::move(backing.m_bos))
+  , m_uptr(backing.m_uptr)
+  , m_type(bo_flags_to_type(flags, dev.has_dev_heap()))
+{
+  for (auto& bo : m_bos) {
+    m_total_size += bo->m_size;
+    if (!bo->m_vaddr && bo->m_map_offset != AMDXDNA_INVALID_ADDR)
+      m_mmap_pending = true;
+  }
+  m_cur_size = m_total_size;
+  shim_debug("Reused %s", describe().c_str());
+}
+
+buffer::
+buffer(const pdev& dev, uint64_t flags, std::shared_ptr<bo_slab> slab, size_t offset, size_t size)
+  : m_pdev(dev)
+  , m_flags(flags)
+  , m_type(bo_flags_to_type(flags, dev.has_dev_heap()))
+  , m_total_size(size)
+  , m_cur_size(size)
+  , m_slab(std::move(slab))
+  , m_slab_offset(offset)
+{
+  shim_debug("Sub-allocated %s", describe().c_str());
+}
+
+buffer::
+buffer(std::shared_ptr<const buffer> parent, size_t offset, size_t size)
+  : m_pdev(parent->m_pdev)
+  , m_flags(parent->m_flags)
+  , m_imported(parent->m_imported)
+  , m_readonly(parent->m_readonly)
+  , m_type(parent->m_type)
+  , m_total_size(size)
+  , m_cur_size(size)
+  , m_slab_offset(offset)
+{
+  if (parent->m_slab)
+    shim_err(EINVAL, "Can't take sub-range of sub-allocated BO");
+  if (!size || offset + size > parent->size())
+    shim_err(EINVAL, "Bad sub-range offset 0x%lx size 0x%lx of BO of 0x%lx bytes",
+      offset, size, parent->size());
+  // Always on top of the BO owning DRM BOs, so that sub-range of a sub-range
+  // does not keep a chain of buffers alive.
+  if (parent->m_parent) {
+    m_slab_offset += parent->m_slab_offset;
+    parent = parent->m_parent;
+  }
+  m_parent = std::move(parent);
+  shim_debug("Sliced %s", describe().c_str());
+}
+
+bo_backing
+buffer::
+release_backing()
+{
+  bo_backing backing;
+  // New owner does not track writes, leave mapping writable for it.
+  m_write_tracked = false;
+  m_write_tracker.reset();
+  backing.m_range_addr = std::move(m_range_addr);
+  backing.m_bos = std::move(m_bos);
+  backing.m_uptr = m_uptr;
+  m_uptr = nullptr;
+  m_total_size = m_cur_size = 0;
+  return backing;
+}
+
+buffer::
+buffer(const pdev& dev, xrt_core::shared_handle::export_handle ehdl, bool readonly)
   : m_pdev(dev)
+  , m_imported(true)
+  , m_readonly(readonly)
   , m_type(AMDXDNA_BO_SHARE)
 {
   auto bo = std::make_unique<drm_bo>(dev, ehdl);
@@ -446,6 +1260,9 @@ void
 buffer::
 expand(size_t size)
 {
+  if (parent())
+    shim_err(EINVAL, "Can't expand sub-allocated BO");
+
   size = (m_type == AMDXDNA_BO_DEV_HEAP) ? heap_page_size_roundup(size) : size;
   auto cur_sz = m_cur_size;
   auto new_sz = size + m_cur_size;
@@ -458,8 +1275,15 @@ expand(size_t size)
   if (m_uptr)
     bo = std::make_unique<drm_bo>(m_pdev, size, m_uptr);
   else
-    bo = std::make_unique<drm_bo>(m_pdev, size, m_type);
-  mmap_drm_bo(bo.get());
+    bo = std::make_unique<drm_bo>(m_pdev, size, m_type, is_wc_bo_flags(m_flags, m_type));
+  // CPU mapping of host BO with device address is not needed by shim, map it
+  // only when asked for. For user pointer BO, it is never needed. Heap is
+  // accessed through its mapping by all device BOs, so map it right away.
+  if (is_lazy_bo_mmap() && m_type != AMDXDNA_BO_DEV_HEAP &&
+    bo->m_xdna_addr != AMDXDNA_INVALID_ADDR && bo->m_map_offset != AMDXDNA_INVALID_ADDR)
+    m_mmap_pending = true;
+  else
+    mmap_drm_bo(bo.get());
 
   m_bos.push_back(std::move(bo));
   m_cur_size += size;
@@ -475,39 +1299,134 @@ expand(size_t size)
 buffer::
 ~buffer()
 {
+  // DRM BO may be gone already, see release_backing()
+  trace_stream::emit_bo(trace_stream::event::bo_free, this, 0, size(), m_flags);
+  m_write_tracker.reset();
+  if (m_slab) {
+    shim_debug("Destroying %s", describe().c_str());
+    m_slab->free(m_slab_offset);
+    return;
+  }
+  if (m_parent) {
+    shim_debug("Destroying %s", describe().c_str());
+    return;
+  }
+  // Nothing to describe if backing has been handed over.
+  if (m_bos.empty())
+    return;
   shim_debug("Destroying %s", describe().c_str());
 }
 
 void
 buffer::
-mmap_drm_bo(drm_bo *bo)
+mmap_drm_bo(drm_bo *bo) const
 {
   if (bo->m_map_offset == AMDXDNA_INVALID_ADDR) {
     if (m_type != AMDXDNA_BO_DEV)
       shim_err(EINVAL, "Non-DEV BO without mmap offset!");
     return;
   }
-  bo->m_vaddr = m_range_addr->alloc(&m_pdev, bo->m_map_offset, bo->m_size);
+  bo->m_vaddr = m_range_addr->alloc(&m_pdev, bo->m_map_offset, bo->m_size,
+    m_readonly ? PROT_READ : PROT_READ | PROT_WRITE);
+  eager_mmap_count++;
 }
 
-void *
+void
 buffer::
-map(map_type t)
+mmap_deferred() const
 {
-  if (t != map_type::write)
-    shim_err(EINVAL, "Not support map BO as readonly. Type must be bo::map_type::write");
-  return vaddr();
+  std::lock_guard<std::mutex> lg(m_mmap_lock);
+  if (!m_mmap_pending)
+    return;
+
+  // BOs have to be mapped in order since they share one mmap range.
+  for (auto& bo : m_bos) {
+    if (bo->m_vaddr || bo->m_map_offset == AMDXDNA_INVALID_ADDR)
+      continue;
+    bo->m_vaddr = m_range_addr->alloc(&m_pdev, bo->m_map_offset, bo->m_size);
+    lazy_mmap_count++;
+  }
+  m_mmap_lazy = true;
+  m_mmap_pending = false;
 }
 
-void *
+bool
 buffer::
-vaddr() const
+is_mmap_deferred() const
 {
-  if (m_uptr)
-    return m_uptr;
+  return !m_uptr && m_mmap_pending;
+}
 
-  auto& bo = m_bos[0];
-  if (bo->m_map_offset != AMDXDNA_INVALID_ADDR)
+bool
+buffer::
+is_write_combined() const
+{
+  if (m_parent)
+    return m_parent->is_write_combined();
+  return !m_bos.empty() &&
+    std::all_of(m_bos.begin(), m_bos.end(), [](auto& bo) { return bo->m_wc; });
+}
+
+void *
+buffer::
+map(map_type t)
+{
+  if (m_readonly) {
+    if (t != map_type::read)
+      shim_err(EACCES, "BO is imported read-only. Type must be bo::map_type::read");
+  } else if (t != map_type::write) {
+    shim_err(EINVAL, "Not support map BO as readonly. Type must be bo::map_type::write");
+  }
+  auto p = vaddr();
+  if (is_bo_write_tracking() && !m_readonly)
+    std::call_once(m_track_once, [this] { track_writes(); });
+  return p;
+}
+
+void
+buffer::
+track_writes()
+{
+  // Only BOs flushed through their own mapping, which nothing else shares.
+  // Device BO is on heap mapping shared with others.
+  if (m_type != AMDXDNA_BO_SHARE || parent() || m_uptr || m_imported ||
+    m_pdev.is_cache_coherent() || is_write_combined() || is_driver_sync())
+    return;
+
+  try {
+    m_write_tracker = std::make_unique<write_tracker>(static_cast<char *>(vaddr()), size());
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("BO %d is not write tracked: %s", id().handle, e.what());
+    return;
+  }
+  m_write_tracked.store(true, std::memory_order_release);
+  shim_debug("Tracking writes to BO %d", id().handle);
+}
+
+std::vector< std::pair<size_t, size_t> >
+buffer::
+take_dirty(size_t sz, size_t offset)
+{
+  if (m_write_tracked.load(std::memory_order_acquire))
+    return m_write_tracker->take_dirty(sz, offset);
+  return { { offset, sz } };
+}
+
+void *
+buffer::
+vaddr() const
+{
+  if (auto p = parent())
+    return static_cast<char*>(p->vaddr()) + m_slab_offset;
+
+  if (m_uptr)
+    return m_uptr;
+
+  if (m_mmap_pending)
+    mmap_deferred();
+
+  auto& bo = m_bos[0];
+  if (bo->m_map_offset != AMDXDNA_INVALID_ADDR)
     return reinterpret_cast<char*>(bo->m_vaddr->get());
 
   // Must be DEV BO.
@@ -540,6 +1459,15 @@ std::unique_ptr<xrt_core::shared_handle>
 buffer::
 share() const 
 {
+  // Exporting the slab would expose other BOs carved out of it.
+  if (m_slab)
+    shim_not_supported_err(__func__);
+
+  if (m_parent)
+    return m_parent->share(m_slab_offset, size());
+
+  // Importers rely on fences of submissions using it
+  m_pdev.exclude_resident_bo(id().handle);
   export_bo_arg arg = {
     .bo = id(),
     .fd = -1,
@@ -550,6 +1478,27 @@ share() const
   return std::make_unique<shared>(arg.fd);
 }
 
+std::unique_ptr<xrt_core::shared_handle>
+buffer::
+share(size_t offset, size_t sz) const
+{
+  if (m_parent)
+    return m_parent->share(m_slab_offset + offset, sz);
+  if (!sz || offset + sz > size())
+    shim_err(EINVAL, "Bad export range offset 0x%lx size 0x%lx", offset, sz);
+
+  // There is no dma-buf of part of a BO, range is only known to importer.
+  m_pdev.exclude_resident_bo(id().handle);
+  export_bo_arg arg = {
+    .bo = id(),
+    .fd = -1,
+  };
+  m_pdev.drv_ioctl(drv_ioctl_cmd::export_bo, &arg);
+
+  shim_debug("Exported BO %d range 0x%lx+0x%lx to fd %d", id().handle, offset, sz, arg.fd);
+  return std::make_unique<shared_range>(arg.fd, offset, sz);
+}
+
 void
 buffer::
 bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
@@ -577,6 +1526,8 @@ bo_id
 buffer::
 id(int index) const
 {
+  if (auto p = parent())
+    return p->id(index);
   return m_bos[index]->m_id;
 }
 
@@ -584,6 +1535,9 @@ uint64_t
 buffer::
 paddr() const
 {
+  if (auto p = parent())
+    return p->paddr() + m_slab_offset;
+
   auto xdna_addr = m_bos[0]->m_xdna_addr;
   return (xdna_addr != AMDXDNA_INVALID_ADDR) ?
     xdna_addr : reinterpret_cast<uintptr_t>(m_bos[0]->m_vaddr->get());
@@ -610,6 +1564,15 @@ get_flags() const
   return m_flags;
 }
 
+const buffer *
+buffer::
+parent() const
+{
+  if (m_slab)
+    return &m_slab->get_buffer();
+  return m_parent.get();
+}
+
 std::string
 buffer::
 describe() const
@@ -623,21 +1586,51 @@ describe() const
     desc += std::to_string(id(i).handle);
     desc += " ";
   }
+  if (parent()) {
+    desc += std::to_string(id().handle);
+    desc += "+";
+    desc += to_hex_string(m_slab_offset);
+    desc += " ";
+  }
 
   desc += "sz=";
   desc += to_hex_string(size());
 
+  if (!m_bos.empty()) {
+    uint32_t segs = 0;
+    for (auto& bo : m_bos)
+      segs += bo->m_nr_segs;
+    desc += " ";
+    desc += "segs=";
+    desc += std::to_string(segs);
+  }
+
   desc += " ";
   desc += "paddr=";
   desc += to_hex_string(paddr());
 
   desc += " ";
   desc += "vaddr=";
-  desc += to_hex_string(reinterpret_cast<uint64_t>(vaddr()));
+  if (is_mmap_deferred())
+    desc += "deferred";
+  else
+    desc += to_hex_string(reinterpret_cast<uint64_t>(vaddr()));
 
   desc += " ";
   desc += "uptr=";
   desc += to_hex_string(reinterpret_cast<uint64_t>(m_uptr));
+
+  desc += " ";
+  desc += "mmap=";
+  desc += m_mmap_lazy ? "lazy" : "eager";
+  desc += "(";
+  desc += std::to_string(eager_mmap_count.load());
+  desc += "/";
+  desc += std::to_string(lazy_mmap_count.load());
+  desc += ")";
+
+  if (is_write_combined())
+    desc += " wc";
   return desc;
 }
 
@@ -648,34 +1641,298 @@ sync_by_driver(direction dir, size_t sz, size_t offset)
   if (offset + sz > size())
     shim_err(EINVAL, "Invalid BO offset and size for sync'ing: %ld, %ld", offset, sz);
 
-  sync_bo_arg arg = {
-    .bo = id(),
-    .direction = dir,
-    .offset = offset,
-    .size = sz,
-  };
-  m_pdev.drv_ioctl(drv_ioctl_cmd::sync_bo, &arg);
+  if (batched_driver_syncs) {
+    // One range, chunks only help with parallel ioctls
+    batched_driver_syncs->push_back({
+      .bo = id(),
+      .direction = dir,
+      .offset = m_slab_offset + offset,
+      .size = sz,
+    });
+    shim_debug("Batched driver sync of BO %d: offset=%ld, size=%ld", id().handle, offset, sz);
+    return;
+  }
+
+  SHIM_TRACE_POINT_SCOPE2(sync_bo_by_driver, id().handle, sz);
+  for_each_sync_chunk(offset, sz, [this, dir](size_t off, size_t len) {
+    sync_bo_arg arg = {
+      .bo = id(),
+      .direction = dir,
+      .offset = m_slab_offset + off,
+      .size = len,
+    };
+    m_pdev.drv_ioctl(drv_ioctl_cmd::sync_bo, &arg);
+  });
   shim_debug("Sync'ed BO %d in driver: offset=%ld, size=%ld", id().handle, offset, sz);
 }
 
+buffer::driver_sync_batch::
+driver_sync_batch(std::vector<sync_bo_arg>& args)
+  : m_prev(batched_driver_syncs)
+{
+  batched_driver_syncs = &args;
+}
+
+buffer::driver_sync_batch::
+~driver_sync_batch()
+{
+  batched_driver_syncs = m_prev;
+}
+
 void
 buffer::
 sync(direction dir, size_t sz, size_t offset)
 {
+  if (trace_stream::enabled()) {
+    // Don't map BO just for sampling its content
+    bool sample = dir == direction::host2device && !m_imported && !is_mmap_deferred() &&
+      offset + sz <= size();
+    trace_stream::emit_bo_sync(this, static_cast<uint32_t>(dir), offset, sz,
+      sample ? static_cast<char *>(vaddr()) + offset : nullptr);
+  }
+
   if (m_pdev.is_cache_coherent())
     return;
 
-  if (is_driver_sync()) {
+  // Nothing in CPU cache to flush, device reads CPU writes once WC buffers
+  // are drained.
+  if (is_write_combined()) {
+    if (dir == direction::host2device)
+      wc_drain();
+    return;
+  }
+
+  // Let driver flush through its own mapping rather than mapping the BO just
+  // for that. CPU has not written to it through shim anyway. Imported BO may
+  // be memory of other device, only its exporter knows how to sync it.
+  if (is_driver_sync() || is_mmap_deferred() || m_imported) {
     sync_by_driver(dir, sz, offset);
     return;
   }
 
   if (offset + sz > size())
     shim_err(EINVAL, "Invalid BO offset and size for sync'ing: %ld, %ld", offset, sz);
-  clflush_data(vaddr(), offset, sz); 
+  SHIM_TRACE_POINT_SCOPE2(sync_bo, id().handle, sz);
+  auto base = vaddr();
+  bool to_device = (dir == direction::host2device);
+  auto flush = [base, to_device](size_t off, size_t len) {
+    clflush_data(base, off, len, to_device);
+  };
+  if (to_device) {
+    // Skip what write() has already put in memory
+    for (auto& d : take_dirty(sz, offset)) {
+      for (auto& r : take_unclean(d.second, d.first))
+        for_each_sync_chunk(r.first, r.second, flush);
+    }
+  } else {
+    for_each_sync_chunk(offset, sz, flush);
+  }
   shim_debug("Sync'ed BO %d: offset=%ld, size=%ld", id().handle, offset, sz);
 }
 
+std::unique_ptr<xrt_core::fence_handle>
+buffer::
+sync_async(direction dir, size_t sz, size_t offset)
+{
+  static async_sync_queue queue;
+
+  if (offset + sz > size())
+    shim_err(EINVAL, "Invalid BO offset and size for sync'ing: %ld, %ld", offset, sz);
+
+  // Worker signals its own copy of the fence, so that it does not depend on
+  // life time of the one returned to caller.
+  auto signal_fence = std::make_shared<fence>(m_pdev);
+  auto wait_fence = signal_fence->clone();
+  shim_debug("Queuing async sync of BO %d: offset=%ld, size=%ld, fence=%s",
+    id().handle, offset, sz, signal_fence->describe().c_str());
+
+  queue.push([this, dir, sz, offset, signal_fence]() {
+    try {
+      sync(dir, sz, offset);
+    } catch (const xrt_core::system_error& e) {
+      // Still signal the fence, or its waiters will be stuck forever.
+      std::cout << "Failed to sync BO " << std::to_string(id().handle)
+        << " asynchronously: " << e.what() << std::endl;
+    }
+    try {
+      signal_fence->signal();
+    } catch (const xrt_core::system_error& e) {
+      std::cout << "Failed to signal async sync fence: " << e.what() << std::endl;
+    }
+  });
+  return wait_fence;
+}
+
+void
+buffer::
+write(size_t offset, const void *src, size_t len)
+{
+  if (m_readonly)
+    shim_err(EACCES, "BO %d is imported read-only", id().handle);
+  if (offset + len > size())
+    shim_err(EINVAL, "Invalid BO offset and size for writing: %ld, %ld", offset, len);
+  if (!len)
+    return;
+
+  auto dst = static_cast<char *>(vaddr()) + offset;
+  auto s = static_cast<const char *>(src);
+  auto stream_copy = get_stream_copy();
+  // Nothing for sync() to skip, or it does not flush through our mapping.
+  if (!stream_copy || m_pdev.is_cache_coherent() || is_write_combined() ||
+    is_driver_sync() || m_imported) {
+    std::memcpy(dst, s, len);
+    return;
+  }
+
+  SHIM_TRACE_POINT_SCOPE2(write_bo, id().handle, len);
+  const size_t line = 64;
+  auto head = std::min(len, static_cast<size_t>(
+    static_cast<char *>(next_aligned_addr(dst, line)) - dst));
+  auto body = (len - head) & ~(line - 1);
+  auto tail = len - head - body;
+
+  // Partial lines at both ends go through cache, flush them here.
+  std::memcpy(dst, s, head);
+  std::memcpy(dst + head + body, s + head + body, tail);
+  clflush_data(vaddr(), offset, head, true);
+  clflush_data(vaddr(), offset + head + body, tail, true);
+  stream_copy(dst + head, s + head, body);
+  shim_debug("Wrote BO %d around cache: offset=%ld, size=%ld", id().handle, offset, len);
+
+  // Pages fully written are clean now, partial ones may have been written
+  // through mapping as well.
+  std::lock_guard<std::mutex> lg(m_clean_lock);
+  auto first = (offset + page_size - 1) / page_size;
+  auto last = (offset + len) / page_size;
+  if (first >= last)
+    return;
+  if (m_clean_map.empty())
+    m_clean_map.resize((size() / page_size + 1 + 63) / 64);
+  for (auto p = first; p < last; p++)
+    m_clean_map[p / 64] |= (1ul << (p % 64));
+}
+
+void
+buffer::
+read(size_t offset, void *dst, size_t len)
+{
+  if (offset + len > size())
+    shim_err(EINVAL, "Invalid BO offset and size for reading: %ld, %ld", offset, len);
+  if (!len)
+    return;
+
+  auto src = static_cast<const char *>(vaddr()) + offset;
+  auto d = static_cast<char *>(dst);
+#if defined(__x86_64__) || defined(_M_X64)
+  if (is_write_combined() && !m_pdev.is_cache_coherent() &&
+    __builtin_cpu_supports("sse4.1") && get_stream_copy()) {
+    auto head = std::min(len, static_cast<size_t>(
+      static_cast<const char *>(next_aligned_addr(const_cast<char *>(src), 16)) - src));
+    // Aligned loads need aligned stores as well, or it is no faster.
+    if (!((reinterpret_cast<uintptr_t>(d) + head) % 16)) {
+      auto body = (len - head) & ~size_t(15);
+      std::memcpy(d, src, head);
+      stream_load_sse41(d + head, src + head, body);
+      std::memcpy(d + head + body, src + head + body, len - head - body);
+      return;
+    }
+  }
+#endif
+  if (m_pdev.is_cache_coherent() || is_write_combined() || is_driver_sync() || m_imported) {
+    sync(direction::device2host, len, offset);
+    std::memcpy(d, src, len);
+    return;
+  }
+
+  // Invalidate and copy one chunk at a time, so that lines are brought in
+  // once and copied out while still in cache.
+  SHIM_TRACE_POINT_SCOPE2(read_bo, id().handle, len);
+  const size_t chunk_size = 256 * 1024;
+  for (size_t off = 0; off < len; off += chunk_size) {
+    auto n = std::min(chunk_size, len - off);
+    clflush_data(vaddr(), offset + off, n, false);
+    std::memcpy(d + off, src + off, n);
+  }
+}
+
+std::vector< std::pair<size_t, size_t> >
+buffer::
+take_unclean(size_t sz, size_t offset)
+{
+  std::vector< std::pair<size_t, size_t> > ranges;
+  auto is_clean = [this](size_t p) { return m_clean_map[p / 64] & (1ul << (p % 64)); };
+  const auto end = offset + sz;
+
+  std::lock_guard<std::mutex> lg(m_clean_lock);
+  if (m_clean_map.empty() || !sz) {
+    ranges.emplace_back(offset, sz);
+    return ranges;
+  }
+
+  // Clean pages are skipped once, and are assumed dirty again after.
+  auto last = (end - 1) / page_size;
+  for (auto p = offset / page_size; p <= last;) {
+    if (is_clean(p)) {
+      m_clean_map[p / 64] &= ~(1ul << (p % 64));
+      p++;
+      continue;
+    }
+    auto first = p;
+    while (p <= last && !is_clean(p))
+      p++;
+    auto s = std::max(first * page_size, offset);
+    auto e = std::min(p * page_size, end);
+    ranges.emplace_back(s, e - s);
+  }
+  return ranges;
+}
+
+void
+buffer::
+set_patch_table(std::vector<size_t> offsets)
+{
+  for (auto off : offsets) {
+    if (off % sizeof(uint32_t) || off + sizeof(uint64_t) > size())
+      shim_err(EINVAL, "Invalid patch table offset of BO %d: %ld", id().handle, off);
+  }
+  std::sort(offsets.begin(), offsets.end());
+  m_patch_table = std::move(offsets);
+}
+
+void
+buffer::
+patch_args(const std::vector<uint64_t>& values)
+{
+  if (values.size() != m_patch_table.size())
+    shim_err(EINVAL, "Expect %ld patch values for BO %d, got %ld",
+      m_patch_table.size(), id().handle, values.size());
+
+  // Cacheline aligned ranges with slots written, adjacent lines merged.
+  std::vector< std::pair<size_t, size_t> > ranges;
+  auto base = static_cast<char *>(vaddr());
+  const size_t line = cacheline_size;
+  for (size_t i = 0; i < values.size(); i++) {
+    auto off = m_patch_table[i];
+    uint64_t cur;
+    std::memcpy(&cur, base + off, sizeof(cur));
+    if (cur == values[i])
+      continue;
+    std::memcpy(base + off, &values[i], sizeof(values[i]));
+
+    auto s = off / line * line;
+    auto e = std::min((off + sizeof(uint64_t) + line - 1) / line * line, size());
+    if (!ranges.empty() && s <= ranges.back().first + ranges.back().second)
+      ranges.back().second = e - ranges.back().first;
+    else
+      ranges.emplace_back(s, e - s);
+  }
+
+  for (auto& r : ranges)
+    sync(direction::host2device, r.second, r.first);
+  shim_debug("Patched %ld args of BO %d, sync'ed %ld ranges",
+    values.size(), id().handle, ranges.size());
+}
+
 std::set<bo_id>
 buffer::
 get_arg_bo_ids() const
@@ -685,6 +1942,16 @@ get_arg_bo_ids() const
   return ret;
 }
 
+bool
+buffer::
+get_single_arg_bo_id(bo_id& bid) const
+{
+  if (!parent() && m_bos.size() != 1)
+    return false;
+  bid = id();
+  return true;
+}
+
 std::set<const buffer *>
 buffer::
 get_arg_bos() const
@@ -700,6 +1967,25 @@ get_arg_bos() const
 cmd_buffer::
 cmd_buffer(const pdev& dev, size_t size, uint64_t flags)
   : buffer(dev, size, flags)
+  , m_dump_arg_bos(get_dump_arg_bos())
+  , m_cmd_timestamps(get_cmd_timestamps())
+{
+  dev.insert_bo_handle(id().handle, this);
+}
+
+cmd_buffer::
+cmd_buffer(const pdev& dev, size_t size, uint64_t flags, std::weak_ptr<cmd_bo_pool> pool)
+  : cmd_buffer(dev, size, flags)
+{
+  m_pool = std::move(pool);
+}
+
+cmd_buffer::
+cmd_buffer(const pdev& dev, uint64_t flags, bo_backing&& backing, std::weak_ptr<cmd_bo_pool> pool)
+  : buffer(dev, flags, std::move(backing))
+  , m_dump_arg_bos(get_dump_arg_bos())
+  , m_cmd_timestamps(get_cmd_timestamps())
+  , m_pool(std::move(pool))
 {
   dev.insert_bo_handle(id().handle, this);
 }
@@ -708,33 +1994,49 @@ cmd_buffer::
 ~cmd_buffer()
 {
   m_pdev.remove_bo_handle(id().handle);
+
+  // Driver keeps prebuilt cmdlist with the cmd BO, don't let it be reused.
+  auto pool = m_pool.lock();
+  if (pool && !(m_chain_cmdlist && m_chain_cmdlist->list_bo)) {
+    auto sz = size();
+    pool->recycle(release_backing(), sz);
+  }
 }
 
 void
 cmd_buffer::
 mark_enqueued() const
 {
-  std::unique_lock<std::mutex> lg(m_submission_lock);
-  m_submitted = false;
+  m_submit_state.store(submit_state_pending, std::memory_order_relaxed);
 }
 
 uint64_t
 cmd_buffer::
 wait_for_submitted() const
 {
-  std::unique_lock<std::mutex> lg(m_submission_lock);
-  m_submission_cv.wait(lg, [this]() { return m_submitted; });
-  return m_cmd_seq;
+  auto state = m_submit_state.load(std::memory_order_acquire);
+  while (state != submit_state_done) {
+    // Tell submitter that there is someone to wake up before going to sleep.
+    if (state == submit_state_pending &&
+      !m_submit_state.compare_exchange_weak(state, submit_state_pending_waited,
+        std::memory_order_acquire)) {
+      continue;
+    }
+    futex_wait(&m_submit_state, submit_state_pending_waited);
+    state = m_submit_state.load(std::memory_order_acquire);
+  }
+  return m_cmd_seq.load(std::memory_order_relaxed);
 }
 
 void
 cmd_buffer::
 mark_submitted(uint64_t seq) const
 {
-  std::unique_lock<std::mutex> lg(m_submission_lock);
-  m_cmd_seq = seq;
-  m_submitted = true;
-  m_submission_cv.notify_all();
+  trace_stream::emit_cmd(trace_stream::event::cmd_submit, id().handle, seq);
+  m_cmd_seq.store(seq, std::memory_order_relaxed);
+  auto prev = m_submit_state.exchange(submit_state_done, std::memory_order_release);
+  if (prev == submit_state_pending_waited)
+    futex_wake_all(&m_submit_state);
 }
 
 void
@@ -747,7 +2049,15 @@ bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
   auto boh = reinterpret_cast<const buffer*>(bh);
   std::lock_guard<std::mutex> lg(m_args_map_lock);
 
-  m_args_map[pos] = boh->get_arg_bo_ids();
+  auto& slot = arg_slot(pos);
+  if (boh->get_single_arg_bo_id(slot)) {
+    if (!m_multi_bo_args.empty())
+      m_multi_bo_args.erase(pos);
+  } else {
+    slot = {};
+    m_multi_bo_args[pos] = boh->get_arg_bo_ids();
+  }
+  m_arg_bo_hdls_dirty = true;
 
   // Collecting BO handles for dumping BO content before cmd submission.
   // BO content dumping out is off by default.
@@ -768,10 +2078,48 @@ cmd_buffer::
 reset()
 {
   std::lock_guard<std::mutex> lg(m_args_map_lock);
-  m_args_map.clear();
+  std::fill_n(m_inline_args.begin(), std::min(m_num_args, num_inline_args), bo_id{});
+  m_more_args.clear();
+  m_num_args = 0;
+  m_multi_bo_args.clear();
+  m_arg_bo_hdls.clear();
+  m_arg_bo_hdls_dirty = false;
   m_arg_bos_map.clear();
+  // Keep capacity for the next runlist.
   m_subcmds.clear();
-  m_subcmds.shrink_to_fit();
+}
+
+bo_id&
+cmd_buffer::
+arg_slot(size_t pos)
+{
+  m_num_args = std::max(m_num_args, pos + 1);
+  if (pos < num_inline_args)
+    return m_inline_args[pos];
+
+  auto idx = pos - num_inline_args;
+  if (idx >= m_more_args.size())
+    m_more_args.resize(idx + 1);
+  return m_more_args[idx];
+}
+
+template <typename F>
+void
+cmd_buffer::
+for_each_arg_bo_id(F&& fn) const
+{
+  for (size_t i = 0; i < std::min(m_num_args, num_inline_args); i++) {
+    if (m_inline_args[i].handle != AMDXDNA_INVALID_BO_HANDLE)
+      fn(m_inline_args[i]);
+  }
+  for (const auto& id : m_more_args) {
+    if (id.handle != AMDXDNA_INVALID_BO_HANDLE)
+      fn(id);
+  }
+  for (const auto& m : m_multi_bo_args) {
+    for (const auto& id : m.second)
+      fn(id);
+  }
 }
 
 std::set<bo_id>
@@ -781,12 +2129,36 @@ get_arg_bo_ids() const
   std::set<bo_id> ret;
   std::lock_guard<std::mutex> lg(m_args_map_lock);
 
-  // For cmd BO, arg bo handles contains everything in args_map.
-  for (const auto& m : m_args_map)
-    ret.insert(m.second.begin(), m.second.end());
+  // For cmd BO, arg bo handles contains all bound arg BOs.
+  for_each_arg_bo_id([&ret](const bo_id& id) { ret.insert(id); });
   return ret;
 }
 
+bool
+cmd_buffer::
+get_single_arg_bo_id(bo_id& id) const
+{
+  return false;
+}
+
+const std::vector<uint32_t>&
+cmd_buffer::
+get_arg_bo_handles() const
+{
+  std::lock_guard<std::mutex> lg(m_args_map_lock);
+
+  if (!m_arg_bo_hdls_dirty)
+    return m_arg_bo_hdls;
+
+  m_arg_bo_hdls.clear();
+  for_each_arg_bo_id([this](const bo_id& id) { m_arg_bo_hdls.push_back(id.handle); });
+  std::sort(m_arg_bo_hdls.begin(), m_arg_bo_hdls.end());
+  auto last = std::unique(m_arg_bo_hdls.begin(), m_arg_bo_hdls.end());
+  m_arg_bo_hdls.erase(last, m_arg_bo_hdls.end());
+  m_arg_bo_hdls_dirty = false;
+  return m_arg_bo_hdls;
+}
+
 std::set<const buffer *>
 cmd_buffer::
 get_arg_bos() const
@@ -807,6 +2179,391 @@ get_subcmd_list() const
   return m_subcmds;
 }
 
+chain_cmdlist&
+cmd_buffer::
+get_chain_cmdlist() const
+{
+  if (!m_chain_cmdlist)
+    m_chain_cmdlist = std::make_unique<chain_cmdlist>();
+  return *m_chain_cmdlist;
+}
+
+bool
+cmd_buffer::
+is_dump_arg_bos() const
+{
+  return m_dump_arg_bos;
+}
+
+void
+cmd_buffer::
+request_timestamps() const
+{
+  if (!m_cmd_timestamps)
+    return;
+
+  auto pkt = reinterpret_cast<ert_start_kernel_cmd *>(vaddr());
+  auto ts = reinterpret_cast<char *>(ert_start_kernel_timestamps(pkt));
+  if (ts + sizeof(cu_cmd_state_timestamps) > reinterpret_cast<char *>(vaddr()) + size()) {
+    shim_debug("No room for timestamps in cmd BO %d", id().handle);
+    return;
+  }
+  pkt->stat_enabled = 1;
+}
+
+bool
+cmd_buffer::
+get_timestamps(uint64_t& start_ns, uint64_t& end_ns) const
+{
+  auto pkt = reinterpret_cast<ert_start_kernel_cmd *>(vaddr());
+  if (!pkt->stat_enabled || pkt->state < ERT_CMD_STATE_COMPLETED || pkt->state > ERT_CMD_STATE_TIMEOUT)
+    return false;
+
+  // Laid out right after payload, which is only 32-bit aligned
+  cu_cmd_state_timestamps ts;
+  std::memcpy(&ts, ert_start_kernel_timestamps(pkt), sizeof(ts));
+  start_ns = ts.skc_timestamps[ERT_CMD_STATE_RUNNING - ERT_CMD_STATE_NEW];
+  end_ns = ts.skc_timestamps[pkt->state - ERT_CMD_STATE_NEW];
+  return start_ns && end_ns >= start_ns;
+}
+
+//
+// Impl for class cmd_bo_pool
+//
+
+cmd_bo_pool::
+cmd_bo_pool(const pdev& dev)
+  : m_pdev(dev)
+  , m_max_per_class(get_cmd_bo_pool_size())
+{
+}
+
+cmd_bo_pool::
+~cmd_bo_pool()
+{
+  shim_debug("Cmd BO pool hit %ld, miss %ld", m_hit.load(), m_miss.load());
+}
+
+std::unique_ptr<cmd_buffer>
+cmd_bo_pool::
+alloc(size_t size, uint64_t flags)
+{
+  if (!m_max_per_class)
+    return nullptr;
+
+  auto it = std::lower_bound(m_size_classes.begin(), m_size_classes.end(), size);
+  if (it == m_size_classes.end())
+    return nullptr;
+  auto idx = it - m_size_classes.begin();
+
+  bo_backing backing;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    auto& free_list = m_free[idx];
+    if (!free_list.empty()) {
+      backing = std::move(free_list.back());
+      free_list.pop_back();
+    }
+  }
+
+  if (backing.m_bos.empty()) {
+    m_miss++;
+    return std::make_unique<cmd_buffer>(m_pdev, *it, flags, weak_from_this());
+  }
+
+  m_hit++;
+  auto bo = std::make_unique<cmd_buffer>(m_pdev, flags, std::move(backing), weak_from_this());
+  // Fresh BO from driver is zeroed, make recycled one look the same.
+  std::memset(bo->vaddr(), 0, size);
+  return bo;
+}
+
+void
+cmd_bo_pool::
+recycle(bo_backing&& backing, size_t size)
+{
+  auto it = std::find(m_size_classes.begin(), m_size_classes.end(), size);
+  if (it == m_size_classes.end())
+    return;
+
+  std::lock_guard<std::mutex> lg(m_lock);
+  auto& free_list = m_free[it - m_size_classes.begin()];
+  if (free_list.size() < m_max_per_class)
+    free_list.push_back(std::move(backing));
+}
+
+size_t
+cmd_bo_pool::
+trim()
+{
+  std::array<std::vector<bo_backing>, m_size_classes.size()> dropped;
+  size_t cnt = 0;
+
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    dropped.swap(m_free);
+  }
+  // BOs are freed by driver when dropped goes out of scope, after lock is
+  // released.
+  for (auto& l : dropped)
+    cnt += l.size();
+  return cnt;
+}
+
+uint64_t
+cmd_bo_pool::
+get_hit_count() const
+{
+  return m_hit;
+}
+
+uint64_t
+cmd_bo_pool::
+get_miss_count() const
+{
+  return m_miss;
+}
+
+//
+// Impl for class uptr_buffer
+//
+
+uptr_buffer::
+uptr_buffer(const pdev& dev, size_t size, void *uptr, uint64_t flags,
+  std::weak_ptr<uptr_bo_cache> cache)
+  : buffer(dev, size, uptr, flags)
+  , m_cache(std::move(cache))
+{
+}
+
+uptr_buffer::
+uptr_buffer(const pdev& dev, uint64_t flags, bo_backing&& backing,
+  std::weak_ptr<uptr_bo_cache> cache)
+  : buffer(dev, flags, std::move(backing))
+  , m_cache(std::move(cache))
+{
+}
+
+uptr_buffer::
+~uptr_buffer()
+{
+  auto cache = m_cache.lock();
+  if (cache) {
+    auto sz = size();
+    auto flags = get_flags();
+    cache->recycle(release_backing(), sz, flags);
+  }
+}
+
+//
+// Impl for class uptr_bo_cache
+//
+
+uptr_bo_cache::
+uptr_bo_cache(const pdev& dev)
+  : m_pdev(dev)
+  , m_max_entries(get_uptr_bo_cache_size())
+{
+}
+
+uptr_bo_cache::
+~uptr_bo_cache()
+{
+  shim_debug("Uptr BO cache hit %ld, miss %ld", m_hit, m_miss);
+}
+
+std::unique_ptr<uptr_buffer>
+uptr_bo_cache::
+alloc(void *uptr, size_t size, uint64_t flags)
+{
+  if (!m_max_entries)
+    return nullptr;
+
+  bo_backing backing;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    auto it = std::find_if(m_lru.begin(), m_lru.end(), [=](const entry& e) {
+      return e.m_uptr == uptr && e.m_size == size && e.m_flags == flags;
+    });
+    if (it == m_lru.end()) {
+      m_miss++;
+    } else {
+      m_hit++;
+      backing = std::move(it->m_backing);
+      m_lru.erase(it);
+    }
+  }
+
+  if (backing.m_bos.empty())
+    return std::make_unique<uptr_buffer>(m_pdev, size, uptr, flags, weak_from_this());
+
+  auto bo = std::make_unique<uptr_buffer>(m_pdev, flags, std::move(backing), weak_from_this());
+  // Same as newly created BO, flush whatever CPU left in cache so that it
+  // does not pollute output from device.
+  bo->sync(xrt_core::buffer_handle::direction::host2device, size, 0);
+  return bo;
+}
+
+void
+uptr_bo_cache::
+recycle(bo_backing&& backing, size_t size, uint64_t flags)
+{
+  std::list<entry> evicted;
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  m_lru.push_front({ backing.m_uptr, size, flags, std::move(backing) });
+  while (m_lru.size() > m_max_entries)
+    evicted.splice(evicted.end(), m_lru, std::prev(m_lru.end()));
+  // Evicted backing is unpinned by driver when evicted goes out of scope,
+  // after lock is released.
+}
+
+void
+uptr_bo_cache::
+invalidate(void *uptr, size_t size)
+{
+  std::list<entry> invalid;
+  auto start = reinterpret_cast<uintptr_t>(uptr);
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  for (auto it = m_lru.begin(); it != m_lru.end();) {
+    auto s = reinterpret_cast<uintptr_t>(it->m_uptr);
+    auto next = std::next(it);
+    if (s < start + size && start < s + it->m_size)
+      invalid.splice(invalid.end(), m_lru, it);
+    it = next;
+  }
+}
+
+size_t
+uptr_bo_cache::
+trim()
+{
+  std::list<entry> dropped;
+
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    dropped.swap(m_lru);
+  }
+  return dropped.size();
+}
+
+//
+// Impl for class bo_slab
+//
+
+bo_slab::
+bo_slab(const pdev& dev, size_t chunk_size, int type)
+  : m_chunk_size(chunk_size)
+  , m_bo(std::make_unique<buffer>(dev, m_slab_size, type))
+  , m_used(m_slab_size / chunk_size, false)
+{
+}
+
+bool
+bo_slab::
+alloc(size_t& offset)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  if (m_num_used == m_used.size())
+    return false;
+
+  auto it = std::find(m_used.begin(), m_used.end(), false);
+  *it = true;
+  m_num_used++;
+  offset = (it - m_used.begin()) * m_chunk_size;
+  return true;
+}
+
+void
+bo_slab::
+free(size_t offset)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_used[offset / m_chunk_size] = false;
+  m_num_used--;
+}
+
+bool
+bo_slab::
+is_empty()
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  return m_num_used == 0;
+}
+
+const buffer&
+bo_slab::
+get_buffer() const
+{
+  return *m_bo;
+}
+
+//
+// Impl for class bo_suballocator
+//
+
+bo_suballocator::
+bo_suballocator(const pdev& dev)
+  : m_pdev(dev)
+  , m_enabled(is_small_bo_suballoc())
+{
+}
+
+std::unique_ptr<buffer>
+bo_suballocator::
+alloc(size_t size, uint64_t flags)
+{
+  if (!m_enabled || !size)
+    return nullptr;
+
+  // Only host only BOs, others are either accessed by driver through their
+  // own handle or allocated from device heap already.
+  auto f = xcl_bo_flags{flags};
+  if ((static_cast<uint32_t>(f.boflags) << 24) != XCL_BO_FLAGS_HOST_ONLY)
+    return nullptr;
+
+  auto it = std::lower_bound(m_size_classes.begin(), m_size_classes.end(), size);
+  if (it == m_size_classes.end())
+    return nullptr;
+
+  auto type = bo_flags_to_type(flags, m_pdev.has_dev_heap());
+  // Slab BOs are cached, keep write-combined BOs on their own.
+  if (is_wc_bo_flags(flags, type))
+    return nullptr;
+
+  std::shared_ptr<bo_slab> slab;
+  size_t offset = 0;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    auto& slabs = m_slabs[it - m_size_classes.begin()][type];
+    for (auto s = slabs.begin(); s != slabs.end();) {
+      if (!slab && (*s)->alloc(offset)) {
+        slab = *s;
+        s++;
+        continue;
+      }
+      // Give empty slabs back to driver, keep the one just allocated from.
+      if ((*s)->is_empty() && slabs.size() > 1)
+        s = slabs.erase(s);
+      else
+        s++;
+    }
+    if (!slab) {
+      slab = std::make_shared<bo_slab>(m_pdev, *it, type);
+      slab->alloc(offset);
+      slabs.push_back(slab);
+    }
+  }
+
+  auto bo = std::make_unique<buffer>(m_pdev, flags, std::move(slab), offset, size);
+  // Fresh BO from driver is zeroed, make reused chunk look the same. Flush
+  // it as well so that no dirty cacheline pollutes output from device.
+  std::memset(bo->vaddr(), 0, size);
+  bo->sync(xrt_core::buffer_handle::direction::host2device, size, 0);
+  return bo;
+}
+
 //
 // Impl for class dbg_buffer
 //
@@ -870,12 +2627,100 @@ void
 dbg_buffer::
 sync(direction dir, size_t sz, size_t offset)
 {
-  if (dir == xrt_core::buffer_handle::direction::host2device)
+  // Firmware writes log ring out as it goes, there is nothing for it to
+  // flush on request, CPU side invalidation is all it takes.
+  if (dir == xrt_core::buffer_handle::direction::host2device ||
+    (!is_driver_sync() && size() > sizeof(amdxdna_log_ring) &&
+    log_ring_reader(*this, 0, size()).ready()))
     buffer::sync(dir, sz, offset);
   else
     buffer::sync_by_driver(dir, sz, offset);
 }
 
+//
+// Impl for class log_ring_reader
+//
+
+log_ring_reader::
+log_ring_reader(buffer& bo, size_t offset, size_t size)
+  : m_bo(bo)
+  , m_offset(offset)
+  , m_size(size)
+{
+  if (offset + size > bo.size() || size <= sizeof(amdxdna_log_ring))
+    shim_err(EINVAL, "Invalid log ring offset and size: %ld, %ld", offset, size);
+}
+
+amdxdna_log_ring *
+log_ring_reader::
+header() const
+{
+  return reinterpret_cast<amdxdna_log_ring *>(static_cast<char *>(m_bo.vaddr()) + m_offset);
+}
+
+uint64_t
+log_ring_reader::
+load_prod()
+{
+  // Base class sync, which is CPU cache maintenance, not driver sync.
+  m_bo.buffer::sync(buffer::direction::device2host, offsetof(amdxdna_log_ring, pad0), m_offset);
+  return __atomic_load_n(&header()->prod, __ATOMIC_ACQUIRE);
+}
+
+bool
+log_ring_reader::
+ready()
+{
+  load_prod();
+  auto hdr = header();
+  auto cap = hdr->size;
+  return hdr->magic == AMDXDNA_LOG_RING_MAGIC && cap && !(cap & (cap - 1)) &&
+    cap <= m_size - sizeof(amdxdna_log_ring);
+}
+
+size_t
+log_ring_reader::
+read(void *buf, size_t len)
+{
+  if (!ready())
+    return 0;
+
+  auto hdr = header();
+  uint64_t cap = hdr->size;
+  auto prod = load_prod();
+  auto cons = hdr->cons;
+  if (prod - cons > cap) {
+    m_dropped += prod - cons - cap;
+    cons = prod - cap;
+  }
+
+  auto n = std::min<uint64_t>(len, prod - cons);
+  auto data_off = m_offset + offsetof(amdxdna_log_ring, data);
+  auto dst = static_cast<char *>(buf);
+  for (uint64_t done = 0; done < n; ) {
+    auto pos = (cons + done) & (cap - 1);
+    auto chunk = std::min(n - done, cap - pos);
+    m_bo.buffer::sync(buffer::direction::device2host, chunk, data_off + pos);
+    std::memcpy(dst + done, hdr->data + pos, chunk);
+    done += chunk;
+  }
+
+  // Bytes firmware has wrapped over while they were copied are garbage.
+  auto over = load_prod() - cons;
+  if (over > cap) {
+    auto lost = std::min<uint64_t>(over - cap, n);
+    m_dropped += lost;
+    std::memmove(dst, dst + lost, n - lost);
+    cons += lost;
+    n -= lost;
+  }
+
+  __atomic_store_n(&hdr->cons, cons + n, __ATOMIC_RELEASE);
+  m_bo.buffer::sync(buffer::direction::host2device, sizeof(hdr->cons),
+    m_offset + offsetof(amdxdna_log_ring, cons));
+  return n;
+}
+
 //
 // Impl for class uc_dbg_buffer
 //
@@ -10,7 +10,10 @@
 #include "shim_debug.h"
 #include "core/common/shim/hwctx_handle.h"
 #include "core/common/shim/buffer_handle.h"
+#include <array>
+#include <list>
 #include <set>
+#include <sys/mman.h>
 #include "drm_local/amdxdna_accel.h"
 
 namespace shim_xdna {
@@ -18,14 +21,15 @@ namespace shim_xdna {
 class mmap_ptr {
 public:
   mmap_ptr(size_t size, size_t alignment);
-  mmap_ptr(const pdev *dev, void *addr, uint64_t offset, size_t size);
+  mmap_ptr(const pdev *dev, void *addr, uint64_t offset, size_t size,
+    int prot = PROT_READ | PROT_WRITE);
   ~mmap_ptr();
 
   void *
   get() const;
 
   std::unique_ptr<mmap_ptr>
-  alloc(const pdev *dev, uint64_t offset, size_t size);
+  alloc(const pdev *dev, uint64_t offset, size_t size, int prot = PROT_READ | PROT_WRITE);
 
 private:
   const pdev* m_dev = nullptr;
@@ -35,7 +39,7 @@ private:
 
 class drm_bo {
 public:
-  drm_bo(const pdev& pdev, size_t size, uint32_t type);
+  drm_bo(const pdev& pdev, size_t size, uint32_t type, bool wc = false);
   drm_bo(const pdev& pdev, size_t size, void *uptr);
   drm_bo(const pdev& pdev, xrt_core::shared_handle::export_handle ehdl);
   ~drm_bo();
@@ -45,18 +49,36 @@ public:
   uint64_t m_xdna_addr = AMDXDNA_INVALID_ADDR;
   uint64_t m_map_offset = AMDXDNA_INVALID_ADDR;
   std::unique_ptr<mmap_ptr> m_vaddr = nullptr;
+  // CPU mapping is write-combined, never needs cache flush.
+  bool m_wc = false;
+  uint32_t m_nr_segs = 0;
 
 private:
   const pdev& m_pdev;
 };
 
+// DRM BOs and CPU mapping backing a buffer. Can be taken over by another
+// buffer object without going through driver.
+struct bo_backing {
+  std::unique_ptr<mmap_ptr> m_range_addr = nullptr;
+  std::vector< std::unique_ptr<drm_bo> > m_bos;
+  void *m_uptr = nullptr;
+};
+
+class cmd_bo_pool;
+class uptr_bo_cache;
+class bo_slab;
+class write_tracker;
+
 class buffer : public xrt_core::buffer_handle
 {
 public:
   buffer(const pdev& dev, size_t size, int type);
   buffer(const pdev& dev, size_t size, uint64_t flags);
   buffer(const pdev& dev, size_t size, void *uptr, uint64_t flags);
-  buffer(const pdev& dev, xrt_core::shared_handle::export_handle ehdl);
+  // Read-only import is mapped without write access, it can only be map()'ed
+  // for read.
+  buffer(const pdev& dev, xrt_core::shared_handle::export_handle ehdl, bool readonly = false);
   virtual ~buffer();
 
   void
@@ -85,7 +107,17 @@ public:
   reset() override;
 
 public:
-  buffer(const pdev& dev, size_t size, int type, void *uptr);
+  buffer(const pdev& dev, size_t size, int type, void *uptr, uint64_t flags = 0);
+  // Sub-range [offset, offset + size) of a slab BO, no DRM BO of its own.
+  buffer(const pdev& dev, uint64_t flags, std::shared_ptr<bo_slab> slab, size_t offset, size_t size);
+  // Sub-range [offset, offset + size) of parent, e.g. one frame of a ring BO.
+  // Shares DRM BO and mapping of parent, nothing is copied. Is synced and
+  // passed to device as that range of parent only.
+  buffer(std::shared_ptr<const buffer> parent, size_t offset, size_t size);
+
+  // Export only the range [offset, offset + size) of this BO.
+  std::unique_ptr<xrt_core::shared_handle>
+  share(size_t offset, size_t size) const;
 
   void*
   vaddr() const;
@@ -113,38 +145,170 @@ public:
   virtual std::set<bo_id>
   get_arg_bo_ids() const;
 
+  // Fast path of get_arg_bo_ids() for the common case of a single arg BO.
+  // Returns false if there is more than one.
+  virtual bool
+  get_single_arg_bo_id(bo_id& id) const;
+
   virtual std::set<const buffer *>
   get_arg_bos() const;
 
   void
   expand(size_t size);
 
+  // Same as sync(), but done by a shim worker thread. Returned fence is
+  // signaled when done and can be waited on by host or passed to
+  // hwq::submit_wait() to hold off next command. Buffer must stay alive
+  // until then.
+  std::unique_ptr<xrt_core::fence_handle>
+  sync_async(direction dir, size_t size, size_t offset);
+
+  // While one is alive, driver syncs of this thread's buffer::sync() calls
+  // are appended to args instead of being done right away, so that caller
+  // can do them all in one go. See device::sync_bos().
+  class driver_sync_batch
+  {
+  public:
+    explicit driver_sync_batch(std::vector<sync_bo_arg>& args);
+    ~driver_sync_batch();
+
+    driver_sync_batch(const driver_sync_batch&) = delete;
+    driver_sync_batch& operator=(const driver_sync_batch&) = delete;
+
+  private:
+    std::vector<sync_bo_arg> *m_prev;
+  };
+
+  // With Runtime.bo_write_tracking, pages of a BO mapped by map() are kept
+  // read-only once synced and marked dirty on first write after, so that
+  // sync(host2device) only flushes pages written since the last one.
+
+  // Copy len bytes from src into BO at offset around CPU cache, with
+  // non-temporal stores where CPU has them. Pages fully written are then
+  // skipped by next sync(host2device), so data is not walked again to flush
+  // it. Those pages must not be written through map() before that sync.
+  void
+  write(size_t offset, const void *src, size_t len);
+
+  // Copy len bytes at offset of BO into dst, syncing them from device on the
+  // way, no sync(device2host) is needed before.
+  void
+  read(size_t offset, void *dst, size_t len);
+
+  // Argument slots of an instruction buffer, each of which is a 64-bit
+  // address at given offset. Set once, after that patch_args() rewrites the
+  // slots of a relaunch with new argument addresses and syncs only the
+  // cachelines holding slots that really changed, instead of patching and
+  // syncing the whole buffer again.
+  void
+  set_patch_table(std::vector<size_t> offsets);
+
+  // One value per offset of patch table, in the same order.
+  void
+  patch_args(const std::vector<uint64_t>& values);
+
 protected:
   const pdev& m_pdev;
 
+  // Construct on top of backing released by another buffer object.
+  buffer(const pdev& dev, uint64_t flags, bo_backing&& backing);
+
   void
   sync_by_driver(direction dir, size_t size, size_t offset);
 
+  // Hand over DRM BOs and mapping, leaving this object empty.
+  bo_backing
+  release_backing();
+
 private:
   std::string
   describe() const;
 
+  // Buffer this one is a sub-range of, nullptr if it has DRM BOs of its own.
+  const buffer *
+  parent() const;
+
+  void
+  mmap_drm_bo(drm_bo *bo) const; // Obtain void* through mmap()
+
+  // Map DRM BOs whose mmap has been deferred until CPU pointer is needed.
   void
-  mmap_drm_bo(drm_bo *bo); // Obtain void* through mmap()
+  mmap_deferred() const;
+
+  bool
+  is_mmap_deferred() const;
+
+  // All DRM BOs are write-combined, see drm_bo::m_wc.
+  bool
+  is_write_combined() const;
+
+  // Ranges within [offset, offset + sz) not made clean by write(), clean
+  // pages in there are taken, i.e., are no longer treated as clean.
+  std::vector< std::pair<size_t, size_t> >
+  take_unclean(size_t sz, size_t offset);
+
+  // Start write tracking of CPU mapping if it is enabled and can be done.
+  void
+  track_writes();
+
+  // Ranges within [offset, offset + sz) written through CPU mapping since
+  // last taken, the whole range if writes are not tracked.
+  std::vector< std::pair<size_t, size_t> >
+  take_dirty(size_t sz, size_t offset);
 
   uint64_t m_flags = 0;
+  // Backed by dma-buf from another device or process
+  bool m_imported = false;
+  // CPU mapping of imported dma-buf has no write access
+  bool m_readonly = false;
   std::unique_ptr<mmap_ptr> m_range_addr = nullptr;
   std::vector< std::unique_ptr<drm_bo> > m_bos;
   void *m_uptr = nullptr;
   int m_type = AMDXDNA_BO_INVALID;
   size_t m_total_size = 0;
   size_t m_cur_size = 0;
+  // Set when some DRM BO is not mapped yet, see mmap_deferred().
+  mutable std::atomic<bool> m_mmap_pending = false;
+  mutable bool m_mmap_lazy = false;
+  mutable std::mutex m_mmap_lock;
+  // Set only for buffer carved out of a slab BO.
+  std::shared_ptr<bo_slab> m_slab;
+  // Set only for sub-range of another buffer, see parent().
+  std::shared_ptr<const buffer> m_parent;
+  // Offset of sub-range in slab BO or parent
+  size_t m_slab_offset = 0;
+  // One bit per page written by write() since last sync, empty until then.
+  std::vector<uint64_t> m_clean_map;
+  std::mutex m_clean_lock;
+  // Set once CPU mapping is write tracked, see track_writes().
+  std::unique_ptr<write_tracker> m_write_tracker;
+  std::atomic<bool> m_write_tracked = false;
+  std::once_flag m_track_once;
+  // Offsets of argument slots, see set_patch_table().
+  std::vector<size_t> m_patch_table;
+};
+
+// Prebuilt firmware cmdlist of a chained cmd submitted in kernel mode, see
+// hwq_kmq::prepare_chain().
+struct chain_cmdlist {
+  // Hwctx the list is built for, CU indexes in it are per hwctx
+  uint32_t ctx_handle = AMDXDNA_INVALID_CTX_HANDLE;
+  // Chain payload and sub-cmds up to their args, as last submitted
+  std::vector<uint32_t> snapshot;
+  std::unique_ptr<buffer> list_bo;
+  // Offset of each slot in list BO, followed by the end of the last one
+  std::vector<uint32_t> offsets;
+  // Set once chain can't be prebuilt, it is submitted as is from then on
+  bool unsupported = false;
 };
 
 class cmd_buffer : public buffer
 {
 public:
   cmd_buffer(const pdev& dev, size_t size, uint64_t flags);
+  // Backing is given back to pool when this object is destroyed.
+  cmd_buffer(const pdev& dev, size_t size, uint64_t flags, std::weak_ptr<cmd_bo_pool> pool);
+  cmd_buffer(const pdev& dev, uint64_t flags, bo_backing&& backing, std::weak_ptr<cmd_bo_pool> pool);
   ~cmd_buffer();
 
   void
@@ -164,31 +328,236 @@ public:
   uint64_t
   wait_for_submitted() const;
 
+  // Whether wait_for_submitted() would return right away.
+  bool
+  is_submitted() const
+  { return m_submit_state.load(std::memory_order_acquire) == submit_state_done; }
+
   std::set<bo_id>
   get_arg_bo_ids() const override;
 
+  bool
+  get_single_arg_bo_id(bo_id& id) const override;
+
+  // Deduplicated, sorted DRM BO handles of all arg BOs, ready to be passed
+  // to driver. Rebuilt only after bind_at() or reset() changed arg BOs.
+  // The reference is valid until the next bind_at() or reset().
+  const std::vector<uint32_t>&
+  get_arg_bo_handles() const;
+
   std::set<const buffer *>
   get_arg_bos() const override;
 
   std::vector<const cmd_buffer *>&
   get_subcmd_list() const;
 
+  // Created on first use, only by the HW queue submitting this chained cmd.
+  chain_cmdlist&
+  get_chain_cmdlist() const;
+
+  // Whether arg BOs are collected for dumping, see Debug.dump_arg_bos.
+  bool
+  is_dump_arg_bos() const;
+
+  // Ask driver to store, right after the cmd payload, CLOCK_MONOTONIC time
+  // of when cmd is sent to device and when it is done. Only if enabled by
+  // Debug.cmd_timestamps and cmd BO has room for it.
+  void
+  request_timestamps() const;
+
+  // Time in ns cmd was sent to device and completed, false if cmd is not
+  // done yet or timestamps were not requested.
+  bool
+  get_timestamps(uint64_t& start_ns, uint64_t& end_ns) const;
+
 private:
-  // Valid only when m_submitted is true.
-  mutable uint64_t m_cmd_seq = 0;
-  std::map< size_t, std::set<bo_id> > m_args_map;
+  // Slot of arg BO at pos, growing the arg list if needed.
+  bo_id&
+  arg_slot(size_t pos);
+
+  // Call fn(bo_id) on each bound arg BO, m_args_map_lock must be held.
+  template <typename F>
+  void
+  for_each_arg_bo_id(F&& fn) const;
+
+  // Valid only when m_submit_state is submit_state_done.
+  mutable std::atomic<uint64_t> m_cmd_seq = 0;
+  // Arg BO indexed by arg position, invalid handle if not bound. Kernel arity
+  // is small, so the first few live inline. Capacity is kept across reset().
+  static constexpr size_t num_inline_args = 16;
+  std::array<bo_id, num_inline_args> m_inline_args;
+  std::vector<bo_id> m_more_args;
+  size_t m_num_args = 0;
+  // Slow path for args which are backed by more than one DRM BO.
+  std::map< size_t, std::set<bo_id> > m_multi_bo_args;
+  // Cached from bound arg BOs, see get_arg_bo_handles().
+  mutable std::vector<uint32_t> m_arg_bo_hdls;
+  mutable bool m_arg_bo_hdls_dirty = false;
   // For dumping arg BO content only
   std::map< size_t, std::set<const buffer *> > m_arg_bos_map;
   bool m_dump_arg_bos = false;
+  bool m_cmd_timestamps = false;
   mutable std::mutex m_args_map_lock;
 
-  mutable std::mutex m_submission_lock;
-  // Changed only once in the life time of cmd BO.
-  mutable bool m_submitted = false;
-  // Changed only once in the life time of cmd BO.
-  mutable std::condition_variable m_submission_cv;
+  // Futex word, waiters block on it only while cmd is in pending queue.
+  static constexpr uint32_t submit_state_pending = 0;
+  static constexpr uint32_t submit_state_pending_waited = 1;
+  static constexpr uint32_t submit_state_done = 2;
+  mutable std::atomic<uint32_t> m_submit_state = submit_state_pending;
   // For chained cmd, contains submitted sub-cmd pointers.
   mutable std::vector<const cmd_buffer *> m_subcmds;
+  mutable std::unique_ptr<chain_cmdlist> m_chain_cmdlist;
+  // Pool to recycle backing into, if allocated from one.
+  std::weak_ptr<cmd_bo_pool> m_pool;
+};
+
+// Per device free lists of cmd BO backing in a few fixed size classes, so
+// that short lived exec bufs do not go through driver for every allocation.
+class cmd_bo_pool : public std::enable_shared_from_this<cmd_bo_pool>
+{
+public:
+  cmd_bo_pool(const pdev& dev);
+  ~cmd_bo_pool();
+
+  // Returns nullptr if pool is disabled or size is beyond the largest class.
+  std::unique_ptr<cmd_buffer>
+  alloc(size_t size, uint64_t flags);
+
+  // Keep backing of a destroyed cmd_buffer for reuse, drop it if the free
+  // list of its size class is full.
+  void
+  recycle(bo_backing&& backing, size_t size);
+
+  // Free all idle backing, returns number of BOs freed.
+  size_t
+  trim();
+
+  uint64_t
+  get_hit_count() const;
+
+  uint64_t
+  get_miss_count() const;
+
+private:
+  static constexpr std::array<size_t, 3> m_size_classes = { 0x1000, 0x4000, 0x10000 };
+
+  const pdev& m_pdev;
+  const size_t m_max_per_class;
+  std::mutex m_lock;
+  std::array<std::vector<bo_backing>, m_size_classes.size()> m_free;
+  std::atomic<uint64_t> m_hit = 0;
+  std::atomic<uint64_t> m_miss = 0;
+};
+
+// One host BO divided into equal sized chunks, each handed out as a buffer
+// object of its own.
+class bo_slab
+{
+public:
+  bo_slab(const pdev& dev, size_t chunk_size, int type);
+
+  // Returns false if all chunks are in use.
+  bool
+  alloc(size_t& offset);
+
+  void
+  free(size_t offset);
+
+  bool
+  is_empty();
+
+  const buffer&
+  get_buffer() const;
+
+private:
+  static constexpr size_t m_slab_size = 0x40000;
+
+  const size_t m_chunk_size;
+  std::unique_ptr<buffer> m_bo;
+  std::mutex m_lock;
+  std::vector<bool> m_used;
+  size_t m_num_used = 0;
+};
+
+// Per device allocator serving small host only BOs out of slab BOs, so that
+// they do not each cost a DRM BO, a mapping and an arg BO handle.
+class bo_suballocator
+{
+public:
+  bo_suballocator(const pdev& dev);
+
+  // Returns nullptr if disabled or the BO is not eligible.
+  std::unique_ptr<buffer>
+  alloc(size_t size, uint64_t flags);
+
+private:
+  static constexpr std::array<size_t, 3> m_size_classes = { 0x400, 0x1000, 0x4000 };
+
+  const pdev& m_pdev;
+  const bool m_enabled;
+  std::mutex m_lock;
+  // Slabs of each size class, keyed by BO type.
+  std::array<std::map< int, std::vector< std::shared_ptr<bo_slab> > >, m_size_classes.size()> m_slabs;
+};
+
+class uptr_buffer : public buffer
+{
+public:
+  // Backing, including pinned user pages, is given back to cache when this
+  // object is destroyed.
+  uptr_buffer(const pdev& dev, size_t size, void *uptr, uint64_t flags,
+    std::weak_ptr<uptr_bo_cache> cache);
+  uptr_buffer(const pdev& dev, uint64_t flags, bo_backing&& backing,
+    std::weak_ptr<uptr_bo_cache> cache);
+  ~uptr_buffer();
+
+private:
+  std::weak_ptr<uptr_bo_cache> m_cache;
+};
+
+// Per device LRU cache of user pointer BO backing keyed on (uptr, size, flags),
+// so that registering the same user memory again does not pin pages again.
+// Pages stay pinned while cached. Caller has to invalidate the range before
+// the memory is unmapped or remapped, or the pages may be stale.
+class uptr_bo_cache : public std::enable_shared_from_this<uptr_bo_cache>
+{
+public:
+  uptr_bo_cache(const pdev& dev);
+  ~uptr_bo_cache();
+
+  // Returns nullptr if cache is disabled.
+  std::unique_ptr<uptr_buffer>
+  alloc(void *uptr, size_t size, uint64_t flags);
+
+  // Keep backing of a destroyed uptr_buffer as most recently used entry and
+  // evict the least recently used one if cache is full.
+  void
+  recycle(bo_backing&& backing, size_t size, uint64_t flags);
+
+  // Drop all entries overlapping with [uptr, uptr + size).
+  void
+  invalidate(void *uptr, size_t size);
+
+  // Drop all entries, so that their pages are unpinned. Returns number of
+  // entries dropped.
+  size_t
+  trim();
+
+private:
+  struct entry {
+    void *m_uptr;
+    size_t m_size;
+    uint64_t m_flags;
+    bo_backing m_backing;
+  };
+
+  const pdev& m_pdev;
+  const size_t m_max_entries;
+  std::mutex m_lock;
+  // Most recently used first.
+  std::list<entry> m_lru;
+  uint64_t m_hit = 0;
+  uint64_t m_miss = 0;
 };
 
 class dbg_buffer : public buffer
@@ -213,6 +582,40 @@ private:
   xrt_core::hwctx_handle::slot_id m_ctx_id = AMDXDNA_INVALID_CTX_HANDLE;
 };
 
+// Tail of a log written by firmware in amdxdna_log_ring format into
+// [offset, offset + size) of a BO. Reads go through CPU mapping of the BO
+// with cache invalidation only, so that following the log takes no ioctl.
+class log_ring_reader
+{
+public:
+  log_ring_reader(buffer& bo, size_t offset, size_t size);
+
+  // True once firmware has set ring up.
+  bool
+  ready();
+
+  // Copy up to len bytes not read yet into buf, returns bytes copied.
+  size_t
+  read(void *buf, size_t len);
+
+  // Bytes overwritten by firmware before being read.
+  uint64_t
+  dropped() const
+  { return m_dropped; }
+
+private:
+  amdxdna_log_ring *
+  header() const;
+
+  uint64_t
+  load_prod();
+
+  buffer& m_bo;
+  const size_t m_offset;
+  const size_t m_size;
+  uint64_t m_dropped = 0;
+};
+
 class uc_dbg_buffer : public buffer
 {
 public:
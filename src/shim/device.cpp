@@ -6,20 +6,31 @@
 #include "kmq/hwctx.h"
 #include "umq/hwctx.h"
 #include "fence.h"
+#include "hwq.h"
 #include "smi_xdna.h"
+#include "trace_stream.h"
 
+#include "core/common/config_reader.h"
 #include "core/common/query_requests.h"
 #include "core/include/ert.h"
 #include "core/include/xclerr_int.h"
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <linux/limits.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <climits>
+#include <cstring>
+#include <fstream>
 #include <sstream>
+#include <string_view>
 
 namespace {
 
@@ -48,6 +59,10 @@ get_shim_data_dir()
 inline std::shared_ptr<xrt_core::pci::dev>
 get_pcidev(const xrt_core::device* device)
 {
+  // Device may not be backed by the pcidev of its ID in virtual device mode.
+  if (auto device_impl = dynamic_cast<const shim_xdna::device*>(device))
+    return device_impl->get_pcidev_handle();
+
   auto pdev = xrt_core::pci::get_dev(device->get_device_id(), device->is_userpf());
   if (!pdev)
     throw xrt_core::generic_error(EINVAL, "Invalid device handle");
@@ -63,6 +78,30 @@ get_pcidev_impl(const xrt_core::device* device)
   return device_impl->get_pdev();
 }
 
+// Tee what the driver just returned into the trace stream, together with the
+// current firmware clock offset so it can be placed on the host timeline.
+void
+tee_fw_data(const xrt_core::device* device, uint32_t config_param,
+  shim_xdna::trace_stream::event type, uint64_t end_offset, const void *data, uint32_t size)
+{
+  if (!shim_xdna::trace_stream::enabled() || !size)
+    return;
+
+  amdxdna_drm_get_dpt_state config = {};
+  amdxdna_drm_get_array arg = {
+    .param = config_param,
+    .element_size = sizeof(amdxdna_drm_get_dpt_state),
+    .num_element = 1,
+    .buffer = reinterpret_cast<uintptr_t>(&config)
+  };
+  try {
+    get_pcidev_impl(device).drv_ioctl(shim_xdna::drv_ioctl_cmd::get_info_array, &arg);
+  } catch (const xrt_core::system_error&) {
+    // Data without clock correlation is still useful, offset stays 0.
+  }
+  shim_xdna::trace_stream::emit_fw(type, config.clock_offset_ns, end_offset - size, data, size);
+}
+
 template <typename ValueType>
 struct sysfs_fcn
 {
@@ -694,6 +733,8 @@ struct event_trace
         output.size = fw_trace->size;
         output.b_wait = fw_trace->watch;
         output.data = request.data;
+        tee_fw_data(device, DRM_AMDXDNA_FW_TRACE_CONFIG, shim_xdna::trace_stream::event::fw_trace,
+          output.abs_offset, output.data, output.size);
         return output;
 
       }
@@ -817,6 +858,8 @@ struct firmware_log
         output.size = fw_log->size;
         output.b_wait = fw_log->watch;
         output.data = request.data;
+        tee_fw_data(device, DRM_AMDXDNA_FW_LOG_CONFIG, shim_xdna::trace_stream::event::fw_log,
+          output.abs_offset, output.data, output.size);
         return output;
       }
       default:
@@ -1360,41 +1403,30 @@ struct sensor_info
     return false;
   }
 
-  static amdxdna_drm_get_info
+  // Sensor readings change all the time, driver is queried on every call, so
+  // that power can be sampled while device is running.
+  static std::vector<char>
   get_sensor_data(const xrt_core::device* device)
   {
-    static std::map<const xrt_core::device*, std::vector<char>> data_map;
-
-    // If an entry does not exist for the current device, query the driver for sensor data
-    if (data_map.find(device) == data_map.end()) {
-      const uint32_t output_size = sizeof(amdxdna_drm_query_sensor);
-
-      std::vector<char> payload(output_size);
-      amdxdna_drm_get_info arg = {
-        .param = DRM_AMDXDNA_QUERY_SENSORS,
-        .buffer_size = output_size,
-        .buffer = reinterpret_cast<uintptr_t>(payload.data())
-      };
+    const uint32_t output_size = sizeof(amdxdna_drm_query_sensor);
 
-      auto& pci_dev_impl = get_pcidev_impl(device);
-      pci_dev_impl.drv_ioctl(shim_xdna::drv_ioctl_cmd::get_info, &arg);
+    std::vector<char> payload(output_size);
+    amdxdna_drm_get_info arg = {
+      .param = DRM_AMDXDNA_QUERY_SENSORS,
+      .buffer_size = output_size,
+      .buffer = reinterpret_cast<uintptr_t>(payload.data())
+    };
 
-      if (output_size < arg.buffer_size) {
-        throw xrt_core::query::exception(
-          boost::str(boost::format("DRM_AMDXDNA_QUERY_SENSORS - Insufficient buffer size. Need: %u") % arg.buffer_size));
-      }
+    auto& pci_dev_impl = get_pcidev_impl(device);
+    pci_dev_impl.drv_ioctl(shim_xdna::drv_ioctl_cmd::get_info, &arg);
 
-      payload.resize(arg.buffer_size);
-      data_map.emplace(device, payload);
+    if (output_size < arg.buffer_size) {
+      throw xrt_core::query::exception(
+        boost::str(boost::format("DRM_AMDXDNA_QUERY_SENSORS - Insufficient buffer size. Need: %u") % arg.buffer_size));
     }
 
-    auto& payload = data_map.at(device);
-    amdxdna_drm_get_info output = {
-      .param = DRM_AMDXDNA_QUERY_SENSORS,
-      .buffer_size = static_cast<uint32_t>(payload.size()),
-      .buffer = reinterpret_cast<uintptr_t>(payload.data())
-    };
-    return output;
+    payload.resize(arg.buffer_size);
+    return payload;
   }
 
   static std::any
@@ -1403,11 +1435,11 @@ struct sensor_info
     if (key != key_type::sdm_sensor_info)
       throw xrt_core::query::no_such_key(key, "Not implemented");
 
-    amdxdna_drm_get_info arg = get_sensor_data(device);
+    auto payload = get_sensor_data(device);
 
     amdxdna_drm_query_sensor* drv_sensors;
-    const uint32_t drv_sensor_count = arg.buffer_size / sizeof(*drv_sensors);
-    drv_sensors = reinterpret_cast<decltype(drv_sensors)>(arg.buffer);
+    const uint32_t drv_sensor_count = payload.size() / sizeof(*drv_sensors);
+    drv_sensors = reinterpret_cast<decltype(drv_sensors)>(payload.data());
 
     // Parse the received sensor info into the user facing struct
     xrt_core::query::sdm_sensor_info::result_type sensors;
@@ -1513,6 +1545,73 @@ struct sub_device_path
   }
 };
 
+// Opt-in caching of query results. Once enabled, static properties are
+// cached for the lifetime of the device, dynamic ones for this long.
+std::chrono::milliseconds
+get_query_cache_ttl()
+{
+  static std::chrono::milliseconds ttl{
+    xrt_core::config::detail::get_uint_value("Runtime.query_cache_ttl_ms", 0) };
+  return ttl;
+}
+
+enum class query_lifetime
+{
+  device,
+  ttl,
+};
+
+template <query_lifetime Lifetime, typename Fetch>
+std::any
+cached_query(const xrt_core::device* device, const shim_xdna::query_cache::cache_key& key,
+  Fetch fetch)
+{
+  auto ttl = get_query_cache_ttl();
+  auto dev = dynamic_cast<const shim_xdna::device*>(device);
+  if (ttl.count() == 0 || !dev)
+    return fetch();
+
+  auto& cache = dev->get_query_cache();
+  auto expire = (Lifetime == query_lifetime::device) ? std::chrono::milliseconds(0) : ttl;
+  if (auto result = cache.get(key, expire))
+    return *result;
+
+  // Failed query throws and is not cached
+  auto result = fetch();
+  cache.put(key, result);
+  return result;
+}
+
+// Caches result of query without parameter
+template <typename Base, query_lifetime Lifetime>
+struct cached_get : Base
+{
+  using Base::Base;
+  using Base::get;
+
+  std::any
+  get(const xrt_core::device* device) const override
+  {
+    return cached_query<Lifetime>(device, { Base::key, 0 },
+      [this, device] { return Base::get(device); });
+  }
+};
+
+// Caches result of query with an enum parameter, per parameter value
+template <typename Base, typename ParamType, query_lifetime Lifetime>
+struct cached_get_by_param : Base
+{
+  using Base::get;
+
+  std::any
+  get(const xrt_core::device* device, const std::any& param) const override
+  {
+    auto p = static_cast<uint64_t>(std::any_cast<ParamType>(param));
+    return cached_query<Lifetime>(device, { Base::key, p },
+      [this, device, &param] { return Base::get(device, param); });
+  }
+};
+
 template <typename QueryRequestType>
 struct sysfs_get : virtual QueryRequestType
 {
@@ -1607,6 +1706,33 @@ emplace_func1_request()
   query_tbl.emplace(k, std::make_unique<function1_get<QueryRequestType, Getter>>());
 }
 
+template <typename QueryRequestType, query_lifetime Lifetime>
+static void
+emplace_cached_sysfs_get(const char* subdev, const char* entry)
+{
+  auto x = QueryRequestType::key;
+  query_tbl.emplace(x,
+    std::make_unique<cached_get<sysfs_get<QueryRequestType>, Lifetime>>(subdev, entry));
+}
+
+template <typename QueryRequestType, typename Getter, query_lifetime Lifetime>
+static void
+emplace_cached_func0_request()
+{
+  auto k = QueryRequestType::key;
+  query_tbl.emplace(k,
+    std::make_unique<cached_get<function0_get<QueryRequestType, Getter>, Lifetime>>());
+}
+
+template <typename QueryRequestType, typename Getter, typename ParamType, query_lifetime Lifetime>
+static void
+emplace_cached_func1_request()
+{
+  auto k = QueryRequestType::key;
+  query_tbl.emplace(k,
+    std::make_unique<cached_get_by_param<function1_get<QueryRequestType, Getter>, ParamType, Lifetime>>());
+}
+
 template <typename QueryRequestType, typename GetPut>
 static void
 emplace_func0_getput()
@@ -1618,30 +1744,33 @@ emplace_func0_getput()
 static void
 initialize_query_table()
 {
-  emplace_func0_request<query::aie_partition_info,             partition_info>();
+  constexpr auto dev_life = query_lifetime::device;
+  constexpr auto ttl_life = query_lifetime::ttl;
+
+  emplace_cached_func0_request<query::aie_partition_info,      partition_info, ttl_life>();
   emplace_func0_request<query::xocl_errors,                    xocl_errors>();
   emplace_func1_request<query::context_health_info,            context_health_info>();
-  emplace_func0_request<query::aie_status_version,             aie_info>();
-  emplace_func0_request<query::aie_tiles_stats,                aie_info>();
+  emplace_cached_func0_request<query::aie_status_version,      aie_info, dev_life>();
+  emplace_cached_func0_request<query::aie_tiles_stats,         aie_info, dev_life>();
   emplace_func1_request<query::aie_tiles_status_info,          aie_info>();
-  emplace_func0_request<query::clock_freq_topology_raw,        clock_topology>();
-  emplace_func0_request<query::xrt_resource_raw,               resource_info>();
+  emplace_cached_func0_request<query::clock_freq_topology_raw, clock_topology, ttl_life>();
+  emplace_cached_func0_request<query::xrt_resource_raw,        resource_info, ttl_life>();
   emplace_func0_request<query::device_class,                   default_value>();
   emplace_func0_request<query::instance,                       instance>();
   emplace_func0_request<query::is_ready,                       default_value>();
   emplace_func0_request<query::is_versal,                      default_value>();
   emplace_func0_request<query::logic_uuids,                    default_value>();
-  emplace_func0_request<query::pcie_bdf,                       bdf>();
-  emplace_func0_request<query::pcie_id,                        pcie_id>();
-  emplace_func0_request<query::total_cols,                     total_cols>();
-  emplace_sysfs_get<query::pcie_device>                        ("", "device");
-  emplace_sysfs_get<query::pcie_express_lane_width>            ("", "link_width");
-  emplace_sysfs_get<query::pcie_express_lane_width_max>        ("", "link_width_max");
-  emplace_sysfs_get<query::pcie_link_speed>                    ("", "link_speed");
-  emplace_sysfs_get<query::pcie_link_speed_max>                ("", "link_speed_max");
-  emplace_sysfs_get<query::pcie_subsystem_id>                  ("", "subsystem_device");
-  emplace_sysfs_get<query::pcie_subsystem_vendor>              ("", "subsystem_vendor");
-  emplace_sysfs_get<query::pcie_vendor>                        ("", "vendor");
+  emplace_cached_func0_request<query::pcie_bdf,                bdf, dev_life>();
+  emplace_cached_func0_request<query::pcie_id,                 pcie_id, dev_life>();
+  emplace_cached_func0_request<query::total_cols,              total_cols, dev_life>();
+  emplace_cached_sysfs_get<query::pcie_device, dev_life>       ("", "device");
+  emplace_cached_sysfs_get<query::pcie_express_lane_width, ttl_life>("", "link_width");
+  emplace_cached_sysfs_get<query::pcie_express_lane_width_max, dev_life>("", "link_width_max");
+  emplace_cached_sysfs_get<query::pcie_link_speed, ttl_life>   ("", "link_speed");
+  emplace_cached_sysfs_get<query::pcie_link_speed_max, dev_life>("", "link_speed_max");
+  emplace_cached_sysfs_get<query::pcie_subsystem_id, dev_life> ("", "subsystem_device");
+  emplace_cached_sysfs_get<query::pcie_subsystem_vendor, dev_life>("", "subsystem_vendor");
+  emplace_cached_sysfs_get<query::pcie_vendor, dev_life>       ("", "vendor");
 
   emplace_func0_getput<query::performance_mode,                performance_mode>();
   emplace_func0_getput<query::preemption,                      preemption>();
@@ -1664,11 +1793,13 @@ initialize_query_table()
 
   emplace_func0_request<query::rom_ddr_bank_count_max,         default_value>();
   emplace_func0_request<query::rom_ddr_bank_size_gb,           default_value>();
-  emplace_sysfs_get<query::rom_vbnv>                           ("", "vbnv");
-  emplace_func1_request<query::sdm_sensor_info,                sensor_info>();
+  emplace_cached_sysfs_get<query::rom_vbnv, dev_life>          ("", "vbnv");
+  emplace_cached_func1_request<query::sdm_sensor_info,         sensor_info,
+    query::sdm_sensor_info::sdr_req_type, ttl_life>();
   emplace_func1_request<query::xrt_smi_config,                 xrt_smi_config>();
   emplace_func1_request<query::xrt_smi_lists,                  xrt_smi_lists>();
-  emplace_func1_request<query::firmware_version,               firmware_version>();
+  emplace_cached_func1_request<query::firmware_version,        firmware_version,
+    query::firmware_version::firmware_type, dev_life>();
   emplace_func1_request<query::sub_device_path,                sub_device_path>();
   emplace_func1_request<query::aie_coredump,                   aie_coredump>();
 }
@@ -1700,6 +1831,227 @@ import_fd(pid_t pid, int ehdl)
   return fd;
 }
 
+// Entry of named BO registry, holding pid and exported fd of the process
+// publishing the BO. Other processes get the fd through pidfd_getfd().
+std::string
+bo_registry_path(const std::string& name)
+{
+  static std::string dir =
+    xrt_core::config::detail::get_string_value("Runtime.bo_registry_dir", "/dev/shm");
+
+  if (name.empty() || name.find('/') != std::string::npos)
+    shim_err(EINVAL, "Bad shared BO name '%s'", name.c_str());
+  return dir + "/amdxdna_bo." + name;
+}
+
+// Returns false if there is no entry or its publisher has gone away.
+bool
+read_bo_registry(const std::string& path, pid_t& pid, int& fd)
+{
+  std::ifstream f(path);
+  if (!(f >> pid >> fd))
+    return false;
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void
+write_bo_registry(const std::string& path, pid_t pid, int fd)
+{
+  // Renamed into place, so that readers never see a partial entry.
+  auto tmp = path + "." + std::to_string(pid);
+  {
+    std::ofstream f(tmp, std::ios::trunc);
+    f << pid << " " << fd << std::endl;
+    if (!f)
+      shim_err(EIO, "Failed to write %s", tmp.c_str());
+  }
+  if (rename(tmp.c_str(), path.c_str()) == -1) {
+    auto err = errno;
+    unlink(tmp.c_str());
+    shim_err(-err, "Failed to publish %s", path.c_str());
+  }
+}
+
+// Device BOs known from xclbin are PDIs, which are loaded at hwctx creation.
+size_t
+get_dev_heap_hint(const shim_xdna::xclbin_parser& xp)
+{
+  static const size_t page_sz = getpagesize();
+  size_t sz = 0;
+
+  for (int i = 0; i < xp.get_num_cus(); i++)
+    sz += (xp.get_cu_pdi(i).size() + page_sz - 1) / page_sz * page_sz;
+  return sz;
+}
+
+// Number of hwctx kept created ahead of time per xclbin and QoS. 0 means
+// hwctx are only created on demand.
+size_t
+get_hwctx_pool_size()
+{
+  static size_t size =
+    xrt_core::config::detail::get_uint_value("Runtime.hwctx_pool_size", 0);
+  return size;
+}
+
+bool
+is_mem_pressure_notify()
+{
+  static bool notify =
+    xrt_core::config::detail::get_bool_value("Runtime.mem_pressure_notify", true);
+  return notify;
+}
+
+// Heap / BO usage of this process to be notified at, on top of system memory
+// pressure. 0 means no threshold.
+uint64_t
+get_mem_pressure_heap_bytes()
+{
+  static uint64_t mb =
+    xrt_core::config::detail::get_uint_value("Runtime.mem_pressure_heap_mb", 0);
+  return mb << 20;
+}
+
+uint64_t
+get_mem_pressure_bo_bytes()
+{
+  static uint64_t mb =
+    xrt_core::config::detail::get_uint_value("Runtime.mem_pressure_bo_mb", 0);
+  return mb << 20;
+}
+
+// In virtual device mode, each device opened by this process is placed on
+// the NPU with most headroom, so that apps scale to all NPUs in the box.
+bool
+is_virtual_device()
+{
+  static bool enabled =
+    xrt_core::config::detail::get_bool_value("Runtime.virtual_device", false);
+  return enabled;
+}
+
+// In virtual device mode, prefer NPUs on NUMA node of calling thread.
+bool
+is_virtual_device_numa_aware()
+{
+  static bool enabled =
+    xrt_core::config::detail::get_bool_value("Runtime.virtual_device_numa", true);
+  return enabled;
+}
+
+// Fraction of NPU tasks and TOPs not in use, of which the lower one is the
+// headroom of the NPU.
+double
+get_free_capacity(const shim_xdna::pdev& pdev)
+{
+  amdxdna_drm_get_resource_info info = {};
+  amdxdna_drm_get_info arg = {
+    .param = DRM_AMDXDNA_QUERY_RESOURCE_INFO,
+    .buffer_size = sizeof(info),
+    .buffer = reinterpret_cast<uintptr_t>(&info),
+  };
+
+  pdev.open();
+  try {
+    pdev.drv_ioctl(shim_xdna::drv_ioctl_cmd::get_info, &arg);
+  } catch (...) {
+    pdev.close();
+    throw;
+  }
+  pdev.close();
+
+  double free_task = info.npu_task_max ?
+    1.0 - static_cast<double>(info.npu_task_curr) / info.npu_task_max : 0;
+  double free_tops = info.npu_tops_max ?
+    1.0 - static_cast<double>(info.npu_tops_curr) / info.npu_tops_max : free_task;
+  return std::min(free_task, free_tops);
+}
+
+std::shared_ptr<xrt_core::pci::dev>
+select_pcidev(xrt_core::device::id_type id, bool user)
+{
+  auto dflt = xrt_core::pci::get_dev(id, user);
+  if (!user || !is_virtual_device())
+    return dflt;
+
+  auto ndev = xrt_core::pci::get_dev_ready(user);
+  if (ndev < 2)
+    return dflt;
+
+  // Number of devices placed on each NPU by this process, so that devices
+  // opened back to back, before any hwctx shows up as load, spread out.
+  static std::mutex placed_lock;
+  static std::map<const xrt_core::pci::dev*, unsigned> placed;
+  const std::lock_guard<std::mutex> lock(placed_lock);
+
+  unsigned cpu = 0, node = 0;
+  int my_node = -1;
+  if (is_virtual_device_numa_aware() && syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+    my_node = node;
+
+  struct candidate {
+    std::shared_ptr<xrt_core::pci::dev> m_pdev;
+    bool m_local;
+    double m_free;
+    unsigned m_placed;
+  };
+  std::optional<candidate> best;
+  for (unsigned i = 0; i < ndev; i++) {
+    auto pd = std::dynamic_pointer_cast<shim_xdna::pdev>(xrt_core::pci::get_dev(i, user));
+    if (!pd)
+      continue;
+
+    candidate c = { pd, my_node >= 0 && pd->get_numa_node() == my_node, 0, placed[pd.get()] };
+    try {
+      c.m_free = get_free_capacity(*pd);
+    } catch (const std::exception& ex) {
+      shim_debug("Skip %s for placement: %s", pd->m_sysfs_name.c_str(), ex.what());
+      continue;
+    }
+    shim_debug("Placement candidate %s: local=%d free=%.2f placed=%u",
+      pd->m_sysfs_name.c_str(), c.m_local, c.m_free, c.m_placed);
+
+    // Local NPU with headroom wins, then most headroom, then least used by us.
+    auto better = [] (const candidate& a, const candidate& b) {
+      bool a_local = a.m_local && a.m_free > 0;
+      bool b_local = b.m_local && b.m_free > 0;
+      if (a_local != b_local)
+        return a_local;
+      if (a.m_free != b.m_free)
+        return a.m_free > b.m_free;
+      return a.m_placed < b.m_placed;
+    };
+    if (!best || better(c, *best))
+      best = std::move(c);
+  }
+
+  if (!best)
+    return dflt;
+
+  placed[best->m_pdev.get()]++;
+  shim_debug("Device %u placed on %s", id, best->m_pdev->m_sysfs_name.c_str());
+  return best->m_pdev;
+}
+
+const shim_xdna::pdev&
+select_pdev(const shim_xdna::pdev& dflt, const std::shared_ptr<xrt_core::pci::dev>& handle)
+{
+  auto pd = dynamic_cast<const shim_xdna::pdev*>(handle.get());
+  return pd ? *pd : dflt;
+}
+
+std::unique_ptr<shim_xdna::hwctx>
+create_xclbin_hwctx(const shim_xdna::device& dev, const xrt::xclbin& xclbin,
+  const xrt::hw_context::qos_type& qos)
+{
+  if (dev.get_pdev().is_umq())
+    return std::make_unique<shim_xdna::hwctx_umq>(dev, xclbin, qos);
+
+  // Device heap has to be there before hwctx is created.
+  dev.get_pdev().reserve_dev_heap(get_dev_heap_hint(*dev.get_xclbin_parser(xclbin)));
+  return std::make_unique<shim_xdna::hwctx_kmq>(dev, xclbin, qos);
+}
+
 }
 
 namespace shim_xdna {
@@ -1721,10 +2073,26 @@ lookup_query(query::key_type query_key) const
 device::
 device(const pdev& pdev, handle_type shim_handle, id_type device_id)
   : noshim<xrt_core::device_pcie>{shim_handle, device_id, !pdev.m_is_mgmt}
-  , m_pdev(pdev)
-  , m_pcidev_handle(xrt_core::pci::get_dev(device_id,is_userpf()))
+  , m_pcidev_handle(select_pcidev(device_id, is_userpf()))
+  , m_pdev(select_pdev(pdev, m_pcidev_handle))
 {
   m_pdev.open();
+  m_cmd_bo_pool = std::make_shared<cmd_bo_pool>(m_pdev);
+  m_bo_suballoc = std::make_unique<bo_suballocator>(m_pdev);
+  m_uptr_bo_cache = std::make_shared<uptr_bo_cache>(m_pdev);
+  m_syncobj_pool = std::make_shared<syncobj_pool>(m_pdev);
+  m_pending_pool = std::make_shared<pending_pool>(m_pdev);
+  m_cmd_reaper = std::make_shared<cmd_reaper>(m_pdev);
+  if (auto n = get_hwctx_pool_size()) {
+    m_hwctx_pool = std::make_unique<hwctx_pool>(n,
+      [this] (const xrt::xclbin& xclbin, const hwctx_pool::qos_type& qos) {
+        return create_xclbin_hwctx(*this, xclbin, qos);
+      });
+  }
+  if (is_mem_pressure_notify()) {
+    m_mem_pressure_listener = std::make_unique<mem_pressure_listener>(m_pdev,
+      [this] (uint32_t reasons) { trim_pools(reasons); });
+  }
   shim_debug("Created device (%s) ...", m_pdev.m_sysfs_name.c_str());
 }
 
@@ -1732,6 +2100,19 @@ device::
 ~device()
 {
   shim_debug("Destroying device (%s) ...", m_pdev.m_sysfs_name.c_str());
+  m_mem_pressure_listener.reset();
+  // Pooled BOs have to be freed before device is closed.
+  m_hwctx_pool.reset();
+  for (auto& pub : m_published_bos)
+    unlink(bo_registry_path(pub.first).c_str());
+  m_published_bos.clear();
+  m_cu_configs.clear();
+  m_cmd_bo_pool.reset();
+  m_bo_suballoc.reset();
+  m_uptr_bo_cache.reset();
+  m_syncobj_pool.reset();
+  m_pending_pool.reset();
+  m_cmd_reaper.reset();
   m_pdev.close();
 }
 
@@ -1743,6 +2124,247 @@ get_pdev() const
   return m_pdev;
 }
 
+std::shared_ptr<xrt_core::pci::dev>
+device::
+get_pcidev_handle() const
+{
+  return m_pcidev_handle;
+}
+
+std::pair<uint64_t, uint64_t>
+device::
+get_cmd_bo_pool_stats() const
+{
+  return { m_cmd_bo_pool->get_hit_count(), m_cmd_bo_pool->get_miss_count() };
+}
+
+std::shared_ptr<syncobj_pool>
+device::
+get_syncobj_pool() const
+{
+  return m_syncobj_pool;
+}
+
+std::shared_ptr<pending_pool>
+device::
+get_pending_pool() const
+{
+  return m_pending_pool;
+}
+
+std::shared_ptr<cmd_reaper>
+device::
+get_cmd_reaper() const
+{
+  return m_cmd_reaper;
+}
+
+query_cache&
+device::
+get_query_cache() const
+{
+  return m_query_cache;
+}
+
+std::shared_ptr<const xclbin_parser>
+device::
+get_xclbin_parser(const xrt::xclbin& xclbin) const
+{
+  const std::lock_guard<std::mutex> lock(m_xclbin_cache_lock);
+
+  auto& xp = m_xclbin_parsers[xclbin.get_uuid()];
+  if (!xp)
+    xp = std::make_shared<const xclbin_parser>(xclbin);
+  return xp;
+}
+
+void
+device::
+record_qos_profile(const xrt::uuid& uuid, const qos_profile& p) const
+{
+  const std::lock_guard<std::mutex> lock(m_xclbin_cache_lock);
+  m_qos_profiles[uuid] = p;
+}
+
+std::optional<qos_profile>
+device::
+get_qos_profile(const xrt::uuid& uuid) const
+{
+  const std::lock_guard<std::mutex> lock(m_xclbin_cache_lock);
+  auto it = m_qos_profiles.find(uuid);
+  if (it == m_qos_profiles.end())
+    return std::nullopt;
+  return it->second;
+}
+
+std::shared_ptr<buffer>
+device::
+get_pdi_bo(std::string_view pdi) const
+{
+  auto hash = std::hash<std::string_view>{}(pdi);
+
+  auto range = m_pdi_bos.equal_range(hash);
+  for (auto it = range.first; it != range.second;) {
+    auto bo = it->second.lock();
+    if (!bo) {
+      it = m_pdi_bos.erase(it);
+      continue;
+    }
+    if (bo->size() >= pdi.size() && !std::memcmp(bo->vaddr(), pdi.data(), pdi.size())) {
+      shim_debug("Reusing PDI BO %d for PDI of %ld bytes", bo->id().handle, pdi.size());
+      return bo;
+    }
+    ++it;
+  }
+
+  xcl_bo_flags f = {};
+  f.flags = XRT_BO_FLAGS_CACHEABLE;
+  // const_cast: alloc_bo() is not const yet in device class
+  auto& dev = const_cast<device&>(*this);
+  auto boh = dev.alloc_bo(pdi.size(), f.all);
+  std::shared_ptr<buffer> bo(dynamic_cast<buffer*>(boh.release()));
+
+  std::memcpy(bo->vaddr(), pdi.data(), pdi.size());
+  bo->sync(xrt_core::buffer_handle::direction::host2device, bo->size(), 0);
+  m_pdi_bos.emplace(hash, bo);
+  return bo;
+}
+
+std::shared_ptr<const cu_config>
+device::
+get_cu_config(const xrt::xclbin& xclbin, const xclbin_parser& xp) const
+{
+  const std::lock_guard<std::mutex> lock(m_xclbin_cache_lock);
+
+  auto& conf = m_cu_configs[xclbin.get_uuid()];
+  if (conf)
+    return conf;
+
+  auto c = std::make_shared<cu_config>();
+  c->m_conf_buf.resize(
+    sizeof(amdxdna_hwctx_param_config_cu) + xp.get_num_cus() * sizeof(amdxdna_cu_config));
+  auto cu_conf_param = reinterpret_cast<amdxdna_hwctx_param_config_cu *>(c->m_conf_buf.data());
+
+  cu_conf_param->num_cus = xp.get_num_cus();
+  for (int i = 0; i < cu_conf_param->num_cus; i++) {
+    c->m_pdi_bos.push_back(get_pdi_bo(xp.get_cu_pdi(i)));
+
+    auto& cf = cu_conf_param->cu_configs[i];
+    cf.cu_bo = c->m_pdi_bos[i]->id().handle;
+    cf.cu_func = xp.get_cu_func(i);
+  }
+
+  conf = c;
+  return conf;
+}
+
+std::optional<std::any>
+query_cache::
+get(const cache_key& key, std::chrono::milliseconds ttl)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  auto it = m_results.find(key);
+  if (it == m_results.end())
+    return std::nullopt;
+  if (ttl.count() && clock::now() - it->second.first > ttl)
+    return std::nullopt;
+  return it->second.second;
+}
+
+void
+query_cache::
+put(const cache_key& key, const std::any& result)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_results[key] = { clock::now(), result };
+}
+
+mem_pressure_listener::
+mem_pressure_listener(const pdev& pdev, trim_func trim)
+  : m_pdev(pdev)
+  , m_trim(std::move(trim))
+{
+  m_cancel_fd = eventfd(0, EFD_CLOEXEC);
+  if (m_cancel_fd == -1)
+    shim_err(-errno, "Failed to create eventfd for memory pressure listener");
+  m_thread = std::thread(&mem_pressure_listener::run, this);
+}
+
+mem_pressure_listener::
+~mem_pressure_listener()
+{
+  uint64_t one = 1;
+  if (write(m_cancel_fd, &one, sizeof(one)) != sizeof(one))
+    shim_debug("Failed to cancel memory pressure listener, err=%d", errno);
+  m_thread.join();
+  close(m_cancel_fd);
+}
+
+void
+mem_pressure_listener::
+run()
+{
+  wait_mem_pressure_arg arg = {
+    .heap_threshold = get_mem_pressure_heap_bytes(),
+    .bo_threshold = get_mem_pressure_bo_bytes(),
+    .cancel_fd = m_cancel_fd,
+  };
+
+  while (true) {
+    try {
+      m_pdev.drv_ioctl(drv_ioctl_cmd::wait_mem_pressure, &arg);
+    } catch (const xrt_core::system_error& ex) {
+      // E.g., driver or platform has no memory pressure notification
+      shim_debug("Stop listening to memory pressure: %s", ex.what());
+      return;
+    }
+    if (!arg.reasons)
+      return;
+
+    shim_debug("Memory pressure 0x%x, heap 0x%lx, BO 0x%lx",
+      arg.reasons, arg.heap_usage, arg.bo_usage);
+    m_trim(arg.reasons);
+  }
+}
+
+void
+device::
+trim_pools(uint32_t reasons) const
+{
+  auto cmd_bos = m_cmd_bo_pool->trim();
+  auto uptr_bos = m_uptr_bo_cache->trim();
+  auto ctxs = m_hwctx_pool ? m_hwctx_pool->trim() : 0;
+  shim_debug("Trimmed %ld cmd BOs, %ld uptr BOs, %ld hwctx on memory pressure 0x%x",
+    cmd_bos, uptr_bos, ctxs, reasons);
+}
+
+void
+device::
+invalidate_uptr_bo_cache(void *uptr, size_t size)
+{
+  m_uptr_bo_cache->invalidate(uptr, size);
+}
+
+void
+device::
+sync_bos(const std::vector<bo_sync>& syncs) const
+{
+  std::vector<sync_bo_arg> args;
+  {
+    buffer::driver_sync_batch batch(args);
+    for (auto& s : syncs)
+      s.bo->sync(s.dir, s.size, s.offset);
+  }
+  if (args.empty())
+    return;
+
+  sync_bos_arg arg = {
+    .bos = args,
+  };
+  m_pdev.drv_ioctl(drv_ioctl_cmd::sync_bos, &arg);
+  shim_debug("Sync'ed %ld BOs, %ld of them in driver", syncs.size(), args.size());
+}
+
 void
 device::
 close_device()
@@ -1774,15 +2396,24 @@ open_aie_context(xrt::aie::access_mode)
   // which calls open_aie_context of ishim.
 }
 
+std::unique_ptr<hwctx>
+device::
+create_hwctx(const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos) const
+{
+  return create_xclbin_hwctx(*this, xclbin, qos);
+}
+
 std::unique_ptr<xrt_core::hwctx_handle>
 device::
 create_hw_context(const xrt::uuid& xclbin_uuid, const xrt::hw_context::qos_type& qos,
   xrt::hw_context::access_mode mode) const
 {
-  if (m_pdev.is_umq())
-    return std::make_unique<hwctx_umq>(*this, get_xclbin(xclbin_uuid), qos);
-  else
-    return std::make_unique<hwctx_kmq>(*this, get_xclbin(xclbin_uuid), qos);
+  auto xclbin = get_xclbin(xclbin_uuid);
+  if (m_hwctx_pool) {
+    if (auto ctx = m_hwctx_pool->get(xclbin, qos))
+      return ctx;
+  }
+  return create_xclbin_hwctx(*this, xclbin, qos);
 }
 
 std::unique_ptr<xrt_core::hwctx_handle>
@@ -1792,8 +2423,9 @@ create_hw_context(uint32_t partition_size, const xrt::hw_context::qos_type& qos,
 {
   if (m_pdev.is_umq())
     return std::make_unique<hwctx_umq>(*this, partition_size);
-  else
-    return std::make_unique<hwctx_kmq>(*this, partition_size);
+
+  m_pdev.reserve_dev_heap(0);
+  return std::make_unique<hwctx_kmq>(*this, partition_size);
 }
 
 std::unique_ptr<xrt_core::buffer_handle>
@@ -1819,10 +2451,20 @@ alloc_bo(void* userptr, size_t size, uint64_t flags)
     f.use == XRT_BO_USE_DEBUG_QUEUE ||
     f.use == XRT_BO_USE_UC_DEBUG)
     bo = std::make_unique<uc_dbg_buffer>(get_pdev(), size, flags);
-  else if (f.boflags == (XCL_BO_FLAGS_EXECBUF >> 24))
-    bo = std::make_unique<cmd_buffer>(get_pdev(), size, flags);
-  else
-    bo = std::make_unique<buffer>(get_pdev(), size, userptr, flags);
+  else if (f.boflags == (XCL_BO_FLAGS_EXECBUF >> 24)) {
+    bo = m_cmd_bo_pool->alloc(size, flags);
+    if (!bo)
+      bo = std::make_unique<cmd_buffer>(get_pdev(), size, flags);
+  } else {
+    if (userptr)
+      bo = m_uptr_bo_cache->alloc(userptr, size, flags);
+    else
+      bo = m_bo_suballoc->alloc(size, flags);
+    if (!bo)
+      bo = std::make_unique<buffer>(get_pdev(), size, userptr, flags);
+  }
+  shim_xdna::trace_stream::emit_bo(shim_xdna::trace_stream::event::bo_alloc, bo.get(),
+    bo->id().handle, size, flags);
   return bo;
 }
 
@@ -1833,6 +2475,107 @@ import_bo(pid_t pid, xrt_core::shared_handle::export_handle ehdl)
   return std::make_unique<buffer>(get_pdev(), import_fd(pid, ehdl));
 }
 
+void
+device::
+publish_bo(const std::string& name, const xrt_core::buffer_handle *bo)
+{
+  auto path = bo_registry_path(name);
+  const std::lock_guard<std::mutex> lock(m_named_bo_lock);
+
+  pid_t pid;
+  int fd;
+  if (m_published_bos.count(name) || (read_bo_registry(path, pid, fd) && pid != getpid()))
+    shim_err(EEXIST, "BO '%s' is already published", name.c_str());
+
+  // Exported fd has to stay open for as long as others may import it.
+  auto shared = bo->share();
+  write_bo_registry(path, getpid(), shared->get_export_handle());
+  m_published_bos[name] = std::move(shared);
+  shim_debug("Published BO %d as '%s'", static_cast<const buffer*>(bo)->id().handle,
+    name.c_str());
+}
+
+void
+device::
+unpublish_bo(const std::string& name)
+{
+  const std::lock_guard<std::mutex> lock(m_named_bo_lock);
+
+  auto it = m_published_bos.find(name);
+  if (it == m_published_bos.end())
+    shim_err(ENOENT, "BO '%s' is not published by this process", name.c_str());
+  unlink(bo_registry_path(name).c_str());
+  m_published_bos.erase(it);
+}
+
+std::unique_ptr<xrt_core::buffer_handle>
+device::
+import_bo(pid_t pid, xrt_core::shared_handle::export_handle ehdl, size_t offset, size_t size)
+{
+  auto fd = import_fd(pid, ehdl);
+  struct stat st = {};
+  if (fstat(fd, &st) == -1) {
+    auto err = errno;
+    if (fd != ehdl)
+      close(fd);
+    shim_err(-err, "Failed to stat dma-buf fd %d", fd);
+  }
+
+  std::shared_ptr<buffer> parent;
+  {
+    const std::lock_guard<std::mutex> lock(m_named_bo_lock);
+    auto& wbo = m_range_parent_bos[{ st.st_dev, st.st_ino }];
+    parent = wbo.lock();
+    if (!parent) {
+      try {
+        parent = std::make_shared<buffer>(get_pdev(), fd);
+      } catch (...) {
+        if (fd != ehdl)
+          close(fd);
+        throw;
+      }
+      wbo = parent;
+    }
+  }
+  if (fd != ehdl)
+    close(fd);
+  return std::make_unique<buffer>(std::move(parent), offset, size);
+}
+
+std::shared_ptr<buffer>
+device::
+import_named_bo(const std::string& name) const
+{
+  auto path = bo_registry_path(name);
+  const std::lock_guard<std::mutex> lock(m_named_bo_lock);
+
+  // All users in this process share one import, so that it is mapped once.
+  auto& wbo = m_named_bos[name];
+  if (auto bo = wbo.lock())
+    return bo;
+
+  pid_t pid;
+  int ehdl;
+  if (!read_bo_registry(path, pid, ehdl))
+    shim_err(ENOENT, "No BO is published as '%s'", name.c_str());
+  auto fd = import_fd(pid, ehdl);
+  std::shared_ptr<buffer> bo;
+  try {
+    bo = std::make_shared<buffer>(get_pdev(), fd, true);
+  } catch (...) {
+    if (fd != ehdl)
+      close(fd);
+    throw;
+  }
+  // Imported BO holds the dma-buf, fd taken from publisher is not needed.
+  if (fd != ehdl)
+    close(fd);
+  wbo = bo;
+  shim_debug("Imported BO '%s' of %ld bytes from pid %d read-only as BO %d", name.c_str(),
+    bo->size(), pid, bo->id().handle);
+  return bo;
+}
+
 std::unique_ptr<xrt_core::fence_handle>
 device::
 create_fence(xrt::fence::access_mode)
@@ -9,18 +9,150 @@
 #include "shim_debug.h"
 #include "core/common/ishim.h"
 
+#include <any>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
 namespace shim_xdna {
 
-class device : public xrt_core::noshim<xrt_core::device_pcie>
+// Results of device queries, see Runtime.query_cache_ttl_ms.
+class query_cache
+{
+public:
+  using clock = std::chrono::steady_clock;
+  // Query key and, for queries taking a parameter, the parameter value
+  using cache_key = std::pair<xrt_core::query::key_type, uint64_t>;
+
+  // Returns nothing if not cached or cached longer than ttl ago. Zero ttl
+  // means cached result never expires.
+  std::optional<std::any>
+  get(const cache_key& key, std::chrono::milliseconds ttl);
+
+  void
+  put(const cache_key& key, const std::any& result);
+
+private:
+  std::mutex m_lock;
+  std::map<cache_key, std::pair<clock::time_point, std::any>> m_results;
+};
+
+// Waits on a thread of its own for driver to say memory is short and calls
+// trim on it, so that what is cached for performance is given back. See
+// Runtime.mem_pressure_notify, _heap_mb and _bo_mb.
+class mem_pressure_listener
 {
+public:
+  // Called with AMDXDNA_MEM_PRESSURE_* bits
+  using trim_func = std::function<void(uint32_t)>;
+
+  mem_pressure_listener(const pdev& pdev, trim_func trim);
+  ~mem_pressure_listener();
+
 private:
-  const pdev& m_pdev; // The pcidev that this device object is created from
+  void
+  run();
+
+  const pdev& m_pdev;
+  const trim_func m_trim;
+  int m_cancel_fd = -1;
+  std::thread m_thread;
+};
+
+class cmd_bo_pool;
+class bo_suballocator;
+class uptr_bo_cache;
+class syncobj_pool;
+class pending_pool;
+class cmd_reaper;
+class xclbin_parser;
+struct cu_config;
+class hwctx;
+class hwctx_pool;
+class buffer;
+
+// Cmd profile of a hwctx, recorded when it is destroyed. QoS of later hwctx
+// created from the same xclbin without QoS of their own is derived from it.
+struct qos_profile
+{
+  // Giga ops done by one cmd
+  uint32_t gop;
+  // Cmds submitted per second
+  uint32_t cps;
+};
 
-  // The shared pointer to the pcidev which this device is created from
+class device : public xrt_core::noshim<xrt_core::device_pcie>
+{
+private:
+  // The shared pointer to the pcidev which this device is created from, or
+  // placed on in virtual device mode (see Runtime.virtual_device).
   // Hold the shared pointer in this object to make sure the underline pdev
   // will not be released until this object is released.
   std::shared_ptr<xrt_core::pci::dev> m_pcidev_handle;
 
+  const pdev& m_pdev; // The pcidev that backs this device object
+
+  // Recycles exec buf BOs allocated through this device.
+  std::shared_ptr<cmd_bo_pool> m_cmd_bo_pool;
+
+  // Carves small host only BOs out of shared slab BOs.
+  std::unique_ptr<bo_suballocator> m_bo_suballoc;
+
+  // Keeps user pointer BOs pinned for re-registration of the same range.
+  std::shared_ptr<uptr_bo_cache> m_uptr_bo_cache;
+
+  // Recycles syncobjs of fences created through this device.
+  std::shared_ptr<syncobj_pool> m_syncobj_pool;
+
+  // Workers processing pending queues of all hwqs created on this device.
+  std::shared_ptr<pending_pool> m_pending_pool;
+
+  // Finds completed cmds of all hwqs created on this device for callbacks.
+  std::shared_ptr<cmd_reaper> m_cmd_reaper;
+
+  // Lives as long as this device, so static properties are read only once.
+  mutable query_cache m_query_cache;
+
+  // Parsed xclbins and CU configs built from them, keyed by xclbin UUID, so
+  // that only the first hwctx created from an xclbin pays for them.
+  mutable std::mutex m_xclbin_cache_lock;
+  mutable std::map<xrt::uuid, std::shared_ptr<const xclbin_parser>> m_xclbin_parsers;
+  mutable std::map<xrt::uuid, std::shared_ptr<const cu_config>> m_cu_configs;
+  // PDI BOs of above CU configs keyed by hash of PDI content, as different
+  // xclbins often carry the same PDIs.
+  mutable std::unordered_multimap<size_t, std::weak_ptr<buffer>> m_pdi_bos;
+
+  // What past hwctx of an xclbin did, keyed by xclbin UUID.
+  mutable std::map<xrt::uuid, qos_profile> m_qos_profiles;
+
+  // Returns PDI BO holding pdi, allocated only if no one has it yet.
+  // m_xclbin_cache_lock must be held.
+  std::shared_ptr<buffer>
+  get_pdi_bo(std::string_view pdi) const;
+
+  // Exported fds of BOs published by this process and read-only imports of
+  // BOs published by any process, keyed by name.
+  mutable std::mutex m_named_bo_lock;
+  std::map<std::string, std::unique_ptr<xrt_core::shared_handle>> m_published_bos;
+  mutable std::map<std::string, std::weak_ptr<buffer>> m_named_bos;
+  // Whole BOs of imported sub-ranges keyed by dma-buf inode, so that all
+  // ranges of one BO share its mapping.
+  mutable std::map<std::pair<dev_t, ino_t>, std::weak_ptr<buffer>> m_range_parent_bos;
+
+  // Pre-created hwctx, only if enabled by Runtime.hwctx_pool_size.
+  std::unique_ptr<hwctx_pool> m_hwctx_pool;
+
+  // Trims pools above on memory pressure, if enabled.
+  std::unique_ptr<mem_pressure_listener> m_mem_pressure_listener;
+
+  void
+  trim_pools(uint32_t reasons) const;
+
   // Private look up function for concrete query::request
   const xrt_core::query::request&
   lookup_query(xrt_core::query::key_type query_key) const override;
@@ -32,6 +164,77 @@ public:
   const pdev&
   get_pdev() const;
 
+  std::shared_ptr<xrt_core::pci::dev>
+  get_pcidev_handle() const;
+
+  // Number of exec buf allocations served by / missed in cmd BO pool.
+  std::pair<uint64_t, uint64_t>
+  get_cmd_bo_pool_stats() const;
+
+  std::shared_ptr<syncobj_pool>
+  get_syncobj_pool() const;
+
+  std::shared_ptr<pending_pool>
+  get_pending_pool() const;
+
+  std::shared_ptr<cmd_reaper>
+  get_cmd_reaper() const;
+
+  query_cache&
+  get_query_cache() const;
+
+  std::shared_ptr<const xclbin_parser>
+  get_xclbin_parser(const xrt::xclbin& xclbin) const;
+
+  // Create hwctx of the kind this device runs, not taken from hwctx pool.
+  std::unique_ptr<hwctx>
+  create_hwctx(const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos) const;
+
+  void
+  record_qos_profile(const xrt::uuid& uuid, const qos_profile& p) const;
+
+  std::optional<qos_profile>
+  get_qos_profile(const xrt::uuid& uuid) const;
+
+  // KMQ only, PDI BOs are allocated from device heap on first call.
+  std::shared_ptr<const cu_config>
+  get_cu_config(const xrt::xclbin& xclbin, const xclbin_parser& xp) const;
+
+  // Named registry of BOs shared read-only across processes, e.g. model
+  // weights loaded once for all workers on the host. Publisher keeps BO
+  // exported until it is unpublished or device is closed. Importing a name
+  // again in the same process returns the same BO while it is alive. The
+  // driver imports the publisher's pages, nothing is copied.
+  void
+  publish_bo(const std::string& name, const xrt_core::buffer_handle *bo);
+
+  void
+  unpublish_bo(const std::string& name);
+
+  std::shared_ptr<buffer>
+  import_named_bo(const std::string& name) const;
+
+  // Import range [offset, offset + size) exported by buffer::share(offset,
+  // size) as BO of that size.
+  std::unique_ptr<xrt_core::buffer_handle>
+  import_bo(pid_t pid, xrt_core::shared_handle::export_handle ehdl, size_t offset, size_t size);
+
+  // If uptr BO cache is enabled, must be called after BOs on user memory are
+  // destroyed and before that memory is unmapped or remapped.
+  void
+  invalidate_uptr_bo_cache(void *uptr, size_t size);
+
+  struct bo_sync {
+    xrt_core::buffer_handle *bo;
+    xrt_core::buffer_handle::direction dir;
+    size_t size;
+    size_t offset;
+  };
+  // Same as sync() of each BO of this device, but BOs that have to be
+  // synced by driver are synced by one ioctl, rather than one per BO.
+  void
+  sync_bos(const std::vector<bo_sync>& syncs) const;
+
 // ISHIM APIs supported are listed below
 public:
   void
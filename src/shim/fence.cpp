@@ -2,6 +2,8 @@
 // Copyright (C) 2024-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "fence.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
 
 namespace {
 
@@ -59,58 +61,249 @@ signal_syncobj(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint
 }
 
 void
-wait_syncobj_done(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint)
+wait_syncobj_done(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint,
+  uint32_t timeout_ms)
 {
   wait_syncobj_arg wsobj = {
     .handle = sobj_hdl,
-    .timeout_ms = 0, /* wait forever */
+    .timeout_ms = timeout_ms, /* 0 means wait forever */
     .timepoint = timepoint,
   };
   dev.drv_ioctl(drv_ioctl_cmd::wait_syncobj, &wsobj);
 }
 
+uint64_t
+query_syncobj(const shim_xdna::pdev& dev, uint32_t sobj_hdl)
+{
+  query_syncobj_arg qsobj = {
+    .handle = sobj_hdl,
+  };
+  dev.drv_ioctl(drv_ioctl_cmd::query_syncobj, &qsobj);
+  return qsobj.timepoint;
+}
+
+size_t
+get_syncobj_pool_size()
+{
+  static size_t pool_size =
+    xrt_core::config::detail::get_uint_value("Runtime.syncobj_pool_size", 64);
+  return pool_size;
+}
+
 }
 
 namespace shim_xdna {
 
+//
+// Impl for class syncobj
+//
+
+syncobj::
+syncobj(const pdev& pdev, uint32_t hdl, uint64_t base, std::weak_ptr<syncobj_pool> pool)
+  : m_pdev(pdev)
+  , m_hdl(hdl)
+  , m_base(base)
+  , m_pool(std::move(pool))
+  , m_issued(base)
+  , m_reached(base)
+{
+}
+
+syncobj::
+~syncobj()
+{
+  auto pool = m_pool.lock();
+  if (pool && !m_exported) {
+    auto last = m_reached.load();
+    // Device may have signaled timepoints we have not seen.
+    if (last < m_issued) {
+      try {
+        last = std::max(last, query_syncobj(m_pdev, m_hdl));
+      } catch (const xrt_core::system_error& e) {
+        shim_debug("Failed to query syncobj %d", m_hdl);
+      }
+    }
+    // Timepoints still pending could be mistaken by next user.
+    if (last >= m_issued && pool->recycle(m_hdl, last))
+      return;
+  }
+
+  try {
+    destroy_syncobj(m_pdev, m_hdl);
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to destroy syncobj %d", m_hdl);
+  }
+}
+
+uint32_t
+syncobj::
+get_handle() const
+{
+  return m_hdl;
+}
+
+uint64_t
+syncobj::
+get_base() const
+{
+  return m_base;
+}
+
+void
+syncobj::
+issued(uint64_t state)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_issued = std::max(m_issued, state);
+}
+
+void
+syncobj::
+reached(uint64_t state)
+{
+  auto cur = m_reached.load();
+  while (cur < state && !m_reached.compare_exchange_weak(cur, state))
+    ;
+}
+
+bool
+syncobj::
+is_reached(uint64_t state) const
+{
+  return m_reached.load() >= state;
+}
+
+void
+syncobj::
+exported()
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_exported = true;
+}
+
+//
+// Impl for class syncobj_pool
+//
+
+syncobj_pool::
+syncobj_pool(const pdev& dev)
+  : m_pdev(dev)
+  , m_max_size(get_syncobj_pool_size())
+{
+}
+
+syncobj_pool::
+~syncobj_pool()
+{
+  shim_debug("Syncobj pool hit %ld, miss %ld", m_hit.load(), m_miss.load());
+  for (auto& s : m_free) {
+    try {
+      destroy_syncobj(m_pdev, s.first);
+    } catch (const xrt_core::system_error& e) {
+      shim_debug("Failed to destroy syncobj %d", s.first);
+    }
+  }
+}
+
+std::shared_ptr<syncobj>
+syncobj_pool::
+alloc()
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    if (!m_free.empty()) {
+      auto s = m_free.back();
+      m_free.pop_back();
+      m_hit++;
+      return std::make_shared<syncobj>(m_pdev, s.first, s.second, weak_from_this());
+    }
+  }
+  m_miss++;
+  return std::make_shared<syncobj>(m_pdev, create_syncobj(m_pdev), 0, weak_from_this());
+}
+
+bool
+syncobj_pool::
+recycle(uint32_t hdl, uint64_t base)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  if (m_free.size() >= m_max_size)
+    return false;
+  m_free.emplace_back(hdl, base);
+  return true;
+}
+
+uint64_t
+syncobj_pool::
+get_hit_count() const
+{
+  return m_hit;
+}
+
+uint64_t
+syncobj_pool::
+get_miss_count() const
+{
+  return m_miss;
+}
+
+//
+// Impl for class fence
+//
+
 fence::
 fence(const device& device)
-  : m_pdev(device.get_pdev())
+  : fence(device.get_pdev(), device.get_syncobj_pool()->alloc())
+{
+}
+
+fence::
+fence(const pdev& pdev, std::shared_ptr<syncobj> sobj)
+  : m_pdev(pdev)
   , m_import(std::make_unique<shared>(-1))
-  , m_syncobj_hdl(create_syncobj(m_pdev))
+  , m_syncobj(sobj ? std::move(sobj) :
+    std::make_shared<syncobj>(m_pdev, create_syncobj(m_pdev), 0, std::weak_ptr<syncobj_pool>()))
+  , m_initial_state(m_syncobj->get_base())
+  , m_state(m_initial_state)
 {
-  shim_debug("Fence allocated: %d@%d", m_syncobj_hdl, m_state);
+  shim_debug("Fence allocated: %d@%ld", m_syncobj->get_handle(), m_state);
 }
 
 fence::
 fence(const device& device, xrt_core::shared_handle::export_handle ehdl)
   : m_pdev(device.get_pdev())
   , m_import(std::make_unique<shared>(ehdl))
-  , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
+  , m_syncobj(std::make_shared<syncobj>(m_pdev, import_syncobj(m_pdev, m_import->get_export_handle()),
+    0, std::weak_ptr<syncobj_pool>()))
+  , m_initial_state(0)
+  , m_state(m_initial_state)
 {
-  shim_debug("Fence imported: %d@%ld", m_syncobj_hdl, m_state);
+  shim_debug("Fence imported: %d@%ld", m_syncobj->get_handle(), m_state);
 }
 
+// Clone within the same process shares the syncobj handle, no need to go
+// through export and import.
 fence::
 fence(const fence& f)
   : m_pdev(f.m_pdev)
-  , m_import(f.share())
-  , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
-  , m_state{f.m_state}
-  , m_signaled{f.m_signaled}
+  , m_import(std::make_unique<shared>(-1))
 {
-  shim_debug("Fence cloned: %d@%ld", m_syncobj_hdl, m_state);
+  std::lock_guard<std::mutex> guard(f.m_lock);
+  // Recycled syncobj can't be replaced by share() once it is cloned. Unused
+  // fence may still be shared through either copy, give both a fresh one.
+  if (f.m_initial_state != 0 && f.m_state == f.m_initial_state)
+    f.use_fresh_syncobj();
+  m_syncobj = f.m_syncobj;
+  m_signaled = f.m_signaled;
+  m_initial_state = f.m_initial_state;
+  m_state = f.m_state;
+  shim_debug("Fence cloned: %d@%ld", m_syncobj->get_handle(), m_state);
 }
 
 fence::
 ~fence()
 {
-  shim_debug("Fence going away: %d@%ld", m_syncobj_hdl, m_state);
-  try {
-    destroy_syncobj(m_pdev, m_syncobj_hdl);
-  } catch (const xrt_core::system_error& e) {
-    shim_debug("Failed to destroy fence");
-  }
+  shim_debug("Fence going away: %d@%ld", m_syncobj->get_handle(), m_state);
 }
 
 std::unique_ptr<xrt_core::shared_handle>
@@ -119,10 +312,27 @@ share() const
 {
   std::lock_guard<std::mutex> guard(m_lock);
 
-  if (m_state != initial_state)
+  if (m_state != m_initial_state)
     shim_err(EINVAL, "Can't share fence not at initial state.");
 
-  return std::make_unique<shared>(export_syncobj(m_pdev, m_syncobj_hdl));
+  // Importer expects timeline to start from 0, recycled syncobj can't be used.
+  if (m_initial_state != 0) {
+    if (m_syncobj.use_count() > 1)
+      shim_err(EINVAL, "Can't share recycled fence which has been cloned.");
+    use_fresh_syncobj();
+  }
+  m_syncobj->exported();
+  return std::make_unique<shared>(export_syncobj(m_pdev, m_syncobj->get_handle()));
+}
+
+void
+fence::
+use_fresh_syncobj() const
+{
+  m_syncobj = std::make_shared<syncobj>(m_pdev, create_syncobj(m_pdev), 0,
+    std::weak_ptr<syncobj_pool>());
+  m_initial_state = m_state = 0;
+  shim_debug("Fence moved to fresh syncobj %d", m_syncobj->get_handle());
 }
 
 uint64_t
@@ -145,25 +355,143 @@ next_wait_state() const
 {
   std::lock_guard<std::mutex> guard(m_lock);
 
-  if (m_state != initial_state && m_signaled)
+  if (m_state != m_initial_state && m_signaled)
     shim_err(EINVAL, "Can't wait on fence that has been signaled before.");
-  return ++m_state;
+  m_syncobj->issued(++m_state);
+  return m_state;
+}
+
+void
+fence::
+unwind_wait_state(uint64_t state) const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  // Nothing to do if someone else has moved on from this state.
+  if (m_state == state)
+    m_state--;
 }
 
 void
 fence::
-wait(uint64_t state) const
+wait(uint64_t state, uint32_t timeout_ms) const
 {
-  shim_debug("Waiting for command fence %d@%ld", m_syncobj_hdl, state);
-  wait_syncobj_done(m_pdev, m_syncobj_hdl, state);
+  shim_debug("Waiting for command fence %d@%ld", get_syncobj(), state);
+  wait_syncobj_done(m_pdev, get_syncobj(), state, timeout_ms);
+  m_syncobj->reached(state);
 }
 
-// Timeout value is ignored for now.
 void
 fence::
 wait(uint32_t timeout_ms) const
 {
-  wait(next_wait_state());
+  auto state = next_wait_state();
+  try {
+    wait(state, timeout_ms);
+  } catch (const xrt_core::system_error& ex) {
+    // Let next wait try the same state again.
+    if (ex.get_code() == ETIME)
+      unwind_wait_state(state);
+    throw;
+  }
+}
+
+size_t
+fence::
+wait(const std::vector<const fence *>& fences, bool wait_all, uint32_t timeout_ms)
+{
+  if (fences.empty())
+    shim_err(EINVAL, "No fence to wait for");
+
+  auto& pdev = fences[0]->m_pdev;
+  std::vector<uint32_t> handles;
+  std::vector<uint64_t> states;
+  for (auto f : fences) {
+    if (&f->m_pdev != &pdev)
+      shim_err(EINVAL, "Can't wait for fences from different devices together");
+    handles.push_back(f->get_syncobj());
+  }
+  for (auto f : fences)
+    states.push_back(f->next_wait_state());
+
+  wait_syncobjs_arg arg = {
+    .handles = handles,
+    .timepoints = states,
+    .timeout_ms = timeout_ms,
+    .wait_all = wait_all,
+  };
+  shim_debug("Waiting for %s of %ld fences", wait_all ? "all" : "any", fences.size());
+  try {
+    pdev.drv_ioctl(drv_ioctl_cmd::wait_syncobjs, &arg);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() == ETIME) {
+      for (size_t i = 0; i < fences.size(); i++)
+        fences[i]->unwind_wait_state(states[i]);
+    }
+    throw;
+  }
+
+  if (wait_all) {
+    for (size_t i = 0; i < fences.size(); i++)
+      fences[i]->m_syncobj->reached(states[i]);
+    return 0;
+  }
+
+  // Only the reported one is known to be signaled, the rest are still to be
+  // waited.
+  for (size_t i = 0; i < fences.size(); i++) {
+    if (i != arg.first_signaled)
+      fences[i]->unwind_wait_state(states[i]);
+  }
+  fences[arg.first_signaled]->m_syncobj->reached(states[arg.first_signaled]);
+  return arg.first_signaled;
+}
+
+bool
+fence::
+is_signaled(uint64_t state) const
+{
+  if (m_syncobj->is_reached(state))
+    return true;
+
+  auto cur = query_syncobj(m_pdev, get_syncobj());
+  m_syncobj->reached(cur);
+  return cur >= state;
+}
+
+std::vector<bool>
+fence::
+is_signaled(const std::vector<const fence *>& fences, const std::vector<uint64_t>& states)
+{
+  if (fences.size() != states.size())
+    shim_err(EINVAL, "Fences and states mismatch: %ld, %ld", fences.size(), states.size());
+
+  std::vector<bool> ret(fences.size(), true);
+  std::vector<size_t> idx;
+  std::vector<uint32_t> handles;
+  for (size_t i = 0; i < fences.size(); i++) {
+    if (fences[i]->m_syncobj->is_reached(states[i]))
+      continue;
+    if (&fences[i]->m_pdev != &fences[0]->m_pdev)
+      shim_err(EINVAL, "Can't query fences from different devices together");
+    idx.push_back(i);
+    handles.push_back(fences[i]->get_syncobj());
+  }
+  if (idx.empty())
+    return ret;
+
+  std::vector<uint64_t> values;
+  query_syncobjs_arg arg = {
+    .handles = handles,
+    .timepoints = values,
+  };
+  fences[0]->m_pdev.drv_ioctl(drv_ioctl_cmd::query_syncobjs, &arg);
+  for (size_t i = 0; i < idx.size(); i++) {
+    auto f = fences[idx[i]];
+    f->m_syncobj->reached(values[i]);
+    ret[idx[i]] = values[i] >= states[idx[i]];
+  }
+  return ret;
 }
 
 uint64_t
@@ -172,19 +500,21 @@ next_signal_state() const
 {
   std::lock_guard<std::mutex> guard(m_lock);
 
-  if (m_state != initial_state && !m_signaled)
+  if (m_state != m_initial_state && !m_signaled)
     shim_err(EINVAL, "Can't signal fence that has been waited before.");
-  if (m_state == initial_state)
+  if (m_state == m_initial_state)
     m_signaled = true;
-  return ++m_state;
+  m_syncobj->issued(++m_state);
+  return m_state;
 }
 
 void
 fence::
 signal(uint64_t state) const
 {
-  shim_debug("Signaling command fence %d@%ld", m_syncobj_hdl, state);
-  signal_syncobj(m_pdev, m_syncobj_hdl, state);
+  shim_debug("Signaling command fence %d@%ld", get_syncobj(), state);
+  signal_syncobj(m_pdev, get_syncobj(), state);
+  m_syncobj->reached(state);
 }
 
 void
@@ -194,11 +524,18 @@ signal() const
   signal(next_signal_state());
 }
 
+uint32_t
+fence::
+get_syncobj() const
+{
+  return m_syncobj->get_handle();
+}
+
 const std::string
 fence::
 describe() const
 {
-  return std::to_string(m_syncobj_hdl) + "@" + std::to_string(get_next_state());
+  return std::to_string(get_syncobj()) + "@" + std::to_string(get_next_state());
 }
 
 }
@@ -8,14 +8,96 @@
 #include "device.h"
 #include "shared.h"
 #include "core/common/shim/fence_handle.h"
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 namespace shim_xdna {
 
+class syncobj_pool;
+
+// Timeline syncobj shared by a fence and its in process clones. Destroyed or,
+// if it has come from a pool and all its timepoints are reached, given back
+// to the pool when last fence referencing it goes away.
+class syncobj
+{
+public:
+  syncobj(const pdev& pdev, uint32_t hdl, uint64_t base, std::weak_ptr<syncobj_pool> pool);
+  ~syncobj();
+
+  uint32_t
+  get_handle() const;
+
+  // First timepoint of this syncobj is the one after base.
+  uint64_t
+  get_base() const;
+
+  // Timepoint handed out to be waited or signaled.
+  void
+  issued(uint64_t state);
+
+  // Timepoint known to have been signaled.
+  void
+  reached(uint64_t state);
+
+  // Whether state is known to have been signaled, no ioctl involved.
+  bool
+  is_reached(uint64_t state) const;
+
+  // Handle is visible outside of this process, never recycle it.
+  void
+  exported();
+
+private:
+  const pdev& m_pdev;
+  const uint32_t m_hdl;
+  const uint64_t m_base;
+  std::weak_ptr<syncobj_pool> m_pool;
+
+  std::mutex m_lock;
+  uint64_t m_issued;
+  bool m_exported = false;
+  // Last timeline value observed, read without lock
+  std::atomic<uint64_t> m_reached;
+};
+
+// Per device list of idle syncobjs, so that short lived fences do not cost a
+// create and destroy ioctl each. Recycled syncobjs keep their timeline, new
+// fence on it just starts from where the last one stopped.
+class syncobj_pool : public std::enable_shared_from_this<syncobj_pool>
+{
+public:
+  syncobj_pool(const pdev& dev);
+  ~syncobj_pool();
+
+  std::shared_ptr<syncobj>
+  alloc();
+
+  // Keep idle syncobj for reuse, returns false if pool is full.
+  bool
+  recycle(uint32_t hdl, uint64_t base);
+
+  uint64_t
+  get_hit_count() const;
+
+  uint64_t
+  get_miss_count() const;
+
+private:
+  const pdev& m_pdev;
+  const size_t m_max_size;
+  std::mutex m_lock;
+  std::vector< std::pair<uint32_t, uint64_t> > m_free;
+  std::atomic<uint64_t> m_hit = 0;
+  std::atomic<uint64_t> m_miss = 0;
+};
+
 class fence : public xrt_core::fence_handle
 {
 public:
   fence(const device& device);
+  fence(const pdev& pdev, std::shared_ptr<syncobj> sobj = nullptr);
   fence(const device& device, xrt_core::shared_handle::export_handle ehdl);
   fence(const fence&);
   ~fence() override;
@@ -45,24 +127,54 @@ public:
   uint64_t
   next_signal_state() const;
 
+  // Timeout of 0 means waiting forever. Throws ETIME on timeout.
   void
-  wait(uint64_t state) const;
+  wait(uint64_t state, uint32_t timeout_ms = 0) const;
+
+  // Wait for all or any of fences in one ioctl. Returns index of a signaled
+  // fence when waiting for any. On timeout, ETIME is thrown and none of the
+  // fences is considered waited.
+  static size_t
+  wait(const std::vector<const fence *>& fences, bool wait_all, uint32_t timeout_ms);
+
+  // Non-blocking check whether state has been signaled. Last observed
+  // timeline value is cached, so ioctl is needed only until it is passed.
+  bool
+  is_signaled(uint64_t state) const;
+
+  // Same as above for many fences, all not yet known ones are queried in
+  // one ioctl.
+  static std::vector<bool>
+  is_signaled(const std::vector<const fence *>& fences, const std::vector<uint64_t>& states);
 
   void
   signal(uint64_t state) const;
 
+  uint32_t
+  get_syncobj() const;
+
 private:
+  // Give back state obtained from next_wait_state() when it is not waited.
+  void
+  unwind_wait_state(uint64_t state) const;
+
+  // Replace syncobj by a new one with timeline starting from 0, m_lock held.
+  void
+  use_fresh_syncobj() const;
+
   const pdev& m_pdev;
   const std::unique_ptr<xrt_core::shared_handle> m_import;
-  uint32_t m_syncobj_hdl;
 
   // Protecting below mutables
   mutable std::mutex m_lock;
+  // Replaced only when a recycled syncobj may have to be shared
+  mutable std::shared_ptr<syncobj> m_syncobj;
   // Set once at first signal
   mutable bool m_signaled = false;
-  static constexpr uint64_t initial_state = 0;
+  // Timepoint before the first wait/signal
+  mutable uint64_t m_initial_state;
   // Ever incrementing at each wait/signal
-  mutable uint64_t m_state = initial_state;
+  mutable uint64_t m_state;
 };
 
 }
@@ -5,8 +5,10 @@
 #include "../kmq/pcidev.h"
 #include "../umq/pcidev.h"
 #include "platform_host.h"
+#include "platform_host_uring.h"
 #include "pcidrv_amdxdna.h"
 #include "core/pcie/linux/system_linux.h"
+#include "core/common/config_reader.h"
 #include <fstream>
 
 namespace {
@@ -68,8 +70,12 @@ drv_amdxdna::
 create_pcidev(const std::string& sysfs) const
 {
   auto driver = std::dynamic_pointer_cast<const drv>(shared_from_this());
-  auto platform_driver = std::dynamic_pointer_cast<const platform_drv>(
-    std::make_shared<const platform_drv_host>(driver));
+  static bool use_uring = xrt_core::config::detail::get_bool_value("Runtime.io_uring", false);
+  std::shared_ptr<const platform_drv> platform_driver;
+  if (use_uring)
+    platform_driver = std::make_shared<const platform_drv_host_uring>(driver);
+  else
+    platform_driver = std::make_shared<const platform_drv_host>(driver);
   auto device_type = get_dev_type(sysfs);
 
   if (device_type == AMDXDNA_DEV_TYPE_KMQ)
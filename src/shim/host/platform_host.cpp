@@ -3,11 +3,16 @@
 
 #include "../shim_debug.h"
 #include "platform_host.h"
-#include "core/common/trace.h"
+#include "../trace_recorder.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <fcntl.h>
+#include <poll.h>
 #include <drm/drm.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace {
 
@@ -31,12 +36,16 @@ ioctl_cmd2name(unsigned long cmd)
     return "DRM_IOCTL_AMDXDNA_EXEC_CMD";
   case DRM_IOCTL_AMDXDNA_WAIT_CMD:
     return "DRM_IOCTL_AMDXDNA_WAIT_CMD";
+  case DRM_IOCTL_AMDXDNA_WAIT_CMDS:
+    return "DRM_IOCTL_AMDXDNA_WAIT_CMDS";
   case DRM_IOCTL_AMDXDNA_GET_INFO:
     return "DRM_IOCTL_AMDXDNA_GET_INFO";
   case DRM_IOCTL_AMDXDNA_GET_ARRAY:
     return "DRM_IOCTL_AMDXDNA_GET_ARRAY";
   case DRM_IOCTL_AMDXDNA_SET_STATE:
     return "DRM_IOCTL_AMDXDNA_SET_STATE";
+  case DRM_IOCTL_AMDXDNA_MEM_NOTIFY:
+    return "DRM_IOCTL_AMDXDNA_MEM_NOTIFY";
 
   case DRM_IOCTL_GEM_CLOSE:
     return "DRM_IOCTL_GEM_CLOSE";
@@ -71,7 +80,7 @@ page_roundup(size_t size)
 void
 ioctl(int dev_fd, unsigned long cmd, void* arg)
 {
-  XRT_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
+  SHIM_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
   if (::ioctl(dev_fd, cmd, arg) == -1)
     shim_err(-errno, "%s IOCTL failed", ioctl_cmd2name(cmd).c_str());
 }
@@ -91,6 +100,29 @@ wait_syncobj_available(int dev_fd, uint32_t sobj_hdl, uint64_t timepoint)
   ioctl(dev_fd, DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
 }
 
+bool
+is_syncobj_available(int dev_fd, uint32_t sobj_hdl, uint64_t timepoint)
+{
+  drm_syncobj_timeline_wait wsobj = {
+    .handles = reinterpret_cast<uintptr_t>(&sobj_hdl),
+    .points = reinterpret_cast<uintptr_t>(&timepoint),
+    .timeout_nsec = 0, /* do not wait */
+    .count_handles = 1,
+    .flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT |
+             DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+  };
+
+  try {
+    ioctl(dev_fd, DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
+  }
+  catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+    return false;
+  }
+  return true;
+}
+
 void *
 to_ptr(uint64_t drv_ptr)
 {
@@ -111,8 +143,23 @@ create_ctx(create_ctx_arg& ctx_arg) const
   arg.max_opc = ctx_arg.max_opc;
   arg.num_tiles = ctx_arg.num_tiles;
   arg.log_buf_bo = ctx_arg.log_buf_bo.handle;
+  arg.queue_depth = ctx_arg.queue_depth;
+  arg.flags = ctx_arg.flags;
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_CREATE_HWCTX, &arg);
-  
+
+  // Cmds of context are held back by driver until context is ready, there
+  // is nothing shim needs to wait for. Driver without async create leaves
+  // handle as 0 and has waited itself.
+  if (arg.ready_syncobj != AMDXDNA_INVALID_FENCE_HANDLE) {
+    create_destroy_syncobj_arg sarg = {
+      .handle = arg.ready_syncobj,
+    };
+    destroy_syncobj(sarg);
+  }
+
+  if (arg.out_flags & AMDXDNA_CTX_OUT_QOS_DEGRADED)
+    shim_info("Context %d is over device QoS capacity, QoS is not guaranteed", arg.handle);
+
   ctx_arg.ctx_handle = arg.handle;
   ctx_arg.umq_doorbell = arg.umq_doorbell;
   ctx_arg.syncobj_handle = arg.syncobj_handle;
@@ -158,36 +205,67 @@ config_ctx_debug_bo(config_ctx_debug_bo_arg& ctx_arg) const
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &arg);
 }
 
-std::pair<uint64_t, uint64_t>
+void
+platform_drv_host::
+config_ctx_build_cmdlist(config_ctx_build_cmdlist_arg& ctx_arg) const
+{
+  amdxdna_drm_build_cmdlist barg = {};
+  barg.cmd_handle = ctx_arg.cmd_bo.handle;
+  barg.list_handle = ctx_arg.list_bo.handle;
+  barg.offsets = reinterpret_cast<uintptr_t>(ctx_arg.offsets.data());
+  barg.count = ctx_arg.offsets.size();
+
+  amdxdna_drm_config_hwctx arg = {};
+  arg.handle = ctx_arg.ctx_handle;
+  arg.param_type = DRM_AMDXDNA_HWCTX_BUILD_CMDLIST;
+  arg.param_val = reinterpret_cast<uintptr_t>(&barg);
+  arg.param_val_size = sizeof(barg);
+  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &arg);
+}
+
+void
+platform_drv_host::
+config_ctx_resident_bo(config_ctx_resident_bo_arg& ctx_arg) const
+{
+  amdxdna_drm_config_hwctx arg = {};
+  arg.handle = ctx_arg.ctx_handle;
+  arg.param_type = ctx_arg.is_remove ?
+    DRM_AMDXDNA_HWCTX_REMOVE_RESIDENT_BO : DRM_AMDXDNA_HWCTX_ADD_RESIDENT_BO;
+  arg.param_val = ctx_arg.bo_handle;
+  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &arg);
+}
+
+void
 platform_drv_host::
-get_bo_info(uint32_t boh) const
+get_bo_info(uint32_t boh, bo_info& info) const
 {
   amdxdna_drm_get_bo_info iarg = {};
   iarg.handle = boh;
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_GET_BO_INFO, &iarg);
-  return {iarg.xdna_addr, iarg.map_offset};
+  info.bo.handle = boh;
+  info.xdna_addr = iarg.xdna_addr;
+  info.map_offset = iarg.map_offset;
+  info.nr_segs = iarg.nr_segs;
 }
 
-std::tuple<uint32_t, uint64_t, uint64_t>
+void
 platform_drv_host::
-create_drm_bo(void *uva_tbl, size_t size, int type) const
+create_drm_bo(void *uva_tbl, size_t size, int type, uint64_t flags, bo_info& info) const
 {
-  uint64_t xdna_addr, map_offset;
-
   amdxdna_drm_create_bo carg = {};
   carg.vaddr = reinterpret_cast<uintptr_t>(uva_tbl);
   carg.size = size;
   carg.type = type;
+  carg.flags = flags;
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_CREATE_BO, &carg);
 
   try {
-    std::tie(xdna_addr, map_offset) = get_bo_info(carg.handle);
+    get_bo_info(carg.handle, info);
   } catch (...) {
     destroy_bo_arg darg = { carg.handle };
     destroy_bo(darg);
     throw;
   }
-  return { carg.handle, xdna_addr, map_offset };
 }
 
 void
@@ -195,8 +273,7 @@ platform_drv_host::
 create_bo(bo_info& bo_arg) const
 {
   bo_arg.bo.res_id = AMDXDNA_INVALID_BO_HANDLE;
-  std::tie(bo_arg.bo.handle, bo_arg.xdna_addr, bo_arg.map_offset) =
-    create_drm_bo(nullptr, bo_arg.size, bo_arg.type);
+  create_drm_bo(nullptr, bo_arg.size, bo_arg.type, bo_arg.flags, bo_arg);
   save_bo_info(bo_arg.bo.handle, bo_arg);
 }
 
@@ -213,8 +290,28 @@ create_uptr_bo(bo_info& bo_arg) const
   tbl->va_entries[0].len = page_roundup(bo_arg.size);
 
   bo_arg.bo.res_id = AMDXDNA_INVALID_BO_HANDLE;
-  std::tie(bo_arg.bo.handle, bo_arg.xdna_addr, bo_arg.map_offset) =
-    create_drm_bo(buf, 0, AMDXDNA_BO_SHARE);
+
+  // Device accessing user memory through PASID needs no pinning or mapping
+  // of it by driver, try that first.
+  static std::atomic<bool> sva_unsupported = false;
+  if (!sva_unsupported) {
+    try {
+      create_drm_bo(buf, 0, AMDXDNA_BO_SHARE, AMDXDNA_BO_FLAG_SVA, bo_arg);
+      save_bo_info(bo_arg.bo.handle, bo_arg);
+      return;
+    }
+    catch (const xrt_core::system_error& ex) {
+      auto err = ex.get_code();
+      // Older driver rejects unknown flag with EINVAL. EPERM is for a device
+      // opened by another process, e.g. parent, only.
+      if (err != EOPNOTSUPP && err != EINVAL && err != EPERM)
+        throw;
+      if (err != EPERM && !sva_unsupported.exchange(true))
+        shim_debug("SVA user pointer BO not supported, pinning user memory");
+    }
+  }
+
+  create_drm_bo(buf, 0, AMDXDNA_BO_SHARE, 0, bo_arg);
   save_bo_info(bo_arg.bo.handle, bo_arg);
 }
 
@@ -225,6 +322,7 @@ destroy_bo(destroy_bo_arg& bo_arg) const
   if (!delete_bo_info(bo_arg.bo.handle))
     return;
 
+  forget_imported_bo(bo_arg.bo.handle);
   drm_gem_close arg = {};
   arg.handle = bo_arg.bo.handle;
   ioctl(dev_fd(), DRM_IOCTL_GEM_CLOSE, &arg);
@@ -243,6 +341,47 @@ sync_bo(sync_bo_arg& bo_arg) const
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_SYNC_BO, &arg);
 }
 
+void
+platform_drv_host::
+sync_bos(sync_bos_arg& bos_arg) const
+{
+  // Driver without DRM_AMDXDNA_SYNC_BOS fails it with EINVAL
+  static std::atomic<bool> unsupported = false;
+
+  if (!unsupported) {
+    try {
+      for (size_t i = 0; i < bos_arg.bos.size(); i += AMDXDNA_SYNC_BOS_MAX) {
+        auto cnt = std::min<size_t>(bos_arg.bos.size() - i, AMDXDNA_SYNC_BOS_MAX);
+        std::vector<amdxdna_drm_sync_bo> bos(cnt);
+        for (size_t j = 0; j < cnt; j++) {
+          auto& bo = bos_arg.bos[i + j];
+          bos[j].handle = bo.bo.handle;
+          bos[j].direction = bo.direction == xrt_core::buffer_handle::direction::host2device ?
+            SYNC_DIRECT_TO_DEVICE : SYNC_DIRECT_FROM_DEVICE;
+          bos[j].offset = bo.offset;
+          bos[j].size = bo.size;
+        }
+        amdxdna_drm_sync_bos arg = {
+          .bos = reinterpret_cast<uintptr_t>(bos.data()),
+          .count = static_cast<uint32_t>(cnt),
+        };
+        ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_SYNC_BOS, &arg);
+      }
+      return;
+    }
+    catch (const xrt_core::system_error& ex) {
+      if (ex.get_code() != EINVAL)
+        throw;
+    }
+  }
+
+  // Syncing again what is already synced is harmless. If one by one works,
+  // it was the ioctl that is not supported, not its arguments.
+  platform_drv::sync_bos(bos_arg);
+  if (!unsupported.exchange(true))
+    shim_debug("Driver can't sync BOs at once, syncing one by one");
+}
+
 void
 platform_drv_host::
 export_bo(export_bo_arg& bo_arg) const
@@ -255,61 +394,209 @@ export_bo(export_bo_arg& bo_arg) const
   bo_arg.fd = arg.fd;
 }
 
+bool
+platform_drv_host::
+import_drm_bo(int fd, bo_info& info) const
+{
+  amdxdna_drm_get_bo_info iarg = {};
+  bool described = false;
+
+  if (m_import_describe) {
+    iarg.ext_flags = AMDXDNA_BO_INFO_FROM_FD;
+    iarg.handle = fd;
+    try {
+      ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_GET_BO_INFO, &iarg);
+      described = true;
+    } catch (const xrt_core::system_error& ex) {
+      // Could be an older driver or a bad fd, the latter fails below again.
+      if (ex.get_code() != EINVAL)
+        throw;
+    }
+  }
+
+  if (!described) {
+    drm_prime_handle carg = {};
+    carg.handle = AMDXDNA_INVALID_BO_HANDLE;
+    carg.flags = 0;
+    carg.fd = fd;
+    ioctl(dev_fd(), DRM_IOCTL_PRIME_FD_TO_HANDLE, &carg);
+    // Good fd, driver does not support import and describe in one go.
+    m_import_describe = false;
+
+    // Found existing BO, no need to describe it.
+    if (load_bo_info(carg.handle, info))
+      return true;
+
+    iarg = {};
+    iarg.handle = carg.handle;
+    ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_GET_BO_INFO, &iarg);
+  } else if (load_bo_info(iarg.handle, info)) {
+    return true;
+  }
+
+  info.bo.handle = iarg.handle;
+  info.xdna_addr = iarg.xdna_addr;
+  info.vaddr = to_ptr(iarg.vaddr);
+  info.map_offset = iarg.map_offset;
+  info.nr_segs = iarg.nr_segs;
+  return false;
+}
+
+void
+platform_drv_host::
+forget_imported_bo(uint32_t boh) const
+{
+  std::lock_guard<std::mutex> lg(m_import_lock);
+  auto it = m_import_keys.find(boh);
+  if (it == m_import_keys.end())
+    return;
+  m_import_cache.erase(it->second);
+  m_import_keys.erase(it);
+}
+
 void
 platform_drv_host::
 import_bo(import_bo_arg& bo_arg) const
 {
-  drm_prime_handle carg = {};
-  carg.handle = AMDXDNA_INVALID_BO_HANDLE;
-  carg.flags = 0;
-  carg.fd = bo_arg.fd;
-  ioctl(dev_fd(), DRM_IOCTL_PRIME_FD_TO_HANDLE, &carg);
+  // One fstat gives both cache key and size of the dma-buf.
+  struct stat st = {};
+  if (fstat(bo_arg.fd, &st) == -1)
+    shim_err(-errno, "Failed to stat dma-buf fd %d", bo_arg.fd);
+  import_key key = { st.st_dev, st.st_ino };
+
+  {
+    std::lock_guard<std::mutex> lg(m_import_lock);
+    auto it = m_import_cache.find(key);
+    if (it != m_import_cache.end() && load_bo_info(it->second, bo_arg.boinfo))
+      return;
+  }
 
   // Found existing BO, just use the saved info.
-  if (load_bo_info(carg.handle, bo_arg.boinfo))
-    return;
+  if (!import_drm_bo(bo_arg.fd, bo_arg.boinfo)) {
+    bo_arg.boinfo.bo.res_id = AMDXDNA_INVALID_BO_HANDLE;
+    bo_arg.boinfo.type = AMDXDNA_BO_SHARE;
+    bo_arg.boinfo.size = st.st_size;
+    if (!bo_arg.boinfo.size) {
+      // Kernel not reporting dma-buf size through its inode
+      bo_arg.boinfo.size = lseek(bo_arg.fd, 0, SEEK_END);
+      lseek(bo_arg.fd, 0, SEEK_SET);
+    }
+    save_bo_info(bo_arg.boinfo.bo.handle, bo_arg.boinfo);
+  }
 
-  amdxdna_drm_get_bo_info iarg = {};
-  iarg.handle = carg.handle;
-  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_GET_BO_INFO, &iarg);
-  bo_arg.boinfo.bo.handle = carg.handle;
-  bo_arg.boinfo.bo.res_id = AMDXDNA_INVALID_BO_HANDLE;
-  bo_arg.boinfo.xdna_addr = iarg.xdna_addr;
-  bo_arg.boinfo.vaddr = to_ptr(iarg.vaddr);
-  bo_arg.boinfo.map_offset = iarg.map_offset;
-  bo_arg.boinfo.type = AMDXDNA_BO_SHARE;
-  bo_arg.boinfo.size = lseek(bo_arg.fd, 0, SEEK_END);
-  lseek(bo_arg.fd, 0, SEEK_SET);
+  auto boh = bo_arg.boinfo.bo.handle;
 
-  save_bo_info(carg.handle, bo_arg.boinfo);
+  std::lock_guard<std::mutex> lg(m_import_lock);
+  m_import_cache[key] = boh;
+  m_import_keys[boh] = key;
 }
 
 void
 platform_drv_host::
-submit_cmd(submit_cmd_arg& cmd_arg) const
+exec_ioctl(amdxdna_drm_exec_cmd& arg) const
 {
-  // Assuming 512 max args per cmd bo
-  const size_t max_args = 512;
-  const auto nargs = cmd_arg.arg_bos.size();
-  if (nargs > max_args)
-    shim_err(EINVAL, "Max arg %ld, received %ld", max_args, nargs);
-
-  uint32_t arg_bo_hdls[max_args] = {};
-  int i = 0;
-  for (auto& id : cmd_arg.arg_bos)
-    arg_bo_hdls[i++] = id.handle;
+  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_EXEC_CMD, &arg);
+}
 
+void
+platform_drv_host::
+submit_cmd(submit_cmd_arg& cmd_arg) const
+{
   amdxdna_drm_exec_cmd arg = {};
   arg.hwctx = cmd_arg.ctx_handle;
   arg.type = AMDXDNA_CMD_SUBMIT_EXEC_BUF;
   arg.cmd_handles = cmd_arg.cmd_bo.handle;
-  arg.args = reinterpret_cast<uintptr_t>(arg_bo_hdls);
+  arg.args = reinterpret_cast<uintptr_t>(cmd_arg.arg_bo_hdls.data());
   arg.cmd_count = 1;
-  arg.arg_count = nargs;
-  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_EXEC_CMD, &arg);
+  arg.arg_count = cmd_arg.arg_bo_hdls.size();
+  exec_ioctl(arg);
+  cmd_arg.seq = arg.seq;
+}
+
+void
+platform_drv_host::
+submit_cmds(submit_cmds_arg& cmd_arg) const
+{
+  std::vector<uint32_t> cmd_bo_hdls;
+  for (auto& id : cmd_arg.cmd_bos)
+    cmd_bo_hdls.push_back(id.handle);
+
+  amdxdna_drm_exec_cmd arg = {};
+  arg.hwctx = cmd_arg.ctx_handle;
+  arg.type = AMDXDNA_CMD_SUBMIT_EXEC_BUF;
+  arg.cmd_handles = reinterpret_cast<uintptr_t>(cmd_bo_hdls.data());
+  arg.args = reinterpret_cast<uintptr_t>(cmd_arg.arg_bo_hdls.data());
+  arg.cmd_count = cmd_bo_hdls.size();
+  arg.arg_count = cmd_arg.arg_bo_hdls.size();
+  cmd_arg.submitted = 0;
+  try {
+    exec_ioctl(arg);
+  }
+  catch (const xrt_core::system_error&) {
+    // Driver updates cmd_count to what has been submitted before failing.
+    // Unchanged cmd_count means nothing is submitted, e.g. old driver.
+    if (arg.cmd_count < cmd_bo_hdls.size()) {
+      cmd_arg.submitted = arg.cmd_count;
+      cmd_arg.seq = arg.seq;
+    }
+    throw;
+  }
+  cmd_arg.submitted = arg.cmd_count;
   cmd_arg.seq = arg.seq;
 }
 
+void
+platform_drv_host::
+submit_dependency(submit_fence_arg& fence_arg) const
+{
+  // Driver can only depend on a fence which is already submitted. Waiting
+  // for the submission has to be done by caller.
+  if (!is_syncobj_available(dev_fd(), fence_arg.syncobj_handle, fence_arg.timepoint))
+    shim_err(EAGAIN, "Fence %d@%ld is not submitted yet",
+      fence_arg.syncobj_handle, fence_arg.timepoint);
+
+  amdxdna_drm_exec_cmd arg = {};
+  arg.hwctx = fence_arg.ctx_handle;
+  arg.type = AMDXDNA_CMD_SUBMIT_DEPENDENCY;
+  arg.cmd_handles = reinterpret_cast<uintptr_t>(&fence_arg.syncobj_handle);
+  arg.args = reinterpret_cast<uintptr_t>(&fence_arg.timepoint);
+  arg.cmd_count = 1;
+  arg.arg_count = 1;
+  exec_ioctl(arg);
+  fence_arg.seq = arg.seq;
+}
+
+void
+platform_drv_host::
+submit_signal(submit_fence_arg& fence_arg) const
+{
+  amdxdna_drm_exec_cmd arg = {};
+  arg.hwctx = fence_arg.ctx_handle;
+  arg.type = AMDXDNA_CMD_SUBMIT_SIGNAL;
+  arg.cmd_handles = fence_arg.syncobj_handle;
+  arg.args = fence_arg.timepoint;
+  arg.cmd_count = 1;
+  arg.arg_count = 1;
+  exec_ioctl(arg);
+}
+
+void
+platform_drv_host::
+submit_ctx_dependency(submit_ctx_dep_arg& dep_arg) const
+{
+  std::vector<amdxdna_drm_wait_cmd> cmds;
+  for (auto& c : dep_arg.cmds)
+    cmds.push_back({ .hwctx = c.first, .timeout = 0, .seq = c.second });
+
+  amdxdna_drm_exec_cmd arg = {};
+  arg.hwctx = dep_arg.ctx_handle;
+  arg.type = AMDXDNA_CMD_SUBMIT_CTX_DEPENDENCY;
+  arg.cmd_handles = reinterpret_cast<uintptr_t>(cmds.data());
+  arg.cmd_count = static_cast<uint32_t>(cmds.size());
+  exec_ioctl(arg);
+  dep_arg.seq = arg.seq;
+}
+
 void
 platform_drv_host::
 wait_cmd_ioctl(wait_cmd_arg& cmd_arg) const
@@ -334,6 +621,46 @@ wait_cmd_syncobj(wait_cmd_arg& cmd_arg) const
   wait_syncobj(wcmd);
 }
 
+void
+platform_drv_host::
+wait_cmds(wait_cmds_arg& cmds_arg) const
+{
+  auto cnt = cmds_arg.ctx_handles.size();
+  if (cnt != cmds_arg.seqs.size())
+    shim_err(EINVAL, "Ctx handles and seqs mismatch: %ld, %ld", cnt, cmds_arg.seqs.size());
+  if (!cnt || cnt > AMDXDNA_WAIT_CMDS_MAX)
+    shim_err(EINVAL, "Invalid number of cmds to wait: %ld", cnt);
+
+  std::vector<amdxdna_drm_wait_cmd> wcmds(cnt);
+  for (size_t i = 0; i < cnt; i++) {
+    wcmds[i].hwctx = cmds_arg.ctx_handles[i];
+    wcmds[i].seq = cmds_arg.seqs[i];
+  }
+  std::vector<uint64_t> bitmap((cnt + 63) / 64, 0);
+  amdxdna_drm_wait_cmds arg = {
+    .cmds = reinterpret_cast<uintptr_t>(wcmds.data()),
+    .completed = reinterpret_cast<uintptr_t>(bitmap.data()),
+    .count = static_cast<uint32_t>(cnt),
+    .flags = cmds_arg.wait_all ? AMDXDNA_WAIT_CMDS_ALL : 0u,
+    .timeout = cmds_arg.timeout_ms,
+  };
+
+  auto fill_completed = [&] {
+    cmds_arg.completed.resize(cnt);
+    for (size_t i = 0; i < cnt; i++)
+      cmds_arg.completed[i] = bitmap[i / 64] & (1ul << (i % 64));
+  };
+  try {
+    ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_WAIT_CMDS, &arg);
+  }
+  catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() == ETIME)
+      fill_completed();
+    throw;
+  }
+  fill_completed();
+}
+
 void
 platform_drv_host::
 get_info(amdxdna_drm_get_info& info) const
@@ -355,6 +682,54 @@ set_state(amdxdna_drm_set_state& state) const
   ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_SET_STATE, &state);
 }
 
+void
+platform_drv_host::
+wait_mem_pressure(wait_mem_pressure_arg& arg) const
+{
+  amdxdna_drm_mem_notify notify = {
+    .heap_threshold = arg.heap_threshold,
+    .bo_threshold = arg.bo_threshold,
+  };
+  ioctl(dev_fd(), DRM_IOCTL_AMDXDNA_MEM_NOTIFY, &notify);
+
+  // Driver sends no other DRM event, whatever is read from fd is ours.
+  arg.reasons = 0;
+  while (!arg.reasons) {
+    pollfd fds[] = { { dev_fd(), POLLIN, 0 }, { arg.cancel_fd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      shim_err(-errno, "Failed to poll for memory pressure event");
+    }
+    if (fds[1].revents)
+      return;
+    if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+      shim_err(EIO, "Device fd failed while waiting for memory pressure event");
+
+    alignas(8) char buf[256];
+    auto len = read(dev_fd(), buf, sizeof(buf));
+    if (len == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      shim_err(-errno, "Failed to read memory pressure event");
+    }
+    for (ssize_t off = 0; off + static_cast<ssize_t>(sizeof(drm_event)) <= len;) {
+      drm_event e;
+      std::memcpy(&e, buf + off, sizeof(e));
+      if (e.type == AMDXDNA_EVENT_MEM_PRESSURE && e.length >= sizeof(amdxdna_drm_mem_event)) {
+        amdxdna_drm_mem_event me;
+        std::memcpy(&me, buf + off, sizeof(me));
+        arg.reasons |= me.reasons;
+        arg.heap_usage = me.heap_usage;
+        arg.bo_usage = me.bo_usage;
+      }
+      if (!e.length)
+        break;
+      off += e.length;
+    }
+  }
+}
+
 void
 platform_drv_host::
 get_sysfs(get_sysfs_arg& arg) const
@@ -5,6 +5,10 @@
 #define PLAT_HOST_H
 
 #include "../platform.h"
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
 
 namespace shim_xdna {
 
@@ -13,6 +17,11 @@ class platform_drv_host : public platform_drv
 public:
   using platform_drv::platform_drv;
 
+protected:
+  // All DRM_IOCTL_AMDXDNA_EXEC_CMD go through here.
+  virtual void
+  exec_ioctl(amdxdna_drm_exec_cmd& arg) const;
+
 private:
   void
   create_ctx(create_ctx_arg& arg) const override;
@@ -26,6 +35,12 @@ private:
   void
   config_ctx_debug_bo(config_ctx_debug_bo_arg& arg) const override;
 
+  void
+  config_ctx_build_cmdlist(config_ctx_build_cmdlist_arg& arg) const override;
+
+  void
+  config_ctx_resident_bo(config_ctx_resident_bo_arg& arg) const override;
+
   void
   create_bo(bo_info& arg) const override;
 
@@ -38,6 +53,9 @@ private:
   void
   sync_bo(sync_bo_arg& arg) const override;
 
+  void
+  sync_bos(sync_bos_arg& arg) const override;
+
   void
   export_bo(export_bo_arg& arg) const override;
 
@@ -47,12 +65,27 @@ private:
   void
   submit_cmd(submit_cmd_arg& arg) const override;
 
+  void
+  submit_cmds(submit_cmds_arg& arg) const override;
+
+  void
+  submit_dependency(submit_fence_arg& arg) const override;
+
+  void
+  submit_signal(submit_fence_arg& arg) const override;
+
+  void
+  submit_ctx_dependency(submit_ctx_dep_arg& arg) const override;
+
   void
   wait_cmd_ioctl(wait_cmd_arg& arg) const override;
 
   void
   wait_cmd_syncobj(wait_cmd_arg& arg) const override;
 
+  void
+  wait_cmds(wait_cmds_arg& arg) const override;
+
   void
   get_info(amdxdna_drm_get_info& arg) const override;
 
@@ -62,17 +95,40 @@ private:
   void
   set_state(amdxdna_drm_set_state& arg) const override;
 
-  std::pair<uint64_t, uint64_t>
-  get_bo_info(uint32_t boh) const;
+  void
+  wait_mem_pressure(wait_mem_pressure_arg& arg) const override;
+
+  // Fill in BO handle, device address, mmap offset and DMA segment count.
+  void
+  get_bo_info(uint32_t boh, bo_info& info) const;
 
-  std::tuple<uint32_t, uint64_t, uint64_t>
-  create_drm_bo(void *uva_tbl, size_t size, int type) const;
+  void
+  create_drm_bo(void *uva_tbl, size_t size, int type, uint64_t flags, bo_info& info) const;
 
   void
   get_sysfs(get_sysfs_arg& arg) const override;
 
   void
   put_sysfs(put_sysfs_arg& arg) const override;
+
+  // Imports dma-buf fd. Returns true if the BO is known to this process and
+  // info is loaded from the saved one. Otherwise, only the handle and
+  // addresses in info are filled in from driver.
+  bool
+  import_drm_bo(int fd, bo_info& info) const;
+
+  void
+  forget_imported_bo(uint32_t boh) const;
+
+  // Handles of imported dma-bufs keyed by the dma-buf's (st_dev, st_ino), so
+  // that importing the same buffer again needs no ioctl at all. Dma-buf inode
+  // numbers are never reused, entry is dropped when GEM handle is closed.
+  using import_key = std::pair<dev_t, ino_t>;
+  mutable std::mutex m_import_lock;
+  mutable std::map<import_key, uint32_t> m_import_cache;
+  mutable std::unordered_map<uint32_t, import_key> m_import_keys;
+  // Cleared if driver does not support AMDXDNA_BO_INFO_FROM_FD
+  mutable std::atomic<bool> m_import_describe = true;
 };
 
 }
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "../shim_debug.h"
+#include "platform_host_uring.h"
+#include "../trace_recorder.h"
+#include "core/common/config_reader.h"
+#include <atomic>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+bool
+is_sqpoll()
+{
+  static bool sqpoll =
+    xrt_core::config::detail::get_bool_value("Runtime.io_uring_sqpoll", false);
+  return sqpoll;
+}
+
+void *
+map_ring(int ring_fd, size_t size, off_t offset)
+{
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  if (p == MAP_FAILED)
+    shim_err(-errno, "Failed to map io_uring at 0x%lx", offset);
+  return p;
+}
+
+template <typename T>
+T *
+ring_ptr(void *ring, uint32_t off)
+{
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + off);
+}
+
+// Number of cmd polls on CQ with SQPOLL before going into kernel to wait
+const int cq_spin_cnt = 1024;
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+}
+
+namespace shim_xdna {
+
+uring::
+uring(int dev_fd, unsigned entries, bool sqpoll)
+  : m_dev_fd(dev_fd)
+  , m_sqpoll(sqpoll)
+{
+  io_uring_params p = {};
+  if (sqpoll)
+    p.flags = IORING_SETUP_SQPOLL;
+  m_ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+  if (m_ring_fd < 0)
+    shim_err(-errno, "io_uring setup failed");
+
+  try {
+    m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_sq_ring = map_ring(m_ring_fd, m_sq_ring_size, IORING_OFF_SQ_RING);
+    m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    m_cq_ring = map_ring(m_ring_fd, m_cq_ring_size, IORING_OFF_CQ_RING);
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe *>(map_ring(m_ring_fd, m_sqes_size, IORING_OFF_SQES));
+  }
+  catch (...) {
+    unmap();
+    throw;
+  }
+
+  m_sq_tail = ring_ptr<unsigned>(m_sq_ring, p.sq_off.tail);
+  m_sq_mask = ring_ptr<unsigned>(m_sq_ring, p.sq_off.ring_mask);
+  m_sq_flags = ring_ptr<unsigned>(m_sq_ring, p.sq_off.flags);
+  m_sq_array = ring_ptr<unsigned>(m_sq_ring, p.sq_off.array);
+  m_cq_head = ring_ptr<unsigned>(m_cq_ring, p.cq_off.head);
+  m_cq_tail = ring_ptr<unsigned>(m_cq_ring, p.cq_off.tail);
+  m_cq_mask = ring_ptr<unsigned>(m_cq_ring, p.cq_off.ring_mask);
+  m_cqes = ring_ptr<io_uring_cqe>(m_cq_ring, p.cq_off.cqes);
+  shim_debug("io_uring created, %d entries%s", p.sq_entries, sqpoll ? ", SQPOLL" : "");
+}
+
+uring::
+~uring()
+{
+  unmap();
+}
+
+void
+uring::
+unmap()
+{
+  if (m_sqes)
+    munmap(m_sqes, m_sqes_size);
+  if (m_cq_ring)
+    munmap(m_cq_ring, m_cq_ring_size);
+  if (m_sq_ring)
+    munmap(m_sq_ring, m_sq_ring_size);
+  if (m_ring_fd >= 0)
+    close(m_ring_fd);
+  m_sqes = nullptr;
+  m_cq_ring = m_sq_ring = nullptr;
+  m_ring_fd = -1;
+}
+
+int
+uring::
+enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  auto ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, nullptr, 0);
+  if (ret < 0 && errno != EINTR)
+    shim_err(-errno, "io_uring enter failed");
+  return static_cast<int>(ret);
+}
+
+int
+uring::
+run(unsigned long cmd, void *arg)
+{
+  SHIM_TRACE_POINT_SCOPE2(uring_cmd, cmd, arg);
+  const std::lock_guard<std::mutex> lock(m_lock);
+
+  // Only one SQE is ever in flight, whatever slot tail points to is free.
+  auto tail = __atomic_load_n(m_sq_tail, __ATOMIC_RELAXED);
+  auto idx = tail & *m_sq_mask;
+  auto sqe = &m_sqes[idx];
+  *sqe = {};
+  sqe->opcode = IORING_OP_URING_CMD;
+  sqe->fd = m_dev_fd;
+  sqe->cmd_op = static_cast<uint32_t>(cmd);
+  auto ucmd = reinterpret_cast<amdxdna_uring_cmd *>(sqe->cmd);
+  ucmd->arg = reinterpret_cast<uintptr_t>(arg);
+  m_sq_array[idx] = idx;
+  __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  auto cq_ready = [this] {
+    return __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) != *m_cq_head;
+  };
+  if (m_sqpoll) {
+    // Kernel thread goes to sleep after being idle for a while
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(m_sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+      enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+    for (int i = 0; i < cq_spin_cnt && !cq_ready(); i++)
+      cpu_relax();
+    while (!cq_ready())
+      enter(0, 1, IORING_ENTER_GETEVENTS);
+  } else {
+    while (enter(1, 1, IORING_ENTER_GETEVENTS) < 0)
+      ;
+    while (!cq_ready())
+      enter(0, 1, IORING_ENTER_GETEVENTS);
+  }
+
+  auto head = *m_cq_head;
+  auto res = m_cqes[head & *m_cq_mask].res;
+  __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+  return res;
+}
+
+void
+platform_drv_host_uring::
+drv_close() const
+{
+  {
+    const std::lock_guard<std::mutex> lock(m_uring_lock);
+    m_uring.reset();
+  }
+  platform_drv_host::drv_close();
+}
+
+uring *
+platform_drv_host_uring::
+get_uring() const
+{
+  if (m_uring_failed)
+    return nullptr;
+
+  const std::lock_guard<std::mutex> lock(m_uring_lock);
+  if (!m_uring) {
+    try {
+      m_uring = std::make_unique<uring>(dev_fd(), 8, is_sqpoll());
+    }
+    catch (const xrt_core::system_error& ex) {
+      // E.g., io_uring disabled by kernel.io_uring_disabled
+      shim_debug("Falling back to ioctl: %s", ex.what());
+      m_uring_failed = true;
+      return nullptr;
+    }
+  }
+  return m_uring.get();
+}
+
+void
+platform_drv_host_uring::
+exec_ioctl(amdxdna_drm_exec_cmd& arg) const
+{
+  auto ring = get_uring();
+  if (!ring) {
+    platform_drv_host::exec_ioctl(arg);
+    return;
+  }
+
+  auto ret = ring->run(DRM_IOCTL_AMDXDNA_EXEC_CMD, &arg);
+  // Driver or kernel has no io_uring passthrough, nothing is submitted.
+  if (ret == -EOPNOTSUPP) {
+    shim_debug("Driver has no io_uring cmd support, falling back to ioctl");
+    m_uring_failed = true;
+    platform_drv_host::exec_ioctl(arg);
+    return;
+  }
+  if (ret < 0)
+    shim_err(ret, "DRM_IOCTL_AMDXDNA_EXEC_CMD io_uring cmd failed");
+}
+
+}
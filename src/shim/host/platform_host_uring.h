@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef PLAT_HOST_URING_H
+#define PLAT_HOST_URING_H
+
+#include "platform_host.h"
+#include <memory>
+#include <mutex>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace shim_xdna {
+
+// Minimal io_uring, only for IORING_OP_URING_CMD on the accel fd, so that no
+// liburing is needed. With SQPOLL, a kernel thread picks SQEs up and
+// submitting takes no syscall at all.
+class uring
+{
+public:
+  uring(int dev_fd, unsigned entries, bool sqpoll);
+  ~uring();
+
+  // Run DRM ioctl cmd with arg as uring cmd, returns CQE res.
+  int
+  run(unsigned long cmd, void *arg);
+
+private:
+  void
+  unmap();
+
+  int
+  enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+  const int m_dev_fd;
+  const bool m_sqpoll;
+  int m_ring_fd = -1;
+  void *m_sq_ring = nullptr;
+  size_t m_sq_ring_size = 0;
+  void *m_cq_ring = nullptr;
+  size_t m_cq_ring_size = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqes_size = 0;
+
+  unsigned *m_sq_tail;
+  unsigned *m_sq_mask;
+  unsigned *m_sq_flags;
+  unsigned *m_sq_array;
+  unsigned *m_cq_head;
+  unsigned *m_cq_tail;
+  unsigned *m_cq_mask;
+  io_uring_cqe *m_cqes;
+
+  // One cmd in flight at a time, so that CQE seen is always ours
+  std::mutex m_lock;
+};
+
+// Host driver access with cmd submission done through io_uring on the
+// accel fd, enabled by Runtime.io_uring. Waits stay as ioctl, they would
+// otherwise hold the ring up for submissions from other threads. Falls back
+// to ioctl if kernel or driver can't do io_uring passthrough.
+class platform_drv_host_uring : public platform_drv_host
+{
+public:
+  using platform_drv_host::platform_drv_host;
+
+  void
+  drv_close() const override;
+
+protected:
+  void
+  exec_ioctl(amdxdna_drm_exec_cmd& arg) const override;
+
+private:
+  uring *
+  get_uring() const;
+
+  mutable std::mutex m_uring_lock;
+  mutable std::unique_ptr<uring> m_uring;
+  mutable std::atomic<bool> m_uring_failed = false;
+};
+
+}
+
+#endif
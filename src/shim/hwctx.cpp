@@ -4,9 +4,80 @@
 #include "buffer.h"
 #include "hwctx.h"
 #include "hwq.h"
+#include "trace_recorder.h"
 
+#include "core/common/config_reader.h"
 #include "core/common/query_requests.h"
 #include "core/common/api/xclbin_int.h"
+#include <algorithm>
+#include <cmath>
+#include <sys/eventfd.h>
+
+namespace {
+
+uint32_t
+get_default_wait_spin_us()
+{
+  static uint32_t spin_us =
+    xrt_core::config::detail::get_uint_value("Runtime.hwq_wait_spin_us", 0);
+  return spin_us;
+}
+
+bool
+is_qos_derived()
+{
+  static bool derived =
+    xrt_core::config::detail::get_bool_value("Runtime.derive_qos", true);
+  return derived;
+}
+
+// Don't block in creating hwctx for device partitions to be set up for it,
+// so that app can go on with creating more hwctx and allocating BOs.
+bool
+is_async_create()
+{
+  static bool async =
+    xrt_core::config::detail::get_bool_value("Runtime.hwctx_async_create", true);
+  return async;
+}
+
+// Priority driver runs hwctx at, anything unknown is taken as normal.
+uint32_t
+effective_priority(uint32_t priority)
+{
+  switch (priority) {
+  case AMDXDNA_QOS_REALTIME_PRIORITY:
+  case AMDXDNA_QOS_HIGH_PRIORITY:
+  case AMDXDNA_QOS_LOW_PRIORITY:
+    return priority;
+  default:
+    return AMDXDNA_QOS_NORMAL_PRIORITY;
+  }
+}
+
+// Fewer cmds than this over hwctx lifetime are not worth a profile.
+const uint64_t qos_profile_min_cmds = 16;
+
+// Current H clock in MHz, 0 if not known.
+uint32_t
+get_hclk_mhz(const shim_xdna::device& dev)
+{
+  amdxdna_drm_query_clock_metadata clk = {};
+  amdxdna_drm_get_info arg = {
+    .param = DRM_AMDXDNA_QUERY_CLOCK_METADATA,
+    .buffer_size = sizeof(clk),
+    .buffer = reinterpret_cast<uintptr_t>(&clk)
+  };
+  try {
+    dev.get_pdev().drv_ioctl(shim_xdna::drv_ioctl_cmd::get_info, &arg);
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to get clocks: %s", e.what());
+    return 0;
+  }
+  return clk.h_clock.freq_mhz;
+}
+
+}
 
 namespace shim_xdna {
 
@@ -16,18 +87,25 @@ namespace shim_xdna {
 
 xclbin_parser::
 xclbin_parser(const xrt::xclbin& xclbin)
+  : m_xclbin(xclbin)
 {
   auto axlf = xclbin.get_axlf();
-  auto aie_partition = xrt_core::xclbin::get_aie_partition(axlf);
+  auto hdr = xrt_core::xclbin::get_axlf_section(axlf, AIE_PARTITION);
+  if (!hdr || hdr->m_sectionSize < sizeof(aie_partition))
+    shim_err(EINVAL, "No valid AIE partition in xclbin");
+  auto sect = reinterpret_cast<const char *>(axlf) + hdr->m_sectionOffset;
+  auto sect_size = hdr->m_sectionSize;
+  auto aie = reinterpret_cast<const aie_partition *>(sect);
 
   for (const auto& k : xclbin.get_kernels()) {
     auto& props = xrt_core::xclbin_int::get_properties(k);
     try {
+      auto pdi = get_pdi(sect, sect_size, props.kernel_id);
       for (const auto& cu : k.get_cus()) {
         m_cus.push_back( {
           .m_name = cu.get_name(),
           .m_func = props.functional,
-          .m_pdi = get_pdi(aie_partition, props.kernel_id) } );
+          .m_pdi = pdi } );
       }
     } catch (xrt_core::system_error &ex) {
       if (ex.get_code() != ENOENT)
@@ -39,8 +117,8 @@ xclbin_parser(const xrt::xclbin& xclbin)
 
   if (m_cus.empty())
     shim_err(EINVAL, "No valid DPU kernel found in xclbin");
-  m_ops_per_cycle = aie_partition.ops_per_cycle;
-  m_column_cnt = aie_partition.ncol;
+  m_ops_per_cycle = aie->operations_per_cycle;
+  m_column_cnt = aie->info.column_width;
   //print_info();
 }
 
@@ -50,15 +128,37 @@ xclbin_parser::
   // Nothing to do
 }
 
-std::vector<uint8_t>
+namespace {
+
+// Array of n elements of T at offset of AIE partition section
+template <typename T>
+const T *
+sect_array(const char *sect, size_t sect_size, const array_offset& arr)
+{
+  if (arr.offset > sect_size || arr.size > (sect_size - arr.offset) / sizeof(T))
+    shim_err(EINVAL, "Bad array in AIE partition, offset 0x%x size %d", arr.offset, arr.size);
+  return reinterpret_cast<const T *>(sect + arr.offset);
+}
+
+}
+
+std::string_view
 xclbin_parser::
-get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id) const
+get_pdi(const char *sect, size_t sect_size, uint16_t kernel_id) const
 {
-  for (auto& pdi : aie.pdis) {
-    for (auto& cdo : pdi.cdo_groups) {
-      for (auto kid : cdo.kernel_ids) {
-        if (kid == kernel_id)
-          return pdi.pdi;
+  auto aie = reinterpret_cast<const aie_partition *>(sect);
+  auto pdis = sect_array<aie_pdi>(sect, sect_size, aie->aie_pdi);
+
+  for (uint32_t i = 0; i < aie->aie_pdi.size; i++) {
+    auto& pdi = pdis[i];
+    auto cdos = sect_array<cdo_group>(sect, sect_size, pdi.cdo_groups);
+    for (uint32_t j = 0; j < pdi.cdo_groups.size; j++) {
+      auto kids = sect_array<uint64_t>(sect, sect_size, cdos[j].dpu_kernel_ids);
+      for (uint32_t k = 0; k < cdos[j].dpu_kernel_ids.size; k++) {
+        if (kids[k] == kernel_id) {
+          auto img = sect_array<char>(sect, sect_size, pdi.pdi_image);
+          return std::string_view(img, pdi.pdi_image.size);
+        }
       }
     }
   }
@@ -118,7 +218,7 @@ get_cu_func(int idx) const
   return m_cus[idx].m_func;
 }
 
-const std::vector<uint8_t>&
+std::string_view
 xclbin_parser::
 get_cu_pdi(int idx) const
 {
@@ -135,17 +235,24 @@ hwctx(const device& dev, const qos_type& qos, const xrt::xclbin& xclbin,
   : m_device(dev)
   , m_q(std::move(queue))
 {
-  xclbin_parser xp(xclbin);
+  auto xp = dev.get_xclbin_parser(xclbin);
 
-  m_col_cnt = xp.get_column_cnt();
-  m_ops_per_cycle = xp.get_ops_per_cycle();
-  auto n_cu = xp.get_num_cus();
+  m_col_cnt = xp->get_column_cnt();
+  m_ops_per_cycle = xp->get_ops_per_cycle();
+  auto n_cu = xp->get_num_cus();
   for (int i = 0; i < n_cu; i++)
-    m_cu_names.push_back(xp.get_cu_name(i));
+    m_cu_names.push_back(xp->get_cu_name(i));
 
+  m_wait_spin_us = get_default_wait_spin_us();
   init_qos_info(qos);
+  m_uuid = xclbin.get_uuid();
+  m_xclbin = xclbin;
+  m_qos_req = qos;
+  if (is_qos_derived())
+    derive_qos_info();
 
   create_ctx_on_device();
+  m_create_time = std::chrono::steady_clock::now();
 }
 
 hwctx::
@@ -155,6 +262,7 @@ hwctx(const device& dev, uint32_t partition_size, std::unique_ptr<hwq> queue)
 {
   m_col_cnt = partition_size;
   m_ops_per_cycle = 0;
+  m_wait_spin_us = get_default_wait_spin_us();
 
   create_ctx_on_device();
 }
@@ -162,11 +270,15 @@ hwctx(const device& dev, uint32_t partition_size, std::unique_ptr<hwq> queue)
 hwctx::
 ~hwctx()
 {
+  m_prio_ctxs.clear();
   try {
+    record_qos_profile();
     delete_ctx_on_device();
   } catch (const xrt_core::system_error& e) {
     shim_debug("Failed to delete context on device: %s", e.what());
   }
+  if (m_completion_fd != -1)
+    close(m_completion_fd);
 }
 
 hwctx::slot_id
@@ -237,6 +349,33 @@ get_hw_queue()
   return m_q.get();
 }
 
+xrt_core::hwqueue_handle*
+hwctx::
+get_hw_queue(uint32_t priority)
+{
+  priority = effective_priority(priority);
+  if (priority == effective_priority(m_qos.priority))
+    return m_q.get();
+  if (!m_uuid)
+    shim_err(EOPNOTSUPP, "No queue of priority 0x%x on hwctx created without xclbin", priority);
+
+  const std::lock_guard<std::mutex> lock(m_prio_lock);
+  auto& ctx = m_prio_ctxs[priority];
+  if (!ctx) {
+    auto qos = m_qos_req;
+    qos["priority"] = priority;
+    try {
+      ctx = m_device.create_hwctx(m_xclbin, qos);
+    } catch (...) {
+      m_prio_ctxs.erase(priority);
+      throw;
+    }
+    shim_debug("Created ctx %d for priority 0x%x queue of ctx %d",
+      ctx->get_slotidx(), priority, m_handle);
+  }
+  return ctx->get_hw_queue();
+}
+
 void
 hwctx::
 init_qos_info(const qos_type& qos)
@@ -256,19 +395,73 @@ init_qos_info(const qos_type& qos)
       m_qos.frame_exec_time = value;
     else if (key == "priority")
       m_qos.priority = value;
+    else if (key == "preempt_mode")
+      m_qos.preempt_mode = value;
+    else if (key == "wait_spin_us")
+      m_wait_spin_us = value;
+    else if (key == "queue_depth")
+      m_queue_depth = value;
   }
 }
 
+void
+hwctx::
+derive_qos_info()
+{
+  auto p = m_device.get_qos_profile(*m_uuid);
+  if (!p)
+    return;
+
+  // Driver only uses QoS for DPM when gops and one of fps or latency are
+  // set, app given values are never overridden.
+  if (!m_qos.gops)
+    m_qos.gops = p->gop;
+  if (!m_qos.fps && !m_qos.latency)
+    m_qos.fps = p->cps;
+  shim_debug("Derived QoS gops %d fps %d for ctx with opc %d cols %d",
+    m_qos.gops, m_qos.fps, m_ops_per_cycle, m_col_cnt);
+}
+
+void
+hwctx::
+record_qos_profile() const
+{
+  if (!m_uuid || m_handle == AMDXDNA_INVALID_CTX_HANDLE || !m_ops_per_cycle)
+    return;
+
+  auto cmds = m_q->get_submitted();
+  auto wait_us = m_q->get_avg_wait_us();
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_create_time).count();
+  if (cmds < qos_profile_min_cmds || !wait_us || secs <= 0)
+    return;
+  auto hclk = get_hclk_mhz(m_device);
+  if (!hclk)
+    return;
+
+  // Wait time is an upper bound of cmd exec time, so gop is not underrated.
+  auto gop = static_cast<double>(m_ops_per_cycle) * hclk * wait_us / 1e9;
+  qos_profile p = {
+    .gop = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(gop))),
+    .cps = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(cmds / secs))),
+  };
+  m_device.record_qos_profile(*m_uuid, p);
+  shim_debug("Recorded QoS profile gop %d cps %d, avg wait %ldus, H clock %dMHz",
+    p.gop, p.cps, wait_us, hclk);
+}
+
 void
 hwctx::
 create_ctx_on_device()
 {
+  SHIM_TRACE_POINT_SCOPE1(hwctx_create_ctx, m_col_cnt);
   create_ctx_arg arg = {
     .qos = m_qos,
     .umq_bo = m_q->get_queue_bo(),
     .log_buf_bo = { AMDXDNA_INVALID_BO_HANDLE, AMDXDNA_INVALID_BO_HANDLE },
     .max_opc = m_ops_per_cycle,
     .num_tiles = m_col_cnt * xrt_core::device_query<xrt_core::query::aie_tiles_stats>(&m_device).core_rows,
+    .queue_depth = m_queue_depth,
+    .flags = is_async_create() ? AMDXDNA_CTX_CREATE_ASYNC : 0u,
   };
   m_device.get_pdev().drv_ioctl(drv_ioctl_cmd::create_ctx, &arg);
 
@@ -285,7 +478,10 @@ delete_ctx_on_device()
   if (m_handle == AMDXDNA_INVALID_CTX_HANDLE)
     return;
 
+  SHIM_TRACE_POINT_SCOPE1(hwctx_destroy_ctx, m_handle);
   m_q->unbind_hwctx();
+  // Before handle can be taken by a new hwctx
+  m_device.get_pdev().drop_resident_ctx(m_handle);
   struct destroy_ctx_arg arg = {
     .ctx_handle = m_handle,
     .syncobj_handle = m_syncobj,
@@ -307,4 +503,205 @@ get_syncobj() const
   return m_syncobj;
 }
 
+uint32_t
+hwctx::
+get_wait_spin_us() const
+{
+  return m_wait_spin_us;
+}
+
+void
+hwctx::
+arm_completion_fd()
+{
+  // Syncobj timeline signals in order, so eventfd on the next seq tells
+  // that at least one more cmd is completed.
+  eventfd_syncobj_arg arg = {
+    .handle = m_syncobj,
+    .timepoint = m_next_completed_seq,
+    .fd = m_completion_fd,
+  };
+  m_device.get_pdev().drv_ioctl(drv_ioctl_cmd::eventfd_syncobj, &arg);
+}
+
+int
+hwctx::
+get_completion_fd()
+{
+  std::lock_guard<std::mutex> lg(m_completion_lock);
+
+  if (m_completion_fd != -1)
+    return m_completion_fd;
+
+  if (m_syncobj == AMDXDNA_INVALID_FENCE_HANDLE)
+    shim_not_supported_err(__func__);
+
+  auto fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == -1)
+    shim_err(-errno, "Failed to create completion eventfd");
+  m_completion_fd = fd;
+  try {
+    arm_completion_fd();
+  } catch (...) {
+    close(m_completion_fd);
+    m_completion_fd = -1;
+    throw;
+  }
+  return m_completion_fd;
+}
+
+std::vector<uint64_t>
+hwctx::
+drain_completed()
+{
+  std::lock_guard<std::mutex> lg(m_completion_lock);
+  std::vector<uint64_t> seqs;
+
+  if (m_completion_fd == -1)
+    shim_err(EINVAL, "Completion fd is not created");
+
+  uint64_t cnt = 0;
+  bool fired = read(m_completion_fd, &cnt, sizeof(cnt)) == sizeof(cnt);
+
+  query_syncobj_arg arg = {
+    .handle = m_syncobj,
+  };
+  m_device.get_pdev().drv_ioctl(drv_ioctl_cmd::query_syncobj, &arg);
+
+  // Seq 0 can't be told apart from initial state by query, rely on eventfd.
+  uint64_t last;
+  if (fired)
+    last = std::max(arg.timepoint, m_next_completed_seq);
+  else if (arg.timepoint && arg.timepoint >= m_next_completed_seq)
+    last = arg.timepoint;
+  else
+    return seqs;
+
+  for (auto seq = m_next_completed_seq; seq <= last; seq++)
+    seqs.push_back(seq);
+  m_next_completed_seq = last + 1;
+  arm_completion_fd();
+  return seqs;
+}
+
+
+//
+// Implementation of hwctx_pool
+//
+
+hwctx_pool::
+hwctx_pool(size_t size, create_func create)
+  : m_size(size)
+  , m_create(std::move(create))
+{
+  m_thread = std::thread(&hwctx_pool::refill, this);
+}
+
+hwctx_pool::
+~hwctx_pool()
+{
+  {
+    const std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+  shim_debug("hwctx pool hits=%ld misses=%ld", m_hits, m_misses);
+}
+
+std::unique_ptr<hwctx>
+hwctx_pool::
+get(const xrt::xclbin& xclbin, const qos_type& qos)
+{
+  pool_key key{xclbin.get_uuid(), qos};
+  std::unique_ptr<hwctx> ctx;
+
+  {
+    const std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+      // First request for this xclbin and QoS, fill the pool for next ones.
+      m_entries.emplace(key, pool_entry{xclbin, {}});
+      m_refills.insert(m_refills.end(), m_size, key);
+    } else if (!it->second.m_ctxs.empty()) {
+      ctx = std::move(it->second.m_ctxs.back());
+      it->second.m_ctxs.pop_back();
+      m_refills.push_back(key);
+    }
+    if (ctx)
+      m_hits++;
+    else
+      m_misses++;
+  }
+  m_cv.notify_one();
+  return ctx;
+}
+
+std::pair<uint64_t, uint64_t>
+hwctx_pool::
+get_stats() const
+{
+  const std::lock_guard<std::mutex> lock(m_lock);
+  return { m_hits, m_misses };
+}
+
+size_t
+hwctx_pool::
+trim()
+{
+  std::map<pool_key, pool_entry> dropped;
+  size_t cnt = 0;
+
+  {
+    const std::lock_guard<std::mutex> lock(m_lock);
+    dropped.swap(m_entries);
+    m_refills.clear();
+  }
+  for (auto& e : dropped)
+    cnt += e.second.m_ctxs.size();
+  return cnt;
+}
+
+void
+hwctx_pool::
+refill()
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_refills.empty(); });
+    if (m_stop)
+      break;
+
+    auto key = m_refills.front();
+    m_refills.pop_front();
+    auto xclbin = m_entries.at(key).m_xclbin;
+
+    lock.unlock();
+    std::unique_ptr<hwctx> ctx;
+    try {
+      ctx = m_create(xclbin, key.second);
+    } catch (const std::exception& ex) {
+      // Most likely out of resource, caller will create hwctx on demand.
+      shim_debug("Failed to pre-create hwctx: %s", ex.what());
+    }
+    lock.lock();
+
+    // Pool may have been trimmed in the mean time
+    auto it = m_entries.find(key);
+    if (ctx && it != m_entries.end()) {
+      it->second.m_ctxs.push_back(std::move(ctx));
+    } else if (ctx) {
+      lock.unlock();
+      ctx.reset();
+      lock.lock();
+    }
+  }
+
+  // Pre-created hwctx have to be gone before device is.
+  auto entries = std::move(m_entries);
+  lock.unlock();
+  entries.clear();
+}
+
 } // shim_xdna
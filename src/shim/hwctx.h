@@ -8,11 +8,21 @@
 #include "core/common/xclbin_parser.h"
 #include "core/common/shim/buffer_handle.h"
 #include "core/common/shim/hwctx_handle.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
 
 namespace shim_xdna {
 
 class hwq; // forward declaration
 
+// CU PDIs are views into the axlf already in memory with xclbin, which is
+// kept alive by the parser, nothing is copied until PDIs are put in BOs.
 class xclbin_parser {
 public:
   xclbin_parser(const xrt::xclbin& xclbin);
@@ -33,21 +43,22 @@ public:
   size_t
   get_cu_func(int idx) const;
 
-  const std::vector<uint8_t>&
+  std::string_view
   get_cu_pdi(int idx) const;
 
 private:
   struct cu_info {
     std::string m_name;
     size_t m_func;
-    std::vector<uint8_t> m_pdi;
+    std::string_view m_pdi;
   };
+  xrt::xclbin m_xclbin;
   std::vector<cu_info> m_cus;
   uint32_t m_column_cnt;
   uint32_t m_ops_per_cycle;
 
-  std::vector<uint8_t>
-  get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id) const;
+  std::string_view
+  get_pdi(const char *sect, size_t sect_size, uint16_t kernel_id) const;
 
   void
   print_info() const;
@@ -96,6 +107,31 @@ public:
   uint32_t
   get_syncobj() const;
 
+  // Max time in us wait_command() may spin on cmd state before sleeping
+  // in driver. 0 means no spinning.
+  uint32_t
+  get_wait_spin_us() const;
+
+  // Pollable fd which becomes readable when any cmd submitted on this ctx
+  // completes. The fd is owned by hwctx and is valid till hwctx is gone.
+  // Only available when ctx has a syncobj (KMQ).
+  int
+  get_completion_fd();
+
+  // Queue whose cmds run at priority, one of AMDXDNA_QOS_*_PRIORITY. Queue of
+  // a priority other than the one of this hwctx is backed by a companion
+  // hwctx created from the same xclbin on first use, driver then runs its
+  // cmds ahead of or after cmds of this hwctx by priority. CU indexes and BOs
+  // of this hwctx work the same on all of its queues. Only for hwctx created
+  // from xclbin.
+  xrt_core::hwqueue_handle*
+  get_hw_queue(uint32_t priority);
+
+  // Return seqs of all cmds completed since last drain and re-arm the
+  // completion fd.
+  std::vector<uint64_t>
+  drain_completed();
+
 private:
   const device& m_device;
   slot_id m_handle = AMDXDNA_INVALID_CTX_HANDLE;
@@ -106,6 +142,25 @@ private:
   uint32_t m_ops_per_cycle = 0;
   std::unique_ptr<hwq> m_q;
   amdxdna_qos_info m_qos = {};
+  uint32_t m_wait_spin_us = 0;
+  // From QoS key queue_depth, 0 leaves it to driver
+  uint32_t m_queue_depth = 0;
+  // Set only for hwctx created from xclbin, whose profile is recorded.
+  std::optional<xrt::uuid> m_uuid;
+  std::chrono::steady_clock::time_point m_create_time;
+  // What this hwctx is created from, for companion hwctx of other priority.
+  xrt::xclbin m_xclbin;
+  qos_type m_qos_req;
+  std::mutex m_prio_lock;
+  std::map<uint32_t, std::unique_ptr<hwctx>> m_prio_ctxs;
+
+  std::mutex m_completion_lock;
+  int m_completion_fd = -1;
+  // Next seq to be reported by drain_completed()
+  uint64_t m_next_completed_seq = 0;
+
+  void
+  arm_completion_fd();
 
   void
   create_ctx_on_device();
@@ -115,6 +170,64 @@ private:
 
   void
   init_qos_info(const qos_type& qos);
+
+  // Fill in what app has left out of QoS from profile of past hwctx.
+  void
+  derive_qos_info();
+
+  void
+  record_qos_profile() const;
+};
+
+// Keeps hwctx created ahead of time for each (xclbin UUID, QoS) which has
+// been asked for before, see Runtime.hwctx_pool_size. A hwctx handed out is
+// destroyed on release as usual and a replacement is created in background.
+class hwctx_pool
+{
+public:
+  using qos_type = xrt::hw_context::qos_type;
+  using create_func = std::function<std::unique_ptr<hwctx>(const xrt::xclbin&, const qos_type&)>;
+
+  hwctx_pool(size_t size, create_func create);
+  ~hwctx_pool();
+
+  // Returns nullptr if no pre-created hwctx is ready, in which case caller
+  // has to create one.
+  std::unique_ptr<hwctx>
+  get(const xrt::xclbin& xclbin, const qos_type& qos);
+
+  // Number of requests served by / missed in pool.
+  std::pair<uint64_t, uint64_t>
+  get_stats() const;
+
+  // Destroy all pre-created hwctx and forget what has been asked for, pool
+  // fills up again only on next request. Returns number of hwctx destroyed.
+  size_t
+  trim();
+
+private:
+  using pool_key = std::pair<xrt::uuid, qos_type>;
+  struct pool_entry {
+    xrt::xclbin m_xclbin;
+    std::vector< std::unique_ptr<hwctx> > m_ctxs;
+  };
+
+  void
+  refill();
+
+  const size_t m_size;
+  const create_func m_create;
+
+  mutable std::mutex m_lock;
+  std::condition_variable m_cv;
+  bool m_stop = false;
+  std::map<pool_key, pool_entry> m_entries;
+  // One request per hwctx to be created in background.
+  std::deque<pool_key> m_refills;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+
+  std::thread m_thread;
 };
 
 }
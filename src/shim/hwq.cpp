@@ -5,12 +5,69 @@
 #include "fence.h"
 #include "buffer.h"
 #include "shim_debug.h"
-#include "core/common/trace.h"
-#include <fstream>
+#include "trace_stream.h"
+#include "core/common/config_reader.h"
+#include "trace_recorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
 
 namespace {
 
+// Pending queue depth is rounded up to power of 2.
+const size_t max_pending_depth = 1024;
+
+// Time a pending queue worker blocks on a fence or cmd before moving on to
+// other hwqs, to come back later.
+const uint32_t pending_block_slice_ms = 5;
+
+// Time reaper thread waits for cmds before taking cmds watched in the
+// meantime into account. Cmds watched on hwqs which already have cmds
+// watched complete after those in most cases, so this is rarely hit.
+const uint32_t reaper_slice_ms = 2;
+
+size_t
+get_pending_threads()
+{
+  static size_t n = std::clamp<size_t>(
+    xrt_core::config::detail::get_uint_value("Runtime.hwq_pending_threads",
+      std::min(4u, std::max(1u, std::thread::hardware_concurrency()))),
+    1, 64);
+  return n;
+}
+
+size_t
+get_pending_queue_depth()
+{
+  size_t d = xrt_core::config::detail::get_uint_value("Runtime.hwq_pending_depth", 16);
+  d = std::clamp<size_t>(d, 1, max_pending_depth);
+  size_t depth = 1;
+  while (depth < d)
+    depth <<= 1;
+  return depth;
+}
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+  // Make sure cmd state is re-read from memory
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
 std::string
 to_hex_string(uint64_t num) {
   std::stringstream ss;
@@ -18,40 +75,196 @@ to_hex_string(uint64_t num) {
   return ss.str();
 }
 
+// Dump one in this many cmds, 0 to dump none.
+size_t
+get_dump_sample_interval()
+{
+  static size_t interval =
+    xrt_core::config::detail::get_uint_value("Debug.dump_arg_bos_sample", 1);
+  return interval;
+}
+
+// BO content beyond this size is not dumped, 0 for no limit.
+size_t
+get_dump_max_bo_size()
+{
+  static size_t sz =
+    xrt_core::config::detail::get_uint_value("Debug.dump_arg_bos_max_size", 0);
+  return sz;
+}
+
+size_t
+get_dump_staging_size()
+{
+  static size_t sz =
+    xrt_core::config::detail::get_uint_value("Debug.dump_arg_bos_staging_size", 64 * 1024 * 1024);
+  return sz;
+}
+
 void
-dump_buf_to_file(void *buf, size_t size, const std::string& dumpfile)
+write_file(const std::string& path, const char *buf, size_t size)
 {
-  std::ofstream ofs(dumpfile, std::ios::out | std::ios::binary);
-  if (!ofs.is_open())
-    shim_err(errno, "Failed to open dump file: %s", dumpfile);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    shim_err(errno, "Failed to open dump file: %s", path.c_str());
 
-  for (int i = 0; i < size; i++)
-    ofs.write(reinterpret_cast<char *>(buf) + i, 1);
+  const size_t block_size = 4 * 1024 * 1024;
+  while (size) {
+    auto ret = write(fd, buf, std::min(size, block_size));
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      auto err = errno;
+      close(fd);
+      shim_err(err, "Failed to write dump file: %s", path.c_str());
+    }
+    buf += ret;
+    size -= ret;
+  }
+  close(fd);
 }
 
+// Snapshots BO content into a staging ring on submission path and writes it
+// out to files on a background thread. Content that does not fit in the ring
+// is dropped rather than holding up submission.
+class bo_dumper
+{
+public:
+  bo_dumper()
+    : m_ring(get_dump_staging_size())
+    , m_thread(&bo_dumper::writer, this)
+  {
+  }
+
+  ~bo_dumper()
+  {
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+    if (m_dropped)
+      std::cout << "Dropped " << m_dropped << " BO dumps, staging ring is full" << std::endl;
+  }
+
+  // Returns false if this cmd is not sampled.
+  bool
+  sample()
+  {
+    auto interval = get_dump_sample_interval();
+    return interval && (m_cmd_cnt++ % interval) == 0;
+  }
+
+  void
+  dump(const void *buf, size_t size, std::string&& path)
+  {
+    auto max = get_dump_max_bo_size();
+    if (max)
+      size = std::min(size, max);
+
+    std::lock_guard<std::mutex> lg(m_lock);
+    // Record has to be contiguous in ring, skip the tail end if needed.
+    size_t off = m_head;
+    size_t pad = 0;
+    if (off + size > m_ring.size()) {
+      pad = m_ring.size() - off;
+      off = 0;
+    }
+    if (m_used + pad + size > m_ring.size()) {
+      m_dropped++;
+      return;
+    }
+    std::memcpy(m_ring.data() + off, buf, size);
+    m_head = (off + size) % m_ring.size();
+    m_used += pad + size;
+    m_records.push_back({ std::move(path), off, size, pad + size });
+    m_cv.notify_one();
+  }
+
+  std::string
+  next_dump_dir()
+  {
+    return "/tmp/BO_DUMPS." + std::to_string(getpid()) + "/" + std::to_string(m_dump_cnt++) + "/";
+  }
+
+private:
+  struct record {
+    std::string m_path;
+    size_t m_offset;
+    size_t m_size;
+    // Bytes taken from ring, including skipped tail end.
+    size_t m_consumed;
+  };
+
+  void
+  writer()
+  {
+    std::unique_lock<std::mutex> lk(m_lock);
+    while (true) {
+      m_cv.wait(lk, [this]() { return m_stop || !m_records.empty(); });
+      if (m_records.empty())
+        return;
+      auto r = std::move(m_records.front());
+      m_records.pop_front();
+      lk.unlock();
+
+      // Ring content of this record can't be reused until it is released.
+      try {
+        std::error_code ec;
+        auto dir = std::filesystem::path(r.m_path).parent_path();
+        std::filesystem::create_directories(dir, ec);
+        if (ec)
+          shim_err(ec.value(), "Failed to create BO dump dir: %s: %s", dir.c_str(), ec.message().c_str());
+        write_file(r.m_path, m_ring.data() + r.m_offset, r.m_size);
+      } catch (const xrt_core::system_error& e) {
+        std::cout << e.what() << std::endl;
+      }
+
+      lk.lock();
+      m_used -= r.m_consumed;
+    }
+  }
+
+  std::vector<char> m_ring;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::deque<record> m_records;
+  size_t m_head = 0;
+  size_t m_used = 0;
+  uint64_t m_dropped = 0;
+  bool m_stop = false;
+  std::atomic<uint64_t> m_cmd_cnt = 0;
+  std::atomic<uint64_t> m_dump_cnt = 0;
+  std::thread m_thread;
+};
+
 void
 dump_arg_bos(const shim_xdna::cmd_buffer *cmd_bo)
 {
+  if (!cmd_bo->is_dump_arg_bos())
+    return;
+
   auto bos = cmd_bo->get_arg_bos();
   if (bos.empty())
     return;
 
-  // Dump exec buf and all argument BO content for debugging.
-  std::string dir_path = "/tmp/BO_DUMPS.";
-  dir_path += std::to_string(getpid()) + "/";
-  std::error_code ec;
-  std::filesystem::create_directories(dir_path, ec);
-  if (ec)
-    shim_err(ec.value(), "Failed to create BO dump dir: %s: %s", dir_path, ec.message());
+  static bo_dumper dumper;
+  if (!dumper.sample())
+    return;
+
+  // Dump exec buf and all argument BO content for debugging. Each sampled
+  // cmd goes to its own sub-dir.
+  auto dir_path = dumper.next_dump_dir();
 
   std::string filename = "exec_buf.";
   filename += std::to_string(cmd_bo->id().handle);
-  dump_buf_to_file(cmd_bo->vaddr(), cmd_bo->size(), dir_path + filename);
+  dumper.dump(cmd_bo->vaddr(), cmd_bo->size(), dir_path + filename);
 
   for (const auto& bo : bos) {
     std::string filename = std::to_string(bo->id().handle) + ".";
     filename += to_hex_string(bo->paddr());
-    dump_buf_to_file(bo->vaddr(), bo->size(), dir_path + filename);
+    dumper.dump(bo->vaddr(), bo->size(), dir_path + filename);
   }
 }
 
@@ -59,24 +272,310 @@ dump_arg_bos(const shim_xdna::cmd_buffer *cmd_bo)
 
 namespace shim_xdna {
 
+void
+cmd_graph::
+add_cmd(const cmd_buffer *cmd)
+{
+  if (m_nodes.empty() || m_nodes.back().m_type != node_type::cmds ||
+    m_nodes.back().m_batch.m_cmds.size() == AMDXDNA_EXEC_CMD_MAX_BATCH)
+    m_nodes.push_back({ node_type::cmds });
+  m_nodes.back().m_batch.m_cmds.push_back(cmd);
+}
+
+void
+cmd_graph::
+add_fence(node_type type, const fence *f)
+{
+  m_nodes.push_back({ type, {}, f });
+}
+
+void
+cmd_graph::
+finalize()
+{
+  for (auto& n : m_nodes) {
+    auto& b = n.m_batch;
+    for (auto cmd : b.m_cmds) {
+      b.m_cmd_bos.push_back(cmd->id());
+      auto& hdls = cmd->get_arg_bo_handles();
+      b.m_arg_bo_hdls.insert(b.m_arg_bo_hdls.end(), hdls.begin(), hdls.end());
+    }
+    std::sort(b.m_arg_bo_hdls.begin(), b.m_arg_bo_hdls.end());
+    b.m_arg_bo_hdls.erase(std::unique(b.m_arg_bo_hdls.begin(), b.m_arg_bo_hdls.end()),
+      b.m_arg_bo_hdls.end());
+  }
+}
+
+size_t
+cmd_graph::
+get_num_cmds() const
+{
+  size_t n = 0;
+  for (auto& node : m_nodes)
+    n += node.m_batch.m_cmds.size();
+  return n;
+}
+
+pending_pool::
+pending_pool(const pdev& pdev)
+  : m_pdev(pdev)
+{}
+
+pending_pool::
+~pending_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto& t : m_threads)
+    t.join();
+}
+
+void
+pending_pool::
+schedule(hwq *q)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_threads.empty()) {
+      auto n = get_pending_threads();
+      for (size_t i = 0; i < n; i++) {
+        m_threads.emplace_back(&pending_pool::worker, this);
+        m_pdev.bind_thread(m_threads.back());
+      }
+      shim_debug("Started %ld pending queue threads", n);
+    }
+    m_ready.push_back(q);
+  }
+  m_cv.notify_one();
+}
+
+void
+pending_pool::
+worker()
+{
+  while (true) {
+    hwq *q;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_cv.wait(lock, [this] { return m_stop || !m_ready.empty(); });
+      if (m_ready.empty())
+        break;
+      q = m_ready.front();
+      m_ready.pop_front();
+    }
+    // Back of the line, so that one busy or blocked hwq can't starve others
+    if (q->process_pending_queue())
+      schedule(q);
+  }
+}
+
+cmd_reaper::
+cmd_reaper(const pdev& pdev)
+  : m_pdev(pdev)
+{}
+
+cmd_reaper::
+~cmd_reaper()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void
+cmd_reaper::
+set_executor(executor_type exec)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_exec = std::move(exec);
+}
+
+void
+cmd_reaper::
+add(const hwq *q, xrt_core::buffer_handle *cmd, callback_type cb)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_thread.joinable()) {
+      m_thread = std::thread(&cmd_reaper::reaper, this);
+      m_pdev.bind_thread(m_thread);
+    }
+    m_cmds.push_back({ q, cmd, std::move(cb) });
+  }
+  m_cv.notify_all();
+}
+
+void
+cmd_reaper::
+add_fence(const fence *f, uint64_t state, std::function<void()> cb)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_thread.joinable()) {
+      m_thread = std::thread(&cmd_reaper::reaper, this);
+      m_pdev.bind_thread(m_thread);
+    }
+    m_fences.push_back({ f, state, std::move(cb) });
+  }
+  m_cv.notify_all();
+}
+
+cmd_reaper::executor_type
+cmd_reaper::
+get_executor()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_exec;
+}
+
+void
+cmd_reaper::
+forget(const hwq *q)
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+  // Reaper thread may be waiting on q's hwctx right now
+  m_cv.wait(lock, [this] { return !m_busy; });
+  m_cmds.erase(std::remove_if(m_cmds.begin(), m_cmds.end(),
+    [q] (const entry& e) { return e.m_q == q; }), m_cmds.end());
+}
+
+void
+cmd_reaper::
+run(xrt_core::buffer_handle *cmd, const callback_type& cb)
+{
+  auto state = reinterpret_cast<ert_packet *>(static_cast<cmd_buffer*>(cmd)->vaddr())->state;
+  auto exec = get_executor();
+  if (exec)
+    exec([cb, state] { cb(state); });
+  else
+    cb(state);
+}
+
+void
+cmd_reaper::
+reaper()
+{
+  shim_debug("Cmd reaper thread started!");
+  std::unique_lock<std::mutex> lock(m_lock);
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_cmds.empty() || !m_fences.empty(); });
+    if (m_stop)
+      break;
+
+    // Cmds still in pending queue have no seq to wait for yet
+    std::vector<std::pair<const hwq*, xrt_core::buffer_handle*>> cmds;
+    for (auto& e : m_cmds) {
+      if (static_cast<cmd_buffer*>(e.m_cmd)->is_submitted())
+        cmds.emplace_back(e.m_q, e.m_cmd);
+    }
+    m_busy = true;
+    lock.unlock();
+
+    std::vector<bool> done;
+    try {
+      if (cmds.empty())
+        std::this_thread::sleep_for(std::chrono::milliseconds(reaper_slice_ms));
+      else
+        done = hwq::wait_commands(cmds, false, reaper_slice_ms);
+    }
+    catch (const xrt_core::system_error& ex) {
+      // Most likely a hwctx gone bad, which is then reported by its cmds
+      shim_debug("Cmd reaper failed to wait, err: %s", ex.what());
+      std::this_thread::sleep_for(std::chrono::milliseconds(reaper_slice_ms));
+    }
+
+    lock.lock();
+    m_busy = false;
+    std::vector<std::function<void()>> signaled;
+    if (!m_fences.empty()) {
+      std::vector<const fence *> fences;
+      std::vector<uint64_t> states;
+      for (auto& e : m_fences) {
+        fences.push_back(e.m_fence);
+        states.push_back(e.m_state);
+      }
+      std::vector<bool> sig;
+      try {
+        sig = fence::is_signaled(fences, states);
+      }
+      catch (const xrt_core::system_error& ex) {
+        shim_debug("Cmd reaper failed to check fences, err: %s", ex.what());
+      }
+      size_t j = 0;
+      for (size_t i = 0; i < m_fences.size(); i++) {
+        if (i < sig.size() && sig[i])
+          signaled.push_back(std::move(m_fences[i].m_cb));
+        else
+          m_fences[j++] = std::move(m_fences[i]);
+      }
+      m_fences.resize(j);
+    }
+    std::vector<entry> reaped;
+    for (size_t i = 0; i < done.size(); i++) {
+      if (!done[i])
+        continue;
+      auto it = std::find_if(m_cmds.begin(), m_cmds.end(), [&cmds, i] (const entry& e) {
+        return e.m_q == cmds[i].first && e.m_cmd == cmds[i].second;
+      });
+      if (it == m_cmds.end())
+        continue;
+      reaped.push_back(std::move(*it));
+      m_cmds.erase(it);
+    }
+    m_cv.notify_all();
+    if (reaped.empty() && signaled.empty())
+      continue;
+
+    // Callback may register more cmds or destroy hwctx
+    lock.unlock();
+    for (auto& e : reaped)
+      run(e.m_cmd, e.m_cb);
+    if (!signaled.empty()) {
+      auto exec = get_executor();
+      for (auto& cb : signaled) {
+        if (exec)
+          exec(std::move(cb));
+        else
+          cb();
+      }
+    }
+    lock.lock();
+  }
+  shim_debug("Cmd reaper thread stopped!");
+}
+
 hwq::
 hwq(const device& device)
   : m_pdev(device.get_pdev())
+  , m_pending_depth(get_pending_queue_depth())
+  , m_pending(m_pending_depth)
+  , m_pending_pool(device.get_pending_pool())
+  , m_cmd_reaper(device.get_cmd_reaper())
 {
-  // Pending queue processing thread should be created as the last step
-  // after all other member variables have been initialized.
-  m_pending_thread = std::thread(&hwq::process_pending_queue, this);
 }
 
 hwq::
 ~hwq()
 {
+  m_pending_thread_stop = true;
   {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    m_pending_thread_stop = true;
+    // Whatever is pending is still processed
+    std::unique_lock<std::mutex> lock(m_pending_mutex);
+    m_pending_producer_cv.wait(lock, [this] { return !m_pending_scheduled; });
   }
-  m_pending_consumer_cv.notify_one();
-  m_pending_thread.join();
+
+  shim_debug("Pending queue depth %ld, producer stalled %ld times, %ld us in total",
+    m_pending_depth, m_pending_stall_cnt, m_pending_stall_us);
+  shim_debug("Wait spin hit %ld, miss %ld", m_spin_hit.load(), m_spin_miss.load());
+  shim_debug("Producers blocked on queue lock %ld times, %ld us in total",
+    m_lock_wait_cnt.load(), m_lock_wait_us.load());
 }
 
 void
@@ -90,9 +589,38 @@ void
 hwq::
 unbind_hwctx()
 {
+  m_cmd_reaper->forget(this);
   m_ctx = nullptr;
 }
 
+void
+hwq::
+add_completion_callback(xrt_core::buffer_handle *cmd, cmd_reaper::callback_type cb)
+{
+  if (poll_command(cmd))
+    m_cmd_reaper->run(cmd, cb);
+  else
+    m_cmd_reaper->add(this, cmd, std::move(cb));
+}
+
+bool
+hwq::
+is_cmd_state_done(uint32_t state)
+{
+  switch (state) {
+  case ERT_CMD_STATE_COMPLETED:
+  case ERT_CMD_STATE_ERROR:
+  case ERT_CMD_STATE_ABORT:
+  case ERT_CMD_STATE_TIMEOUT:
+  case ERT_CMD_STATE_NORESPONSE:
+  case ERT_CMD_STATE_SKERROR:
+  case ERT_CMD_STATE_SKCRASHED:
+    return true;
+  default:
+    return false;
+  }
+}
+
 int
 hwq::
 poll_command(xrt_core::buffer_handle *cmd) const
@@ -100,8 +628,8 @@ poll_command(xrt_core::buffer_handle *cmd) const
   auto boh = static_cast<cmd_buffer*>(cmd);
   auto cmdpkt = reinterpret_cast<ert_packet *>(boh->vaddr());
 
-  if (cmdpkt->state >= ERT_CMD_STATE_COMPLETED) {
-    XRT_TRACE_POINT_LOG(poll_command_done);
+  if (is_cmd_state_done(cmdpkt->state)) {
+    SHIM_TRACE_POINT_LOG(poll_command_done);
     return 1;
   }
   return 0;
@@ -111,7 +639,7 @@ int
 hwq::
 wait_command(uint64_t seq, uint32_t timeout_ms) const
 {
-  XRT_TRACE_POINT_SCOPE1(wait_command, seq);
+  SHIM_TRACE_POINT_SCOPE1(wait_command, seq);
 
   int ret = 1;
 
@@ -140,6 +668,92 @@ wait_command(uint64_t seq, uint32_t timeout_ms) const
   return ret;
 }
 
+uint64_t
+hwq::
+get_spin_budget_us() const
+{
+  uint64_t max_us = m_ctx->get_wait_spin_us();
+  if (!max_us)
+    return 0;
+
+  // No history yet, give it a try.
+  uint64_t avg_us = m_avg_wait_us;
+  if (!avg_us)
+    return max_us;
+
+  // Recent cmds take longer than we are allowed to spin, go to sleep directly.
+  if (avg_us > max_us)
+    return 0;
+  return std::min(max_us, avg_us * 2);
+}
+
+void
+hwq::
+record_wait_time(uint64_t us) const
+{
+  // Exponential moving average with 1/8 weight for the latest sample. Racing
+  // updates from multiple waiters may drop a sample, which is fine.
+  uint64_t avg_us = m_avg_wait_us;
+  if (!avg_us)
+    m_avg_wait_us = us ? us : 1;
+  else
+    m_avg_wait_us = avg_us - (avg_us >> 3) + (us >> 3);
+}
+
+bool
+hwq::
+spin_wait_command(const cmd_buffer *cmd, uint32_t timeout_ms) const
+{
+  auto budget_us = get_spin_budget_us();
+  if (!budget_us)
+    return false;
+  if (timeout_ms)
+    budget_us = std::min<uint64_t>(budget_us, timeout_ms * 1000ul);
+
+  auto cmdpkt = reinterpret_cast<volatile ert_packet *>(cmd->vaddr());
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::microseconds(budget_us);
+  do {
+    if (is_cmd_state_done(cmdpkt->state)) {
+      m_spin_hit++;
+      SHIM_TRACE_POINT_LOG(wait_command_spin_hit);
+      return true;
+    }
+    cpu_relax();
+  } while (std::chrono::steady_clock::now() < end);
+
+  m_spin_miss++;
+  SHIM_TRACE_POINT_LOG(wait_command_spin_miss);
+  return false;
+}
+
+bool
+hwq::
+backoff_wait(const std::function<bool()>& done, uint64_t budget_us)
+{
+  const int spin_cnt = 64;
+  const uint64_t max_sleep_us = 64;
+
+  if (!budget_us)
+    return done();
+
+  for (int i = 0; i < spin_cnt; i++) {
+    if (done())
+      return true;
+    cpu_relax();
+  }
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us);
+  uint64_t sleep_us = 1;
+  while (std::chrono::steady_clock::now() < end) {
+    if (done())
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    sleep_us = std::min(sleep_us * 2, max_sleep_us);
+  }
+  return done();
+}
+
 int
 hwq::
 wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
@@ -151,9 +765,44 @@ wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
   auto boh = static_cast<cmd_buffer*>(cmd);
   auto cmdpkt = reinterpret_cast<ert_packet *>(boh->vaddr());
   auto seq = boh->wait_for_submitted();
-  auto ret = wait_command(seq, timeout_ms);
   auto& subcmds = boh->get_subcmd_list();
 
+  // For chained cmd submitted in user mode, only the last sub-cmd tells
+  // when the whole chain is done.
+  auto start = std::chrono::steady_clock::now();
+  auto ret = 1;
+  auto wait_bo = subcmds.empty() ? boh : subcmds.back();
+  trace_stream::emit_cmd(trace_stream::event::cmd_wait_begin, boh->id().handle, seq);
+  // Time spent spinning counts against timeout_ms, 0 is no timeout. Once it
+  // is all spent, state of cmd is the answer.
+  auto left_ms = [&start, timeout_ms](uint32_t& ms) {
+    ms = timeout_ms;
+    if (!timeout_ms)
+      return true;
+    auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    if (spent >= timeout_ms)
+      return false;
+    ms = timeout_ms - static_cast<uint32_t>(spent);
+    return true;
+  };
+  uint32_t ms;
+  bool done = spin_wait_command(wait_bo, timeout_ms);
+  if (!done && left_ms(ms))
+    done = user_wait_command(wait_bo, ms);
+  if (!done) {
+    auto pkt = reinterpret_cast<volatile ert_packet *>(wait_bo->vaddr());
+    ret = left_ms(ms) ? wait_command(seq, ms) : is_cmd_state_done(pkt->state);
+  }
+  if (ret) {
+    auto end = std::chrono::steady_clock::now();
+    record_wait_time(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+    trace_stream::emit_cmd(trace_stream::event::cmd_wait_end, boh->id().handle, seq);
+    trace_stream::cmd_exec_payload p = { .bo_handle = boh->id().handle, .seq = seq };
+    if (trace_stream::enabled() && boh->get_timestamps(p.start_ns, p.end_ns))
+      trace_stream::emit(trace_stream::event::cmd_exec, &p, sizeof(p));
+  }
+
   // The timeout_ms expired.
   if (!ret)
     return ret;
@@ -186,22 +835,160 @@ wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
   return ret;
 }
 
+std::vector<bool>
+hwq::
+wait_commands(const std::vector<std::pair<const hwq*, xrt_core::buffer_handle*>>& cmds,
+  bool wait_all, uint32_t timeout_ms)
+{
+  SHIM_TRACE_POINT_SCOPE1(wait_commands, cmds.size());
+
+  std::vector<bool> done(cmds.size(), false);
+  if (cmds.empty())
+    return done;
+
+  // Check status to avoid calling into driver, if it's already completed
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < cmds.size(); i++) {
+    done[i] = cmds[i].first->poll_command(cmds[i].second);
+    if (!done[i])
+      pending.push_back(i);
+  }
+  if (pending.empty() || (!wait_all && pending.size() < cmds.size()))
+    return done;
+
+  // Wait on ctx syncobjs if all cmds have one, otherwise, on ctx handles
+  auto& pdev = cmds[0].first->m_pdev;
+  bool use_syncobj = true;
+  std::vector<uint64_t> seqs;
+  for (auto i : pending) {
+    auto q = cmds[i].first;
+    if (&q->m_pdev != &pdev)
+      shim_err(EINVAL, "Can't wait for cmds from different devices");
+    seqs.push_back(static_cast<cmd_buffer*>(cmds[i].second)->wait_for_submitted());
+    if (q->m_ctx->get_syncobj() == AMDXDNA_INVALID_FENCE_HANDLE)
+      use_syncobj = false;
+  }
+  std::vector<uint32_t> handles;
+  for (auto i : pending) {
+    auto ctx = cmds[i].first->m_ctx;
+    handles.push_back(use_syncobj ? ctx->get_syncobj() : ctx->get_slotidx());
+  }
+
+  shim_debug("Waiting for %ld cmds (%s)...", pending.size(), wait_all ? "all" : "any");
+  std::vector<bool> completed;
+  try {
+    if (use_syncobj) {
+      wait_syncobjs_arg arg = {
+        .handles = handles,
+        .timepoints = seqs,
+        .timeout_ms = timeout_ms,
+        .wait_all = wait_all,
+      };
+      pdev.drv_ioctl(drv_ioctl_cmd::wait_syncobjs, &arg);
+    } else {
+      wait_cmds_arg arg = {
+        .ctx_handles = handles,
+        .seqs = seqs,
+        .timeout_ms = timeout_ms,
+        .wait_all = wait_all,
+        .completed = completed,
+      };
+      pdev.drv_ioctl(drv_ioctl_cmd::wait_cmds, &arg);
+    }
+  }
+  catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+  }
+
+  if (use_syncobj) {
+    std::vector<uint64_t> points;
+    query_syncobjs_arg arg = {
+      .handles = handles,
+      .timepoints = points,
+    };
+    pdev.drv_ioctl(drv_ioctl_cmd::query_syncobjs, &arg);
+    for (size_t j = 0; j < pending.size(); j++)
+      completed.push_back(points[j] >= seqs[j]);
+  }
+
+  // Completed cmds return right away, chained cmd status is fixed up there.
+  for (size_t j = 0; j < completed.size(); j++) {
+    if (!completed[j])
+      continue;
+    auto i = pending[j];
+    done[i] = cmds[i].first->wait_command(cmds[i].second, timeout_ms);
+  }
+  return done;
+}
+
+template <typename L>
 void
 hwq::
-push_to_pending_queue(std::unique_lock<std::mutex>& lock,
-  const void *cmd, uint64_t fence_state, pending_cmd_type type)
+lock_producer(L& lock)
+{
+  if (lock.try_lock())
+    return;
+
+  SHIM_TRACE_POINT_SCOPE1(hwq_lock_wait, m_last_seq.load());
+  auto start = std::chrono::steady_clock::now();
+  lock.lock();
+  auto end = std::chrono::steady_clock::now();
+  m_lock_wait_cnt.fetch_add(1, std::memory_order_relaxed);
+  m_lock_wait_us.fetch_add(
+    std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+    std::memory_order_relaxed);
+}
+
+void
+hwq::
+wait_pending_queue_not_full()
+{
+  if (!pending_queue_full())
+    return;
+
+  SHIM_TRACE_POINT_LOG(pending_queue_stall);
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> lock(m_pending_mutex);
+    m_pending_producer_waiting = true;
+    m_pending_producer_cv.wait(lock, [this]() { return !pending_queue_full(); });
+    m_pending_producer_waiting = false;
+  }
+  auto end = std::chrono::steady_clock::now();
+  m_pending_stall_cnt++;
+  m_pending_stall_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void
+hwq::
+push_to_pending_queue(const void *cmd, uint64_t fence_state, pending_cmd_type type,
+  const hwq *peer)
 {
   if (m_pending_thread_stop)
     shim_err(EINVAL, "Enqueuing when processing thread is stopped");
 
-  m_pending_producer_cv.wait(lock, [this]() { return !pending_queue_full(); });
+  wait_pending_queue_not_full();
   pending_cmd& c = m_pending[pending_queue_producer_idx()];
   c.m_type = type;
   c.m_cmd = cmd;
   c.m_fence_state = fence_state;
-  c.m_last_seq = m_last_seq;
+  c.m_peer = peer;
   m_pending_producer++;
-  m_pending_consumer_cv.notify_one();
+
+  // Only bother the pool when no worker has this hwq yet. Pairs with the
+  // re-check in process_pending_queue() after it gives hwq up.
+  if (!m_pending_scheduled.exchange(true))
+    m_pending_pool->schedule(this);
+}
+
+void
+hwq::
+update_last_seq(uint64_t seq)
+{
+  uint64_t cur = m_last_seq;
+  while ((cur == INVALID_SEQ || cur < seq) && !m_last_seq.compare_exchange_weak(cur, seq))
+    ;
 }
 
 void
@@ -210,40 +997,287 @@ submit_command(xrt_core::buffer_handle *cmd)
 {
   auto boh = static_cast<cmd_buffer*>(cmd);
 
-  XRT_TRACE_POINT_SCOPE1(submit_command, boh->id().handle);
-  std::unique_lock<std::mutex> lock(m_mutex);
+  SHIM_TRACE_POINT_SCOPE1(submit_command, boh->id().handle);
 
   dump_arg_bos(boh);
+  boh->request_timestamps();
+  record_cmd(boh);
+  m_submitted.fetch_add(1, std::memory_order_relaxed);
 
-  // If pending queue is empty, submit directly to driver, else enqueue.
+  // Fast path, pending queue is empty, submit directly to driver. Pending
+  // queue can only be filled by exclusive lock holder, so it stays empty
+  // while we are here.
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mutex, std::defer_lock);
+    lock_producer(lock);
+    if (pending_queue_empty()) {
+      auto seq = issue_command(boh);
+      boh->mark_submitted(seq);
+      update_last_seq(seq);
+      return;
+    }
+  }
+
+  // Slow path, cmd has to go after what is pending. Queue may have been
+  // drained by the time we get the lock, re-check.
+  std::unique_lock<std::shared_mutex> lock(m_mutex, std::defer_lock);
+  lock_producer(lock);
   if (pending_queue_empty()) {
     auto seq = issue_command(boh);
     boh->mark_submitted(seq);
+    update_last_seq(seq);
   } else {
-    shim_debug("Enqueuing command after command %ld", m_last_seq);
-    push_to_pending_queue(lock, boh, 0, pending_cmd_type::io);
+    shim_debug("Enqueuing command after command %ld", m_last_seq.load());
+    // Consumer may issue it and mark it submitted as soon as it is published.
     boh->mark_enqueued();
+    push_to_pending_queue(boh, 0, pending_cmd_type::io);
+  }
+}
+
+void
+hwq::
+issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs)
+{
+  for (auto boh : cmds)
+    seqs.push_back(issue_command(boh));
+}
+
+void
+hwq::
+submit_commands(const std::vector<xrt_core::buffer_handle *>& cmds)
+{
+  if (cmds.empty())
+    return;
+
+  SHIM_TRACE_POINT_SCOPE1(submit_commands, cmds.size());
+  std::vector<const cmd_buffer *> bohs;
+  for (auto cmd : cmds)
+    bohs.push_back(static_cast<cmd_buffer*>(cmd));
+
+  m_submitted.fetch_add(bohs.size(), std::memory_order_relaxed);
+  for (auto boh : bohs) {
+    dump_arg_bos(boh);
+    boh->request_timestamps();
+    record_cmd(boh);
   }
+
+  submit_batch(bohs, [this, &bohs] (std::vector<uint64_t>& seqs) { issue_commands(bohs, seqs); });
+}
+
+void
+hwq::
+submit_batch(const std::vector<const cmd_buffer *>& bohs,
+  const std::function<void(std::vector<uint64_t>&)>& issue)
+{
+  std::shared_lock<std::shared_mutex> shared_lock(m_mutex, std::defer_lock);
+  lock_producer(shared_lock);
+  // If pending queue is not empty, all cmds have to go after pending ones.
+  if (!pending_queue_empty()) {
+    shared_lock.unlock();
+    std::unique_lock<std::shared_mutex> lock(m_mutex, std::defer_lock);
+    lock_producer(lock);
+    if (!pending_queue_empty()) {
+      shim_debug("Enqueuing %ld commands after command %ld", bohs.size(), m_last_seq.load());
+      for (auto boh : bohs) {
+        boh->mark_enqueued();
+        push_to_pending_queue(boh, 0, pending_cmd_type::io);
+      }
+      return;
+    }
+    // Drained while we were waiting for the lock, issue under exclusive lock.
+    issue_and_mark_submitted(bohs, issue);
+    return;
+  }
+  issue_and_mark_submitted(bohs, issue);
+}
+
+void
+hwq::
+issue_and_mark_submitted(const std::vector<const cmd_buffer *>& bohs)
+{
+  issue_and_mark_submitted(bohs, [this, &bohs] (std::vector<uint64_t>& seqs) {
+    issue_commands(bohs, seqs);
+  });
+}
+
+void
+hwq::
+issue_and_mark_submitted(const std::vector<const cmd_buffer *>& bohs,
+  const std::function<void(std::vector<uint64_t>&)>& issue)
+{
+  std::vector<uint64_t> seqs;
+  try {
+    issue(seqs);
+  }
+  catch (...) {
+    // Whatever has been issued still needs to be waitable.
+    for (size_t i = 0; i < seqs.size(); i++)
+      bohs[i]->mark_submitted(seqs[i]);
+    if (!seqs.empty())
+      update_last_seq(seqs.back());
+    throw;
+  }
+  for (size_t i = 0; i < seqs.size(); i++)
+    bohs[i]->mark_submitted(seqs[i]);
+  update_last_seq(seqs.back());
 }
 
 void
 hwq::
 submit_wait(const xrt_core::fence_handle* f)
 {
-  std::unique_lock<std::mutex> lock(m_mutex);
   auto fh = static_cast<const fence*>(f);
-  shim_debug("Enqueuing wait fence %s after command %ld", fh->describe().c_str(), m_last_seq);
-  push_to_pending_queue(lock, fh, fh->next_wait_state(), pending_cmd_type::wait);
+  record_fence(cmd_graph::node_type::wait, fh);
+
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  auto state = fh->next_wait_state();
+  trace_stream::emit_fence(trace_stream::event::fence_wait, fh, state);
+
+  uint64_t seq;
+  if (pending_queue_empty() && issue_wait(fh, state, seq)) {
+    shim_debug("Submitted wait fence %s to driver (%ld)", fh->describe().c_str(), seq);
+    update_last_seq(seq);
+    return;
+  }
+  shim_debug("Enqueuing wait fence %s after command %ld", fh->describe().c_str(), m_last_seq.load());
+  push_to_pending_queue(fh, state, pending_cmd_type::wait);
 }
 
 void
 hwq::
 submit_signal(const xrt_core::fence_handle* f)
 {
-  std::unique_lock<std::mutex> lock(m_mutex);
   auto fh = static_cast<const fence*>(f);
-  shim_debug("Enqueuing signal fence %s after command %ld", fh->describe().c_str(), m_last_seq);
-  push_to_pending_queue(lock, fh, fh->next_signal_state(), pending_cmd_type::signal);
+  record_fence(cmd_graph::node_type::signal, fh);
+
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  auto state = fh->next_signal_state();
+  trace_stream::emit_fence(trace_stream::event::fence_signal, fh, state);
+
+  if (pending_queue_empty() && issue_signal(fh, state)) {
+    shim_debug("Submitted signal fence %s to driver after command %ld",
+      fh->describe().c_str(), m_last_seq.load());
+    return;
+  }
+  shim_debug("Enqueuing signal fence %s after command %ld", fh->describe().c_str(), m_last_seq.load());
+  push_to_pending_queue(fh, state, pending_cmd_type::signal);
+}
+
+void
+hwq::
+submit_wait(const std::vector<std::pair<const hwq*, xrt_core::buffer_handle*>>& cmds)
+{
+  std::vector<std::pair<uint32_t, uint64_t>> deps;
+  for (auto& c : cmds) {
+    if (&c.first->m_pdev != &m_pdev)
+      shim_err(EINVAL, "Can't wait for cmds from different devices");
+    deps.push_back({ c.first->m_ctx->get_slotidx(),
+      static_cast<cmd_buffer*>(c.second)->wait_for_submitted() });
+  }
+  if (deps.empty())
+    return;
+
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+  uint64_t seq;
+  if (pending_queue_empty() && issue_peer_wait(deps, seq)) {
+    shim_debug("Submitted wait for %ld cmds of other hwqs to driver (%ld)", deps.size(), seq);
+    update_last_seq(seq);
+    return;
+  }
+  shim_debug("Enqueuing wait for %ld cmds of other hwqs after command %ld", deps.size(),
+    m_last_seq.load());
+  for (size_t i = 0; i < cmds.size(); i++)
+    push_to_pending_queue(nullptr, deps[i].second, pending_cmd_type::peer_wait, cmds[i].first);
+}
+
+void
+hwq::
+record_cmd(const cmd_buffer *cmd)
+{
+  if (!m_capturing.load(std::memory_order_relaxed))
+    return;
+
+  const std::lock_guard<std::mutex> lock(m_capture_lock);
+  if (m_capture)
+    m_capture->add_cmd(cmd);
+}
+
+void
+hwq::
+record_fence(cmd_graph::node_type type, const fence *f)
+{
+  if (!m_capturing.load(std::memory_order_relaxed))
+    return;
+
+  const std::lock_guard<std::mutex> lock(m_capture_lock);
+  if (m_capture)
+    m_capture->add_fence(type, f);
+}
+
+void
+hwq::
+begin_capture()
+{
+  const std::lock_guard<std::mutex> lock(m_capture_lock);
+  if (m_capture)
+    shim_err(EBUSY, "Capture is already in progress");
+  m_capture = std::make_unique<cmd_graph>();
+  m_capturing = true;
+}
+
+std::unique_ptr<cmd_graph>
+hwq::
+end_capture()
+{
+  const std::lock_guard<std::mutex> lock(m_capture_lock);
+  if (!m_capture)
+    shim_err(EINVAL, "No capture in progress");
+  m_capturing = false;
+  m_capture->finalize();
+  shim_debug("Captured %ld nodes, %ld commands",
+    m_capture->get_nodes().size(), m_capture->get_num_cmds());
+  return std::move(m_capture);
+}
+
+void
+hwq::
+replay(const cmd_graph& graph)
+{
+  SHIM_TRACE_POINT_SCOPE1(replay, graph.get_num_cmds());
+
+  // Cmd BOs are re-used as they are, none of them can be in flight.
+  for (auto& n : graph.get_nodes()) {
+    for (auto cmd : n.m_batch.m_cmds) {
+      auto pkt = reinterpret_cast<ert_packet*>(cmd->vaddr());
+      if (!is_cmd_state_done(pkt->state))
+        shim_err(EBUSY, "Command BO %d of graph is still in flight", cmd->id().handle);
+    }
+  }
+
+  for (auto& n : graph.get_nodes()) {
+    switch (n.m_type) {
+    case cmd_graph::node_type::cmds: {
+      auto& b = n.m_batch;
+      for (auto cmd : b.m_cmds) {
+        reinterpret_cast<ert_packet*>(cmd->vaddr())->state = ERT_CMD_STATE_NEW;
+        dump_arg_bos(cmd);
+        cmd->request_timestamps();
+        record_cmd(cmd);
+      }
+      submit_batch(b.m_cmds, [this, &b] (std::vector<uint64_t>& seqs) {
+        issue_graph_batch(b, seqs);
+      });
+      break;
+    }
+    case cmd_graph::node_type::wait:
+      submit_wait(n.m_fence);
+      break;
+    case cmd_graph::node_type::signal:
+      submit_signal(n.m_fence);
+      break;
+    }
+  }
 }
 
 bool
@@ -257,79 +1291,108 @@ bool
 hwq::
 pending_queue_full() const
 {
-  return (m_pending_producer - m_pending_consumer) == m_pending.size();
+  return (m_pending_producer - m_pending_consumer) == m_pending_depth;
 }
 
 uint64_t
 hwq::
 pending_queue_consumer_idx() const
 {
-  return (m_pending_consumer & (m_pending.size() - 1));
+  return (m_pending_consumer & (m_pending_depth - 1));
 }
 
 uint64_t
 hwq::
 pending_queue_producer_idx() const
 {
-  return (m_pending_producer & (m_pending.size() - 1));
+  return (m_pending_producer & (m_pending_depth - 1));
 }
 
-void
+bool
 hwq::
 process_pending_queue()
 {
-  uint64_t seq;
-  shim_debug("Pending queue thread started!");
-
-  std::unique_lock<std::mutex> lock(m_mutex);
-
-  while (!(m_pending_thread_stop && pending_queue_empty())) {
-
-    // Wait for new pending commands or quit indicator.
-    m_pending_consumer_cv.wait(lock,
-      [this]() { return m_pending_thread_stop || !pending_queue_empty(); });
-
-    // Process all pending commands in queued order.
-    if (!pending_queue_empty()) {
-      // Releasing the lock, allow others to add to the pending queue while
-      // it is being processed. The pending cmd is processed in this single
-      // thread, so no need for any locking.
-      lock.unlock();
-
-      pending_cmd& c = m_pending[pending_queue_consumer_idx()];
-      switch (c.m_type) {
-      case pending_cmd_type::io: {
-        auto boh = reinterpret_cast<const cmd_buffer*>(c.m_cmd);
-        seq = issue_command(boh);
-        boh->mark_submitted(seq);
-        break;
+  // Taking turns with other hwqs on the same workers
+  for (size_t n = 0; n < m_pending_depth && !pending_queue_empty(); n++) {
+    // The pending cmd is processed by one worker at a time and the slot is
+    // not reused by producer until consumer index moves, so no need for
+    // any locking here.
+    pending_cmd& c = m_pending[pending_queue_consumer_idx()];
+    switch (c.m_type) {
+    case pending_cmd_type::io: {
+      // Cmds queued back to back are independent of each other, issue them
+      // together the same way as submit_commands() does.
+      std::vector<const cmd_buffer *> bohs;
+      for (auto i = m_pending_consumer.load(); i != m_pending_producer; i++) {
+        auto& p = m_pending[i & (m_pending_depth - 1)];
+        if (p.m_type != pending_cmd_type::io)
+          break;
+        bohs.push_back(reinterpret_cast<const cmd_buffer*>(p.m_cmd));
       }
-      case pending_cmd_type::signal: {
-        auto fh = reinterpret_cast<const fence*>(c.m_cmd);
-        if (c.m_last_seq != INVALID_SEQ)
-          wait_command(c.m_last_seq, 0);
-        fh->signal(c.m_fence_state);
-        break;
-      }
-      case pending_cmd_type::wait: {
-        auto fh = reinterpret_cast<const fence*>(c.m_cmd);
-        fh->wait(c.m_fence_state);
-        break;
-      }
-      default:
-        shim_err(EINVAL, "Bad pending cmd!");
-        break;
+      issue_and_mark_submitted(bohs);
+      // The last one is moved past below
+      m_pending_consumer += bohs.size() - 1;
+      n += bohs.size() - 1;
+      break;
+    }
+    case pending_cmd_type::signal: {
+      // All commands queued before this signal have been issued by now.
+      // Give the worker back to others while they are still running.
+      auto fh = reinterpret_cast<const fence*>(c.m_cmd);
+      uint64_t last_seq = m_last_seq;
+      if (last_seq != INVALID_SEQ && !wait_command(last_seq, pending_block_slice_ms))
+        return true;
+      fh->signal(c.m_fence_state);
+      break;
+    }
+    case pending_cmd_type::wait: {
+      // Fence may be signaled by pending queue of another hwq on the same
+      // workers, don't hold on to the worker until then.
+      auto fh = reinterpret_cast<const fence*>(c.m_cmd);
+      if (!fh->is_signaled(c.m_fence_state)) {
+        try {
+          fh->wait(c.m_fence_state, pending_block_slice_ms);
+        }
+        catch (const xrt_core::system_error& ex) {
+          if (ex.get_code() != ETIME)
+            throw;
+          return true;
+        }
       }
+      break;
+    }
+    case pending_cmd_type::peer_wait: {
+      // Same as fence wait, don't hold on to the worker until cmd is done.
+      if (!c.m_peer->wait_command(c.m_fence_state, pending_block_slice_ms))
+        return true;
+      break;
+    }
+    default:
+      shim_err(EINVAL, "Bad pending cmd!");
+      break;
+    }
 
-      lock.lock();
-      if (c.m_type == pending_cmd_type::io)
-        m_last_seq = seq;
-      m_pending_consumer++;
+    m_pending_consumer++;
+
+    // Only bother the producer when it is sleeping on a full queue.
+    if (m_pending_producer_waiting) {
+      std::lock_guard<std::mutex> lock(m_pending_mutex);
       m_pending_producer_cv.notify_all();
     }
   }
 
-  shim_debug("Pending queue thread stopped!");
+  if (!pending_queue_empty())
+    return true;
+
+  // Producer seeing m_pending_scheduled still set before it is cleared below
+  // has made its cmd visible, which is picked up by the re-check. After the
+  // lock is dropped, hwq may be gone.
+  std::lock_guard<std::mutex> lock(m_pending_mutex);
+  m_pending_scheduled = false;
+  if (!pending_queue_empty() && !m_pending_scheduled.exchange(true))
+    return true;
+  m_pending_producer_cv.notify_all();
+  return false;
 }
 
 }
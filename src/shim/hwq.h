@@ -8,10 +8,163 @@
 #include "hwctx.h"
 #include "buffer.h"
 #include "core/common/shim/hwqueue_handle.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
 #include <thread>
+#include <vector>
 
 namespace shim_xdna {
 
+// Sequence of cmd submissions and fence waits/signals recorded on a hwq
+// between hwq::begin_capture() and hwq::end_capture(), which can be
+// submitted again as a whole by hwq::replay(). Recorded cmd BOs and fences
+// are referenced, not owned, and must outlive the graph. Arg BOs of the cmds
+// are resolved at capture, they must not be re-bound afterwards.
+class cmd_graph
+{
+public:
+  // Consecutive cmds, up to the max driver takes in one submission, with
+  // their BO lists resolved ahead of time.
+  struct batch {
+    std::vector<const cmd_buffer *> m_cmds;
+    std::vector<bo_id> m_cmd_bos;
+    std::vector<uint32_t> m_arg_bo_hdls;
+  };
+
+  enum class node_type
+  {
+    cmds,
+    wait,
+    signal,
+  };
+  struct node {
+    node_type m_type;
+    batch m_batch;
+    const fence* m_fence = nullptr;
+  };
+
+  const std::vector<node>&
+  get_nodes() const
+  { return m_nodes; }
+
+  size_t
+  get_num_cmds() const;
+
+private:
+  friend class hwq;
+
+  void
+  add_cmd(const cmd_buffer *cmd);
+
+  void
+  add_fence(node_type type, const fence *f);
+
+  // Resolve BO lists of all batches, done once capture ends.
+  void
+  finalize();
+
+  std::vector<node> m_nodes;
+};
+
+class hwq;
+
+// Worker threads processing pending queues of all hwqs of a device, rather
+// than one sleeping thread per hwq. A hwq is handed to one worker at a time,
+// so its pending cmds are still processed in order. Threads are started on
+// first use, Runtime.hwq_pending_threads of them, bound to device local CPUs.
+class pending_pool
+{
+public:
+  pending_pool(const pdev& pdev);
+  ~pending_pool();
+
+  // Queue hwq for a worker, caller has won hwq::m_pending_scheduled.
+  void
+  schedule(hwq *q);
+
+private:
+  void
+  worker();
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::deque<hwq *> m_ready;
+  std::vector<std::thread> m_threads;
+  bool m_stop = false;
+};
+
+// Single thread per device finding completed cmds which have a completion
+// callback registered, see hwq::add_completion_callback(), so that runtimes
+// don't need one blocking waiter per stream. All watched cmds are waited for
+// in one trip to driver, in slices, so that cmds watched in the meantime are
+// picked up. Watched fences are checked, in one ioctl, after each slice.
+// Started on first use, bound to device local CPUs.
+class cmd_reaper
+{
+public:
+  // Called with ERT state of cmd, which is completed or failed.
+  using callback_type = std::function<void(uint32_t)>;
+  // Runs a callback. By default, it is run right on the reaper thread,
+  // which is then held up by it.
+  using executor_type = std::function<void(std::function<void()>)>;
+
+  cmd_reaper(const pdev& pdev);
+  ~cmd_reaper();
+
+  void
+  set_executor(executor_type exec);
+
+  void
+  add(const hwq *q, xrt_core::buffer_handle *cmd, callback_type cb);
+
+  // Run cb on executor once state of f is signaled. f must stay alive
+  // till then.
+  void
+  add_fence(const fence *f, uint64_t state, std::function<void()> cb);
+
+  // Drop callbacks of all cmds of q, which must not be waited for anymore.
+  void
+  forget(const hwq *q);
+
+  // Run cb with state of cmd on executor.
+  void
+  run(xrt_core::buffer_handle *cmd, const callback_type& cb);
+
+private:
+  struct entry {
+    const hwq *m_q;
+    xrt_core::buffer_handle *m_cmd;
+    callback_type m_cb;
+  };
+  struct fence_entry {
+    const fence *m_fence;
+    uint64_t m_state;
+    std::function<void()> m_cb;
+  };
+
+  void
+  reaper();
+
+  executor_type
+  get_executor();
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::vector<entry> m_cmds;
+  std::vector<fence_entry> m_fences;
+  // Set while reaper thread is waiting for a snapshot of m_cmds
+  bool m_busy = false;
+  bool m_stop = false;
+  executor_type m_exec;
+  std::thread m_thread;
+};
+
 class hwq : public xrt_core::hwqueue_handle
 {
 public:
@@ -27,17 +180,45 @@ public:
   int
   wait_command(xrt_core::buffer_handle *, uint32_t timeout_ms) const override;
 
+  // Wait for cmds, possibly from different hwqs of the same device, in one
+  // trip to driver. Waits for all of them if wait_all is set, otherwise for
+  // any of them. Returns completion status of each cmd, cmds completed before
+  // timeout are still reported.
+  static std::vector<bool>
+  wait_commands(const std::vector<std::pair<const hwq*, xrt_core::buffer_handle*>>& cmds,
+    bool wait_all, uint32_t timeout_ms);
+
   void
   submit_wait(const xrt_core::fence_handle*) override;
 
   void
   submit_signal(const xrt_core::fence_handle*) override;
 
+  // Cmds submitted to this queue afterwards wait for cmds of other hwqs of
+  // the same device, e.g. output of one stage on another partition, to
+  // complete. With driver support, the wait is resolved in driver, right on
+  // their completion, without host involvement. Otherwise, it is done by the
+  // pending queue. Waited cmds must have been submitted.
+  void
+  submit_wait(const std::vector<std::pair<const hwq*, xrt_core::buffer_handle*>>& cmds);
+
   std::unique_ptr<xrt_core::fence_handle>
   import(xrt_core::fence_handle::export_handle) override
   { shim_not_supported_err(__func__); }
 
 public:
+  // Submit a batch of independent cmds, which may be issued to driver
+  // all together, if supported.
+  void
+  submit_commands(const std::vector<xrt_core::buffer_handle *>& cmds);
+
+  // Have cb called on the reaper thread of device, with ERT state of cmd,
+  // once cmd has completed or failed. cmd must not be freed or submitted
+  // again till then. Callbacks of cmds still running when hwctx is gone are
+  // dropped.
+  void
+  add_completion_callback(xrt_core::buffer_handle *cmd, cmd_reaper::callback_type cb);
+
   virtual void
   bind_hwctx(const hwctx& ctx);
 
@@ -47,6 +228,29 @@ public:
   virtual bo_id
   get_queue_bo() const = 0;
 
+  // Moving average of cmd wait time and number of cmds submitted so far,
+  // profile of this queue for deriving QoS of later hwctx.
+  uint64_t
+  get_avg_wait_us() const
+  { return m_avg_wait_us; }
+
+  uint64_t
+  get_submitted() const
+  { return m_submitted; }
+
+  // Record all submissions on this queue, from any thread, till
+  // end_capture(). Recorded submissions are still carried out as usual.
+  void
+  begin_capture();
+
+  std::unique_ptr<cmd_graph>
+  end_capture();
+
+  // Submit everything recorded in graph again, in recorded order. All cmds
+  // of graph must have completed.
+  void
+  replay(const cmd_graph& graph);
+
 protected:
   const pdev& m_pdev;
   const hwctx* m_ctx = nullptr;
@@ -54,23 +258,112 @@ protected:
   int
   wait_command(uint64_t seq, uint32_t timeout_ms) const;
 
+  // Poll till done() returns true or budget_us runs out, without going into
+  // driver. Spins briefly, then backs off with growing sleeps. Returns the
+  // last result of done().
+  static bool
+  backoff_wait(const std::function<bool()>& done, uint64_t budget_us);
+
+  // Whether cmd in ERT state is done. SUBMITTED comes after COMPLETED in
+  // numbers, but cmd is still in flight.
+  static bool
+  is_cmd_state_done(uint32_t state);
+
 private:
+  // Wait for cmd completion in user space after spinning has missed.
+  // Return false if it can't be done, then, driver is called to wait.
+  virtual bool
+  user_wait_command(const cmd_buffer *cmd, uint32_t timeout_ms) const
+  { return false; }
+
+  // Spin on cmd state for up to the adaptive spin budget. Returns true if
+  // cmd is done during spinning.
+  bool
+  spin_wait_command(const cmd_buffer *cmd, uint32_t timeout_ms) const;
+
+  uint64_t
+  get_spin_budget_us() const;
+
+  void
+  record_wait_time(uint64_t us) const;
+
+  // Moving average of recent cmd wait time, used to size spin budget.
+  // Updated by waiters, kept off the lines of submission path.
+  alignas(64) mutable std::atomic<uint64_t> m_avg_wait_us = 0;
+  mutable std::atomic<uint64_t> m_spin_hit = 0;
+  mutable std::atomic<uint64_t> m_spin_miss = 0;
+  std::atomic<uint64_t> m_submitted = 0;
+
   enum class pending_cmd_type
   {
     io,
     signal,
     wait,
+    // Wait for cmd of seq m_fence_state on hwq m_peer
+    peer_wait,
   };
   struct pending_cmd {
     pending_cmd_type m_type;
     const void* m_cmd = nullptr;
     uint64_t m_fence_state;
-    uint64_t m_last_seq;
+    const hwq *m_peer = nullptr;
   };
 
   virtual uint64_t
   issue_command(const cmd_buffer *) = 0;
 
+  // Hand fence wait/signal over to driver so that it is done in between
+  // device cmds without host involvement. Return false if it can't be done,
+  // then, it is done by the pending queue thread. For wait, seq is set to
+  // the seq of the cmd which waits for the fence in driver.
+  virtual bool
+  issue_wait(const fence *f, uint64_t state, uint64_t& seq)
+  { return false; }
+
+  virtual bool
+  issue_signal(const fence *f, uint64_t state)
+  { return false; }
+
+  // Same as issue_wait(), for cmds of other hwqs, as ctx handle and seq.
+  virtual bool
+  issue_peer_wait(const std::vector<std::pair<uint32_t, uint64_t>>& cmds, uint64_t& seq)
+  { return false; }
+
+  // Issue cmds in order and append their seq to seqs as they are issued.
+  // By default, this is done one cmd at a time.
+  virtual void
+  issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs);
+
+  // Issue a batch of recorded cmds. By default, BO lists are resolved again.
+  virtual void
+  issue_graph_batch(const cmd_graph::batch& b, std::vector<uint64_t>& seqs)
+  { issue_commands(b.m_cmds, seqs); }
+
+  // Issue cmds by issue(), which appends their seq to seqs as they are
+  // issued, then mark them submitted.
+  void
+  issue_and_mark_submitted(const std::vector<const cmd_buffer *>& cmds,
+    const std::function<void(std::vector<uint64_t>&)>& issue);
+
+  void
+  issue_and_mark_submitted(const std::vector<const cmd_buffer *>& cmds);
+
+  // Submit cmds after whatever is in pending queue, by issue() if they can
+  // be issued to driver right away.
+  void
+  submit_batch(const std::vector<const cmd_buffer *>& cmds,
+    const std::function<void(std::vector<uint64_t>&)>& issue);
+
+  void
+  record_cmd(const cmd_buffer *cmd);
+
+  void
+  record_fence(cmd_graph::node_type type, const fence *f);
+
+  std::atomic<bool> m_capturing = false;
+  std::mutex m_capture_lock;
+  std::unique_ptr<cmd_graph> m_capture;
+
   bool
   pending_queue_empty() const;
 
@@ -83,24 +376,69 @@ private:
   uint64_t
   pending_queue_producer_idx() const;
 
-  void
+  friend class pending_pool;
+
+  // Process pending cmds in order for a while, on a pending_pool worker.
+  // Returns false once queue is empty and hwq is no longer scheduled, true
+  // if it has to be scheduled again for the rest.
+  bool
   process_pending_queue();
 
   void
-  push_to_pending_queue(std::unique_lock<std::mutex>& lock,
-    const void *cmd, uint64_t fence_state, pending_cmd_type type);
+  push_to_pending_queue(const void *cmd, uint64_t fence_state, pending_cmd_type type,
+    const hwq *peer = nullptr);
+
+  void
+  wait_pending_queue_not_full();
+
+  // Take m_mutex for a producer, counting how often and how long it had to
+  // wait for it.
+  template <typename L>
+  void
+  lock_producer(L& lock);
 
-  std::mutex m_mutex;
+  // Record seq of a cmd issued to driver. With concurrent issuers, the
+  // largest seq is kept, which is the one issued last.
+  void
+  update_last_seq(uint64_t seq);
+
+  // Submission state below is split by writer, submitting threads on one
+  // cacheline and pending queue consumer on another, so that they don't
+  // keep invalidating each other's line on every cmd.
+
+  // Producers issuing cmds directly to driver take m_mutex shared, so that
+  // independent threads do not serialize on each other. Anyone who needs
+  // an order against all other producers (fences and enqueuing to pending
+  // queue) takes it exclusive.
+  alignas(64) std::shared_mutex m_mutex;
   const uint64_t INVALID_SEQ = 0xffffffffffffffff;
-  uint64_t m_last_seq = INVALID_SEQ;
+  std::atomic<uint64_t> m_last_seq = INVALID_SEQ;
+  std::atomic<uint64_t> m_pending_producer = 0;
+  // Number of times and total time producers were blocked on a full ring.
+  uint64_t m_pending_stall_cnt = 0;
+  uint64_t m_pending_stall_us = 0;
+  // Number of times and total time producers were blocked on m_mutex.
+  std::atomic<uint64_t> m_lock_wait_cnt = 0;
+  std::atomic<uint64_t> m_lock_wait_us = 0;
+
+  // Written by consumer only.
+  alignas(64) std::atomic<uint64_t> m_pending_consumer = 0;
 
-  bool m_pending_thread_stop = false;
-  std::array<pending_cmd, 1> m_pending;
+  // Pending queue is a single producer (exclusive m_mutex holder), single
+  // consumer (whichever pending_pool worker has the hwq) ring. Producer and
+  // consumer only meet on m_pending_mutex when the ring is full, or when
+  // consumer gives the hwq up.
+  alignas(64) std::atomic<bool> m_pending_thread_stop = false;
+  // Power of 2, see Runtime.hwq_pending_depth.
+  const size_t m_pending_depth;
+  std::vector<pending_cmd> m_pending;
+  std::mutex m_pending_mutex;
   std::condition_variable m_pending_producer_cv;
-  std::condition_variable m_pending_consumer_cv;
-  uint64_t m_pending_consumer = 0;
-  uint64_t m_pending_producer = 0;
-  std::thread m_pending_thread;
+  std::atomic<bool> m_pending_producer_waiting = false;
+  // Set while hwq is queued in or being processed by m_pending_pool
+  std::atomic<bool> m_pending_scheduled = false;
+  std::shared_ptr<pending_pool> m_pending_pool;
+  std::shared_ptr<cmd_reaper> m_cmd_reaper;
 };
 
 }
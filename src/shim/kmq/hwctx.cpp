@@ -3,12 +3,13 @@
 
 #include "hwq.h"
 #include "hwctx.h"
+#include "../trace_recorder.h"
 
 namespace {
 
 // For debug only
 void
-print_cu_config(amdxdna_hwctx_param_config_cu *config)
+print_cu_config(const amdxdna_hwctx_param_config_cu *config)
 {
   auto n = config->num_cus;
   auto conf = config->cu_configs;
@@ -25,35 +26,19 @@ hwctx_kmq::
 hwctx_kmq(const device& device, const xrt::xclbin& xclbin, const qos_type& qos)
   : hwctx(device, qos, xclbin, std::make_unique<hwq_kmq>(device))
 {
-  xclbin_parser xp(xclbin);
-  std::vector<char> cu_conf_param_buf(
-    sizeof(amdxdna_hwctx_param_config_cu) + xp.get_num_cus() * sizeof(amdxdna_cu_config));
-  auto cu_conf_param = reinterpret_cast<amdxdna_hwctx_param_config_cu *>(cu_conf_param_buf.data());
-
-  cu_conf_param->num_cus = xp.get_num_cus();
-  xcl_bo_flags f = {};
-  f.flags = XRT_BO_FLAGS_CACHEABLE;
-  for (int i = 0; i < cu_conf_param->num_cus; i++) {
-    auto& pdi = xp.get_cu_pdi(i);
-    auto bo = alloc_bo(pdi.size(), f.all);
-    m_pdi_bos.emplace_back(dynamic_cast<buffer*>(bo.release()));
-
-    auto& pdi_bo = m_pdi_bos[i];
-    auto pdi_vaddr = reinterpret_cast<char *>(pdi_bo->vaddr());
-
-    auto& cf = cu_conf_param->cu_configs[i];
-    std::memcpy(pdi_vaddr, pdi.data(), pdi.size());
-    pdi_bo->sync(xrt_core::buffer_handle::direction::host2device, pdi_bo->size(), 0);
-    cf.cu_bo = pdi_bo->id().handle;
-    cf.cu_func = xp.get_cu_func(i);
+  {
+    // PDIs are registered as BOs here, unless cached by device already
+    SHIM_TRACE_POINT_SCOPE1(hwctx_register_pdi, get_slotidx());
+    m_cu_config = device.get_cu_config(xclbin, *device.get_xclbin_parser(xclbin));
   }
-
-  //print_cu_config(cu_conf_param);
+  //print_cu_config(reinterpret_cast<const amdxdna_hwctx_param_config_cu *>(
+  //  m_cu_config->m_conf_buf.data()));
 
   config_ctx_cu_config_arg arg = {
     .ctx_handle = get_slotidx(),
-    .conf_buf = cu_conf_param_buf,
+    .conf_buf = m_cu_config->m_conf_buf,
   };
+  SHIM_TRACE_POINT_SCOPE1(hwctx_config_cu, get_slotidx());
   device.get_pdev().drv_ioctl(drv_ioctl_cmd::config_ctx_cu_config, &arg);
 
   shim_debug("Created KMQ HW context (%d)", get_slotidx());
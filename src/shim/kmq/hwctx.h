@@ -8,6 +8,14 @@
 
 namespace shim_xdna {
 
+// PDI BOs and CU config built from an xclbin, shared by all hwctx created
+// from the same xclbin, see device::get_cu_config(). PDI BOs are further
+// shared by content with CU configs of other xclbins.
+struct cu_config {
+  std::vector< std::shared_ptr<buffer> > m_pdi_bos;
+  std::vector<char> m_conf_buf;
+};
+
 class hwctx_kmq : public hwctx {
 public:
   hwctx_kmq(const device& dev, const xrt::xclbin& xclbin, const qos_type& qos);
@@ -15,7 +23,8 @@ public:
   ~hwctx_kmq();
 
 private:
-  std::vector< std::unique_ptr<buffer> > m_pdi_bos;
+  // Keeps PDI BOs alive, firmware may reload PDIs while hwctx is alive.
+  std::shared_ptr<const cu_config> m_cu_config;
 };
 
 }
@@ -2,11 +2,48 @@
 // Copyright (C) 2023-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "hwq.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Room for firmware slot header of each sub-cmd in a prebuilt cmdlist.
+const size_t max_slot_header_size = 64;
+
+bool
+get_cmd_chain_prebuild()
+{
+  static bool prebuild =
+    xrt_core::config::detail::get_bool_value("Runtime.cmd_chain_prebuild", true);
+  return prebuild;
+}
+
+// Bytes of sub-cmd payload in front of its args, which firmware cmdlist slot
+// keeps apart from the args. Sub-cmds of other ops are not prebuilt.
+bool
+get_subcmd_arg_offset(uint32_t opcode, size_t& offset)
+{
+  switch (opcode) {
+  case ERT_START_CU:
+    offset = 0;
+    return true;
+  case ERT_START_NPU:
+    // Instruction buffer address, size and property count
+    offset = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    return true;
+  default:
+    return false;
+  }
+}
+
+}
 
 namespace shim_xdna {
 
 hwq_kmq::
 hwq_kmq(const device& device) : hwq(device)
+  , m_chain_prebuild(get_cmd_chain_prebuild())
 {
   shim_debug("Created KMQ HW queue");
 }
@@ -17,20 +54,292 @@ hwq_kmq::
   shim_debug("Destroying KMQ HW queue");
 }
 
+void
+hwq_kmq::
+prepare_chain(const cmd_buffer *cmd_bo)
+{
+  auto cmd = reinterpret_cast<ert_packet *>(cmd_bo->vaddr());
+  if (!m_chain_prebuild || cmd->opcode != ERT_CMD_CHAIN)
+    return;
+  auto& cl = cmd_bo->get_chain_cmdlist();
+  if (cl.unsupported)
+    return;
+
+  // Everything but sub-cmd args has to stay the same for the list to be
+  // reused, args are copied into the list before each submission.
+  auto chain = get_ert_cmd_chain_data(cmd);
+  std::vector<uint32_t> snapshot = { chain->command_count };
+  std::vector< std::pair<const void *, size_t> > args;
+  size_t list_size = 0;
+  for (uint32_t i = 0; i < chain->command_count; i++) {
+    auto subcmd_bo = static_cast<const cmd_buffer *>(m_pdev.find_bo_by_handle(chain->data[i]));
+    auto subcmd = subcmd_bo ?
+      reinterpret_cast<ert_start_kernel_cmd *>(subcmd_bo->vaddr()) : nullptr;
+    size_t arg_off = 0;
+    if (!subcmd || !get_subcmd_arg_offset(subcmd->opcode, arg_off) ||
+      subcmd->count < 1 + subcmd->extra_cu_masks + arg_off / sizeof(uint32_t)) {
+      shim_debug("Chain BO %d can't be prebuilt", cmd_bo->id().handle);
+      cl.unsupported = true;
+      return;
+    }
+
+    auto masks = &subcmd->cu_mask;
+    auto payload = masks + 1 + subcmd->extra_cu_masks;
+    auto arg_start = payload + arg_off / sizeof(uint32_t);
+    auto end = &subcmd->cu_mask + subcmd->count;
+    snapshot.push_back(static_cast<uint32_t>(chain->data[i]));
+    snapshot.push_back(subcmd->opcode);
+    snapshot.push_back(subcmd->count);
+    snapshot.insert(snapshot.end(), masks, arg_start);
+    args.push_back({ arg_start, (end - arg_start) * sizeof(uint32_t) });
+    list_size += (subcmd->count + 1) * sizeof(uint32_t) + max_slot_header_size;
+  }
+
+  auto ctx_handle = m_ctx->get_slotidx();
+  bool same = ctx_handle == cl.ctx_handle && snapshot == cl.snapshot;
+  if (cl.list_bo && same) {
+    auto list = reinterpret_cast<char *>(cl.list_bo->vaddr());
+    for (size_t i = 0; i < args.size(); i++)
+      std::memcpy(list + cl.offsets[i + 1] - args[i].second, args[i].first, args[i].second);
+    return;
+  }
+
+  if (cl.list_bo) {
+    // Chain was changed, this waits for cmds already submitted to the hwctx.
+    std::vector<uint32_t> none;
+    config_ctx_build_cmdlist_arg arg = {
+      .ctx_handle = cl.ctx_handle,
+      .cmd_bo = cmd_bo->id(),
+      .list_bo = {},
+      .offsets = none,
+    };
+    m_pdev.drv_ioctl(drv_ioctl_cmd::config_ctx_build_cmdlist, &arg);
+    cl.list_bo.reset();
+    shim_debug("Dropped cmdlist of changed chain BO %d", cmd_bo->id().handle);
+  }
+  cl.ctx_handle = ctx_handle;
+  cl.snapshot = std::move(snapshot);
+  // Only chains submitted again unchanged are worth building a list for.
+  if (!same)
+    return;
+
+  try {
+    cl.list_bo = std::make_unique<buffer>(m_pdev, list_size, AMDXDNA_BO_DEV);
+    cl.offsets.resize(args.size() + 1);
+    config_ctx_build_cmdlist_arg arg = {
+      .ctx_handle = ctx_handle,
+      .cmd_bo = cmd_bo->id(),
+      .list_bo = cl.list_bo->id(),
+      .offsets = cl.offsets,
+    };
+    m_pdev.drv_ioctl(drv_ioctl_cmd::config_ctx_build_cmdlist, &arg);
+  }
+  catch (const xrt_core::system_error& ex) {
+    auto err = ex.get_code();
+    cl.list_bo.reset();
+    cl.unsupported = true;
+    // Old driver or virtio, don't try again for any chain.
+    if (err == ENOTSUP || err == EOPNOTSUPP)
+      m_chain_prebuild = false;
+    shim_debug("Failed to prebuild cmdlist of chain BO %d, err=%d", cmd_bo->id().handle, err);
+    return;
+  }
+  shim_debug("Prebuilt cmdlist of chain BO %d, %ld sub-cmds",
+    cmd_bo->id().handle, args.size());
+}
+
 uint64_t
 hwq_kmq::
 issue_command(const cmd_buffer *cmd_bo)
 {
+  prepare_chain(cmd_bo);
+
+  std::vector<uint32_t> buf;
   submit_cmd_arg ecmd = {
     .ctx_handle = m_ctx->get_slotidx(),
     .cmd_bo = cmd_bo->id(),
-    .arg_bos = cmd_bo->get_arg_bo_ids(),
+    .arg_bo_hdls = m_pdev.filter_resident_bos(m_ctx->get_slotidx(),
+      cmd_bo->get_arg_bo_handles(), buf),
   };
   m_pdev.drv_ioctl(drv_ioctl_cmd::submit_cmd, &ecmd);
   shim_debug("Submitted command (%ld)", ecmd.seq);
   return ecmd.seq;
 }
 
+void
+hwq_kmq::
+issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs)
+{
+  const size_t max_batch = AMDXDNA_EXEC_CMD_MAX_BATCH;
+
+  for (size_t start = 0; start < cmds.size(); start += max_batch) {
+    auto end = std::min(start + max_batch, cmds.size());
+
+    if (!m_batch_submit || end - start == 1) {
+      for (auto i = start; i < end; i++)
+        seqs.push_back(issue_command(cmds[i]));
+      continue;
+    }
+
+    std::vector<bo_id> cmd_bos;
+    std::vector<uint32_t> arg_bo_hdls;
+    for (auto i = start; i < end; i++) {
+      prepare_chain(cmds[i]);
+      cmd_bos.push_back(cmds[i]->id());
+      auto& hdls = cmds[i]->get_arg_bo_handles();
+      arg_bo_hdls.insert(arg_bo_hdls.end(), hdls.begin(), hdls.end());
+    }
+    std::sort(arg_bo_hdls.begin(), arg_bo_hdls.end());
+    arg_bo_hdls.erase(std::unique(arg_bo_hdls.begin(), arg_bo_hdls.end()), arg_bo_hdls.end());
+
+    std::vector<uint32_t> buf;
+    issue_batch(cmds, start, end, cmd_bos,
+      m_pdev.filter_resident_bos(m_ctx->get_slotidx(), arg_bo_hdls, buf), seqs);
+  }
+}
+
+void
+hwq_kmq::
+issue_graph_batch(const cmd_graph::batch& b, std::vector<uint64_t>& seqs)
+{
+  if (!m_batch_submit || b.m_cmds.size() == 1) {
+    for (auto cmd : b.m_cmds)
+      seqs.push_back(issue_command(cmd));
+    return;
+  }
+  for (auto cmd : b.m_cmds)
+    prepare_chain(cmd);
+  std::vector<uint32_t> buf;
+  issue_batch(b.m_cmds, 0, b.m_cmds.size(), b.m_cmd_bos,
+    m_pdev.filter_resident_bos(m_ctx->get_slotidx(), b.m_arg_bo_hdls, buf), seqs);
+}
+
+void
+hwq_kmq::
+issue_batch(const std::vector<const cmd_buffer *>& cmds, size_t start, size_t end,
+  const std::vector<bo_id>& cmd_bos, const std::vector<uint32_t>& arg_bo_hdls,
+  std::vector<uint64_t>& seqs)
+{
+  // Driver takes no more than hwctx has room for, the rest goes in the next
+  // round, after some cmds are done.
+  for (size_t off = 0; start + off < end;) {
+    std::vector<bo_id> left;
+    if (off)
+      left.assign(cmd_bos.begin() + off, cmd_bos.end());
+    submit_cmds_arg ecmd = {
+      .ctx_handle = m_ctx->get_slotidx(),
+      .cmd_bos = off ? left : cmd_bos,
+      .arg_bo_hdls = arg_bo_hdls,
+    };
+    try {
+      m_pdev.drv_ioctl(drv_ioctl_cmd::submit_cmds, &ecmd);
+    }
+    catch (const xrt_core::system_error& ex) {
+      for (uint32_t i = 0; i < ecmd.submitted; i++)
+        seqs.push_back(ecmd.seq - ecmd.submitted + 1 + i);
+
+      auto err = ex.get_code();
+      if (ecmd.submitted || (err != EINVAL && err != ENOTSUP))
+        throw;
+
+      // Old driver or virtio rejects batches with EINVAL, but so does any
+      // driver for a bad cmd. Only stop batching if the same cmds can be
+      // submitted one by one.
+      shim_debug("Batched submission failed, err=%d, retrying one by one", err);
+      for (auto i = start + off; i < end; i++)
+        seqs.push_back(issue_command(cmds[i]));
+      if (m_batch_submit.exchange(false))
+        shim_debug("Batched submission is not supported, err=%d", err);
+      return;
+    }
+    if (!ecmd.submitted)
+      shim_err(EINVAL, "Driver submitted no command of batch");
+    for (uint32_t i = 0; i < ecmd.submitted; i++)
+      seqs.push_back(ecmd.seq - ecmd.submitted + 1 + i);
+    shim_debug("Submitted %d commands (%ld)", ecmd.submitted, ecmd.seq);
+    off += ecmd.submitted;
+  }
+}
+
+bool
+hwq_kmq::
+issue_wait(const fence *f, uint64_t state, uint64_t& seq)
+{
+  if (!m_driver_fence)
+    return false;
+
+  submit_fence_arg arg = {
+    .ctx_handle = m_ctx->get_slotidx(),
+    .syncobj_handle = f->get_syncobj(),
+    .timepoint = state,
+  };
+  try {
+    m_pdev.drv_ioctl(drv_ioctl_cmd::submit_dependency, &arg);
+  }
+  catch (const xrt_core::system_error& ex) {
+    // Fence is not submitted yet, let host wait for it.
+    if (ex.get_code() == EAGAIN)
+      return false;
+    if (ex.get_code() != ENOTSUP)
+      throw;
+    m_driver_fence = false;
+    return false;
+  }
+  seq = arg.seq;
+  return true;
+}
+
+bool
+hwq_kmq::
+issue_signal(const fence *f, uint64_t state)
+{
+  if (!m_driver_fence)
+    return false;
+
+  submit_fence_arg arg = {
+    .ctx_handle = m_ctx->get_slotidx(),
+    .syncobj_handle = f->get_syncobj(),
+    .timepoint = state,
+  };
+  try {
+    m_pdev.drv_ioctl(drv_ioctl_cmd::submit_signal, &arg);
+  }
+  catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ENOTSUP)
+      throw;
+    m_driver_fence = false;
+    return false;
+  }
+  return true;
+}
+
+bool
+hwq_kmq::
+issue_peer_wait(const std::vector<std::pair<uint32_t, uint64_t>>& cmds, uint64_t& seq)
+{
+  if (!m_driver_peer_wait)
+    return false;
+
+  submit_ctx_dep_arg arg = {
+    .ctx_handle = m_ctx->get_slotidx(),
+    .cmds = cmds,
+  };
+  try {
+    m_pdev.drv_ioctl(drv_ioctl_cmd::submit_ctx_dependency, &arg);
+  }
+  catch (const xrt_core::system_error& ex) {
+    // Older driver rejects the submission type as invalid.
+    auto err = ex.get_code();
+    if (err != ENOTSUP && err != EOPNOTSUPP && err != EINVAL)
+      throw;
+    shim_debug("Driver can't wait for cmds of other contexts, err %d", err);
+    m_driver_peer_wait = false;
+    return false;
+  }
+  seq = arg.seq;
+  return true;
+}
+
 bo_id
 hwq_kmq::
 get_queue_bo() const
@@ -18,8 +18,44 @@ public:
   get_queue_bo() const override;
 
 private:
+  // Cleared once driver turns down batched submission.
+  std::atomic<bool> m_batch_submit = true;
+  // Cleared once driver turns down fence wait/signal submission.
+  std::atomic<bool> m_driver_fence = true;
+  // Cleared once driver turns down waits for cmds of other contexts.
+  std::atomic<bool> m_driver_peer_wait = true;
+  // Cleared once driver turns down prebuilding cmdlist of chained cmds.
+  std::atomic<bool> m_chain_prebuild;
+
+  // Prebuild firmware cmdlist of a chained cmd once it is submitted again
+  // unchanged, afterwards only copy sub-cmd args into it. Driver then skips
+  // looking up and converting sub-cmds on each submission.
+  void
+  prepare_chain(const cmd_buffer *cmd_bo);
+
   uint64_t
   issue_command(const cmd_buffer *) override;
+
+  void
+  issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs) override;
+
+  void
+  issue_graph_batch(const cmd_graph::batch& b, std::vector<uint64_t>& seqs) override;
+
+  // Issue cmds[start, end) in one trip to driver with the BO lists given.
+  void
+  issue_batch(const std::vector<const cmd_buffer *>& cmds, size_t start, size_t end,
+    const std::vector<bo_id>& cmd_bos, const std::vector<uint32_t>& arg_bo_hdls,
+    std::vector<uint64_t>& seqs);
+
+  bool
+  issue_wait(const fence *f, uint64_t state, uint64_t& seq) override;
+
+  bool
+  issue_signal(const fence *f, uint64_t state) override;
+
+  bool
+  issue_peer_wait(const std::vector<std::pair<uint32_t, uint64_t>>& cmds, uint64_t& seq) override;
 };
 
 }
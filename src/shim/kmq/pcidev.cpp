@@ -5,6 +5,8 @@
 #include "pcidev.h"
 #include "core/common/config_reader.h"
 
+#include <algorithm>
+
 namespace {
 
 // Device memory heap needs to be multiple of 64MB page.
@@ -20,6 +22,12 @@ get_heap_num_pages()
   return num;
 }
 
+size_t
+heap_page_size_roundup(size_t size)
+{
+  return ((size + heap_page_size - 1) / heap_page_size) * heap_page_size;
+}
+
 }
 
 namespace shim_xdna {
@@ -28,11 +36,43 @@ void
 pdev_kmq::
 on_first_open() const
 {
-  auto heap_sz = heap_page_size * get_heap_num_pages();
-  // Alloc device memory on first device open.
+  // Device memory is alloc'ed on first hwctx or device BO creation, so that
+  // it can be sized for the xclbin and opening device for query is cheap.
+}
+
+void
+pdev_kmq::
+alloc_dev_heap(size_t size) const
+{
+  if (m_dev_heap_bo)
+    return;
+
+  auto heap_sz = std::max(heap_page_size * get_heap_num_pages(), heap_page_size_roundup(size));
   m_dev_heap_bo = std::make_unique<buffer>(*this, heap_sz, AMDXDNA_BO_DEV_HEAP);
 }
 
+void
+pdev_kmq::
+reserve_dev_heap(size_t size) const
+{
+  const std::lock_guard<std::mutex> lock(m_lock);
+  // Shim only uses the default heap, the first one created, which device BOs
+  // and hwctxs get when they name no heap. It is allocated in one go and
+  // never grown, so it can only be sized before it is ever used. Driver takes
+  // more heaps per process, but those only serve BOs and hwctxs created on
+  // them explicitly.
+  if (m_dev_heap_bo) {
+    amdxdna_drm_query_mem_info info;
+    // What is left in heap matters, not its size, already allocated BOs stay.
+    auto avail = get_mem_info(info) ? info.heap_free : m_dev_heap_bo->size();
+    if (size > avail) {
+      shim_debug("Device heap of %ld bytes has %ld bytes free, too few for %ld bytes of device BOs",
+        m_dev_heap_bo->size(), avail, size);
+    }
+  }
+  alloc_dev_heap(size);
+}
+
 void
 pdev_kmq::
 on_last_close() const
@@ -61,6 +101,13 @@ get_heap_vaddr() const
   return m_dev_heap_bo->vaddr();
 }
 
+bool
+pdev_kmq::
+has_dev_heap() const
+{
+  return true;
+}
+
 bool
 pdev_kmq::
 is_umq() const
@@ -77,16 +124,25 @@ create_drm_bo(bo_info *arg) const
     return;
   }
 
-  // Dynamically expanding heap buffer when allocating device BO.
-  const std::lock_guard<std::mutex> lock(m_lock);
+  {
+    const std::lock_guard<std::mutex> lock(m_lock);
+    alloc_dev_heap(arg->size);
+  }
+
   try {
     drv_ioctl(drv_ioctl_cmd::create_bo, arg);
   } catch (const xrt_core::system_error& ex) {
     if (ex.get_code() != ENOMEM)
       throw;
-    // Expanding current heap size and try one more time.
-    m_dev_heap_bo->expand(arg->size);
-    drv_ioctl(drv_ioctl_cmd::create_bo, arg);
+    // Heap can't grow once created, see reserve_dev_heap().
+    amdxdna_drm_query_mem_info info;
+    if (get_mem_info(info)) {
+      shim_err(ENOMEM, "Device heap of %ld bytes has %lld bytes free, largest free %lld bytes, "
+        "too few for %ld bytes BO, increase Debug.num_heap_pages", m_dev_heap_bo->size(),
+        info.heap_free, info.heap_largest_free, arg->size);
+    }
+    shim_err(ENOMEM, "Device heap of %ld bytes is exhausted, increase Debug.num_heap_pages",
+      m_dev_heap_bo->size());
   }
 }
 
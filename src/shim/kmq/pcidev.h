@@ -25,6 +25,12 @@ public:
   void *
   get_heap_vaddr() const override;
 
+  bool
+  has_dev_heap() const override;
+
+  void
+  reserve_dev_heap(size_t size) const override;
+
   bool
   is_umq() const override;
 
@@ -32,10 +38,14 @@ public:
   create_drm_bo(bo_info *arg) const override;
 
 private:
-  // Alloc'ed on first open and freed on last close
+  // Alloc'ed on first use and freed on last close
   mutable std::unique_ptr<buffer> m_dev_heap_bo;
   mutable std::mutex m_lock;
 
+  // Caller should hold m_lock.
+  void
+  alloc_dev_heap(size_t size) const;
+
   virtual void
   on_first_open() const override;
 
@@ -5,10 +5,79 @@
 #include "pcidev.h"
 #include "pcidrv.h"
 #include "shim_debug.h"
+#include "core/common/config_reader.h"
 #include "core/common/trace.h"
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+namespace {
+
+// "auto" binds to NUMA node of device as reported by sysfs, "off" disables
+// binding and a node number overrides the device's node.
+const std::string&
+get_numa_node_config()
+{
+  static std::string node =
+    xrt_core::config::detail::get_string_value("Runtime.numa_node", "auto");
+  return node;
+}
+
+// Submissions to a hwctx an arg BO is passed to before it is made resident
+// there, 0 never makes BOs resident.
+uint32_t
+get_resident_bo_uses()
+{
+  static uint32_t uses =
+    xrt_core::config::detail::get_uint_value("Runtime.resident_bo_uses", 4);
+  return uses;
+}
+
+}
 
 namespace shim_xdna {
 
+void
+parse_cpulist(const std::string& list, cpu_set_t& cpus)
+{
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    auto dash = range.find('-');
+    auto lo = std::stoul(range.substr(0, dash));
+    auto hi = (dash == std::string::npos) ? lo : std::stoul(range.substr(dash + 1));
+    for (auto c = lo; c <= hi && c < CPU_SETSIZE; c++)
+      CPU_SET(c, &cpus);
+  }
+}
+
+numa_mem_scope::
+numa_mem_scope(const pdev& dev)
+{
+  auto node = dev.get_numa_node();
+  if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * CHAR_BIT))
+    return;
+
+  int mode;
+  if (syscall(SYS_get_mempolicy, &mode, nullptr, 0, nullptr, 0) || mode != MPOL_DEFAULT)
+    return;
+
+  unsigned long mask = 1UL << node;
+  m_active = !syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * CHAR_BIT);
+}
+
+numa_mem_scope::
+~numa_mem_scope()
+{
+  if (m_active)
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+}
+
 pdev::
 pdev(std::shared_ptr<const platform_drv>& driver, const std::string& sysfs_name)
   : m_driver(driver)
@@ -24,6 +93,76 @@ pdev::
   shim_debug("Destroying pcidev (%s)", m_sysfs_name.c_str());
 }
 
+int
+pdev::
+get_numa_node() const
+{
+  std::call_once(m_numa_once, [this] {
+    auto& conf = get_numa_node_config();
+    if (conf == "off")
+      return;
+
+    std::string node;
+    if (conf == "auto") {
+      std::ifstream ifs("/sys/bus/pci/devices/" + m_sysfs_name + "/numa_node");
+      std::getline(ifs, node);
+    } else {
+      node = conf;
+    }
+    try {
+      m_numa_node = std::stoi(node);
+    } catch (const std::exception&) {
+      m_numa_node = -1;
+    }
+    shim_debug("Device (%s) bound to NUMA node %d", m_sysfs_name.c_str(), m_numa_node);
+  });
+  return m_numa_node;
+}
+
+void
+pdev::
+bind_thread(std::thread& t) const
+{
+  auto node = get_numa_node();
+  if (node < 0)
+    return;
+
+  std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+  std::string list;
+  if (!std::getline(ifs, list))
+    return;
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  try {
+    parse_cpulist(list, cpus);
+  } catch (const std::exception&) {
+    return;
+  }
+  if (CPU_COUNT(&cpus))
+    pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+}
+
+bool
+pdev::
+get_mem_info(amdxdna_drm_query_mem_info& info) const
+{
+  amdxdna_drm_get_info arg = {
+    .param = DRM_AMDXDNA_QUERY_MEM_INFO,
+    .buffer_size = sizeof(info),
+    .buffer = reinterpret_cast<uintptr_t>(&info),
+  };
+
+  info = {};
+  try {
+    drv_ioctl(drv_ioctl_cmd::get_info, &arg);
+  } catch (const xrt_core::system_error& ex) {
+    shim_debug("Memory info query failed: %s", ex.what());
+    return false;
+  }
+  return true;
+}
+
 xrt_core::device::handle_type
 pdev::
 create_shim(xrt_core::device::id_type id) const
@@ -38,18 +177,42 @@ open() const
 {
   const std::lock_guard<std::mutex> lock(m_open_close_lock);
 
-  if (m_dev_users == 0) {
-    m_driver->drv_open(m_sysfs_name);
-    try {
-      on_first_open();
-    } catch (...) {
-      m_driver->drv_close();
-      throw;
-    }
-  }
+  // Driver is opened on first ioctl or mmap, so that a process which only
+  // queries sysfs never sets up a driver context.
   ++m_dev_users;
 }
 
+void
+pdev::
+drv_open() const
+{
+  if (m_drv_opened.load(std::memory_order_acquire))
+    return;
+  // Ioctls of on_first_open() below, driver is open for them already. No
+  // other thread can see its own id in there.
+  if (m_drv_opener.load(std::memory_order_relaxed) == std::this_thread::get_id())
+    return;
+
+  const std::lock_guard<std::mutex> lock(m_open_close_lock);
+  if (m_drv_opened.load(std::memory_order_relaxed))
+    return;
+  if (m_dev_users == 0)
+    shim_err(ENODEV, "Device (%s) is not opened", m_sysfs_name.c_str());
+
+  m_driver->drv_open(m_sysfs_name);
+  m_drv_opener.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  try {
+    on_first_open();
+  } catch (...) {
+    m_drv_opener.store(std::thread::id(), std::memory_order_relaxed);
+    m_driver->drv_close();
+    throw;
+  }
+  m_drv_opener.store(std::thread::id(), std::memory_order_relaxed);
+  // Other threads go ahead only once device is fully set up.
+  m_drv_opened.store(true, std::memory_order_release);
+}
+
 void
 pdev::
 close() const
@@ -57,13 +220,14 @@ close() const
   const std::lock_guard<std::mutex> lock(m_open_close_lock);
 
   --m_dev_users;
-  if (m_dev_users == 0) {
+  if (m_dev_users == 0 && m_drv_opened.load(std::memory_order_relaxed)) {
     try {
       on_last_close();
       m_driver->drv_close();
     } catch (const xrt_core::system_error& e) {
       shim_debug("Failed to close device: %s", e.what());
     }
+    m_drv_opened.store(false, std::memory_order_release);
   }
 }
 
@@ -71,6 +235,7 @@ void*
 pdev::
 mmap(void *addr, size_t len, int prot, int flags, off_t offset) const
 {
+  drv_open();
   return m_driver->drv_mmap(addr, len, prot, flags, offset);
 }
 
@@ -85,9 +250,17 @@ void
 pdev::
 drv_ioctl(drv_ioctl_cmd cmd, void* arg) const
 {
+  drv_open();
   m_driver->drv_ioctl(cmd, arg);
 }
 
+std::vector<ioctl_stat>
+pdev::
+get_ioctl_stats() const
+{
+  return m_driver->get_ioctl_stats();
+}
+
 std::shared_ptr<xrt_core::device>
 pdev::
 create_device(xrt_core::device::handle_type handle, xrt_core::device::id_type id) const
@@ -225,6 +398,22 @@ void
 pdev::
 insert_bo_handle(uint64_t handle, xrt_core::buffer_handle *ptr) const
 {
+  if (handle < bo_tbl_chunk_size * bo_tbl_num_chunks) {
+    auto& slot = m_bo_tbl[handle / bo_tbl_chunk_size];
+    auto chunk = slot.load(std::memory_order_acquire);
+    if (!chunk) {
+      std::unique_lock<std::shared_mutex> lock(m_bo_map_lock);
+      chunk = slot.load(std::memory_order_relaxed);
+      if (!chunk) {
+        m_bo_tbl_chunks.push_back(std::make_unique<bo_tbl_chunk>());
+        chunk = m_bo_tbl_chunks.back().get();
+        slot.store(chunk, std::memory_order_release);
+      }
+    }
+    (*chunk)[handle % bo_tbl_chunk_size].store(ptr, std::memory_order_release);
+    return;
+  }
+
   std::unique_lock<std::shared_mutex> lock(m_bo_map_lock);
   m_bo_map[handle] = ptr;
 }
@@ -233,6 +422,13 @@ void
 pdev::
 remove_bo_handle(uint64_t handle) const
 {
+  if (handle < bo_tbl_chunk_size * bo_tbl_num_chunks) {
+    auto chunk = m_bo_tbl[handle / bo_tbl_chunk_size].load(std::memory_order_acquire);
+    if (chunk)
+      (*chunk)[handle % bo_tbl_chunk_size].store(nullptr, std::memory_order_release);
+    return;
+  }
+
   std::unique_lock<std::shared_mutex> lock(m_bo_map_lock);
   m_bo_map.erase(handle);
 }
@@ -241,11 +437,135 @@ xrt_core::buffer_handle *
 pdev::
 find_bo_by_handle(uint64_t handle) const
 {
+  if (handle < bo_tbl_chunk_size * bo_tbl_num_chunks) {
+    auto chunk = m_bo_tbl[handle / bo_tbl_chunk_size].load(std::memory_order_acquire);
+    auto ptr = chunk ? (*chunk)[handle % bo_tbl_chunk_size].load(std::memory_order_acquire) : nullptr;
+    if (!ptr)
+      shim_err(EINVAL, "BO handle %d is not found in BO map", handle);
+    return ptr;
+  }
+
   std::shared_lock<std::shared_mutex> lock(m_bo_map_lock);
   auto it = m_bo_map.find(handle);
   if (it == m_bo_map.end())
     shim_err(EINVAL, "BO handle %d is not found in BO map", handle);
-  return m_bo_map[handle];
+  return it->second;
+}
+
+bool
+pdev::
+config_resident_bo(uint32_t ctx_handle, uint32_t bo_handle, bool is_remove) const
+{
+  config_ctx_resident_bo_arg arg = {
+    .ctx_handle = ctx_handle,
+    .is_remove = is_remove,
+    .bo_handle = bo_handle,
+  };
+  try {
+    drv_ioctl(drv_ioctl_cmd::config_ctx_resident_bo, &arg);
+  } catch (const xrt_core::system_error& e) {
+    auto err = e.get_code();
+    if (!is_remove && (err == EOPNOTSUPP || err == ENOTSUP)) {
+      if (m_resident_supported.exchange(false))
+        shim_debug("Resident BO is not supported, err=%d", err);
+    } else {
+      shim_debug("Failed to %s resident BO %d of hwctx %d, err=%d",
+        is_remove ? "remove" : "add", bo_handle, ctx_handle, err);
+    }
+    return false;
+  }
+  shim_debug("%s resident BO %d of hwctx %d", is_remove ? "Removed" : "Added",
+    bo_handle, ctx_handle);
+  return true;
+}
+
+const std::vector<uint32_t>&
+pdev::
+filter_resident_bos(uint32_t ctx_handle, const std::vector<uint32_t>& hdls,
+  std::vector<uint32_t>& buf) const
+{
+  const auto max_uses = get_resident_bo_uses();
+  if (!max_uses || !m_resident_supported.load(std::memory_order_relaxed))
+    return hdls;
+
+  bool filtered = false;
+  std::lock_guard<std::mutex> lg(m_resident_lock);
+  for (size_t i = 0; i < hdls.size(); i++) {
+    auto& rbo = m_resident_bos[hdls[i]];
+    bool resident = false;
+    if (!rbo.excluded) {
+      auto it = std::find_if(rbo.ctxs.begin(), rbo.ctxs.end(),
+        [ctx_handle](const resident_ctx& r) { return r.ctx_handle == ctx_handle; });
+      if (it == rbo.ctxs.end())
+        it = rbo.ctxs.insert(it, { ctx_handle, 0, false });
+      if (!it->resident && it->uses < max_uses && ++it->uses == max_uses) {
+        it->resident = config_resident_bo(ctx_handle, hdls[i], false);
+        if (!it->resident)
+          it->uses = UINT32_MAX;
+      }
+      resident = it->resident;
+    }
+
+    if (resident && !filtered) {
+      buf.assign(hdls.begin(), hdls.begin() + i);
+      filtered = true;
+    } else if (!resident && filtered) {
+      buf.push_back(hdls[i]);
+    }
+  }
+  return filtered ? buf : hdls;
+}
+
+void
+pdev::
+drop_resident_bo(uint32_t bo_handle) const
+{
+  std::vector<resident_ctx> ctxs;
+  {
+    std::lock_guard<std::mutex> lg(m_resident_lock);
+    auto it = m_resident_bos.find(bo_handle);
+    if (it == m_resident_bos.end())
+      return;
+    ctxs = std::move(it->second.ctxs);
+    m_resident_bos.erase(it);
+  }
+  // Driver waits for cmds which may still use it
+  for (auto& r : ctxs) {
+    if (r.resident)
+      config_resident_bo(r.ctx_handle, bo_handle, true);
+  }
+}
+
+void
+pdev::
+exclude_resident_bo(uint32_t bo_handle) const
+{
+  std::vector<resident_ctx> ctxs;
+  {
+    std::lock_guard<std::mutex> lg(m_resident_lock);
+    auto& rbo = m_resident_bos[bo_handle];
+    if (rbo.excluded)
+      return;
+    rbo.excluded = true;
+    ctxs = std::move(rbo.ctxs);
+    rbo.ctxs.clear();
+  }
+  for (auto& r : ctxs) {
+    if (r.resident)
+      config_resident_bo(r.ctx_handle, bo_handle, true);
+  }
+}
+
+void
+pdev::
+drop_resident_ctx(uint32_t ctx_handle) const
+{
+  std::lock_guard<std::mutex> lg(m_resident_lock);
+  for (auto& [hdl, rbo] : m_resident_bos) {
+    auto& ctxs = rbo.ctxs;
+    ctxs.erase(std::remove_if(ctxs.begin(), ctxs.end(),
+      [ctx_handle](const resident_ctx& r) { return r.ctx_handle == ctx_handle; }), ctxs.end());
+  }
 }
 
 }
@@ -6,7 +6,12 @@
 
 #include "platform.h"
 #include "core/pcie/linux/pcidev.h"
+#include <array>
+#include <atomic>
+#include <mutex>
 #include <shared_mutex>
+#include <thread>
+#include <sched.h>
 
 namespace shim_xdna {
 
@@ -66,6 +71,9 @@ public:
   void
   drv_ioctl(drv_ioctl_cmd cmd, void* arg) const;
 
+  std::vector<ioctl_stat>
+  get_ioctl_stats() const;
+
   virtual bool
   is_cache_coherent() const = 0;
 
@@ -75,6 +83,15 @@ public:
   virtual void *
   get_heap_vaddr() const = 0;
 
+  // Whether device BOs are carved out of a device memory heap.
+  virtual bool
+  has_dev_heap() const = 0;
+
+  // Make sure device memory heap exists and, if it has to be allocated now,
+  // that it is large enough for size bytes of device BOs.
+  virtual void
+  reserve_dev_heap(size_t size) const = 0;
+
   virtual bool
   is_umq() const = 0;
 
@@ -91,6 +108,42 @@ public:
   xrt_core::buffer_handle *
   find_bo_by_handle(uint64_t handle) const;
 
+  // NUMA node which host memory and worker threads of this device are bound
+  // to, see Runtime.numa_node. -1 if not bound.
+  int
+  get_numa_node() const;
+
+  // Pin thread to CPUs of device's NUMA node, if there is one.
+  void
+  bind_thread(std::thread& t) const;
+
+  // Heap and BO usage of this process as accounted by driver. Served without
+  // waking up device, so it is cheap enough to ask before large allocations.
+  // False if driver does not support the query.
+  bool
+  get_mem_info(amdxdna_drm_query_mem_info& info) const;
+
+  // Arg BO handles of a submission to hwctx, minus BOs resident in it. BOs
+  // passed to Runtime.resident_bo_uses submissions there are made resident
+  // on the way, driver then neither locks nor fences them per submission.
+  // Returns hdls itself if none is resident, otherwise the others in buf.
+  const std::vector<uint32_t>&
+  filter_resident_bos(uint32_t ctx_handle, const std::vector<uint32_t>& hdls,
+    std::vector<uint32_t>& buf) const;
+
+  // DRM BO is going away, remove it from hwctxs it is resident in.
+  void
+  drop_resident_bo(uint32_t bo_handle) const;
+
+  // DRM BO is shared with others, who rely on its fences. Remove it from
+  // hwctxs and never make it resident again.
+  void
+  exclude_resident_bo(uint32_t bo_handle) const;
+
+  // Hwctx is going away, driver drops its resident BOs.
+  void
+  drop_resident_ctx(uint32_t ctx_handle) const;
+
 private:
   virtual void
   on_first_open() const = 0;
@@ -98,15 +151,74 @@ private:
   virtual void
   on_last_close() const = 0;
 
+  // Open driver on first use, which is the first ioctl or mmap.
+  void
+  drv_open() const;
+
+  mutable std::once_flag m_numa_once;
+  mutable int m_numa_node = -1;
+
   mutable int m_dev_users = 0;
+  mutable std::atomic<bool> m_drv_opened{false};
+  // Thread running on_first_open(), while it does.
+  mutable std::atomic<std::thread::id> m_drv_opener;
   mutable std::mutex m_open_close_lock;
 
   std::shared_ptr<const platform_drv> m_driver;
 
+  // Handles below bo_tbl_chunk_size * bo_tbl_num_chunks are looked up without
+  // lock in a two level table, whose chunks are allocated on first insert and
+  // never moved or freed. Larger handles fall back to m_bo_map.
+  static constexpr size_t bo_tbl_chunk_size = 1024;
+  static constexpr size_t bo_tbl_num_chunks = 1024;
+  using bo_tbl_chunk = std::array<std::atomic<xrt_core::buffer_handle *>, bo_tbl_chunk_size>;
+  mutable std::array<std::atomic<bo_tbl_chunk *>, bo_tbl_num_chunks> m_bo_tbl = {};
+  // Owns chunks in m_bo_tbl, protected by m_bo_map_lock.
+  mutable std::vector< std::unique_ptr<bo_tbl_chunk> > m_bo_tbl_chunks;
+
   mutable std::shared_mutex m_bo_map_lock;
   mutable std::unordered_map<uint64_t, xrt_core::buffer_handle *> m_bo_map;
+
+  struct resident_ctx {
+    uint32_t ctx_handle;
+    // Submissions BO has been passed to, saturated if it can't be resident.
+    uint32_t uses;
+    bool resident;
+  };
+  struct resident_bo {
+    bool excluded = false;
+    std::vector<resident_ctx> ctxs;
+  };
+
+  // Add or remove BO with driver, false if driver refused.
+  bool
+  config_resident_bo(uint32_t ctx_handle, uint32_t bo_handle, bool is_remove) const;
+
+  // Cleared once driver turns down resident BOs.
+  mutable std::atomic<bool> m_resident_supported{true};
+  mutable std::mutex m_resident_lock;
+  // By DRM BO handle, every arg BO passed to some submission is in here
+  // until it is closed.
+  mutable std::unordered_map<uint32_t, resident_bo> m_resident_bos;
+};
+
+// Host memory allocated by calling thread while in scope, including pages
+// allocated by driver on its behalf, is preferred from device's NUMA node.
+// No-op if thread already has a memory policy of its own.
+class numa_mem_scope
+{
+public:
+  explicit numa_mem_scope(const pdev& dev);
+  ~numa_mem_scope();
+
+private:
+  bool m_active = false;
 };
 
+// Parse cpulist format, e.g. "0-7,16-23".
+void
+parse_cpulist(const std::string& list, cpu_set_t& cpus);
+
 }
 
 #endif
@@ -3,14 +3,48 @@
 
 #include "platform.h"
 #include "shim_debug.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
 #include <sys/mman.h>
 #include <fcntl.h>
 
+namespace {
+
+bool
+is_dump_ioctl_stats()
+{
+  static bool dump =
+    xrt_core::config::detail::get_bool_value("Debug.ioctl_stats", false);
+  return dump;
+}
+
+size_t
+get_ioctl_stat_shard(size_t num_shards)
+{
+  static std::atomic<size_t> next_shard = 0;
+  thread_local size_t shard = next_shard++;
+  return shard % num_shards;
+}
+
+void
+atomic_max(std::atomic<uint64_t>& a, uint64_t v)
+{
+  auto cur = a.load(std::memory_order_relaxed);
+  while (cur < v && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+    ;
+}
+
+}
+
 namespace shim_xdna {
 
 platform_drv::
 platform_drv(std::shared_ptr<const drv>& driver)
   : m_driver(driver)
+  , m_ioctl_stats(std::make_unique< std::array<ioctl_stat_shard, num_ioctl_stat_shards> >())
 {
 }
 
@@ -73,6 +107,8 @@ void
 platform_drv::
 drv_close() const
 {
+  if (is_dump_ioctl_stats())
+    dump_ioctl_stats();
   close(m_dev_fd);
   shim_debug("Closed %d", m_dev_fd);
   m_dev_fd = -1;
@@ -158,6 +194,27 @@ wait_syncobj(wait_syncobj_arg& sobj_arg) const
   ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &arg);
 }
 
+void
+platform_drv::
+wait_syncobjs(wait_syncobjs_arg& sobj_arg) const
+{
+  if (sobj_arg.handles.size() != sobj_arg.timepoints.size())
+    shim_err(EINVAL, "Syncobj handles and timepoints mismatch: %ld, %ld",
+      sobj_arg.handles.size(), sobj_arg.timepoints.size());
+
+  drm_syncobj_timeline_wait arg = {};
+  arg.handles = reinterpret_cast<uintptr_t>(sobj_arg.handles.data());
+  arg.points = reinterpret_cast<uintptr_t>(sobj_arg.timepoints.data());
+  arg.timeout_nsec = timeout_ms2abs_ns(sobj_arg.timeout_ms);
+  arg.count_handles = sobj_arg.handles.size();
+  /* Keep waiting even if not submitted yet */
+  arg.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT;
+  if (sobj_arg.wait_all)
+    arg.flags |= DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL;
+  ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &arg);
+  sobj_arg.first_signaled = arg.first_signaled;
+}
+
 void
 platform_drv::
 signal_syncobj(signal_syncobj_arg& sobj_arg) const
@@ -169,9 +226,184 @@ signal_syncobj(signal_syncobj_arg& sobj_arg) const
   ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL, &arg);
 }
 
+void
+platform_drv::
+query_syncobj(query_syncobj_arg& sobj_arg) const
+{
+  drm_syncobj_timeline_array arg = {};
+  arg.handles = reinterpret_cast<uintptr_t>(&sobj_arg.handle);
+  arg.points = reinterpret_cast<uintptr_t>(&sobj_arg.timepoint);
+  arg.count_handles = 1;
+  if (ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_QUERY, &arg) == -1)
+    shim_err(-errno, "Failed to query syncobj %d", sobj_arg.handle);
+}
+
+void
+platform_drv::
+query_syncobjs(query_syncobjs_arg& sobj_arg) const
+{
+  sobj_arg.timepoints.resize(sobj_arg.handles.size());
+  drm_syncobj_timeline_array arg = {};
+  arg.handles = reinterpret_cast<uintptr_t>(sobj_arg.handles.data());
+  arg.points = reinterpret_cast<uintptr_t>(sobj_arg.timepoints.data());
+  arg.count_handles = sobj_arg.handles.size();
+  if (ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_QUERY, &arg) == -1)
+    shim_err(-errno, "Failed to query %ld syncobjs", sobj_arg.handles.size());
+}
+
+void
+platform_drv::
+eventfd_syncobj(eventfd_syncobj_arg& sobj_arg) const
+{
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+  drm_syncobj_eventfd arg = {};
+  arg.handle = sobj_arg.handle;
+  arg.flags = 0;
+  arg.point = sobj_arg.timepoint;
+  arg.fd = sobj_arg.fd;
+  if (ioctl(dev_fd(), DRM_IOCTL_SYNCOBJ_EVENTFD, &arg) == -1)
+    shim_err(-errno, "Failed to register eventfd on syncobj %d@%ld",
+      sobj_arg.handle, sobj_arg.timepoint);
+#else
+  shim_not_supported_err(__func__);
+#endif
+}
+
 void
 platform_drv::
 drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
+{
+  auto idx = static_cast<size_t>(cmd);
+  if (idx >= static_cast<size_t>(drv_ioctl_cmd::num_cmds)) {
+    dispatch_ioctl(cmd, cmd_arg);
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    dispatch_ioctl(cmd, cmd_arg);
+  } catch (...) {
+    record_ioctl(idx, start, true);
+    throw;
+  }
+  record_ioctl(idx, start, false);
+}
+
+void
+platform_drv::
+record_ioctl(size_t idx, std::chrono::steady_clock::time_point start, bool failed) const
+{
+  auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count());
+  auto bucket = std::min<size_t>(ns ? 63 - __builtin_clzll(ns) : 0, ioctl_stat::num_buckets - 1);
+  auto& c = (*m_ioctl_stats)[get_ioctl_stat_shard(num_ioctl_stat_shards)].cmds[idx];
+
+  c.count.fetch_add(1, std::memory_order_relaxed);
+  if (failed)
+    c.errors.fetch_add(1, std::memory_order_relaxed);
+  c.total_ns.fetch_add(ns, std::memory_order_relaxed);
+  atomic_max(c.max_ns, ns);
+  c.hist[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<ioctl_stat>
+platform_drv::
+get_ioctl_stats() const
+{
+  std::vector<ioctl_stat> stats;
+
+  for (size_t i = 0; i < static_cast<size_t>(drv_ioctl_cmd::num_cmds); i++) {
+    ioctl_stat st = { static_cast<drv_ioctl_cmd>(i) };
+    for (auto& shard : *m_ioctl_stats) {
+      auto& c = shard.cmds[i];
+      st.count += c.count.load(std::memory_order_relaxed);
+      st.errors += c.errors.load(std::memory_order_relaxed);
+      st.total_ns += c.total_ns.load(std::memory_order_relaxed);
+      st.max_ns = std::max(st.max_ns, c.max_ns.load(std::memory_order_relaxed));
+      for (size_t b = 0; b < ioctl_stat::num_buckets; b++)
+        st.hist[b] += c.hist[b].load(std::memory_order_relaxed);
+    }
+    if (st.count)
+      stats.push_back(st);
+  }
+  return stats;
+}
+
+void
+platform_drv::
+dump_ioctl_stats() const
+{
+  auto stats = get_ioctl_stats();
+  if (stats.empty())
+    return;
+
+  std::cout << "drv_ioctl stats of fd " << m_dev_fd << ":" << std::endl;
+  for (auto& st : stats) {
+    std::cout << "  " << std::left << std::setw(24) << drv_ioctl_cmd2name(st.cmd) << std::right
+      << " count=" << st.count << " errors=" << st.errors
+      << " avg_ns=" << st.total_ns / st.count << " max_ns=" << st.max_ns << " log2_ns_hist=";
+    // Print only the range of buckets that have been hit.
+    size_t first = 0, last = ioctl_stat::num_buckets - 1;
+    while (!st.hist[first])
+      first++;
+    while (!st.hist[last])
+      last--;
+    std::cout << "[" << first << "]";
+    for (auto b = first; b <= last; b++)
+      std::cout << (b == first ? "" : ",") << st.hist[b];
+    std::cout << std::endl;
+  }
+}
+
+const char *
+platform_drv::
+drv_ioctl_cmd2name(drv_ioctl_cmd cmd)
+{
+  switch (cmd) {
+  case drv_ioctl_cmd::create_ctx:            return "create_ctx";
+  case drv_ioctl_cmd::destroy_ctx:           return "destroy_ctx";
+  case drv_ioctl_cmd::config_ctx_cu_config:  return "config_ctx_cu_config";
+  case drv_ioctl_cmd::config_ctx_debug_bo:   return "config_ctx_debug_bo";
+  case drv_ioctl_cmd::config_ctx_build_cmdlist: return "config_ctx_build_cmdlist";
+  case drv_ioctl_cmd::config_ctx_resident_bo: return "config_ctx_resident_bo";
+  case drv_ioctl_cmd::create_bo:             return "create_bo";
+  case drv_ioctl_cmd::create_uptr_bo:        return "create_uptr_bo";
+  case drv_ioctl_cmd::destroy_bo:            return "destroy_bo";
+  case drv_ioctl_cmd::sync_bo:               return "sync_bo";
+  case drv_ioctl_cmd::sync_bos:              return "sync_bos";
+  case drv_ioctl_cmd::export_bo:             return "export_bo";
+  case drv_ioctl_cmd::import_bo:             return "import_bo";
+  case drv_ioctl_cmd::submit_cmd:            return "submit_cmd";
+  case drv_ioctl_cmd::submit_cmds:           return "submit_cmds";
+  case drv_ioctl_cmd::submit_dependency:     return "submit_dependency";
+  case drv_ioctl_cmd::submit_signal:         return "submit_signal";
+  case drv_ioctl_cmd::submit_ctx_dependency: return "submit_ctx_dependency";
+  case drv_ioctl_cmd::wait_cmd_ioctl:        return "wait_cmd_ioctl";
+  case drv_ioctl_cmd::wait_cmd_syncobj:      return "wait_cmd_syncobj";
+  case drv_ioctl_cmd::wait_cmds:             return "wait_cmds";
+  case drv_ioctl_cmd::get_info:              return "get_info";
+  case drv_ioctl_cmd::get_info_array:        return "get_info_array";
+  case drv_ioctl_cmd::set_state:             return "set_state";
+  case drv_ioctl_cmd::wait_mem_pressure:     return "wait_mem_pressure";
+  case drv_ioctl_cmd::get_sysfs:             return "get_sysfs";
+  case drv_ioctl_cmd::put_sysfs:             return "put_sysfs";
+  case drv_ioctl_cmd::create_syncobj:        return "create_syncobj";
+  case drv_ioctl_cmd::destroy_syncobj:       return "destroy_syncobj";
+  case drv_ioctl_cmd::export_syncobj:        return "export_syncobj";
+  case drv_ioctl_cmd::import_syncobj:        return "import_syncobj";
+  case drv_ioctl_cmd::signal_syncobj:        return "signal_syncobj";
+  case drv_ioctl_cmd::wait_syncobj:          return "wait_syncobj";
+  case drv_ioctl_cmd::wait_syncobjs:         return "wait_syncobjs";
+  case drv_ioctl_cmd::query_syncobj:         return "query_syncobj";
+  case drv_ioctl_cmd::query_syncobjs:        return "query_syncobjs";
+  case drv_ioctl_cmd::eventfd_syncobj:       return "eventfd_syncobj";
+  default:                                   return "unknown";
+  }
+}
+
+void
+platform_drv::
+dispatch_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
 {
   switch (cmd) {
   case drv_ioctl_cmd::create_ctx:
@@ -186,6 +418,12 @@ drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
   case drv_ioctl_cmd::config_ctx_debug_bo:
     config_ctx_debug_bo(*static_cast<config_ctx_debug_bo_arg*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::config_ctx_build_cmdlist:
+    config_ctx_build_cmdlist(*static_cast<config_ctx_build_cmdlist_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::config_ctx_resident_bo:
+    config_ctx_resident_bo(*static_cast<config_ctx_resident_bo_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::create_bo:
     create_bo(*static_cast<bo_info*>(cmd_arg));
     break;
@@ -198,6 +436,9 @@ drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
   case drv_ioctl_cmd::sync_bo:
     sync_bo(*static_cast<sync_bo_arg*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::sync_bos:
+    sync_bos(*static_cast<sync_bos_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::export_bo:
     export_bo(*static_cast<export_bo_arg*>(cmd_arg));
     break;
@@ -207,12 +448,27 @@ drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
   case drv_ioctl_cmd::submit_cmd:
     submit_cmd(*static_cast<submit_cmd_arg*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::submit_cmds:
+    submit_cmds(*static_cast<submit_cmds_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::submit_dependency:
+    submit_dependency(*static_cast<submit_fence_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::submit_signal:
+    submit_signal(*static_cast<submit_fence_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::submit_ctx_dependency:
+    submit_ctx_dependency(*static_cast<submit_ctx_dep_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::wait_cmd_ioctl:
     wait_cmd_ioctl(*static_cast<wait_cmd_arg*>(cmd_arg));
     break;
   case drv_ioctl_cmd::wait_cmd_syncobj:
     wait_cmd_syncobj(*static_cast<wait_cmd_arg*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::wait_cmds:
+    wait_cmds(*static_cast<wait_cmds_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::get_info:
     get_info(*static_cast<amdxdna_drm_get_info*>(cmd_arg));
     break;
@@ -222,6 +478,9 @@ drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
   case drv_ioctl_cmd::set_state:
     set_state(*static_cast<amdxdna_drm_set_state*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::wait_mem_pressure:
+    wait_mem_pressure(*static_cast<wait_mem_pressure_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::create_syncobj:
     create_syncobj(*static_cast<create_destroy_syncobj_arg*>(cmd_arg));
     break;
@@ -240,6 +499,18 @@ drv_ioctl(drv_ioctl_cmd cmd, void* cmd_arg) const
   case drv_ioctl_cmd::wait_syncobj:
     wait_syncobj(*static_cast<wait_syncobj_arg*>(cmd_arg));
     break;
+  case drv_ioctl_cmd::wait_syncobjs:
+    wait_syncobjs(*static_cast<wait_syncobjs_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::query_syncobj:
+    query_syncobj(*static_cast<query_syncobj_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::query_syncobjs:
+    query_syncobjs(*static_cast<query_syncobjs_arg*>(cmd_arg));
+    break;
+  case drv_ioctl_cmd::eventfd_syncobj:
+    eventfd_syncobj(*static_cast<eventfd_syncobj_arg*>(cmd_arg));
+    break;
   case drv_ioctl_cmd::get_sysfs:
     get_sysfs(*static_cast<get_sysfs_arg*>(cmd_arg));
     break;
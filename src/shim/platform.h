@@ -8,6 +8,10 @@
 #include "shim_debug.h"
 #include "drm_local/amdxdna_accel.h"
 #include "core/common/shim/buffer_handle.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <set>
 #include <tuple>
 #include <vector>
@@ -21,21 +25,30 @@ enum class drv_ioctl_cmd {
   destroy_ctx,
   config_ctx_cu_config,
   config_ctx_debug_bo,
+  config_ctx_build_cmdlist,
+  config_ctx_resident_bo,
 
   create_bo,
   create_uptr_bo,
   destroy_bo,
   sync_bo,
+  sync_bos,
   export_bo,
   import_bo,
 
   submit_cmd,
+  submit_cmds,
+  submit_dependency,
+  submit_signal,
+  submit_ctx_dependency,
   wait_cmd_ioctl,
   wait_cmd_syncobj,
+  wait_cmds,
 
   get_info,
   get_info_array,
   set_state,
+  wait_mem_pressure,
 
   get_sysfs,
   put_sysfs,
@@ -46,6 +59,13 @@ enum class drv_ioctl_cmd {
   import_syncobj,
   signal_syncobj,
   wait_syncobj,
+  wait_syncobjs,
+  query_syncobj,
+  query_syncobjs,
+  eventfd_syncobj,
+
+  // Number of commands above, keep it last
+  num_cmds,
 };
 
 struct bo_id {
@@ -64,6 +84,10 @@ struct create_ctx_arg {
   uint32_t max_opc;
   uint32_t num_tiles;
   uint32_t mem_size;
+  // Max cmds in flight, 0 for driver default
+  uint32_t queue_depth;
+  // AMDXDNA_CTX_CREATE_* flags
+  uint32_t flags;
   uint32_t ctx_handle;
   uint32_t umq_doorbell;
   uint32_t syncobj_handle;
@@ -85,6 +109,22 @@ struct config_ctx_debug_bo_arg {
   bo_id bo;
 };
 
+struct config_ctx_build_cmdlist_arg {
+  uint32_t ctx_handle;
+  bo_id cmd_bo;
+  // Invalid handle to drop the prebuilt list
+  bo_id list_bo;
+  // Returned offset of each slot in list BO, followed by the end of the last
+  // one, as many as there is room for.
+  std::vector<uint32_t>& offsets;
+};
+
+struct config_ctx_resident_bo_arg {
+  uint32_t ctx_handle;
+  bool is_remove;
+  uint32_t bo_handle;
+};
+
 struct bo_info {
   uint64_t xdna_addr_align;
   size_t size;
@@ -93,6 +133,8 @@ struct bo_info {
   void *vaddr;
   uint64_t map_offset;
   uint32_t type;
+  uint64_t flags; // AMDXDNA_BO_FLAG_*
+  uint32_t nr_segs; // DMA segments backing the BO, 0 if unknown
 };
 
 struct import_bo_arg {
@@ -111,6 +153,10 @@ struct sync_bo_arg {
   size_t size;
 };
 
+struct sync_bos_arg {
+  std::vector<sync_bo_arg>& bos;
+};
+
 struct export_bo_arg {
   bo_id bo;
   int fd;
@@ -119,7 +165,36 @@ struct export_bo_arg {
 struct submit_cmd_arg {
   uint32_t ctx_handle;
   bo_id cmd_bo;
-  const std::set<bo_id>& arg_bos;
+  // Deduplicated DRM BO handles of all arg BOs.
+  const std::vector<uint32_t>& arg_bo_hdls;
+  uint64_t seq;
+};
+
+struct submit_cmds_arg {
+  uint32_t ctx_handle;
+  const std::vector<bo_id>& cmd_bos;
+  // Deduplicated DRM BO handles of arg BOs of all cmd BOs.
+  const std::vector<uint32_t>& arg_bo_hdls;
+  // Seq of the last submitted cmd, earlier ones have consecutive seq.
+  uint64_t seq;
+  // Number of cmd BOs submitted, valid even if submission failed. Driver
+  // may take fewer than given without failing, when hwctx is out of slots.
+  uint32_t submitted;
+};
+
+struct submit_fence_arg {
+  uint32_t ctx_handle;
+  uint32_t syncobj_handle;
+  uint64_t timepoint;
+  // Returned seq of the no-op cmd waiting for the fence, for submit_dependency only.
+  uint64_t seq;
+};
+
+struct submit_ctx_dep_arg {
+  uint32_t ctx_handle;
+  // Cmds of contexts of this process to wait for, as ctx handle and seq
+  const std::vector<std::pair<uint32_t, uint64_t>>& cmds;
+  // Returned seq of the no-op cmd waiting for them
   uint64_t seq;
 };
 
@@ -152,6 +227,57 @@ struct wait_syncobj_arg {
   uint64_t timepoint;
 };
 
+struct wait_cmds_arg {
+  const std::vector<uint32_t>& ctx_handles;
+  const std::vector<uint64_t>& seqs;
+  uint32_t timeout_ms;
+  // Wait for all cmds, otherwise for any of them
+  bool wait_all;
+  // Returned, completion status of each cmd, also valid on ETIME
+  std::vector<bool>& completed;
+};
+
+struct wait_syncobjs_arg {
+  const std::vector<uint32_t>& handles;
+  const std::vector<uint64_t>& timepoints;
+  uint32_t timeout_ms;
+  // Wait for all timepoints, otherwise for any of them
+  bool wait_all;
+  // Returned, index of a signaled timepoint when not waiting for all
+  uint32_t first_signaled;
+};
+
+struct query_syncobj_arg {
+  uint32_t handle;
+  // Returned last signaled timepoint
+  uint64_t timepoint;
+};
+
+struct query_syncobjs_arg {
+  const std::vector<uint32_t>& handles;
+  // Returned last signaled timepoint of each handle
+  std::vector<uint64_t>& timepoints;
+};
+
+struct eventfd_syncobj_arg {
+  uint32_t handle;
+  uint64_t timepoint;
+  // eventfd to be signaled once timepoint is signaled
+  int fd;
+};
+
+struct wait_mem_pressure_arg {
+  // Bytes of heap / all BOs of this process to be notified at, 0 for none
+  uint64_t heap_threshold;
+  uint64_t bo_threshold;
+  // Readable once waiter has to give up, e.g. device is closing
+  int cancel_fd;
+  // Returned AMDXDNA_MEM_PRESSURE_* bits, 0 if cancelled
+  uint32_t reasons;
+  uint64_t heap_usage;
+  uint64_t bo_usage;
+};
+
 struct get_sysfs_arg {
   const std::string& sysfs_node;
   std::vector<char>& data;
@@ -163,6 +289,19 @@ struct put_sysfs_arg {
   const std::vector<char>& data;
 };
 
+// Aggregated latency stats of one drv_ioctl_cmd. Bucket i of the histogram
+// counts calls taking [2^i, 2^(i+1)) ns, last bucket takes all longer ones.
+struct ioctl_stat {
+  static constexpr size_t num_buckets = 32;
+
+  drv_ioctl_cmd cmd;
+  uint64_t count;
+  uint64_t errors;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  std::array<uint64_t, num_buckets> hist;
+};
+
 class platform_drv
 {
 public:
@@ -190,6 +329,13 @@ public:
   static int64_t
   timeout_ms2abs_ns(int64_t timeout_ms);
 
+  static const char *
+  drv_ioctl_cmd2name(drv_ioctl_cmd cmd);
+
+  // Stats of all commands called so far, merged from all shards.
+  std::vector<ioctl_stat>
+  get_ioctl_stats() const;
+
 protected:
   int
   dev_fd() const;
@@ -200,12 +346,24 @@ protected:
   virtual void
   wait_syncobj(wait_syncobj_arg& arg) const;
 
+  virtual void
+  wait_syncobjs(wait_syncobjs_arg& arg) const;
+
   virtual void
   destroy_syncobj(create_destroy_syncobj_arg& arg) const;
 
   virtual void
   signal_syncobj(signal_syncobj_arg& arg) const;
 
+  virtual void
+  query_syncobj(query_syncobj_arg& arg) const;
+
+  virtual void
+  query_syncobjs(query_syncobjs_arg& arg) const;
+
+  virtual void
+  eventfd_syncobj(eventfd_syncobj_arg& arg) const;
+
   void
   save_bo_info(uint32_t key, bo_info& info) const;
 
@@ -216,8 +374,33 @@ protected:
   load_bo_info(uint32_t key, bo_info& info) const;
 
 private:
+  void
+  dispatch_ioctl(drv_ioctl_cmd cmd, void* arg) const;
+
+  void
+  record_ioctl(size_t idx, std::chrono::steady_clock::time_point start, bool failed) const;
+
+  void
+  dump_ioctl_stats() const;
+
   std::shared_ptr<const drv> m_driver;
 
+  // Always on ioctl stats. Threads are spread over a few cache line aligned
+  // shards and only do relaxed atomic adds, so recording costs two clock
+  // reads per ioctl.
+  struct ioctl_counters {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::array<std::atomic<uint64_t>, ioctl_stat::num_buckets> hist;
+  };
+  struct alignas(64) ioctl_stat_shard {
+    std::array<ioctl_counters, static_cast<size_t>(drv_ioctl_cmd::num_cmds)> cmds;
+  };
+  static constexpr size_t num_ioctl_stat_shards = 8;
+  std::unique_ptr< std::array<ioctl_stat_shard, num_ioctl_stat_shards> > m_ioctl_stats;
+
   // Supposed to be set once and used till object is destroyed.
   // No locking protection here. Caller should make sure there is no race.
   mutable int m_dev_fd = -1;
@@ -253,6 +436,14 @@ private:
   config_ctx_debug_bo(config_ctx_debug_bo_arg& arg) const
   { shim_not_supported_err(__func__); }
 
+  virtual void
+  config_ctx_build_cmdlist(config_ctx_build_cmdlist_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
+  virtual void
+  config_ctx_resident_bo(config_ctx_resident_bo_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
   virtual void
   create_bo(bo_info& arg) const
   { shim_not_supported_err(__func__); }
@@ -269,6 +460,14 @@ private:
   sync_bo(sync_bo_arg& arg) const
   { shim_not_supported_err(__func__); }
 
+  // One sync_bo() per BO range, unless platform can do them all at once.
+  virtual void
+  sync_bos(sync_bos_arg& arg) const
+  {
+    for (auto& bo : arg.bos)
+      sync_bo(bo);
+  }
+
   virtual void
   export_bo(export_bo_arg& arg) const
   { shim_not_supported_err(__func__); }
@@ -281,6 +480,22 @@ private:
   submit_cmd(submit_cmd_arg& arg) const
   { shim_not_supported_err(__func__); }
 
+  virtual void
+  submit_cmds(submit_cmds_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
+  virtual void
+  submit_dependency(submit_fence_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
+  virtual void
+  submit_signal(submit_fence_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
+  virtual void
+  submit_ctx_dependency(submit_ctx_dep_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
   virtual void
   wait_cmd_ioctl(wait_cmd_arg& arg) const
   { shim_not_supported_err(__func__); }
@@ -289,6 +504,10 @@ private:
   wait_cmd_syncobj(wait_cmd_arg& arg) const
   { shim_not_supported_err(__func__); }
 
+  virtual void
+  wait_cmds(wait_cmds_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
   virtual void
   get_info(amdxdna_drm_get_info& arg) const
   { shim_not_supported_err(__func__); }
@@ -301,6 +520,11 @@ private:
   set_state(amdxdna_drm_set_state& arg) const
   { shim_not_supported_err(__func__); }
 
+  // Blocks till driver says memory is short or arg.cancel_fd is readable.
+  virtual void
+  wait_mem_pressure(wait_mem_pressure_arg& arg) const
+  { shim_not_supported_err(__func__); }
+
   virtual void
   create_syncobj(create_destroy_syncobj_arg& arg) const;
 
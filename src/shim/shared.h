@@ -31,6 +31,29 @@ private:
   const int m_fd;
 };
 
+// Export of sub-range [offset, offset + size) of a BO. The fd is still of the
+// whole dma-buf, importer has to be given offset and size along with it to
+// carve the same range out of it, see device::import_bo().
+class shared_range : public shared
+{
+public:
+  shared_range(int fd, size_t offset, size_t size)
+    : shared(fd), m_offset(offset), m_size(size)
+  {}
+
+  size_t
+  get_offset() const
+  { return m_offset; }
+
+  size_t
+  get_size() const
+  { return m_size; }
+
+private:
+  const size_t m_offset;
+  const size_t m_size;
+};
+
 }
 
 #endif
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "trace_recorder.h"
+#include "shim_debug.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+using namespace shim_xdna::trace_recorder;
+
+struct record {
+  const char *name;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+  uint64_t arg0;
+  uint64_t arg1;
+  unsigned nargs;
+};
+
+// Written by its own thread only, read by dump().
+struct ring {
+  ring(size_t entries)
+    : m_recs(entries)
+    , m_tid(static_cast<pid_t>(syscall(SYS_gettid)))
+  {}
+
+  std::vector<record> m_recs;
+  std::atomic<uint64_t> m_head = 0;
+  pid_t m_tid;
+};
+
+size_t
+get_ring_entries()
+{
+  auto n = xrt_core::config::detail::get_uint_value("Debug.trace_recorder_entries", 16 * 1024);
+  // Power of 2, so that wrapping is a mask
+  size_t entries = 1;
+  while (entries < n)
+    entries <<= 1;
+  return entries;
+}
+
+sem_t dump_sem;
+
+void
+dump_signal_handler(int)
+{
+  // Only async-signal-safe work here, dumper thread does the rest
+  sem_post(&dump_sem);
+}
+
+class recorder
+{
+public:
+  recorder()
+  {
+    m_path = xrt_core::config::detail::get_string_value("Debug.trace_recorder", "");
+    if (m_path.empty())
+      return;
+    m_entries = get_ring_entries();
+
+    // Don't take SIGUSR2 over from application if it handles it
+    struct sigaction sa = {};
+    sigaction(SIGUSR2, nullptr, &sa);
+    if (sa.sa_handler == SIG_DFL && sem_init(&dump_sem, 0, 0) == 0) {
+      m_dumper = std::thread([this] { dumper(); });
+      sa = {};
+      sa.sa_handler = dump_signal_handler;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = SA_RESTART;
+      sigaction(SIGUSR2, &sa, nullptr);
+    }
+    m_enabled = true;
+    shim_debug("Recording trace points to %s, %zu entries per thread", m_path.c_str(), m_entries);
+  }
+
+  ~recorder()
+  {
+    if (!m_enabled)
+      return;
+    if (m_dumper.joinable()) {
+      m_stop = true;
+      sem_post(&dump_sem);
+      m_dumper.join();
+    }
+    dump();
+  }
+
+  bool
+  enabled() const
+  {
+    return m_enabled;
+  }
+
+  ring *
+  new_ring()
+  {
+    auto r = std::make_unique<ring>(m_entries);
+    auto ret = r.get();
+    // Ring outlives its thread, so that its records are still dumped.
+    const std::lock_guard<std::mutex> lock(m_rings_lock);
+    m_rings.push_back(std::move(r));
+    return ret;
+  }
+
+  // Records being overwritten while dumping may come out garbled, which is
+  // fine for a trace taken from a live process.
+  void
+  dump()
+  {
+    const std::lock_guard<std::mutex> dlock(m_dump_lock);
+    auto f = std::fopen(m_path.c_str(), "w");
+    if (!f) {
+      shim_info("Failed to open trace recorder output %s, errno %d", m_path.c_str(), errno);
+      return;
+    }
+
+    auto pid = getpid();
+    const char *sep = "";
+    std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    const std::lock_guard<std::mutex> lock(m_rings_lock);
+    for (auto& r : m_rings) {
+      auto head = r->m_head.load(std::memory_order_acquire);
+      auto n = std::min<uint64_t>(head, r->m_recs.size());
+      for (auto i = head - n; i < head; i++) {
+        auto rec = r->m_recs[i & (r->m_recs.size() - 1)];
+        if (!rec.name)
+          continue;
+        std::fprintf(f, "%s\n{\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+          sep, rec.name, pid, r->m_tid, rec.begin_ns / 1000.0);
+        if (rec.end_ns)
+          std::fprintf(f, ",\"ph\":\"X\",\"dur\":%.3f", (rec.end_ns - rec.begin_ns) / 1000.0);
+        else
+          std::fprintf(f, ",\"ph\":\"i\",\"s\":\"t\"");
+        if (rec.nargs == 1)
+          std::fprintf(f, ",\"args\":{\"arg0\":%lu}", rec.arg0);
+        else if (rec.nargs == 2)
+          std::fprintf(f, ",\"args\":{\"arg0\":%lu,\"arg1\":%lu}", rec.arg0, rec.arg1);
+        std::fprintf(f, "}");
+        sep = ",";
+      }
+    }
+    std::fprintf(f, "\n]}\n");
+    std::fclose(f);
+  }
+
+private:
+  void
+  dumper()
+  {
+    while (true) {
+      while (sem_wait(&dump_sem) == -1 && errno == EINTR)
+        ;
+      if (m_stop)
+        break;
+      dump();
+    }
+  }
+
+  bool m_enabled = false;
+  std::string m_path;
+  size_t m_entries = 0;
+  std::mutex m_rings_lock;
+  std::vector<std::unique_ptr<ring>> m_rings;
+  std::mutex m_dump_lock;
+  std::thread m_dumper;
+  std::atomic<bool> m_stop = false;
+};
+
+recorder&
+get_recorder()
+{
+  static recorder r;
+  return r;
+}
+
+thread_local ring *this_ring = nullptr;
+
+}
+
+namespace shim_xdna::trace_recorder {
+
+bool
+init()
+{
+  return get_recorder().enabled();
+}
+
+void
+add(const char *name, uint64_t begin_ns, uint64_t end_ns,
+  unsigned nargs, uint64_t arg0, uint64_t arg1)
+{
+  if (!enabled())
+    return;
+  if (!this_ring)
+    this_ring = get_recorder().new_ring();
+
+  auto r = this_ring;
+  auto head = r->m_head.load(std::memory_order_relaxed);
+  auto& rec = r->m_recs[head & (r->m_recs.size() - 1)];
+  rec.name = name;
+  rec.begin_ns = begin_ns;
+  rec.end_ns = end_ns;
+  rec.nargs = nargs;
+  rec.arg0 = arg0;
+  rec.arg1 = arg1;
+  r->m_head.store(head + 1, std::memory_order_release);
+}
+
+void
+dump()
+{
+  if (enabled())
+    get_recorder().dump();
+}
+
+} // namespace shim_xdna::trace_recorder
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef TRACE_RECORDER_XDNA_H
+#define TRACE_RECORDER_XDNA_H
+
+#include "core/common/trace.h"
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+
+// Built-in recorder of shim trace points, so that a timeline is available
+// without any LTTng or USDT setup. Enabled by setting Debug.trace_recorder
+// to an output file path.
+//
+// Each thread records into its own ring of Debug.trace_recorder_entries
+// records, oldest ones are overwritten. Recording takes no lock and only
+// allocates on the first record of a thread. All rings are written out as
+// Chrome trace JSON, which Perfetto UI loads as well, when the process exits
+// or gets SIGUSR2. Timestamps are CLOCK_MONOTONIC, same as trace_stream.
+//
+// Use the SHIM_TRACE_POINT_* macros below, they feed both XRT trace points
+// and this recorder.
+namespace shim_xdna::trace_recorder {
+
+bool
+init();
+
+inline bool
+enabled()
+{
+  static const bool on = init();
+  return on;
+}
+
+inline uint64_t
+now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// name must be a string literal. end_ns is 0 for instant events.
+void
+add(const char *name, uint64_t begin_ns, uint64_t end_ns,
+  unsigned nargs, uint64_t arg0, uint64_t arg1);
+
+// Write all rings to output file now, records are kept.
+void
+dump();
+
+template <typename T>
+inline uint64_t
+to_arg(T v)
+{
+  if constexpr (std::is_pointer_v<T>)
+    return reinterpret_cast<uintptr_t>(v);
+  else
+    return static_cast<uint64_t>(v);
+}
+
+class scope
+{
+public:
+  scope(const char *name, unsigned nargs = 0, uint64_t arg0 = 0, uint64_t arg1 = 0)
+    : m_name(name), m_nargs(nargs), m_arg0(arg0), m_arg1(arg1)
+    , m_begin_ns(enabled() ? now_ns() : 0)
+  {}
+
+  ~scope()
+  {
+    if (m_begin_ns)
+      add(m_name, m_begin_ns, now_ns(), m_nargs, m_arg0, m_arg1);
+  }
+
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+
+private:
+  const char *m_name;
+  unsigned m_nargs;
+  uint64_t m_arg0;
+  uint64_t m_arg1;
+  uint64_t m_begin_ns;
+};
+
+} // namespace shim_xdna::trace_recorder
+
+#define SHIM_TRACE_POINT_LOG(p)                                         \
+  do {                                                                  \
+    XRT_TRACE_POINT_LOG(p);                                             \
+    if (shim_xdna::trace_recorder::enabled())                           \
+      shim_xdna::trace_recorder::add(#p, shim_xdna::trace_recorder::now_ns(), 0, 0, 0, 0); \
+  } while (0)
+
+#define SHIM_DETAIL_TRACE_POINT_LOG(p, a0, a1)                          \
+  do {                                                                  \
+    XRT_DETAIL_TRACE_POINT_LOG(p, a0, a1);                              \
+    if (shim_xdna::trace_recorder::enabled())                           \
+      shim_xdna::trace_recorder::add(#p, shim_xdna::trace_recorder::now_ns(), 0, 2, \
+        shim_xdna::trace_recorder::to_arg(a0), shim_xdna::trace_recorder::to_arg(a1)); \
+  } while (0)
+
+#define SHIM_TRACE_POINT_SCOPE1(p, a0)                                  \
+  XRT_TRACE_POINT_SCOPE1(p, a0);                                        \
+  shim_xdna::trace_recorder::scope shim_trace_scope_##p(#p, 1,          \
+    shim_xdna::trace_recorder::to_arg(a0))
+
+#define SHIM_TRACE_POINT_SCOPE2(p, a0, a1)                              \
+  XRT_TRACE_POINT_SCOPE2(p, a0, a1);                                    \
+  shim_xdna::trace_recorder::scope shim_trace_scope_##p(#p, 2,          \
+    shim_xdna::trace_recorder::to_arg(a0), shim_xdna::trace_recorder::to_arg(a1))
+
+#endif
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "trace_stream.h"
+#include "shim_debug.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+using namespace shim_xdna::trace_stream;
+
+uint64_t
+now_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+class writer
+{
+public:
+  writer()
+  {
+    auto path = xrt_core::config::detail::get_string_value("Debug.trace_stream", "");
+    if (path.empty())
+      return;
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file) {
+      shim_info("Failed to open trace stream %s, errno %d", path.c_str(), errno);
+      return;
+    }
+
+    file_header hdr = {};
+    std::memcpy(hdr.magic, file_magic, sizeof(hdr.magic));
+    hdr.version = file_version;
+    hdr.pid = getpid();
+    hdr.ts_ns = now_ns();
+    std::fwrite(&hdr, sizeof(hdr), 1, m_file);
+  }
+
+  ~writer()
+  {
+    if (m_file)
+      std::fclose(m_file);
+  }
+
+  bool
+  enabled() const
+  {
+    return m_file != nullptr;
+  }
+
+  // Frames may be written in two parts, head is usually a small fixed struct.
+  void
+  write(event type, const void *head, size_t head_size, const void *tail, size_t tail_size)
+  {
+    static const uint64_t zero = 0;
+    frame_header hdr = {};
+    hdr.type = static_cast<uint16_t>(type);
+    hdr.size = static_cast<uint32_t>(head_size + tail_size);
+    hdr.ts_ns = now_ns();
+    size_t pad = (8 - (hdr.size & 7)) & 7;
+
+    const std::lock_guard<std::mutex> lock(m_lock);
+    std::fwrite(&hdr, sizeof(hdr), 1, m_file);
+    if (head_size)
+      std::fwrite(head, head_size, 1, m_file);
+    if (tail_size)
+      std::fwrite(tail, tail_size, 1, m_file);
+    if (pad)
+      std::fwrite(&zero, pad, 1, m_file);
+  }
+
+  // Only emit fw_clock when firmware got re-calibrated, e.g. after resume.
+  void
+  update_fw_clock(int64_t offset_ns)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(m_lock);
+      if (m_have_fw_clock && m_fw_clock_offset_ns == offset_ns)
+        return;
+      m_have_fw_clock = true;
+      m_fw_clock_offset_ns = offset_ns;
+    }
+    write(event::fw_clock, &offset_ns, sizeof(offset_ns), nullptr, 0);
+  }
+
+private:
+  std::FILE *m_file = nullptr;
+  std::mutex m_lock;
+  bool m_have_fw_clock = false;
+  int64_t m_fw_clock_offset_ns = 0;
+};
+
+writer&
+get_writer()
+{
+  static writer w;
+  return w;
+}
+
+uint64_t
+bo_sample_size()
+{
+  static uint64_t sz =
+    xrt_core::config::detail::get_uint_value("Debug.trace_stream_bo_sample", 0);
+  return sz;
+}
+
+uint64_t
+to_key(const void *p)
+{
+  return reinterpret_cast<uintptr_t>(p);
+}
+
+}
+
+namespace shim_xdna::trace_stream {
+
+bool
+enabled()
+{
+  static bool on = get_writer().enabled();
+  return on;
+}
+
+void
+emit(event type, const void *payload, size_t size)
+{
+  if (!enabled())
+    return;
+  get_writer().write(type, payload, size, nullptr, 0);
+}
+
+void
+emit_cmd(event type, uint64_t bo_handle, uint64_t seq)
+{
+  if (!enabled())
+    return;
+  cmd_payload p = { .bo_handle = bo_handle, .seq = seq };
+  get_writer().write(type, &p, sizeof(p), nullptr, 0);
+}
+
+void
+emit_bo(event type, const void *bo, uint64_t bo_handle, uint64_t size, uint64_t flags)
+{
+  if (!enabled())
+    return;
+  bo_payload p = { .bo_key = to_key(bo), .bo_handle = bo_handle, .size = size, .flags = flags };
+  get_writer().write(type, &p, sizeof(p), nullptr, 0);
+}
+
+void
+emit_bo_sync(const void *bo, uint32_t direction, uint64_t offset, uint64_t size, const void *data)
+{
+  if (!enabled())
+    return;
+  bo_sync_payload p = {
+    .bo_key = to_key(bo), .offset = offset, .size = size, .direction = direction, .reserved = 0
+  };
+  auto sample = std::min(size, bo_sample_size());
+  if (data && sample) {
+    p.size = sample;
+    get_writer().write(event::bo_content, &p, sizeof(p), data, sample);
+    p.size = size;
+  }
+  get_writer().write(event::bo_sync, &p, sizeof(p), nullptr, 0);
+}
+
+void
+emit_fence(event type, const void *fence, uint64_t state)
+{
+  if (!enabled())
+    return;
+  fence_payload p = { .fence_key = to_key(fence), .state = state };
+  get_writer().write(type, &p, sizeof(p), nullptr, 0);
+}
+
+void
+emit_fw(event type, int64_t clock_offset_ns, uint64_t abs_offset, const void *data, size_t size)
+{
+  if (!enabled() || !size)
+    return;
+  get_writer().update_fw_clock(clock_offset_ns);
+  fw_payload p = { .abs_offset = abs_offset };
+  get_writer().write(type, &p, sizeof(p), data, size);
+}
+
+} // namespace shim_xdna::trace_stream
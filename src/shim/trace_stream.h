@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef TRACE_STREAM_XDNA_H
+#define TRACE_STREAM_XDNA_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Compact binary trace stream shared by host side events and firmware trace/log
+// data, enabled by setting Debug.trace_stream to an output file path.
+//
+// File layout: one file_header, followed by frames. Every frame is a
+// frame_header plus payload, padded to 8 bytes. Host timestamps are
+// CLOCK_MONOTONIC nanoseconds. Firmware frames carry the raw DPT bytes as
+// read from the driver; the most recent fw_clock frame gives the offset to
+// subtract from firmware timestamps to land on the same clock.
+//
+// BO and fence frames record what app did, so that it can be replayed on a
+// device later, see the trace replay test cases of shim_test. BOs and fences
+// are identified by the address of their shim object, which is unique while
+// they are alive. Debug.trace_stream_bo_sample sets how many bytes at the
+// start of each host2device synced range are kept as bo_content.
+namespace shim_xdna::trace_stream {
+
+constexpr char file_magic[8] = { 'X', 'D', 'N', 'A', 'T', 'R', 'C', '\0' };
+constexpr uint32_t file_version = 1;
+
+struct file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t pid;
+  uint64_t ts_ns;
+};
+
+enum class event : uint16_t {
+  fw_clock = 1,       // payload: int64_t firmware minus monotonic offset in ns
+  cmd_submit = 2,     // payload: cmd_payload
+  cmd_wait_begin = 3, // payload: cmd_payload
+  cmd_wait_end = 4,   // payload: cmd_payload
+  fw_trace = 5,       // payload: fw_payload + raw firmware trace bytes
+  fw_log = 6,         // payload: fw_payload + raw firmware log bytes
+  cmd_exec = 7,       // payload: cmd_exec_payload
+  bo_alloc = 8,       // payload: bo_payload
+  bo_free = 9,        // payload: bo_payload, bo_handle is not set
+  bo_sync = 10,       // payload: bo_sync_payload
+  bo_content = 11,    // payload: bo_sync_payload + sampled BO bytes, ahead of its bo_sync
+  fence_wait = 12,    // payload: fence_payload, wait submitted to hwq
+  fence_signal = 13,  // payload: fence_payload, signal submitted to hwq
+};
+
+struct frame_header {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t size;      // payload bytes, excluding padding
+  uint64_t ts_ns;
+};
+
+struct cmd_payload {
+  uint64_t bo_handle;
+  uint64_t seq;
+};
+
+// Device side execution, see Debug.cmd_timestamps
+struct cmd_exec_payload {
+  uint64_t bo_handle;
+  uint64_t seq;
+  uint64_t start_ns;
+  uint64_t end_ns;
+};
+
+struct bo_payload {
+  uint64_t bo_key;
+  uint64_t bo_handle;
+  uint64_t size;
+  uint64_t flags;     // XRT BO flags it was allocated with
+};
+
+struct bo_sync_payload {
+  uint64_t bo_key;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t direction; // xrt_core::buffer_handle::direction
+  uint32_t reserved;
+};
+
+struct fence_payload {
+  uint64_t fence_key;
+  uint64_t state;
+};
+
+struct fw_payload {
+  uint64_t abs_offset; // stream offset of the first raw byte
+};
+
+bool
+enabled();
+
+void
+emit(event type, const void *payload, size_t size);
+
+void
+emit_cmd(event type, uint64_t bo_handle, uint64_t seq);
+
+void
+emit_bo(event type, const void *bo, uint64_t bo_handle, uint64_t size, uint64_t flags);
+
+// data, if not nullptr, is the synced range as seen by CPU, to be sampled.
+void
+emit_bo_sync(const void *bo, uint32_t direction, uint64_t offset, uint64_t size, const void *data);
+
+void
+emit_fence(event type, const void *fence, uint64_t state);
+
+void
+emit_fw(event type, int64_t clock_offset_ns, uint64_t abs_offset, const void *data, size_t size);
+
+} // namespace shim_xdna::trace_stream
+
+#endif
@@ -13,11 +13,35 @@ extern "C"
 #define ATTACH_CMD 1
 #define READ_MEM_CMD 2
 #define WRITE_MEM_CMD 3
+#define READ_MEM_BULK_CMD 4
+#define WRITE_MEM_BULK_CMD 5
 #define DETACH_CMD 0xffff
 
 #define AIE_DBG_SUCCESS 0
+#define AIE_DBG_INVALID_REQ 0xfffe
 #define AIE_DBG_NOT_ATTACHED 0xffff
 
+/*
+ * Bulk commands move up to AIE_DBG_BULK_MAX bytes in one request. Every
+ * request and response is prefixed by its length in bytes, same as other
+ * commands. Requests may be sent back to back without waiting, responses
+ * come back in request order.
+ *
+ * READ_MEM_BULK_CMD request:  cmd
+ *                   response: status, flags, data
+ * WRITE_MEM_BULK_CMD request: cmd, data
+ *                   response: status
+ *
+ * bulk_mem.length is the size of the memory in bytes, multiple of word. With
+ * AIE_DBG_BULK_ZRLE in flags, data may be zero run length encoded. It's a
+ * sequence of tokens, each word either 0x80000000 | n for n zero words, or
+ * n followed by n literal words. The flags of a read response tell whether
+ * the server did encode data, it only does if that makes it smaller.
+ */
+#define AIE_DBG_BULK_MAX (64 << 20)
+#define AIE_DBG_BULK_ZRLE 0x1
+#define AIE_DBG_ZRLE_ZERO_RUN 0x80000000
+
 struct aie_debugger_cmd
 {
   uint32_t type;
@@ -37,6 +61,12 @@ struct aie_debugger_cmd
       uint32_t aie_addr;
       uint32_t data[1]; 
     } write_mem;
+    struct Bulk_mem
+    {
+      uint32_t aie_addr;
+      uint32_t length;
+      uint32_t flags;
+    } bulk_mem;
   } cmd;
 };
 
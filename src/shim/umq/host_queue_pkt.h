@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _HOST_QUEUE_PKT_H_
+#define _HOST_QUEUE_PKT_H_
+
+#include "host_queue.h"
+#include "core/include/ert.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Encoders of exec_buf host queue packets. Packet is composed in a local,
+// which compiler keeps in registers, and is then stored into its slot with
+// 64-bit writes. Writing field by field through volatile pointers, instead,
+// turns every bitfield and 16-bit field into its own read-modify-write of
+// queue memory, which is uncached on some platforms.
+//
+// Packet kind is picked at compile time by number of uCs cmd runs on, so
+// that each variant is straight line code without loops over the chain.
+
+namespace shim_xdna {
+
+// Store src into queue memory at dst with 64-bit writes.
+template <typename T>
+inline void
+host_queue_store(volatile T *dst, const T& src)
+{
+  static_assert(sizeof(T) % sizeof(uint64_t) == 0, "packet is not made of 64-bit words");
+  static_assert(alignof(T) >= alignof(uint32_t), "packet is not word aligned");
+
+  uint64_t w[sizeof(T) / sizeof(uint64_t)];
+  std::memcpy(w, &src, sizeof(T));
+  auto d = reinterpret_cast<volatile uint64_t *>(dst);
+  for (size_t i = 0; i < sizeof(T) / sizeof(uint64_t); i++)
+    d[i] = w[i];
+}
+
+inline exec_buf
+host_queue_exec_buf(uint64_t ctrl_code)
+{
+  exec_buf eb = {};
+  eb.dpu_control_code_host_addr_low = static_cast<uint32_t>(ctrl_code);
+  eb.dpu_control_code_host_addr_high = static_cast<uint32_t>(ctrl_code >> 32);
+  return eb;
+}
+
+// NUM_UC is 1 for direct packet, otherwise packet is indirect with one
+// level 2 host_indirect_data per uC.
+template <unsigned NUM_UC>
+struct exec_buf_encoder
+{
+  static_assert(NUM_UC >= 1 && NUM_UC < HSA_MAX_LEVEL1_INDIRECT_ENTRIES,
+    "unsupported number of uCs");
+  static_assert(NUM_UC * sizeof(host_indirect_packet_entry) <= sizeof(host_queue_packet::data),
+    "indirect entries do not fit in packet");
+
+  static constexpr bool is_indirect = NUM_UC > 1;
+
+  // Packet of cmd whose first uC data is dpu, chain of dpu has to be NUM_UC
+  // long. For indirect, indirect_paddr is device address of the level 2 data
+  // of the slot.
+  static host_queue_packet
+  encode(ert_dpu_data *dpu, uint64_t completion_signal, uint64_t indirect_paddr)
+  {
+    host_queue_packet pkt = {};
+    auto& hdr = pkt.xrt_header;
+
+    hdr.common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
+    hdr.common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
+    hdr.completion_signal = completion_signal;
+
+    if constexpr (is_indirect) {
+      host_indirect_packet_entry hp[NUM_UC] = {};
+      for (unsigned i = 0; i < NUM_UC; i++, dpu = get_ert_dpu_data_next(dpu)) {
+        auto buf_paddr = indirect_paddr + i * sizeof(host_indirect_data);
+        hp[i].host_addr_low = static_cast<uint32_t>(buf_paddr);
+        hp[i].host_addr_high = static_cast<uint32_t>(buf_paddr >> 32);
+        hp[i].uc_index = dpu->uc_index;
+      }
+      std::memcpy(pkt.data, hp, sizeof(hp));
+      hdr.common_header.count = sizeof(hp);
+      hdr.common_header.distribute = 1;
+      hdr.common_header.indirect = 1;
+    } else {
+      auto eb = host_queue_exec_buf(dpu->instruction_buffer);
+      std::memcpy(pkt.data, &eb, sizeof(eb));
+      hdr.common_header.count = sizeof(eb);
+    }
+
+    return pkt;
+  }
+
+  // Fill payloads of level 2 data of the slot, their headers are pre-set.
+  static void
+  store_indirect_data(ert_dpu_data *dpu, volatile host_indirect_data *data)
+  {
+    static_assert(is_indirect, "direct packet has no level 2 data");
+    static_assert(offsetof(host_indirect_data, payload) % sizeof(uint64_t) == 0,
+      "payload is not 64-bit aligned");
+
+    for (unsigned i = 0; i < NUM_UC; i++, dpu = get_ert_dpu_data_next(dpu))
+      host_queue_store(&data[i].payload, host_queue_exec_buf(dpu->instruction_buffer));
+  }
+};
+
+} // namespace shim_xdna
+
+#endif
@@ -14,8 +14,7 @@ hwctx_umq(const device& device, const xrt::xclbin& xclbin, const qos_type& qos)
   , m_pdev(device.get_pdev())
 {
   shim_debug("Created UMQ HW context (%d)", get_slotidx());
-  xclbin_parser xp(xclbin);
-  m_col_cnt = xp.get_column_cnt();
+  m_col_cnt = device.get_xclbin_parser(xclbin)->get_column_cnt();
 
   auto path = xrt_core::config::get_dtrace_control_file_path();
   if (std::filesystem::exists(path))
@@ -2,10 +2,21 @@
 // Copyright (C) 2023-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "hwq.h"
-#include "core/common/trace.h"
+#include "host_queue_pkt.h"
+#include "core/common/config_reader.h"
+#include "../trace_recorder.h"
 
 namespace {
 
+// How long to poll host queue in user space before waiting in driver.
+uint64_t
+get_poll_wait_us()
+{
+  static uint64_t poll_us =
+    xrt_core::config::detail::get_uint_value("Runtime.umq_poll_wait_us", 1000);
+  return poll_us;
+}
+
 void
 init_indirect_buf(volatile struct host_indirect_data *indirect_buf, int size)
 {
@@ -33,6 +44,7 @@ namespace shim_xdna {
 hwq_umq::
 hwq_umq(const device& dev, size_t nslots) : hwq(dev)
 {
+  SHIM_TRACE_POINT_SCOPE1(hwq_umq_alloc, nslots);
   // host queue layout:
   //   host_queue_header_t
   //   host_queue_packet_t [nslots]
@@ -145,14 +157,11 @@ dump_raw() const
 
 uint32_t
 hwq_umq::
-get_next_avail_slot()
+get_next_avail_slot(uint64_t wi)
 {
-  uint64_t cur_slot = 0;
   auto h = m_umq_hdr;
 
   do {
-    // Take a snapshot of read and write index in case they changes while being processed here
-    uint64_t wi = h->write_index;
     uint64_t ri = h->read_index;
 
     if (wi < ri) {
@@ -161,16 +170,37 @@ get_next_avail_slot()
       shim_err(EINVAL, "UMQ was read before written! read_index=0x%lx, write_index=0x%lx", ri, wi);
     } else if ((wi - ri) < h->capacity) {
       // Found a slot.
-      cur_slot = wi;
       break;
     } else {
       shim_debug("Queue is full, wait for next available slot");
-      // The ri is the first available slot.
-      wait_command(ri, 0);
+      // uC can only free up slots which have been published to it.
+      publish_slots(wi);
+      // The ri is the first available slot, which is free once uC moves
+      // read_index past it.
+      if (!backoff_wait([h, ri]() { return h->read_index > ri; }, get_poll_wait_us()))
+        wait_command(ri, 0);
     }
   } while (true);
 
-  return cur_slot & (h->capacity - 1);
+  return wi & (h->capacity - 1);
+}
+
+void
+hwq_umq::
+publish_slots(uint64_t wi)
+{
+  // Nothing new, or already published by early ring.
+  if (wi <= m_umq_hdr->write_index)
+    return;
+
+  // Issue mfence instruction to make sure all writes to the slots before is done.
+  std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
+  // Indicates the slots are ready for processing by uC.
+  // Must be the last step after all pkts are filled up.
+  m_umq_hdr->write_index = wi;
+
+  // Wake up uC in case it is sleeping and waiting.
+  *m_mapped_doorbell = 0;
 }
 
 volatile struct host_queue_packet *
@@ -182,7 +212,7 @@ get_pkt(uint32_t index)
 
 uint64_t
 hwq_umq::
-issue_single_exec_buf(const cmd_buffer *cmd_bo, bool last_of_chain)
+fill_single_exec_buf(const cmd_buffer *cmd_bo, uint64_t wi, bool last_of_chain)
 {
   auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(cmd_bo->vaddr());
   auto dpu = get_ert_dpu_data(cmd);
@@ -198,30 +228,36 @@ issue_single_exec_buf(const cmd_buffer *cmd_bo, bool last_of_chain)
     shim_err(EINVAL, "No dpu data, invalid exec buf");
   }
 
-  auto slot_idx = get_next_avail_slot();
-
-  if (get_ert_dpu_data_next(dpu))
-    fill_indirect_exec_buf(slot_idx, dpu);
-  else
-    fill_direct_exec_buf(slot_idx, dpu); 
-
-  auto pkt = get_pkt(slot_idx);
-  auto hdr = &pkt->xrt_header;
-  hdr->common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
+  auto slot_idx = get_next_avail_slot(wi);
   // Completion signal area has to be a full WORD, we utilize the command_bo header.
-  hdr->completion_signal = cmd_bo->paddr() + offsetof(ert_start_kernel_cmd, header);
-  // TODO: remove once uC stops looking at this field.
-  hdr->common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
+  auto completion_signal = cmd_bo->paddr() + offsetof(ert_start_kernel_cmd, header);
+
+  switch (dpu->chained + 1) {
+  case 1:
+    fill_exec_buf<1>(slot_idx, dpu, completion_signal);
+    break;
+  case 2:
+    fill_exec_buf<2>(slot_idx, dpu, completion_signal);
+    break;
+  case 3:
+    fill_exec_buf<3>(slot_idx, dpu, completion_signal);
+    break;
+  case 4:
+    fill_exec_buf<4>(slot_idx, dpu, completion_signal);
+    break;
+  case 5:
+    fill_exec_buf<5>(slot_idx, dpu, completion_signal);
+    break;
+  default:
+    shim_err(EINVAL, "unsupported indirect number %d, valid number < %d",
+      dpu->chained + 1, HSA_MAX_LEVEL1_INDIRECT_ENTRIES);
+  }
 
-  // Issue mfence instruction to make sure all writes to the slot before is done.
-  std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
-  // Indicates the slot is ready for processing by uC.
-  // Must be the last step after pkt is filled up.
-  uint64_t wi = m_umq_hdr->write_index++;
-
-  // Wake up uC in case it is sleeping and waiting.
-  *m_mapped_doorbell = 0;
-  XRT_DETAIL_TRACE_POINT_LOG(umq_cmd_submitted, cmd_bo->id().handle, wi);
+  // If uC has run out of work, do not keep it waiting for the rest of the
+  // batch, ring it now. Otherwise, it is rung once the batch is filled.
+  if (m_umq_hdr->read_index == m_umq_hdr->write_index)
+    publish_slots(wi + 1);
+  SHIM_DETAIL_TRACE_POINT_LOG(umq_cmd_submitted, cmd_bo->id().handle, wi);
 
   shim_debug("Submitted %s-uC %scommand (%ld)",
     get_ert_dpu_data_next(dpu) ? "multi" : "single",
@@ -230,82 +266,25 @@ issue_single_exec_buf(const cmd_buffer *cmd_bo, bool last_of_chain)
   return wi;
 }
 
+template <unsigned NUM_UC>
 void
 hwq_umq::
-fill_indirect_exec_buf(uint32_t slot_idx, ert_dpu_data *dpu)
+fill_exec_buf(uint32_t slot_idx, ert_dpu_data *dpu, uint64_t completion_signal)
 {
-  auto pkt = get_pkt(slot_idx);
-  auto pkt_size = (dpu->chained + 1) * sizeof(struct host_indirect_packet_entry);
-
-  if (dpu->chained + 1 >= HSA_MAX_LEVEL1_INDIRECT_ENTRIES)
-    shim_err(EINVAL, "unsupported indirect number %d, valid number <= %d",
-      dpu->chained + 1, HSA_MAX_LEVEL1_INDIRECT_ENTRIES);
+  using encoder = exec_buf_encoder<NUM_UC>;
+  uint64_t indirect_paddr = 0;
 
-  if (pkt_size > sizeof(pkt->data))
-    shim_err(EINVAL, "dpu pkt_size=0x%zx > pkt_data max size=0x%zx",
-      pkt_size, sizeof(pkt->data));
-
-  // no need to memset to zero, all buffer will be set
-  volatile struct host_indirect_packet_entry *hp =
-    reinterpret_cast<volatile struct host_indirect_packet_entry *>(pkt->data);
-
-  for (int i = 0; dpu; i++, hp++, dpu = get_ert_dpu_data_next(dpu)) {
-    auto data_size = sizeof(struct host_indirect_data) * HSA_MAX_LEVEL1_INDIRECT_ENTRIES;
-    auto prefix_off = slot_idx * data_size;
+  if constexpr (encoder::is_indirect) {
     auto prefix_idx = slot_idx * HSA_MAX_LEVEL1_INDIRECT_ENTRIES;
-    auto buf_paddr = m_indirect_paddr + prefix_off +
-       sizeof(struct host_indirect_data) * i;
-
-    hp->host_addr_low = static_cast<uint32_t>(buf_paddr);
-    hp->host_addr_high = static_cast<uint32_t>(buf_paddr >> 32);
-    hp->uc_index = dpu->uc_index;
-
-    auto cebp = &m_umq_indirect_buf[prefix_idx + i];
-    // do not zero this buffer, the cebp->header is pre-set 
-    // set every cebp->payload field in case of garbage data
-    cebp->payload.dpu_control_code_host_addr_low =
-      static_cast<uint32_t>(dpu->instruction_buffer);
-    cebp->payload.dpu_control_code_host_addr_high =
-      static_cast<uint32_t>(dpu->instruction_buffer >> 32);
-    cebp->payload.args_len = 0;
-    cebp->payload.args_host_addr_low = 0;
-    cebp->payload.args_host_addr_high = 0;
+    indirect_paddr = m_indirect_paddr + prefix_idx * sizeof(struct host_indirect_data);
+    encoder::store_indirect_data(dpu, &m_umq_indirect_buf[prefix_idx]);
   }
-
-  auto hdr = &pkt->xrt_header;
-  hdr->common_header.distribute = 1;
-  hdr->common_header.indirect = 1;
-  hdr->common_header.count = pkt_size;
-}
-
-void
-hwq_umq::
-fill_direct_exec_buf(uint32_t slot_idx, ert_dpu_data *dpu)
-{
-  auto pkt = get_pkt(slot_idx);
-  auto pkt_size = sizeof(struct exec_buf);
-
-  if (pkt_size > sizeof(pkt->data))
-    shim_err(EINVAL, "dpu pkt_size=0x%lx > pkt_data max size=%x%lx",
-      pkt_size, sizeof(pkt->data));
-  
-  // zero this buffer
-  auto data = const_cast<uint32_t *>(pkt->data);
-  std::memset(data, 0, pkt_size);
-  // set correct dpu control code
-  volatile struct exec_buf *ebp = reinterpret_cast<volatile struct exec_buf *>(pkt->data);
-  ebp->dpu_control_code_host_addr_low = static_cast<uint32_t>(dpu->instruction_buffer);
-  ebp->dpu_control_code_host_addr_high = static_cast<uint32_t>(dpu->instruction_buffer >> 32);
-
-  auto hdr = &pkt->xrt_header;
-  hdr->common_header.distribute = 0;
-  hdr->common_header.indirect = 0;
-  hdr->common_header.count = pkt_size;
+  host_queue_store(get_pkt(slot_idx), encoder::encode(dpu, completion_signal, indirect_paddr));
 }
 
 uint64_t
 hwq_umq::
-issue_command(const cmd_buffer *cmd_bo)
+fill_command(const cmd_buffer *cmd_bo, uint64_t& wi)
 {
   auto cmd = reinterpret_cast<ert_packet *>(cmd_bo->vaddr());
   auto& subcmds = cmd_bo->get_subcmd_list();
@@ -313,25 +292,81 @@ issue_command(const cmd_buffer *cmd_bo)
 
   // Single command submission.
   if (cmd->opcode != ERT_CMD_CHAIN)
-    return issue_single_exec_buf(cmd_bo, true);
+    return fill_single_exec_buf(cmd_bo, wi++, true);
 
-  // Runlist command submission.
+  // Runlist command submission. Number of sub-cmds is only bounded by what
+  // the exec buf can hold. Chain longer than the queue is fine since filled
+  // slots are published to uC while waiting for free ones.
   auto payload = get_ert_cmd_chain_data(cmd);
-  if (payload->command_count == 0 || payload->command_count > 100)
+  size_t payload_len = cmd->count * sizeof(uint32_t);
+  if (payload_len > cmd_bo->size() - sizeof(cmd->header))
+    shim_err(EINVAL, "Runlist exec buf payload len %zx is beyond BO size %zx", payload_len, cmd_bo->size());
+  if (payload->command_count == 0 ||
+    payload_len < sizeof(*payload) + payload->command_count * sizeof(payload->data[0]))
     shim_err(EINVAL, "Runlist exec buf with bad num of subcmds: %zx", payload->command_count);
 
   if (subcmds.capacity() < payload->command_count)
     subcmds.reserve(payload->command_count);
 
+  // Sub-cmds take consecutive slots, wi moves only when all are filled.
   uint64_t seq = 0;
+  uint64_t next = wi;
   for (size_t i = 0; i < payload->command_count; i++) {
     auto subcmd = static_cast<const cmd_buffer *>(m_pdev.find_bo_by_handle(payload->data[i]));
-    seq = issue_single_exec_buf(subcmd, i == payload->command_count - 1);
+    seq = fill_single_exec_buf(subcmd, next++, i == payload->command_count - 1);
     subcmds.push_back(subcmd);
   }
+  wi = next;
+  return seq;
+}
+
+uint64_t
+hwq_umq::
+issue_command(const cmd_buffer *cmd_bo)
+{
+  std::lock_guard<std::mutex> lock(m_slot_lock);
+  uint64_t wi = m_umq_hdr->write_index;
+
+  auto seq = fill_command(cmd_bo, wi);
+  publish_slots(wi);
   return seq;
 }
 
+void
+hwq_umq::
+issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs)
+{
+  std::lock_guard<std::mutex> lock(m_slot_lock);
+  uint64_t wi = m_umq_hdr->write_index;
+
+  // Fill up slots for all cmds, then publish them to uC all at once.
+  try {
+    for (auto cmd_bo : cmds)
+      seqs.push_back(fill_command(cmd_bo, wi));
+  }
+  catch (...) {
+    publish_slots(wi);
+    throw;
+  }
+  publish_slots(wi);
+}
+
+bool
+hwq_umq::
+user_wait_command(const cmd_buffer *cmd, uint32_t timeout_ms) const
+{
+  // uC writes cmd state straight into the completion signal word, which is
+  // the cmd BO header.
+  uint64_t budget_us = get_poll_wait_us();
+  if (timeout_ms)
+    budget_us = std::min<uint64_t>(budget_us, timeout_ms * 1000ul);
+  if (!budget_us)
+    return false;
+
+  auto cmdpkt = reinterpret_cast<volatile ert_packet *>(cmd->vaddr());
+  return backoff_wait([cmdpkt]() { return is_cmd_state_done(cmdpkt->state); }, budget_us);
+}
+
 void
 hwq_umq::
 bind_hwctx(const hwctx& ctx)
@@ -32,10 +32,24 @@ private:
   volatile struct host_indirect_data *m_umq_indirect_buf = nullptr;
   uint64_t m_indirect_paddr;
   volatile uint32_t *m_mapped_doorbell = nullptr;
+  // Host queue slots and write_index are shared by all submitting threads.
+  // Held from filling the first slot of a batch till publishing the last.
+  std::mutex m_slot_lock;
 
   uint64_t
   issue_command(const cmd_buffer *cmd_bo) override;
 
+  bool
+  user_wait_command(const cmd_buffer *cmd, uint32_t timeout_ms) const override;
+
+  void
+  issue_commands(const std::vector<const cmd_buffer *>& cmds, std::vector<uint64_t>& seqs) override;
+
+  // Fill slots for cmd starting at wi without publishing them to uC. wi is
+  // moved past the filled slots.
+  uint64_t
+  fill_command(const cmd_buffer *cmd_bo, uint64_t& wi);
+
   void
   dump() const;
 
@@ -43,19 +57,22 @@ private:
   dump_raw() const;
 
   uint32_t
-  get_next_avail_slot();
+  get_next_avail_slot(uint64_t wi);
+
+  // Make all slots before wi visible to uC and ring the doorbell.
+  void
+  publish_slots(uint64_t wi);
 
   volatile struct host_queue_packet *
   get_pkt(uint32_t index);
 
+  // Fill slot idx with exec_buf packet of a cmd running on NUM_UC uCs.
+  template <unsigned NUM_UC>
   void
-  fill_direct_exec_buf(uint32_t idx, ert_dpu_data *dpu);
-
-  void 
-  fill_indirect_exec_buf(uint32_t idx, ert_dpu_data *dpu);
+  fill_exec_buf(uint32_t idx, ert_dpu_data *dpu, uint64_t completion_signal);
 
   uint64_t
-  issue_single_exec_buf(const cmd_buffer *cmd_bo, bool last_of_chain);
+  fill_single_exec_buf(const cmd_buffer *cmd_bo, uint64_t wi, bool last_of_chain);
 };
 
 }
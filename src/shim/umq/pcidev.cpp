@@ -33,6 +33,20 @@ get_heap_vaddr() const
   return nullptr;
 }
 
+bool
+pdev_umq::
+has_dev_heap() const
+{
+  return false;
+}
+
+void
+pdev_umq::
+reserve_dev_heap(size_t size) const
+{
+  // do nothing
+}
+
 uint64_t
 pdev_umq::
 get_heap_paddr() const
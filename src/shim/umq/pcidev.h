@@ -23,6 +23,12 @@ public:
   void *
   get_heap_vaddr() const override;
 
+  bool
+  has_dev_heap() const override;
+
+  void
+  reserve_dev_heap(size_t size) const override;
+
   bool
   is_umq() const override;
 
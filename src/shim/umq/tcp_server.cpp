@@ -2,12 +2,72 @@
 // Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
 #include "tcp_server.h"
 
+namespace {
+
+// Bulk transfers go through the data BO this many words at a time
+constexpr size_t bulk_chunk_words = (1 << 20) / sizeof(uint32_t);
+
+// Zero run length encoding of bulk data, see aiedbg.h
+void
+zrle_encode(const uint32_t *in, size_t words, std::vector<uint32_t> &out)
+{
+  size_t i = 0;
+
+  while (i < words) {
+    size_t j = i;
+    while (j < words && !in[j] && j - i < ~AIE_DBG_ZRLE_ZERO_RUN)
+      j++;
+    if (j - i > 1) {
+      out.push_back(AIE_DBG_ZRLE_ZERO_RUN | (j - i));
+      i = j;
+      continue;
+    }
+
+    // Literals until next run of at least two zero words
+    j = i;
+    while (j < words && !(j + 1 < words && !in[j] && !in[j + 1]) &&
+      j - i < ~AIE_DBG_ZRLE_ZERO_RUN)
+      j++;
+    out.push_back(j - i);
+    out.insert(out.end(), in + i, in + j);
+    i = j;
+  }
+}
+
+bool
+zrle_decode(const uint32_t *in, size_t in_words, uint32_t *out, size_t words)
+{
+  size_t o = 0;
+
+  for (size_t i = 0; i < in_words;) {
+    uint32_t tok = in[i++];
+    size_t n = tok & ~AIE_DBG_ZRLE_ZERO_RUN;
+
+    if (n > words - o)
+      return false;
+    if (tok & AIE_DBG_ZRLE_ZERO_RUN) {
+      std::fill(out + o, out + o + n, 0);
+    } else {
+      if (n > in_words - i)
+        return false;
+      std::copy(in + i, in + i + n, out + o);
+      i += n;
+    }
+    o += n;
+  }
+  return o == words;
+}
+
+}
+
 namespace shim_xdna {
 
 tcp_server::
@@ -116,8 +176,22 @@ start()
     bool loop = true;
     while (loop)
     {
-      int length = 0;
-      ssize_t n = recv(clientSocket, &length, sizeof(int), MSG_DONTWAIT);
+      // Wait for the next request. Don't sleep when nothing is there yet,
+      // so that pipelined requests are served back to back. Wake up every
+      // second to check if we are asked to stop.
+      struct pollfd pfd = { clientSocket, POLLIN, 0 };
+      int ready = poll(&pfd, 1, 1000);
+      if (m_srv_stop == 1)
+      {
+        shim_debug("Tcp connection exit!\n");
+        loop = false;
+        break;
+      }
+      if (ready <= 0)
+        continue;
+
+      uint32_t length = 0;
+      ssize_t n = recv(clientSocket, &length, sizeof(length), MSG_WAITALL);
 
       if (n == 0)
       {
@@ -127,38 +201,31 @@ start()
         loop = false;
         break;
       }
-      else if (n < 0)
-      {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-          continue;
-        }
-        else if (errno == EINTR && m_srv_stop == 1)
-        {
-          shim_debug("Tcp connection exit!\n");
-          loop = false;
-          break;
-        }
-      }
 
-      //we don't expect front end read/write longer than 64k in one cmd
-      //and length must be multiple of word
-      if (length <= 0 || length > 0x10000 ||
+      //we don't expect front end read/write longer than 64k in one cmd,
+      //except for bulk write, and length must be multiple of word
+      if (n != sizeof(length) || length == 0 ||
+        length > sizeof(aie_debugger_cmd) + AIE_DBG_BULK_MAX ||
         (length % sizeof(uint32_t) != 0))
       {
         shim_debug("tcp server recv() length failure\n");
         break;
       }
       std::vector<uint32_t> buffer(length >> 2);
-      n = recv(clientSocket, buffer.data(), length, 0);
-      if (n <= 0)
+      if (!recv_all(clientSocket, buffer.data(), length))
       {
         shim_debug("tcp server recv() data failure\n");
         break;
       }
+      bool ok = true;
 
       auto cmd = reinterpret_cast<aie_debugger_cmd *>(buffer.data());
+      if ((cmd->type == READ_MEM_BULK_CMD || cmd->type == WRITE_MEM_BULK_CMD) &&
+        length < sizeof(aie_debugger_cmd))
+      {
+        shim_debug("tcp server bulk cmd too short\n");
+        break;
+      }
       switch (cmd->type)
       {
         case ATTACH_CMD:
@@ -167,7 +234,7 @@ start()
           std::vector<uint32_t> ret;
           ret.push_back(sizeof(uint32_t));
           ret.push_back(status);
-          n = send(clientSocket, ret.data(), ret.size() * sizeof(uint32_t), 0);
+          ok = send_all(clientSocket, ret.data(), ret.size() * sizeof(uint32_t));
           break;
         }
         case READ_MEM_CMD:
@@ -177,7 +244,7 @@ start()
           ret.push_back(sizeof(uint32_t) * (cmd->cmd.read_mem.length + 1));
           ret.insert(ret.end(), data->begin(), data->end());
 
-          n = send(clientSocket, ret.data(), ret.size() * sizeof(uint32_t), 0);
+          ok = send_all(clientSocket, ret.data(), ret.size() * sizeof(uint32_t));
           break;
         }
         case WRITE_MEM_CMD:
@@ -187,7 +254,25 @@ start()
           std::vector<uint32_t> ret;
           ret.push_back(sizeof(uint32_t));
           ret.push_back(status);
-          n = send(clientSocket, ret.data(), ret.size() * sizeof(uint32_t), 0);
+          ok = send_all(clientSocket, ret.data(), ret.size() * sizeof(uint32_t));
+          break;
+        }
+        case READ_MEM_BULK_CMD:
+        {
+          std::vector<uint32_t> ret;
+          handle_read_mem_bulk(cmd, ret);
+          ok = send_all(clientSocket, ret.data(), ret.size() * sizeof(uint32_t));
+          break;
+        }
+        case WRITE_MEM_BULK_CMD:
+        {
+          const size_t hdr_words = sizeof(aie_debugger_cmd) / sizeof(uint32_t);
+          uint32_t status = handle_write_mem_bulk(cmd, buffer.data() + hdr_words,
+            buffer.size() - hdr_words);
+          std::vector<uint32_t> ret;
+          ret.push_back(sizeof(uint32_t));
+          ret.push_back(status);
+          ok = send_all(clientSocket, ret.data(), ret.size() * sizeof(uint32_t));
           break;
         }
         case DETACH_CMD:
@@ -198,7 +283,7 @@ start()
           break;
       }
 
-      if (n <= 0)
+      if (!ok)
       {// if we can't send back data to front, something wrong happen
        // just detach from cert
         shim_debug("tcp server: failed to send data back to front");
@@ -286,6 +371,101 @@ handle_write_mem(uint32_t addr, std::vector<uint32_t> &data)
   return ret != DBG_PKT_SUCCESS ? ret : AIE_DBG_SUCCESS;
 }
 
+// Read length bytes of memory into the response frame, see aiedbg.h
+void
+tcp_server::
+handle_read_mem_bulk(const aie_debugger_cmd *cmd, std::vector<uint32_t> &resp)
+{
+  auto& req = cmd->cmd.bulk_mem;
+  size_t words = req.length / sizeof(uint32_t);
+  const size_t hdr_words = 3; // length, status, flags
+
+  resp.assign(hdr_words, 0);
+  if (!m_aie_attached)
+    resp[1] = AIE_DBG_NOT_ATTACHED;
+  else if (!req.length || req.length > AIE_DBG_BULK_MAX || req.length % sizeof(uint32_t))
+    resp[1] = AIE_DBG_INVALID_REQ;
+  if (resp[1]) {
+    resp[0] = (hdr_words - 1) * sizeof(uint32_t);
+    return;
+  }
+
+  resp.resize(hdr_words + words);
+  resp[1] = bulk_rw(req.aie_addr, resp.data() + hdr_words, words, DBG_CMD_READ);
+  if (resp[1]) {
+    resp.resize(hdr_words);
+  } else if (req.flags & AIE_DBG_BULK_ZRLE) {
+    std::vector<uint32_t> enc(hdr_words, 0);
+    enc.reserve(resp.size());
+    zrle_encode(resp.data() + hdr_words, words, enc);
+    if (enc.size() < resp.size()) {
+      enc[1] = AIE_DBG_SUCCESS;
+      enc[2] = AIE_DBG_BULK_ZRLE;
+      resp.swap(enc);
+    }
+  }
+  resp[0] = (resp.size() - 1) * sizeof(uint32_t);
+  shim_debug("TCP server bulk read mem: addr (0x%x) length (%dB) sent (%dB)\n",
+    req.aie_addr, req.length, resp[0]);
+}
+
+uint32_t
+tcp_server::
+handle_write_mem_bulk(const aie_debugger_cmd *cmd, const uint32_t *data, size_t data_words)
+{
+  auto& req = cmd->cmd.bulk_mem;
+  size_t words = req.length / sizeof(uint32_t);
+
+  if (!m_aie_attached)
+    return AIE_DBG_NOT_ATTACHED;
+  if (!req.length || req.length > AIE_DBG_BULK_MAX || req.length % sizeof(uint32_t))
+    return AIE_DBG_INVALID_REQ;
+
+  std::vector<uint32_t> buf;
+  if (req.flags & AIE_DBG_BULK_ZRLE) {
+    buf.resize(words);
+    if (!zrle_decode(data, data_words, buf.data(), words))
+      return AIE_DBG_INVALID_REQ;
+  } else {
+    if (data_words != words)
+      return AIE_DBG_INVALID_REQ;
+    buf.assign(data, data + words);
+  }
+
+  shim_debug("TCP server bulk write mem: addr (0x%x) length (%dB)\n", req.aie_addr, req.length);
+  return bulk_rw(req.aie_addr, buf.data(), words, DBG_CMD_WRITE);
+}
+
+// Move words of memory between data and AIE, chunk by chunk through the
+// data BO. The BO is sized for the first chunk once, not per chunk.
+uint32_t
+tcp_server::
+bulk_rw(uint32_t addr, uint32_t *data, size_t words, uint16_t opcode)
+{
+  size_t chunk = std::min(words, bulk_chunk_words);
+
+  if (chunk > m_def_size)
+    buffer_extend(chunk);
+
+  for (size_t off = 0; off < words; off += chunk) {
+    size_t len = std::min(chunk, words - off);
+    struct rw_mem rw;
+    rw.host_addr_high = m_data_paddr >> 32;
+    rw.host_addr_low = m_data_paddr & 0xffffffff;
+    rw.aie_addr = addr + off * sizeof(uint32_t);
+    rw.length = len;
+
+    if (opcode == DBG_CMD_WRITE)
+      std::memcpy(const_cast<void *>(m_data_buf), data + off, len * sizeof(uint32_t));
+    uint32_t ret = m_dbg_umq.issue_rw_cmd(rw, opcode);
+    if (ret != DBG_PKT_SUCCESS)
+      return ret;
+    if (opcode == DBG_CMD_READ)
+      std::memcpy(data + off, const_cast<void *>(m_data_buf), len * sizeof(uint32_t));
+  }
+  return AIE_DBG_SUCCESS;
+}
+
 void
 tcp_server::
 buffer_extend(size_t new_size)
@@ -295,6 +475,44 @@ buffer_extend(size_t new_size)
     m_data_bo = std::make_unique<buffer>(m_pdev, n_buf_size, AMDXDNA_BO_SHARE);
     m_data_buf = m_data_bo->vaddr();
     m_data_paddr = m_data_bo->paddr();
+    // Keep it, later requests up to this size don't allocate again
+    m_def_size = new_size;
+}
+
+bool
+tcp_server::
+recv_all(int sock, void *buf, size_t len)
+{
+  auto p = static_cast<char *>(buf);
+
+  while (len) {
+    ssize_t n = recv(sock, p, len, 0);
+    if (n < 0 && errno == EINTR && !m_srv_stop)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool
+tcp_server::
+send_all(int sock, const void *buf, size_t len)
+{
+  auto p = static_cast<const char *>(buf);
+
+  while (len) {
+    ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR && !m_srv_stop)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
 }
 
 uint32_t
@@ -34,7 +34,12 @@ private:
   std::unique_ptr<std::vector<uint32_t>>
   handle_read_mem(uint32_t addr, uint32_t length);
   uint32_t handle_write_mem(uint32_t addr, std::vector<uint32_t> &data);
+  void handle_read_mem_bulk(const aie_debugger_cmd *cmd, std::vector<uint32_t> &resp);
+  uint32_t handle_write_mem_bulk(const aie_debugger_cmd *cmd, const uint32_t *data, size_t words);
+  uint32_t bulk_rw(uint32_t addr, uint32_t *data, size_t words, uint16_t opcode);
   void buffer_extend(size_t new_size);
+  static bool recv_all(int sock, void *buf, size_t len);
+  static bool send_all(int sock, const void *buf, size_t len);
   uint32_t handle_attach(uint32_t);
   void handle_detach();
   static void sigusr1_handler(int sig);
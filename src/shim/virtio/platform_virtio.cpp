@@ -8,17 +8,24 @@
 #include "drm_local/amdxdna_accel.h"
 #include "amdxdna_proto.h"
 #include "platform_virtio.h"
-#include "core/common/trace.h"
+#include "core/common/config_reader.h"
+#include "../trace_recorder.h"
 #include <poll.h>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <vector>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <drm/virtgpu_drm.h>
 
 namespace {
 
+// Response buffer is divided into slots, one for each hcall in flight.
 const size_t resp_buffer_size = 0x1000;
+const size_t resp_ring_slots = 16;
 
 size_t
 roundup_64bit(size_t size)
@@ -26,6 +33,45 @@ roundup_64bit(size_t size)
   return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
 }
 
+// Max time a request not waiting for response can be held back in guest
+// to be sent together with others. 0 disables batching.
+uint64_t
+get_hcall_batch_us()
+{
+  static uint64_t batch_us =
+    xrt_core::config::detail::get_uint_value("Runtime.virtio_hcall_batch_us", 200);
+  return batch_us;
+}
+
+// Time to poll hcall fence without blocking before sleeping on it.
+uint64_t
+get_hcall_spin_us()
+{
+  static uint64_t spin_us =
+    xrt_core::config::detail::get_uint_value("Runtime.virtio_hcall_spin_us", 20);
+  return spin_us;
+}
+
+// Max number of idle guest blob resources kept for reuse. 0 disables it.
+size_t
+get_blob_cache_size()
+{
+  static size_t cache_size =
+    xrt_core::config::detail::get_uint_value("Runtime.virtio_blob_cache_size", 16);
+  return cache_size;
+}
+
+bool
+is_hcall_stats()
+{
+  static bool stats =
+    xrt_core::config::detail::get_bool_value("Debug.ioctl_stats", false);
+  return stats;
+}
+
+// Batch is sent right away once it grows beyond this.
+const size_t max_hcall_batch_size = 0x1000;
+
 #ifndef VIRTGPU_DRM_CAPSET_DRM
 #define VIRTGPU_DRM_CAPSET_DRM 6
 #endif
@@ -100,7 +146,7 @@ hcall_cmd2name(unsigned long cmd)
 void
 ioctl(int dev_fd, unsigned long cmd, void* arg)
 {
-  XRT_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
+  SHIM_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
   if (::ioctl(dev_fd, cmd, arg) == -1)
     shim_err(-errno, "%s IOCTL failed", ioctl_cmd2name(cmd).c_str());
 }
@@ -165,37 +211,70 @@ hcall_no_wait(int dev_fd, void *buf, size_t size)
   }
 }
 
-void
-hcall_wait(int dev_fd, void *buf, size_t size)
+uint32_t
+hcall_ring_idx(const vdrm_ccmd_req *req)
 {
-  auto req = reinterpret_cast<vdrm_ccmd_req*>(buf);
-  uint32_t ring_idx = 0;
-
-  XRT_TRACE_POINT_SCOPE1(hcall, req->cmd);
-
   // For now, only AMDXDNA_CCMD_WAIT_CMD requires non-zero ring index
-  if (req->cmd == AMDXDNA_CCMD_WAIT_CMD) {
-    auto wcmd = reinterpret_cast<amdxdna_ccmd_wait_cmd_req*>(req);
-    ring_idx = wcmd->ctx_handle;
-  }
+  if (req->cmd == AMDXDNA_CCMD_WAIT_CMD)
+    return reinterpret_cast<const amdxdna_ccmd_wait_cmd_req*>(req)->ctx_handle;
+  return 0;
+}
+
+// Submit a command stream, which may hold several requests back to back.
+// The last one decides the ring. Returns fence fd to wait for completion.
+int
+hcall_submit(int dev_fd, void *buf, size_t size, const vdrm_ccmd_req *last)
+{
+  SHIM_TRACE_POINT_SCOPE1(hcall, last->cmd);
 
   drm_virtgpu_execbuffer exec = {
     .flags = VIRTGPU_EXECBUF_FENCE_FD_OUT | VIRTGPU_EXECBUF_RING_IDX,
     .size = static_cast<uint32_t>(size),
     .command = reinterpret_cast<uintptr_t>(buf),
-    .ring_idx = ring_idx,
+    .ring_idx = hcall_ring_idx(last),
   };
 
   try {
-    shim_debug("%s HCALL IOCTL started", hcall_cmd2name(req->cmd).c_str());
+    shim_debug("%s HCALL IOCTL started", hcall_cmd2name(last->cmd).c_str());
     ioctl(dev_fd, DRM_IOCTL_VIRTGPU_EXECBUFFER, &exec);
-    shim_debug("%s HCALL IOCTL ended", hcall_cmd2name(req->cmd).c_str());
-    sync_wait(exec.fence_fd, -1);
-    shim_debug("%s HCALL IOCTL wait ended", hcall_cmd2name(req->cmd).c_str());
+    shim_debug("%s HCALL IOCTL ended", hcall_cmd2name(last->cmd).c_str());
   } catch (const xrt_core::system_error& e) {
-    shim_err(e.get_code(), "%s HCALL failed: %s", hcall_cmd2name(req->cmd).c_str(), e.what());
+    shim_err(e.get_code(), "%s HCALL failed: %s", hcall_cmd2name(last->cmd).c_str(), e.what());
   }
-  close(exec.fence_fd);
+  return exec.fence_fd;
+}
+
+// Short host calls are often done within a few micro seconds, catching
+// them by polling saves the sleep and wake up.
+bool
+sync_spin(int fd, uint64_t spin_us)
+{
+  if (!spin_us)
+    return false;
+
+  struct pollfd fds = {};
+  fds.fd = fd;
+  fds.events = POLLIN;
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(spin_us);
+  do {
+    if (poll(&fds, 1, 0) > 0)
+      return !(fds.revents & (POLLERR | POLLNVAL));
+  } while (std::chrono::steady_clock::now() < end);
+  return false;
+}
+
+void
+hcall_complete(int fence_fd, const vdrm_ccmd_req *last)
+{
+  try {
+    if (!sync_spin(fence_fd, get_hcall_spin_us()))
+      sync_wait(fence_fd, -1);
+    shim_debug("%s HCALL IOCTL wait ended", hcall_cmd2name(last->cmd).c_str());
+  } catch (const xrt_core::system_error& e) {
+    close(fence_fd);
+    shim_err(e.get_code(), "%s HCALL failed: %s", hcall_cmd2name(last->cmd).c_str(), e.what());
+  }
+  close(fence_fd);
 }
 
 // Notify host of response buffer
@@ -352,7 +431,7 @@ drv_open(const std::string& sysfs_name) const
     shim_err(EINVAL, "%s is not NPU device", sysfs_name.c_str());
 
   set_virtgpu_context(fd);
-  m_resp_buf = std::make_unique<response_buffer>(fd);
+  m_resp_buf = std::make_unique<response_buffer>(fd, resp_buffer_size * resp_ring_slots);
   try {
     register_resp_buf(fd, m_resp_buf->res_id());
   } catch (const xrt_core::system_error& e) {
@@ -361,45 +440,305 @@ drv_open(const std::string& sysfs_name) const
   }
 }
 
+platform_drv_virtio::
+~platform_drv_virtio()
+{
+  stop_batch_flusher();
+}
+
 void
 platform_drv_virtio::
 drv_close() const
 {
+  try {
+    std::lock_guard<std::mutex> lg(m_exec_lock);
+    reap_execs(0);
+  } catch (const xrt_core::system_error& e) {
+    std::cout << "Failed to complete async EXEC_CMD: " << e.what() << std::endl;
+  }
+  stop_batch_flusher();
+  try {
+    flush_batch();
+  } catch (const xrt_core::system_error& e) {
+    std::cout << "Failed to flush batched host calls: " << e.what() << std::endl;
+  }
+  free_cached_blobs();
   m_resp_buf.reset();
+  if (is_hcall_stats())
+    dump_hcall_stats();
 
   // Call into parent to close the device node.
   platform_drv::drv_close();
 }
 
+int
+platform_drv_virtio::
+hcall_start(void *req, std::vector<uint32_t>& gem_hdls) const
+{
+  // Assume the request buffer always starts with vdrm_ccmd_req!
+  auto hdr = reinterpret_cast<vdrm_ccmd_req*>(req);
+  auto fd = dev_fd();
+
+  auto start = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lg(m_batch_lock);
+  if (m_batch.empty()) {
+    auto fence_fd = hcall_submit(fd, req, hdr->len, hdr);
+    record_hcall_submit(req, hdr->len, start);
+    return fence_fd;
+  }
+
+  // Held back requests go in the same execbuffer ahead of this one.
+  auto off = m_batch.size();
+  m_batch.resize(off + hdr->len);
+  std::memcpy(m_batch.data() + off, req, hdr->len);
+  int fence_fd;
+  try {
+    fence_fd = hcall_submit(fd, m_batch.data(), m_batch.size(), hdr);
+  } catch (...) {
+    m_batch.resize(off);
+    throw;
+  }
+  record_hcall_submit(m_batch.data(), m_batch.size(), start);
+  m_batch.clear();
+  gem_hdls.swap(m_batch_gem_hdls);
+  return fence_fd;
+}
+
 void
 platform_drv_virtio::
 hcall(void *req) const
 {
-  // Assume the request buffer always starts with vdrm_ccmd_req!
   auto hdr = reinterpret_cast<vdrm_ccmd_req*>(req);
+  std::vector<uint32_t> gem_hdls;
+
+  auto fence_fd = hcall_start(req, gem_hdls);
+  auto start = std::chrono::steady_clock::now();
+  hcall_complete(fence_fd, hdr);
+  record_hcall_wait(hdr->cmd, start);
+  for (auto h : gem_hdls)
+    drm_bo_free(dev_fd(), h);
+}
+
+void
+platform_drv_virtio::
+hcall_batched(void *req, uint32_t gem_hdl) const
+{
+  auto hdr = reinterpret_cast<vdrm_ccmd_req*>(req);
+  auto batch_us = get_hcall_batch_us();
+
+  // Next request in the stream should start 64 bit aligned.
+  if (!batch_us || hdr->len % sizeof(uint64_t)) {
+    hcall(req);
+    drm_bo_free(dev_fd(), gem_hdl);
+    return;
+  }
+
+  bool full;
+  {
+    std::lock_guard<std::mutex> lg(m_batch_lock);
+    if (m_batch.empty())
+      m_batch_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(batch_us);
+    auto off = m_batch.size();
+    m_batch.resize(off + hdr->len);
+    std::memcpy(m_batch.data() + off, req, hdr->len);
+    // Guest BO can only go after host is done with it.
+    if (gem_hdl != AMDXDNA_INVALID_BO_HANDLE)
+      m_batch_gem_hdls.push_back(gem_hdl);
+    full = m_batch.size() >= max_hcall_batch_size;
+    if (!full && !m_batch_flusher.joinable())
+      m_batch_flusher = std::thread([this] { batch_flusher(); });
+  }
+
+  if (full)
+    flush_batch();
+  else
+    m_batch_cv.notify_one();
+}
+
+void
+platform_drv_virtio::
+flush_batch() const
+{
   auto fd = dev_fd();
-  hcall_wait(fd, req, hdr->len);
+  std::vector<char> batch;
+  std::vector<uint32_t> gem_hdls;
+  int fence_fd;
+  uint32_t cmd;
+
+  {
+    std::lock_guard<std::mutex> lg(m_batch_lock);
+    if (m_batch.empty())
+      return;
+    auto start = std::chrono::steady_clock::now();
+    // Find the last request, which decides the ring.
+    size_t last = 0;
+    for (size_t off = 0; off < m_batch.size();
+      off += reinterpret_cast<vdrm_ccmd_req*>(m_batch.data() + off)->len)
+      last = off;
+    auto hdr = reinterpret_cast<vdrm_ccmd_req*>(m_batch.data() + last);
+    fence_fd = hcall_submit(fd, m_batch.data(), m_batch.size(), hdr);
+    record_hcall_submit(m_batch.data(), m_batch.size(), start);
+    cmd = hdr->cmd;
+    batch.swap(m_batch);
+    gem_hdls.swap(m_batch_gem_hdls);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  hcall_complete(fence_fd, reinterpret_cast<vdrm_ccmd_req*>(batch.data()));
+  record_hcall_wait(cmd, start);
+  for (auto h : gem_hdls)
+    drm_bo_free(fd, h);
+}
+
+void
+platform_drv_virtio::
+record_hcall_submit(const void *buf, size_t size,
+  std::chrono::steady_clock::time_point start) const
+{
+  if (!is_hcall_stats())
+    return;
+
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  auto p = reinterpret_cast<const char*>(buf);
+  for (size_t off = 0; off < size;) {
+    auto hdr = reinterpret_cast<const vdrm_ccmd_req*>(p + off);
+    off += hdr->len;
+    if (hdr->cmd >= m_hcall_stats.size())
+      continue;
+    auto& st = m_hcall_stats[hdr->cmd];
+    st.count++;
+    if (off < size)
+      st.batched++;
+    else
+      st.submit_ns += ns;
+  }
+}
+
+void
+platform_drv_virtio::
+record_hcall_wait(uint32_t cmd, std::chrono::steady_clock::time_point start) const
+{
+  if (!is_hcall_stats() || cmd >= m_hcall_stats.size())
+    return;
+
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  auto& st = m_hcall_stats[cmd];
+  st.wait_ns += ns;
+  auto cur = st.max_ns.load(std::memory_order_relaxed);
+  while (cur < ns && !st.max_ns.compare_exchange_weak(cur, ns, std::memory_order_relaxed))
+    ;
+}
+
+void
+platform_drv_virtio::
+dump_hcall_stats() const
+{
+  std::cout << "hcall stats of fd " << dev_fd() << ":" << std::endl;
+  for (size_t cmd = 0; cmd < m_hcall_stats.size(); cmd++) {
+    auto& st = m_hcall_stats[cmd];
+    uint64_t count = st.count;
+    if (!count)
+      continue;
+    // Only unbatched requests and the last of a batch are timed.
+    uint64_t timed = count - st.batched;
+    std::cout << "  " << std::left << std::setw(24) << hcall_cmd2name(cmd) << std::right
+      << " count=" << count << " batched=" << st.batched
+      << " avg_submit_ns=" << (timed ? st.submit_ns / timed : 0)
+      << " avg_wait_ns=" << (timed ? st.wait_ns / timed : 0)
+      << " max_wait_ns=" << st.max_ns << std::endl;
+  }
+}
+
+void
+platform_drv_virtio::
+stop_batch_flusher() const
+{
+  {
+    std::lock_guard<std::mutex> lg(m_batch_lock);
+    if (!m_batch_flusher.joinable())
+      return;
+    m_batch_stop = true;
+  }
+  m_batch_cv.notify_one();
+  m_batch_flusher.join();
+  m_batch_stop = false;
+}
+
+void
+platform_drv_virtio::
+batch_flusher() const
+{
+  std::unique_lock<std::mutex> lk(m_batch_lock);
+  while (!m_batch_stop) {
+    if (m_batch.empty()) {
+      m_batch_cv.wait(lk);
+      continue;
+    }
+    if (m_batch_cv.wait_until(lk, m_batch_deadline) != std::cv_status::timeout)
+      continue;
+    if (m_batch.empty() || std::chrono::steady_clock::now() < m_batch_deadline)
+      continue;
+    lk.unlock();
+    try {
+      flush_batch();
+    } catch (const xrt_core::system_error& e) {
+      std::cout << "Failed to flush batched host calls: " << e.what() << std::endl;
+    }
+    lk.lock();
+  }
 }
 
 void
 platform_drv_virtio::
 hcall(void *req, void *out_buf, size_t out_size) const
 {
-  // We have one response buffer, so can't really share across multiple requests.
-  std::lock_guard<std::mutex> lg(m_lock);
-  auto rsp_hdr = reinterpret_cast<amdxdna_ccmd_rsp*>(m_resp_buf->get());
+  // Each hcall in flight has a slot of its own in the response buffer, the
+  // host is told where to write the response through rsp_off.
+  auto slot = get_resp_slot();
+  auto rsp = reinterpret_cast<char*>(m_resp_buf->get()) + slot * resp_buffer_size;
+  auto rsp_hdr = reinterpret_cast<amdxdna_ccmd_rsp*>(rsp);
+  auto r = reinterpret_cast<vdrm_ccmd_req*>(req);
+  r->rsp_off = slot * resp_buffer_size;
   rsp_hdr->ret = 0;
 
   auto sz = out_size;
   if (sz > resp_buffer_size)
     sz = resp_buffer_size;
 
-  hcall(req);
-  if (rsp_hdr->ret) {
-    auto r = reinterpret_cast<vdrm_ccmd_req*>(req);
-    shim_err(rsp_hdr->ret, "%s HCALL received bad reponse", hcall_cmd2name(r->cmd).c_str());
+  try {
+    hcall(req);
+    if (rsp_hdr->ret)
+      shim_err(rsp_hdr->ret, "%s HCALL received bad reponse", hcall_cmd2name(r->cmd).c_str());
+    std::memcpy(out_buf, rsp, sz);
+  } catch (...) {
+    put_resp_slot(slot);
+    throw;
+  }
+  put_resp_slot(slot);
+}
+
+size_t
+platform_drv_virtio::
+get_resp_slot() const
+{
+  std::unique_lock<std::mutex> lk(m_lock);
+  m_resp_slot_cv.wait(lk, [this] { return ~m_resp_slots_busy & ((1u << resp_ring_slots) - 1); });
+  auto slot = __builtin_ctz(~m_resp_slots_busy);
+  m_resp_slots_busy |= 1u << slot;
+  return slot;
+}
+
+void
+platform_drv_virtio::
+put_resp_slot(size_t slot) const
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_resp_slots_busy &= ~(1u << slot);
   }
-  std::memcpy(out_buf, m_resp_buf->get(), sz);
+  m_resp_slot_cv.notify_one();
 }
 
 void
@@ -420,6 +759,10 @@ create_ctx(create_ctx_arg& arg) const
   hcall(&req, &rsp, sizeof(rsp));
   arg.ctx_handle = rsp.handle;
   arg.syncobj_handle = AMDXDNA_INVALID_FENCE_HANDLE;
+
+  // Host numbers cmds of a new ctx from 0 on.
+  std::lock_guard<std::mutex> lg(m_exec_lock);
+  m_next_seq[arg.ctx_handle] = 0;
 }
 
 void
@@ -430,7 +773,12 @@ destroy_ctx(destroy_ctx_arg& arg) const
     .hdr = { AMDXDNA_CCMD_DESTROY_CTX, sizeof(req) },
     .handle = arg.ctx_handle,
   };
-  hcall(&req);
+  {
+    std::lock_guard<std::mutex> lg(m_exec_lock);
+    reap_execs(0);
+    m_next_seq.erase(arg.ctx_handle);
+  }
+  hcall_batched(&req);
 }
 
 std::pair<uint32_t, uint64_t>
@@ -452,13 +800,55 @@ host_bo_alloc(uint32_t type, size_t size, uint32_t res_id, uint64_t align) const
 
 void
 platform_drv_virtio::
-host_bo_free(uint32_t host_hdl) const
+host_bo_free(uint32_t host_hdl, uint32_t gem_hdl) const
 {
   amdxdna_ccmd_destroy_bo_req req = {
     .hdr = { AMDXDNA_CCMD_DESTROY_BO, sizeof(req) },
     .handle = host_hdl,
   };
-  hcall(&req);
+  hcall_batched(&req, gem_hdl);
+}
+
+bool
+platform_drv_virtio::
+get_cached_blob(size_t size, bo_id& id, uint64_t& map_offset) const
+{
+  {
+    std::lock_guard<std::mutex> lg(m_blob_lock);
+    auto it = m_blob_cache.find(size);
+    if (it == m_blob_cache.end())
+      return false;
+    id = it->second.id;
+    map_offset = it->second.map_offset;
+    m_blob_cache.erase(it);
+  }
+
+  // Blob is in guest memory, zero it here before handing it out again as
+  // BOs fresh from driver are all zeros.
+  void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev_fd(), map_offset);
+  if (p == MAP_FAILED) {
+    drm_bo_free(dev_fd(), id.handle);
+    return false;
+  }
+  std::memset(p, 0, size);
+  munmap(p, size);
+  return true;
+}
+
+void
+platform_drv_virtio::
+free_cached_blobs() const
+{
+  std::lock_guard<std::mutex> lg(m_blob_lock);
+  for (auto& b : m_blob_cache) {
+    try {
+      drm_bo_free(dev_fd(), b.second.id.handle);
+    } catch (const xrt_core::system_error& e) {
+      shim_debug("Failed to free cached blob %d", b.second.id.handle);
+    }
+  }
+  m_blob_cache.clear();
+  m_blobs.clear();
 }
 
 void
@@ -469,9 +859,18 @@ create_bo(bo_info& arg) const
   auto fd = dev_fd();
 
   if (arg.type != AMDXDNA_BO_DEV) {
-    id = drm_bo_alloc(fd, arg.size);
+    uint64_t map_offset;
+    if (!get_cached_blob(arg.size, id, map_offset)) {
+      id = drm_bo_alloc(fd, arg.size);
+      try {
+        map_offset = drm_bo_get_map_offset(fd, id.handle);
+      } catch (...) {
+        drm_bo_free(fd, id.handle);
+        throw;
+      }
+    }
     arg.bo.res_id = id.handle;
-    arg.map_offset = drm_bo_get_map_offset(fd, id.handle);
+    arg.map_offset = map_offset;
   } else {
     arg.bo.res_id = AMDXDNA_INVALID_BO_HANDLE;
     arg.map_offset = AMDXDNA_INVALID_ADDR;
@@ -486,6 +885,11 @@ create_bo(bo_info& arg) const
   }
 
   save_bo_info(arg.bo.res_id, arg);
+
+  if (arg.bo.res_id != AMDXDNA_INVALID_BO_HANDLE && get_blob_cache_size()) {
+    std::lock_guard<std::mutex> lg(m_blob_lock);
+    m_blobs[arg.bo.res_id] = { id, arg.map_offset, arg.size };
+  }
 }
 
 void
@@ -497,8 +901,24 @@ destroy_bo(destroy_bo_arg& arg) const
   if (!delete_bo_info(id))
     return;
 
-  host_bo_free(arg.bo.handle);
-  drm_bo_free(dev_fd(), id);
+  // Blob created by us can be reused for a later BO of the same size.
+  bool cached = false;
+  {
+    std::lock_guard<std::mutex> lg(m_blob_lock);
+    auto it = m_blobs.find(id);
+    if (it != m_blobs.end()) {
+      auto b = it->second;
+      m_blobs.erase(it);
+      if (m_blob_cache.size() < get_blob_cache_size()) {
+        m_blob_cache.emplace(b.size, cached_blob{ b.id, b.map_offset });
+        cached = true;
+      }
+    }
+  }
+
+  // Guest BO is freed once host has destroyed its BO. Cached blob is reused
+  // only after it, as requests are handled by host in order.
+  host_bo_free(arg.bo.handle, cached ? AMDXDNA_INVALID_BO_HANDLE : id);
 }
 
 void
@@ -587,7 +1007,7 @@ config_ctx_cu_config(config_ctx_cu_config_arg& arg) const
   cu_conf_req->param_val_size = cu_conf_req->hdr.len - sizeof(amdxdna_ccmd_config_ctx_req);
   std::memcpy(cu_conf_param_buf.data() + sizeof(amdxdna_ccmd_config_ctx_req),
     arg.conf_buf.data(), arg.conf_buf.size());
-  hcall(cu_conf_req);
+  hcall_batched(cu_conf_req);
 }
 
 void
@@ -601,26 +1021,28 @@ config_ctx_debug_bo(config_ctx_debug_bo_arg& arg) const
       DRM_AMDXDNA_HWCTX_REMOVE_DBG_BUF : DRM_AMDXDNA_HWCTX_ASSIGN_DBG_BUF),
     .inline_param = arg.bo.handle,
   };
-  hcall(&req);
+  hcall_batched(&req);
 }
 
 void
 platform_drv_virtio::
 submit_cmd(submit_cmd_arg& arg) const
 {
-  // Assuming 512 max args per cmd bo
-  const size_t max_args = 512;
-  const auto nargs = arg.arg_bos.size();
-  if (nargs > max_args)
-    shim_err(EINVAL, "Max arg %ld, received %ld", max_args, nargs);
+  const auto nargs = arg.arg_bo_hdls.size();
 
   auto req_sz = sizeof(amdxdna_ccmd_exec_cmd_req);
   req_sz += sizeof(uint64_t); // One cmd handle
   req_sz += nargs * sizeof(uint32_t); // For args handle
-  // Get a 64 bit aligned buffer for req
+  // Get a 64 bit aligned buffer for req, kept per thread and only grown, so
+  // that number of args is not bound by stack space.
   auto req_sz_in_u64 = req_sz / sizeof(uint64_t) + 1;
-  uint64_t req_buf[req_sz_in_u64] = {};
-  auto req = reinterpret_cast<amdxdna_ccmd_exec_cmd_req*>(req_buf);
+  thread_local std::vector<uint64_t> req_buf;
+  if (req_buf.size() < req_sz_in_u64)
+    req_buf.resize(req_sz_in_u64);
+  // Only header and tail padding need clearing, the rest is overwritten below.
+  std::memset(req_buf.data(), 0, sizeof(amdxdna_ccmd_exec_cmd_req) + sizeof(uint64_t));
+  req_buf[req_sz_in_u64 - 1] = 0;
+  auto req = reinterpret_cast<amdxdna_ccmd_exec_cmd_req*>(req_buf.data());
   amdxdna_ccmd_exec_cmd_rsp rsp = {};
 
   req->hdr.cmd = AMDXDNA_CCMD_EXEC_CMD;
@@ -631,12 +1053,86 @@ submit_cmd(submit_cmd_arg& arg) const
   req->cmds_n_args[0] = arg.cmd_bo.handle;
   req->arg_count = nargs;
   req->arg_offset = 1;
-  int i = req->arg_offset;
-  for (auto& id : arg.arg_bos)
-    req->cmds_n_args[i++] = id.handle;
+  std::copy(arg.arg_bo_hdls.begin(), arg.arg_bo_hdls.end(), &req->cmds_n_args[req->arg_offset]);
+
+  if (!is_async_exec()) {
+    hcall(req, &rsp, sizeof(rsp));
+    arg.seq = rsp.seq;
+    return;
+  }
 
-  hcall(req, &rsp, sizeof(rsp));
-  arg.seq = rsp.seq;
+  std::lock_guard<std::mutex> lg(m_exec_lock);
+  // Leave enough response slots for other hcalls.
+  reap_execs(resp_ring_slots / 2 - 1);
+
+  auto it = m_next_seq.find(arg.ctx_handle);
+  if (it == m_next_seq.end()) {
+    // Seq of this ctx is not known, learn it from a synchronous submission.
+    hcall(req, &rsp, sizeof(rsp));
+    arg.seq = rsp.seq;
+    m_next_seq[arg.ctx_handle] = rsp.seq + 1;
+    return;
+  }
+
+  pending_exec pe = { arg.ctx_handle, it->second, get_resp_slot() };
+  req->hdr.rsp_off = pe.slot * resp_buffer_size;
+  auto rsp_hdr = reinterpret_cast<amdxdna_ccmd_rsp*>(
+    reinterpret_cast<char*>(m_resp_buf->get()) + req->hdr.rsp_off);
+  rsp_hdr->ret = 0;
+  try {
+    pe.fence_fd = hcall_start(req, pe.gem_hdls);
+  } catch (...) {
+    put_resp_slot(pe.slot);
+    throw;
+  }
+  m_pending_execs.push_back(std::move(pe));
+  arg.seq = it->second++;
+}
+
+bool
+platform_drv_virtio::
+is_async_exec() const
+{
+  static bool async_exec =
+    xrt_core::config::detail::get_bool_value("Runtime.virtio_async_exec", false);
+  return async_exec && m_resp_buf;
+}
+
+void
+platform_drv_virtio::
+reap_execs(size_t keep) const
+{
+  while (m_pending_execs.size() > keep) {
+    auto pe = std::move(m_pending_execs.front());
+    m_pending_execs.pop_front();
+
+    auto rsp = reinterpret_cast<amdxdna_ccmd_exec_cmd_rsp*>(
+      reinterpret_cast<char*>(m_resp_buf->get()) + pe.slot * resp_buffer_size);
+    int ret = 0;
+    uint64_t seq = 0;
+    try {
+      vdrm_ccmd_req hdr = { .cmd = AMDXDNA_CCMD_EXEC_CMD };
+      auto start = std::chrono::steady_clock::now();
+      hcall_complete(pe.fence_fd, &hdr);
+      record_hcall_wait(hdr.cmd, start);
+      ret = rsp->hdr.ret;
+      seq = rsp->seq;
+    } catch (const xrt_core::system_error& e) {
+      ret = e.get_code();
+    }
+    put_resp_slot(pe.slot);
+    for (auto h : pe.gem_hdls)
+      drm_bo_free(dev_fd(), h);
+
+    if (!ret && seq == pe.seq)
+      continue;
+    // Predicted seq can't be trusted any more, go back to synchronous
+    // submission until it is learned again.
+    m_next_seq.erase(pe.ctx);
+    if (ret)
+      shim_err(ret, "Async EXEC_CMD %ld on ctx %d failed", pe.seq, pe.ctx);
+    shim_err(EIO, "Async EXEC_CMD on ctx %d got seq %ld, expected %ld", pe.ctx, seq, pe.seq);
+  }
 }
 
 void
@@ -648,6 +1144,11 @@ wait_cmd_ioctl(wait_cmd_arg& arg) const
     .seq = arg.seq,
     .ctx_handle = arg.ctx_handle,
   };
+  // Cmd being waited for has to be known to be submitted.
+  {
+    std::lock_guard<std::mutex> lg(m_exec_lock);
+    reap_execs(0);
+  }
   // TODO: needs to pass timeout to host
   hcall(&req);
 }
@@ -663,6 +1164,10 @@ export_bo(export_bo_arg& bo_arg) const
   };
   ioctl(dev_fd(), DRM_IOCTL_PRIME_HANDLE_TO_FD, &arg);
   bo_arg.fd = arg.fd;
+
+  // Others may still have the blob after we are done with it, never reuse.
+  std::lock_guard<std::mutex> lg(m_blob_lock);
+  m_blobs.erase(bo_arg.bo.res_id);
 }
 
 void
@@ -675,6 +1180,8 @@ import_bo(import_bo_arg& bo_arg) const
     .flags = 0,
     .fd = bo_arg.fd,
   };
+  // Guest BO handles with pending free could be handed out again below.
+  flush_batch();
   ioctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &carg);
   auto gboh = carg.handle;
 
@@ -5,7 +5,16 @@
 #define PLAT_VIRTIO_H
 
 #include "../platform.h"
+#include "amdxdna_proto.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace shim_xdna {
 
@@ -13,6 +22,7 @@ class platform_drv_virtio : public platform_drv
 {
 public:
   using platform_drv::platform_drv;
+  ~platform_drv_virtio();
 
   void
   drv_open(const std::string& sysfs_name) const override;
@@ -44,8 +54,17 @@ private:
 
   // Setup once and used forever
   mutable std::unique_ptr<response_buffer> m_resp_buf;
-  // Lock to serialize hypercall.
+  // Lock protecting allocation of response slots.
   mutable std::mutex m_lock;
+  mutable std::condition_variable m_resp_slot_cv;
+  // Bit map of response slots in use by hcalls in flight.
+  mutable uint32_t m_resp_slots_busy = 0;
+
+  size_t
+  get_resp_slot() const;
+
+  void
+  put_resp_slot(size_t slot) const;
 
   void
   hcall(void *req, void *out_buf, size_t out_size) const;
@@ -53,6 +72,58 @@ private:
   void
   hcall(void *req) const;
 
+  // Submits request, with held back ones in front. Returns fence fd to wait
+  // for completion, and guest BOs to be freed after completion in gem_hdls.
+  int
+  hcall_start(void *req, std::vector<uint32_t>& gem_hdls) const;
+
+  // For requests without response. Request is held back and sent together
+  // with next waiting hcall or after a short deadline. Guest BO of gem_hdl,
+  // if valid, is freed after the request is done by host.
+  void
+  hcall_batched(void *req, uint32_t gem_hdl = AMDXDNA_INVALID_BO_HANDLE) const;
+
+  void
+  flush_batch() const;
+
+  void
+  batch_flusher() const;
+
+  void
+  stop_batch_flusher() const;
+
+  // Time spent in host calls by request type, dumped on close with
+  // Debug.ioctl_stats. Batched requests are counted under their own type,
+  // but time of the execbuffer and its wait goes to the last one.
+  struct hcall_stat {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> batched;
+    std::atomic<uint64_t> submit_ns;
+    std::atomic<uint64_t> wait_ns;
+    std::atomic<uint64_t> max_ns;
+  };
+  mutable std::array<hcall_stat, AMDXDNA_CCMD_READ_SYSFS + 1> m_hcall_stats = {};
+
+  void
+  record_hcall_submit(const void *buf, size_t size,
+    std::chrono::steady_clock::time_point start) const;
+
+  void
+  record_hcall_wait(uint32_t cmd, std::chrono::steady_clock::time_point start) const;
+
+  void
+  dump_hcall_stats() const;
+
+  // Requests held back for batching, protected by m_batch_lock. Lock is
+  // also held while submitting to keep requests in order.
+  mutable std::mutex m_batch_lock;
+  mutable std::condition_variable m_batch_cv;
+  mutable std::vector<char> m_batch;
+  mutable std::vector<uint32_t> m_batch_gem_hdls;
+  mutable std::chrono::steady_clock::time_point m_batch_deadline;
+  mutable std::thread m_batch_flusher;
+  mutable bool m_batch_stop = false;
+
   void
   create_ctx(create_ctx_arg& arg) const override;
 
@@ -63,11 +134,36 @@ private:
   host_bo_alloc(uint32_t type, size_t size, uint32_t res_id, uint64_t align) const;
 
   void
-  host_bo_free(uint32_t host_hdl) const;
+  host_bo_free(uint32_t host_hdl, uint32_t gem_hdl) const;
 
   void
   create_bo(bo_info& arg) const override;
 
+  // Idle guest blob resources of destroyed BOs are kept by size, saving
+  // CREATE_BLOB, MAP and GEM_CLOSE for short lived BOs. Only blobs created
+  // by us and never exported are reused.
+  struct cached_blob {
+    bo_id id;
+    uint64_t map_offset;
+  };
+  struct blob_info {
+    bo_id id;
+    uint64_t map_offset;
+    size_t size;
+  };
+
+  bool
+  get_cached_blob(size_t size, bo_id& id, uint64_t& map_offset) const;
+
+  void
+  free_cached_blobs() const;
+
+  // Protecting below two
+  mutable std::mutex m_blob_lock;
+  mutable std::multimap<size_t, cached_blob> m_blob_cache;
+  // Blobs of live BOs eligible for reuse, by guest BO handle
+  mutable std::unordered_map<uint32_t, blob_info> m_blobs;
+
   void
   destroy_bo(destroy_bo_arg& arg) const override;
 
@@ -92,6 +188,31 @@ private:
   void
   wait_cmd_ioctl(wait_cmd_arg& arg) const override;
 
+  // With Runtime.virtio_async_exec, EXEC_CMD does not wait for host. Its seq
+  // is predicted from the ctx's previous one, since host numbers cmds of a
+  // ctx one by one. Response is checked later in reap_execs().
+  struct pending_exec {
+    uint32_t ctx;
+    uint64_t seq;
+    size_t slot;
+    int fence_fd = -1;
+    std::vector<uint32_t> gem_hdls;
+  };
+
+  bool
+  is_async_exec() const;
+
+  // Complete oldest async EXEC_CMDs until no more than keep are pending.
+  // Throws if one of them has failed. Called with m_exec_lock held.
+  void
+  reap_execs(size_t keep) const;
+
+  // Protecting below two
+  mutable std::mutex m_exec_lock;
+  mutable std::deque<pending_exec> m_pending_execs;
+  // Seq for next cmd of each ctx, absent when not known
+  mutable std::unordered_map<uint32_t, uint64_t> m_next_seq;
+
   void
   export_bo(export_bo_arg& arg) const override;
 
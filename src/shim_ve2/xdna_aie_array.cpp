@@ -49,6 +49,14 @@ get_driver_config(const pt::ptree& aie_meta)
   return driver_config;
 }
 
+adf::driver_config
+parse_driver_config(const char* data, size_t size)
+{
+  pt::ptree aie_meta;
+  read_aie_metadata(data, size, aie_meta);
+  return get_driver_config(aie_meta);
+}
+
 xdna_aie_array::
 xdna_aie_array(const xrt_core::device* device)
 {
@@ -174,13 +182,11 @@ xdna_aie_array::
 get_driver_config_hwctx(const xrt_core::device* device, const xdna_hwctx* hwctx)
 {
   auto xclbin_uuid = hwctx ? hwctx->get_xclbin_uuid() : xrt::uuid();
-  auto data = device->get_axlf_section(AIE_TRACE_METADATA, xclbin_uuid);
-  if (!data.first || !data.second)
+  auto config = static_cast<const device_xdna*>(device)->get_aie_driver_config(xclbin_uuid);
+  if (!config)
     return {};
 
-  pt::ptree aie_meta;
-  read_aie_metadata(data.first, data.second, aie_meta);
-  return get_driver_config(aie_meta);
+  return *config;
 }
 
 } //namespace shim_xdna_edge
@@ -19,6 +19,10 @@ namespace shim_xdna_edge {
 
 class xdna_hwctx;
 
+// Parse AIE metadata JSON of an xclbin into AIE driver config
+adf::driver_config
+parse_driver_config(const char* data, size_t size);
+
 class xdna_aie_array {
 
 public:
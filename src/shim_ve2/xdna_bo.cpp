@@ -1,12 +1,32 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
 
+#include <algorithm>
+#include <cstring>
 #include <unistd.h>
 
+#include "core/common/config_reader.h"
 #include "core/common/query_requests.h"
 #include "xdna_bo.h"
 
 namespace shim_xdna_edge {
+// Total size of DRM BOs kept by xdna_bo_cache, 0 disables the cache
+static size_t
+get_bo_cache_bytes()
+{
+  static size_t bytes =
+    xrt_core::config::detail::get_uint_value("Runtime.ve2_bo_cache_size_mb", 64) << 20;
+  return bytes;
+}
+
+static bool
+is_ctx_bo(uint64_t flags)
+{
+  xcl_bo_flags xflags{ flags };
+  return xflags.use == XRT_BO_USE_DEBUG || xflags.use == XRT_BO_USE_DTRACE ||
+    xflags.use == XRT_BO_USE_LOG || xflags.use == XRT_BO_USE_UC_DEBUG;
+}
+
 static void
 init_metadata_buffer(xdna_bo& mdata_base_bo,
 		     uint32_t boh,
@@ -165,6 +185,30 @@ xdna_bo(const device_xdna& device, xrt_core::shared_handle::export_handle ehdl)
   shim_xdna_edge::xdna_bo::get_drm_bo_info(boh);
 }
 
+xdna_bo::
+xdna_bo(const device_xdna& device, xrt_core::hwctx_handle::slot_id ctx_id,
+  uint64_t flags, uint32_t type, xdna_bo_backing&& backing,
+  std::weak_ptr<xdna_bo_cache> cache)
+  : m_core_device(&device)
+  , m_edev(device.get_edev())
+  , m_ptr(backing.m_ptr)
+  , m_ptr_writable(true)
+  , m_aligned_size(backing.m_size)
+  , m_flags(flags)
+  , m_type(type)
+  , m_handle(backing.m_handle)
+  , m_map_offset(backing.m_map_offset)
+  , m_xdna_addr(backing.m_xdna_addr)
+  , m_vaddr(backing.m_vaddr)
+  , m_import(-1)
+  , m_owner_ctx_id(ctx_id)
+  , m_cache(std::move(cache))
+{
+  m_edev->bo_handle_ref_inc(m_handle);
+  shim_debug("Reused DRM BO (userptr=0x%lx, size=%ld, flags=0x%llx, type=%d, drm_bo=%d)",
+	     m_ptr, m_aligned_size, m_flags, m_type, get_drm_bo_handle());
+}
+
 // SAIF TODO FIXME
 #if 0
 xdna_bo::
@@ -191,19 +235,54 @@ xdna_bo::
 
   if (m_handle) {
     bool last = m_edev->bo_handle_ref_dec(m_handle);
-    if (last) {
+    if (last && !recycle()) {
+      if (m_ptr)
+        munmap_bo();
       drm_gem_close close_bo{ m_handle, 0 };
       m_edev->ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
     }
   }
 }
 
+bool
+xdna_bo::
+recycle()
+{
+  auto cache = m_cache.lock();
+  if (!cache || m_exported)
+    return false;
+
+  try {
+    if (!m_ptr_writable)
+      mmap_bo(true);
+  }
+  catch (const xrt_core::system_error&) {
+    return false;
+  }
+
+  xdna_bo_backing backing;
+  backing.m_handle = m_handle;
+  backing.m_size = m_aligned_size;
+  backing.m_map_offset = m_map_offset;
+  backing.m_xdna_addr = m_xdna_addr;
+  backing.m_vaddr = m_vaddr;
+  backing.m_ptr = m_ptr;
+  return cache->recycle(std::move(backing), m_flags, m_type);
+}
+
 void
 xdna_bo::
 mmap_bo(bool is_write)
 {
+  if (m_ptr) {
+    if (m_ptr_writable || !is_write)
+      return;
+    munmap_bo();
+  }
+
   m_ptr = m_edev->mmap(0, m_aligned_size, (is_write ? (PROT_READ|PROT_WRITE) : PROT_READ),
 		       MAP_SHARED | MAP_LOCKED, m_map_offset);
+  m_ptr_writable = is_write;
 
   shim_debug("%s: mmap return %p", __func__, m_ptr);
 }
@@ -217,6 +296,8 @@ munmap_bo()
       return;
 
   m_edev->munmap(m_ptr, m_aligned_size);
+  m_ptr = nullptr;
+  m_ptr_writable = false;
 }
 
 void
@@ -434,6 +515,7 @@ share() const
 {
   auto boh = get_drm_bo_handle();
   auto fd = export_drm_bo(boh);
+  m_exported = true;
   shim_debug("Exported bo %d to fd %d", boh, fd);
   return std::make_unique<shared>(fd);
 }
@@ -458,6 +540,9 @@ void
 xdna_bo::
 unmap(void *addr)
 {
+  // Cached BO stays mapped for the next user
+  if (!m_cache.expired() && m_ptr_writable)
+    return;
   munmap_bo();
 }
 
@@ -494,4 +579,90 @@ import_drm_bo(const shim_xdna_edge::shared& share,uint32_t *type, size_t *size)
   return imp_bo.handle;
 }
 
+//
+// Impl for class xdna_bo_cache
+//
+
+xdna_bo_cache::
+xdna_bo_cache(std::shared_ptr<xdna_edgedev> edev)
+  : m_edev(std::move(edev))
+  , m_max_bytes(get_bo_cache_bytes())
+{
+}
+
+xdna_bo_cache::
+~xdna_bo_cache()
+{
+  shim_debug("BO cache hit %ld, miss %ld, %ld bytes cached", m_hit.load(), m_miss.load(),
+	     m_cached_bytes);
+  for (auto& [key, backings] : m_free) {
+    for (auto& b : backings)
+      free_backing(b);
+  }
+}
+
+std::unique_ptr<xdna_bo>
+xdna_bo_cache::
+alloc(const device_xdna& device, xrt_core::hwctx_handle::slot_id ctx_id,
+  size_t size, uint64_t flags, uint32_t type)
+{
+  if (!m_max_bytes || type == AMDXDNA_BO_INVALID || is_ctx_bo(flags))
+    return nullptr;
+
+  auto it = std::lower_bound(m_size_classes.begin(), m_size_classes.end(), size);
+  if (it == m_size_classes.end() || *it > m_max_bytes)
+    return nullptr;
+
+  xdna_bo_backing backing;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    auto fit = m_free.find({ type, flags, *it });
+    if (fit != m_free.end() && !fit->second.empty()) {
+      backing = std::move(fit->second.back());
+      fit->second.pop_back();
+      m_cached_bytes -= backing.m_size;
+    }
+  }
+
+  if (backing.m_handle == AMDXDNA_INVALID_BO_HANDLE) {
+    m_miss++;
+    auto bo = std::make_unique<xdna_bo>(device, ctx_id, *it, flags, type);
+    bo->m_cache = weak_from_this();
+    return bo;
+  }
+
+  m_hit++;
+  // Fresh BO from driver is zeroed, make recycled one look the same.
+  std::memset(backing.m_ptr, 0, size);
+  return std::make_unique<xdna_bo>(device, ctx_id, flags, type, std::move(backing),
+    weak_from_this());
+}
+
+bool
+xdna_bo_cache::
+recycle(xdna_bo_backing&& backing, uint64_t flags, uint32_t type)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  if (m_cached_bytes + backing.m_size > m_max_bytes)
+    return false;
+
+  m_cached_bytes += backing.m_size;
+  m_free[{ type, flags, backing.m_size }].push_back(std::move(backing));
+  return true;
+}
+
+void
+xdna_bo_cache::
+free_backing(xdna_bo_backing& backing)
+{
+  m_edev->munmap(backing.m_ptr, backing.m_size);
+  drm_gem_close close_bo{ backing.m_handle, 0 };
+  try {
+    m_edev->ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
+  }
+  catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to close cached DRM BO %d: %s", backing.m_handle, e.what());
+  }
+}
+
 } // namespace shim_xdna
@@ -4,9 +4,15 @@
 #ifndef XDNA_EDGE_BO_H__
 #define XDNA_EDGE_BO_H__
 
+#include <array>
 #include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
 #include <unistd.h>
+#include <vector>
 
 #include "drm_local/amdxdna_accel.h"
 #include "core/common/shim/buffer_handle.h"
@@ -37,6 +43,19 @@ private:
   const int m_fd;
 };
 
+// DRM BO kept alive and mapped across xdna_bo objects by xdna_bo_cache.
+struct xdna_bo_backing {
+  uint32_t m_handle = AMDXDNA_INVALID_BO_HANDLE;
+  size_t m_size = 0;
+  off_t m_map_offset = AMDXDNA_INVALID_ADDR;
+  uint64_t m_xdna_addr = AMDXDNA_INVALID_ADDR;
+  uint64_t m_vaddr = AMDXDNA_INVALID_ADDR;
+  // Always mapped read/write
+  void *m_ptr = nullptr;
+};
+
+class xdna_bo_cache;
+
 // DRM BO managed by driver.
 class xdna_bo : public xrt_core::buffer_handle {
 public:
@@ -73,6 +92,11 @@ public:
 
   xdna_bo(const device_xdna& device, xrt_core::shared_handle::export_handle ehdl);
 
+  // Reuse backing from cache, which gets it back when this object is destroyed.
+  xdna_bo(const device_xdna& device, xrt_core::hwctx_handle::slot_id ctx_id,
+     uint64_t flags, uint32_t type, xdna_bo_backing&& backing,
+     std::weak_ptr<xdna_bo_cache> cache);
+
   ~xdna_bo();
 
   std::string
@@ -142,6 +166,7 @@ public:
   const xrt_core::device *m_core_device;
   std::shared_ptr<xdna_edgedev> m_edev;
   void* m_ptr = nullptr;
+  bool m_ptr_writable = false;
   size_t m_aligned_size = 0;
   uint64_t m_flags = 0;
   uint32_t m_type = AMDXDNA_BO_INVALID;
@@ -168,6 +193,53 @@ public:
   std::map<size_t, uint32_t> m_args_map;
   mutable std::mutex m_args_map_lock;
 
+  // Set if DRM BO can be given back to cache on destruction.
+  std::weak_ptr<xdna_bo_cache> m_cache;
+  // Exported BO may still be used by others, never recycled.
+  mutable bool m_exported = false;
+
+private:
+  // Hand DRM BO over to cache, returns false if cache does not take it.
+  bool
+  recycle();
+};
+
+// Per device cache of DRM BOs which stay created and mapped after their
+// xdna_bo is destroyed, so that allocating a BO of the same size class, type
+// and flags again needs no ioctl or mmap. Total size kept is capped.
+class xdna_bo_cache : public std::enable_shared_from_this<xdna_bo_cache>
+{
+public:
+  xdna_bo_cache(std::shared_ptr<xdna_edgedev> edev);
+  ~xdna_bo_cache();
+
+  // Returns nullptr if cache is disabled or BO can't be cached.
+  std::unique_ptr<xdna_bo>
+  alloc(const device_xdna& device, xrt_core::hwctx_handle::slot_id ctx_id,
+    size_t size, uint64_t flags, uint32_t type);
+
+  // Returns false if cache is full, caller has to free the backing.
+  bool
+  recycle(xdna_bo_backing&& backing, uint64_t flags, uint32_t type);
+
+private:
+  // Power of 2 from 4KB to 16MB
+  static constexpr std::array<size_t, 13> m_size_classes = {
+    0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x20000, 0x40000,
+    0x80000, 0x100000, 0x200000, 0x400000, 0x800000, 0x1000000
+  };
+
+  void
+  free_backing(xdna_bo_backing& backing);
+
+  std::shared_ptr<xdna_edgedev> m_edev;
+  const size_t m_max_bytes;
+  std::mutex m_lock;
+  size_t m_cached_bytes = 0;
+  // Free backings keyed by (type, flags, size class)
+  std::map< std::tuple<uint32_t, uint64_t, size_t>, std::vector<xdna_bo_backing> > m_free;
+  std::atomic<uint64_t> m_hit = 0;
+  std::atomic<uint64_t> m_miss = 0;
 };
 
 } // namespace shim_xdna_edge
@@ -7,6 +7,7 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <functional>
 #include <libgen.h>
 #include <limits.h>
 #include <map>
@@ -802,11 +803,14 @@ device_xdna(handle_type device_handle, id_type device_id)
 {
   m_edev = xdna_edgedev::get_edgedev();
   m_edev->open();
+  m_bo_cache = std::make_shared<xdna_bo_cache>(m_edev);
 }
 
 device_xdna::
 ~device_xdna()
 {
+  // Cached DRM BOs have to be closed while device is still open
+  m_bo_cache.reset();
   m_edev->close();
 }
 
@@ -918,9 +922,102 @@ alloc_bo(void* userptr, xrt_core::hwctx_handle::slot_id ctx_id,
   if (userptr)
     return std::make_unique<xdna_bo>(*this, ctx_id, size, userptr);
 
+  auto bo = m_bo_cache->alloc(*this, ctx_id, size, flags, flag_to_type(flags));
+  if (bo)
+    return bo;
+
   return std::make_unique<xdna_bo>(*this, ctx_id, size, flags, flag_to_type(flags));
 }
 
+std::vector<char>
+device_xdna::
+read_aie_tiles(pid_t pid, uint32_t ctx_id, const std::vector<aie_tile_range>& ranges) const
+{
+  std::vector<amdxdna_drm_aie_tile_range> drm_ranges(ranges.size());
+  uint32_t data_size = 0;
+
+  for (size_t i = 0; i < ranges.size(); i++) {
+    drm_ranges[i].col = ranges[i].col;
+    drm_ranges[i].row = ranges[i].row;
+    drm_ranges[i].addr = ranges[i].addr;
+    drm_ranges[i].size = ranges[i].size;
+    drm_ranges[i].data_offset = data_size;
+    data_size += ranges[i].size;
+  }
+
+  std::vector<char> data(data_size);
+  amdxdna_drm_aie_tile_batch batch = {
+    .pid = static_cast<__u64>(pid),
+    .context_id = ctx_id,
+    .num_ranges = static_cast<__u32>(drm_ranges.size()),
+    .ranges_p = reinterpret_cast<uintptr_t>(drm_ranges.data()),
+    .data_p = reinterpret_cast<uintptr_t>(data.data()),
+    .data_size = data_size,
+  };
+  amdxdna_drm_get_array arg = {
+    .param = DRM_AMDXDNA_AIE_TILE_READ_BATCH,
+    .element_size = sizeof(batch),
+    .num_element = 1,
+    .buffer = reinterpret_cast<uintptr_t>(&batch)
+  };
+
+  m_edev->ioctl(DRM_IOCTL_AMDXDNA_GET_ARRAY, &arg);
+  return data;
+}
+
+std::shared_ptr<const adf::driver_config>
+device_xdna::
+get_aie_driver_config(const xrt::uuid& xclbin_uuid) const
+{
+  const std::lock_guard<std::mutex> lock(m_aie_config_lock);
+  auto key = xclbin_uuid.to_string();
+  auto it = m_aie_configs.find(key);
+  if (it != m_aie_configs.end())
+    return it->second;
+
+  std::shared_ptr<const adf::driver_config> config;
+  auto data = get_axlf_section(AIE_TRACE_METADATA, xclbin_uuid);
+  if (data.first && data.second)
+    config = std::make_shared<const adf::driver_config>(parse_driver_config(data.first, data.second));
+  m_aie_configs.emplace(key, config);
+  return config;
+}
+
+uint64_t
+device_xdna::
+read_aie_coredump(pid_t pid, uint32_t ctx_id, const aie_tile_region& region,
+  const std::function<void(uint64_t, const char*, size_t)>& sink, uint32_t chunk_size) const
+{
+  std::vector<char> data(chunk_size);
+  amdxdna_drm_aie_coredump_chunk chunk = {
+    .pid = static_cast<__u64>(pid),
+    .context_id = ctx_id,
+    .col = region.col,
+    .num_col = region.num_col,
+    .row = region.row,
+    .num_row = region.num_row,
+    .data_p = reinterpret_cast<uintptr_t>(data.data()),
+  };
+  amdxdna_drm_get_array arg = {
+    .param = DRM_AMDXDNA_AIE_COREDUMP_CHUNK,
+    .element_size = sizeof(chunk),
+    .num_element = 1,
+    .buffer = reinterpret_cast<uintptr_t>(&chunk)
+  };
+
+  uint64_t offset = 0;
+  do {
+    chunk.offset = offset;
+    chunk.size = chunk_size;
+    m_edev->ioctl(DRM_IOCTL_AMDXDNA_GET_ARRAY, &arg);
+    if (!chunk.size)
+      break;
+    sink(offset, data.data(), chunk.size);
+    offset += chunk.size;
+  } while (offset < chunk.total_size);
+  return chunk.total_size;
+}
+
 std::shared_ptr<xdna_edgedev>
 device_xdna::
 get_edev() const
@@ -13,10 +13,31 @@
 #include "xdna_edgedev.h"
 #include "xdna_aie_array.h"
 #include "xdna_shim.h"
+#include <map>
+#include <mutex>
 
 namespace shim_xdna_edge {
 
 class xdna_hwctx;
+class xdna_bo_cache;
+
+// One range of a batched AIE tile read, col is relative to the partition
+struct aie_tile_range
+{
+  uint16_t col;
+  uint16_t row;
+  uint32_t addr;
+  uint32_t size;
+};
+
+// Tiles of a coredump, col is relative to the partition, 0 num is up to the end
+struct aie_tile_region
+{
+  uint32_t col = 0;
+  uint32_t num_col = 0;
+  uint32_t row = 0;
+  uint32_t num_row = 0;
+};
 
 // concrete class derives from device_edge, but mixes in
 // shim layer functions for access through base class
@@ -84,20 +105,42 @@ public:
   bool
   is_aie_registered();
 
+  // Read all ranges of the context's partition in one ioctl. Data of each
+  // range is returned back to back, in the order of ranges.
+  std::vector<char>
+  read_aie_tiles(pid_t pid, uint32_t ctx_id, const std::vector<aie_tile_range>& ranges) const;
+
+  // Stream coredump of the region to sink, chunk_size bytes at a time, so that
+  // neither driver nor caller holds the whole dump. Sink gets offset of the
+  // chunk in the dump, chunk data and its size. Returns total dump size.
+  uint64_t
+  read_aie_coredump(pid_t pid, uint32_t ctx_id, const aie_tile_region& region,
+    const std::function<void(uint64_t, const char*, size_t)>& sink,
+    uint32_t chunk_size = 1024 * 1024) const;
+
   std::string
   get_uuid() const
   {
     return m_uuid.to_string();
   }
 
+  // AIE driver config from AIE metadata of the xclbin. Parsed on first use and
+  // shared by all aie arrays and hwctx of the xclbin afterwards. Null if xclbin
+  // has no AIE metadata.
+  std::shared_ptr<const adf::driver_config>
+  get_aie_driver_config(const xrt::uuid& xclbin_uuid) const;
+
 private:
   std::shared_ptr<xdna_edgedev> m_edev; // The xdna_edgedev that this device object is derived from
+  std::shared_ptr<xdna_bo_cache> m_bo_cache;
 
   // Private look up function for concrete query::request
   const xrt_core::query::request&
   lookup_query(xrt_core::query::key_type query_key) const override;
   std::shared_ptr<xdna_aie_array> m_aie_array;
   mutable xrt::uuid m_uuid;
+  mutable std::mutex m_aie_config_lock;
+  mutable std::map<std::string, std::shared_ptr<const adf::driver_config>> m_aie_configs;
 
 };
 
@@ -5,8 +5,27 @@
 #include "core/common/config_reader.h"
 #include "xdna_device.h"
 #include "xdna_edgedev.h"
+#include <unistd.h>
 
 namespace {
+
+// Entries fixed for the life time of the device, e.g. not by xclbin or state
+bool
+is_static_sysfs_entry(const std::string& entry)
+{
+  return entry == "vbnv" || entry == "device_type" || entry == "fw_version";
+}
+
+std::vector<std::string>
+split_lines(const std::string& s)
+{
+  std::vector<std::string> sv;
+  std::istringstream ss(s);
+  std::string line;
+  while (std::getline(ss, line))
+    sv.push_back(line);
+  return sv;
+}
 std::string
 ioctl_cmd2name(unsigned long cmd)
 {
@@ -78,6 +97,83 @@ std::fstream xdna_edgedev::sysfs_open(const std::string& entry,
     return sysfs_open_path(get_sysfs_path(entry), err, write, binary);
 }
 
+void xdna_edgedev::sysfs_read_locked(const std::string& entry, std::string& err,
+    std::string& out) const
+{
+    err.clear();
+    out.clear();
+    auto st = m_sysfs_static.find(entry);
+    if (st != m_sysfs_static.end()) {
+        out = st->second;
+        return;
+    }
+
+    auto it = m_sysfs_fds.find(entry);
+    if (it == m_sysfs_fds.end()) {
+        auto path = get_sysfs_path(entry);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::stringstream ss;
+            ss << "Failed to open " << path << " for reading: "
+                << strerror(errno) << std::endl;
+            err = ss.str();
+            return;
+        }
+        it = m_sysfs_fds.emplace(entry, fd).first;
+    }
+
+    // Sysfs regenerates content on each read from offset 0
+    char buf[4096];
+    off_t off = 0;
+    while (true) {
+        auto n = ::pread(it->second, buf, sizeof(buf), off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::stringstream ss;
+            ss << "Failed to read " << get_sysfs_path(entry) << ": "
+                << strerror(errno) << std::endl;
+            err = ss.str();
+            out.clear();
+            return;
+        }
+        if (n == 0)
+            break;
+        out.append(buf, n);
+        off += n;
+    }
+
+    if (is_static_sysfs_entry(entry)) {
+        m_sysfs_static.emplace(entry, out);
+        ::close(it->second);
+        m_sysfs_fds.erase(it);
+    }
+}
+
+void xdna_edgedev::sysfs_read(const std::string& entry, std::string& err,
+    std::string& out) const
+{
+    const std::lock_guard<std::mutex> lock(m_sysfs_lock);
+    sysfs_read_locked(entry, err, out);
+}
+
+std::vector<std::string>
+xdna_edgedev::sysfs_get(const std::vector<std::string>& entries, std::string& err_msg) const
+{
+    std::vector<std::string> values(entries.size());
+    const std::lock_guard<std::mutex> lock(m_sysfs_lock);
+    for (size_t i = 0; i < entries.size(); i++) {
+        sysfs_read_locked(entries[i], err_msg, values[i]);
+        if (!err_msg.empty())
+            break;
+        // Same as single string sysfs_get, only first line is the value
+        auto nl = values[i].find('\n');
+        if (nl != std::string::npos)
+            values[i].resize(nl);
+    }
+    return values;
+}
+
 void xdna_edgedev::sysfs_put(const std::string& entry, std::string& err_msg,
     const std::string& input)
 {
@@ -99,24 +195,22 @@ void xdna_edgedev::sysfs_put(const std::string& entry, std::string& err_msg,
 void xdna_edgedev::sysfs_get(const std::string& entry, std::string& err_msg,
     std::vector<char>& buf) const
 {
-    std::fstream fs = sysfs_open(entry, err_msg, false, true);
+    std::string s;
+    sysfs_read(entry, err_msg, s);
     if (!err_msg.empty())
         return;
-    buf.insert(std::end(buf),std::istreambuf_iterator<char>(fs),
-        std::istreambuf_iterator<char>());
+    buf.insert(std::end(buf), s.begin(), s.end());
 }
 
 void xdna_edgedev::sysfs_get(const std::string& entry, std::string& err_msg,
     std::vector<std::string>& sv) const
 {
-    std::fstream fs = sysfs_open(entry, err_msg, false, false);
+    std::string s;
+    sysfs_read(entry, err_msg, s);
     if (!err_msg.empty())
         return;
 
-    sv.clear();
-    std::string line;
-    while (std::getline(fs, line))
-        sv.push_back(line);
+    sv = split_lines(s);
 }
 
 void xdna_edgedev::sysfs_get(const std::string& entry, std::string& err_msg,
@@ -224,6 +318,8 @@ xdna_edgedev(std::string sysfs_name, std::string dev_name)
 xdna_edgedev::
 ~xdna_edgedev()
 {
+  for (auto& [entry, fd] : m_sysfs_fds)
+    ::close(fd);
   shim_debug("Destroying AIARM edgedev");
 }
 
@@ -16,6 +16,8 @@
 #include <sys/mman.h>  // Include this header for munmap
 #include <string>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include "core/common/device.h"
 #include "core/edge/user/device_linux.h"
@@ -56,6 +58,11 @@ public:
   sysfs_get(const std::string& entry, std::string& err_msg,
 		 std::vector<char>& buf) const;
 
+  // Read several entries under one lock, values are in the order of entries.
+  // Stops at the first failing entry, with err_msg set.
+  std::vector<std::string>
+  sysfs_get(const std::vector<std::string>& entries, std::string& err_msg) const;
+
   template <typename T>
   void
   sysfs_get(const std::string& entry, std::string& err_msg,
@@ -100,6 +107,18 @@ private:
   sysfs_open(const std::string& entry, std::string& err,
 		  bool write = false, bool binary = false) const;
 
+  // Whole content of entry, through an fd kept open for it and read from
+  // offset 0 every time. Entries that can't change are only read once.
+  void
+  sysfs_read(const std::string& entry, std::string& err, std::string& out) const;
+
+  void
+  sysfs_read_locked(const std::string& entry, std::string& err, std::string& out) const;
+
+  mutable std::mutex m_sysfs_lock;
+  mutable std::unordered_map<std::string, int> m_sysfs_fds;
+  mutable std::unordered_map<std::string, std::string> m_sysfs_static;
+
   mutable int m_dev_fd		= -1;
   mutable int m_dev_users	= 0;
   //std::shared_ptr<const xdna_edgedrv> m_driver;
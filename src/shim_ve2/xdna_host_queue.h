@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef XDNA_EDGE_HOST_QUEUE_H__
+#define XDNA_EDGE_HOST_QUEUE_H__
+
+#include <cstdint>
+
+// Layout of VE2 HSA queue as mapped by AMDXDNA_VE2_UMQ_OFFSET.
+// Must be kept in sync with driver/amdxdna/ve2_host_queue.h
+
+namespace shim_xdna_edge {
+
+constexpr uint32_t HOST_QUEUE_ENTRY = 32;
+constexpr uint32_t HOST_INDIRECT_PKT_NUM = 36;
+
+enum host_queue_packet_type
+{
+  HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC = 0,
+  HOST_QUEUE_PACKET_TYPE_INVALID = 1,
+};
+
+enum host_queue_packet_opcode
+{
+  HOST_QUEUE_PACKET_EXEC_BUF = 1,
+  HOST_QUEUE_PACKET_TEST = 2,
+  HOST_QUEUE_PACKET_EXIT = 3,
+};
+
+// Completion state of a slot which can be reused
+constexpr uint64_t HOST_QUEUE_SLOT_FREE = 0;
+
+// chain_flag of common_header
+constexpr uint8_t LAST_CMD = 0;
+constexpr uint8_t NOT_LAST_CMD = 1;
+
+struct exec_buf
+{
+  uint16_t cu_index;
+  uint16_t reserved0;
+  uint32_t dpu_control_code_host_addr_low;
+  uint32_t dpu_control_code_host_addr_high;
+  uint16_t args_len;
+  uint16_t reserved1;
+  uint32_t args_host_addr_low;
+  uint32_t args_host_addr_high;
+};
+
+struct host_queue_header
+{
+  uint64_t read_index;
+  struct {
+    uint16_t major;
+    uint16_t minor;
+  } version;
+  uint32_t capacity;
+  uint64_t write_index;
+  // Device address of hq_entry[0]
+  uint64_t data_address;
+};
+
+struct host_indirect_packet_entry
+{
+  uint32_t host_addr_low;
+  uint32_t host_addr_high : 25;
+  uint32_t uc_index : 7;
+};
+
+struct common_header
+{
+  union {
+    struct {
+      uint16_t type : 8;
+      uint16_t barrier : 1;
+      uint16_t acquire_fence_scope : 2;
+      uint16_t release_fence_scope : 2;
+    };
+    uint16_t header;
+  };
+  uint8_t opcode;
+  uint8_t chain_flag;
+  uint16_t count;
+  uint8_t distribute;
+  uint8_t indirect;
+};
+
+struct xrt_packet_header
+{
+  struct common_header common_header;
+  uint64_t completion_signal;
+};
+
+struct host_queue_packet
+{
+  struct xrt_packet_header xrt_header;
+  uint32_t data[12];
+};
+
+struct host_queue_indirect_hdr
+{
+  struct common_header header;
+  uint32_t data[HOST_INDIRECT_PKT_NUM * sizeof(struct host_indirect_packet_entry)];
+};
+
+struct host_queue_indirect_pkt
+{
+  struct common_header header;
+  struct exec_buf payload;
+};
+
+// Followed by one 64-bit completion state per slot
+struct hsa_queue
+{
+  struct host_queue_header hq_header;
+  struct host_queue_packet hq_entry[HOST_QUEUE_ENTRY];
+  struct host_queue_indirect_hdr hq_indirect_hdr[HOST_QUEUE_ENTRY];
+  struct host_queue_indirect_pkt hq_indirect_pkt[HOST_QUEUE_ENTRY][HOST_INDIRECT_PKT_NUM];
+};
+
+} // shim_xdna_edge
+
+#endif // XDNA_EDGE_HOST_QUEUE_H__
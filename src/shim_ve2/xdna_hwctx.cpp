@@ -18,13 +18,6 @@ namespace shim_xdna_edge {
 
 namespace pt = boost::property_tree;
 
-void read_aie_metadata_hw(const char* data, size_t size, pt::ptree& aie_project)
-{
-  std::stringstream aie_stream;
-  aie_stream.write(data,size);
-  pt::read_json(aie_stream,aie_project);
-}
-
 std::vector<uint8_t>
 get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id)
 {
@@ -40,11 +33,11 @@ get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id)
 }
 
 partition_info
-get_partition_info_main(const xrt_core::device* device,const pt::ptree& aie_meta, uint32_t hw_context_id)
+get_partition_info_main(const xrt_core::device* device, uint64_t base_address, uint32_t hw_context_id)
 {
   partition_info info;
   info.start_column = 0;
-  info.base_address = aie_meta.get<uint64_t>("aie_metadata.driver_config.base_address");
+  info.base_address = base_address;
 
   bool partinfo_found = false;
   auto data = xrt_core::device_query_default<xrt_core::query::aie_partition_info>(device, {});
@@ -66,15 +59,13 @@ get_partition_info_main(const xrt_core::device* device,const pt::ptree& aie_meta
 }
 
 partition_info
-get_partition_info_hw(const xrt_core::device* device, const xrt::uuid xclbin_uuid, uint32_t hw_context_id)
+get_partition_info_hw(const device_xdna* device, const xrt::uuid xclbin_uuid, uint32_t hw_context_id)
 {
-  auto data = device->get_axlf_section(AIE_TRACE_METADATA, xclbin_uuid);
-  if (!data.first || !data.second)
+  auto config = device->get_aie_driver_config(xclbin_uuid);
+  if (!config)
     return {};
 
-  pt::ptree aie_meta;
-  read_aie_metadata_hw(data.first, data.second, aie_meta);
-  return get_partition_info_main(device,aie_meta, hw_context_id);
+  return get_partition_info_main(device, config->base_address, hw_context_id);
 }
 
 xdna_hwctx::
@@ -104,6 +95,7 @@ xdna_hwctx(const device_xdna* dev, const xrt::xclbin& xclbin, const xrt::hw_cont
   if (data.first && data.second)
     m_aie_array = std::make_shared<xdna_aie_array>(m_device, this);
 
+  config_queue_depth();
   m_hwq->bind_hwctx(this);
 
   u32 op_timeout = xrt_core::config::get_cert_timeout();
@@ -141,6 +133,7 @@ xdna_hwctx(const device_xdna* dev, uint32_t partition_size, const xrt::hw_contex
   // TODO : create xdna_aie_array object after ELF has AIE_METADATA, AIE_PARTITION
   // sections added
 
+  config_queue_depth();
   m_hwq->bind_hwctx(this);
 }
 
@@ -271,9 +264,27 @@ init_qos_info(const qos_type& qos)
       m_qos.priority = value;
     else if (key == "start_col")
       m_qos.user_start_col = value;
+    else if (key == "queue_depth")
+      m_queue_depth = value;
   }
 }
 
+void
+xdna_hwctx::
+config_queue_depth()
+{
+  if (!m_queue_depth)
+    return;
+
+  // Queue can only be resized before any cmd goes to it
+  amdxdna_drm_config_hwctx arg = {};
+  arg.handle = m_handle;
+  arg.param_type = DRM_AMDXDNA_HWCTX_QUEUE_DEPTH;
+  arg.param_val = m_queue_depth;
+  m_device->get_edev()->ioctl(DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &arg);
+  shim_debug("HSA queue depth of ctx %d set to %u", m_handle, m_queue_depth);
+}
+
 void
 xdna_hwctx::
 print_xclbin_info()
@@ -123,6 +123,8 @@ private:
   uint32_t m_ops_per_cycle;
   uint32_t m_num_cols;
   uint32_t m_doorbell;
+  // HSA queue slots asked for by QoS key queue_depth, 0 for driver default
+  uint32_t m_queue_depth = 0;
   std::unique_ptr<xrt_core::buffer_handle> m_log_bo;
   std::shared_ptr<xdna_aie_array> m_aie_array;
   void *m_log_buf;
@@ -132,6 +134,9 @@ private:
   void
   init_qos_info(const qos_type& qos);
 
+  void
+  config_queue_depth();
+
   void
   parse_xclbin(const xrt::xclbin& xclbin);
 
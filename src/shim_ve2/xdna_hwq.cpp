@@ -1,10 +1,29 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
 
+#include <atomic>
+#include <cstddef>
+
+#include "core/common/config_reader.h"
+#include "core/include/ert.h"
 #include "shim_debug.h"
 #include "xdna_bo.h"
 #include "xdna_hwq.h"
 
+namespace {
+
+// Submit commands by writing the HSA queue mapped in user space. Exec buf
+// ioctl is rejected by driver for such a context.
+bool
+is_umq_enabled()
+{
+  static bool umq =
+    xrt_core::config::detail::get_bool_value("Runtime.ve2_user_mode_queue", false);
+  return umq;
+}
+
+}
+
 namespace shim_xdna_edge {
 
 xdna_hwq::
@@ -21,6 +40,8 @@ bind_hwctx(const xdna_hwctx *ctx)
   if (m_hwctx)
     shim_err(EINVAL, "one queue can be bind to one hw_context only\n");
   m_hwctx = const_cast<xdna_hwctx*>(ctx);
+  if (is_umq_enabled())
+    umq_map();
   shim_debug("Bond HW queue to HW context %d", m_hwctx->get_slotidx());
 }
 
@@ -31,9 +52,185 @@ unbind_hwctx()
   if (!m_hwctx)
     shim_err(EINVAL, "cannot unbind queue multiple times \n");
   shim_debug("Unbond HW queue from HW context %d", m_hwctx->get_slotidx());
+  umq_unmap();
   m_hwctx = nullptr;
 }
 
+void
+xdna_hwq::
+umq_map()
+{
+  m_umq_size = sizeof(struct hsa_queue) + sizeof(uint64_t) * HOST_QUEUE_ENTRY;
+  auto addr = m_hwctx->get_device()->get_edev()->mmap(nullptr, m_umq_size,
+    PROT_READ | PROT_WRITE, MAP_SHARED, AMDXDNA_VE2_UMQ_OFFSET(m_hwctx->get_slotidx()));
+
+  m_umq = reinterpret_cast<volatile struct hsa_queue *>(addr);
+  m_umq_state = reinterpret_cast<volatile uint64_t *>(reinterpret_cast<char *>(addr) +
+    sizeof(struct hsa_queue));
+  m_umq_paddr = m_umq->hq_header.data_address - offsetof(struct hsa_queue, hq_entry);
+  if (m_umq->hq_header.capacity != HOST_QUEUE_ENTRY) {
+    auto capacity = m_umq->hq_header.capacity;
+    umq_unmap();
+    shim_err(EINVAL, "Unexpected HSA queue capacity %u", capacity);
+  }
+  shim_debug("Mapped HSA queue of HW context %d at %p", m_hwctx->get_slotidx(), addr);
+}
+
+void
+xdna_hwq::
+umq_unmap()
+{
+  if (!m_umq)
+    return;
+
+  m_hwctx->get_device()->get_edev()->munmap(const_cast<struct hsa_queue *>(m_umq), m_umq_size);
+  m_umq = nullptr;
+  m_umq_state = nullptr;
+}
+
+void
+xdna_hwq::
+umq_fill_direct(uint32_t slot_idx, const void *data)
+{
+  auto dpu = reinterpret_cast<const ert_dpu_data *>(data);
+  auto pkt = &m_umq->hq_entry[slot_idx];
+  auto hdr = &pkt->xrt_header;
+
+  hdr->common_header.count = sizeof(struct exec_buf);
+  hdr->common_header.distribute = 0;
+  hdr->common_header.indirect = 0;
+
+  auto ebp = reinterpret_cast<volatile struct exec_buf *>(pkt->data);
+  ebp->cu_index = 0;
+  ebp->dpu_control_code_host_addr_low = static_cast<uint32_t>(dpu->instruction_buffer);
+  ebp->dpu_control_code_host_addr_high = static_cast<uint32_t>(dpu->instruction_buffer >> 32);
+  ebp->args_len = 0;
+  ebp->args_host_addr_low = 0;
+  ebp->args_host_addr_high = 0;
+}
+
+void
+xdna_hwq::
+umq_fill_indirect(uint32_t slot_idx, const void *data)
+{
+  auto dpu = reinterpret_cast<const ert_dpu_data *>(data);
+  auto total_cmds = dpu->chained + 1u;
+
+  if (total_cmds > HOST_INDIRECT_PKT_NUM)
+    shim_err(EINVAL, "unsupported indirect number %u, valid number <= %u",
+      total_cmds, HOST_INDIRECT_PKT_NUM);
+
+  auto pkt = &m_umq->hq_entry[slot_idx];
+  auto hdr = &pkt->xrt_header;
+  hdr->common_header.count = sizeof(struct host_indirect_packet_entry);
+  hdr->common_header.distribute = 1;
+  hdr->common_header.indirect = 1;
+
+  auto indirect_hdr = &m_umq->hq_indirect_hdr[slot_idx];
+  indirect_hdr->header.count = total_cmds * sizeof(struct host_indirect_packet_entry);
+  indirect_hdr->header.indirect = 1;
+  indirect_hdr->header.distribute = 1;
+
+  uint64_t hdr_paddr = m_umq_paddr + offsetof(struct hsa_queue, hq_indirect_hdr) +
+    slot_idx * sizeof(struct host_queue_indirect_hdr);
+  auto hp = reinterpret_cast<volatile struct host_indirect_packet_entry *>(pkt->data);
+  hp->host_addr_low = static_cast<uint32_t>(hdr_paddr);
+  hp->host_addr_high = static_cast<uint32_t>(hdr_paddr >> 32);
+  hp->uc_index = 0;
+
+  auto hp_hdr = reinterpret_cast<volatile struct host_indirect_packet_entry *>(indirect_hdr->data);
+  for (uint32_t i = 0; dpu; i++, hp_hdr++, dpu = get_ert_dpu_data_next(dpu)) {
+    uint64_t buf_paddr = m_umq_paddr + offsetof(struct hsa_queue, hq_indirect_pkt) +
+      (slot_idx * HOST_INDIRECT_PKT_NUM + i) * sizeof(struct host_queue_indirect_pkt);
+
+    hp_hdr->host_addr_low = static_cast<uint32_t>(buf_paddr);
+    hp_hdr->host_addr_high = static_cast<uint32_t>(buf_paddr >> 32);
+    hp_hdr->uc_index = dpu->uc_index;
+
+    auto cebp = &m_umq->hq_indirect_pkt[slot_idx][i];
+    cebp->payload.cu_index = 0;
+    cebp->payload.dpu_control_code_host_addr_low =
+      static_cast<uint32_t>(dpu->instruction_buffer);
+    cebp->payload.dpu_control_code_host_addr_high =
+      static_cast<uint32_t>(dpu->instruction_buffer >> 32);
+    cebp->payload.args_len = 0;
+    cebp->payload.args_host_addr_low = 0;
+    cebp->payload.args_host_addr_high = 0;
+  }
+}
+
+void
+xdna_hwq::
+umq_submit_command(xrt_core::buffer_handle *cmd_bo)
+{
+  auto boh = static_cast<shim_xdna_edge::xdna_bo*>(cmd_bo);
+  auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(boh->m_ptr);
+
+  if (!cmd)
+    shim_err(EINVAL, "Command BO is not mapped");
+  if (cmd->opcode != ERT_START_DPU)
+    shim_err(ENOTSUP, "Unsupported ERT cmd %d on user mode queue", cmd->opcode);
+
+  auto dpu = get_ert_dpu_data(cmd);
+  if (!dpu)
+    shim_err(EINVAL, "No dpu data, invalid exec buf");
+
+  std::lock_guard<std::mutex> lock(m_umq_lock);
+  auto hdr = &m_umq->hq_header;
+  uint64_t wi = hdr->write_index;
+  if (wi - hdr->read_index >= hdr->capacity)
+    shim_err(EBUSY, "HSA queue is full");
+
+  uint32_t slot_idx = wi % hdr->capacity;
+  if (m_umq_state[slot_idx] != HOST_QUEUE_SLOT_FREE)
+    shim_err(EBUSY, "slot %u is still active with state %lu", slot_idx, m_umq_state[slot_idx]);
+
+  auto pkt = &m_umq->hq_entry[slot_idx];
+  if (pkt->xrt_header.common_header.type == HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC)
+    shim_err(EBUSY, "pkt of slot %u is already selected", slot_idx);
+
+  m_umq_state[slot_idx] = ERT_CMD_STATE_NEW;
+  if (get_ert_dpu_data_next(dpu))
+    umq_fill_indirect(slot_idx, dpu);
+  else
+    umq_fill_direct(slot_idx, dpu);
+
+  auto phdr = &pkt->xrt_header;
+  phdr->common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
+  phdr->common_header.chain_flag = LAST_CMD;
+  phdr->completion_signal = m_umq_paddr + sizeof(struct hsa_queue) + slot_idx * sizeof(uint64_t);
+  m_umq_state[slot_idx] = ERT_CMD_STATE_SUBMITTED;
+  phdr->common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
+
+  // Packet has to be visible before the write index which publishes it
+  std::atomic_thread_fence(std::memory_order_release);
+  hdr->write_index = wi + 1;
+
+  amdxdna_drm_config_hwctx adbo = {};
+  adbo.handle = m_hwctx->get_slotidx();
+  adbo.param_type = DRM_AMDXDNA_HWCTX_UMQ_DOORBELL;
+  m_hwctx->get_device()->get_edev()->ioctl(DRM_IOCTL_AMDXDNA_CONFIG_HWCTX, &adbo);
+
+  boh->set_cmd_id(wi);
+  shim_debug("Submitted command (%ld) to user mode queue", wi);
+}
+
+void
+xdna_hwq::
+umq_collect_state(xrt_core::buffer_handle *cmd_bo) const
+{
+  auto boh = static_cast<shim_xdna_edge::xdna_bo*>(cmd_bo);
+  auto cmd = reinterpret_cast<ert_packet *>(boh->m_ptr);
+  uint32_t slot_idx = boh->get_cmd_id() % HOST_QUEUE_ENTRY;
+  auto state = static_cast<uint32_t>(m_umq_state[slot_idx]);
+
+  // Firmware did not report back, e.g. context went bad
+  if (state < ERT_CMD_STATE_COMPLETED || state == ERT_CMD_STATE_SUBMITTED)
+    state = ERT_CMD_STATE_ABORT;
+  cmd->state = state;
+  m_umq_state[slot_idx] = HOST_QUEUE_SLOT_FREE;
+}
+
 uint32_t
 xdna_hwq::
 get_queue_bo()
@@ -54,6 +251,11 @@ submit_command(xrt_core::buffer_handle *cmd_bo)
   if (!m_hwctx)
     shim_err(EINVAL, "No hw_context bind to submit the command \n");
 
+  if (m_umq) {
+    umq_submit_command(cmd_bo);
+    return;
+  }
+
   amdxdna_drm_exec_cmd ecmd = {
     .hwctx = m_hwctx->get_slotidx(),
     .cmd_handles = boh->get_drm_bo_handle(),
@@ -96,6 +298,9 @@ wait_command(xrt_core::buffer_handle *cmd_bo, uint32_t timeout_ms) const
       ret = 0;
   }
 
+  if (ret && m_umq)
+    umq_collect_state(cmd_bo);
+
   return ret;
 }
 
@@ -4,9 +4,12 @@
 #ifndef XDNA_EDGE_HWQ_H__
 #define XDNA_EDGE_HWQ_H__
 
+#include <mutex>
+
 #include "core/common/shim/hwqueue_handle.h"
 #include "shim_debug.h"
 #include "xdna_device.h"
+#include "xdna_host_queue.h"
 #include "xdna_hwctx.h"
 
 namespace shim_xdna_edge {
@@ -55,8 +58,36 @@ public:
   get_queue_bo();
 
 private:
+  // User mode queue, packets are written straight into the mapped HSA queue
+  void
+  umq_map();
+
+  void
+  umq_unmap();
+
+  void
+  umq_submit_command(xrt_core::buffer_handle *cmd_bo);
+
+  void
+  umq_fill_direct(uint32_t slot_idx, const void *dpu);
+
+  void
+  umq_fill_indirect(uint32_t slot_idx, const void *dpu);
+
+  void
+  umq_collect_state(xrt_core::buffer_handle *cmd_bo) const;
+
   xdna_hwctx *m_hwctx;
   uint32_t m_queue_boh;
+
+  volatile struct hsa_queue *m_umq = nullptr;
+  // Completion state of each slot, right after m_umq
+  volatile uint64_t *m_umq_state = nullptr;
+  size_t m_umq_size = 0;
+  // Device address of m_umq
+  uint64_t m_umq_paddr = 0;
+  // Serializes submitters on write_index
+  std::mutex m_umq_lock;
 };
 
 } // shim_xdna_edge
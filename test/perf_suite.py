@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2025, Advanced Micro Devices, Inc.
+
+"""Run shim_test benchmarks and compare them against a stored baseline.
+
+shim_test -b, and xrt_test -b if --xrt-test is given, append one JSON object
+per result to a file. Each benchmark is
+run --repeat times, results of the same test case and parameters (threads,
+size, ...) are grouped, and the mean of every latency and throughput metric
+is compared with the baseline of the same device id and firmware version.
+A metric regresses if it is worse than the baseline by more than
+--tolerance AND Welch's t-test says the difference is significant at
+--alpha. With a single sample on either side, only the tolerance is checked.
+
+Baseline JSON:
+
+  {"version": 1, "devices": {"<device>/<firmware>": {"<group>": {
+      "<metric>": {"mean": m, "stdev": s, "n": n}}}}}
+
+With --by-queue, nothing is compared with a baseline. Instead, means of
+the same test case and parameters are printed side by side for each queue
+path, KMQ and UMQ, which are run on different devices. E.g. results of the
+"KMQ/UMQ path" cases show submit cost and completion latency of both.
+
+Exit status is 1 if anything regressed, 2 on usage errors.
+"""
+
+import argparse
+import collections
+import json
+import math
+import os
+import subprocess
+import sys
+
+# Fields telling results of one test case apart
+GROUP_FIELDS = ("threads", "processes", "size", "offset", "inflight", "cmds_per_list",
+                "to_device", "by_driver", "shared_hwctx")
+# Too noisy to compare, or not a quality of the result
+SKIP_METRICS = ("duration_us", "max_us", "worst_max_us", "free_max_us", "min_us")
+
+
+def metric_direction(name):
+    """1 if higher is better, -1 if lower is better, 0 if not compared."""
+    if name in SKIP_METRICS:
+        return 0
+    if name.endswith("_per_sec") or name in ("gbps", "efficiency"):
+        return 1
+    if name.endswith("_us"):
+        return -1
+    return 0
+
+
+def group_name(rec, with_driver=True):
+    params = ",".join("%s=%g" % (f, rec[f]) for f in GROUP_FIELDS if f in rec)
+    name = rec["test"]
+    if with_driver:
+        name = "%s|%s" % (rec.get("driver", ""), name)
+    return name + "|" + params if params else name
+
+
+def load_results(path, by_queue=False):
+    """{device/firmware: {group: {metric: [samples]}}}, or
+    {group: {queue: {metric: [samples]}}} if by_queue"""
+    out = collections.defaultdict(lambda: collections.defaultdict(
+        lambda: collections.defaultdict(list)))
+    with open(path) as f:
+        for n, line in enumerate(f):
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                rec = json.loads(line)
+            except json.JSONDecodeError as e:
+                sys.exit("%s:%d: %s" % (path, n + 1, e))
+            if by_queue:
+                grp = out[group_name(rec, False)][rec.get("queue", "unknown")]
+            else:
+                dev = "%s/%s" % (rec.get("device", "unknown"), rec.get("firmware", "unknown"))
+                grp = out[dev][group_name(rec)]
+            for k, v in rec.items():
+                if isinstance(v, (int, float)) and metric_direction(k):
+                    grp[k].append(float(v))
+    return out
+
+
+def mean_stdev(samples):
+    n = len(samples)
+    m = sum(samples) / n
+    if n < 2:
+        return m, 0.0
+    return m, math.sqrt(sum((x - m) ** 2 for x in samples) / (n - 1))
+
+
+def betacf(a, b, x):
+    """Continued fraction of the incomplete beta function (Lentz)."""
+    tiny = 1e-300
+    c, d = 1.0, 1.0 - (a + b) * x / (a + 1.0)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 200):
+        m2 = 2 * m
+        for num in (m * (b - m) * x / ((a + m2 - 1) * (a + m2)),
+                    -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1))):
+            d = 1.0 + num * d
+            d = 1.0 / (d if abs(d) > tiny else tiny)
+            c = 1.0 + num / c
+            c = c if abs(c) > tiny else tiny
+            h *= d * c
+        if abs(d * c - 1.0) < 1e-12:
+            break
+    return h
+
+
+def betai(a, b, x):
+    if x <= 0:
+        return 0.0
+    if x >= 1:
+        return 1.0
+    lbeta = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+    front = math.exp(lbeta + a * math.log(x) + b * math.log(1 - x))
+    if x < (a + 1) / (a + b + 2):
+        return front * betacf(a, b, x) / a
+    return 1.0 - front * betacf(b, a, 1 - x) / b
+
+
+def welch_p(m1, s1, n1, m2, s2, n2):
+    """Two-sided p-value of Welch's t-test, None if it can't be computed."""
+    if n1 < 2 or n2 < 2:
+        return None
+    v1, v2 = s1 * s1 / n1, s2 * s2 / n2
+    if v1 + v2 == 0:
+        return 0.0 if m1 != m2 else 1.0
+    t = (m1 - m2) / math.sqrt(v1 + v2)
+    df = (v1 + v2) ** 2 / (v1 * v1 / (n1 - 1) + v2 * v2 / (n2 - 1))
+    return betai(df / 2, 0.5, df / (df + t * t))
+
+
+def find_baseline(baseline, dev):
+    devices = baseline.get("devices", {})
+    if dev in devices:
+        return devices[dev], dev
+    # Same device, other firmware, is still better than nothing
+    dev_id = dev.split("/")[0]
+    for k in sorted(devices):
+        if k.split("/")[0] == dev_id:
+            return devices[k], k
+    return None, None
+
+
+def compare(results, baseline, tolerance, alpha):
+    regressed = 0
+    for dev, groups in sorted(results.items()):
+        base, base_dev = find_baseline(baseline, dev)
+        if base is None:
+            print("%s: no baseline" % dev)
+            continue
+        if base_dev != dev:
+            print("%s: no baseline of this firmware, using %s" % (dev, base_dev))
+        print("%s:" % dev)
+        for grp, metrics in sorted(groups.items()):
+            for name, samples in sorted(metrics.items()):
+                b = base.get(grp, {}).get(name)
+                if not b:
+                    print("  NEW       %s %s" % (grp, name))
+                    continue
+                m, s = mean_stdev(samples)
+                change = (m - b["mean"]) / b["mean"] if b["mean"] else 0.0
+                worse = -change * metric_direction(name)
+                p = welch_p(m, s, len(samples), b["mean"], b["stdev"], b["n"])
+                significant = p is None or p < alpha
+                if worse > tolerance and significant:
+                    verdict = "REGRESSED"
+                    regressed += 1
+                elif -worse > tolerance and significant:
+                    verdict = "IMPROVED"
+                else:
+                    verdict = "ok"
+                print("  %-9s %s %s: %.3f vs %.3f (%+.1f%%, p %s)" %
+                      (verdict, grp, name, m, b["mean"], change * 100,
+                       "n/a" if p is None else "%.3f" % p))
+    return regressed
+
+
+def compare_queues(results):
+    for grp, queues in sorted(results.items()):
+        names = sorted(queues)
+        print("%s:" % grp)
+        print("  %-20s" % "metric" + "".join(" %14s" % q for q in names))
+        metrics = sorted(set(m for q in names for m in queues[q]))
+        for name in metrics:
+            row = "  %-20s" % name
+            for q in names:
+                samples = queues[q].get(name)
+                row += " %14s" % ("-" if not samples else "%.3f" % mean_stdev(samples)[0])
+            print(row)
+
+
+def update_baseline(results, baseline):
+    baseline.setdefault("version", 1)
+    devices = baseline.setdefault("devices", {})
+    for dev, groups in results.items():
+        base = devices.setdefault(dev, {})
+        for grp, metrics in groups.items():
+            for name, samples in metrics.items():
+                m, s = mean_stdev(samples)
+                base.setdefault(grp, {})[name] = {"mean": m, "stdev": s, "n": len(samples)}
+    return baseline
+
+
+def run_benchmarks(shim_test, xrt_test, xrt_threads, repeat, tests, result_path):
+    if os.path.exists(result_path):
+        os.remove(result_path)
+    cmds = []
+    if shim_test:
+        cmds.append([shim_test, "-b", result_path] + tests)
+    if xrt_test:
+        # All "measure" cases of xrt_test, e.g. thread scaling up to -t threads
+        cmds.append([xrt_test, "-t", str(xrt_threads), "-b", result_path])
+    for i in range(repeat):
+        print("Benchmark run %d of %d" % (i + 1, repeat), flush=True)
+        for cmd in cmds:
+            ret = subprocess.call(cmd)
+            if ret:
+                sys.exit("%s failed, exit status %d" % (cmd[0], ret))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("tests", nargs="*",
+                        help="shim_test case IDs or names, all \"measure\" cases if none")
+    parser.add_argument("--shim-test", help="shim_test.elf to run")
+    parser.add_argument("--xrt-test", help="xrt_test.elf to run as well, on npu3")
+    parser.add_argument("--xrt-threads", type=int, default=8,
+                        help="max threads of xrt_test thread scaling, default 8")
+    parser.add_argument("--results", default="perf_suite_results.json",
+                        help="benchmark result file, compared without running "
+                        "anything if neither --shim-test nor --xrt-test is given")
+    parser.add_argument("--baseline", help="baseline JSON")
+    parser.add_argument("--repeat", type=int, default=5, help="runs of each benchmark")
+    parser.add_argument("--tolerance", type=float, default=0.05,
+                        help="relative slowdown allowed, default 0.05")
+    parser.add_argument("--alpha", type=float, default=0.05,
+                        help="significance level of the t-test, default 0.05")
+    parser.add_argument("--update", action="store_true",
+                        help="store results as new baseline instead of comparing")
+    parser.add_argument("--by-queue", action="store_true",
+                        help="show results of KMQ and UMQ side by side, no baseline")
+    opts = parser.parse_args()
+    if not opts.baseline and not opts.by_queue:
+        parser.error("--baseline is required unless --by-queue is given")
+
+    if opts.tests and not opts.shim_test:
+        parser.error("test cases given without --shim-test")
+    if opts.shim_test or opts.xrt_test:
+        run_benchmarks(opts.shim_test, opts.xrt_test, opts.xrt_threads, opts.repeat, opts.tests,
+                       opts.results)
+    results = load_results(opts.results, opts.by_queue)
+    if not results:
+        sys.exit("No benchmark results in %s" % opts.results)
+
+    if opts.by_queue:
+        compare_queues(results)
+        return 0
+
+    baseline = {}
+    if os.path.exists(opts.baseline):
+        with open(opts.baseline) as f:
+            baseline = json.load(f)
+
+    if opts.update:
+        with open(opts.baseline, "w") as f:
+            json.dump(update_baseline(results, baseline), f, indent=2, sort_keys=True)
+        print("Baseline updated: %s" % opts.baseline)
+        return 0
+
+    regressed = compare(results, baseline, opts.tolerance, opts.alpha)
+    print("%d regression(s) beyond %.1f%% at p < %g" %
+          (regressed, opts.tolerance * 100, opts.alpha))
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
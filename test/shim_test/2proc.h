@@ -6,7 +6,9 @@
 
 #include "core/common/device.h"
 
+#include <chrono>
 #include <cstdarg>
+#include <vector>
 #include <signal.h>
 #include <sys/wait.h>
 
@@ -144,4 +146,153 @@ private:
   xrt_core::device::id_type m_id;
 };
 
+// Forks N child processes running the same test, for contention benchmarks.
+// Each child does its setup, e.g. opening device and creating HW context, then
+// all children are released at the same time to run the timed part and send
+// back a result of type R to the parent.
+template <typename R>
+class test_nproc {
+public:
+  test_nproc(xrt_core::device::id_type id, int num_procs) : m_id(id), m_num_procs(num_procs)
+  {}
+
+  virtual ~test_nproc() = default;
+
+  void
+  run_test()
+  {
+    int ready_pipefd[2] = {-1, -1};
+    int start_pipefd[2] = {-1, -1};
+    std::vector<int> result_fds;
+    std::vector<pid_t> pids;
+
+    if (pipe(ready_pipefd) < 0 || pipe(start_pipefd) < 0) {
+      std::cout << "Can't create pipes" << std::endl;
+      // Just quit on these fundamental issues and let OS clean it up.
+      _exit(EXIT_FAILURE);
+    }
+    // We want to handle pipe comm issue ourselves.
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < m_num_procs; i++) {
+      int result_pipefd[2] = {-1, -1};
+
+      if (pipe(result_pipefd) < 0) {
+        std::cout << "Can't create pipes" << std::endl;
+        _exit(EXIT_FAILURE);
+      }
+      auto pid = fork();
+      if (pid == -1) {
+        std::cout << "Can't fork" << std::endl;
+        _exit(EXIT_FAILURE);
+      }
+      if (!pid) {
+        close(ready_pipefd[0]);
+        close(start_pipefd[1]);
+        close(result_pipefd[0]);
+        for (auto fd : result_fds)
+          close(fd);
+        run_child(i, ready_pipefd[1], start_pipefd[0], result_pipefd[1]);
+        // Never returns
+      }
+      close(result_pipefd[1]);
+      result_fds.push_back(result_pipefd[0]);
+      pids.push_back(pid);
+    }
+    close(ready_pipefd[1]);
+    close(start_pipefd[0]);
+
+    // Wait for all children to finish setup. A child which failed in setup
+    // still reports in, so that the rest are not blocked forever.
+    bool failed = false;
+    for (int i = 0; i < m_num_procs; i++) {
+      char ok = 0;
+      if (read(ready_pipefd[0], &ok, sizeof(ok)) != sizeof(ok) || !ok)
+        failed = true;
+    }
+    close(ready_pipefd[0]);
+
+    // Closing the pipe wakes up all children at once.
+    auto start = std::chrono::high_resolution_clock::now();
+    close(start_pipefd[1]);
+
+    std::vector<R> results(m_num_procs);
+    for (int i = 0; i < m_num_procs; i++) {
+      if (read(result_fds[i], &results[i], sizeof(R)) != sizeof(R))
+        failed = true;
+      close(result_fds[i]);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    for (auto pid : pids) {
+      int status = 0;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        failed = true;
+    }
+    if (failed)
+      throw std::runtime_error("At least one child did not complete successfully");
+
+    run_test_parent(results, std::chrono::duration_cast<std::chrono::microseconds>(end - start));
+  }
+
+protected:
+  xrt_core::device::id_type
+  get_dev_id()
+  {
+    return m_id;
+  }
+
+private:
+  // Called in child before all children are released
+  virtual void
+  setup_child(int idx) = 0;
+
+  // Called in child, the timed part
+  virtual R
+  run_test_child(int idx) = 0;
+
+  // Called in parent with results from all children and wall time from
+  // children being released till last result is received
+  virtual void
+  run_test_parent(const std::vector<R>& results, std::chrono::microseconds duration) = 0;
+
+  [[noreturn]] void
+  run_child(int idx, int ready_fd, int start_fd, int result_fd)
+  {
+    char ok = 1;
+    try {
+      setup_child(idx);
+    } catch (const std::exception& ex) {
+      std::cout << "Child " << idx << " setup failed: " << ex.what() << std::endl;
+      ok = 0;
+    }
+    if (write(ready_fd, &ok, sizeof(ok)) != sizeof(ok))
+      ok = 0;
+    close(ready_fd);
+
+    // Blocked till parent closes the pipe
+    char c;
+    while (read(start_fd, &c, sizeof(c)) > 0)
+      ;
+    close(start_fd);
+    if (!ok)
+      _exit(EXIT_FAILURE);
+
+    try {
+      R r = run_test_child(idx);
+      if (write(result_fd, &r, sizeof(r)) != sizeof(r))
+        _exit(EXIT_FAILURE);
+    } catch (const std::exception& ex) {
+      std::cout << "Child " << idx << " failed: " << ex.what() << std::endl;
+      _exit(EXIT_FAILURE);
+    }
+    close(result_fd);
+    _exit(EXIT_SUCCESS);
+  }
+
+  xrt_core::device::id_type m_id;
+  int m_num_procs;
+};
+
 #endif // _SHIMTEST_2PROC_H_
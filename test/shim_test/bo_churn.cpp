@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "bo.h"
+#include "speed.h"
+
+#include "core/common/device.h"
+
+#include <queue>
+#include <random>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <unistd.h>
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+std::tuple<uint64_t, uint64_t, uint64_t> get_bo_usage(device* dev, int pid);
+
+namespace {
+
+// One entry of the allocation trace, the BO is freed after lifetime more
+// allocations are done by the same thread.
+struct churn_op {
+  size_t size;
+  uint32_t flags;
+  int lifetime;
+};
+
+// Size and lifetime distribution of the synthetic trace. Mostly small and
+// short lived BOs, with a few large long lived ones, which, across threads,
+// are enough to exhaust the default device heap now and then.
+struct churn_class {
+  int weight;
+  size_t size;
+  uint32_t flags;
+  int min_lifetime;
+  int max_lifetime;
+};
+
+const churn_class churn_classes[] = {
+  { 40, 0x1000,     XCL_BO_FLAGS_HOST_ONLY, 1,  8   },
+  { 25, 0x10000,    XCL_BO_FLAGS_CACHEABLE, 1,  32  },
+  { 20, 0x100000,   XCL_BO_FLAGS_CACHEABLE, 8,  64  },
+  { 10, 0x400000,   XCL_BO_FLAGS_HOST_ONLY, 16, 128 },
+  { 5,  0x1000000,  XCL_BO_FLAGS_CACHEABLE, 32, 256 },
+};
+
+// Give up if device heap stays exhausted for this many retries in a row.
+const int churn_max_retries = 10000;
+
+std::vector<churn_op>
+gen_churn_trace(int num_ops, unsigned seed)
+{
+  std::vector<churn_op> trace;
+  std::vector<int> weights;
+  std::mt19937 gen(seed);
+
+  for (auto& c : churn_classes)
+    weights.push_back(c.weight);
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+
+  trace.reserve(num_ops);
+  for (int i = 0; i < num_ops; i++) {
+    auto& c = churn_classes[pick(gen)];
+    std::uniform_int_distribution<int> lifetime(c.min_lifetime, c.max_lifetime);
+    trace.push_back({ c.size, c.flags, lifetime(gen) });
+  }
+  return trace;
+}
+
+struct churn_result {
+  latency_recorder alloc_lat;
+  latency_recorder free_lat;
+  int enomem_retries = 0;
+  bool failed = false;
+
+  churn_result(int num_ops) : alloc_lat(num_ops), free_lat(num_ops)
+  {}
+};
+
+void
+replay_churn_trace(device* dev, const std::vector<churn_op>& trace, churn_result& res)
+{
+  using live_bo = std::pair<int, std::unique_ptr<bo>>;
+  auto later = [] (const live_bo& a, const live_bo& b) { return a.first > b.first; };
+  std::priority_queue<live_bo, std::vector<live_bo>, decltype(later)> live(later);
+
+  auto free_one = [&] () {
+    // priority_queue::top() is const, steal the BO before popping it
+    auto b = std::move(const_cast<live_bo&>(live.top()).second);
+    live.pop();
+    auto start = clk::now();
+    b.reset();
+    res.free_lat.record(start, clk::now());
+  };
+
+  for (int i = 0; i < trace.size(); i++) {
+    while (!live.empty() && live.top().first <= i)
+      free_one();
+
+    auto& op = trace[i];
+    for (int retries = 0; ; retries++) {
+      try {
+        auto start = clk::now();
+        auto b = std::make_unique<bo>(dev, op.size, op.flags);
+        res.alloc_lat.record(start, clk::now());
+        live.emplace(i + op.lifetime, std::move(b));
+        break;
+      } catch (const std::system_error& e) {
+        if (e.code().value() != ENOMEM || retries >= churn_max_retries)
+          throw;
+        // Make room by freeing the BO due soonest, or wait for other threads
+        // to free theirs.
+        res.enomem_retries++;
+        if (live.empty())
+          std::this_thread::yield();
+        else
+          free_one();
+      }
+    }
+  }
+  while (!live.empty())
+    free_one();
+}
+
+}
+
+void
+TEST_bo_alloc_churn(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  int num_threads = static_cast<int>(arg[0]);
+  int ops_per_thread = static_cast<int>(arg[1]);
+  std::vector<std::vector<churn_op>> traces;
+  std::vector<std::unique_ptr<churn_result>> results;
+  std::vector<std::thread> threads;
+
+  // Traces are generated up front so that the replay only allocates and frees
+  for (int t = 0; t < num_threads; t++) {
+    traces.push_back(gen_churn_trace(ops_per_thread, t));
+    results.push_back(std::make_unique<churn_result>(ops_per_thread));
+  }
+
+  auto [total_before, internal_before, heap_before] = get_bo_usage(dev, getpid());
+  auto start = clk::now();
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      try {
+        replay_churn_trace(dev, traces[t], *results[t]);
+      } catch (const std::exception& ex) {
+        results[t]->failed = true;
+        std::cout << "Thread " << t << " failed: " << ex.what() << std::endl;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  auto end = clk::now();
+  auto [total_after, internal_after, heap_after] = get_bo_usage(dev, getpid());
+
+  latency_recorder alloc_lat(num_threads * ops_per_thread);
+  latency_recorder free_lat(num_threads * ops_per_thread);
+  int enomem_retries = 0;
+  for (auto& r : results) {
+    if (r->failed)
+      throw std::runtime_error("At least one thread has failed");
+    alloc_lat.merge(r->alloc_lat);
+    free_lat.merge(r->free_lat);
+    enomem_retries += r->enomem_retries;
+  }
+
+  // All BOs are freed by now, only internal BOs, e.g. device heap, may remain
+  if (total_after - internal_after != total_before - internal_before)
+    throw std::runtime_error("BO usage mis-match after all BOs are freed");
+
+  auto ops = num_threads * ops_per_thread * 2;
+  auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
+  auto ops_per_sec = (ops * 1000000.0) / duration_us;
+  auto alloc_sum = alloc_lat.summarize();
+  auto free_sum = free_lat.summarize();
+  auto heap_growth = internal_after - internal_before;
+  std::cout << num_threads << " threads finished " << ops << " BO alloc/free in "
+            << duration_us << " us, " << ops_per_sec << " ops/sec, "
+            << enomem_retries << " ENOMEM retries, internal BO usage grew "
+            << heap_growth << " bytes" << std::endl;
+  std::cout << "Alloc:" << std::endl;
+  print_latency_summary(alloc_sum);
+  std::cout << "Free:" << std::endl;
+  print_latency_summary(free_sum);
+  bench_report({
+    { "threads", num_threads },
+    { "ops", ops },
+    { "duration_us", duration_us },
+    { "ops_per_sec", ops_per_sec },
+    { "enomem_retries", enomem_retries },
+    { "internal_growth_bytes", heap_growth },
+    { "free_p50_us", free_sum.p50_us },
+    { "free_p99_us", free_sum.p99_us },
+    { "free_max_us", free_sum.max_us },
+  }, alloc_lat, alloc_sum);
+}
@@ -5,9 +5,17 @@
 #include "io.h"
 #include "2proc.h"
 #include "dev_info.h"
+#include "speed.h"
 
 #include "core/common/system.h"
 
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-heap.h>
+
 namespace {
 
 using namespace xrt_core;
@@ -89,6 +97,68 @@ TEST_export_import_bo_single_proc(device::id_type id, std::shared_ptr<device>& s
   boset2.run();
 }
 
+void
+TEST_import_dmabuf_frame_handoff(device::id_type id, std::shared_ptr<device>& sdev, const std::vector<uint64_t>& arg)
+{
+  auto dev = sdev.get();
+  auto frame_size = static_cast<size_t>(arg[0]);
+  auto num_frames = static_cast<int>(arg[1]);
+  // Frames rotate through a small pool, same as a video decoder output queue.
+  const int pool_size = 4;
+
+  // System dma-heap stands in for GPU as a foreign exporter.
+  int heap_fd = open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC);
+  if (heap_fd < 0) {
+    std::cout << "No system dma-heap, skipped" << std::endl;
+    return;
+  }
+
+  std::vector<int> frames;
+  for (int i = 0; i < pool_size; i++) {
+    dma_heap_allocation_data data = {};
+    data.len = frame_size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    if (ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
+      close(heap_fd);
+      throw std::runtime_error("Failed to allocate dma-heap buffer");
+    }
+    frames.push_back(data.fd);
+  }
+  close(heap_fd);
+
+  // Producer fills each frame once through its own mapping.
+  for (auto fd : frames) {
+    auto p = mmap(nullptr, frame_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Failed to map dma-heap buffer");
+    std::memset(p, 0x5a, frame_size);
+    munmap(p, frame_size);
+  }
+
+  // Handoff of a frame is import + sync to device, BO is dropped afterwards.
+  ns_t first{}, total{};
+  for (int i = 0; i < num_frames; i++) {
+    auto start = clk::now();
+    auto bo = dev->import_bo(getpid(), frames[i % pool_size]);
+    bo->sync(buffer_handle::direction::host2device, frame_size, 0);
+    auto end = clk::now();
+    auto dur = std::chrono::duration_cast<ns_t>(end - start);
+    if (i < pool_size)
+      first += dur;
+    else
+      total += dur;
+  }
+
+  std::cout << "\tFrame 0x" << std::hex << frame_size << std::dec << " bytes, first handoff avg "
+    << first.count() / pool_size << " ns";
+  if (num_frames > pool_size)
+    std::cout << ", later handoff avg " << total.count() / (num_frames - pool_size) << " ns";
+  std::cout << std::endl;
+
+  for (auto fd : frames)
+    close(fd);
+}
+
 void
 TEST_export_bo_then_close_device(device::id_type id, std::shared_ptr<device>& sdev, const std::vector<uint64_t>& arg)
 {
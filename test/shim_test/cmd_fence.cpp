@@ -8,16 +8,152 @@
 #include "dev_info.h"
 #include "exec_buf.h"
 #include "io_config.h"
+#include "io_param.h"
+#include "speed.h"
 
 #include "core/common/system.h"
 #include "core/common/shim/fence_handle.h"
+#include "core/common/shim/shared_handle.h"
 #include <algorithm>
+#include <unistd.h>
 
 namespace {
 
 using namespace xrt_core;
 using arg_type = const std::vector<uint64_t>;
 
+const char *
+fence_chain_mode_name(int mode)
+{
+  switch (mode) {
+  case FENCE_CHAIN_HOST:
+    return "host";
+  case FENCE_CHAIN_DRIVER:
+    return "driver";
+  case FENCE_CHAIN_PENDING:
+    return "pending";
+  default:
+    throw std::runtime_error("Unknown fence chain mode " + std::to_string(mode));
+  }
+}
+
+struct fence_chain_cmd {
+  std::unique_ptr<io_test_bo_set> boset;
+  hwqueue_handle *hwq;
+  buffer_handle *hdl;
+  ert_start_kernel_cmd *pkt;
+};
+
+// Chain of cmds, round robin on a number of hw queues, each cmd waiting for
+// the one before it.
+class fence_chain
+{
+public:
+  fence_chain(device *dev, int num_hwq, int num_cmds)
+    : m_gate(dev->create_fence(fence_handle::access_mode::local))
+  {
+    for (int i = 0; i < num_hwq; i++)
+      m_hwctxs.push_back(std::make_unique<hw_ctx>(dev));
+    for (int i = 0; i < num_cmds; i++) {
+      auto& hwctx = *m_hwctxs[i % num_hwq];
+      fence_chain_cmd c;
+
+      c.boset = std::make_unique<io_test_bo_set>(dev);
+      c.boset->init_cmd(hwctx, false);
+      c.boset->sync_before_run();
+      auto cbo = c.boset->get_bos()[IO_TEST_BO_CMD].tbo;
+      c.hwq = hwctx.get()->get_hw_queue();
+      c.hdl = cbo->get();
+      c.pkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+      m_cmds.push_back(std::move(c));
+      if (i)
+        m_links.push_back(dev->create_fence(fence_handle::access_mode::local));
+    }
+  }
+
+  // Run chain once, returns when chain was let go, i.e. when its first cmd
+  // could start.
+  clk::time_point
+  run(int mode)
+  {
+    clk::time_point start;
+
+    for (auto& c : m_cmds)
+      c.pkt->state = ERT_CMD_STATE_NEW;
+
+    if (mode == FENCE_CHAIN_HOST) {
+      start = clk::now();
+      for (auto& c : m_cmds) {
+        c.hwq->submit_command(c.hdl);
+        c.hwq->wait_command(c.hdl, 0);
+      }
+      check();
+      return start;
+    }
+
+    start = clk::now();
+    if (mode == FENCE_CHAIN_PENDING)
+      m_cmds[0].hwq->submit_wait(m_gate.get());
+    for (size_t i = 0; i < m_cmds.size(); i++) {
+      auto& c = m_cmds[i];
+      if (i)
+        c.hwq->submit_wait(m_links[i - 1].get());
+      c.hwq->submit_command(c.hdl);
+      if (i < m_links.size())
+        c.hwq->submit_signal(m_links[i].get());
+    }
+    if (mode == FENCE_CHAIN_PENDING) {
+      start = clk::now();
+      m_gate->signal();
+    }
+    // Cmds of a queue complete in order, last one of each queue is enough
+    for (size_t i = m_cmds.size() - std::min(m_cmds.size(), m_hwctxs.size()); i < m_cmds.size(); i++)
+      m_cmds[i].hwq->wait_command(m_cmds[i].hdl, 0);
+    check();
+    return start;
+  }
+
+  void
+  verify()
+  {
+    for (auto& c : m_cmds) {
+      c.boset->sync_after_run();
+      c.boset->verify_result();
+    }
+  }
+
+private:
+  void
+  check()
+  {
+    for (size_t i = 0; i < m_cmds.size(); i++) {
+      auto state = m_cmds[i].pkt->state;
+      if (state != ERT_CMD_STATE_COMPLETED)
+        throw std::runtime_error("Command " + std::to_string(i) + " of chain failed, state=" +
+          std::to_string(state));
+    }
+  }
+
+  std::vector<std::unique_ptr<hw_ctx>> m_hwctxs;
+  std::vector<fence_chain_cmd> m_cmds;
+  std::vector<std::unique_ptr<fence_handle>> m_links;
+  std::unique_ptr<fence_handle> m_gate;
+};
+
+void
+report_fence_chain(const char *what, int num_cmds, latency_recorder& rec)
+{
+  auto s = rec.summarize();
+  std::cout << "\t" << what << " chain of " << num_cmds << " commands, "
+            << s.p50_us / num_cmds << " us per hop (p50)" << std::endl;
+  print_latency_summary(s);
+  bench_report({
+    { "commands", num_cmds },
+    { "hop_p50_us", s.p50_us / num_cmds },
+    { "hop_mean_us", s.mean_us / num_cmds },
+  }, rec, s);
+}
+
 class test_2proc_cmd_fence_host : public test_2proc
 {
 public:
@@ -149,6 +285,162 @@ private:
   }
 };
 
+// Chain hopping between two processes, parent runs the even cmds and child
+// the odd ones. Chain starts and ends in parent, there it is timed, so that
+// number of cmds is made odd.
+class test_2proc_fence_chain : public test_2proc
+{
+public:
+  test_2proc_fence_chain(device::id_type id, int num_cmds, int iterations)
+    : test_2proc(id)
+    , m_num_cmds(std::max(num_cmds, 3) | 1)
+    , m_iterations(iterations)
+  {}
+
+private:
+  struct ipc_data {
+    pid_t pid;
+    shared_handle::export_handle to_child;
+    shared_handle::export_handle to_parent;
+  };
+
+  void
+  run_test_parent() override
+  {
+    msg("cross process fence chain test started...");
+
+    ipc_data idata = {};
+    if (!recv_ipc_data(&idata, sizeof(idata)))
+      return;
+
+    auto dev = get_userpf_device(get_dev_id());
+    auto to_child = dev->import_fence(idata.pid, idata.to_child);
+    auto to_parent = dev->import_fence(idata.pid, idata.to_parent);
+    int hops = m_num_cmds / 2 + 1;
+
+    hw_ctx hwctx{dev.get()};
+    auto hwq = hwctx.get()->get_hw_queue();
+    std::vector<std::unique_ptr<io_test_bo_set>> bosets;
+    for (int i = 0; i < hops; i++) {
+      bosets.push_back(std::make_unique<io_test_bo_set>(dev.get()));
+      bosets.back()->init_cmd(hwctx, false);
+      bosets.back()->sync_before_run();
+    }
+
+    latency_recorder rec(m_iterations, m_iterations / 10);
+    for (int it = 0; it < m_iterations; it++) {
+      auto start = clk::now();
+      for (int i = 0; i < hops; i++) {
+        auto cbo = bosets[i]->get_bos()[IO_TEST_BO_CMD].tbo;
+        reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())->state = ERT_CMD_STATE_NEW;
+        if (i)
+          hwq->submit_wait(to_parent.get());
+        hwq->submit_command(cbo->get());
+        if (i < hops - 1)
+          hwq->submit_signal(to_child.get());
+      }
+      hwq->wait_command(bosets.back()->get_bos()[IO_TEST_BO_CMD].tbo->get(), 0);
+      rec.record(start, clk::now());
+    }
+    for (auto& b : bosets) {
+      b->sync_after_run();
+      b->verify_result();
+    }
+    report_fence_chain("cross process", m_num_cmds, rec);
+
+    bool success = true;
+    send_ipc_data(&success, sizeof(success));
+  }
+
+  void
+  run_test_child() override
+  {
+    msg("cross process fence chain test started...");
+
+    auto dev = get_userpf_device(get_dev_id());
+    auto to_child = dev->create_fence(fence_handle::access_mode::process);
+    auto to_parent = dev->create_fence(fence_handle::access_mode::process);
+    int hops = m_num_cmds / 2;
+
+    hw_ctx hwctx{dev.get()};
+    auto hwq = hwctx.get()->get_hw_queue();
+    std::vector<std::unique_ptr<io_test_bo_set>> bosets;
+    for (int i = 0; i < hops; i++) {
+      bosets.push_back(std::make_unique<io_test_bo_set>(dev.get()));
+      bosets.back()->init_cmd(hwctx, false);
+      bosets.back()->sync_before_run();
+    }
+
+    auto cshare = to_child->share();
+    auto pshare = to_parent->share();
+    ipc_data idata = { getpid(), cshare->get_export_handle(), pshare->get_export_handle() };
+    send_ipc_data(&idata, sizeof(idata));
+
+    for (int it = 0; it < m_iterations; it++) {
+      for (int i = 0; i < hops; i++) {
+        auto cbo = bosets[i]->get_bos()[IO_TEST_BO_CMD].tbo;
+        reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())->state = ERT_CMD_STATE_NEW;
+        hwq->submit_wait(to_child.get());
+        hwq->submit_command(cbo->get());
+        hwq->submit_signal(to_parent.get());
+      }
+      hwq->wait_command(bosets.back()->get_bos()[IO_TEST_BO_CMD].tbo->get(), 0);
+    }
+
+    bool success;
+    recv_ipc_data(&success, sizeof(success));
+  }
+
+  const int m_num_cmds;
+  const int m_iterations;
+};
+
+}
+
+// Cmds queued behind a fence are issued to driver in batches once it is
+// signaled, more of them than hwctx has slots for. All of them have to
+// complete. num_cmds has to fit in pending queue, see
+// Runtime.hwq_pending_depth, since nothing drains it before the signal.
+void
+TEST_cmd_fence_queued_batch(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  int num_cmds = static_cast<int>(arg[0]);
+  int iterations = static_cast<int>(arg[1]);
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto gate = dev->create_fence(fence_handle::access_mode::local);
+  std::vector<std::unique_ptr<io_test_bo_set>> bosets;
+
+  for (int i = 0; i < num_cmds; i++) {
+    bosets.push_back(std::make_unique<io_test_bo_set>(dev));
+    bosets.back()->init_cmd(hwctx, false);
+    bosets.back()->sync_before_run();
+  }
+
+  for (int it = 0; it < iterations; it++) {
+    hwq->submit_wait(gate.get());
+    for (auto& b : bosets) {
+      auto cbo = b->get_bos()[IO_TEST_BO_CMD].tbo;
+      reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())->state = ERT_CMD_STATE_NEW;
+      hwq->submit_command(cbo->get());
+    }
+    gate->signal();
+    for (auto& b : bosets)
+      hwq->wait_command(b->get_bos()[IO_TEST_BO_CMD].tbo->get(), 0);
+
+    for (int i = 0; i < num_cmds; i++) {
+      auto cbo = bosets[i]->get_bos()[IO_TEST_BO_CMD].tbo;
+      auto state = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())->state;
+      if (state != ERT_CMD_STATE_COMPLETED)
+        throw std::runtime_error("Queued command " + std::to_string(i) + " of iteration " +
+          std::to_string(it) + " failed, state=" + std::to_string(state));
+    }
+  }
+  for (auto& b : bosets) {
+    b->sync_after_run();
+    b->verify_result();
+  }
 }
 
 void
@@ -170,3 +462,85 @@ TEST_cmd_fence_device(device::id_type id, std::shared_ptr<device>& sdev, arg_typ
   test_2proc_cmd_fence_device t2p(id);
   t2p.run_test();
 }
+
+void
+TEST_cmd_fence_timeout(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto wfence = dev->create_fence(fence_handle::access_mode::process);
+  auto sfence = wfence->clone();
+
+  // Nothing signals the fence yet, wait should time out.
+  bool timed_out = false;
+  try {
+    wfence->wait(100);
+  } catch (const std::system_error& e) {
+    timed_out = true;
+  }
+  if (!timed_out)
+    throw std::runtime_error("Waiting for unsignaled fence did not time out");
+
+  // Timed out wait does not count, this one waits for the first signal.
+  sfence->signal();
+  wfence->wait(100);
+}
+
+// Fence backed by a syncobj recycled through the pool, with a timeline not
+// starting from 0, is cloned and then shared. Importer has to see the same
+// timeline as both copies.
+void
+TEST_cmd_fence_recycled_share(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+
+  // Used once and gone, its syncobj goes back to the pool.
+  {
+    auto wfence = dev->create_fence(fence_handle::access_mode::local);
+    auto sfence = wfence->clone();
+    sfence->signal();
+    wfence->wait(100);
+  }
+
+  auto fence = dev->create_fence(fence_handle::access_mode::process);
+  auto cfence = fence->clone();
+  auto share = cfence->share();
+  // Same process, importer takes its own fd.
+  auto ifence = dev->import_fence(getpid(), dup(share->get_export_handle()));
+
+  ifence->signal();
+  fence->wait(100);
+  cfence->wait(100);
+}
+
+void
+TEST_cmd_fence_chain_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int mode = static_cast<int>(arg[0]);
+  int num_hwq = static_cast<int>(arg[1]);
+  int num_cmds = static_cast<int>(arg[2]);
+  int iterations = static_cast<int>(arg[3]);
+
+  fence_chain chain(sdev.get(), num_hwq, num_cmds);
+  latency_recorder rec(iterations, iterations / 10);
+  for (int i = 0; i < iterations; i++) {
+    auto start = chain.run(mode);
+    rec.record(start, clk::now());
+  }
+  chain.verify();
+
+  auto what = std::string(fence_chain_mode_name(mode)) + " linked, " + std::to_string(num_hwq) + " hwq";
+  report_fence_chain(what.c_str(), num_cmds, rec);
+}
+
+void
+TEST_cmd_fence_chain_2proc_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int num_cmds = static_cast<int>(arg[0]);
+  int iterations = static_cast<int>(arg[1]);
+
+  // Can't fork with opened device.
+  sdev.reset();
+
+  test_2proc_fence_chain t2p(id, num_cmds, iterations);
+  t2p.run_test();
+}
@@ -150,6 +150,28 @@ xclbin_info xclbin_infos[] = {
     .data = "",
     .type = KERNEL_TYPE_TXN_FULL_ELF_PREEMPT,
   },
+  {
+    .name = "nop.elf",
+    .device = npu3_device_id,
+    .revision_id = npu_any_revision_id,
+    .ip_name2idx = {
+      { "DPU:nop", {0xffffffff} },
+    },
+    .workspace = "npu3_workspace",
+    .data = "",
+    .type = KERNEL_TYPE_TXN_FULL_ELF_PREEMPT,
+  },
+  {
+    .name = "nop.elf",
+    .device = npu3_device_id1,
+    .revision_id = npu_any_revision_id,
+    .ip_name2idx = {
+      { "DPU:nop", {0xffffffff} },
+    },
+    .workspace = "npu3_workspace",
+    .data = "",
+    .type = KERNEL_TYPE_TXN_FULL_ELF_PREEMPT,
+  },
   {
     .name = "1x4.xclbin",
     .device = npu4_device_id,
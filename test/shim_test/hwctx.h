@@ -15,11 +15,15 @@ using namespace xrt_core;
 
 class hw_ctx {
 public:
-  hw_ctx(device* dev, const char *xclbin_name=nullptr)
+  hw_ctx(device* dev, const char *xclbin_name=nullptr, uint32_t priority=0x180)
   {
-    hw_ctx_init(dev, xclbin_name);
+    hw_ctx_init(dev, xclbin_name, priority);
   }
 
+  // Wrap context created by caller, e.g. to time create_hw_context() alone
+  hw_ctx(std::unique_ptr<hwctx_handle> handle) : m_handle(std::move(handle))
+  {}
+
   hwctx_handle *
   get()
   {
@@ -30,7 +34,7 @@ private:
   std::unique_ptr<hwctx_handle> m_handle;
 
   void
-  hw_ctx_init(device* dev, const char *xclbin_name)
+  hw_ctx_init(device* dev, const char *xclbin_name, uint32_t priority)
   {
     xrt::xclbin xclbin;
     xrt::elf elf;
@@ -48,7 +52,7 @@ private:
         "specify xclbin path or run \"build.sh -xclbin_only\" to download them");
     }
 
-    xrt::hw_context::qos_type qos{ {"gops", 100}, {"priority", 0x180} };
+    xrt::hw_context::qos_type qos{ {"gops", 100}, {"priority", priority} };
     xrt::hw_context::access_mode mode = xrt::hw_context::access_mode::shared;
     if (is_full_elf) {
       m_handle = dev->create_hw_context(elf_int::get_partition_size(elf), qos, mode);
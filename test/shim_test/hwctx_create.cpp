@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "io.h"
+#include "2proc.h"
+#include "hwctx.h"
+#include "speed.h"
+#include "dev_info.h"
+
+#include "core/common/device.h"
+#include <array>
+#include <thread>
+#include <vector>
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+namespace {
+
+// Phases of bringing a context up and down, as seen by its user. Phases
+// inside of create_hw_context(), driver create_ctx, PDI registration, CU config
+// and UMQ BO allocation, are hwctx_* and hwq_umq_alloc trace points of shim,
+// see Debug.trace_recorder.
+enum hwctx_phase {
+  HWCTX_PHASE_CREATE = 0,
+  HWCTX_PHASE_OPEN_CU,
+  HWCTX_PHASE_HWQ,
+  // Includes device side context setup, which driver defers to first cmd
+  HWCTX_PHASE_FIRST_CMD,
+  HWCTX_PHASE_DESTROY,
+  HWCTX_PHASE_MAX
+};
+
+const std::array<const char *, HWCTX_PHASE_MAX> hwctx_phase_names = {
+  "create", "open_cu", "hwq", "first_cmd", "destroy"
+};
+
+struct hwctx_create_result {
+  std::vector<latency_recorder> phases;
+  bool failed = false;
+
+  hwctx_create_result(int iterations)
+  {
+    for (int i = 0; i < HWCTX_PHASE_MAX; i++)
+      phases.emplace_back(iterations, std::min(iterations / 10, 10));
+  }
+};
+
+// Create, use once and destroy a context again and again, timing each phase.
+void
+hwctx_create_loop(device *dev, int iterations, hwctx_create_result& res)
+{
+  // Loaded once, so that xclbin file parsing is not timed
+  xrt::xclbin xclbin(get_xclbin_path(dev));
+  dev->record_xclbin(xclbin);
+  auto uuid = xclbin.get_uuid();
+  xrt::hw_context::qos_type qos{ {"gops", 100}, {"priority", 0x180} };
+
+  io_test_bo_set boset{dev};
+  auto cbo = boset.get_bos()[IO_TEST_BO_CMD].tbo;
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+
+  for (int i = 0; i < iterations; i++) {
+    std::array<clk::time_point, HWCTX_PHASE_MAX + 1> t;
+
+    t[HWCTX_PHASE_CREATE] = clk::now();
+    auto hwctx = std::make_unique<hw_ctx>(
+      dev->create_hw_context(uuid, qos, xrt::hw_context::access_mode::shared));
+    t[HWCTX_PHASE_OPEN_CU] = clk::now();
+    boset.init_cmd(*hwctx, false);
+    t[HWCTX_PHASE_HWQ] = clk::now();
+    auto hwq = hwctx->get()->get_hw_queue();
+    boset.sync_before_run();
+    cmdpkt->state = ERT_CMD_STATE_NEW;
+    t[HWCTX_PHASE_FIRST_CMD] = clk::now();
+    hwq->submit_command(cbo->get());
+    hwq->wait_command(cbo->get(), 0);
+    t[HWCTX_PHASE_DESTROY] = clk::now();
+    hwctx.reset();
+    t[HWCTX_PHASE_MAX] = clk::now();
+
+    if (cmdpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("First command failed, state=" + std::to_string(cmdpkt->state));
+    for (int p = 0; p < HWCTX_PHASE_MAX; p++)
+      res.phases[p].record(t[p], t[p + 1]);
+  }
+  boset.sync_after_run();
+  boset.verify_result();
+}
+
+void
+report_hwctx_create(const char *who, int num, const std::vector<latency_recorder>& phases)
+{
+  std::vector<latency_recorder::summary> s;
+
+  for (int p = 0; p < HWCTX_PHASE_MAX; p++) {
+    s.push_back(phases[p].summarize());
+    std::cout << hwctx_phase_names[p] << ":" << std::endl;
+    print_latency_summary(s[p]);
+  }
+  std::cout << num << " " << who << " finished " << s[HWCTX_PHASE_CREATE].count
+            << " context create/destroy, p50 create " << s[HWCTX_PHASE_CREATE].p50_us
+            << " us, first cmd " << s[HWCTX_PHASE_FIRST_CMD].p50_us
+            << " us, destroy " << s[HWCTX_PHASE_DESTROY].p50_us << " us" << std::endl;
+  bench_report({
+    { who, num },
+    { "contexts", s[HWCTX_PHASE_CREATE].count },
+    { "open_cu_p50_us", s[HWCTX_PHASE_OPEN_CU].p50_us },
+    { "hwq_p50_us", s[HWCTX_PHASE_HWQ].p50_us },
+    { "first_cmd_p50_us", s[HWCTX_PHASE_FIRST_CMD].p50_us },
+    { "first_cmd_p99_us", s[HWCTX_PHASE_FIRST_CMD].p99_us },
+    { "destroy_p50_us", s[HWCTX_PHASE_DESTROY].p50_us },
+    { "destroy_p99_us", s[HWCTX_PHASE_DESTROY].p99_us },
+  }, phases[HWCTX_PHASE_CREATE], s[HWCTX_PHASE_CREATE]);
+}
+
+// Each process runs the loop on its own device, so that contexts of all
+// processes are created at the same time.
+struct hwctx_create_proc_result {
+  int count;
+  double p50_us[HWCTX_PHASE_MAX];
+  double p99_us[HWCTX_PHASE_MAX];
+  double max_us[HWCTX_PHASE_MAX];
+};
+
+class test_nproc_hwctx_create : public test_nproc<hwctx_create_proc_result>
+{
+public:
+  test_nproc_hwctx_create(device::id_type id, int num_procs, int iterations)
+    : test_nproc(id, num_procs), m_num_procs(num_procs), m_iterations(iterations)
+  {}
+
+private:
+  void
+  setup_child(int idx) override
+  {
+    m_dev = get_userpf_device(get_dev_id());
+  }
+
+  hwctx_create_proc_result
+  run_test_child(int idx) override
+  {
+    hwctx_create_result res(m_iterations);
+    hwctx_create_proc_result r = {};
+
+    hwctx_create_loop(m_dev.get(), m_iterations, res);
+    m_dev.reset();
+
+    for (int p = 0; p < HWCTX_PHASE_MAX; p++) {
+      auto s = res.phases[p].summarize();
+      r.count = s.count;
+      r.p50_us[p] = s.p50_us;
+      r.p99_us[p] = s.p99_us;
+      r.max_us[p] = s.max_us;
+    }
+    return r;
+  }
+
+  void
+  run_test_parent(const std::vector<hwctx_create_proc_result>& results,
+    std::chrono::microseconds duration) override
+  {
+    hwctx_create_proc_result worst = {};
+
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+      std::cout << "\tProcess " << i << ", " << r.count << " contexts:";
+      for (int p = 0; p < HWCTX_PHASE_MAX; p++) {
+        std::cout << " " << hwctx_phase_names[p] << " p50 " << r.p50_us[p]
+                  << " us p99 " << r.p99_us[p] << " us";
+        worst.p50_us[p] = std::max(worst.p50_us[p], r.p50_us[p]);
+        worst.p99_us[p] = std::max(worst.p99_us[p], r.p99_us[p]);
+        worst.max_us[p] = std::max(worst.max_us[p], r.max_us[p]);
+      }
+      std::cout << std::endl;
+      worst.count += r.count;
+    }
+
+    std::cout << m_num_procs << " processes finished " << worst.count
+              << " context create/destroy in " << duration.count() << " us, worst p99 create "
+              << worst.p99_us[HWCTX_PHASE_CREATE] << " us, first cmd "
+              << worst.p99_us[HWCTX_PHASE_FIRST_CMD] << " us" << std::endl;
+    bench_report({
+      { "processes", m_num_procs },
+      { "contexts", worst.count },
+      { "duration_us", duration.count() },
+      { "worst_create_p50_us", worst.p50_us[HWCTX_PHASE_CREATE] },
+      { "worst_create_p99_us", worst.p99_us[HWCTX_PHASE_CREATE] },
+      { "worst_open_cu_p99_us", worst.p99_us[HWCTX_PHASE_OPEN_CU] },
+      { "worst_hwq_p99_us", worst.p99_us[HWCTX_PHASE_HWQ] },
+      { "worst_first_cmd_p50_us", worst.p50_us[HWCTX_PHASE_FIRST_CMD] },
+      { "worst_first_cmd_p99_us", worst.p99_us[HWCTX_PHASE_FIRST_CMD] },
+      { "worst_destroy_p99_us", worst.p99_us[HWCTX_PHASE_DESTROY] },
+      { "worst_destroy_max_us", worst.max_us[HWCTX_PHASE_DESTROY] },
+    });
+  }
+
+  int m_num_procs;
+  int m_iterations;
+  std::shared_ptr<device> m_dev;
+};
+
+}
+
+void
+TEST_hwctx_create_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  int num_threads = static_cast<int>(arg[0]);
+  int iterations = static_cast<int>(arg[1]);
+  std::vector<std::unique_ptr<hwctx_create_result>> results;
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < num_threads; t++)
+    results.push_back(std::make_unique<hwctx_create_result>(iterations));
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      try {
+        hwctx_create_loop(dev, iterations, *results[t]);
+      } catch (const std::exception& ex) {
+        results[t]->failed = true;
+        std::cout << "Thread " << t << " failed: " << ex.what() << std::endl;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  std::vector<latency_recorder> phases;
+  for (int p = 0; p < HWCTX_PHASE_MAX; p++)
+    phases.emplace_back(num_threads * iterations);
+  for (auto& r : results) {
+    if (r->failed)
+      throw std::runtime_error("At least one thread has failed");
+    for (int p = 0; p < HWCTX_PHASE_MAX; p++)
+      phases[p].merge(r->phases[p]);
+  }
+  report_hwctx_create("threads", num_threads, phases);
+}
+
+void
+TEST_hwctx_create_multi_proc_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int num_procs = static_cast<int>(arg[0]);
+  int iterations = static_cast<int>(arg[1]);
+
+  // Can't fork with opened device.
+  sdev.reset();
+
+  test_nproc_hwctx_create t(id, num_procs, iterations);
+  t.run_test();
+}
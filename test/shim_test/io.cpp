@@ -7,12 +7,19 @@
 #include "xrt/detail/xrt_error_code.h"
 
 #include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <string>
 #include <sstream>
 #include <regex>
+#include <unistd.h>
 
 using namespace xrt_core;
 
+// Keep ELF assembled from TXN files here across runs, see -e option
+extern std::string elf_cache_dir;
+
 namespace {
 
 std::array io_test_bo_type_names {
@@ -112,8 +119,43 @@ read_binary_file(const std::string& filename)
   return { size, bin_buf };
 }
 
+uint64_t
+fnv1a_hash(const std::vector<char>& buf, uint64_t h = 0xcbf29ce484222325ull)
+{
+  for (auto c : buf) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Cached ELF is only good for the same TXN, control packet and preemption
+// libs, assembled for the same device and firmware.
+std::string
+elf_cache_path(device* dev, const std::vector<char>& txn_buf, const std::vector<char>& pm_ctrlpkt_buf)
+{
+  auto libs = get_preemption_libs_path();
+  auto h = fnv1a_hash(pm_ctrlpkt_buf, fnv1a_hash(txn_buf));
+  h = fnv1a_hash(std::vector<char>(libs.begin(), libs.end()), h);
+
+  std::string fw = "unknown";
+  try {
+    auto v = device_query<query::firmware_version>(dev,
+      query::firmware_version::firmware_type::npu_firmware);
+    fw = std::to_string(v.major) + "." + std::to_string(v.minor) + "." +
+      std::to_string(v.patch) + "." + std::to_string(v.build);
+  }
+  catch (const std::exception&) {
+  }
+
+  std::stringstream ss;
+  ss << elf_cache_dir << "/" << std::hex << device_query<query::pcie_device>(dev)
+     << "-" << fw << "-" << std::setw(16) << std::setfill('0') << h << ".elf";
+  return ss.str();
+}
+
 const xrt::elf
-txn_file2elf(const std::string& ml_txn, const std::string& pm_ctrlpkt)
+txn_file2elf(device* dev, const std::string& ml_txn, const std::string& pm_ctrlpkt)
 {
   auto [ instr_size, txn_buf ] = read_binary_file(ml_txn);
   auto [ pm_ctrlpkt_size, pm_ctrlpkt_buf ] = read_binary_file(pm_ctrlpkt);
@@ -121,6 +163,13 @@ txn_file2elf(const std::string& ml_txn, const std::string& pm_ctrlpkt)
   if (!instr_size)
     throw std::runtime_error("Can't open TXN bin file: " + ml_txn);
 
+  std::string cache_path;
+  if (!elf_cache_dir.empty()) {
+    cache_path = elf_cache_path(dev, txn_buf, pm_ctrlpkt_buf);
+    if (std::filesystem::exists(cache_path))
+      return xrt::elf{cache_path};
+  }
+
   std::unique_ptr<aiebu::aiebu_assembler> asp = nullptr;
   if (pm_ctrlpkt_buf.size()) {
     std::vector<char> buffer2 = {};
@@ -138,6 +187,15 @@ txn_file2elf(const std::string& ml_txn, const std::string& pm_ctrlpkt)
       aiebu::aiebu_assembler::buffer_type::blob_instr_transaction, txn_buf);
   }
   auto elf_buf = asp->get_elf();
+  if (!cache_path.empty()) {
+    // Written aside and renamed, so that concurrent runs never see half of it
+    auto tmp = cache_path + "." + std::to_string(getpid());
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(elf_buf.data(), elf_buf.size());
+    out.close();
+    if (!out || std::rename(tmp.c_str(), cache_path.c_str()))
+      std::filesystem::remove(tmp);
+  }
   std::istringstream elf_stream;
   elf_stream.rdbuf()->pubsetbuf(elf_buf.data(), elf_buf.size());
   //dump_buf_to_file((int8_t*)elf_buf.data(), elf_buf.size(), "/tmp/elf");
@@ -352,7 +410,7 @@ elf_io_test_bo_set(device* dev, const std::string& xclbin_name) :
   if (std::filesystem::exists(elf_path))
     m_elf = xrt::elf(elf_path);
   else
-    m_elf = txn_file2elf(m_local_data_path + "/ml_txn.bin", m_local_data_path + "/pm_ctrlpkt.bin");
+    m_elf = txn_file2elf(dev, m_local_data_path + "/ml_txn.bin", m_local_data_path + "/pm_ctrlpkt.bin");
 
   for (int i = 0; i < IO_TEST_BO_MAX_TYPES; i++) {
     auto& ibo = m_bo_array[i];
@@ -397,7 +455,7 @@ elf_preempt_io_test_bo_set(device* dev, const std::string& xclbin_name)
     auto mod = xrt::module{m_elf};
     m_kernel_index = module_int::get_ctrlcode_id(mod, get_kernel_name(dev, xclbin_name.c_str()));
   } else {
-    m_elf = txn_file2elf(m_local_data_path + "/ml_txn.bin", m_local_data_path + "/pm_ctrlpkt.bin");
+    m_elf = txn_file2elf(dev, m_local_data_path + "/ml_txn.bin", m_local_data_path + "/pm_ctrlpkt.bin");
     m_kernel_index = module_int::no_ctrl_code_id;
   }
 
@@ -817,6 +875,25 @@ verify_result()
   }
 }
 
+uint64_t
+elf_io_gemm_test_bo_set::
+get_ops_per_run() const
+{
+  std::ifstream config(m_local_data_path + "/gemm_shape.ini");
+  if (!config)
+    return 0;
+
+  std::map<std::string, uint64_t> conf;
+  std::string line;
+  while (std::getline(config, line)) {
+    std::istringstream iss(line);
+    std::string key, value;
+    if (std::getline(iss, key, '=') && std::getline(iss, value))
+      conf[key] = std::stoull(value);
+  }
+  return 2 * conf["M"] * conf["N"] * conf["K"];
+}
+
 const char *
 io_test_bo_set_base::
 bo_type2name(int type)
@@ -186,6 +186,11 @@ public:
   void
   verify_result() override;
 
+  // Ops of one run, 2 * M * N * K from gemm_shape.ini of workspace, 0 if
+  // it has none.
+  uint64_t
+  get_ops_per_run() const;
+
 private:
   std::unique_ptr<xrt_core::buffer_handle> m_dbo;
 };
@@ -21,4 +21,36 @@ struct io_test_parameter {
   bool debug;
 };
 
+// How cmds of fence chain benchmark are linked, see TEST_cmd_fence_chain_latency()
+//
+// Host waits for each cmd before submitting the next, no fence at all
+#define FENCE_CHAIN_HOST      0
+// Linked by submit_wait/submit_signal, waits are handed to driver
+#define FENCE_CHAIN_DRIVER    1
+// Linked the same way, but held by a host fence until fully submitted, so
+// that waits are done by pending queue threads of shim
+#define FENCE_CHAIN_PENDING   2
+
+// Workloads of submit path benchmark, run the same way on KMQ and UMQ, see
+// TEST_io_submit_path()
+//
+// One no-op cmd in flight
+#define IO_SUBMIT_PATH_LATENCY    0
+// 8 no-op cmds in flight
+#define IO_SUBMIT_PATH_THRUPUT    1
+// One chained cmd of 8 no-op cmds in flight
+#define IO_SUBMIT_PATH_RUNLIST    2
+// One no-op cmd in flight from each of 4 threads, all on one HW queue
+#define IO_SUBMIT_PATH_THREADS    3
+
+// Preemption modes of preemption benchmark, see TEST_io_preemption_latency()
+//
+// Neither fine grain nor frame boundary preemption, high priority cmd waits
+// for low priority one to finish
+#define IO_PREEMPT_NONE           0
+// Frame boundary preemption only
+#define IO_PREEMPT_FRAME          1
+// Fine grain preemption only, needs disable_fine_preemption=0 of driver
+#define IO_PREEMPT_FINE           2
+
 #endif // _SHIMTEST_IO_PARAM_H_
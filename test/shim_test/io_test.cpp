@@ -2,6 +2,7 @@
 // Copyright (C) 2024-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "io.h"
+#include "2proc.h"
 #include "hwctx.h"
 #include "multi_threads.h"
 #include "speed.h"
@@ -9,15 +10,35 @@
 #include "io_param.h"
 
 #include "core/common/device.h"
+#include "core/common/system.h"
+#include "core/common/query_requests.h"
+#include "core/common/xclbin_parser.h"
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <string>
 #include <regex>
 
+#include "../../src/include/uapi/drm_local/amdxdna_accel.h"
+
 using namespace xrt_core;
 using arg_type = const std::vector<uint64_t>;
 
+bool dev_filter_is_aie4(device::id_type id, device* dev);
+
 namespace {
 
+// Max number of runs of an io test in benchmark mode before giving up on
+// getting a stable median latency.
+const unsigned io_test_max_rounds = 5;
+
+// Iterations at beginning of each run excluded from latency percentiles
+int
+io_test_warmup(int total)
+{
+  return std::min(total / 10, 100);
+}
+
 io_test_parameter io_test_parameters;
 
 void
@@ -113,7 +134,8 @@ void
 io_test_cmd_submit_and_wait_latency(
   hwqueue_handle *hwq,
   int total_cmd_submission,
-  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos
+  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos,
+  latency_recorder *rec = nullptr
   )
 {
   int completed = 0;
@@ -121,8 +143,12 @@ io_test_cmd_submit_and_wait_latency(
 
   while (completed < total_cmd_submission) {
     for (auto& cmd : cmdlist_bos) {
+      std::get<1>(cmd)->state = ERT_CMD_STATE_NEW;
+      auto start = clk::now();
       hwq->submit_command(std::get<0>(cmd).get()->get());
       io_test_cmd_wait(hwq, std::get<0>(cmd));
+      if (rec)
+        rec->record(start, clk::now());
       auto state = std::get<1>(cmd)->state;
       if (state != ERT_CMD_STATE_COMPLETED) {
         std::string errmsg = "Command ";
@@ -135,7 +161,6 @@ io_test_cmd_submit_and_wait_latency(
       completed++;
       if (completed >= total_cmd_submission)
         break;
-      std::get<1>(cmd)->state = ERT_CMD_STATE_NEW;
     }
   }
 }
@@ -144,13 +169,17 @@ void
 io_test_cmd_submit_and_wait_thruput(
   hwqueue_handle *hwq,
   int total_cmd_submission,
-  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos
+  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos,
+  latency_recorder *rec = nullptr
   )
 {
   int issued = 0;
   int completed = 0;
   int wait_idx = 0;
 
+  // With all commands in flight, latency of each iteration is the interval
+  // between two consecutive completions.
+  auto last = clk::now();
   for (auto& cmd : cmdlist_bos) {
     std::get<1>(cmd)->state = ERT_CMD_STATE_NEW;
     hwq->submit_command(std::get<0>(cmd).get()->get());
@@ -165,6 +194,11 @@ io_test_cmd_submit_and_wait_thruput(
     if (state != ERT_CMD_STATE_COMPLETED)
       throw std::runtime_error(std::string("Command failed, state=") + std::to_string(state));
     completed++;
+    if (rec) {
+      auto now = clk::now();
+      rec->record(last, now);
+      last = now;
+    }
 
     if (issued < total_cmd_submission) {
       std::get<1>(cmdlist_bos[wait_idx])->state = ERT_CMD_STATE_NEW;
@@ -290,13 +324,21 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
     pre_cntrs = get_fine_preemption_counters(dev);
   }
 
-  // Submit commands and wait for results
-  auto start = clk::now();
-  if (io_test_parameters.perf == IO_TEST_THRUPUT_PERF)
-    io_test_cmd_submit_and_wait_thruput(hwq, total_hwq_submit, cmdlist_bos);
-  else
-    io_test_cmd_submit_and_wait_latency(hwq, total_hwq_submit, cmdlist_bos);
-  auto end = clk::now();
+  // Submit commands and wait for results. In benchmark mode, repeat the run
+  // until the median latency is stable. Preemption counters are checked
+  // against a single run, so it is never repeated.
+  latency_recorder rec(total_hwq_submit, io_test_warmup(total_hwq_submit));
+  unsigned rounds = (is_bench_mode() && !preemption_enabled) ? io_test_max_rounds : 1;
+  clk::time_point start;
+  clk::time_point end;
+  auto summary = run_until_stable(rec, [&] () {
+    start = clk::now();
+    if (io_test_parameters.perf == IO_TEST_THRUPUT_PERF)
+      io_test_cmd_submit_and_wait_thruput(hwq, total_hwq_submit, cmdlist_bos, &rec);
+    else
+      io_test_cmd_submit_and_wait_latency(hwq, total_hwq_submit, cmdlist_bos, &rec);
+    end = clk::now();
+  }, rounds);
 
   // Verify preemption counters
   if (preemption_enabled) {
@@ -330,7 +372,659 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
               << duration_us << " us, " << cmds_per_list << " commands per list, "
               << cps << " Command/sec,"
               << " Average latency " << latency_us << " us" << std::endl;
+    print_latency_summary(summary);
+    bench_report({
+      { "commands", total_hwq_submit * cmds_per_list },
+      { "cmds_per_list", cmds_per_list },
+      { "duration_us", duration_us },
+      { "cmds_per_sec", cps },
+      { "latency_us", latency_us },
+    }, rec, summary);
+  }
+}
+
+void
+io_test_multi_thread_scaling(device* dev, int total_cmds, int max_threads, const char *xclbin)
+{
+  // One BO set per thread, all submitted through one shared HW queue.
+  std::vector< std::unique_ptr<io_test_bo_set_base> > bo_set;
+  for (int i = 0; i < max_threads; i++)
+    bo_set.push_back(std::move(alloc_and_init_bo_set(dev, xclbin)));
+
+  hw_ctx hwctx{dev, xclbin};
+  auto hwq = hwctx.get()->get_hw_queue();
+
+  for (auto& boset : bo_set) {
+    boset->init_cmd(hwctx, io_test_parameters.debug);
+    boset->sync_before_run();
+  }
+
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    int cmds_per_thread = total_cmds / num_threads;
+    std::vector<std::thread> threads;
+    std::vector<int> failed(num_threads, 0);
+
+    auto start = clk::now();
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t]() {
+        auto cbo = bo_set[t]->get_bos()[IO_TEST_BO_CMD].tbo;
+        auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+        std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> > cmdlist_bos{ {cbo, cmdpkt} };
+
+        cmdpkt->state = ERT_CMD_STATE_NEW;
+        try {
+          io_test_cmd_submit_and_wait_latency(hwq, cmds_per_thread, cmdlist_bos);
+        } catch (const std::exception& ex) {
+          failed[t] = 1;
+          std::cout << "Thread " << t << " failed: " << ex.what() << std::endl;
+        }
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+    auto end = clk::now();
+
+    for (int t = 0; t < num_threads; t++) {
+      if (failed[t])
+        throw std::runtime_error("At least one thread has failed");
+    }
+
+    auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
+    auto cps = (cmds_per_thread * num_threads * 1000000.0) / duration_us;
+    std::cout << num_threads << " threads finished " << cmds_per_thread * num_threads
+              << " commands in " << duration_us << " us, "
+              << cps << " Command/sec" << std::endl;
+    bench_report({
+      { "threads", num_threads },
+      { "commands", cmds_per_thread * num_threads },
+      { "duration_us", duration_us },
+      { "cmds_per_sec", cps },
+    });
+  }
+
+  for (auto& boset : bo_set) {
+    auto cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    cmdpkt->state = ERT_CMD_STATE_COMPLETED;
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+}
+
+struct io_test_proc_result {
+  int commands;
+  double p50_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+};
+
+// Each process opens its own device and HW context and submits commands one
+// at a time, so that all contexts compete for the device at the same time.
+class test_nproc_io_contention : public test_nproc<io_test_proc_result>
+{
+public:
+  test_nproc_io_contention(device::id_type id, int num_procs, int cmds_per_proc, const char *xclbin)
+    : test_nproc(id, num_procs), m_num_procs(num_procs), m_cmds_per_proc(cmds_per_proc), m_xclbin(xclbin)
+  {}
+
+private:
+  void
+  setup_child(int idx) override
+  {
+    m_dev = get_userpf_device(get_dev_id());
+    m_bo_set = alloc_and_init_bo_set(m_dev.get(), m_xclbin);
+    m_hwctx = std::make_unique<hw_ctx>(m_dev.get(), m_xclbin);
+    m_bo_set->init_cmd(*m_hwctx, io_test_parameters.debug);
+    m_bo_set->sync_before_run();
+  }
+
+  io_test_proc_result
+  run_test_child(int idx) override
+  {
+    auto cbo = m_bo_set->get_bos()[IO_TEST_BO_CMD].tbo;
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> > cmdlist_bos{ {cbo, cmdpkt} };
+    latency_recorder rec(m_cmds_per_proc, io_test_warmup(m_cmds_per_proc));
+
+    io_test_cmd_submit_and_wait_latency(m_hwctx->get()->get_hw_queue(), m_cmds_per_proc, cmdlist_bos, &rec);
+    m_bo_set->sync_after_run();
+    m_bo_set->verify_result();
+
+    auto s = rec.summarize();
+    m_hwctx.reset();
+    m_bo_set.reset();
+    m_dev.reset();
+    return { m_cmds_per_proc, s.p50_us, s.p99_us, s.p999_us, s.max_us };
+  }
+
+  void
+  run_test_parent(const std::vector<io_test_proc_result>& results, std::chrono::microseconds duration) override
+  {
+    int commands = 0;
+    io_test_proc_result worst = {};
+
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+      std::cout << "\tProcess " << i << ": p50 " << r.p50_us << " us, p99 " << r.p99_us
+                << " us, p99.9 " << r.p999_us << " us, max " << r.max_us << " us" << std::endl;
+      commands += r.commands;
+      worst.p50_us = std::max(worst.p50_us, r.p50_us);
+      worst.p99_us = std::max(worst.p99_us, r.p99_us);
+      worst.p999_us = std::max(worst.p999_us, r.p999_us);
+      worst.max_us = std::max(worst.max_us, r.max_us);
+    }
+
+    auto duration_us = duration.count();
+    auto cps = (commands * 1000000.0) / duration_us;
+    std::cout << m_num_procs << " processes finished " << commands
+              << " commands in " << duration_us << " us, "
+              << cps << " Command/sec, worst p99 latency " << worst.p99_us << " us" << std::endl;
+    bench_report({
+      { "processes", m_num_procs },
+      { "commands", commands },
+      { "duration_us", duration_us },
+      { "cmds_per_sec", cps },
+      { "worst_p50_us", worst.p50_us },
+      { "worst_p99_us", worst.p99_us },
+      { "worst_p999_us", worst.p999_us },
+      { "worst_max_us", worst.max_us },
+    });
+  }
+
+  int m_num_procs;
+  int m_cmds_per_proc;
+  const char *m_xclbin;
+  std::shared_ptr<device> m_dev;
+  std::unique_ptr<io_test_bo_set_base> m_bo_set;
+  std::unique_ptr<hw_ctx> m_hwctx;
+};
+
+void
+io_test_multi_proc_contention(device::id_type id, int total_cmds, int max_procs, const char *xclbin)
+{
+  for (int num_procs = 1; num_procs <= max_procs; num_procs *= 2) {
+    test_nproc_io_contention t(id, num_procs, total_cmds / num_procs, xclbin);
+    t.run_test();
+  }
+}
+
+using io_cmd_list = std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >;
+
+struct io_submit_path_result {
+  // Time spent in submit_command(), host side cost of the path
+  latency_recorder submit;
+  // From submit_command() returning till wait returns, device run time plus
+  // completion notification of the path
+  latency_recorder complete;
+  bool failed = false;
+
+  io_submit_path_result(int total)
+    : submit(total, io_test_warmup(total)), complete(total, io_test_warmup(total))
+  {}
+};
+
+// Submit all cmds of the list, then wait for each in order, until total cmds
+// are done.
+void
+io_submit_path_loop(hwqueue_handle *hwq, int total, io_cmd_list& cmds, io_submit_path_result& res)
+{
+  std::vector<clk::time_point> submitted(cmds.size());
+
+  for (int done = 0; done < total; done += cmds.size()) {
+    for (size_t i = 0; i < cmds.size(); i++) {
+      std::get<1>(cmds[i])->state = ERT_CMD_STATE_NEW;
+      auto start = clk::now();
+      hwq->submit_command(std::get<0>(cmds[i])->get());
+      submitted[i] = clk::now();
+      res.submit.record(start, submitted[i]);
+    }
+    for (size_t i = 0; i < cmds.size(); i++) {
+      io_test_cmd_wait(hwq, std::get<0>(cmds[i]));
+      res.complete.record(submitted[i], clk::now());
+      auto state = std::get<1>(cmds[i])->state;
+      if (state != ERT_CMD_STATE_COMPLETED)
+        throw std::runtime_error(std::string("Command failed, state=") + std::to_string(state));
+    }
+  }
+}
+
+// Same workload on whichever queue path device has, KMQ on aie2 and UMQ on
+// aie4, reported with queue name, so that the two can be put side by side.
+// Where the time goes inside of each path is in shim trace points, e.g.
+// hwq_submit and ioctl, see Debug.trace_recorder.
+void
+io_submit_path(device* dev, int workload, int total, const char *xclbin)
+{
+  int num_threads = workload == IO_SUBMIT_PATH_THREADS ? 4 : 1;
+  int inflight = workload == IO_SUBMIT_PATH_THRUPUT ? 8 : 1;
+  int cmds_per_list = workload == IO_SUBMIT_PATH_RUNLIST ? 8 : 1;
+  int per_thread = total / num_threads;
+
+  std::vector< std::unique_ptr<io_test_bo_set_base> > bo_set;
+  for (int i = 0; i < num_threads * inflight * cmds_per_list; i++)
+    bo_set.push_back(alloc_and_init_bo_set(dev, xclbin));
+
+  hw_ctx hwctx{dev, xclbin};
+  auto hwq = hwctx.get()->get_hw_queue();
+
+  for (auto& boset : bo_set) {
+    boset->init_cmd(hwctx, io_test_parameters.debug);
+    boset->sync_before_run();
+  }
+
+  // Cmds of each thread, chained ones for runlist
+  std::vector<io_cmd_list> cmds(num_threads);
+  std::vector<bo*> chain;
+  for (size_t i = 0; i < bo_set.size(); i++) {
+    auto& list = cmds[i / (inflight * cmds_per_list)];
+    auto cbo = bo_set[i]->get_bos()[IO_TEST_BO_CMD].tbo;
+    if (cmds_per_list == 1) {
+      list.push_back( {cbo, reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())} );
+      continue;
+    }
+    chain.push_back(cbo.get());
+    if (static_cast<int>(chain.size()) == cmds_per_list) {
+      auto chain_bo = std::make_shared<bo>(dev, 0x1000ul, XCL_BO_FLAGS_EXECBUF);
+      io_test_init_runlist_cmd(chain_bo.get(), chain);
+      list.push_back( {chain_bo, reinterpret_cast<ert_start_kernel_cmd *>(chain_bo->map())} );
+      chain.clear();
+    }
+  }
+
+  std::vector< std::unique_ptr<io_submit_path_result> > results;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++)
+    results.push_back(std::make_unique<io_submit_path_result>(per_thread));
+  auto start = clk::now();
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      try {
+        io_submit_path_loop(hwq, per_thread, cmds[t], *results[t]);
+      } catch (const std::exception& ex) {
+        results[t]->failed = true;
+        std::cout << "Thread " << t << " failed: " << ex.what() << std::endl;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  auto end = clk::now();
+
+  latency_recorder submit(total);
+  latency_recorder complete(total);
+  for (auto& r : results) {
+    if (r->failed)
+      throw std::runtime_error("At least one thread has failed");
+    submit.merge(r->submit);
+    complete.merge(r->complete);
+  }
+
+  for (auto& boset : bo_set) {
+    // Original cmd BO of a chained cmd is not updated, see io_test()
+    auto cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())->state = ERT_CMD_STATE_COMPLETED;
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+
+  auto ss = submit.summarize();
+  auto cs = complete.summarize();
+  auto num_cmds = per_thread * num_threads * cmds_per_list;
+  auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
+  auto cps = (num_cmds * 1000000.0) / duration_us;
+  std::cout << num_cmds << " commands finished in " << duration_us << " us, "
+            << num_threads << " threads, " << inflight << " in flight, "
+            << cmds_per_list << " commands per list, " << cps << " Command/sec" << std::endl;
+  std::cout << "Submit:" << std::endl;
+  print_latency_summary(ss);
+  std::cout << "Completion:" << std::endl;
+  print_latency_summary(cs);
+  bench_report({
+    { "threads", num_threads },
+    { "inflight", inflight },
+    { "cmds_per_list", cmds_per_list },
+    { "commands", num_cmds },
+    { "duration_us", duration_us },
+    { "cmds_per_sec", cps },
+    { "submit_p50_us", ss.p50_us },
+    { "submit_p99_us", ss.p99_us },
+    { "submit_mean_us", ss.mean_us },
+  }, complete, cs);
+}
+
+// Fine grain preemption can only be turned off when driver is loaded, 1 if it
+// is on, 0 if off, -1 if that can't be read.
+int
+get_fine_preemption_state()
+{
+  std::ifstream f("/sys/module/amdxdna/parameters/disable_fine_preemption");
+  std::string disabled;
+
+  if (!(f >> disabled))
+    return -1;
+  return disabled == "N" ? 1 : 0;
+}
+
+// Keep low priority tenant busy, all its cmds in flight, until stopped.
+// Returns number of cmds completed.
+int
+io_preempt_low_loop(hwqueue_handle *hwq, io_cmd_list& cmds, const std::atomic<bool>& stop)
+{
+  int completed = 0;
+  size_t i = 0;
+
+  for (auto& cmd : cmds) {
+    std::get<1>(cmd)->state = ERT_CMD_STATE_NEW;
+    hwq->submit_command(std::get<0>(cmd)->get());
+  }
+  for (;; i = (i + 1) % cmds.size()) {
+    io_test_cmd_wait(hwq, std::get<0>(cmds[i]));
+    auto state = std::get<1>(cmds[i])->state;
+    if (state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("Low priority command failed, state=") + std::to_string(state));
+    completed++;
+    if (stop)
+      break;
+    std::get<1>(cmds[i])->state = ERT_CMD_STATE_NEW;
+    hwq->submit_command(std::get<0>(cmds[i])->get());
+  }
+  // Drain the rest, not counted
+  for (size_t n = 1; n < cmds.size(); n++)
+    io_test_cmd_wait(hwq, std::get<0>(cmds[(i + n) % cmds.size()]));
+  return completed;
+}
+
+// Submit high priority no-op cmd one at a time, spaced out, so that each finds
+// low priority tenant running.
+void
+io_preempt_high_loop(hwqueue_handle *hwq, io_cmd_list& cmds, int iterations, latency_recorder& rec)
+{
+  auto& cmd = cmds[0];
+
+  for (int i = 0; i < iterations; i++) {
+    std::get<1>(cmd)->state = ERT_CMD_STATE_NEW;
+    auto start = clk::now();
+    hwq->submit_command(std::get<0>(cmd)->get());
+    io_test_cmd_wait(hwq, std::get<0>(cmd));
+    rec.record(start, clk::now());
+    auto state = std::get<1>(cmd)->state;
+    if (state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("High priority command failed, state=") + std::to_string(state));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+io_cmd_list
+io_preempt_cmds(std::vector< std::unique_ptr<io_test_bo_set_base> >& bo_set, hw_ctx& hwctx)
+{
+  io_cmd_list cmds;
+
+  for (auto& boset : bo_set) {
+    boset->init_cmd(hwctx, io_test_parameters.debug);
+    boset->sync_before_run();
+    auto cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    cmds.push_back( {cbo, reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())} );
   }
+  return cmds;
+}
+
+// Time from submitting a high priority no-op cmd till it completes, while a
+// long running low priority kernel keeps the device busy, against the same on
+// an idle device. Difference of the two is time to preempt. Also reports how
+// much throughput low priority tenant loses to the preemptions.
+void
+io_preemption_latency(device* dev, int mode, int iterations, const char *low_xclbin,
+  const char *high_xclbin)
+{
+  static const char *mode_names[] = { "no", "frame boundary", "fine grain" };
+  auto fine = get_fine_preemption_state();
+
+  if (fine < 0) {
+    std::cout << "Can't read fine grain preemption state of driver, skipped" << std::endl;
+    return;
+  }
+  if (fine != (mode == IO_PREEMPT_FINE)) {
+    std::cout << "Fine grain preemption is " << (fine ? "on" : "off")
+              << ", reload driver with disable_fine_preemption=" << (fine ? 1 : 0)
+              << " to run this mode, skipped" << std::endl;
+    return;
+  }
+
+  auto frame_orig = device_query<query::frame_boundary_preemption>(dev);
+  try {
+    device_update<query::frame_boundary_preemption>(dev,
+      static_cast<uint32_t>(mode == IO_PREEMPT_FRAME));
+  }
+  catch (const std::exception& ex) {
+    std::cout << "Can't set frame boundary preemption: " << ex.what() << ", skipped" << std::endl;
+    return;
+  }
+
+  std::vector< std::unique_ptr<io_test_bo_set_base> > low_bo_set;
+  for (int i = 0; i < 2; i++)
+    low_bo_set.push_back(alloc_and_init_bo_set(dev, low_xclbin));
+  std::vector< std::unique_ptr<io_test_bo_set_base> > high_bo_set;
+  high_bo_set.push_back(alloc_and_init_bo_set(dev, high_xclbin));
+
+  hw_ctx low_ctx{dev, low_xclbin, AMDXDNA_QOS_LOW_PRIORITY};
+  hw_ctx high_ctx{dev, high_xclbin, AMDXDNA_QOS_REALTIME_PRIORITY};
+  auto low_hwq = low_ctx.get()->get_hw_queue();
+  auto high_hwq = high_ctx.get()->get_hw_queue();
+  auto low_cmds = io_preempt_cmds(low_bo_set, low_ctx);
+  auto high_cmds = io_preempt_cmds(high_bo_set, high_ctx);
+
+  latency_recorder idle(iterations, io_test_warmup(iterations));
+  latency_recorder busy(iterations, io_test_warmup(iterations));
+  io_preempt_high_loop(high_hwq, high_cmds, iterations, idle);
+
+  // Run low priority tenant with and without high priority one for the same
+  // amount of time
+  std::atomic<bool> stop = false;
+  int low_busy = 0;
+  std::string low_err;
+  auto low_run = [&] () {
+    try {
+      return io_preempt_low_loop(low_hwq, low_cmds, stop);
+    } catch (const std::exception& ex) {
+      low_err = ex.what();
+    }
+    return 0;
+  };
+
+  auto start = clk::now();
+  std::thread low_thread([&] () { low_busy = low_run(); });
+  // Let low priority cmds get going first
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  try {
+    io_preempt_high_loop(high_hwq, high_cmds, iterations, busy);
+  } catch (...) {
+    stop = true;
+    low_thread.join();
+    throw;
+  }
+  stop = true;
+  low_thread.join();
+  auto duration = clk::now() - start;
+  if (!low_err.empty())
+    throw std::runtime_error(low_err);
+
+  stop = false;
+  int low_alone = 0;
+  low_thread = std::thread([&] () { low_alone = low_run(); });
+  std::this_thread::sleep_for(duration);
+  stop = true;
+  low_thread.join();
+  if (!low_err.empty())
+    throw std::runtime_error(low_err);
+
+  device_update<query::frame_boundary_preemption>(dev, static_cast<uint32_t>(frame_orig));
+
+  for (auto& boset : low_bo_set) {
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+  for (auto& boset : high_bo_set) {
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+
+  auto is = idle.summarize();
+  auto bs = busy.summarize();
+  auto duration_us = std::chrono::duration_cast<us_t>(duration).count();
+  auto low_cps_alone = (low_alone * 1000000.0) / duration_us;
+  auto low_cps = (low_busy * 1000000.0) / duration_us;
+  auto loss = low_alone ? 100.0 * (low_alone - low_busy) / low_alone : 0;
+  std::cout << "With " << mode_names[mode] << " preemption, high priority cmd p50 "
+            << bs.p50_us << " us busy vs " << is.p50_us << " us idle, time to preempt "
+            << bs.p50_us - is.p50_us << " us" << std::endl;
+  print_latency_summary(bs);
+  std::cout << "Low priority tenant " << low_cps << " Command/sec vs " << low_cps_alone
+            << " Command/sec alone, " << loss << "% lost" << std::endl;
+  bench_report({
+    { "mode", mode },
+    { "duration_us", duration_us },
+    { "idle_p50_us", is.p50_us },
+    { "idle_p99_us", is.p99_us },
+    { "preempt_p50_us", bs.p50_us - is.p50_us },
+    { "low_cmds_per_sec", low_cps },
+    { "low_alone_cmds_per_sec", low_cps_alone },
+    { "low_loss_pct", loss },
+  }, busy, bs);
+}
+
+// Roof of a context running xclbin. Ops per cycle of AIE partition is for
+// the whole partition, the same way QoS profile of shim takes it.
+struct gemm_roof {
+  uint32_t ops_per_cycle = 0;
+  uint32_t columns = 0;
+  uint32_t hclk_mhz = 0;
+  double peak_tops = 0;
+};
+
+gemm_roof
+get_gemm_roof(device* dev, const char *xclbin_name)
+{
+  gemm_roof r;
+  xrt::xclbin xclbin(get_xclbin_path(dev, xclbin_name));
+  auto axlf = xclbin.get_axlf();
+  auto hdr = xrt_core::xclbin::get_axlf_section(axlf, AIE_PARTITION);
+  if (hdr && hdr->m_sectionSize >= sizeof(aie_partition)) {
+    auto aie = reinterpret_cast<const aie_partition *>(
+      reinterpret_cast<const char *>(axlf) + hdr->m_sectionOffset);
+    r.ops_per_cycle = aie->operations_per_cycle;
+    r.columns = aie->info.column_width;
+  }
+
+  try {
+    auto raw = device_query<query::clock_freq_topology_raw>(dev);
+    auto topo = reinterpret_cast<const clock_freq_topology *>(raw.data());
+    // MP-NPU clock comes first, then H clock which AIE runs at
+    if (topo->m_count > 1)
+      r.hclk_mhz = topo->m_clock_freq[1].m_freq_Mhz;
+  } catch (const std::exception& ex) {
+    std::cout << "Failed to get clocks: " << ex.what() << std::endl;
+  }
+  r.peak_tops = static_cast<double>(r.ops_per_cycle) * r.hclk_mhz * 1e6 / 1e12;
+  return r;
+}
+
+// Keep inflight cmds of the list running until total are done.
+void
+io_gemm_roofline_loop(hwqueue_handle *hwq, int total, size_t inflight, io_cmd_list& cmds,
+  latency_recorder& rec)
+{
+  std::vector<clk::time_point> submitted(inflight);
+  int issued = 0;
+
+  auto submit = [&](size_t i) {
+    cmds[i].second->state = ERT_CMD_STATE_NEW;
+    submitted[i] = clk::now();
+    hwq->submit_command(cmds[i].first->get());
+    issued++;
+  };
+  for (size_t i = 0; i < inflight && issued < total; i++)
+    submit(i);
+  for (int done = 0; done < total; done++) {
+    auto i = done % inflight;
+    io_test_cmd_wait(hwq, cmds[i].first);
+    rec.record(submitted[i], clk::now());
+    auto state = cmds[i].second->state;
+    if (state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("Command failed, state=") + std::to_string(state));
+    if (issued < total)
+      submit(i);
+  }
+}
+
+// With one cmd in flight, per cmd time is host path plus kernel. With more,
+// host work overlaps with device and per cmd time drops towards kernel run
+// time. What it drops by is taken as host overhead.
+void
+io_gemm_roofline(device* dev, int total, size_t max_inflight, const char *xclbin, const char *elf)
+{
+  std::vector< std::unique_ptr<elf_io_gemm_test_bo_set> > bo_set;
+  for (size_t i = 0; i < max_inflight; i++)
+    bo_set.push_back(std::make_unique<elf_io_gemm_test_bo_set>(dev, xclbin, elf));
+
+  hw_ctx hwctx{dev, xclbin};
+  auto hwq = hwctx.get()->get_hw_queue();
+  io_cmd_list cmds;
+  for (auto& boset : bo_set) {
+    boset->init_cmd(hwctx, false);
+    boset->sync_before_run();
+    auto cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    cmds.push_back( {cbo, reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())} );
+  }
+
+  auto ops = bo_set[0]->get_ops_per_run();
+  if (!ops)
+    std::cout << "GEMM shape not known, no TOPS reported" << std::endl;
+  double single_us = 0;
+  double host_frac = 0;
+  for (size_t inflight = 1; inflight <= max_inflight; inflight *= 2) {
+    latency_recorder rec(total, io_test_warmup(total));
+    auto start = clk::now();
+    io_gemm_roofline_loop(hwq, total, inflight, cmds, rec);
+    auto duration_us = std::chrono::duration_cast<us_t>(clk::now() - start).count();
+    // Clock is read while device is still at the level the run brought it to
+    auto roof = get_gemm_roof(dev, xclbin);
+
+    double per_cmd_us = static_cast<double>(duration_us) / total;
+    if (inflight == 1)
+      single_us = per_cmd_us;
+    host_frac = single_us ? std::max(0.0, 1 - per_cmd_us / single_us) : 0;
+    double tops = ops ? ops / (per_cmd_us * 1e6) : 0;
+    double eff = roof.peak_tops ? tops / roof.peak_tops : 0;
+    auto s = rec.summarize();
+
+    std::cout << total << " GEMM commands, " << inflight << " in flight, " << per_cmd_us
+              << " us per command, " << tops << " TOPS of " << roof.peak_tops << " peak ("
+              << roof.ops_per_cycle << " ops/cycle, " << roof.columns << " columns, "
+              << roof.hclk_mhz << " MHz), efficiency " << eff * 100 << "%, host overhead "
+              << host_frac * 100 << "%" << std::endl;
+    print_latency_summary(s);
+    bench_report({
+      { "inflight", inflight },
+      { "commands", total },
+      { "duration_us", duration_us },
+      { "per_cmd_us", per_cmd_us },
+      { "ops_per_cmd", ops },
+      { "achieved_tops", tops },
+      { "peak_tops", roof.peak_tops },
+      { "device_efficiency", eff },
+      { "host_overhead_fraction", host_frac },
+      { "columns", roof.columns },
+      { "ops_per_cycle", roof.ops_per_cycle },
+      { "hclk_mhz", roof.hclk_mhz },
+    }, rec, s);
+  }
+  std::cout << "GEMM is " << (host_frac > 0.5 ? "host path" : "kernel")
+            << " bound, host overhead " << host_frac * 100 << "% with "
+            << max_inflight << " in flight" << std::endl;
+
+  for (auto& boset : bo_set)
+    boset->verify_result();
 }
 
 }
@@ -366,6 +1060,35 @@ TEST_io_throughput(device::id_type id, std::shared_ptr<device>& sdev, arg_type&
   io_test(id, sdev.get(), total, 8, 1, run_type == IO_TEST_NOOP_RUN ? "nop.xclbin" : nullptr);
 }
 
+void
+TEST_io_multi_thread_scaling(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  unsigned int run_type = static_cast<unsigned int>(arg[0]);
+  unsigned int wait_type = static_cast<unsigned int>(arg[1]);
+  unsigned int total = static_cast<unsigned int>(arg[2]);
+  unsigned int max_threads = static_cast<unsigned int>(arg[3]);
+
+  io_test_parameter_init(IO_TEST_LATENCY_PERF, run_type, wait_type);
+  io_test_multi_thread_scaling(sdev.get(), total, max_threads,
+    run_type == IO_TEST_NOOP_RUN ? "nop.xclbin" : nullptr);
+}
+
+void
+TEST_io_multi_proc_contention(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  unsigned int run_type = static_cast<unsigned int>(arg[0]);
+  unsigned int wait_type = static_cast<unsigned int>(arg[1]);
+  unsigned int total = static_cast<unsigned int>(arg[2]);
+  unsigned int max_procs = static_cast<unsigned int>(arg[3]);
+
+  // Can't fork with opened device.
+  sdev.reset();
+
+  io_test_parameter_init(IO_TEST_LATENCY_PERF, run_type, wait_type);
+  io_test_multi_proc_contention(id, total, max_procs,
+    run_type == IO_TEST_NOOP_RUN ? "nop.xclbin" : nullptr);
+}
+
 void
 TEST_io_runlist_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
 {
@@ -551,6 +1274,16 @@ TEST_io_gemm(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
   boset.run();
 }
 
+void
+TEST_io_gemm_roofline(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int total = static_cast<int>(arg[0]);
+  size_t max_inflight = static_cast<size_t>(arg[1]);
+
+  io_test_parameter_init(IO_TEST_THRUPUT_PERF, IO_TEST_NORMAL_RUN, IO_TEST_IOCTL_WAIT);
+  io_gemm_roofline(sdev.get(), total, max_inflight, "gemm.xclbin", "gemm_int8.elf");
+}
+
 void
 TEST_io_runlist_bad_cmd(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
 {
@@ -628,3 +1361,115 @@ TEST_io_runlist_bad_cmd(device::id_type id, std::shared_ptr<device>& sdev, arg_t
 
   (*bad).verify_result();
 }
+
+void
+TEST_io_runlist_prebuilt(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  size_t cmds_per_list = static_cast<size_t>(arg[0]);
+  auto dev = sdev.get();
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NORMAL_RUN, IO_TEST_IOCTL_WAIT);
+
+  // Set A is run by the chain first, set B by the same chain once sub-cmds
+  // of set A are patched with cmds of set B.
+  std::vector< std::unique_ptr<io_test_bo_set_base> > set_a;
+  std::vector< std::unique_ptr<io_test_bo_set_base> > set_b;
+  for (size_t i = 0; i < cmds_per_list; i++) {
+    set_a.push_back(alloc_and_init_bo_set(dev, nullptr));
+    set_b.push_back(alloc_and_init_bo_set(dev, nullptr));
+  }
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  std::vector<bo*> subcmds;
+  for (size_t i = 0; i < cmds_per_list; i++) {
+    set_a[i]->init_cmd(hwctx, false);
+    set_a[i]->sync_before_run();
+    set_b[i]->init_cmd(hwctx, false);
+    set_b[i]->sync_before_run();
+    subcmds.push_back(set_a[i]->get_bos()[IO_TEST_BO_CMD].tbo.get());
+  }
+
+  std::shared_ptr<bo> cbo = std::make_unique<bo>(dev, 0x1000ul, XCL_BO_FLAGS_EXECBUF);
+  auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+  io_test_init_runlist_cmd(cbo.get(), subcmds);
+  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> > cmdlist_bos{ {cbo, cmdpkt} };
+
+  // Shim prebuilds firmware cmdlist of the chain once it is submitted again
+  // unchanged.
+  io_test_cmd_submit_and_wait_latency(hwq, 2, cmdlist_bos);
+  for (auto& boset : set_a) {
+    auto pkt = reinterpret_cast<ert_packet *>(boset->get_bos()[IO_TEST_BO_CMD].tbo->map());
+    pkt->state = ERT_CMD_STATE_COMPLETED;
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+
+  // Patch sub-cmds in place, the chain itself is not touched. Args of the
+  // sub-cmds are copied into the prebuilt list, other changes, if any, have
+  // the list built again. Results of set B show either way made it to device.
+  for (size_t i = 0; i < cmds_per_list; i++) {
+    auto dst = subcmds[i];
+    auto src = set_b[i]->get_bos()[IO_TEST_BO_CMD].tbo.get();
+    std::memcpy(dst->map(), src->map(), std::min(dst->size(), src->size()));
+    // Arg BOs of set B have to go with the chain as well
+    cbo->get()->bind_at(cmds_per_list + i, src->get(), 0, src->size());
+  }
+  io_test_cmd_submit_and_wait_latency(hwq, 1, cmdlist_bos);
+  for (auto& boset : set_b) {
+    auto pkt = reinterpret_cast<ert_packet *>(boset->get_bos()[IO_TEST_BO_CMD].tbo->map());
+    pkt->state = ERT_CMD_STATE_COMPLETED;
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+}
+
+void
+TEST_io_resident_bo(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int total = static_cast<int>(arg[0]);
+  auto dev = sdev.get();
+
+  io_test_parameter_init(IO_TEST_NO_PERF, IO_TEST_NORMAL_RUN, IO_TEST_IOCTL_WAIT);
+
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+
+  // Arg BOs passed to enough submissions are made resident in hwctx by shim
+  // and no longer passed down. Second round gets BOs of the first one closed
+  // and, most likely, their handles taken by the new ones.
+  for (int round = 0; round < 2; round++) {
+    auto boset = alloc_and_init_bo_set(dev, nullptr);
+    boset->init_cmd(hwctx, false);
+    boset->sync_before_run();
+
+    auto cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> > cmds{ {cbo, cmdpkt} };
+    io_test_cmd_submit_and_wait_latency(hwq, total, cmds);
+
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+}
+
+void
+TEST_io_submit_path(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int workload = static_cast<int>(arg[0]);
+  int total = static_cast<int>(arg[1]);
+
+  io_test_parameter_init(IO_TEST_LATENCY_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT);
+  io_submit_path(sdev.get(), workload, total,
+    dev_filter_is_aie4(id, sdev.get()) ? "nop.elf" : "nop.xclbin");
+}
+
+void
+TEST_io_preemption_latency(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int mode = static_cast<int>(arg[0]);
+  int iterations = static_cast<int>(arg[1]);
+
+  io_test_parameter_init(IO_TEST_LATENCY_PERF, IO_TEST_NORMAL_RUN, IO_TEST_IOCTL_WAIT);
+  io_preemption_latency(sdev.get(), mode, iterations, "yolo_fullelf_aximm.elf", "nop.xclbin");
+}
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _SHIMTEST_LATENCY_H_
+#define _SHIMTEST_LATENCY_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Records latency of each iteration of a benchmark loop so that tail latency
+// can be reported instead of just the average. Header only, so that it can be
+// shared by shim_test and xrt_test.
+//
+// Storage for all samples is allocated up front, record() does nothing more
+// than storing one value and never allocates while the loop is being timed.
+// The first m_warmup samples are kept but excluded from the summary.
+class latency_recorder {
+public:
+  using time_point = std::chrono::high_resolution_clock::time_point;
+
+  struct summary {
+    size_t count = 0;
+    double min_us = 0;
+    double mean_us = 0;
+    double p50_us = 0;
+    double p90_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+    double max_us = 0;
+    // hist[i] counts samples in [2^(i-1), 2^i) us, hist[0] counts < 1us
+    std::vector<size_t> hist;
+  };
+
+  latency_recorder(size_t iterations, size_t warmup = 0)
+    : m_warmup(warmup)
+  {
+    m_samples.reserve(iterations);
+  }
+
+  void
+  record(time_point start, time_point end)
+  {
+    if (m_samples.size() == m_samples.capacity())
+      return;
+    m_samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  }
+
+  void
+  reset()
+  {
+    m_samples.clear();
+  }
+
+  // Append samples of another recorder, e.g. one per thread, dropping its
+  // warm-up samples. Not meant to be called while timing.
+  void
+  merge(const latency_recorder& other)
+  {
+    if (other.m_samples.size() <= other.m_warmup)
+      return;
+    m_samples.insert(m_samples.end(), other.m_samples.begin() + other.m_warmup, other.m_samples.end());
+  }
+
+  size_t
+  warmup() const
+  {
+    return m_warmup;
+  }
+
+  const std::vector<uint64_t>&
+  samples() const
+  {
+    return m_samples;
+  }
+
+  summary
+  summarize() const
+  {
+    summary s;
+
+    if (m_samples.size() <= m_warmup)
+      return s;
+
+    std::vector<uint64_t> sorted(m_samples.begin() + m_warmup, m_samples.end());
+    std::sort(sorted.begin(), sorted.end());
+    s.count = sorted.size();
+
+    // Nearest-rank percentile
+    auto pct = [&sorted] (double p) {
+      size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+      return sorted[std::max<size_t>(rank, 1) - 1] / 1000.0;
+    };
+    s.min_us = sorted.front() / 1000.0;
+    s.p50_us = pct(0.5);
+    s.p90_us = pct(0.9);
+    s.p99_us = pct(0.99);
+    s.p999_us = pct(0.999);
+    s.max_us = sorted.back() / 1000.0;
+
+    double total = 0;
+    for (auto ns : sorted) {
+      total += ns;
+      size_t bucket = 0;
+      for (auto us = ns / 1000; us; us >>= 1)
+        bucket++;
+      if (bucket >= s.hist.size())
+        s.hist.resize(bucket + 1);
+      s.hist[bucket]++;
+    }
+    s.mean_us = total / s.count / 1000.0;
+    return s;
+  }
+
+  // One line per sample: iteration,latency_ns,warmup
+  void
+  write_csv(const std::string& path) const
+  {
+    std::ofstream out(path);
+    if (!out)
+      throw std::runtime_error("Failed to open latency sample file: " + path);
+    out << "iteration,latency_ns,warmup" << std::endl;
+    for (size_t i = 0; i < m_samples.size(); i++)
+      out << i << "," << m_samples[i] << "," << (i < m_warmup) << "\n";
+  }
+
+private:
+  size_t m_warmup;
+  std::vector<uint64_t> m_samples;
+};
+
+static inline void
+print_latency_summary(const latency_recorder::summary& s)
+{
+  std::ios_base::fmtflags f(std::cout.flags());
+  auto prec = std::cout.precision();
+
+  std::cout << std::setprecision(3) << std::fixed
+            << "\tLatency of " << s.count << " iterations (us): "
+            << "min " << s.min_us << ", mean " << s.mean_us
+            << ", p50 " << s.p50_us << ", p90 " << s.p90_us
+            << ", p99 " << s.p99_us << ", p99.9 " << s.p999_us
+            << ", max " << s.max_us << std::endl;
+  for (size_t i = 0; i < s.hist.size(); i++) {
+    if (!s.hist[i])
+      continue;
+    std::cout << "\t\t" << std::setw(8) << (i ? (1ul << (i - 1)) : 0)
+              << " - " << std::setw(8) << (1ul << i) << " us: " << s.hist[i] << std::endl;
+  }
+
+  std::cout.flags(f);
+  std::cout.precision(prec);
+}
+
+// Run one round of the benchmark loop, which records into rec, again and again
+// until p50 of two consecutive rounds differ by less than tolerance, or
+// max_rounds is reached. Returns summary of the last round.
+template <typename F>
+latency_recorder::summary
+run_until_stable(latency_recorder& rec, F&& round, unsigned max_rounds, double tolerance = 0.05)
+{
+  latency_recorder::summary prev;
+  latency_recorder::summary cur;
+
+  for (unsigned i = 0; i < max_rounds; i++) {
+    rec.reset();
+    round();
+    cur = rec.summarize();
+    if (i && std::fabs(cur.p50_us - prev.p50_us) <= tolerance * prev.p50_us)
+      break;
+    prev = cur;
+  }
+  return cur;
+}
+
+#endif // _SHIMTEST_LATENCY_H_
@@ -18,6 +18,8 @@
 #include "core/common/system.h"
 #include "core/common/device.h"
 
+#include <algorithm>
+#include <cctype>
 #include <filesystem>
 #include <fstream>
 #include <vector>
@@ -44,22 +46,38 @@ std::string cur_path;
 std::string xclbin_path;
 int base_write_speed;
 int base_read_speed;
+// Benchmark mode result file, see bench_report()
+std::string bench_path;
+std::string cur_test_name;
+std::string cur_drv_name;
+std::string cur_queue_name;
+std::string cur_dev_id;
+std::string cur_fw_ver;
+std::string elf_cache_dir;
+std::string replay_trace_path;
 
 using arg_type = const std::vector<uint64_t>;
 void TEST_export_import_bo(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_export_import_bo_single_proc(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_export_bo_then_close_device(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_bo_alloc_churn(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_import_dmabuf_frame_handoff(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_timeout(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_gemm(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_gemm_roofline(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_async_error_io(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg);
 void TEST_async_error_multi(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg);
 void TEST_instr_invalid_addr_io(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg);
 void TEST_io_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_throughput(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_multi_thread_scaling(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_multi_proc_contention(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_runlist_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_runlist_throughput(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_runlist_bad_cmd(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_runlist_prebuilt(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_resident_bo(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_noop_io_with_dup_bo(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_with_ubuf_bo(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_io_suspend_resume(device::id_type, std::shared_ptr<device>&, arg_type&);
@@ -71,6 +89,16 @@ void TEST_elf_io(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_preempt_elf_io(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_cmd_fence_host(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_cmd_fence_device(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_cmd_fence_timeout(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_cmd_fence_queued_batch(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_cmd_fence_recycled_share(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_cmd_fence_chain_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_cmd_fence_chain_2proc_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_hwctx_create_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_trace_replay(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_hwctx_create_multi_proc_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_submit_path(device::id_type, std::shared_ptr<device>&, arg_type&);
+void TEST_io_preemption_latency(device::id_type, std::shared_ptr<device>&, arg_type&);
 void TEST_preempt_full_elf_io(device::id_type, std::shared_ptr<device>&, arg_type&);
 
 inline void
@@ -90,6 +118,14 @@ usage(const std::string& prog)
   std::cout << "\t" << "-h" << ": print this help message\n";
   std::cout << "\t" << "-k" << ": evaluate test result based on kernel version\n";
   std::cout << "\t" << "-x <xclbin_path>" << ": run test cases with specified xclbin file\n";
+  std::cout << "\t" << "-b <result_file>" << ": benchmark mode, run performance test cases and "
+    "append results to file, one JSON object per line\n";
+  std::cout << "\t" << "     set Debug.ioctl_stats=true in xrt.ini to also get time spent "
+    "per ioctl and, on virtio, per host call type\n";
+  std::cout << "\t" << "-e <cache_dir>" << ": keep ELF assembled from TXN files in this directory, "
+    "so that later runs load it instead of assembling again\n";
+  std::cout << "\t" << "-r <trace_file>" << ": trace stream recorded with Debug.trace_stream "
+    "to be replayed by trace replay test cases\n";
   std::cout << std::endl;
 }
 
@@ -128,16 +164,108 @@ is_xdna_dev(device* dev)
   return is_xdna;
 }
 
+std::string
+get_drv_name(device* dev)
+{
+  query::sub_device_path::args query_arg = {std::string(""), 0};
+  auto sysfs = device_query<query::sub_device_path>(dev, query_arg);
+  auto drv_path = std::filesystem::read_symlink(sysfs + "/driver");
+  return drv_path.filename();
+}
+
 bool
 is_amdxdna_drv(device* dev)
 {
   const std::string amdxdna = "amdxdna";
 
-  query::sub_device_path::args query_arg = {std::string(""), 0};
-  auto sysfs = device_query<query::sub_device_path>(dev, query_arg);
-  auto drv_path = std::filesystem::read_symlink(sysfs + "/driver");
-  auto drv_name = drv_path.filename();
-  return drv_name == amdxdna;
+  return get_drv_name(dev) == amdxdna;
+}
+
+std::string
+get_dev_id(device* dev)
+{
+  std::stringstream ss;
+
+  ss << "0x" << std::hex << device_query<query::pcie_device>(dev);
+  return ss.str();
+}
+
+std::string
+get_fw_ver(device* dev)
+{
+  try {
+    auto fw = device_query<query::firmware_version>(dev,
+      query::firmware_version::firmware_type::npu_firmware);
+    return std::to_string(fw.major) + "." + std::to_string(fw.minor) + "." +
+      std::to_string(fw.patch) + "." + std::to_string(fw.build);
+  }
+  catch (const std::exception&) {
+    return "unknown";
+  }
+}
+
+// Results of the same test case run on bare-metal (amdxdna driver) and in a
+// guest (virtio_gpu driver) can be told apart by "driver". "device" and
+// "firmware" select the baseline to compare with, see test/perf_suite.py.
+namespace {
+
+std::ofstream
+bench_report_begin(std::initializer_list< std::pair<const char*, double> > results)
+{
+  std::ofstream out(bench_path, std::ios::app);
+  if (!out)
+    throw std::runtime_error("Failed to open benchmark result file: " + bench_path);
+  out << "{\"test\":\"" << cur_test_name << "\",\"driver\":\"" << cur_drv_name << "\""
+      << ",\"queue\":\"" << cur_queue_name << "\""
+      << ",\"device\":\"" << cur_dev_id << "\",\"firmware\":\"" << cur_fw_ver << "\"";
+  for (auto& r : results)
+    out << ",\"" << r.first << "\":" << std::fixed << r.second;
+  return out;
+}
+
+}
+
+bool
+is_bench_mode()
+{
+  return !bench_path.empty();
+}
+
+void
+bench_report(std::initializer_list< std::pair<const char*, double> > results)
+{
+  if (bench_path.empty())
+    return;
+
+  auto out = bench_report_begin(results);
+  out << "}" << std::endl;
+}
+
+void
+bench_report(std::initializer_list< std::pair<const char*, double> > results,
+  const latency_recorder& rec, const latency_recorder::summary& s)
+{
+  if (bench_path.empty())
+    return;
+
+  auto out = bench_report_begin(results);
+  out << ",\"iterations\":" << s.count
+      << ",\"warmup\":" << rec.warmup()
+      << ",\"min_us\":" << s.min_us
+      << ",\"mean_us\":" << s.mean_us
+      << ",\"p50_us\":" << s.p50_us
+      << ",\"p90_us\":" << s.p90_us
+      << ",\"p99_us\":" << s.p99_us
+      << ",\"p999_us\":" << s.p999_us
+      << ",\"max_us\":" << s.max_us
+      << ",\"hist_log2_us\":[";
+  for (size_t i = 0; i < s.hist.size(); i++)
+    out << (i ? "," : "") << s.hist[i];
+  out << "]}" << std::endl;
+
+  auto csv = cur_test_name;
+  std::replace_if(csv.begin(), csv.end(), [] (char c) { return !std::isalnum(c); }, '_');
+  rec.write_csv(bench_path + "." + cur_drv_name + "." + csv + ".csv");
 }
 
 bool
@@ -216,6 +344,13 @@ dev_filter_is_xdna_and_amdxdna_drv(device::id_type id, device* dev)
   return true;
 }
 
+// Trace replay is only run when a trace is given, see -r.
+bool
+dev_filter_is_aie2_with_replay_trace(device::id_type id, device* dev)
+{
+  return !replay_trace_path.empty() && dev_filter_is_aie2(id, dev);
+}
+
 bool
 dev_filter_is_aie2_and_amdxdna_drv(device::id_type id, device* dev)
 {
@@ -558,6 +693,119 @@ TEST_sync_bo_off_size(device::id_type id, std::shared_ptr<device>& sdev, arg_typ
   get_speed_and_print("sync", sync_size, start, end);
 }
 
+void
+TEST_write_sync_bo_wc(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto boflags = static_cast<unsigned int>(arg[0]);
+  auto size = static_cast<size_t>(arg[1]);
+  const std::vector<std::pair<std::string, unsigned int>> uses = {
+    { "cached", XRT_BO_USE_UNUSED },
+    // Instruction BO is write-combined, sync to device is just a fence.
+    { "write-combined", XRT_BO_USE_INSTRUCTION << 4 },
+  };
+
+  for (auto& u : uses) {
+    bo bo{sdev.get(), size, boflags, u.second};
+
+    auto start = clk::now();
+    std::memset(bo.map(), 0x5a, size);
+    bo.get()->sync(buffer_handle::direction::host2device, size, 0);
+    auto end = clk::now();
+    get_speed_and_print(u.first + " write and sync to device", size, start, end);
+  }
+}
+
+// p50 of per-call latency of sync'ing [offset, size) of the BO, BO is synced
+// by driver if it has never been mapped, otherwise by CPU cache flush.
+latency_recorder::summary
+sync_bo_latency(buffer_handle *boh, buffer_handle::direction dir, size_t size, size_t offset)
+{
+  // Enough calls to smooth out small sizes without taking forever on big ones
+  const size_t reps = std::clamp<size_t>(0x4000000 / size, 3, 1000);
+  latency_recorder rec(reps);
+
+  for (size_t i = 0; i < reps; i++) {
+    auto start = clk::now();
+    boh->sync(dir, size - offset, offset);
+    rec.record(start, clk::now());
+  }
+  return rec.summarize();
+}
+
+void
+TEST_sync_bo_bandwidth_sweep(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto boflags = static_cast<unsigned int>(arg[0]);
+  auto min_size = static_cast<size_t>(arg[1]);
+  auto max_size = static_cast<size_t>(arg[2]);
+  // Page aligned, cache line aligned and unaligned start of sync range
+  const size_t offsets[] = { 0, 0x40, 0x3 };
+  const std::pair<const char*, buffer_handle::direction> dirs[] = {
+    { "to device", buffer_handle::direction::host2device },
+    { "from device", buffer_handle::direction::device2host },
+  };
+  // Smallest size where driver sync beats CPU flush, per direction
+  size_t crossover[2] = { 0, 0 };
+  double overhead_us[2][2] = {};
+
+  // Shim syncs a BO by driver till it is mapped, so both methods can be
+  // measured in one run with default settings. With Debug.force_driver_sync
+  // or Runtime.lazy_bo_mmap=false both rows show the same method. The CPU
+  // flush kernel can be switched by Debug.cache_flush_by_line.
+  std::cout << "\tsize offset direction method p50_us GB/s" << std::endl;
+  for (auto size = min_size; size <= max_size; size *= 4) {
+    for (auto offset : offsets) {
+      for (int d = 0; d < 2; d++) {
+        double p50[2];
+        for (int by_driver = 1; by_driver >= 0; by_driver--) {
+          auto boh = dev->alloc_bo(size, get_bo_flags(boflags, 0));
+          if (!by_driver)
+            boh->map(buffer_handle::map_type::write);
+          auto s = sync_bo_latency(boh.get(), dirs[d].second, size, offset);
+          auto gbps = (size - offset) / (s.p50_us * 1000.0);
+          p50[by_driver] = s.p50_us;
+          if (size == min_size && !offset)
+            overhead_us[d][by_driver] = s.p50_us;
+
+          std::cout << "\t0x" << std::hex << size << " 0x" << offset << std::dec
+                    << " " << dirs[d].first << " " << (by_driver ? "driver" : "cpu")
+                    << " " << s.p50_us << " " << gbps << std::endl;
+          bench_report({
+            { "size", size },
+            { "offset", offset },
+            { "to_device", d == 0 },
+            { "by_driver", by_driver },
+            { "p50_us", s.p50_us },
+            { "p99_us", s.p99_us },
+            { "gbps", gbps },
+          });
+        }
+        if (!offset && !crossover[d] && p50[1] < p50[0])
+          crossover[d] = size;
+      }
+    }
+  }
+
+  for (int d = 0; d < 2; d++) {
+    std::cout << "\tSync " << dirs[d].first << ": per-call overhead driver "
+              << overhead_us[d][1] << " us, cpu " << overhead_us[d][0] << " us, ";
+    if (crossover[d])
+      std::cout << "driver is faster from 0x" << std::hex << crossover[d] << std::dec << " bytes";
+    else
+      std::cout << "driver is never faster";
+    std::cout << std::endl;
+  }
+  bench_report({
+    { "to_device_crossover", crossover[0] },
+    { "from_device_crossover", crossover[1] },
+    { "to_device_driver_overhead_us", overhead_us[0][1] },
+    { "to_device_cpu_overhead_us", overhead_us[0][0] },
+    { "from_device_driver_overhead_us", overhead_us[1][1] },
+    { "from_device_cpu_overhead_us", overhead_us[1][0] },
+  });
+}
+
 void
 TEST_map_read_bo(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
 {
@@ -847,9 +1095,18 @@ std::vector<test_case> test_list {
   test_case{ "sync_bo for input_output 1MiB BO w/ offset and size", {},
     TEST_POSITIVE, dev_filter_xdna, TEST_sync_bo_off_size, {XCL_BO_FLAGS_HOST_ONLY, 0, 0x100000, 0x1004, 0x3c}
   },
+  test_case{ "measure sync_bo bandwidth by driver vs cpu flush for input_output BO from 4KiB to 1GiB", {},
+    TEST_POSITIVE, dev_filter_xdna, TEST_sync_bo_bandwidth_sweep, {XCL_BO_FLAGS_HOST_ONLY, 0x1000, 0x40000000}
+  },
+  test_case{ "write and sync_bo speed for cached vs write-combined 1MiB BO", {},
+    TEST_POSITIVE, dev_filter_xdna, TEST_write_sync_bo_wc, {XCL_BO_FLAGS_HOST_ONLY, 0x100000}
+  },
   test_case{ "export import BO in single process", {},
     TEST_POSITIVE, dev_filter_is_aie2, TEST_export_import_bo_single_proc, {}
   },
+  test_case{ "import foreign dma-buf frame handoff latency for 8MiB frame", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_import_dmabuf_frame_handoff, {0x800000, 64}
+  },
   test_case{ "multi-command ELF io test real kernel good run", {},
     TEST_POSITIVE, dev_filter_is_aie2, TEST_elf_io, { IO_TEST_NORMAL_RUN, 3 }
   },
@@ -911,18 +1168,102 @@ std::vector<test_case> test_list {
   test_case{ "gemm and debug BO", {},
     TEST_POSITIVE, dev_filter_is_npu4, TEST_io_gemm, {}
   },
+  test_case{ "measure gemm achieved vs peak TOPS with 1 to 8 cmds in flight", {},
+    TEST_POSITIVE, dev_filter_is_npu4, TEST_io_gemm_roofline, { 1000, 8 }
+  },
   test_case{ "create and free internal bo", {},
     TEST_POSITIVE, dev_filter_is_aie, TEST_create_free_internal_bo, {}
   },
   test_case{ "export BO then close device", {},
     TEST_POSITIVE, dev_filter_is_aie2, TEST_export_bo_then_close_device, {}
   },
+  test_case{ "measure BO alloc and free churn with 4 threads", {},
+    TEST_POSITIVE, dev_filter_xdna, TEST_bo_alloc_churn, { 4, 5000 }
+  },
+  test_case{ "measure no-op kernel latency with 1 to 32 threads sharing one context", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_multi_thread_scaling, { IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, 32000, 32 }
+  },
+  test_case{ "measure no-op kernel latency with 1 to 16 processes each with own context", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_multi_proc_contention, { IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, 32000, 16 }
+  },
+  test_case{ "measure real kernel latency with 1 to 16 processes each with own context", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_multi_proc_contention, { IO_TEST_NORMAL_RUN, IO_TEST_IOCTL_WAIT, 8000, 16 }
+  },
   test_case{ "failed chained command", {},
     TEST_POSITIVE, dev_filter_is_npu4, TEST_io_runlist_bad_cmd, {false}
   },
   test_case{ "timed out chained command", {},
     TEST_POSITIVE, dev_filter_is_npu4, TEST_io_runlist_bad_cmd, {true}
   },
+  test_case{ "chained command resubmitted with prebuilt cmdlist patched in place", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_runlist_prebuilt, {4}
+  },
+  test_case{ "io test with arg BOs made resident in hwctx", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_resident_bo, {16}
+  },
+  test_case{ "Cmd fencing (wait timeout)", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_timeout, {}
+  },
+  test_case{ "Cmd fencing (12 cmds queued behind fence issued in batches)", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_queued_batch, { 12, 10 }
+  },
+  test_case{ "Cmd fencing (share clone of recycled fence)", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_recycled_share, {}
+  },
+  test_case{ "measure latency of chain of 8 commands serialized by host", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_latency, { FENCE_CHAIN_HOST, 1, 8, 500 }
+  },
+  test_case{ "measure latency of chain of 8 commands linked by fences in driver", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_latency, { FENCE_CHAIN_DRIVER, 1, 8, 500 }
+  },
+  test_case{ "measure latency of chain of 8 commands linked by fences in driver across 4 hwqs", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_latency, { FENCE_CHAIN_DRIVER, 4, 8, 500 }
+  },
+  test_case{ "measure latency of chain of 8 commands linked by fences in pending queue", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_latency, { FENCE_CHAIN_PENDING, 1, 8, 500 }
+  },
+  test_case{ "measure latency of chain of 8 commands linked by fences in pending queue across 4 hwqs", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_latency, { FENCE_CHAIN_PENDING, 4, 8, 500 }
+  },
+  test_case{ "measure latency of chain of 9 commands linked by fences across 2 processes", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_fence_chain_2proc_latency, { 9, 500 }
+  },
+  test_case{ "measure context create and destroy latency by phase", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_hwctx_create_latency, { 1, 200 }
+  },
+  test_case{ "measure context create and destroy latency by phase with 4 threads", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_hwctx_create_latency, { 4, 100 }
+  },
+  test_case{ "measure context create and destroy latency by phase with 4 processes", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_hwctx_create_multi_proc_latency, { 4, 100 }
+  },
+  test_case{ "measure submit cost and completion latency of no-op cmd on KMQ/UMQ path", {},
+    TEST_POSITIVE, dev_filter_is_aie, TEST_io_submit_path, { IO_SUBMIT_PATH_LATENCY, 10000 }
+  },
+  test_case{ "measure submit cost and completion latency of 8 no-op cmds in flight on KMQ/UMQ path", {},
+    TEST_POSITIVE, dev_filter_is_aie, TEST_io_submit_path, { IO_SUBMIT_PATH_THRUPUT, 10000 }
+  },
+  test_case{ "measure submit cost and completion latency of chained no-op cmds on KMQ/UMQ path", {},
+    TEST_POSITIVE, dev_filter_is_aie, TEST_io_submit_path, { IO_SUBMIT_PATH_RUNLIST, 2000 }
+  },
+  test_case{ "measure submit cost and completion latency of no-op cmd from 4 threads on KMQ/UMQ path", {},
+    TEST_POSITIVE, dev_filter_is_aie, TEST_io_submit_path, { IO_SUBMIT_PATH_THREADS, 10000 }
+  },
+  test_case{ "measure high priority cmd latency and low priority throughput loss without preemption", {},
+    TEST_POSITIVE, dev_filter_is_npu4_and_amdxdna_drv, TEST_io_preemption_latency, { IO_PREEMPT_NONE, 200 }
+  },
+  test_case{ "measure high priority cmd latency and low priority throughput loss with frame boundary preemption", {},
+    TEST_POSITIVE, dev_filter_is_npu4_and_amdxdna_drv, TEST_io_preemption_latency, { IO_PREEMPT_FRAME, 200 }
+  },
+  test_case{ "measure high priority cmd latency and low priority throughput loss with fine grain preemption", {},
+    TEST_POSITIVE, dev_filter_is_npu4_and_amdxdna_drv, TEST_io_preemption_latency, { IO_PREEMPT_FINE, 200 }
+  },
+  test_case{ "measure replay of recorded submission trace with recorded timing", {},
+    TEST_POSITIVE, dev_filter_is_aie2_with_replay_trace, TEST_trace_replay, { 100 }
+  },
+  test_case{ "measure replay of recorded submission trace back to back", {},
+    TEST_POSITIVE, dev_filter_is_aie2_with_replay_trace, TEST_trace_replay, { 0 }
+  },
 };
 
 // Test case executor implementation
@@ -948,6 +1289,7 @@ run_test(int id, const test_case& test, bool force, const device::id_type& num_o
   bool skipped = true;
 
   std::cout << "====== " << id << ": " << test.name << " started =====" << std::endl;
+  cur_test_name = test.name;
   try {
     if (test.dev_filter == no_dev_filter) { // system test
       skipped = false;
@@ -959,6 +1301,12 @@ run_test(int id, const test_case& test, bool force, const device::id_type& num_o
         if (!force && !test.dev_filter(i, dev.get()))
           continue;
         skipped = false;
+        if (!bench_path.empty()) {
+          cur_drv_name = get_drv_name(dev.get());
+          cur_queue_name = dev_filter_is_aie4(i, dev.get()) ? "umq" : "kmq";
+          cur_dev_id = get_dev_id(dev.get());
+          cur_fw_ver = get_fw_ver(dev.get());
+        }
         test.func(i, dev, test.arg);
       }
     }
@@ -1008,10 +1356,14 @@ run_all_test(std::vector<int>& tests)
     return;
   }
 
-  // Run all tests
+  // Run all tests, or all performance tests in benchmark mode
   if (tests.empty()) {
     int id = 0;
     for (const auto& t : test_list) {
+      if (!bench_path.empty() && t.name.rfind("measure ", 0) != 0) {
+        id++;
+        continue;
+      }
       run_test(id++, t, false, total_dev);
       std::cout << std::endl;
     }
@@ -1080,7 +1432,7 @@ main(int argc, char **argv)
   std::string program = std::filesystem::path(argv[0]).filename();
 
   int option;
-  while ((option = getopt(argc, argv, ":hx:k")) != -1) {
+  while ((option = getopt(argc, argv, ":hx:kb:e:r:")) != -1) {
     switch (option) {
     case 'h':
       usage(program);
@@ -1103,6 +1455,19 @@ main(int argc, char **argv)
         << current_kern.major << "." << current_kern.minor << std::endl;
       break;
     }
+    case 'b':
+      bench_path = optarg;
+      std::cout << "Benchmark mode, appending results to: " << bench_path << std::endl;
+      break;
+    case 'e':
+      elf_cache_dir = optarg;
+      std::filesystem::create_directories(elf_cache_dir);
+      std::cout << "Caching assembled ELF in: " << elf_cache_dir << std::endl;
+      break;
+    case 'r':
+      replay_trace_path = optarg;
+      std::cout << "Replaying trace stream: " << replay_trace_path << std::endl;
+      break;
     case '?':
       std::cout << "Unknown option: " << static_cast<char>(optopt) << std::endl;
       return 1;
@@ -4,7 +4,11 @@
 #ifndef _SHIMTEST_SPEED_H_
 #define _SHIMTEST_SPEED_H_
 
+#include "latency.h"
+
 #include <chrono>
+#include <initializer_list>
+#include <utility>
 
 using clk = std::chrono::high_resolution_clock;
 using ms_t = std::chrono::milliseconds;
@@ -29,4 +33,19 @@ get_speed_and_print(std::string prefix, size_t size, clk::time_point &start, clk
   return speed;
 }
 
+// In benchmark mode (-b), append one line of results of current test case to
+// the result file as a JSON object, no-op otherwise.
+void
+bench_report(std::initializer_list< std::pair<const char*, double> > results);
+
+// Same as above, plus latency percentiles and histogram from s. Samples in rec
+// are also dumped as CSV next to the result file, named after the test case.
+void
+bench_report(std::initializer_list< std::pair<const char*, double> > results,
+  const latency_recorder& rec, const latency_recorder::summary& s);
+
+// True if running in benchmark mode (-b).
+bool
+is_bench_mode();
+
 #endif // _SHIMTEST_SPEED_H_
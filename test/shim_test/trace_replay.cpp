@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "io.h"
+#include "io_param.h"
+#include "speed.h"
+#include "../../src/shim/trace_stream.h"
+
+#include "core/common/device.h"
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+namespace ts = shim_xdna::trace_stream;
+
+extern std::string replay_trace_path;
+
+void io_test_parameter_init(int perf, int type, int wait, bool debug);
+std::unique_ptr<io_test_bo_set_base> alloc_and_init_bo_set(device* dev, const char *xclbin);
+
+namespace {
+
+// No-op cmds submitted in place of recorded ones, more in flight than this
+// and the oldest one is waited for first.
+const size_t replay_max_inflight = 16;
+
+struct replay_frame {
+  ts::event type;
+  uint64_t ts_ns;
+  std::vector<char> payload;
+
+  template <typename T>
+  const T&
+  as() const
+  {
+    if (payload.size() < sizeof(T))
+      throw std::runtime_error("Truncated trace frame of type " +
+        std::to_string(static_cast<int>(type)));
+    return *reinterpret_cast<const T *>(payload.data());
+  }
+};
+
+std::vector<replay_frame>
+load_trace(const std::string& path)
+{
+  std::ifstream f(path, std::ios::binary);
+  if (!f)
+    throw std::runtime_error("Failed to open trace " + path);
+  std::vector<char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+  ts::file_header fh;
+  if (buf.size() < sizeof(fh))
+    throw std::runtime_error("Trace " + path + " is too short");
+  std::memcpy(&fh, buf.data(), sizeof(fh));
+  if (std::memcmp(fh.magic, ts::file_magic, sizeof(fh.magic)) || fh.version != ts::file_version)
+    throw std::runtime_error("Trace " + path + " is not a trace stream of this version");
+
+  std::vector<replay_frame> frames;
+  for (size_t off = sizeof(fh); off + sizeof(ts::frame_header) <= buf.size();) {
+    ts::frame_header hdr;
+    std::memcpy(&hdr, buf.data() + off, sizeof(hdr));
+    off += sizeof(hdr);
+    if (off + hdr.size > buf.size())
+      break; // Recording process did not exit cleanly
+    frames.push_back({ static_cast<ts::event>(hdr.type), hdr.ts_ns,
+      std::vector<char>(buf.data() + off, buf.data() + off + hdr.size) });
+    off += (hdr.size + 7) & ~7u;
+  }
+  std::cout << "Loaded " << frames.size() << " frames from " << path
+            << ", recorded by pid " << fh.pid << std::endl;
+  return frames;
+}
+
+struct replay_cmd {
+  std::shared_ptr<bo> cbo;
+  ert_start_kernel_cmd *pkt;
+  uint64_t orig_handle = 0;
+  clk::time_point submitted;
+};
+
+class trace_replay
+{
+public:
+  trace_replay(device *dev, const std::vector<replay_frame>& frames, int time_scale_pct)
+    : m_dev(dev), m_frames(frames), m_time_scale_pct(time_scale_pct)
+    , m_complete(frames.size()), m_sync(frames.size())
+  {}
+
+  void
+  run()
+  {
+    const char *xclbin = "nop.xclbin";
+    hw_ctx hwctx{m_dev, xclbin};
+    m_hwq = hwctx.get()->get_hw_queue();
+
+    for (size_t i = 0; i < replay_max_inflight; i++) {
+      m_bo_set.push_back(alloc_and_init_bo_set(m_dev, xclbin));
+      m_bo_set.back()->init_cmd(hwctx, false);
+      m_bo_set.back()->sync_before_run();
+      auto cbo = m_bo_set.back()->get_bos()[IO_TEST_BO_CMD].tbo;
+      m_free.push_back({ cbo, reinterpret_cast<ert_start_kernel_cmd *>(cbo->map()) });
+    }
+
+    auto start = clk::now();
+    for (auto& f : m_frames) {
+      pace(f.ts_ns, start);
+      replay(f);
+    }
+    while (!m_inflight.empty())
+      complete_oldest();
+    m_duration_us = std::chrono::duration_cast<us_t>(clk::now() - start).count();
+    m_bos.clear();
+  }
+
+  void
+  report() const
+  {
+    auto cs = m_complete.summarize();
+    auto ss = m_sync.summarize();
+    uint64_t orig_us = m_frames.empty() ? 0 :
+      (m_frames.back().ts_ns - m_frames.front().ts_ns) / 1000;
+
+    std::cout << "Replayed " << m_cmds << " commands, " << m_allocs << " BO allocations, "
+              << m_syncs << " BO syncs in " << m_duration_us << " us, recorded in "
+              << orig_us << " us, time scale " << m_time_scale_pct << "%" << std::endl;
+    if (m_skipped)
+      std::cout << m_skipped << " frames not replayed, e.g. fences or unknown BOs" << std::endl;
+    std::cout << "Command completion:" << std::endl;
+    print_latency_summary(cs);
+    std::cout << "BO sync:" << std::endl;
+    print_latency_summary(ss);
+    bench_report({
+      { "time_scale_pct", m_time_scale_pct },
+      { "commands", m_cmds },
+      { "bo_allocs", m_allocs },
+      { "bo_syncs", m_syncs },
+      { "duration_us", m_duration_us },
+      { "recorded_duration_us", orig_us },
+      { "sync_p50_us", ss.p50_us },
+      { "sync_p99_us", ss.p99_us },
+    }, m_complete, cs);
+  }
+
+private:
+  // Hold frame back until its recorded time, scaled, since start of trace.
+  void
+  pace(uint64_t ts_ns, clk::time_point start)
+  {
+    if (!m_time_scale_pct)
+      return;
+    auto rel_ns = (ts_ns - m_frames.front().ts_ns) * m_time_scale_pct / 100;
+    std::this_thread::sleep_until(start + ns_t(rel_ns));
+  }
+
+  bo *
+  find_bo(uint64_t key)
+  {
+    auto it = m_bos.find(key);
+    if (it == m_bos.end()) {
+      m_skipped++;
+      return nullptr;
+    }
+    return it->second.get();
+  }
+
+  void
+  replay(const replay_frame& f)
+  {
+    switch (f.type) {
+    case ts::event::bo_alloc: {
+      auto& p = f.as<ts::bo_payload>();
+      // Recorded cmds are replaced by no-op ones
+      if (xcl_bo_flags{p.flags}.boflags == (XCL_BO_FLAGS_EXECBUF >> 24)) {
+        m_skipped++;
+        break;
+      }
+      m_bos[p.bo_key] = std::make_unique<bo>(m_dev, p.size,
+        static_cast<uint32_t>(p.flags), static_cast<uint32_t>(p.flags >> 32));
+      m_allocs++;
+      break;
+    }
+    case ts::event::bo_free:
+      m_bos.erase(f.as<ts::bo_payload>().bo_key);
+      break;
+    case ts::event::bo_content: {
+      auto& p = f.as<ts::bo_sync_payload>();
+      auto b = find_bo(p.bo_key);
+      auto len = f.payload.size() - sizeof(p);
+      if (b && p.offset + len <= b->size())
+        std::memcpy(reinterpret_cast<char *>(b->map()) + p.offset, f.payload.data() + sizeof(p), len);
+      break;
+    }
+    case ts::event::bo_sync: {
+      auto& p = f.as<ts::bo_sync_payload>();
+      auto b = find_bo(p.bo_key);
+      if (!b || p.offset + p.size > b->size())
+        break;
+      auto s = clk::now();
+      b->get()->sync(static_cast<buffer_handle::direction>(p.direction), p.size, p.offset);
+      m_sync.record(s, clk::now());
+      m_syncs++;
+      break;
+    }
+    case ts::event::cmd_submit:
+      submit(f.as<ts::cmd_payload>().bo_handle);
+      break;
+    case ts::event::cmd_wait_end:
+      complete(f.as<ts::cmd_payload>().bo_handle);
+      break;
+    case ts::event::fence_wait:
+    case ts::event::fence_signal:
+      // In one process with one hwq everything is in order already
+      m_skipped++;
+      break;
+    default:
+      break;
+    }
+  }
+
+  void
+  submit(uint64_t orig_handle)
+  {
+    if (m_free.empty())
+      complete_oldest();
+    auto cmd = m_free.front();
+    m_free.pop_front();
+
+    cmd.orig_handle = orig_handle;
+    cmd.pkt->state = ERT_CMD_STATE_NEW;
+    cmd.submitted = clk::now();
+    m_hwq->submit_command(cmd.cbo->get());
+    m_inflight.push_back(cmd);
+    m_cmds++;
+  }
+
+  // App waited for recorded cmd, wait for the oldest one replaying it.
+  void
+  complete(uint64_t orig_handle)
+  {
+    for (size_t i = 0; i < m_inflight.size(); i++) {
+      if (m_inflight[i].orig_handle != orig_handle)
+        continue;
+      auto cmd = m_inflight[i];
+      m_inflight.erase(m_inflight.begin() + i);
+      wait(cmd);
+      return;
+    }
+  }
+
+  void
+  complete_oldest()
+  {
+    auto cmd = m_inflight.front();
+    m_inflight.pop_front();
+    wait(cmd);
+  }
+
+  void
+  wait(replay_cmd& cmd)
+  {
+    m_hwq->wait_command(cmd.cbo->get(), 0);
+    m_complete.record(cmd.submitted, clk::now());
+    if (cmd.pkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error("Replayed command failed, state=" + std::to_string(cmd.pkt->state));
+    m_free.push_back(cmd);
+  }
+
+  device *m_dev;
+  const std::vector<replay_frame>& m_frames;
+  const int m_time_scale_pct;
+  hwqueue_handle *m_hwq = nullptr;
+  std::vector< std::unique_ptr<io_test_bo_set_base> > m_bo_set;
+  std::deque<replay_cmd> m_free;
+  std::deque<replay_cmd> m_inflight;
+  std::map< uint64_t, std::unique_ptr<bo> > m_bos;
+  latency_recorder m_complete;
+  latency_recorder m_sync;
+  size_t m_cmds = 0;
+  size_t m_allocs = 0;
+  size_t m_syncs = 0;
+  size_t m_skipped = 0;
+  uint64_t m_duration_us = 0;
+};
+
+}
+
+// Drive the BO allocations, syncs and submissions of a trace stream recorded
+// with Debug.trace_stream against device again, recorded cmds being replaced
+// by no-op ones. arg[0] scales recorded timing in percent, 100 is as
+// recorded and 0 is back to back.
+void
+TEST_trace_replay(device::id_type id, std::shared_ptr<device>& sdev, arg_type& arg)
+{
+  int time_scale_pct = static_cast<int>(arg[0]);
+
+  io_test_parameter_init(IO_TEST_LATENCY_PERF, IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, false);
+  auto frames = load_trace(replay_trace_path);
+  trace_replay r(sdev.get(), frames, time_scale_pct);
+  r.run();
+  r.report();
+}
@@ -11,19 +11,31 @@
 #include "xrt/experimental/xrt_kernel.h"
 #include "multi-layer.h"
 #include "resnet50.h"
+#include "../shim_test/latency.h"
+
+#include "core/common/device.h"
+#include "core/common/query_requests.h"
 
 #include <fstream>
 #include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <filesystem>
 #include <iostream>
 #include <libgen.h>
 #include <set>
+#include <sstream>
 #include <stdlib.h>
 #include <string>
 #include <vector>
 #include <chrono>
+#include <limits>
+#include <mutex>
 #include <regex>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <thread>
 
 namespace {
@@ -48,6 +60,9 @@ std::string xclbinpath;
 std::string elfpath;
 bool printing_on;
 bool elf_flow = true;
+// Benchmark mode result file, see bench_report()
+std::string bench_path;
+std::string cur_test_name;
 
 std::string dolphinPass = R"(
                                          .--.
@@ -88,6 +103,7 @@ usage(const std::string& prog)
   std::cout << "\t" << "-v" << ": apply each thread to corresponding vf, max 4\n";
   std::cout << "\t" << "-w" << ": timeout in seconds (default 600 sec, some simnow server are slow)\n";
   std::cout << "\t" << "-l" << ": use xclbin flow if available\n";
+  std::cout << "\t" << "-b" << ": benchmark mode, append results to this file, run only \"measure\" tests if none given\n";
   std::cout << "\t" << "-h" << ": print this help message\n\n";
   std::cout << "\t" << "Example Usage: ./xrt_test <# for stress test> -s 20 -d vadd -x vadd\n";
   std::cout << "\t" << "               Run stress test with Vadd kernel and xclbin for 20 rounds\n";
@@ -113,6 +129,176 @@ struct test_case { // Definition of one test case
   arg_type arg;
 };
 
+// In benchmark mode, append one line of results of current test case to
+// benchmark result file, in the format of shim_test -b.
+void
+bench_report(const xrt::device& device,
+  std::initializer_list< std::pair<const char*, double> > results)
+{
+  if (bench_path.empty())
+    return;
+
+  std::ofstream out(bench_path, std::ios::app);
+  if (!out)
+    throw std::runtime_error("Failed to open benchmark result file: " + bench_path);
+  out << "{\"test\":\"" << cur_test_name << "\",\"driver\":\"amdxdna\",\"queue\":\"umq\""
+      << ",\"device\":\"" << device.get_info<xrt::info::device::name>() << "\"";
+  for (auto& r : results)
+    out << ",\"" << r.first << "\":" << std::fixed << r.second;
+  out << "}" << std::endl;
+}
+
+// Power in watts from NPU power sensor of driver, negative if driver has no
+// reading, which it reports as UINT32_MAX.
+double
+read_power_sensor_w(const xrt_core::device *dev)
+{
+  try {
+    auto sensors = xrt_core::device_query<xrt_core::query::sdm_sensor_info>(dev,
+      xrt_core::query::sdm_sensor_info::sdr_req_type::power);
+    for (auto& s : sensors) {
+      if (s.input == std::numeric_limits<uint32_t>::max())
+        continue;
+      return s.input * std::pow(10.0, s.unitm);
+    }
+  } catch (const std::exception&) {
+  }
+  return -1;
+}
+
+// Package energy counter of powercap in uJ, false if it can't be read, it is
+// root only on most kernels.
+bool
+read_package_energy_uj(uint64_t& uj, uint64_t& range_uj)
+{
+  std::ifstream e("/sys/class/powercap/intel-rapl:0/energy_uj");
+  std::ifstream r("/sys/class/powercap/intel-rapl:0/max_energy_range_uj");
+  return static_cast<bool>(e >> uj) && static_cast<bool>(r >> range_uj);
+}
+
+// Energy used while a workload runs, summed over all start()/stop() intervals.
+// NPU power sensor is sampled every power_sample_ms on a thread and
+// integrated over time. If driver has no power reading, package energy
+// counter is used instead. It covers the whole SoC, CPU included, so it is
+// an upper bound of what NPU uses.
+class power_sampler {
+public:
+  explicit power_sampler(const xrt::device& device)
+    : m_dev(device.get_handle())
+  {
+    uint64_t uj, range;
+    m_use_sensor = read_power_sensor_w(m_dev.get()) >= 0;
+    m_use_package = !m_use_sensor && read_package_energy_uj(uj, range);
+  }
+
+  ~power_sampler()
+  {
+    if (m_thread.joinable())
+      stop();
+  }
+
+  bool
+  valid() const
+  { return m_use_sensor || m_use_package; }
+
+  bool
+  is_package() const
+  { return m_use_package; }
+
+  void
+  start()
+  {
+    m_start = clk::now();
+    if (m_use_package) {
+      read_package_energy_uj(m_start_uj, m_range_uj);
+      return;
+    }
+    if (!m_use_sensor)
+      return;
+    m_stop = false;
+    m_thread = std::thread([this] { sample_loop(); });
+  }
+
+  void
+  stop()
+  {
+    if (m_use_package) {
+      uint64_t uj = m_start_uj;
+      read_package_energy_uj(uj, m_range_uj);
+      // Counter wraps around at max_energy_range_uj
+      auto delta = uj >= m_start_uj ? uj - m_start_uj : uj + m_range_uj - m_start_uj;
+      m_joules += delta / 1e6;
+      m_samples += 2;
+    } else if (m_thread.joinable()) {
+      {
+        const std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+      }
+      m_cv.notify_all();
+      m_thread.join();
+    }
+    m_duration += clk::now() - m_start;
+  }
+
+  double
+  joules() const
+  { return m_joules; }
+
+  double
+  seconds() const
+  { return std::chrono::duration<double>(m_duration).count(); }
+
+  unsigned
+  samples() const
+  { return m_samples; }
+
+private:
+  using clk = std::chrono::steady_clock;
+  static constexpr std::chrono::milliseconds power_sample_ms{10};
+
+  void
+  sample_loop()
+  {
+    auto last_t = clk::now();
+    auto last_w = std::max(read_power_sensor_w(m_dev.get()), 0.0);
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    m_samples++;
+    // Last round samples once more after stop, for the tail of the interval
+    for (bool done = false; !done;) {
+      done = m_cv.wait_for(lock, power_sample_ms, [this] { return m_stop; });
+      auto t = clk::now();
+      auto w = read_power_sensor_w(m_dev.get());
+      if (w < 0)
+        w = last_w;
+      else
+        m_samples++;
+      // Trapezoid between two samples
+      m_joules += (w + last_w) / 2 * std::chrono::duration<double>(t - last_t).count();
+      last_t = t;
+      last_w = w;
+    }
+  }
+
+  std::shared_ptr<xrt_core::device> m_dev;
+  bool m_use_sensor = false;
+  bool m_use_package = false;
+  clk::time_point m_start;
+  clk::duration m_duration{};
+  uint64_t m_start_uj = 0;
+  uint64_t m_range_uj = 0;
+  double m_joules = 0;
+  unsigned m_samples = 0;
+
+  std::thread m_thread;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  bool m_stop = false;
+};
+
+// If set, run_frames_pipelined() samples power while frames are running
+power_sampler *frame_power = nullptr;
+
 // For overall test result evaluation
 int test_passed = 0;
 int test_skipped = 0;
@@ -151,7 +337,7 @@ private:
   int *m_bop;
 };
 
-xrt::run get_xrt_run(
+xrt::kernel get_xrt_kernel(
   xrt::device& device,
   const std::string xclbin_path,
   const std::string xclbin_elf,
@@ -174,7 +360,19 @@ xrt::run get_xrt_run(
     kernel = xrt::ext::kernel{hwctx, mod, xclbin_kernel};
   }
 
-  return xrt::run{kernel};
+  return kernel;
+}
+
+xrt::run get_xrt_run(
+  xrt::device& device,
+  const std::string xclbin_path,
+  const std::string xclbin_elf,
+  const std::string xclbin_kernel,
+  const std::string full_elf,
+  const std::string full_elf_kernel)
+{
+  return xrt::run{get_xrt_kernel(device, xclbin_path, xclbin_elf, xclbin_kernel,
+    full_elf, full_elf_kernel)};
 }
 
 template <typename TEST_BO>
@@ -376,6 +574,64 @@ sync_bo_from_dev(xrt_bo& bo)
   bo.get().sync(XCL_BO_SYNC_BO_FROM_DEVICE, bo.size(), 0);
 }
 
+// Push num_frames frames through runs, each run with its own input and output
+// BOs. Frame f goes to run f % runs.size(), so while host post-processes the
+// oldest frame and prepares the next one in its slot, the other runs keep the
+// device busy. One run is the serialized sync-in, run, wait, sync-out flow.
+void
+run_frames_pipelined(std::vector<xrt::run>& runs, unsigned num_frames,
+  const std::function<void(size_t)>& pre, const std::function<void(size_t)>& post)
+{
+  using clk = std::chrono::high_resolution_clock;
+  auto depth = runs.size();
+  std::vector<clk::time_point> submitted(num_frames);
+  std::vector<clk::time_point> done(num_frames);
+
+  auto retire = [&] (unsigned f) {
+    auto& run = runs[f % depth];
+    auto state = run.wait(timeout_ms);
+    done[f] = clk::now();
+    if (state == ERT_CMD_STATE_TIMEOUT)
+      throw std::runtime_error(std::string("exec buf timed out."));
+    if (state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("bad command state: ") + std::to_string(state));
+    post(f % depth);
+  };
+
+  if (frame_power)
+    frame_power->start();
+  auto start = clk::now();
+  for (unsigned f = 0; f < num_frames; f++) {
+    if (f >= depth)
+      retire(f - depth);
+    pre(f % depth);
+    submitted[f] = clk::now();
+    runs[f % depth].start();
+  }
+  for (unsigned f = num_frames > depth ? num_frames - depth : 0; f < num_frames; f++)
+    retire(f);
+  auto end = clk::now();
+  if (frame_power)
+    frame_power->stop();
+
+  // Device has nothing to run from completion of a frame till the next one is
+  // submitted. Completion is seen by host no earlier than it happens, so this
+  // is a lower bound of the real idle time.
+  double idle_us = 0;
+  double max_idle_us = 0;
+  for (unsigned f = 1; f < num_frames; f++) {
+    if (submitted[f] <= done[f - 1])
+      continue;
+    auto gap = std::chrono::duration_cast<std::chrono::nanoseconds>(submitted[f] - done[f - 1]).count() / 1000.0;
+    idle_us += gap;
+    max_idle_us = std::max(max_idle_us, gap);
+  }
+  auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  std::cout << "Finished " << num_frames << " frames with " << depth << " in flight in "
+            << duration_us << "us, " << num_frames * 1000000.0 / duration_us << " frames/sec, "
+            << "device idle at least " << idle_us << "us (max gap " << max_idle_us << "us)\n";
+}
+
 void
 TEST_xrt_umq_vadd(int device_index, arg_type& arg)
 {
@@ -520,10 +776,13 @@ TEST_xrt_umq_nop(int device_index, arg_type& arg)
   xrt::run run{kernel};
 
   // Send the command to device and wait for it to complete
+  latency_recorder rec(c_rounds, std::min(c_rounds / 10, 100u));
   auto start = std::chrono::high_resolution_clock::now();
   for (int i = 0 ; i < c_rounds; i++) {
+    auto cmd_start = std::chrono::high_resolution_clock::now();
     run.start();
     auto state = run.wait(timeout_ms);
+    rec.record(cmd_start, std::chrono::high_resolution_clock::now());
     if (state == ERT_CMD_STATE_TIMEOUT)
       throw std::runtime_error(std::string("exec buf timed out."));
     if (state != ERT_CMD_STATE_COMPLETED)
@@ -533,6 +792,7 @@ TEST_xrt_umq_nop(int device_index, arg_type& arg)
   auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
   std::cout << "Executed " << c_rounds << " NOP commands in " << duration_us
 	    << "us, average latency: " << duration_us * 1.0 / c_rounds << "us\n";
+  print_latency_summary(rec.summarize());
 }
 
 void
@@ -864,6 +1124,68 @@ TEST_xrt_umq_single_col_resnet50_all_layer(int device_index, arg_type& arg)
   }
 }
 
+void
+TEST_xrt_umq_single_col_resnet50_all_layer_pipelined(int device_index, arg_type& arg)
+{
+  auto num_frames = static_cast<unsigned>(arg[0]);
+  auto max_depth = static_cast<unsigned>(arg[1]);
+  auto device = xrt::device{device_index};
+
+  std::string ifm_path = local_path("npu3_workspace/ifm32.txt");
+  std::string wts_path = local_path("npu3_workspace/wts32.txt");
+  std::string ofm_path = local_path("npu3_workspace/ofm32.txt");
+
+  const uint32_t IFM_BYTE_SIZE = 233472;
+  const uint32_t WTS_BYTE_SIZE = 25704832;
+  const uint32_t OFM_BYTE_SIZE = 1024;
+  // Weights are read only, shared by all frames in flight
+  xrt_bo bo_ifm_src{device, IFM_BYTE_SIZE, xrt::bo::flags::host_only};
+  xrt_bo bo_wts{device, WTS_BYTE_SIZE, xrt::bo::flags::host_only};
+  xrt_bo bo_ofm_gld{device, OFM_BYTE_SIZE, xrt::bo::flags::host_only};
+
+  read_txt_file<xrt_bo>(ifm_path, bo_ifm_src);
+  read_txt_file<xrt_bo>(wts_path, bo_wts);
+  read_txt_file<xrt_bo>(ofm_path, bo_ofm_gld);
+  sync_bo_to_dev(bo_wts);
+
+  auto kernel = get_xrt_kernel(device,
+		  "npu3_workspace/xclbin_resnet50_all.xclbin",
+		  "npu3_workspace/xclbin_resnet50_all.elf",
+		  "dpu:{vadd}",
+		  "npu3_workspace/resnet50_all_layer.elf",
+		  "DPU:resnet50");
+
+  for (unsigned depth = 1; depth <= max_depth; depth *= 2) {
+    std::vector<xrt_bo> ifms;
+    std::vector<xrt_bo> ofms;
+    std::vector<xrt::run> runs;
+
+    for (unsigned i = 0; i < depth; i++) {
+      ifms.emplace_back(device, IFM_BYTE_SIZE, xrt::bo::flags::host_only);
+      ofms.emplace_back(device, OFM_BYTE_SIZE, xrt::bo::flags::host_only);
+      runs.emplace_back(kernel);
+      for (int a = 0; a < 54; a++)
+        runs.back().set_arg(a, bo_wts.get().address() + (wts_offset[a] * sizeof(uint32_t)));
+      runs.back().set_arg(54, ifms.back().get());
+      runs.back().set_arg(55, ofms.back().get());
+    }
+
+    auto pre = [&] (size_t slot) {
+      std::memcpy(ifms[slot].map(), bo_ifm_src.map(), IFM_BYTE_SIZE);
+      std::memset(ofms[slot].map(), 0, OFM_BYTE_SIZE);
+      sync_bo_to_dev(ifms[slot]);
+      sync_bo_to_dev(ofms[slot]);
+    };
+    auto post = [&] (size_t slot) {
+      sync_bo_from_dev(ofms[slot]);
+      if (std::memcmp(ofms[slot].map(), bo_ofm_gld.map(), OFM_BYTE_SIZE))
+        throw std::runtime_error("result mis-match");
+    };
+    run_frames_pipelined(runs, num_frames, pre, post);
+  }
+  std::cout << "result matched" << std::endl;
+}
+
 void
 TEST_xrt_umq_single_col_resnet50_multi_layer(int device_index, arg_type& arg)
 {
@@ -1372,6 +1694,75 @@ TEST_xrt_umq_yolov3(int device_index, arg_type& arg)
   check_umq_yolov3_result(bo_ofm.map(), ofm_path);
 }
 
+void
+TEST_xrt_umq_yolov3_pipelined(int device_index, arg_type& arg)
+{
+  auto num_frames = static_cast<unsigned>(arg[0]);
+  auto max_depth = static_cast<unsigned>(arg[1]);
+  auto device = xrt::device{device_index};
+
+  std::string ifm_path = local_path("npu3_workspace/ifm_yolov3.bin");
+  std::string param_path = local_path("npu3_workspace/param_yolov3.bin");
+  std::string wgt_path = local_path("npu3_workspace/wgt_yolov3.bin");
+  std::string ofm_path = local_path("npu3_workspace/ofm_yolov3.bin");
+
+  const uint32_t IFM_BYTE_SIZE = std::filesystem::file_size(ifm_path);
+  const uint32_t WTS_BYTE_SIZE = std::filesystem::file_size(wgt_path);
+  const uint32_t OFM_BYTE_SIZE = std::filesystem::file_size(ofm_path);
+  const uint32_t PARAM_BYTE_SIZE = std::filesystem::file_size(param_path);
+  // Weights and params are read only, shared by all frames in flight
+  xrt_bo bo_ifm_src{device, IFM_BYTE_SIZE, xrt::bo::flags::host_only};
+  xrt_bo bo_wts{device, WTS_BYTE_SIZE, xrt::bo::flags::host_only};
+  xrt_bo bo_param{device, PARAM_BYTE_SIZE, xrt::bo::flags::host_only};
+
+  read_bin_file<xrt_bo>(ifm_path, bo_ifm_src);
+  read_bin_file<xrt_bo>(wgt_path, bo_wts);
+  read_bin_file<xrt_bo>(param_path, bo_param);
+  sync_bo_to_dev(bo_wts);
+  sync_bo_to_dev(bo_param);
+
+  xrt::elf elf{local_path("npu3_workspace/yolov3.elf")};
+  xrt::hw_context hwctx{device, elf};
+  xrt::kernel kernel = xrt::ext::kernel{hwctx, "DPU:yolov3"};
+
+  for (unsigned depth = 1; depth <= max_depth; depth *= 2) {
+    std::vector<xrt_bo> ifms;
+    std::vector<xrt_bo> ofms;
+    std::vector<xrt::run> runs;
+    // Output is checked against golden once, later frames must be identical
+    std::vector<char> first_ofm;
+
+    for (unsigned i = 0; i < depth; i++) {
+      ifms.emplace_back(device, IFM_BYTE_SIZE, xrt::bo::flags::host_only);
+      ofms.emplace_back(device, OFM_BYTE_SIZE, xrt::bo::flags::host_only);
+      // Same as the single frame test, which starts with golden in ofm
+      read_bin_file<xrt_bo>(ofm_path, ofms.back());
+      runs.emplace_back(kernel);
+      runs.back().set_arg(0, ofms.back().get());
+      runs.back().set_arg(1, ifms.back().get());
+      runs.back().set_arg(2, bo_wts.get());
+      runs.back().set_arg(3, bo_param.get());
+    }
+
+    auto pre = [&] (size_t slot) {
+      std::memcpy(ifms[slot].map(), bo_ifm_src.map(), IFM_BYTE_SIZE);
+      sync_bo_to_dev(ifms[slot]);
+      sync_bo_to_dev(ofms[slot]);
+    };
+    auto post = [&] (size_t slot) {
+      sync_bo_from_dev(ofms[slot]);
+      auto ofm = reinterpret_cast<char *>(ofms[slot].map());
+      if (first_ofm.empty()) {
+        check_umq_yolov3_result(ofms[slot].map(), ofm_path);
+        first_ofm.assign(ofm, ofm + OFM_BYTE_SIZE);
+      } else if (std::memcmp(ofm, first_ofm.data(), OFM_BYTE_SIZE)) {
+        throw std::runtime_error("result mis-match");
+      }
+    };
+    run_frames_pipelined(runs, num_frames, pre, post);
+  }
+}
+
 /* run.start n requests, then run.wait all of them */
 void
 TEST_xrt_stress_run(int device_index, arg_type& arg)
@@ -1438,6 +1829,259 @@ TEST_xrt_stress_hwctx(int device_index, arg_type& arg)
   }
 }
 
+// Contentions and total wait time in us of driver locks whose class name
+// ends with name, e.g. io_lock, from /proc/lock_stat. Needs CONFIG_LOCK_STAT
+// and root, returns false if it can't be read.
+bool
+get_lock_stat(const std::string& name, uint64_t& contentions, double& wait_us)
+{
+  std::ifstream f("/proc/lock_stat");
+  std::string line;
+  bool found = false;
+
+  contentions = 0;
+  wait_us = 0;
+  while (std::getline(f, line)) {
+    auto pos = line.find(name + ":");
+    if (pos == std::string::npos)
+      continue;
+    // con-bounces contentions waittime-min waittime-max waittime-total ...
+    std::istringstream cols(line.substr(pos + name.size() + 1));
+    uint64_t bounces, cnt;
+    double wmin, wmax, wtotal;
+    if (!(cols >> bounces >> cnt >> wmin >> wmax >> wtotal))
+      continue;
+    contentions += cnt;
+    wait_us += wtotal;
+    found = true;
+  }
+  return found;
+}
+
+struct thread_scaling_result {
+  uint64_t vcsw = 0;
+  uint64_t ivcsw = 0;
+  bool failed = false;
+};
+
+// Run no-op cmds one at a time on kernel. Voluntary context switches beyond
+// what waiting for each cmd costs come from blocking on locks.
+void
+thread_scaling_loop(xrt::kernel& kernel, unsigned iterations, latency_recorder& rec,
+  thread_scaling_result& res)
+{
+  xrt::run run{kernel};
+  rusage before, after;
+
+  getrusage(RUSAGE_THREAD, &before);
+  for (unsigned i = 0; i < iterations; i++) {
+    auto cmd_start = std::chrono::high_resolution_clock::now();
+    run.start();
+    auto state = run.wait(timeout_ms);
+    rec.record(cmd_start, std::chrono::high_resolution_clock::now());
+    if (state == ERT_CMD_STATE_TIMEOUT)
+      throw std::runtime_error(std::string("exec buf timed out."));
+    if (state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("bad command state: ") + std::to_string(state));
+  }
+  getrusage(RUSAGE_THREAD, &after);
+  res.vcsw = after.ru_nvcsw - before.ru_nvcsw;
+  res.ivcsw = after.ru_nivcsw - before.ru_nivcsw;
+}
+
+/* sweep 1..n threads (-t) of no-op cmds, on one shared and on separate hwctxs */
+void
+TEST_xrt_thread_scaling(int device_index, arg_type& arg)
+{
+  auto device = xrt::device{device_index};
+  unsigned iterations = static_cast<unsigned>(arg[0]);
+  xrt::elf elf{local_path("npu3_workspace/nop.elf")};
+  std::vector<unsigned> sweep;
+
+  for (unsigned n = 1; n < threads; n *= 2)
+    sweep.push_back(n);
+  sweep.push_back(threads);
+
+  for (bool shared : { true, false }) {
+    double base_cps = 0;
+
+    for (auto n : sweep) {
+      std::vector<xrt::hw_context> hwctxs;
+      std::vector<xrt::kernel> kernels;
+      for (unsigned t = 0; t < n; t++) {
+        if (!shared || hwctxs.empty())
+          hwctxs.emplace_back(device, elf);
+        kernels.push_back(xrt::ext::kernel{hwctxs.back(), "DPU:nop"});
+      }
+
+      std::vector<latency_recorder> recs;
+      std::vector<thread_scaling_result> results(n);
+      std::vector<std::thread> workers;
+      for (unsigned t = 0; t < n; t++)
+        recs.emplace_back(iterations, std::min(iterations / 10, 100u));
+
+      uint64_t lock_cnt_before = 0, lock_cnt_after = 0;
+      double lock_us_before = 0, lock_us_after = 0;
+      auto has_lock_stat = get_lock_stat("io_lock", lock_cnt_before, lock_us_before);
+
+      auto start = std::chrono::high_resolution_clock::now();
+      for (unsigned t = 0; t < n; t++) {
+        workers.emplace_back([&, t]() {
+          try {
+            thread_scaling_loop(kernels[t], iterations, recs[t], results[t]);
+          } catch (const std::exception& ex) {
+            results[t].failed = true;
+            std::cerr << "Thread " << t << " failed: " << ex.what() << std::endl;
+          }
+        });
+      }
+      for (auto& w : workers)
+        w.join();
+      auto end = std::chrono::high_resolution_clock::now();
+      if (has_lock_stat)
+        get_lock_stat("io_lock", lock_cnt_after, lock_us_after);
+
+      latency_recorder rec(n * iterations);
+      uint64_t vcsw = 0, ivcsw = 0;
+      for (unsigned t = 0; t < n; t++) {
+        if (results[t].failed)
+          throw std::runtime_error("At least one thread has failed");
+        rec.merge(recs[t]);
+        vcsw += results[t].vcsw;
+        ivcsw += results[t].ivcsw;
+      }
+
+      auto s = rec.summarize();
+      auto cmds = n * iterations;
+      auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+      auto cps = cmds * 1000000.0 / duration_us;
+      if (n == 1)
+        base_cps = cps;
+      auto efficiency = base_cps ? cps / (n * base_cps) : 0;
+      std::cout << n << " threads on " << (shared ? "shared" : "separate") << " hwctx: "
+                << cps << " Command/sec, " << efficiency * 100 << "% of linear, p50 "
+                << s.p50_us << " us, p99 " << s.p99_us << " us, "
+                << vcsw * 1.0 / cmds << " voluntary / " << ivcsw * 1.0 / cmds
+                << " involuntary context switches per cmd";
+      if (has_lock_stat)
+        std::cout << ", io_lock contended " << lock_cnt_after - lock_cnt_before << " times, "
+                  << lock_us_after - lock_us_before << " us";
+      std::cout << std::endl;
+      bench_report(device, {
+        { "threads", n },
+        { "shared_hwctx", shared },
+        { "commands", cmds },
+        { "duration_us", duration_us },
+        { "cmds_per_sec", cps },
+        { "efficiency", efficiency },
+        { "p50_us", s.p50_us },
+        { "p99_us", s.p99_us },
+        { "vcsw_per_cmd", vcsw * 1.0 / cmds },
+        { "ivcsw_per_cmd", ivcsw * 1.0 / cmds },
+        { "io_lock_contentions", static_cast<double>(lock_cnt_after - lock_cnt_before) },
+        { "io_lock_wait_us", lock_us_after - lock_us_before },
+      });
+    }
+  }
+}
+
+// No-op cmds pushed through run_frames_pipelined(), arg is frames and depth.
+// Energy of cmd dispatch alone, without any compute.
+void
+run_nop_frames(int device_index, arg_type& arg)
+{
+  auto device = xrt::device{device_index};
+  xrt::elf elf{local_path("npu3_workspace/nop.elf")};
+  xrt::hw_context hwctx{device, elf};
+  xrt::kernel kernel = xrt::ext::kernel{hwctx, "DPU:nop"};
+  std::vector<xrt::run> runs;
+
+  for (unsigned i = 0; i < arg[1]; i++)
+    runs.emplace_back(kernel);
+  run_frames_pipelined(runs, static_cast<unsigned>(arg[0]), [] (size_t) {}, [] (size_t) {});
+}
+
+const char *power_mode_names[] = { "default", "low", "medium", "high", "turbo" };
+
+// Workloads of energy benchmark, all take frames and max depth as arg and
+// run their frames through run_frames_pipelined().
+const std::vector<std::pair<const char *, void (*)(int, arg_type&)>> energy_workloads {
+  { "nop", run_nop_frames },
+  { "resnet50", TEST_xrt_umq_single_col_resnet50_all_layer_pipelined },
+  { "yolov3", TEST_xrt_umq_yolov3_pipelined },
+};
+
+/* n frames of each workload at each power mode, joules per inference */
+void
+TEST_xrt_energy_per_inference(int device_index, arg_type& arg)
+{
+  auto frames = arg[0];
+  auto device = xrt::device{device_index};
+  auto dev = device.get_handle();
+
+  if (!power_sampler(device).valid()) {
+    std::cout << "No power reading from driver or powercap, skipped" << std::endl;
+    return;
+  }
+
+  using power_type = xrt_core::query::performance_mode::power_type;
+  auto orig_mode = xrt_core::device_query<xrt_core::query::performance_mode>(dev);
+  struct restore_guard {
+    std::shared_ptr<xrt_core::device> dev;
+    uint32_t mode;
+    ~restore_guard()
+    {
+      frame_power = nullptr;
+      try {
+        xrt_core::device_update<xrt_core::query::performance_mode>(dev.get(),
+          static_cast<power_type>(mode));
+      } catch (const std::exception& ex) {
+        std::cerr << "Failed to restore power mode: " << ex.what() << std::endl;
+      }
+    }
+  } restore{dev, orig_mode};
+
+  for (uint32_t mode = 0; mode < std::size(power_mode_names); mode++) {
+    try {
+      xrt_core::device_update<xrt_core::query::performance_mode>(dev.get(),
+        static_cast<power_type>(mode));
+    } catch (const std::exception& ex) {
+      std::cout << "Can't set power mode " << power_mode_names[mode] << ": " << ex.what() << std::endl;
+      continue;
+    }
+
+    for (auto& w : energy_workloads) {
+      power_sampler sampler{device};
+      // One frame in flight, so that each inference is paid for in full
+      arg_type warg{frames, 1};
+
+      frame_power = &sampler;
+      w.second(device_index, warg);
+      frame_power = nullptr;
+
+      auto fps = frames / sampler.seconds();
+      auto watts = sampler.joules() / sampler.seconds();
+      auto jpi = sampler.joules() / frames;
+      std::cout << w.first << " at power mode " << power_mode_names[mode] << ": " << fps
+                << " inferences/sec, " << watts << " W" << (sampler.is_package() ? " (package)" : "")
+                << ", " << jpi * 1000 << " mJ/inference, " << fps / watts
+                << " inferences/sec/W from " << sampler.samples() << " samples" << std::endl;
+      bench_report(device, {
+        { w.first, 1 },
+        { "power_mode", mode },
+        { "frames", frames },
+        { "duration_us", sampler.seconds() * 1000000 },
+        { "inferences_per_sec", fps },
+        { "avg_power_w", watts },
+        { "package_power", sampler.is_package() },
+        { "power_samples", sampler.samples() },
+        { "joules_per_inference", jpi },
+        { "inferences_per_sec_per_watt", fps / watts },
+      });
+    }
+  }
+}
+
 // List of all test cases
 std::vector<test_case> test_list {
   test_case{ "npu3 xrt vadd", TEST_xrt_umq_vadd, {} },
@@ -1457,7 +2101,11 @@ std::vector<test_case> test_list {
   test_case{ "npu3 xrt single col resnet50 all layer", TEST_xrt_umq_single_col_resnet50_all_layer, {} },
   test_case{ "npu3 xrt single col resnet50 multi layer", TEST_xrt_umq_single_col_resnet50_multi_layer, {} },
   test_case{ "npu3 xrt yolov3", TEST_xrt_umq_yolov3, {} },
-  test_case{ "npu3 xrt runlist of vadd", TEST_xrt_umq_runlist_nop, {} }
+  test_case{ "npu3 xrt runlist of vadd", TEST_xrt_umq_runlist_nop, {} },
+  test_case{ "npu3 xrt single col resnet50 all layer pipelined", TEST_xrt_umq_single_col_resnet50_all_layer_pipelined, {64, 4} },
+  test_case{ "npu3 xrt yolov3 pipelined", TEST_xrt_umq_yolov3_pipelined, {64, 4} },
+  test_case{ "measure npu3 xrt thread scaling", TEST_xrt_thread_scaling, {1000} },
+  test_case{ "measure npu3 xrt energy per inference", TEST_xrt_energy_per_inference, {256} }
 };
 
 /* test n threads of 1 or more tests */
@@ -1523,6 +2171,7 @@ run_test(int id, const test_case& test, int device_index)
   bool failed = false;
 
   std::cout << "====== " << id << ": " << test.description << " started =====" << std::endl;
+  cur_test_name = test.description;
 
   try {
     test.func(device_index, test.arg);
@@ -1557,6 +2206,9 @@ run_all_test(std::set<int>& tests)
         continue;
       else
         tests.erase(i);
+    } else if (!bench_path.empty() &&
+      std::string(test_list[i].description).rfind("measure ", 0) != 0) {
+      continue;
     }
     const auto& t = test_list[i];
     run_test(i, t, device_index);
@@ -1574,7 +2226,7 @@ main(int argc, char **argv)
 
   try {
     int option, val;
-    while ((option = getopt(argc, argv, ":c:s:m:x:d:i:t:e:v:w:lh")) != -1) {
+    while ((option = getopt(argc, argv, ":c:s:m:x:d:i:t:e:v:w:lb:h")) != -1) {
       switch (option) {
         case 'c': {
           val = std::stoi(optarg);
@@ -1650,6 +2302,11 @@ main(int argc, char **argv)
 	  elf_flow = false;
 	  break;
 	}
+	case 'b': {
+	  bench_path = optarg;
+	  std::cout << "Benchmark mode, appending results to: " << bench_path << std::endl;
+	  break;
+	}
 	case 'v': {
 	  val = std::stoi(optarg);
 	  if (val > 4 || val < 1) {